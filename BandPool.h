@@ -0,0 +1,97 @@
+#pragma once
+//======================================================================================
+// BandPool.h
+// A fixed set of threads for splitting one piece of work into bands: Run(fn)
+// calls fn(0..bands-1), band 0 on the calling thread and the rest on helpers that
+// sleep between runs, and returns when all are done. Used for band-parallel
+// conversion and compositing.
+//======================================================================================
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//======================================================================================
+// BandPool
+//======================================================================================
+class BandPool
+{
+public:
+    explicit BandPool(uint32_t bands) : m_bands(bands ? bands : 1)
+    {
+        for (uint32_t band = 1; band < m_bands; ++band)
+        {
+            m_helpers.emplace_back(&BandPool::Helper, this, band);
+        }
+    }
+
+    ~BandPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_start.notify_all();
+        for (std::thread& helper : m_helpers)
+        {
+            helper.join();
+        }
+    }
+
+    BandPool(const BandPool&) = delete;
+    BandPool& operator=(const BandPool&) = delete;
+
+    uint32_t Bands() const { return m_bands; }
+
+    void Run(const std::function<void(uint32_t)>& fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pFn = &fn;
+            m_pending = m_bands - 1;
+            ++m_generation;
+        }
+        m_start.notify_all();
+        fn(0);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [&] { return m_pending == 0; });
+    }
+
+private:
+    void Helper(uint32_t band)
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            const std::function<void(uint32_t)>* pFn = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_start.wait(lock, [&] { return m_stopping || m_generation != seen; });
+                if (m_stopping)
+                {
+                    return;
+                }
+                seen = m_generation;
+                pFn = m_pFn;
+            }
+            (*pFn)(band);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0)
+            {
+                m_done.notify_one();
+            }
+        }
+    }
+
+    uint32_t m_bands;
+    std::vector<std::thread> m_helpers;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    const std::function<void(uint32_t)>* m_pFn = nullptr;
+    uint32_t m_pending = 0;
+    uint64_t m_generation = 0;
+    bool m_stopping = false;
+};
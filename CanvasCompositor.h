@@ -0,0 +1,206 @@
+#pragma once
+//======================================================================================
+// CanvasCompositor.h
+// Several monitors' images stitched into one BGRA canvas laid out as they sit on the
+// desktop, so they can be recorded as a single stream.
+//
+// Monitors are placed by their desktop coordinates, which may be negative (a
+// monitor left of or above the primary one) and may leave gaps; the canvas is
+// their bounding box rounded up to even dimensions for 4:2:0, and anything no
+// monitor covers stays black. Mixed resolutions are just differently sized rects.
+//
+// Only what changed is copied: each monitor's dirty rects are clipped to it,
+// mapped into canvas space and queued, and Compose() copies the queued rows split
+// evenly across a BandPool, so one large update and many small ones balance the
+// same way. Small updates are copied on the calling thread, where waking the
+// helpers would cost more than the copy. Monitors are not expected to overlap; if
+// they do (cloned displays), the one queued last may or may not win.
+//======================================================================================
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "BandPool.h"
+#include "CaptureSource.h"
+
+class CanvasCompositor
+{
+public:
+    // Below this many bytes in one Compose(), the copy stays on one thread.
+    static const size_t MinParallelBytes = 512 * 1024;
+    static const uint32_t MaxDimension = 16384;
+
+    //----------------------------------------------------------------------------------
+    // [CanvasCompositor::Configure]
+    // Lays out monitors given in desktop coordinates and clears the canvas. False if
+    // there are none or the canvas would exceed MaxDimension either way.
+    //----------------------------------------------------------------------------------
+    bool Configure(const std::vector<FrameRect>& monitors, uint32_t threads)
+    {
+        m_placements.clear();
+        m_copies.clear();
+        m_dirty.clear();
+        if (monitors.empty())
+        {
+            return false;
+        }
+        FrameRect bounds = monitors[0];
+        for (const FrameRect& monitor : monitors)
+        {
+            if (monitor.right <= monitor.left || monitor.bottom <= monitor.top)
+            {
+                return false;
+            }
+            bounds.left = monitor.left < bounds.left ? monitor.left : bounds.left;
+            bounds.top = monitor.top < bounds.top ? monitor.top : bounds.top;
+            bounds.right = monitor.right > bounds.right ? monitor.right : bounds.right;
+            bounds.bottom = monitor.bottom > bounds.bottom ? monitor.bottom : bounds.bottom;
+        }
+        const int64_t width = static_cast<int64_t>(bounds.right) - bounds.left;
+        const int64_t height = static_cast<int64_t>(bounds.bottom) - bounds.top;
+        if (width > MaxDimension || height > MaxDimension)
+        {
+            return false;
+        }
+        m_width = (static_cast<uint32_t>(width) + 1) & ~1u;
+        m_height = (static_cast<uint32_t>(height) + 1) & ~1u;
+        for (const FrameRect& monitor : monitors)
+        {
+            m_placements.push_back(FrameRect{ monitor.left - bounds.left, monitor.top - bounds.top,
+                                              monitor.right - bounds.left, monitor.bottom - bounds.top });
+        }
+        m_pixels.assign(static_cast<size_t>(m_width) * m_height * 4, 0);
+        for (size_t i = 0; i < m_pixels.size(); i += 4)
+        {
+            m_pixels[i + 3] = 0xFF; // Opaque black.
+        }
+        if (!m_pPool || m_pPool->Bands() != (threads ? threads : 1))
+        {
+            m_pPool.reset(new BandPool(threads));
+        }
+        return true;
+    }
+
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+    size_t Stride() const { return static_cast<size_t>(m_width) * 4; }
+    const uint8_t* Pixels() const { return m_pixels.data(); }
+    uint32_t MonitorCount() const { return static_cast<uint32_t>(m_placements.size()); }
+
+    // Where a monitor landed on the canvas.
+    const FrameRect& Placement(uint32_t monitor) const { return m_placements[monitor]; }
+
+    //----------------------------------------------------------------------------------
+    // [CanvasCompositor::AddFrame]
+    // Queues the changed rects (monitor coordinates) of one monitor's top-down BGRA
+    // frame, or all of it if pRects is null. The pixels must stay valid until
+    // Compose().
+    //----------------------------------------------------------------------------------
+    void AddFrame(uint32_t monitor, const uint8_t* pPixels, size_t stride, const FrameRect* pRects, uint32_t rectCount)
+    {
+        const FrameRect& placement = m_placements[monitor];
+        const FrameRect whole = { 0, 0, placement.right - placement.left, placement.bottom - placement.top };
+        if (!pRects)
+        {
+            pRects = &whole;
+            rectCount = 1;
+        }
+        for (uint32_t i = 0; i < rectCount; ++i)
+        {
+            FrameRect rect = pRects[i];
+            rect.left = rect.left < 0 ? 0 : rect.left;
+            rect.top = rect.top < 0 ? 0 : rect.top;
+            rect.right = rect.right > whole.right ? whole.right : rect.right;
+            rect.bottom = rect.bottom > whole.bottom ? whole.bottom : rect.bottom;
+            if (rect.right <= rect.left || rect.bottom <= rect.top)
+            {
+                continue;
+            }
+            Copy copy;
+            copy.pSource = pPixels + static_cast<size_t>(rect.top) * stride + static_cast<size_t>(rect.left) * 4;
+            copy.sourceStride = stride;
+            copy.target = FrameRect{ rect.left + placement.left, rect.top + placement.top, rect.right + placement.left,
+                                     rect.bottom + placement.top };
+            m_copies.push_back(copy);
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CanvasCompositor::Compose]
+    // Copies everything queued since the last call and returns the canvas rects that
+    // were rewritten.
+    //----------------------------------------------------------------------------------
+    const std::vector<FrameRect>& Compose()
+    {
+        m_dirty.clear();
+        uint64_t totalRows = 0;
+        uint64_t totalBytes = 0;
+        for (const Copy& copy : m_copies)
+        {
+            m_dirty.push_back(copy.target);
+            totalRows += static_cast<uint64_t>(copy.target.bottom - copy.target.top);
+            totalBytes += static_cast<uint64_t>(copy.target.bottom - copy.target.top) * (copy.target.right - copy.target.left) * 4;
+        }
+        if (totalRows)
+        {
+            const uint32_t bands = totalBytes < MinParallelBytes ? 1 : m_pPool->Bands();
+            if (bands == 1)
+            {
+                CopyRows(0, totalRows);
+            }
+            else
+            {
+                m_pPool->Run([&](uint32_t band) {
+                    CopyRows(totalRows * band / bands, totalRows * (band + 1) / bands);
+                });
+            }
+        }
+        m_copies.clear();
+        return m_dirty;
+    }
+
+private:
+    struct Copy
+    {
+        const uint8_t* pSource; // The rect's top-left pixel.
+        size_t sourceStride;
+        FrameRect target;
+    };
+
+    // Rows [first, end) of all queued copies, counted through them in order.
+    void CopyRows(uint64_t first, uint64_t end)
+    {
+        uint64_t row = 0;
+        const size_t stride = Stride();
+        for (const Copy& copy : m_copies)
+        {
+            const uint64_t rows = static_cast<uint64_t>(copy.target.bottom - copy.target.top);
+            if (row + rows > first && row < end)
+            {
+                const uint64_t begin = first > row ? first - row : 0;
+                const uint64_t stop = end - row < rows ? end - row : rows;
+                const size_t bytes = static_cast<size_t>(copy.target.right - copy.target.left) * 4;
+                for (uint64_t y = begin; y < stop; ++y)
+                {
+                    uint8_t* pTarget = m_pixels.data() + (static_cast<size_t>(copy.target.top) + y) * stride +
+                                       static_cast<size_t>(copy.target.left) * 4;
+                    memcpy(pTarget, copy.pSource + y * copy.sourceStride, bytes);
+                }
+            }
+            row += rows;
+            if (row >= end)
+            {
+                break;
+            }
+        }
+    }
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    std::vector<uint8_t> m_pixels;
+    std::vector<FrameRect> m_placements;
+    std::vector<Copy> m_copies;
+    std::vector<FrameRect> m_dirty;
+    std::unique_ptr<BandPool> m_pPool;
+};
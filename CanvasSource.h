@@ -0,0 +1,262 @@
+#pragma once
+//======================================================================================
+// CanvasSource.h
+// Several capture sources - one per monitor - presented as a single source whose
+// frames are the whole desktop canvas (see CanvasCompositor.h). The recorder
+// treats it like any other source, so one file holds every monitor.
+//
+// An acquire collects whatever each monitor has: all of them are polled, then
+// waited on in turn in short slices until one has an update or the timeout runs
+// out, and the rest are polled once more so updates that arrive together stay in
+// one frame. Each monitor's frame is released as soon as its changed rects are
+// on the canvas. The canvas frame reports the union of those rects (moves become
+// dirty rects, since the pixels are copied), the newest timestamp, and the pointer
+// in canvas coordinates from whichever monitor it is on.
+//======================================================================================
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "CanvasCompositor.h"
+#include "CaptureSource.h"
+
+class CanvasSource : public CaptureSource
+{
+public:
+    struct Monitor
+    {
+        std::unique_ptr<CaptureSource> pSource;
+        int32_t left = 0; // Desktop coordinates of the top-left corner.
+        int32_t top = 0;
+    };
+
+    // How long one monitor is waited on before the others are polled again.
+    static const uint32_t WaitSliceMs = 4;
+
+    //----------------------------------------------------------------------------------
+    // [CanvasSource::Open]
+    // Takes the monitors over. False if they can't be laid out (see
+    // CanvasCompositor::Configure).
+    //----------------------------------------------------------------------------------
+    bool Open(std::vector<Monitor> monitors, uint32_t threads)
+    {
+        std::vector<FrameRect> layout;
+        for (const Monitor& monitor : monitors)
+        {
+            layout.push_back(FrameRect{ monitor.left, monitor.top, monitor.left + static_cast<int32_t>(monitor.pSource->Width()),
+                                        monitor.top + static_cast<int32_t>(monitor.pSource->Height()) });
+        }
+        if (!m_canvas.Configure(layout, threads))
+        {
+            return false;
+        }
+        m_monitors = std::move(monitors);
+        m_seen.assign(m_monitors.size(), false);
+        m_infos.resize(m_monitors.size());
+        m_pointerMonitor = -1;
+        return true;
+    }
+
+    uint32_t Width() const override { return m_canvas.Width(); }
+    uint32_t Height() const override { return m_canvas.Height(); }
+
+    const CanvasCompositor& Canvas() const { return m_canvas; }
+
+    //----------------------------------------------------------------------------------
+    // [CanvasSource::AcquireFrame]
+    //----------------------------------------------------------------------------------
+    CaptureResult AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info) override
+    {
+        const size_t count = m_monitors.size();
+        std::vector<bool> held(count, false);
+        bool any = false;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+        auto acquire = [&](size_t index, uint32_t waitMs) -> CaptureResult
+        {
+            const CaptureResult result = m_monitors[index].pSource->AcquireFrame(waitMs, m_infos[index]);
+            if (result == CaptureResult::Ok)
+            {
+                held[index] = true;
+                any = true;
+            }
+            return result;
+        };
+
+        CaptureResult failure = CaptureResult::Ok;
+        for (;;)
+        {
+            for (size_t i = 0; i < count && failure == CaptureResult::Ok; ++i)
+            {
+                if (!held[i])
+                {
+                    const CaptureResult result = acquire(i, 0);
+                    failure = (result == CaptureResult::Ok || result == CaptureResult::Timeout) ? failure : result;
+                }
+            }
+            if (any || failure != CaptureResult::Ok)
+            {
+                break;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                return CaptureResult::Timeout;
+            }
+            const uint64_t remainingMs = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+            const size_t index = m_nextWait++ % count;
+            const CaptureResult result = acquire(index, static_cast<uint32_t>(remainingMs < WaitSliceMs ? remainingMs : WaitSliceMs));
+            failure = (result == CaptureResult::Ok || result == CaptureResult::Timeout) ? failure : result;
+        }
+
+        // Put every update on the canvas, then let go of the monitors' frames.
+        bool mapped = true;
+        for (size_t i = 0; i < count && failure == CaptureResult::Ok; ++i)
+        {
+            MappedFrame frame;
+            if (!held[i] || !m_infos[i].imageUpdated)
+            {
+                continue;
+            }
+            if (!m_monitors[i].pSource->MapFrame(frame))
+            {
+                mapped = false;
+                break;
+            }
+            if (!m_seen[i] || !m_infos[i].pDirtyRects)
+            {
+                m_canvas.AddFrame(static_cast<uint32_t>(i), frame.pPixels, frame.stride, nullptr, 0);
+                m_seen[i] = true;
+                continue;
+            }
+            m_canvas.AddFrame(static_cast<uint32_t>(i), frame.pPixels, frame.stride, m_infos[i].pDirtyRects,
+                              m_infos[i].dirtyRectCount);
+            for (uint32_t move = 0; move < m_infos[i].moveRectCount; ++move)
+            {
+                m_canvas.AddFrame(static_cast<uint32_t>(i), frame.pPixels, frame.stride,
+                                  &m_infos[i].pMoveRects[move].destination, 1);
+            }
+        }
+        if (failure == CaptureResult::Ok)
+        {
+            // Even after a failed map, so nothing queued outlives the frames it points into.
+            m_dirty = m_canvas.Compose();
+            if (mapped)
+            {
+                MergeInfo(held, info);
+            }
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (held[i])
+            {
+                m_monitors[i].pSource->ReleaseFrame();
+            }
+        }
+        if (failure != CaptureResult::Ok)
+        {
+            return failure;
+        }
+        if (!mapped)
+        {
+            return CaptureResult::Error;
+        }
+        m_acquired = true;
+        return CaptureResult::Ok;
+    }
+
+    bool MapFrame(MappedFrame& mapped) override
+    {
+        if (!m_acquired)
+        {
+            return false;
+        }
+        mapped.pPixels = m_canvas.Pixels();
+        mapped.stride = m_canvas.Stride();
+        mapped.width = m_canvas.Width();
+        mapped.height = m_canvas.Height();
+        return true;
+    }
+
+    void ReleaseFrame() override
+    {
+        m_acquired = false;
+    }
+
+    bool Prepare() override
+    {
+        bool prepared = true;
+        for (Monitor& monitor : m_monitors)
+        {
+            prepared = monitor.pSource->Prepare() && prepared;
+        }
+        return prepared;
+    }
+
+private:
+    // Combines the monitors' frame info, copying what must outlive their frames.
+    void MergeInfo(const std::vector<bool>& held, CaptureFrameInfo& info)
+    {
+        info = CaptureFrameInfo();
+        bool shapeChanged = false;
+        for (size_t i = 0; i < held.size(); ++i)
+        {
+            if (!held[i])
+            {
+                continue;
+            }
+            const CaptureFrameInfo& frame = m_infos[i];
+            info.timestamp = frame.timestamp > info.timestamp ? frame.timestamp : info.timestamp;
+            info.imageUpdated = info.imageUpdated || frame.imageUpdated;
+            info.accumulatedFrames = frame.accumulatedFrames > info.accumulatedFrames ? frame.accumulatedFrames : info.accumulatedFrames;
+
+            // Each monitor reports the pointer while it is on that monitor.
+            const FrameRect& placement = m_canvas.Placement(static_cast<uint32_t>(i));
+            if (frame.pointerUpdated && frame.pointerVisible)
+            {
+                m_pointerMonitor = static_cast<int32_t>(i);
+                m_pointerX = frame.pointerX + placement.left;
+                m_pointerY = frame.pointerY + placement.top;
+                m_pointerVisible = true;
+                info.pointerUpdated = true;
+            }
+            else if (frame.pointerUpdated && m_pointerMonitor == static_cast<int32_t>(i))
+            {
+                m_pointerVisible = false;
+                info.pointerUpdated = true;
+            }
+            if (frame.pPointerShape && (!shapeChanged || m_pointerMonitor == static_cast<int32_t>(i)))
+            {
+                const PointerShape& shape = *frame.pPointerShape;
+                const size_t rows = shape.type == PointerShapeType::Monochrome ? static_cast<size_t>(shape.height) * 2 : shape.height;
+                m_shapeData.assign(shape.pData, shape.pData + rows * shape.pitch);
+                m_shape = shape;
+                m_shape.pData = m_shapeData.data();
+                shapeChanged = true;
+            }
+        }
+        info.pDirtyRects = m_dirty.empty() ? nullptr : m_dirty.data();
+        info.dirtyRectCount = static_cast<uint32_t>(m_dirty.size());
+        info.pointerVisible = m_pointerVisible;
+        info.pointerX = m_pointerX;
+        info.pointerY = m_pointerY;
+        info.pPointerShape = shapeChanged ? &m_shape : nullptr;
+    }
+
+    std::vector<Monitor> m_monitors;
+    CanvasCompositor m_canvas;
+    std::vector<CaptureFrameInfo> m_infos;
+    std::vector<bool> m_seen;
+    std::vector<FrameRect> m_dirty;
+    size_t m_nextWait = 0;
+    bool m_acquired = false;
+
+    int32_t m_pointerMonitor = -1;
+    bool m_pointerVisible = false;
+    int32_t m_pointerX = 0;
+    int32_t m_pointerY = 0;
+    PointerShape m_shape;
+    std::vector<uint8_t> m_shapeData;
+};
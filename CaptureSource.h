@@ -0,0 +1,127 @@
+#pragma once
+//======================================================================================
+// CaptureSource.h
+// Where frames come from. The recorder only needs three things from a source: wait
+// for the next update, give the CPU the pixels, and let go of them again. Keeping
+// that behind an interface lets the rest of the pipeline run against something
+// other than a live desktop - see SyntheticSource.h.
+//
+// A frame is acquired, optionally mapped, and must be released before the next
+// acquire:
+//
+//     CaptureFrameInfo info;
+//     if (pSource->AcquireFrame(1000, info) == CaptureResult::Ok)
+//     {
+//         MappedFrame mapped;
+//         if (pSource->MapFrame(mapped)) { ... read mapped.pPixels ... }
+//         pSource->ReleaseFrame();
+//     }
+//
+// Rects, pointer shape and pixels stay valid until ReleaseFrame().
+//======================================================================================
+#include <cstddef>
+#include <cstdint>
+
+struct FrameRect
+{
+    int32_t left;
+    int32_t top;
+    int32_t right;  // Exclusive.
+    int32_t bottom; // Exclusive.
+};
+
+// Pixels that were copied unchanged from sourceX/sourceY to destination (scrolling,
+// window moves). The source area is not reported as dirty unless it also changed.
+struct FrameMoveRect
+{
+    int32_t sourceX;
+    int32_t sourceY;
+    FrameRect destination;
+};
+
+// The pointer's image, in the three forms desktop duplication delivers it:
+//
+//   Color       - BGRA, alpha-blended over the desktop.
+//   MaskedColor - BGRA whose alpha is a mask: 0 replaces the desktop pixel with the
+//                 color, 0xFF XORs the color into it.
+//   Monochrome  - 1 bit per pixel, most significant bit first: `height` rows of
+//                 AND mask followed by `height` rows of XOR mask.
+//
+// The pointer position is where the image's top-left corner goes; the hotspot is
+// the pixel within the image that the position refers to for hit testing.
+enum class PointerShapeType
+{
+    Color,
+    MaskedColor,
+    Monochrome,
+};
+
+struct PointerShape
+{
+    PointerShapeType type = PointerShapeType::Color;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pitch = 0; // Bytes from one row to the next.
+    int32_t hotspotX = 0;
+    int32_t hotspotY = 0;
+    const uint8_t* pData = nullptr;
+};
+
+struct CaptureFrameInfo
+{
+    int64_t timestamp = 0;           // When the newest included update was presented (100 ns units).
+    bool imageUpdated = false;       // false: only the pointer changed; the image is the previous one.
+    uint32_t accumulatedFrames = 0;  // Updates merged into this frame since the previous acquire.
+    const FrameRect* pDirtyRects = nullptr;
+    uint32_t dirtyRectCount = 0;
+    const FrameMoveRect* pMoveRects = nullptr;
+    uint32_t moveRectCount = 0;
+    bool pointerUpdated = false;
+    bool pointerVisible = false;
+    int32_t pointerX = 0;
+    int32_t pointerY = 0;
+    const PointerShape* pPointerShape = nullptr; // Only set when the shape changed.
+};
+
+// 32-bit BGRA, top-down.
+struct MappedFrame
+{
+    const uint8_t* pPixels = nullptr;
+    size_t stride = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+enum class CaptureResult
+{
+    Ok,
+    Timeout,    // No update within the timeout; not an error.
+    AccessLost, // The source went away (mode change, secure desktop...); recreate it.
+    Ended,      // A finite source (a replayed trace) has no more frames.
+    Error,
+};
+
+//======================================================================================
+// CaptureSource
+//======================================================================================
+class CaptureSource
+{
+public:
+    virtual ~CaptureSource() = default;
+
+    virtual uint32_t Width() const = 0;
+    virtual uint32_t Height() const = 0;
+
+    // Waits up to timeoutMs for the next update.
+    virtual CaptureResult AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info) = 0;
+
+    // Makes the acquired frame's pixels readable by the CPU. May be skipped.
+    virtual bool MapFrame(MappedFrame& mapped) = 0;
+
+    // Required after every successful AcquireFrame(), mapped or not.
+    virtual void ReleaseFrame() = 0;
+
+    // Allocates ahead what the first frame would otherwise allocate (readback
+    // textures and the like), for a recording set up to start later (StartGate.h).
+    virtual bool Prepare() { return true; }
+};
@@ -0,0 +1,778 @@
+#pragma once
+//======================================================================================
+// CaptureTrace.h
+// Records what a capture source delivered - pixels, dirty and move rects, pointer
+// and present timestamps - so the session can be replayed later as a source of its
+// own (see ReplaySource.h), e.g. to reproduce a production stall on a Linux
+// benchmark machine.
+//
+// Frames are delta-coded against the previous frame: moves are stored as rects
+// only, and only the dirty rects' pixels are stored, with runs of pixels that did
+// not actually change skipped. Every keyframeIntervalSeconds a full keyframe is
+// written, predicted from the row above, so replay can start anywhere without
+// decoding from the beginning. An idle desktop costs a few bytes per frame.
+//
+// The file is designed to be memory-mapped. All fields are little-endian and
+// naturally aligned:
+//
+//   File header (64 bytes):
+//     char magic[8] = "WRCTRACE", uint32 version = 1, uint32 headerSize = 64,
+//     uint32 width, uint32 height, uint32 frameCount, uint32 0,
+//     uint64 indexOffset, then zeros
+//   Frames, each padded to a multiple of 8 bytes:
+//     Frame header (48 bytes):
+//       uint32 magic = "CTFR", uint32 flags (TraceFrameFlags),
+//       int64 timestamp (100 ns units), uint32 accumulatedFrames,
+//       int32 pointerX, int32 pointerY, uint32 moveCount, uint32 dirtyCount,
+//       uint32 0, uint64 payloadBytes
+//     moveCount x { int32 sourceX, sourceY, left, top, right, bottom }
+//     dirtyCount x { int32 left, top, right, bottom }
+//     Payload: for every row of every dirty rect (of the whole frame for a
+//       keyframe), runs of { uint16 skip, uint16 literal, literal x BGRA pixel }
+//       covering the row's width. Skipped pixels keep the reference value: the
+//       previous frame after the moves, or the row above in a keyframe (zero for
+//       the first row).
+//   Index at indexOffset: frameCount x { uint64 offset, int64 timestamp,
+//     uint32 flags, uint32 0 }
+//
+// The header and index are written when the trace is closed. A trace cut off
+// before that still replays: the reader rebuilds the index by walking the frames.
+//======================================================================================
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "FileWriter.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+enum TraceFrameFlags : uint32_t
+{
+    TraceFrameKey = 1,
+    TraceFrameImageUpdated = 2,
+    TraceFramePointerUpdated = 4,
+    TraceFramePointerVisible = 8,
+};
+
+namespace CaptureTraceFormat
+{
+    static const uint32_t Version = 1;
+    static const uint32_t HeaderSize = 64;
+    static const uint32_t FrameHeaderSize = 48;
+    static const uint32_t FrameMagic = 0x52465443u; // "CTFR"
+    static const size_t MoveRectSize = 24;
+    static const size_t DirtyRectSize = 16;
+    static const size_t IndexEntrySize = 24;
+    static const char Magic[8] = { 'W', 'R', 'C', 'T', 'R', 'A', 'C', 'E' };
+
+    struct IndexEntry
+    {
+        uint64_t offset;
+        int64_t timestamp;
+        uint32_t flags;
+        uint32_t reserved;
+    };
+
+    inline void Put32(uint8_t* p, uint32_t value) { memcpy(p, &value, 4); }
+    inline void Put64(uint8_t* p, uint64_t value) { memcpy(p, &value, 8); }
+    inline uint32_t Get32(const uint8_t* p) { uint32_t value; memcpy(&value, p, 4); return value; }
+    inline uint64_t Get64(const uint8_t* p) { uint64_t value; memcpy(&value, p, 8); return value; }
+
+    // Clips a rect to the frame; false if nothing is left.
+    inline bool Clip(FrameRect& rect, uint32_t width, uint32_t height)
+    {
+        rect.left = rect.left < 0 ? 0 : rect.left;
+        rect.top = rect.top < 0 ? 0 : rect.top;
+        rect.right = rect.right > static_cast<int32_t>(width) ? static_cast<int32_t>(width) : rect.right;
+        rect.bottom = rect.bottom > static_cast<int32_t>(height) ? static_cast<int32_t>(height) : rect.bottom;
+        return rect.left < rect.right && rect.top < rect.bottom;
+    }
+
+    inline bool MoveFits(const FrameMoveRect& move, uint32_t width, uint32_t height)
+    {
+        const FrameRect& d = move.destination;
+        const int32_t w = d.right - d.left;
+        const int32_t h = d.bottom - d.top;
+        return w > 0 && h > 0 && d.left >= 0 && d.top >= 0 && move.sourceX >= 0 && move.sourceY >= 0 &&
+               d.right <= static_cast<int32_t>(width) && d.bottom <= static_cast<int32_t>(height) &&
+               move.sourceX + w <= static_cast<int32_t>(width) && move.sourceY + h <= static_cast<int32_t>(height);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CaptureTraceFormat::ApplyMoves]
+    // Applies move rects to a tightly packed BGRA image. All sources refer to the
+    // image before any of the moves, so they are gathered first. Moves that do not
+    // fit the frame are ignored.
+    //----------------------------------------------------------------------------------
+    inline void ApplyMoves(uint32_t* pImage, uint32_t width, uint32_t height, const FrameMoveRect* pMoves,
+                           uint32_t moveCount, std::vector<uint32_t>& scratch)
+    {
+        scratch.clear();
+        for (uint32_t i = 0; i < moveCount; ++i)
+        {
+            const FrameMoveRect& move = pMoves[i];
+            const FrameRect& d = move.destination;
+            const int32_t w = d.right - d.left;
+            const int32_t h = d.bottom - d.top;
+            if (!MoveFits(move, width, height))
+            {
+                continue;
+            }
+            for (int32_t y = 0; y < h; ++y)
+            {
+                const uint32_t* pRow = pImage + static_cast<size_t>(move.sourceY + y) * width + move.sourceX;
+                scratch.insert(scratch.end(), pRow, pRow + w);
+            }
+        }
+        const uint32_t* pSource = scratch.data();
+        for (uint32_t i = 0; i < moveCount; ++i)
+        {
+            const FrameMoveRect& move = pMoves[i];
+            const FrameRect& d = move.destination;
+            const int32_t w = d.right - d.left;
+            const int32_t h = d.bottom - d.top;
+            if (!MoveFits(move, width, height))
+            {
+                continue;
+            }
+            for (int32_t y = 0; y < h; ++y)
+            {
+                memcpy(pImage + static_cast<size_t>(d.top + y) * width + d.left, pSource, static_cast<size_t>(w) * 4);
+                pSource += w;
+            }
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CaptureTraceFormat::DecodeRow]
+    // Decodes one row of runs into pRow (count pixels), taking skipped pixels from
+    // pReference (which may alias pRow). Returns the bytes consumed, 0 if the runs
+    // are malformed or overrun 'size'.
+    //----------------------------------------------------------------------------------
+    inline size_t DecodeRow(const uint8_t* p, size_t size, uint32_t* pRow, const uint32_t* pReference, uint32_t count)
+    {
+        size_t used = 0;
+        uint32_t x = 0;
+        while (x < count)
+        {
+            if (size - used < 4)
+            {
+                return 0;
+            }
+            uint16_t skip;
+            uint16_t literal;
+            memcpy(&skip, p + used, 2);
+            memcpy(&literal, p + used + 2, 2);
+            used += 4;
+            if (x + skip + literal > count || size - used < static_cast<size_t>(literal) * 4)
+            {
+                return 0;
+            }
+            if (pReference != pRow)
+            {
+                memcpy(pRow + x, pReference + x, static_cast<size_t>(skip) * 4);
+            }
+            x += skip;
+            memcpy(pRow + x, p + used, static_cast<size_t>(literal) * 4);
+            used += static_cast<size_t>(literal) * 4;
+            x += literal;
+        }
+        return used;
+    }
+}
+
+//======================================================================================
+// CaptureTraceWriter
+//======================================================================================
+class CaptureTraceWriter
+{
+public:
+    CaptureTraceWriter() = default;
+    ~CaptureTraceWriter() { Close(); }
+    CaptureTraceWriter(const CaptureTraceWriter&) = delete;
+    CaptureTraceWriter& operator=(const CaptureTraceWriter&) = delete;
+
+    //----------------------------------------------------------------------------------
+    // [CaptureTraceWriter::Open]
+    //----------------------------------------------------------------------------------
+    bool Open(const std::string& path, uint32_t width, uint32_t height, uint32_t keyframeIntervalSeconds = 60)
+    {
+        Close();
+        if (width == 0 || height == 0 || width > 65535)
+        {
+            return false;
+        }
+        if (!m_writer.Open(path, FileWriter::Options()))
+        {
+            return false;
+        }
+        m_width = width;
+        m_height = height;
+        m_keyframeInterval = static_cast<int64_t>(keyframeIntervalSeconds) * 10000000;
+        m_reference.assign(static_cast<size_t>(width) * height, 0);
+        m_index.clear();
+        m_haveReference = false;
+
+        // The header is rewritten with the frame count and index offset on Close().
+        uint8_t header[CaptureTraceFormat::HeaderSize] = {};
+        WriteHeader(header, 0, 0);
+        return m_writer.Write(header, sizeof(header));
+    }
+
+    bool IsOpen() const { return m_writer.IsOpen(); }
+    uint64_t FrameCount() const { return m_index.size(); }
+    uint64_t Bytes() const { return m_writer.Size(); }
+
+    //----------------------------------------------------------------------------------
+    // [CaptureTraceWriter::Append]
+    // Records one acquired frame. 'mapped' may be null when the frame was not
+    // mapped; its pixels are then not recorded (the replay repeats the previous
+    // image). Frames of a different size than the trace are rejected.
+    //----------------------------------------------------------------------------------
+    bool Append(const CaptureFrameInfo& info, const MappedFrame* pMapped)
+    {
+        using namespace CaptureTraceFormat;
+        if (!IsOpen() || (pMapped && (pMapped->width != m_width || pMapped->height != m_height)))
+        {
+            return false;
+        }
+
+        const bool updated = pMapped && info.imageUpdated;
+        const bool key = pMapped && (!m_haveReference || info.timestamp - m_lastKeyTimestamp >= m_keyframeInterval);
+        uint32_t flags = 0;
+        if (key) flags |= TraceFrameKey;
+        if (updated || key) flags |= TraceFrameImageUpdated;
+        if (info.pointerUpdated) flags |= TraceFramePointerUpdated;
+        if (info.pointerVisible) flags |= TraceFramePointerVisible;
+
+        // Rects are clipped so the reader never has to deal with out-of-frame ones.
+        m_moves.clear();
+        m_dirty.clear();
+        if (updated)
+        {
+            for (uint32_t i = 0; i < info.moveRectCount; ++i)
+            {
+                FrameMoveRect move = info.pMoveRects[i];
+                const FrameRect before = move.destination;
+                if (Clip(move.destination, m_width, m_height))
+                {
+                    move.sourceX += move.destination.left - before.left;
+                    move.sourceY += move.destination.top - before.top;
+                    m_moves.push_back(move);
+                }
+            }
+            for (uint32_t i = 0; i < info.dirtyRectCount; ++i)
+            {
+                FrameRect rect = info.pDirtyRects[i];
+                if (Clip(rect, m_width, m_height))
+                {
+                    m_dirty.push_back(rect);
+                }
+            }
+        }
+
+        m_record.resize(FrameHeaderSize + m_moves.size() * MoveRectSize + m_dirty.size() * DirtyRectSize);
+        uint8_t* p = m_record.data() + FrameHeaderSize;
+        for (const FrameMoveRect& move : m_moves)
+        {
+            const int32_t values[6] = { move.sourceX, move.sourceY, move.destination.left, move.destination.top,
+                                        move.destination.right, move.destination.bottom };
+            memcpy(p, values, sizeof(values));
+            p += MoveRectSize;
+        }
+        for (const FrameRect& rect : m_dirty)
+        {
+            memcpy(p, &rect, DirtyRectSize);
+            p += DirtyRectSize;
+        }
+
+        const size_t payloadStart = m_record.size();
+        const uint8_t* pPixels = pMapped ? pMapped->pPixels : nullptr;
+        if (key)
+        {
+            // Each row is predicted from the one above, which the reference holds
+            // after the previous row was stored.
+            for (uint32_t y = 0; y < m_height; ++y)
+            {
+                const uint32_t* pRow = reinterpret_cast<const uint32_t*>(pPixels + y * pMapped->stride);
+                uint32_t* pStored = m_reference.data() + static_cast<size_t>(y) * m_width;
+                static const uint32_t Zero[1] = { 0 };
+                EncodeRow(pRow, y ? pStored - m_width : Zero, y ? 1 : 0, m_width);
+                memcpy(pStored, pRow, static_cast<size_t>(m_width) * 4);
+            }
+            m_haveReference = true;
+            m_lastKeyTimestamp = info.timestamp;
+        }
+        else if (updated)
+        {
+            ApplyMoves(m_reference.data(), m_width, m_height, m_moves.data(), static_cast<uint32_t>(m_moves.size()),
+                       m_scratch);
+            for (const FrameRect& rect : m_dirty)
+            {
+                const uint32_t count = static_cast<uint32_t>(rect.right - rect.left);
+                for (int32_t y = rect.top; y < rect.bottom; ++y)
+                {
+                    const uint32_t* pRow = reinterpret_cast<const uint32_t*>(pPixels + y * pMapped->stride) + rect.left;
+                    uint32_t* pStored = m_reference.data() + static_cast<size_t>(y) * m_width + rect.left;
+                    EncodeRow(pRow, pStored, 1, count);
+                    memcpy(pStored, pRow, static_cast<size_t>(count) * 4);
+                }
+            }
+        }
+        const uint64_t payloadBytes = m_record.size() - payloadStart;
+        m_record.resize((m_record.size() + 7) / 8 * 8, 0);
+
+        uint8_t* pHeader = m_record.data();
+        Put32(pHeader, FrameMagic);
+        Put32(pHeader + 4, flags);
+        Put64(pHeader + 8, static_cast<uint64_t>(info.timestamp));
+        Put32(pHeader + 16, info.accumulatedFrames);
+        Put32(pHeader + 20, static_cast<uint32_t>(info.pointerX));
+        Put32(pHeader + 24, static_cast<uint32_t>(info.pointerY));
+        Put32(pHeader + 28, static_cast<uint32_t>(m_moves.size()));
+        Put32(pHeader + 32, static_cast<uint32_t>(m_dirty.size()));
+        Put32(pHeader + 36, 0);
+        Put64(pHeader + 40, payloadBytes);
+
+        m_index.push_back(IndexEntry{ m_writer.Tell(), info.timestamp, flags, 0 });
+        return m_writer.Write(m_record.data(), m_record.size());
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CaptureTraceWriter::Close]
+    // Appends the index and completes the header. Returns false if any write failed.
+    //----------------------------------------------------------------------------------
+    bool Close()
+    {
+        using namespace CaptureTraceFormat;
+        if (!IsOpen())
+        {
+            return true;
+        }
+        const uint64_t indexOffset = m_writer.Tell();
+        std::vector<uint8_t> index(m_index.size() * IndexEntrySize);
+        for (size_t i = 0; i < m_index.size(); ++i)
+        {
+            uint8_t* p = index.data() + i * IndexEntrySize;
+            Put64(p, m_index[i].offset);
+            Put64(p + 8, static_cast<uint64_t>(m_index[i].timestamp));
+            Put32(p + 16, m_index[i].flags);
+            Put32(p + 20, 0);
+        }
+        m_writer.Write(index.data(), index.size());
+
+        uint8_t header[HeaderSize] = {};
+        WriteHeader(header, static_cast<uint32_t>(m_index.size()), indexOffset);
+        m_writer.Seek(0);
+        m_writer.Write(header, sizeof(header));
+        return m_writer.Close();
+    }
+
+private:
+    void WriteHeader(uint8_t* pHeader, uint32_t frameCount, uint64_t indexOffset) const
+    {
+        using namespace CaptureTraceFormat;
+        memcpy(pHeader, Magic, 8);
+        Put32(pHeader + 8, Version);
+        Put32(pHeader + 12, HeaderSize);
+        Put32(pHeader + 16, m_width);
+        Put32(pHeader + 20, m_height);
+        Put32(pHeader + 24, frameCount);
+        Put64(pHeader + 32, indexOffset);
+    }
+
+    // Appends runs for 'count' pixels. referenceStep 0 compares every pixel with
+    // pReference[0] (the first row of a keyframe).
+    void EncodeRow(const uint32_t* pRow, const uint32_t* pReference, uint32_t referenceStep, uint32_t count)
+    {
+        uint32_t x = 0;
+        while (x < count)
+        {
+            uint32_t skip = 0;
+            while (x + skip < count && skip < 0xFFFF && pRow[x + skip] == pReference[(x + skip) * referenceStep])
+            {
+                ++skip;
+            }
+            uint32_t literal = 0;
+            while (x + skip + literal < count && literal < 0xFFFF &&
+                   pRow[x + skip + literal] != pReference[(x + skip + literal) * referenceStep])
+            {
+                ++literal;
+            }
+            const size_t at = m_record.size();
+            m_record.resize(at + 4 + static_cast<size_t>(literal) * 4);
+            const uint16_t run[2] = { static_cast<uint16_t>(skip), static_cast<uint16_t>(literal) };
+            memcpy(&m_record[at], run, 4);
+            memcpy(&m_record[at + 4], pRow + x + skip, static_cast<size_t>(literal) * 4);
+            x += skip + literal;
+        }
+    }
+
+    FileWriter m_writer;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    int64_t m_keyframeInterval = 0;
+    int64_t m_lastKeyTimestamp = 0;
+    bool m_haveReference = false;
+
+    // The image as a reader will have reconstructed it after the last frame.
+    std::vector<uint32_t> m_reference;
+    std::vector<uint32_t> m_scratch;
+    std::vector<FrameMoveRect> m_moves;
+    std::vector<FrameRect> m_dirty;
+    std::vector<uint8_t> m_record;
+    std::vector<CaptureTraceFormat::IndexEntry> m_index;
+};
+
+//======================================================================================
+// MappedFile
+// A read-only memory mapping of a whole file.
+//======================================================================================
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        m_hFile = CreateFileW(Utf8ToWide(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_hFile == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        m_pData = m_hMapping ? static_cast<const uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        m_size = static_cast<uint64_t>(size.QuadPart);
+#else
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat status;
+        if (fstat(fd, &status) == 0 && status.st_size > 0)
+        {
+            void* pMapping = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (pMapping != MAP_FAILED)
+            {
+                // Replay reads front to back.
+                madvise(pMapping, static_cast<size_t>(status.st_size), MADV_SEQUENTIAL);
+                m_pData = static_cast<const uint8_t*>(pMapping);
+                m_size = static_cast<uint64_t>(status.st_size);
+            }
+        }
+        close(fd);
+#endif
+        if (!m_pData)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (m_pData) UnmapViewOfFile(m_pData);
+        if (m_hMapping) CloseHandle(m_hMapping);
+        if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+        m_hMapping = nullptr;
+        m_hFile = INVALID_HANDLE_VALUE;
+#else
+        if (m_pData) munmap(const_cast<uint8_t*>(m_pData), static_cast<size_t>(m_size));
+#endif
+        m_pData = nullptr;
+        m_size = 0;
+    }
+
+    const uint8_t* Data() const { return m_pData; }
+    uint64_t Size() const { return m_size; }
+
+private:
+    const uint8_t* m_pData = nullptr;
+    uint64_t m_size = 0;
+#ifdef _WIN32
+    HANDLE m_hFile = INVALID_HANDLE_VALUE;
+    HANDLE m_hMapping = nullptr;
+#endif
+};
+
+//======================================================================================
+// CaptureTraceReader
+// Validates a mapped trace and decodes its frames in order into a BGRA image.
+//======================================================================================
+class CaptureTraceReader
+{
+public:
+    // One decoded frame; rects and image stay valid until the next Decode().
+    struct Frame
+    {
+        CaptureFrameInfo info;
+        const uint32_t* pImage = nullptr;
+    };
+
+    //----------------------------------------------------------------------------------
+    // [CaptureTraceReader::Open]
+    //----------------------------------------------------------------------------------
+    bool Open(const std::string& path, std::string& error)
+    {
+        using namespace CaptureTraceFormat;
+        if (!m_file.Open(path))
+        {
+            error = "Could not open capture trace " + path;
+            return false;
+        }
+        const uint8_t* pData = m_file.Data();
+        if (m_file.Size() < HeaderSize || memcmp(pData, Magic, 8) != 0 || Get32(pData + 8) != Version)
+        {
+            error = path + " is not a version 1 capture trace";
+            return false;
+        }
+        m_width = Get32(pData + 16);
+        m_height = Get32(pData + 20);
+        if (m_width == 0 || m_height == 0 || m_width > 65535 || m_height > 65535)
+        {
+            error = path + " has an invalid frame size";
+            return false;
+        }
+
+        // Use the index if the trace was closed properly, otherwise walk the frames.
+        const uint32_t frameCount = Get32(pData + 24);
+        const uint64_t indexOffset = Get64(pData + 32);
+        m_index.clear();
+        if (indexOffset >= HeaderSize && indexOffset <= m_file.Size() &&
+            (m_file.Size() - indexOffset) / IndexEntrySize >= frameCount)
+        {
+            for (uint32_t i = 0; i < frameCount; ++i)
+            {
+                const uint8_t* p = pData + indexOffset + static_cast<uint64_t>(i) * IndexEntrySize;
+                m_index.push_back(IndexEntry{ Get64(p), static_cast<int64_t>(Get64(p + 8)), Get32(p + 16), 0 });
+            }
+            m_dataEnd = indexOffset;
+        }
+        else
+        {
+            m_dataEnd = m_file.Size();
+            uint64_t offset = HeaderSize;
+            uint64_t size = 0;
+            while (RecordSize(offset, size))
+            {
+                const uint8_t* p = pData + offset;
+                m_index.push_back(IndexEntry{ offset, static_cast<int64_t>(Get64(p + 8)), Get32(p + 4), 0 });
+                offset += size;
+            }
+            m_recovered = true;
+        }
+        if (m_index.empty() || !(m_index[0].flags & TraceFrameKey))
+        {
+            error = path + " contains no frames";
+            return false;
+        }
+
+        m_image.assign(static_cast<size_t>(m_width) * m_height, 0);
+        m_next = 0;
+        return true;
+    }
+
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+    size_t FrameCount() const { return m_index.size(); }
+    size_t NextFrame() const { return m_next; }
+    int64_t Timestamp(size_t frame) const { return m_index[frame].timestamp; }
+    // True if the trace was not closed and its index was rebuilt.
+    bool Recovered() const { return m_recovered; }
+
+    //----------------------------------------------------------------------------------
+    // [CaptureTraceReader::Seek]
+    // Makes 'frame' the next one Decode() returns, decoding from the keyframe
+    // before it.
+    //----------------------------------------------------------------------------------
+    bool Seek(size_t frame)
+    {
+        if (frame >= m_index.size())
+        {
+            return false;
+        }
+        size_t key = frame;
+        while (key > 0 && !(m_index[key].flags & TraceFrameKey))
+        {
+            --key;
+        }
+        m_next = key;
+        Frame decoded;
+        while (m_next < frame)
+        {
+            if (!Decode(decoded))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CaptureTraceReader::Decode]
+    // Decodes the next frame. Returns false at the end or on a corrupt record.
+    //----------------------------------------------------------------------------------
+    bool Decode(Frame& frame)
+    {
+        using namespace CaptureTraceFormat;
+        uint64_t size = 0;
+        if (m_next >= m_index.size() || !RecordSize(m_index[m_next].offset, size))
+        {
+            return false;
+        }
+        const uint8_t* p = m_file.Data() + m_index[m_next].offset;
+        const uint32_t flags = Get32(p + 4);
+        const uint32_t moveCount = Get32(p + 28);
+        const uint32_t dirtyCount = Get32(p + 32);
+        const uint64_t payloadBytes = Get64(p + 40);
+
+        m_moves.resize(moveCount);
+        const uint8_t* pRects = p + FrameHeaderSize;
+        for (uint32_t i = 0; i < moveCount; ++i)
+        {
+            int32_t values[6];
+            memcpy(values, pRects + i * MoveRectSize, sizeof(values));
+            m_moves[i] = FrameMoveRect{ values[0], values[1], FrameRect{ values[2], values[3], values[4], values[5] } };
+        }
+        pRects += static_cast<size_t>(moveCount) * MoveRectSize;
+        m_dirty.resize(dirtyCount);
+        for (uint32_t i = 0; i < dirtyCount; ++i)
+        {
+            memcpy(&m_dirty[i], pRects + i * DirtyRectSize, DirtyRectSize);
+        }
+        const uint8_t* pPayload = pRects + static_cast<size_t>(dirtyCount) * DirtyRectSize;
+
+        size_t used = 0;
+        if (flags & TraceFrameKey)
+        {
+            for (uint32_t y = 0; y < m_height; ++y)
+            {
+                uint32_t* pRow = m_image.data() + static_cast<size_t>(y) * m_width;
+                // The first row is predicted from zero: decode it against a zeroed row.
+                if (y == 0)
+                {
+                    memset(pRow, 0, static_cast<size_t>(m_width) * 4);
+                }
+                const size_t consumed = DecodeRow(pPayload + used, payloadBytes - used, pRow, y ? pRow - m_width : pRow, m_width);
+                if (consumed == 0)
+                {
+                    return false;
+                }
+                used += consumed;
+            }
+        }
+        else if (flags & TraceFrameImageUpdated)
+        {
+            ApplyMoves(m_image.data(), m_width, m_height, m_moves.data(), moveCount, m_scratch);
+            for (FrameRect rect : m_dirty)
+            {
+                if (!Clip(rect, m_width, m_height))
+                {
+                    return false;
+                }
+                for (int32_t y = rect.top; y < rect.bottom; ++y)
+                {
+                    uint32_t* pRow = m_image.data() + static_cast<size_t>(y) * m_width + rect.left;
+                    const size_t consumed = DecodeRow(pPayload + used, payloadBytes - used, pRow, pRow,
+                                                      static_cast<uint32_t>(rect.right - rect.left));
+                    if (consumed == 0)
+                    {
+                        return false;
+                    }
+                    used += consumed;
+                }
+            }
+        }
+
+        frame.info = CaptureFrameInfo();
+        frame.info.timestamp = static_cast<int64_t>(Get64(p + 8));
+        frame.info.imageUpdated = (flags & TraceFrameImageUpdated) != 0;
+        frame.info.accumulatedFrames = Get32(p + 16);
+        frame.info.pointerX = static_cast<int32_t>(Get32(p + 20));
+        frame.info.pointerY = static_cast<int32_t>(Get32(p + 24));
+        frame.info.pointerUpdated = (flags & TraceFramePointerUpdated) != 0;
+        frame.info.pointerVisible = (flags & TraceFramePointerVisible) != 0;
+        frame.info.pMoveRects = m_moves.empty() ? nullptr : m_moves.data();
+        frame.info.moveRectCount = moveCount;
+        frame.info.pDirtyRects = m_dirty.empty() ? nullptr : m_dirty.data();
+        frame.info.dirtyRectCount = dirtyCount;
+        if (flags & TraceFrameKey)
+        {
+            // A keyframe replaces the whole image, whatever its rects say.
+            m_dirty.assign(1, FrameRect{ 0, 0, static_cast<int32_t>(m_width), static_cast<int32_t>(m_height) });
+            m_moves.clear();
+            frame.info.pDirtyRects = m_dirty.data();
+            frame.info.dirtyRectCount = 1;
+            frame.info.pMoveRects = nullptr;
+            frame.info.moveRectCount = 0;
+        }
+        frame.pImage = m_image.data();
+        ++m_next;
+        return true;
+    }
+
+private:
+    // Checks that the record at 'offset' is complete; sets its padded size.
+    bool RecordSize(uint64_t offset, uint64_t& size) const
+    {
+        using namespace CaptureTraceFormat;
+        if (offset + FrameHeaderSize > m_dataEnd)
+        {
+            return false;
+        }
+        const uint8_t* p = m_file.Data() + offset;
+        if (Get32(p) != FrameMagic)
+        {
+            return false;
+        }
+        const uint64_t moves = Get32(p + 28);
+        const uint64_t dirty = Get32(p + 32);
+        const uint64_t payload = Get64(p + 40);
+        if (payload > m_dataEnd)
+        {
+            return false;
+        }
+        size = (FrameHeaderSize + moves * MoveRectSize + dirty * DirtyRectSize + payload + 7) / 8 * 8;
+        return offset + size <= m_dataEnd;
+    }
+
+    MappedFile m_file;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint64_t m_dataEnd = 0;
+    bool m_recovered = false;
+    std::vector<CaptureTraceFormat::IndexEntry> m_index;
+    size_t m_next = 0;
+
+    std::vector<uint32_t> m_image;
+    std::vector<uint32_t> m_scratch;
+    std::vector<FrameMoveRect> m_moves;
+    std::vector<FrameRect> m_dirty;
+};
@@ -0,0 +1,15 @@
+#pragma once
+//======================================================================================
+// ComHelpers.h
+// Small helpers shared by everything that talks to COM / Media Foundation.
+//======================================================================================
+
+// Safely releases a COM interface pointer and sets it to nullptr.
+template <class T> void SafeRelease(T** ppT)
+{
+    if (*ppT)
+    {
+        (*ppT)->Release();
+        *ppT = nullptr;
+    }
+}
@@ -0,0 +1,345 @@
+#pragma once
+//======================================================================================
+// ControlProtocol.h
+// The requests a --daemon recorder takes on its control socket (ControlServer.h)
+// or its standard input, and the responses it sends back: one request per line
+// and one response line for each, in order.
+//
+//   {"cmd":"start"}                       {"ok":true,"recording":"rec-0003.mp4"}
+//   {"cmd":"mark","label":"goal"}         {"ok":true,"frame":1234,"seconds":41.133}
+//   {"cmd":"save-replay","path":"r.ts"}   {"ok":true,"path":"r.ts","frames":900,...}
+//   {"cmd":"query-stats"}                 {"ok":true,"state":"recording",...}
+//   {"cmd":"stop"}, {"cmd":"quit"}
+//   anything that fails                   {"ok":false,"error":"..."}
+//
+// The bare words work as well ("start", "mark goal", "save-replay r.ts"), which
+// is what a person types. A request is one flat JSON object with string members
+// in any order; members we don't know are ignored, so clients may send more.
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+enum class ControlCommand
+{
+    Start,
+    Stop,
+    Mark,       // Argument: the label (optional).
+    SaveReplay, // Argument: the file to write (optional).
+    QueryStats,
+    Quit,
+};
+
+inline const char* ControlCommandName(ControlCommand command)
+{
+    switch (command)
+    {
+    case ControlCommand::Start: return "start";
+    case ControlCommand::Stop: return "stop";
+    case ControlCommand::Mark: return "mark";
+    case ControlCommand::SaveReplay: return "save-replay";
+    case ControlCommand::QueryStats: return "query-stats";
+    case ControlCommand::Quit: return "quit";
+    default: return "?";
+    }
+}
+
+struct ControlRequest
+{
+    ControlCommand command = ControlCommand::QueryStats;
+    std::string argument;
+};
+
+namespace ControlProtocol
+{
+    // Longer lines are refused, so a client can't make us buffer without limit.
+    static const size_t MaxLineBytes = 4096;
+
+    inline bool ParseCommand(const std::string& name, ControlCommand& command)
+    {
+        for (ControlCommand candidate : { ControlCommand::Start, ControlCommand::Stop, ControlCommand::Mark,
+                                          ControlCommand::SaveReplay, ControlCommand::QueryStats, ControlCommand::Quit })
+        {
+            if (name == ControlCommandName(candidate))
+            {
+                command = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [ControlProtocol::AppendString]
+    // Appends 'text' as a quoted JSON string.
+    //----------------------------------------------------------------------------------
+    inline void AppendString(std::string& json, const std::string& text)
+    {
+        json += '"';
+        for (char c : text)
+        {
+            const unsigned char u = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\')
+            {
+                json += '\\';
+                json += c;
+            }
+            else if (c == '\n')
+            {
+                json += "\\n";
+            }
+            else if (u < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", u);
+                json += escaped;
+            }
+            else
+            {
+                json += c;
+            }
+        }
+        json += '"';
+    }
+
+    namespace Detail
+    {
+        inline void SkipSpace(const std::string& text, size_t& i)
+        {
+            while (i < text.size() && (text[i] == ' ' || text[i] == '\t' || text[i] == '\r' || text[i] == '\n'))
+            {
+                ++i;
+            }
+        }
+
+        // A JSON string starting at text[i] (the opening quote). \u escapes are kept
+        // for ASCII only, which is all a command or a path needs here.
+        inline bool ParseString(const std::string& text, size_t& i, std::string& value)
+        {
+            if (i >= text.size() || text[i] != '"')
+            {
+                return false;
+            }
+            value.clear();
+            for (++i; i < text.size(); ++i)
+            {
+                char c = text[i];
+                if (c == '"')
+                {
+                    ++i;
+                    return true;
+                }
+                if (c == '\\')
+                {
+                    if (++i >= text.size())
+                    {
+                        return false;
+                    }
+                    switch (text[i])
+                    {
+                    case 'n': c = '\n'; break;
+                    case 't': c = '\t'; break;
+                    case 'r': c = '\r'; break;
+                    case 'b': c = '\b'; break;
+                    case 'f': c = '\f'; break;
+                    case 'u':
+                    {
+                        unsigned int code = 0;
+                        if (i + 4 >= text.size() || sscanf(text.c_str() + i + 1, "%4x", &code) != 1 || code > 0x7F)
+                        {
+                            return false;
+                        }
+                        c = static_cast<char>(code);
+                        i += 4;
+                        break;
+                    }
+                    default: c = text[i]; break; // \" \\ \/
+                    }
+                }
+                value += c;
+            }
+            return false;
+        }
+
+        // Numbers, true, false and null are accepted and ignored.
+        inline bool SkipScalar(const std::string& text, size_t& i)
+        {
+            const size_t start = i;
+            while (i < text.size() && text[i] != ',' && text[i] != '}' && text[i] != ' ' && text[i] != '\t')
+            {
+                const char c = text[i];
+                if (c == '"' || c == '{' || c == '[' || c == ':')
+                {
+                    return false;
+                }
+                ++i;
+            }
+            return i > start;
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [ControlProtocol::ParseRequest]
+    // One line, JSON or bare words. False with 'error' set if it isn't a request.
+    //----------------------------------------------------------------------------------
+    inline bool ParseRequest(const std::string& line, ControlRequest& request, std::string& error)
+    {
+        size_t i = 0;
+        Detail::SkipSpace(line, i);
+        std::string name;
+        std::string argument;
+        if (i < line.size() && line[i] == '{')
+        {
+            ++i;
+            Detail::SkipSpace(line, i);
+            bool first = true;
+            while (i < line.size() && line[i] != '}')
+            {
+                if (!first)
+                {
+                    if (line[i] != ',')
+                    {
+                        error = "Malformed request: expected , or }";
+                        return false;
+                    }
+                    ++i;
+                    Detail::SkipSpace(line, i);
+                }
+                first = false;
+
+                std::string key;
+                std::string value;
+                if (!Detail::ParseString(line, i, key))
+                {
+                    error = "Malformed request: expected a member name";
+                    return false;
+                }
+                Detail::SkipSpace(line, i);
+                if (i >= line.size() || line[i] != ':')
+                {
+                    error = "Malformed request: expected :";
+                    return false;
+                }
+                ++i;
+                Detail::SkipSpace(line, i);
+                const bool isString = i < line.size() && line[i] == '"';
+                if (isString ? !Detail::ParseString(line, i, value) : !Detail::SkipScalar(line, i))
+                {
+                    error = "Malformed request: bad value for \"" + key + "\"";
+                    return false;
+                }
+                Detail::SkipSpace(line, i);
+
+                if (key == "cmd")
+                {
+                    name = value;
+                }
+                else if (key == "label" || key == "path")
+                {
+                    argument = value;
+                }
+            }
+            if (i >= line.size())
+            {
+                error = "Malformed request: missing }";
+                return false;
+            }
+            ++i;
+            Detail::SkipSpace(line, i);
+            if (i != line.size())
+            {
+                error = "Malformed request: text after the object";
+                return false;
+            }
+            if (name.empty())
+            {
+                error = "Missing \"cmd\"";
+                return false;
+            }
+        }
+        else
+        {
+            // "mark some label": the command, then everything after it.
+            const size_t end = line.find_first_of(" \t\r\n", i);
+            name = line.substr(i, end == std::string::npos ? std::string::npos : end - i);
+            if (end != std::string::npos)
+            {
+                size_t rest = end;
+                Detail::SkipSpace(line, rest);
+                argument = line.substr(rest);
+                while (!argument.empty() && (argument.back() == ' ' || argument.back() == '\t' ||
+                                             argument.back() == '\r' || argument.back() == '\n'))
+                {
+                    argument.pop_back();
+                }
+            }
+        }
+
+        if (!ParseCommand(name, request.command))
+        {
+            error = "Unknown command: " + name + " (expected start, stop, mark, save-replay, query-stats or quit)";
+            return false;
+        }
+        request.argument = argument;
+        return true;
+    }
+
+    inline std::string Error(const std::string& message)
+    {
+        std::string json = "{\"ok\":false,\"error\":";
+        AppendString(json, message);
+        json += '}';
+        return json;
+    }
+}
+
+//======================================================================================
+// ControlResponse
+// Builds a successful response: {"ok":true, then the members in the order added.
+//======================================================================================
+class ControlResponse
+{
+public:
+    ControlResponse() : m_json("{\"ok\":true") {}
+
+    ControlResponse& AddString(const char* pName, const std::string& value)
+    {
+        AddName(pName);
+        ControlProtocol::AppendString(m_json, value);
+        return *this;
+    }
+
+    ControlResponse& AddNumber(const char* pName, uint64_t value)
+    {
+        char number[32];
+        snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(value));
+        return AddJson(pName, number);
+    }
+
+    ControlResponse& AddSeconds(const char* pName, double seconds)
+    {
+        char number[32];
+        snprintf(number, sizeof(number), "%.3f", seconds);
+        return AddJson(pName, number);
+    }
+
+    // 'json' is already formatted, e.g. an object.
+    ControlResponse& AddJson(const char* pName, const std::string& json)
+    {
+        AddName(pName);
+        m_json += json;
+        return *this;
+    }
+
+    std::string Finish() const { return m_json + "}"; }
+
+private:
+    void AddName(const char* pName)
+    {
+        m_json += ",\"";
+        m_json += pName;
+        m_json += "\":";
+    }
+
+    std::string m_json;
+};
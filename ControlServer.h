@@ -0,0 +1,349 @@
+#pragma once
+//======================================================================================
+// ControlServer.h
+// The local control socket of a --daemon recorder (--control <path>): a Unix
+// domain socket, which Windows 10 and later have as well, taking the requests of
+// ControlProtocol.h from up to MaxClients clients at once.
+//
+// Everything runs on the server's own thread: accepting, reading, parsing, and the
+// handler, which answers each request. The handler decides how much work that is;
+// the recorder's only queues the request for the daemon and waits for its answer,
+// so a client never touches the capture thread. Clients are served one request at
+// a time, in the order their lines arrive.
+//
+// A client that sends a line longer than ControlProtocol::MaxLineBytes, or doesn't
+// read its responses within a second, is disconnected. On Linux the socket is
+// only accessible to our own user.
+//======================================================================================
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ControlProtocol.h"
+#include "Trace.h"
+#include "Utf8Path.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+class ControlServer
+{
+public:
+    // Answers one request with a response line (without the newline). Called on
+    // the server thread.
+    typedef std::function<std::string(const ControlRequest&)> Handler;
+
+    static const size_t MaxClients = 8;
+
+    ControlServer() = default;
+    ~ControlServer() { Stop(); }
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    //----------------------------------------------------------------------------------
+    // [ControlServer::Start]
+    // Binds the socket up front, replacing a stale one left by an earlier run, so a
+    // bad path is reported here.
+    //----------------------------------------------------------------------------------
+    bool Start(const std::string& path, Handler handler, std::string& error)
+    {
+        Stop();
+        m_path = path;
+        m_handler = handler;
+        if (!Listen(error))
+        {
+            return false;
+        }
+        m_stopping = false;
+        m_thread = std::thread(&ControlServer::Run, this);
+        return true;
+    }
+
+    // Disconnects every client and removes the socket.
+    void Stop()
+    {
+        if (m_thread.joinable())
+        {
+            m_stopping = true;
+            m_thread.join();
+        }
+        for (Client& client : m_clients)
+        {
+            CloseSocket(client.socket);
+        }
+        m_clients.clear();
+        CloseListener();
+    }
+
+    uint64_t RequestsServed() const { return m_requests.load(std::memory_order_relaxed); }
+
+private:
+    // How often the thread checks for Stop() while nothing happens.
+    static const int PollIntervalMs = 100;
+
+#ifdef _WIN32
+    typedef SOCKET Socket;
+    typedef WSAPOLLFD PollFd;
+    static const SOCKET InvalidSocket = INVALID_SOCKET;
+    static const int SendFlags = 0;
+    static const short ReadableEvents = POLLRDNORM;
+#else
+    typedef int Socket;
+    typedef pollfd PollFd;
+    static const int InvalidSocket = -1;
+    static const int SendFlags = MSG_NOSIGNAL; // A client hanging up must not raise SIGPIPE.
+    static const short ReadableEvents = POLLIN;
+#endif
+
+    struct Client
+    {
+        Socket socket;
+        std::string pending; // Received bytes not yet ending in a newline.
+    };
+
+    void Run()
+    {
+        Trace::SetThreadName("control");
+        std::vector<PollFd> fds;
+        while (!m_stopping.load(std::memory_order_relaxed))
+        {
+            fds.assign(1 + m_clients.size(), PollFd());
+            fds[0].fd = m_listen;
+            fds[0].events = ReadableEvents;
+            for (size_t i = 0; i < m_clients.size(); ++i)
+            {
+                fds[1 + i].fd = m_clients[i].socket;
+                fds[1 + i].events = ReadableEvents;
+            }
+            if (Poll(fds.data(), fds.size(), PollIntervalMs) <= 0)
+            {
+                continue;
+            }
+
+            // Clients first, by index from the back, so closing one doesn't move the
+            // ones still to be served.
+            for (size_t i = m_clients.size(); i-- > 0; )
+            {
+                if (fds[1 + i].revents && !ServeClient(m_clients[i]))
+                {
+                    CloseSocket(m_clients[i].socket);
+                    m_clients.erase(m_clients.begin() + i);
+                }
+            }
+            if (fds[0].revents)
+            {
+                AcceptClient();
+            }
+        }
+    }
+
+    void AcceptClient()
+    {
+        Socket socket = accept(m_listen, nullptr, nullptr);
+        if (socket == InvalidSocket)
+        {
+            return;
+        }
+        SetSendTimeout(socket, 1000);
+        if (m_clients.size() >= MaxClients)
+        {
+            SendLine(socket, ControlProtocol::Error("Too many control clients"));
+            CloseSocket(socket);
+            return;
+        }
+        m_clients.push_back(Client{ socket, std::string() });
+    }
+
+    //----------------------------------------------------------------------------------
+    // [ControlServer::ServeClient]
+    // Reads what the client sent and answers every complete line. False once the
+    // client has gone or must go.
+    //----------------------------------------------------------------------------------
+    bool ServeClient(Client& client)
+    {
+        char buffer[1024];
+        const int received = recv(client.socket, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        client.pending.append(buffer, static_cast<size_t>(received));
+
+        size_t start = 0;
+        for (size_t end = client.pending.find('\n'); end != std::string::npos; end = client.pending.find('\n', start))
+        {
+            if (end - start > ControlProtocol::MaxLineBytes)
+            {
+                SendLine(client.socket, ControlProtocol::Error("Request line too long"));
+                return false;
+            }
+            const std::string line = client.pending.substr(start, end - start);
+            start = end + 1;
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
+            ControlRequest request;
+            std::string error;
+            const std::string response = ControlProtocol::ParseRequest(line, request, error)
+                                             ? m_handler(request)
+                                             : ControlProtocol::Error(error);
+            m_requests.fetch_add(1, std::memory_order_relaxed);
+            if (!SendLine(client.socket, response))
+            {
+                return false;
+            }
+        }
+        client.pending.erase(0, start);
+        if (client.pending.size() > ControlProtocol::MaxLineBytes)
+        {
+            SendLine(client.socket, ControlProtocol::Error("Request line too long"));
+            return false;
+        }
+        return true;
+    }
+
+    static bool SendLine(Socket socket, const std::string& response)
+    {
+        const std::string line = response + "\n";
+        size_t sent = 0;
+        while (sent < line.size())
+        {
+            const int chunk = send(socket, line.data() + sent, static_cast<int>(line.size() - sent), SendFlags);
+            if (chunk <= 0)
+            {
+                return false;
+            }
+            sent += static_cast<size_t>(chunk);
+        }
+        return true;
+    }
+
+#ifdef _WIN32
+    bool Listen(std::string& error)
+    {
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+        {
+            error = "Could not initialize Winsock";
+            return false;
+        }
+        m_wsaStarted = true;
+        m_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy_s(address.sun_path, m_path.c_str(), sizeof(address.sun_path) - 1);
+        DeleteFileW(Utf8ToWide(m_path).c_str());
+        if (m_path.size() >= sizeof(address.sun_path) || m_listen == INVALID_SOCKET ||
+            bind(m_listen, (sockaddr*)&address, sizeof(address)) != 0 || listen(m_listen, 4) != 0)
+        {
+            error = "Could not listen on control socket " + m_path;
+            CloseListener();
+            return false;
+        }
+        return true;
+    }
+
+    static int Poll(PollFd* pFds, size_t count, int timeoutMs)
+    {
+        return WSAPoll(pFds, static_cast<ULONG>(count), timeoutMs);
+    }
+
+    static void SetSendTimeout(Socket socket, DWORD timeoutMs)
+    {
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+    }
+
+    static void CloseSocket(Socket socket)
+    {
+        closesocket(socket);
+    }
+
+    void CloseListener()
+    {
+        if (m_listen != INVALID_SOCKET)
+        {
+            closesocket(m_listen);
+            m_listen = INVALID_SOCKET;
+            DeleteFileW(Utf8ToWide(m_path).c_str());
+        }
+        if (m_wsaStarted)
+        {
+            WSACleanup();
+            m_wsaStarted = false;
+        }
+    }
+
+    bool m_wsaStarted = false;
+#else
+    bool Listen(std::string& error)
+    {
+        m_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, m_path.c_str(), sizeof(address.sun_path) - 1);
+        unlink(m_path.c_str());
+        if (m_path.size() >= sizeof(address.sun_path) || m_listen < 0 ||
+            bind(m_listen, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            chmod(m_path.c_str(), 0600) != 0 || listen(m_listen, 4) != 0)
+        {
+            error = "Could not listen on control socket " + m_path;
+            CloseListener();
+            return false;
+        }
+        return true;
+    }
+
+    static int Poll(PollFd* pFds, size_t count, int timeoutMs)
+    {
+        return poll(pFds, static_cast<nfds_t>(count), timeoutMs);
+    }
+
+    static void SetSendTimeout(Socket socket, int timeoutMs)
+    {
+        timeval timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    static void CloseSocket(Socket socket)
+    {
+        close(socket);
+    }
+
+    void CloseListener()
+    {
+        if (m_listen >= 0)
+        {
+            close(m_listen);
+            m_listen = -1;
+            unlink(m_path.c_str());
+        }
+    }
+#endif
+
+    std::string m_path;
+    Handler m_handler;
+    Socket m_listen = InvalidSocket;
+    std::vector<Client> m_clients;
+    std::thread m_thread;
+    std::atomic<bool> m_stopping{ false };
+    std::atomic<uint64_t> m_requests{ 0 };
+};
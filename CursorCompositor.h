@@ -0,0 +1,339 @@
+#pragma once
+//======================================================================================
+// CursorCompositor.h
+// Draws the mouse pointer into captured frames. Desktop duplication hands us the
+// desktop without the pointer: its position comes with every frame and its shape
+// only when the shape changes.
+//
+// Each shape is converted once into three byte planes - color, blend weight and XOR
+// mask, per BGRA byte - which PixelKernels::BlendCursorRow composites the same way
+// whether the pointer was alpha-blended color, masked color or monochrome. Converted
+// shapes are kept in a small cache keyed by a hash of the shape, so switching between
+// the arrow, the I-beam and the resize pointers costs a lookup, not a conversion.
+// Fully transparent borders are trimmed when converting, and compositing reads and
+// writes only the pointer's bounding box clipped to the frame.
+//======================================================================================
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "PixelKernels.h"
+
+class CursorCompositor
+{
+public:
+    struct Stats
+    {
+        uint64_t shapesConverted = 0;
+        uint64_t shapeCacheHits = 0;
+    };
+
+    //----------------------------------------------------------------------------------
+    // [CursorCompositor::Update]
+    // Follows the pointer through each acquired frame's metadata. The position is
+    // only current on frames that report a pointer update; on others desktop
+    // duplication leaves it stale.
+    //----------------------------------------------------------------------------------
+    void Update(const CaptureFrameInfo& info)
+    {
+        if (info.pPointerShape)
+        {
+            SetShape(*info.pPointerShape);
+        }
+        if (info.pointerUpdated)
+        {
+            m_visible = info.pointerVisible;
+            m_x = info.pointerX;
+            m_y = info.pointerY;
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CursorCompositor::SetShape]
+    // Makes this the current shape, converting it unless it is cached. A shape we
+    // can't make sense of clears the pointer rather than drawing garbage.
+    //----------------------------------------------------------------------------------
+    bool SetShape(const PointerShape& shape)
+    {
+        if (!IsValid(shape))
+        {
+            m_current = -1;
+            return false;
+        }
+        const uint64_t hash = HashShape(shape);
+        ++m_useCounter;
+        for (size_t i = 0; i < m_cache.size(); ++i)
+        {
+            if (m_cache[i].hash == hash)
+            {
+                m_cache[i].lastUse = m_useCounter;
+                m_current = static_cast<int>(i);
+                ++m_stats.shapeCacheHits;
+                return true;
+            }
+        }
+
+        Prepared prepared;
+        Convert(shape, prepared);
+        prepared.hash = hash;
+        prepared.lastUse = m_useCounter;
+        ++m_stats.shapesConverted;
+
+        size_t slot = m_cache.size();
+        if (m_cache.size() == CacheSize)
+        {
+            slot = 0;
+            for (size_t i = 1; i < m_cache.size(); ++i)
+            {
+                slot = m_cache[i].lastUse < m_cache[slot].lastUse ? i : slot;
+            }
+            m_cache[slot] = std::move(prepared);
+        }
+        else
+        {
+            m_cache.push_back(std::move(prepared));
+        }
+        m_current = static_cast<int>(slot);
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CursorCompositor::Bounds]
+    // The part of a width x height frame the pointer covers. False if none.
+    //----------------------------------------------------------------------------------
+    bool Bounds(uint32_t width, uint32_t height, FrameRect& bounds) const
+    {
+        return Clip(FrameRect{ 0, 0, static_cast<int32_t>(width), static_cast<int32_t>(height) }, bounds);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CursorCompositor::Composite]
+    // Blends the current pointer into a BGRA image. pTopRow points at the top row of
+    // the picture; a bottom-up buffer passes its last row and a negative stride.
+    // Returns false if there is nothing to draw, otherwise the rect it touched.
+    //----------------------------------------------------------------------------------
+    bool Composite(uint8_t* pTopRow, ptrdiff_t stride, uint32_t width, uint32_t height,
+                   FrameRect* pTouched = nullptr) const
+    {
+        return CompositeRegion(pTopRow, stride,
+                               FrameRect{ 0, 0, static_cast<int32_t>(width), static_cast<int32_t>(height) }, pTouched);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CursorCompositor::CompositeRegion]
+    // Same, for a buffer holding only `region` of the frame: pRegion is the pixel at
+    // (region.left, region.top). Lets a tool convert just the pointer's surroundings.
+    //----------------------------------------------------------------------------------
+    bool CompositeRegion(uint8_t* pRegion, ptrdiff_t stride, const FrameRect& region,
+                         FrameRect* pTouched = nullptr) const
+    {
+        FrameRect clipped;
+        if (!Clip(region, clipped))
+        {
+            return false;
+        }
+        const Prepared& shape = m_cache[static_cast<size_t>(m_current)];
+        const int64_t shapeLeft = static_cast<int64_t>(m_x) + shape.offsetX;
+        const int64_t shapeTop = static_cast<int64_t>(m_y) + shape.offsetY;
+        const size_t shapeRowBytes = static_cast<size_t>(shape.width) * 4;
+        const size_t skipBytes = static_cast<size_t>(clipped.left - shapeLeft) * 4;
+        const uint32_t bytes = static_cast<uint32_t>(clipped.right - clipped.left) * 4;
+        for (int32_t y = clipped.top; y < clipped.bottom; ++y)
+        {
+            const size_t offset = static_cast<size_t>(y - shapeTop) * shapeRowBytes + skipBytes;
+            PixelKernels::BlendCursorRow(pRegion + static_cast<ptrdiff_t>(y - region.top) * stride +
+                                             static_cast<ptrdiff_t>(clipped.left - region.left) * 4,
+                                         shape.color.data() + offset, shape.weight.data() + offset,
+                                         shape.xorMask.data() + offset, bytes);
+        }
+        if (pTouched)
+        {
+            *pTouched = clipped;
+        }
+        return true;
+    }
+
+    Stats GetStats() const { return m_stats; }
+
+    // Bytes of shape data per row and number of rows, padding excluded.
+    static void ShapeExtent(const PointerShape& shape, size_t& rowBytes, uint32_t& rows)
+    {
+        const bool monochrome = shape.type == PointerShapeType::Monochrome;
+        rowBytes = monochrome ? (static_cast<size_t>(shape.width) + 7) / 8 : static_cast<size_t>(shape.width) * 4;
+        rows = monochrome ? shape.height * 2 : shape.height;
+    }
+
+    // Sane size and enough data per row; checked before anything reads the pixels.
+    static bool IsValid(const PointerShape& shape)
+    {
+        size_t rowBytes = 0;
+        uint32_t rows = 0;
+        ShapeExtent(shape, rowBytes, rows);
+        return shape.pData && shape.width > 0 && shape.height > 0 && shape.width <= 1024 && shape.height <= 1024 &&
+               shape.pitch >= rowBytes;
+    }
+
+    // FNV-1a over the type, size and every significant byte: equal for the same
+    // image whatever its row padding. Expects IsValid(shape).
+    static uint64_t HashShape(const PointerShape& shape)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](uint32_t value) {
+            for (int i = 0; i < 4; ++i)
+            {
+                hash = (hash ^ ((value >> (8 * i)) & 0xFF)) * 1099511628211ull;
+            }
+        };
+        mix(static_cast<uint32_t>(shape.type));
+        mix(shape.width);
+        mix(shape.height);
+        size_t rowBytes = 0;
+        uint32_t rows = 0;
+        ShapeExtent(shape, rowBytes, rows);
+        for (uint32_t y = 0; y < rows; ++y)
+        {
+            const uint8_t* pRow = shape.pData + static_cast<size_t>(y) * shape.pitch;
+            for (size_t i = 0; i < rowBytes; ++i)
+            {
+                hash = (hash ^ pRow[i]) * 1099511628211ull;
+            }
+        }
+        return hash;
+    }
+
+private:
+    static const size_t CacheSize = 16;
+
+    // The current pointer's visible pixels intersected with `area`.
+    bool Clip(const FrameRect& area, FrameRect& clipped) const
+    {
+        if (!m_visible || m_current < 0)
+        {
+            return false;
+        }
+        const Prepared& shape = m_cache[static_cast<size_t>(m_current)];
+        const int64_t shapeLeft = static_cast<int64_t>(m_x) + shape.offsetX;
+        const int64_t shapeTop = static_cast<int64_t>(m_y) + shape.offsetY;
+        const int64_t left = shapeLeft > area.left ? shapeLeft : area.left;
+        const int64_t top = shapeTop > area.top ? shapeTop : area.top;
+        const int64_t right = shapeLeft + shape.width < area.right ? shapeLeft + shape.width : area.right;
+        const int64_t bottom = shapeTop + shape.height < area.bottom ? shapeTop + shape.height : area.bottom;
+        if (left >= right || top >= bottom)
+        {
+            return false;
+        }
+        clipped = FrameRect{ static_cast<int32_t>(left), static_cast<int32_t>(top), static_cast<int32_t>(right),
+                             static_cast<int32_t>(bottom) };
+        return true;
+    }
+
+    // Trimmed to its visible pixels; offsetX/offsetY place it relative to the
+    // pointer position. Planes hold width * 4 bytes per row.
+    struct Prepared
+    {
+        uint64_t hash = 0;
+        uint64_t lastUse = 0;
+        int32_t offsetX = 0;
+        int32_t offsetY = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> color;
+        std::vector<uint8_t> weight;
+        std::vector<uint8_t> xorMask;
+    };
+
+    // One pixel of a shape as blend color, weight and XOR mask (BGR; alpha stays).
+    static void ShapePixel(const PointerShape& shape, uint32_t x, uint32_t y, uint8_t (&color)[4],
+                           uint8_t& weight, uint8_t (&xorMask)[4])
+    {
+        color[3] = 0;
+        xorMask[3] = 0;
+        if (shape.type == PointerShapeType::Monochrome)
+        {
+            const uint8_t bit = static_cast<uint8_t>(0x80 >> (x % 8));
+            const bool andBit = (shape.pData[static_cast<size_t>(y) * shape.pitch + x / 8] & bit) != 0;
+            const bool xorBit = (shape.pData[static_cast<size_t>(y + shape.height) * shape.pitch + x / 8] & bit) != 0;
+            // AND 0 draws black or white; AND 1 keeps the desktop or inverts it.
+            weight = andBit ? 0 : 255;
+            for (int c = 0; c < 3; ++c)
+            {
+                color[c] = !andBit && xorBit ? 255 : 0;
+                xorMask[c] = andBit && xorBit ? 255 : 0;
+            }
+            return;
+        }
+        const uint8_t* pPixel = shape.pData + static_cast<size_t>(y) * shape.pitch + static_cast<size_t>(x) * 4;
+        const bool masked = shape.type == PointerShapeType::MaskedColor;
+        const bool xorPixel = masked && pPixel[3] != 0;
+        weight = masked ? (xorPixel ? 0 : 255) : pPixel[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            color[c] = xorPixel ? 0 : pPixel[c];
+            xorMask[c] = xorPixel ? pPixel[c] : 0;
+        }
+    }
+
+    // Expects IsValid(shape).
+    static void Convert(const PointerShape& shape, Prepared& prepared)
+    {
+        // Find the visible pixels first so only their bounding box is kept.
+        uint32_t minX = shape.width;
+        uint32_t minY = shape.height;
+        uint32_t maxX = 0;
+        uint32_t maxY = 0;
+        uint8_t color[4];
+        uint8_t weight = 0;
+        uint8_t xorMask[4];
+        for (uint32_t y = 0; y < shape.height; ++y)
+        {
+            for (uint32_t x = 0; x < shape.width; ++x)
+            {
+                ShapePixel(shape, x, y, color, weight, xorMask);
+                if (weight != 0 || xorMask[0] != 0 || xorMask[1] != 0 || xorMask[2] != 0)
+                {
+                    minX = x < minX ? x : minX;
+                    minY = y < minY ? y : minY;
+                    maxX = x > maxX ? x : maxX;
+                    maxY = y > maxY ? y : maxY;
+                }
+            }
+        }
+        if (minX > maxX || minY > maxY)
+        {
+            // Nothing visible: a valid, empty pointer.
+            return;
+        }
+
+        prepared.offsetX = static_cast<int32_t>(minX);
+        prepared.offsetY = static_cast<int32_t>(minY);
+        prepared.width = maxX - minX + 1;
+        prepared.height = maxY - minY + 1;
+        const size_t planeBytes = static_cast<size_t>(prepared.width) * prepared.height * 4;
+        prepared.color.assign(planeBytes, 0);
+        prepared.weight.assign(planeBytes, 0);
+        prepared.xorMask.assign(planeBytes, 0);
+        size_t offset = 0;
+        for (uint32_t y = minY; y <= maxY; ++y)
+        {
+            for (uint32_t x = minX; x <= maxX; ++x, offset += 4)
+            {
+                ShapePixel(shape, x, y, color, weight, xorMask);
+                for (int c = 0; c < 3; ++c)
+                {
+                    prepared.color[offset + c] = color[c];
+                    prepared.weight[offset + c] = weight;
+                    prepared.xorMask[offset + c] = xorMask[c];
+                }
+            }
+        }
+    }
+
+    std::vector<Prepared> m_cache;
+    int m_current = -1;
+    uint64_t m_useCounter = 0;
+    bool m_visible = false;
+    int32_t m_x = 0;
+    int32_t m_y = 0;
+    Stats m_stats;
+};
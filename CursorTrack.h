@@ -0,0 +1,304 @@
+#pragma once
+//======================================================================================
+// CursorTrack.h
+// The ".cursor" sidecar: the mouse pointer recorded as timed metadata next to the
+// video instead of drawn into it. Burning the pointer in makes every mouse move
+// re-encode the macroblocks it crosses; kept separately, an idle desktop stays
+// pixel-identical from frame to frame and a player (or tools/CursorOverlay.cpp)
+// draws the pointer on top.
+//
+// A 16-byte header is followed by variable-size records, each starting with a
+// uint32 type and the uint32 size of the rest of the record. All fields are
+// little-endian.
+//
+//   Header:   char magic[4] = "CURS", uint32 version = 1, uint32 timescale, uint32 0
+//   Shape:    type 1. uint32 shapeId, uint32 shapeType (0 color, 1 masked color,
+//             2 monochrome), uint32 width, uint32 height, uint32 pitch,
+//             int32 hotspotX, int32 hotspotY, uint32 0, then the image: pitch bytes
+//             per row, height rows (2 * height for monochrome - see PointerShape).
+//   Position: type 2. uint64 frameIndex, int64 timestamp (timescale units),
+//             int32 x, int32 y (the image's top-left), uint32 shapeId,
+//             uint32 visible.
+//
+// Each distinct shape is written once, before the first position that uses it;
+// a position is written only for frames where the pointer moved, changed shape or
+// was shown or hidden, and holds until the next one. Records are flushed as they
+// are written, so a recording cut off by a crash keeps its pointer up to the end.
+//======================================================================================
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "CursorCompositor.h"
+#include "Utf8Path.h"
+
+namespace CursorTrack
+{
+    static const uint32_t Magic = 0x53525543u; // "CURS"
+    static const uint32_t Version = 1;
+    static const uint32_t ShapeRecord = 1;
+    static const uint32_t PositionRecord = 2;
+    static const uint32_t NoShape = ~0u;
+
+    struct Position
+    {
+        uint64_t frameIndex = 0;
+        int64_t timestamp = 0;
+        int32_t x = 0;
+        int32_t y = 0;
+        uint32_t shapeId = NoShape;
+        bool visible = false;
+    };
+
+    struct Shape
+    {
+        PointerShape info; // pData is left null; see View().
+        std::vector<uint8_t> data;
+
+        PointerShape View() const
+        {
+            PointerShape view = info;
+            view.pData = data.data();
+            return view;
+        }
+    };
+}
+
+//======================================================================================
+// CursorTrackWriter
+// Update() with every acquired frame's metadata (the shape is only valid until the
+// frame is released), then WriteFrame() for every frame that makes it into the
+// video.
+//======================================================================================
+class CursorTrackWriter
+{
+public:
+    bool Open(const std::string& path, uint32_t timescale)
+    {
+        if (!OpenUtf8(m_file, path, std::ios::binary | std::ios::trunc))
+        {
+            return false;
+        }
+        const uint32_t header[4] = { CursorTrack::Magic, CursorTrack::Version, timescale, 0 };
+        m_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        m_file.flush();
+        m_shapeHashes.clear();
+        m_current = CursorTrack::Position();
+        m_written = false;
+        return m_file.good();
+    }
+
+    bool IsOpen() const
+    {
+        return m_file.is_open();
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CursorTrackWriter::Update]
+    // Follows the pointer like CursorCompositor::Update, writing new shapes out as
+    // they appear.
+    //----------------------------------------------------------------------------------
+    void Update(const CaptureFrameInfo& info)
+    {
+        if (!m_file.is_open())
+        {
+            return;
+        }
+        if (info.pPointerShape)
+        {
+            m_current.shapeId = CursorTrack::NoShape;
+            if (CursorCompositor::IsValid(*info.pPointerShape))
+            {
+                m_current.shapeId = ShapeId(*info.pPointerShape);
+            }
+        }
+        if (info.pointerUpdated)
+        {
+            m_current.visible = info.pointerVisible;
+            m_current.x = info.pointerX;
+            m_current.y = info.pointerY;
+        }
+    }
+
+    // Records the pointer for this frame if it differs from the last one written.
+    void WriteFrame(uint64_t frameIndex, int64_t timestamp)
+    {
+        if (!m_file.is_open())
+        {
+            return;
+        }
+        if (m_written && m_current.x == m_last.x && m_current.y == m_last.y && m_current.shapeId == m_last.shapeId &&
+            m_current.visible == m_last.visible)
+        {
+            return;
+        }
+        struct Record
+        {
+            uint32_t type;
+            uint32_t size;
+            uint64_t frameIndex;
+            int64_t timestamp;
+            int32_t x;
+            int32_t y;
+            uint32_t shapeId;
+            uint32_t visible;
+        } record = { CursorTrack::PositionRecord, 32, frameIndex, timestamp, m_current.x, m_current.y,
+                     m_current.shapeId, m_current.visible ? 1u : 0u };
+        static_assert(sizeof(Record) == 40, "Cursor position records must stay 40 bytes");
+        m_file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        m_file.flush();
+        m_last = m_current;
+        m_written = true;
+    }
+
+    void Close()
+    {
+        if (m_file.is_open())
+        {
+            m_file.close();
+        }
+    }
+
+private:
+    // Index of the shape in the file, writing it first if it is new.
+    uint32_t ShapeId(const PointerShape& shape)
+    {
+        const uint64_t hash = CursorCompositor::HashShape(shape);
+        for (size_t i = 0; i < m_shapeHashes.size(); ++i)
+        {
+            if (m_shapeHashes[i] == hash)
+            {
+                return static_cast<uint32_t>(i);
+            }
+        }
+        const uint32_t id = static_cast<uint32_t>(m_shapeHashes.size());
+        m_shapeHashes.push_back(hash);
+
+        // Rows are written without their padding.
+        size_t rowBytes = 0;
+        uint32_t rows = 0;
+        CursorCompositor::ShapeExtent(shape, rowBytes, rows);
+        const uint32_t header[10] = { CursorTrack::ShapeRecord,
+                                      static_cast<uint32_t>(32 + rowBytes * rows),
+                                      id,
+                                      static_cast<uint32_t>(shape.type),
+                                      shape.width,
+                                      shape.height,
+                                      static_cast<uint32_t>(rowBytes),
+                                      static_cast<uint32_t>(shape.hotspotX),
+                                      static_cast<uint32_t>(shape.hotspotY),
+                                      0 };
+        m_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        for (uint32_t y = 0; y < rows; ++y)
+        {
+            m_file.write(reinterpret_cast<const char*>(shape.pData + static_cast<size_t>(y) * shape.pitch),
+                         static_cast<std::streamsize>(rowBytes));
+        }
+        m_file.flush();
+        return id;
+    }
+
+    std::ofstream m_file;
+    std::vector<uint64_t> m_shapeHashes;
+    CursorTrack::Position m_current;
+    CursorTrack::Position m_last;
+    bool m_written = false;
+};
+
+//======================================================================================
+// CursorTrackReader
+// Loads a whole sidecar. A record cut off at the end (a crashed recording) is
+// ignored.
+//======================================================================================
+class CursorTrackReader
+{
+public:
+    bool Open(const std::string& path, std::string& error)
+    {
+        std::ifstream file;
+        if (!OpenUtf8(file, path, std::ios::binary))
+        {
+            error = "Could not open " + path;
+            return false;
+        }
+        uint32_t header[4] = {};
+        if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != CursorTrack::Magic)
+        {
+            error = path + " is not a cursor track";
+            return false;
+        }
+        if (header[1] != CursorTrack::Version)
+        {
+            error = path + " has unsupported cursor track version " + std::to_string(header[1]);
+            return false;
+        }
+        m_timescale = header[2];
+        m_shapes.clear();
+        m_positions.clear();
+
+        uint32_t recordHeader[2];
+        std::vector<uint8_t> payload;
+        while (file.read(reinterpret_cast<char*>(recordHeader), sizeof(recordHeader)))
+        {
+            payload.resize(recordHeader[1]);
+            if (!file.read(reinterpret_cast<char*>(payload.data()), static_cast<std::streamsize>(payload.size())))
+            {
+                break;
+            }
+            if (recordHeader[0] == CursorTrack::ShapeRecord && payload.size() >= 32)
+            {
+                uint32_t fields[8];
+                memcpy(fields, payload.data(), sizeof(fields));
+                CursorTrack::Shape shape;
+                shape.info.type = static_cast<PointerShapeType>(fields[1]);
+                shape.info.width = fields[2];
+                shape.info.height = fields[3];
+                shape.info.pitch = fields[4];
+                shape.info.hotspotX = static_cast<int32_t>(fields[5]);
+                shape.info.hotspotY = static_cast<int32_t>(fields[6]);
+                shape.data.assign(payload.begin() + 32, payload.end());
+                if (fields[0] != m_shapes.size() || fields[1] > static_cast<uint32_t>(PointerShapeType::Monochrome))
+                {
+                    error = path + " has a malformed shape record";
+                    return false;
+                }
+                size_t rowBytes = 0;
+                uint32_t rows = 0;
+                CursorCompositor::ShapeExtent(shape.info, rowBytes, rows);
+                if (!CursorCompositor::IsValid(shape.View()) || shape.data.size() < static_cast<size_t>(shape.info.pitch) * rows)
+                {
+                    error = path + " has a malformed shape record";
+                    return false;
+                }
+                m_shapes.push_back(std::move(shape));
+            }
+            else if (recordHeader[0] == CursorTrack::PositionRecord && payload.size() >= 32)
+            {
+                CursorTrack::Position position;
+                memcpy(&position.frameIndex, &payload[0], 8);
+                memcpy(&position.timestamp, &payload[8], 8);
+                memcpy(&position.x, &payload[16], 4);
+                memcpy(&position.y, &payload[20], 4);
+                memcpy(&position.shapeId, &payload[24], 4);
+                uint32_t visible = 0;
+                memcpy(&visible, &payload[28], 4);
+                position.visible = visible != 0;
+                m_positions.push_back(position);
+            }
+            // Unknown record types are skipped, so later versions can add some.
+        }
+        return true;
+    }
+
+    uint32_t Timescale() const { return m_timescale; }
+    const std::vector<CursorTrack::Shape>& Shapes() const { return m_shapes; }
+    const std::vector<CursorTrack::Position>& Positions() const { return m_positions; }
+
+private:
+    uint32_t m_timescale = 0;
+    std::vector<CursorTrack::Shape> m_shapes;
+    std::vector<CursorTrack::Position> m_positions;
+};
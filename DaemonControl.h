@@ -0,0 +1,440 @@
+#pragma once
+//======================================================================================
+// DaemonControl.h
+// What a --daemon run does with its requests (ControlProtocol.h), apart from the
+// recording itself: the queue the control socket and the standard input feed, and
+// ServeDaemon(), which keeps the next recording set up and parked on a StartGate,
+// starts, marks, saves and stops it, and answers.
+//
+// The recording is behind DaemonRecorder, so the same request handling drives the
+// Recorder in main.cpp and the synthetic pipeline of bench/ControlBench.cpp, which
+// runs it on Linux with a local client.
+//======================================================================================
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ControlProtocol.h"
+#include "HealthCounters.h"
+#include "Log.h"
+#include "RecorderOptions.h"
+#include "ReplayBuffer.h"
+#include "StartGate.h"
+#include "Utf8Path.h"
+
+//--------------------------------------------------------------------------------------
+// [DaemonCommand]
+// A control request on its way to the daemon, and where its answer goes.
+//--------------------------------------------------------------------------------------
+struct DaemonCommand
+{
+    ControlRequest request;
+    std::shared_ptr<std::promise<std::string>> pReply; // Null for a wake-up.
+
+    void Answer(const std::string& response)
+    {
+        if (pReply)
+        {
+            pReply->set_value(response);
+            pReply.reset();
+        }
+    }
+};
+
+//======================================================================================
+// CommandQueue
+// Requests for a --daemon run, from the control socket (ControlServer.h) or the
+// standard input, one per line. Both are read on threads of their own, which wait
+// for the daemon's answer, so neither ever holds up a recording.
+//======================================================================================
+class CommandQueue
+{
+public:
+    // Queues a command without a request, which only wakes Wait().
+    void Wake() { Push(DaemonCommand()); }
+
+    void Push(DaemonCommand command)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_closed)
+        {
+            command.Answer(ControlProtocol::Error("The recorder is shutting down"));
+            return;
+        }
+        m_commands.push_back(std::move(command));
+        m_changed.notify_one();
+    }
+
+    void Wait(DaemonCommand& command)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() { return !m_commands.empty(); });
+        command = std::move(m_commands.front());
+        m_commands.pop_front();
+    }
+
+    // Answers what is still queued, and everything pushed from now on, with an error.
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        for (DaemonCommand& command : m_commands)
+        {
+            command.Answer(ControlProtocol::Error("The recorder is shutting down"));
+        }
+        m_commands.clear();
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CommandQueue::Submit]
+    // Queues a request and waits for the daemon's answer. A stop is answered once
+    // the file is complete, which can take a moment.
+    //----------------------------------------------------------------------------------
+    std::string Submit(const ControlRequest& request)
+    {
+        DaemonCommand command;
+        command.request = request;
+        command.pReply = std::make_shared<std::promise<std::string>>();
+        std::future<std::string> reply = command.pReply->get_future();
+        Push(std::move(command));
+        if (reply.wait_for(std::chrono::seconds(30)) != std::future_status::ready)
+        {
+            return ControlProtocol::Error("The recorder did not answer in time");
+        }
+        try
+        {
+            return reply.get();
+        }
+        catch (const std::future_error&)
+        {
+            return ControlProtocol::Error("The request was dropped"); // Never answered.
+        }
+    }
+
+    // One line as typed on the standard input: the answer, or why it isn't a request.
+    std::string SubmitLine(const std::string& line)
+    {
+        ControlRequest request;
+        std::string error;
+        return ControlProtocol::ParseRequest(line, request, error) ? Submit(request) : ControlProtocol::Error(error);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<DaemonCommand> m_commands;
+    bool m_closed = false;
+};
+
+//======================================================================================
+// DaemonRecorder
+// One recording as ServeDaemon() drives it. Prepare() and Discard() are called on
+// the daemon's thread and Record() on a thread of its own; Health() and SaveReplay()
+// are called on the daemon's thread while Record() runs.
+//======================================================================================
+class DaemonRecorder
+{
+public:
+    enum class Result
+    {
+        Recorded,  // Started, and finished when stopped or after its frames.
+        Cancelled, // Stopped before it was started.
+        Failed,
+    };
+
+    virtual ~DaemonRecorder() = default;
+
+    // Sets up what has to be set up before the recording thread starts.
+    virtual bool Prepare() = 0;
+
+    // Sets up the rest, waits on 'gate' and records until the gate is stopped or
+    // RecorderOptions::FramesToRecord() frames are in.
+    virtual Result Record(StartGate& gate) = 0;
+
+    // Frame and queue counters so far; FramesWritten is the recording's position.
+    virtual HealthCounters::Snapshot Health() const = 0;
+
+    // Writes the last --replay-seconds to 'path' as MPEG-TS.
+    virtual bool SaveReplay(const std::string& path, ReplayBuffer::Saved& saved, std::string& error) = 0;
+
+    // Removes the files of a recording cancelled before it started.
+    virtual void Discard() = 0;
+};
+
+// Makes the recorder for one recording of a --daemon run from its options.
+typedef std::function<std::unique_ptr<DaemonRecorder>(const RecorderOptions&)> DaemonRecorderFactory;
+
+//--------------------------------------------------------------------------------------
+// [DaemonRecording]
+// The recording a --daemon run has set up, and the answers to the requests about
+// it that don't start or stop it.
+//--------------------------------------------------------------------------------------
+struct DaemonRecording
+{
+    RecorderOptions options;
+    DaemonRecorder* pRecorder = nullptr;
+    StartGate* pGate = nullptr;
+    bool started = false;
+    bool stopping = false;
+    bool setupFailed = false;
+    uint32_t replays = 0;
+    std::ofstream marks;
+
+    const char* State() const
+    {
+        if (setupFailed) return "failed";
+        if (stopping) return "stopping";
+        if (started) return "recording";
+        return (pGate && pGate->IsReady()) ? "ready" : "preparing";
+    }
+
+    std::string QueryStats(uint32_t recordingsDone) const
+    {
+        ControlResponse response;
+        response.AddString("state", State()).AddString("recording", options.outputPath)
+                .AddNumber("recordings", recordingsDone);
+        if (pRecorder)
+        {
+            const HealthCounters::Snapshot health = pRecorder->Health();
+            std::string counters;
+            HealthCounters::FormatCounters(health, counters);
+            response.AddSeconds("seconds", (double)health[HealthCounter::FramesWritten] / options.fps)
+                    .AddJson("counters", counters);
+        }
+        return response.Finish();
+    }
+
+    // Notes the position in "<output>.marks": frame, seconds, label, tab-separated.
+    std::string Mark(const std::string& label)
+    {
+        if (!started || stopping)
+        {
+            return ControlProtocol::Error("Not recording");
+        }
+        const uint64_t frame = pRecorder->Health()[HealthCounter::FramesWritten];
+        const double seconds = (double)frame / options.fps;
+        if (!marks.is_open())
+        {
+            OpenUtf8(marks, options.outputPath + ".marks", std::ios::trunc);
+        }
+        std::string line = label; // One mark per line.
+        std::replace_if(line.begin(), line.end(), [](char c) { return c == '\n' || c == '\r' || c == '\t'; }, ' ');
+        char position[64];
+        snprintf(position, sizeof(position), "%llu\t%.3f\t", (unsigned long long)frame, seconds);
+        marks << position << line << "\n";
+        marks.flush();
+        if (!marks)
+        {
+            return ControlProtocol::Error("Could not write " + options.outputPath + ".marks");
+        }
+        LOG_INFO("Mark at {} s: {}", seconds, label);
+        return ControlResponse().AddNumber("frame", frame).AddSeconds("seconds", seconds).Finish();
+    }
+
+    std::string SaveReplay(const std::string& requestedPath)
+    {
+        if (!started || stopping)
+        {
+            return ControlProtocol::Error("Not recording");
+        }
+        const std::string path = requestedPath.empty() ? PathForReplay(options.outputPath, replays + 1) : requestedPath;
+        ReplayBuffer::Saved saved;
+        std::string error;
+        if (!pRecorder->SaveReplay(path, saved, error))
+        {
+            return ControlProtocol::Error(error);
+        }
+        ++replays;
+        LOG_INFO("Saved the last {} s to {}", saved.seconds, path);
+        return ControlResponse().AddString("path", path).AddNumber("frames", saved.frames)
+                                .AddNumber("bytes", saved.bytes).AddSeconds("seconds", saved.seconds).Finish();
+    }
+};
+
+//--------------------------------------------------------------------------------------
+// [ServeDaemon]
+// Keeps the next recording set up and parked on a StartGate, so a "start" only has
+// to capture the first frame, and serves 'commands' until "quit". Only one desktop
+// duplication of a monitor can exist, so the next recording is set up once the
+// previous one has finished. False if a recording that was started failed.
+//--------------------------------------------------------------------------------------
+inline bool ServeDaemon(const RecorderOptions& options, CommandQueue& commands,
+                        const DaemonRecorderFactory& makeRecorder)
+{
+    bool succeeded = true;
+    uint32_t recordingsDone = 0;
+    DaemonCommand pendingStart; // A start that came while no recording could be set up.
+    bool quit = false;
+    while (!quit)
+    {
+        DaemonRecording recording;
+        recording.options = options;
+        recording.options.outputPath = PathForRecording(options.outputPath, recordingsDone + 1);
+        if (!options.captureTracePath.empty())
+        {
+            recording.options.captureTracePath = PathForRecording(options.captureTracePath, recordingsDone + 1);
+        }
+
+        std::unique_ptr<DaemonRecorder> pRecorder = makeRecorder(recording.options);
+        StartGate gate;
+        recording.pRecorder = pRecorder.get();
+        recording.pGate = &gate;
+        recording.setupFailed = !pRecorder->Prepare();
+        DaemonRecorder::Result result =
+            recording.setupFailed ? DaemonRecorder::Result::Failed : DaemonRecorder::Result::Recorded;
+        std::vector<DaemonCommand> waitingForEnd; // Stops, answered once the file is complete.
+        if (!recording.setupFailed)
+        {
+            std::atomic<bool> finished(false);
+            std::thread thread([&]()
+            {
+                result = pRecorder->Record(gate);
+                finished = true;
+                commands.Wake();
+            });
+
+            // Serve requests until this recording has finished.
+            while (!finished)
+            {
+                DaemonCommand command;
+                if (pendingStart.pReply)
+                {
+                    command = std::move(pendingStart);
+                }
+                else
+                {
+                    commands.Wait(command);
+                }
+                if (!command.pReply)
+                {
+                    continue;
+                }
+
+                const ControlRequest& request = command.request;
+                switch (request.command)
+                {
+                case ControlCommand::Start:
+                    if (recording.started || quit)
+                    {
+                        command.Answer(ControlProtocol::Error(quit ? std::string("The recorder is shutting down")
+                                                                   : "Already recording " + recording.options.outputPath));
+                        break;
+                    }
+                    gate.Start();
+                    recording.started = true;
+                    LOG_INFO("Recording to {}", recording.options.outputPath);
+                    command.Answer(ControlResponse().AddString("recording", recording.options.outputPath).Finish());
+                    break;
+                case ControlCommand::Stop:
+                    if (!recording.started)
+                    {
+                        command.Answer(ControlProtocol::Error("Not recording"));
+                        break;
+                    }
+                    gate.Stop();
+                    recording.stopping = true;
+                    waitingForEnd.push_back(std::move(command));
+                    break;
+                case ControlCommand::Mark:
+                    command.Answer(recording.Mark(request.argument));
+                    break;
+                case ControlCommand::SaveReplay:
+                    command.Answer(recording.SaveReplay(request.argument));
+                    break;
+                case ControlCommand::QueryStats:
+                    command.Answer(recording.QueryStats(recordingsDone));
+                    break;
+                case ControlCommand::Quit:
+                    gate.Stop();
+                    recording.stopping = recording.started;
+                    quit = true;
+                    waitingForEnd.push_back(std::move(command));
+                    break;
+                }
+            }
+            thread.join();
+        }
+
+        std::string response;
+        if (recording.started)
+        {
+            const uint64_t frames = pRecorder->Health()[HealthCounter::FramesWritten];
+            if (result == DaemonRecorder::Result::Failed)
+            {
+                LOG_ERROR("Recording {} failed", recording.options.outputPath);
+                succeeded = false;
+                response = ControlProtocol::Error("Recording " + recording.options.outputPath + " failed");
+            }
+            else
+            {
+                LOG_INFO("Recorded {} frames to {}", frames, recording.options.outputPath);
+                response = ControlResponse().AddString("recording", recording.options.outputPath)
+                                            .AddNumber("frames", frames)
+                                            .AddSeconds("seconds", (double)frames / options.fps).Finish();
+            }
+            ++recordingsDone;
+        }
+        else if (result == DaemonRecorder::Result::Cancelled)
+        {
+            // Cancelled before it started: remove the empty files and reuse the number.
+            pRecorder->Discard();
+            response = ControlResponse().Finish();
+        }
+        else if (result == DaemonRecorder::Result::Failed)
+        {
+            // E.g. the desktop is locked. Try again on the next request rather than in
+            // a loop; a start goes through as soon as a recording could be set up.
+            recording.setupFailed = true;
+            LOG_ERROR("Could not set up recording {}; retrying on the next request.", recording.options.outputPath);
+            if (pendingStart.pReply)
+            {
+                pendingStart.Answer(ControlProtocol::Error("Could not set up a recording"));
+            }
+            while (!quit)
+            {
+                DaemonCommand command;
+                commands.Wait(command);
+                if (!command.pReply)
+                {
+                    continue;
+                }
+                if (command.request.command == ControlCommand::QueryStats)
+                {
+                    command.Answer(recording.QueryStats(recordingsDone));
+                    continue;
+                }
+                if (command.request.command == ControlCommand::Start)
+                {
+                    pendingStart = std::move(command);
+                }
+                else if (command.request.command == ControlCommand::Quit)
+                {
+                    quit = true;
+                    command.Answer(ControlResponse().Finish());
+                }
+                else
+                {
+                    command.Answer(ControlProtocol::Error("No recording is set up; retrying"));
+                }
+                break;
+            }
+        }
+        for (DaemonCommand& command : waitingForEnd)
+        {
+            command.Answer(response.empty() ? ControlResponse().Finish() : response);
+        }
+    }
+    return succeeded;
+}
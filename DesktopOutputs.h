@@ -0,0 +1,259 @@
+#pragma once
+//======================================================================================
+// DesktopOutputs.h
+// The monitors attached to the desktop, across all adapters, and opening one of
+// them for desktop duplication. Outputs are numbered in enumeration order (adapter
+// by adapter), which is the order --outputs refers to.
+//
+// Each opened output gets a D3D11 device of its own on the adapter it belongs to,
+// so recorders on different threads never share an immediate context. Creating a
+// device is by far the slowest step (tens to hundreds of milliseconds, more when
+// a discrete GPU has to wake up), so it is separate from duplicating: a caller
+// trying several outputs on one adapter creates its device once (AdapterDevice).
+//======================================================================================
+#include <windows.h>
+#include <d3d11.h>
+#include <dxgi1_2.h>
+#include <cstdint>
+#include <vector>
+
+#include "ComHelpers.h"
+
+struct DesktopOutput
+{
+    UINT adapterIndex;
+    UINT outputIndex;
+    RECT desktopCoordinates;
+    // Identifies the adapter until it or its driver restarts, unlike its index.
+    uint64_t adapterLuid;
+};
+
+inline uint64_t PackLuid(const LUID& luid)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(luid.HighPart)) << 32) | luid.LowPart;
+}
+
+//--------------------------------------------------------------------------------------
+// [EnumerateDesktopOutputs]
+// Every output attached to the desktop. Adapters or outputs that fail to enumerate
+// are skipped.
+//--------------------------------------------------------------------------------------
+inline HRESULT EnumerateDesktopOutputs(std::vector<DesktopOutput>& outputs)
+{
+    outputs.clear();
+    IDXGIFactory1* pFactory = nullptr;
+    HRESULT hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void**)(&pFactory));
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    for (UINT i = 0; ; ++i)
+    {
+        IDXGIAdapter1* pAdapter = nullptr;
+        hr = pFactory->EnumAdapters1(i, &pAdapter);
+        if (hr == DXGI_ERROR_NOT_FOUND)
+        {
+            break;
+        }
+        if (FAILED(hr))
+        {
+            continue;
+        }
+        DXGI_ADAPTER_DESC1 adapterDesc;
+        const uint64_t luid = SUCCEEDED(pAdapter->GetDesc1(&adapterDesc)) ? PackLuid(adapterDesc.AdapterLuid) : 0;
+        for (UINT j = 0; ; ++j)
+        {
+            IDXGIOutput* pOutput = nullptr;
+            hr = pAdapter->EnumOutputs(j, &pOutput);
+            if (hr == DXGI_ERROR_NOT_FOUND)
+            {
+                break;
+            }
+            if (FAILED(hr))
+            {
+                continue;
+            }
+            DXGI_OUTPUT_DESC desc;
+            if (SUCCEEDED(pOutput->GetDesc(&desc)) && desc.AttachedToDesktop)
+            {
+                outputs.push_back(DesktopOutput{ i, j, desc.DesktopCoordinates, luid });
+            }
+            SafeRelease(&pOutput);
+        }
+        SafeRelease(&pAdapter);
+    }
+
+    SafeRelease(&pFactory);
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// [FindDesktopOutput]
+// One output by its adapter's LUID and its number on that adapter, without
+// enumerating the others. DXGI_ERROR_NOT_FOUND if the adapter is gone or the output
+// isn't attached to the desktop (any more).
+//--------------------------------------------------------------------------------------
+inline HRESULT FindDesktopOutput(uint64_t adapterLuid, UINT outputIndex, DesktopOutput& output)
+{
+    IDXGIFactory1* pFactory = nullptr;
+    HRESULT hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void**)(&pFactory));
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = DXGI_ERROR_NOT_FOUND;
+    bool adapterFound = false;
+    for (UINT i = 0; !adapterFound; ++i)
+    {
+        IDXGIAdapter1* pAdapter = nullptr;
+        const HRESULT enumHr = pFactory->EnumAdapters1(i, &pAdapter);
+        if (enumHr == DXGI_ERROR_NOT_FOUND)
+        {
+            break;
+        }
+        DXGI_ADAPTER_DESC1 adapterDesc;
+        if (SUCCEEDED(enumHr) && SUCCEEDED(pAdapter->GetDesc1(&adapterDesc)) &&
+            PackLuid(adapterDesc.AdapterLuid) == adapterLuid)
+        {
+            adapterFound = true;
+            IDXGIOutput* pOutput = nullptr;
+            DXGI_OUTPUT_DESC desc;
+            if (SUCCEEDED(pAdapter->EnumOutputs(outputIndex, &pOutput)) && SUCCEEDED(pOutput->GetDesc(&desc)) &&
+                desc.AttachedToDesktop)
+            {
+                output = DesktopOutput{ i, outputIndex, desc.DesktopCoordinates, adapterLuid };
+                hr = S_OK;
+            }
+            SafeRelease(&pOutput);
+        }
+        SafeRelease(&pAdapter);
+    }
+
+    SafeRelease(&pFactory);
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [CreateAdapterDevice]
+// A D3D11 device, able to drive the video encoder, on the given adapter.
+//--------------------------------------------------------------------------------------
+inline HRESULT CreateAdapterDevice(UINT adapterIndex, ID3D11Device** ppDevice, ID3D11DeviceContext** ppContext)
+{
+    *ppDevice = nullptr;
+    *ppContext = nullptr;
+
+    IDXGIFactory1* pFactory = nullptr;
+    IDXGIAdapter1* pAdapter = nullptr;
+    HRESULT hr = S_OK;
+    do
+    {
+        hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void**)(&pFactory));
+        if (FAILED(hr)) break;
+        hr = pFactory->EnumAdapters1(adapterIndex, &pAdapter);
+        if (FAILED(hr)) break;
+        hr = D3D11CreateDevice(pAdapter, D3D_DRIVER_TYPE_UNKNOWN, NULL, D3D11_CREATE_DEVICE_VIDEO_SUPPORT, NULL, 0,
+                               D3D11_SDK_VERSION, ppDevice, NULL, ppContext);
+    } while (false);
+
+    SafeRelease(&pAdapter);
+    SafeRelease(&pFactory);
+    return hr;
+}
+
+//======================================================================================
+// AdapterDevice
+// The device for the adapter asked for last, created on first use and kept while
+// outputs on that adapter are tried, so failed attempts don't each pay for one.
+//======================================================================================
+class AdapterDevice
+{
+public:
+    ~AdapterDevice() { Reset(); }
+
+    // S_OK when a device was created, S_FALSE when the one held is on that adapter.
+    HRESULT Open(UINT adapterIndex)
+    {
+        if (m_pDevice && m_adapterIndex == adapterIndex)
+        {
+            return S_FALSE;
+        }
+        Reset();
+        const HRESULT hr = CreateAdapterDevice(adapterIndex, &m_pDevice, &m_pContext);
+        m_adapterIndex = adapterIndex;
+        return hr;
+    }
+
+    void Reset()
+    {
+        SafeRelease(&m_pContext);
+        SafeRelease(&m_pDevice);
+    }
+
+    ID3D11Device* Device() const { return m_pDevice; }
+    ID3D11DeviceContext* Context() const { return m_pContext; }
+
+private:
+    ID3D11Device* m_pDevice = nullptr;
+    ID3D11DeviceContext* m_pContext = nullptr;
+    UINT m_adapterIndex = 0;
+};
+
+//--------------------------------------------------------------------------------------
+// [DuplicateDesktopOutput]
+// Duplicates the output with a device created on its adapter.
+//--------------------------------------------------------------------------------------
+inline HRESULT DuplicateDesktopOutput(const DesktopOutput& output, ID3D11Device* pDevice,
+                                      IDXGIOutputDuplication** ppDuplication)
+{
+    *ppDuplication = nullptr;
+
+    IDXGIFactory1* pFactory = nullptr;
+    IDXGIAdapter1* pAdapter = nullptr;
+    IDXGIOutput* pOutput = nullptr;
+    IDXGIOutput1* pOutput1 = nullptr;
+
+    HRESULT hr = S_OK;
+    do
+    {
+        hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void**)(&pFactory));
+        if (FAILED(hr)) break;
+        hr = pFactory->EnumAdapters1(output.adapterIndex, &pAdapter);
+        if (FAILED(hr)) break;
+        hr = pAdapter->EnumOutputs(output.outputIndex, &pOutput);
+        if (FAILED(hr)) break;
+        hr = pOutput->QueryInterface(__uuidof(IDXGIOutput1), (void**)&pOutput1);
+        if (FAILED(hr)) break;
+        hr = pOutput1->DuplicateOutput(pDevice, ppDuplication);
+    } while (false);
+
+    SafeRelease(&pOutput1);
+    SafeRelease(&pOutput);
+    SafeRelease(&pAdapter);
+    SafeRelease(&pFactory);
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [OpenDesktopOutput]
+// Creates a device on the output's adapter and duplicates the output with it. On
+// failure nothing is returned.
+//--------------------------------------------------------------------------------------
+inline HRESULT OpenDesktopOutput(const DesktopOutput& output, ID3D11Device** ppDevice, ID3D11DeviceContext** ppContext,
+                                 IDXGIOutputDuplication** ppDuplication)
+{
+    *ppDuplication = nullptr;
+    HRESULT hr = CreateAdapterDevice(output.adapterIndex, ppDevice, ppContext);
+    if (SUCCEEDED(hr))
+    {
+        hr = DuplicateDesktopOutput(output, *ppDevice, ppDuplication);
+    }
+    if (FAILED(hr))
+    {
+        SafeRelease(ppDuplication);
+        SafeRelease(ppContext);
+        SafeRelease(ppDevice);
+    }
+    return hr;
+}
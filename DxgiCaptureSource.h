@@ -0,0 +1,328 @@
+#pragma once
+//======================================================================================
+// DxgiCaptureSource.h
+// The live desktop through the DXGI Desktop Duplication API, behind the
+// CaptureSource interface.
+//
+// Each mapped frame is copied into a staging texture the CPU can read, created
+// once (or by Prepare()) and kept while the desktop's size and format stay the
+// same. The copy is flushed before mapping; without that, Map can hand back a
+// black image because the GPU has not run the copy yet. Dirty and move rects come
+// straight from the duplication's frame metadata, and the pointer shape from
+// GetFramePointerShape whenever the frame says it changed.
+//======================================================================================
+#include <windows.h>
+#include <d3d11.h>
+#include <dxgi1_2.h>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "ComHelpers.h"
+
+class DxgiCaptureSource : public CaptureSource
+{
+public:
+    // Takes its own references on all three.
+    DxgiCaptureSource(ID3D11Device* pDevice, ID3D11DeviceContext* pContext, IDXGIOutputDuplication* pDuplication) :
+        m_pDevice(pDevice),
+        m_pContext(pContext),
+        m_pDuplication(pDuplication),
+        m_pDesktopResource(nullptr),
+        m_pStagingTexture(nullptr),
+        m_mapped(false)
+    {
+        m_pDevice->AddRef();
+        m_pContext->AddRef();
+        m_pDuplication->AddRef();
+        DXGI_OUTDUPL_DESC desc;
+        m_pDuplication->GetDesc(&desc);
+        m_width = desc.ModeDesc.Width;
+        m_height = desc.ModeDesc.Height;
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        m_qpcFrequency = frequency.QuadPart;
+    }
+
+    ~DxgiCaptureSource()
+    {
+        ReleaseFrame();
+        SafeRelease(&m_pStagingTexture);
+        SafeRelease(&m_pDuplication);
+        SafeRelease(&m_pContext);
+        SafeRelease(&m_pDevice);
+    }
+
+    uint32_t Width() const override { return m_width; }
+    uint32_t Height() const override { return m_height; }
+
+    CaptureResult AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info) override;
+    bool MapFrame(MappedFrame& mapped) override;
+    void ReleaseFrame() override;
+    bool Prepare() override;
+
+private:
+    HRESULT CreateStagingTexture(const D3D11_TEXTURE2D_DESC& desktopDesc);
+    HRESULT ReadMetadata(const DXGI_OUTDUPL_FRAME_INFO& frameInfo);
+    HRESULT ReadPointerShape(const DXGI_OUTDUPL_FRAME_INFO& frameInfo);
+
+    ID3D11Device* m_pDevice;
+    ID3D11DeviceContext* m_pContext;
+    IDXGIOutputDuplication* m_pDuplication;
+    UINT m_width;
+    UINT m_height;
+    LONGLONG m_qpcFrequency;
+
+    // The frame currently held, between AcquireFrame and ReleaseFrame, and the
+    // texture it is read back through.
+    IDXGIResource* m_pDesktopResource;
+    ID3D11Texture2D* m_pStagingTexture;
+    bool m_mapped;
+
+    // Metadata of the held frame, converted to CaptureSource's types.
+    std::vector<BYTE> m_metadata;
+    std::vector<FrameRect> m_dirty;
+    std::vector<FrameMoveRect> m_moves;
+    std::vector<BYTE> m_pointerShapeBuffer;
+    PointerShape m_pointerShape;
+};
+
+//--------------------------------------------------------------------------------------
+// [DxgiCaptureSource::AcquireFrame]
+//--------------------------------------------------------------------------------------
+inline CaptureResult DxgiCaptureSource::AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info)
+{
+    DXGI_OUTDUPL_FRAME_INFO frameInfo;
+    HRESULT hr = m_pDuplication->AcquireNextFrame(timeoutMs, &frameInfo, &m_pDesktopResource);
+    if (hr == DXGI_ERROR_WAIT_TIMEOUT)
+    {
+        return CaptureResult::Timeout;
+    }
+    if (hr == DXGI_ERROR_ACCESS_LOST)
+    {
+        return CaptureResult::AccessLost;
+    }
+    if (FAILED(hr))
+    {
+        return CaptureResult::Error;
+    }
+
+    // Rects are a best effort: without them the whole frame counts as changed.
+    m_dirty.clear();
+    m_moves.clear();
+    if (frameInfo.TotalMetadataBufferSize > 0 && FAILED(ReadMetadata(frameInfo)))
+    {
+        m_moves.clear();
+        m_dirty.assign(1, FrameRect{ 0, 0, static_cast<int32_t>(m_width), static_cast<int32_t>(m_height) });
+    }
+
+    info = CaptureFrameInfo();
+    // LastPresentTime is a QPC value; split the conversion so it cannot overflow.
+    const LONGLONG presentTime = frameInfo.LastPresentTime.QuadPart;
+    info.timestamp = presentTime / m_qpcFrequency * 10000000 + presentTime % m_qpcFrequency * 10000000 / m_qpcFrequency;
+    info.imageUpdated = presentTime != 0;
+    info.accumulatedFrames = frameInfo.AccumulatedFrames;
+    info.pDirtyRects = m_dirty.empty() ? nullptr : m_dirty.data();
+    info.dirtyRectCount = static_cast<uint32_t>(m_dirty.size());
+    info.pMoveRects = m_moves.empty() ? nullptr : m_moves.data();
+    info.moveRectCount = static_cast<uint32_t>(m_moves.size());
+    info.pointerUpdated = frameInfo.LastMouseUpdateTime.QuadPart != 0;
+    info.pointerVisible = frameInfo.PointerPosition.Visible != FALSE;
+    info.pointerX = frameInfo.PointerPosition.Position.x;
+    info.pointerY = frameInfo.PointerPosition.Position.y;
+    // Without a shape the pointer just keeps its previous one.
+    if (frameInfo.PointerShapeBufferSize > 0 && SUCCEEDED(ReadPointerShape(frameInfo)))
+    {
+        info.pPointerShape = &m_pointerShape;
+    }
+    return CaptureResult::Ok;
+}
+
+//--------------------------------------------------------------------------------------
+// [DxgiCaptureSource::ReadMetadata]
+// Move rects come first in the metadata buffer, dirty rects after them.
+//--------------------------------------------------------------------------------------
+inline HRESULT DxgiCaptureSource::ReadMetadata(const DXGI_OUTDUPL_FRAME_INFO& frameInfo)
+{
+    if (m_metadata.size() < frameInfo.TotalMetadataBufferSize)
+    {
+        m_metadata.resize(frameInfo.TotalMetadataBufferSize);
+    }
+
+    UINT movesBytes = 0;
+    HRESULT hr = m_pDuplication->GetFrameMoveRects(static_cast<UINT>(m_metadata.size()),
+        reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(m_metadata.data()), &movesBytes);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    const DXGI_OUTDUPL_MOVE_RECT* pMoves = reinterpret_cast<const DXGI_OUTDUPL_MOVE_RECT*>(m_metadata.data());
+    for (UINT i = 0; i < movesBytes / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++i)
+    {
+        const RECT& rect = pMoves[i].DestinationRect;
+        m_moves.push_back(FrameMoveRect{ pMoves[i].SourcePoint.x, pMoves[i].SourcePoint.y,
+                                         FrameRect{ rect.left, rect.top, rect.right, rect.bottom } });
+    }
+
+    UINT dirtyBytes = 0;
+    hr = m_pDuplication->GetFrameDirtyRects(static_cast<UINT>(m_metadata.size() - movesBytes),
+        reinterpret_cast<RECT*>(m_metadata.data() + movesBytes), &dirtyBytes);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    const RECT* pDirty = reinterpret_cast<const RECT*>(m_metadata.data() + movesBytes);
+    for (UINT i = 0; i < dirtyBytes / sizeof(RECT); ++i)
+    {
+        m_dirty.push_back(FrameRect{ pDirty[i].left, pDirty[i].top, pDirty[i].right, pDirty[i].bottom });
+    }
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// [DxgiCaptureSource::ReadPointerShape]
+// A monochrome shape's height covers both of its masks; ours counts image rows.
+//--------------------------------------------------------------------------------------
+inline HRESULT DxgiCaptureSource::ReadPointerShape(const DXGI_OUTDUPL_FRAME_INFO& frameInfo)
+{
+    if (m_pointerShapeBuffer.size() < frameInfo.PointerShapeBufferSize)
+    {
+        m_pointerShapeBuffer.resize(frameInfo.PointerShapeBufferSize);
+    }
+
+    UINT requiredBytes = 0;
+    DXGI_OUTDUPL_POINTER_SHAPE_INFO shapeInfo;
+    HRESULT hr = m_pDuplication->GetFramePointerShape(static_cast<UINT>(m_pointerShapeBuffer.size()),
+        m_pointerShapeBuffer.data(), &requiredBytes, &shapeInfo);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_pointerShape = PointerShape();
+    m_pointerShape.height = shapeInfo.Height;
+    switch (shapeInfo.Type)
+    {
+    case DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR:
+        m_pointerShape.type = PointerShapeType::Color;
+        break;
+    case DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MASKED_COLOR:
+        m_pointerShape.type = PointerShapeType::MaskedColor;
+        break;
+    case DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME:
+        m_pointerShape.type = PointerShapeType::Monochrome;
+        m_pointerShape.height = shapeInfo.Height / 2;
+        break;
+    default:
+        return E_UNEXPECTED;
+    }
+    m_pointerShape.width = shapeInfo.Width;
+    m_pointerShape.pitch = shapeInfo.Pitch;
+    m_pointerShape.hotspotX = shapeInfo.HotSpot.x;
+    m_pointerShape.hotspotY = shapeInfo.HotSpot.y;
+    m_pointerShape.pData = m_pointerShapeBuffer.data();
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// [DxgiCaptureSource::MapFrame]
+//--------------------------------------------------------------------------------------
+inline bool DxgiCaptureSource::MapFrame(MappedFrame& mapped)
+{
+    if (!m_pDesktopResource)
+    {
+        return false;
+    }
+
+    HRESULT hr = S_OK;
+    ID3D11Texture2D* pDesktopTexture = nullptr;
+    do
+    {
+        hr = m_pDesktopResource->QueryInterface(IID_PPV_ARGS(&pDesktopTexture));
+        if (FAILED(hr)) break;
+
+        D3D11_TEXTURE2D_DESC desc;
+        pDesktopTexture->GetDesc(&desc);
+        hr = CreateStagingTexture(desc);
+        if (FAILED(hr)) break;
+
+        m_pContext->CopyResource(m_pStagingTexture, pDesktopTexture);
+        m_pContext->Flush();
+
+        D3D11_MAPPED_SUBRESOURCE subresource;
+        hr = m_pContext->Map(m_pStagingTexture, 0, D3D11_MAP_READ, 0, &subresource);
+        if (FAILED(hr)) break;
+        m_mapped = true;
+
+        mapped.pPixels = static_cast<const uint8_t*>(subresource.pData);
+        mapped.stride = subresource.RowPitch;
+        mapped.width = desc.Width;
+        mapped.height = desc.Height;
+    } while (false);
+
+    SafeRelease(&pDesktopTexture);
+    if (FAILED(hr))
+    {
+        SafeRelease(&m_pStagingTexture);
+        return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// [DxgiCaptureSource::ReleaseFrame]
+//--------------------------------------------------------------------------------------
+inline void DxgiCaptureSource::ReleaseFrame()
+{
+    if (m_mapped)
+    {
+        m_pContext->Unmap(m_pStagingTexture, 0);
+        m_mapped = false;
+    }
+    if (m_pDesktopResource)
+    {
+        SafeRelease(&m_pDesktopResource);
+        m_pDuplication->ReleaseFrame();
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// [DxgiCaptureSource::Prepare]
+// Creates the staging texture for the desktop as the duplication describes it.
+//--------------------------------------------------------------------------------------
+inline bool DxgiCaptureSource::Prepare()
+{
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = m_width;
+    desc.Height = m_height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    return SUCCEEDED(CreateStagingTexture(desc));
+}
+
+//--------------------------------------------------------------------------------------
+// [DxgiCaptureSource::CreateStagingTexture]
+// Keeps the current staging texture if it matches the desktop texture's size and
+// format, and replaces it otherwise.
+//--------------------------------------------------------------------------------------
+inline HRESULT DxgiCaptureSource::CreateStagingTexture(const D3D11_TEXTURE2D_DESC& desktopDesc)
+{
+    if (m_pStagingTexture)
+    {
+        D3D11_TEXTURE2D_DESC current;
+        m_pStagingTexture->GetDesc(&current);
+        if (current.Width == desktopDesc.Width && current.Height == desktopDesc.Height &&
+            current.Format == desktopDesc.Format)
+        {
+            return S_OK;
+        }
+        SafeRelease(&m_pStagingTexture);
+    }
+    D3D11_TEXTURE2D_DESC desc = desktopDesc;
+    desc.Usage = D3D11_USAGE_STAGING;
+    desc.BindFlags = 0;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    desc.MiscFlags = 0;
+    return m_pDevice->CreateTexture2D(&desc, NULL, &m_pStagingTexture);
+}
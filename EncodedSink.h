@@ -0,0 +1,126 @@
+#pragma once
+//======================================================================================
+// EncodedSink.h
+// The seam between encoders and containers. An encoder produces EncodedFrames
+// (one H.264 access unit each, Annex-B) and hands them to an EncodedSink, which
+// muxes them into bytes for a ByteSink: a file, a pipe, a socket.
+//======================================================================================
+#include <cstddef>
+#include <cstdint>
+
+#include "FileWriter.h"
+
+// One encoded access unit. Timestamps are in 100 ns units, like Media Foundation.
+struct EncodedFrame
+{
+    const uint8_t* pData;
+    size_t size;
+    int64_t pts;
+    int64_t dts;
+    int64_t duration;
+    bool keyframe;
+    uint64_t frameId; // Capture sequence number of the source frame.
+};
+
+//======================================================================================
+// ByteSink
+// Destination for muxed bytes.
+//======================================================================================
+class ByteSink
+{
+public:
+    virtual ~ByteSink() {}
+    virtual bool Write(const void* pData, size_t size) = 0;
+    // Bytes accepted so far, i.e. the offset the next Write() lands at.
+    virtual uint64_t Position() const = 0;
+    // Overwrites bytes already written, for containers that fill in sizes at the
+    // end. Sinks that can't seek back (pipes, sockets) return false.
+    virtual bool Patch(uint64_t, const void*, size_t) { return false; }
+};
+
+// Appends to a FileWriter.
+class FileByteSink : public ByteSink
+{
+public:
+    explicit FileByteSink(FileWriter& writer) : m_writer(writer) {}
+
+    bool Write(const void* pData, size_t size) override
+    {
+        return m_writer.Write(pData, size);
+    }
+
+    uint64_t Position() const override
+    {
+        return m_writer.Tell();
+    }
+
+    bool Patch(uint64_t offset, const void* pData, size_t size) override
+    {
+        const uint64_t end = m_writer.Tell();
+        m_writer.Seek(offset);
+        const bool ok = m_writer.Write(pData, size);
+        m_writer.Seek(end);
+        return ok;
+    }
+
+private:
+    FileWriter& m_writer;
+};
+
+//======================================================================================
+// EncodedSink
+//======================================================================================
+class EncodedSink
+{
+public:
+    virtual ~EncodedSink() {}
+    virtual bool WriteFrame(const EncodedFrame& frame) = 0;
+    // Writes any trailer. The underlying ByteSink stays open.
+    virtual bool Finish() = 0;
+};
+
+//======================================================================================
+// TeeSink
+// Hands every frame to several sinks, e.g. a file muxer and a live stream. A failing
+// sink does not stop the others; the failure is reported once all have run.
+//======================================================================================
+class TeeSink : public EncodedSink
+{
+public:
+    static const size_t MaxSinks = 4;
+
+    // Returns false if the tee is full.
+    bool Add(EncodedSink* pSink)
+    {
+        if (m_count == MaxSinks)
+        {
+            return false;
+        }
+        m_pSinks[m_count++] = pSink;
+        return true;
+    }
+
+    bool WriteFrame(const EncodedFrame& frame) override
+    {
+        bool ok = true;
+        for (size_t i = 0; i < m_count; ++i)
+        {
+            ok = m_pSinks[i]->WriteFrame(frame) && ok;
+        }
+        return ok;
+    }
+
+    bool Finish() override
+    {
+        bool ok = true;
+        for (size_t i = 0; i < m_count; ++i)
+        {
+            ok = m_pSinks[i]->Finish() && ok;
+        }
+        return ok;
+    }
+
+private:
+    EncodedSink* m_pSinks[MaxSinks] = {};
+    size_t m_count = 0;
+};
@@ -0,0 +1,854 @@
+#pragma once
+//======================================================================================
+// FileWriter.h
+// The output I/O layer shared by every sink that writes to disk.
+//
+// Data is staged in a small pool of big, page-aligned buffers and only whole buffers
+// are handed to the OS, so the disk sees a few large sequential writes instead of
+// one small write per call. With write-behind enabled, full buffers are written by a
+// dedicated thread and the producer (usually the capture thread) only ever blocks
+// when every buffer is in flight, so a stalling disk is absorbed by the pool instead
+// of showing up as dropped frames.
+//
+// On top of that:
+//   - Producers that generate data (e.g. a colour converter) can Reserve() space
+//     and write straight into the staging buffer, avoiding an extra copy.
+//   - Seek() + Write() patch earlier parts of the file, which containers such as
+//     MP4 need for their headers. Patches that hit data still being staged are
+//     applied in memory; older data is rewritten in order by the writer thread, so
+//     the bulk stream stays aligned.
+//   - Space can be preallocated ahead of the write position to keep the file
+//     contiguous and take allocation out of the write path.
+//   - Direct (unbuffered) I/O skips the page cache for the aligned bulk of the
+//     stream, so a long recording doesn't evict everything else from memory.
+//   - fsync policy: never, on close, or every N bytes.
+//
+// The producer-side methods are not thread-safe; wrap the writer if several threads
+// feed the same file (see WriterStream.h).
+//======================================================================================
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Trace.h"
+#include "Utf8Path.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//======================================================================================
+// OsFile
+// Minimal wrapper over the native file handles; no buffering of its own.
+// A second, unbuffered handle is opened on request for direct I/O. It is only used
+// for writes whose offset, size and memory address are all aligned; everything else
+// goes through the regular handle.
+//======================================================================================
+class OsFile
+{
+public:
+    static const size_t DirectAlignment = 4096;
+
+    OsFile() = default;
+    ~OsFile() { Close(); }
+    OsFile(const OsFile&) = delete;
+    OsFile& operator=(const OsFile&) = delete;
+
+    bool Open(const std::string& path, bool tryDirect)
+    {
+        Close();
+#ifdef _WIN32
+        const std::wstring widePath = Utf8ToWide(path);
+        m_handle = CreateFileW(widePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                               nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_handle == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        if (tryDirect)
+        {
+            m_direct = CreateFileW(widePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                   nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr);
+        }
+#else
+        m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            return false;
+        }
+#ifdef O_DIRECT
+        if (tryDirect)
+        {
+            // Fails with EINVAL on file systems without direct I/O (e.g. tmpfs), in
+            // which case we silently stay on the page cache.
+            m_directFd = open(path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+        }
+#else
+        (void)tryDirect;
+#endif
+#endif
+        return true;
+    }
+
+    bool IsOpen() const
+    {
+#ifdef _WIN32
+        return m_handle != INVALID_HANDLE_VALUE;
+#else
+        return m_fd >= 0;
+#endif
+    }
+
+    bool HasDirect() const
+    {
+#ifdef _WIN32
+        return m_direct != INVALID_HANDLE_VALUE;
+#else
+        return m_directFd >= 0;
+#endif
+    }
+
+    //----------------------------------------------------------------------------------
+    // [OsFile::WriteAt]
+    // Writes the whole range at 'offset', retrying on partial writes. The aligned
+    // prefix goes through the direct handle when there is one.
+    //----------------------------------------------------------------------------------
+    bool WriteAt(const void* pData, size_t size, uint64_t offset)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(pData);
+        if (HasDirect() && offset % DirectAlignment == 0 &&
+            reinterpret_cast<uintptr_t>(p) % DirectAlignment == 0)
+        {
+            const size_t directSize = size / DirectAlignment * DirectAlignment;
+            if (directSize > 0)
+            {
+                if (!WriteRange(true, p, directSize, offset))
+                {
+                    return false;
+                }
+                p += directSize;
+                size -= directSize;
+                offset += directSize;
+            }
+        }
+        return size == 0 || WriteRange(false, p, size, offset);
+    }
+
+    // Reads up to 'size' bytes at 'offset'; returns the number of bytes read, or -1.
+    int64_t ReadAt(void* pData, size_t size, uint64_t offset)
+    {
+#ifdef _WIN32
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD read = 0;
+        const DWORD chunk = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size);
+        if (!ReadFile(m_handle, pData, chunk, &read, &ov))
+        {
+            return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+        }
+        return read;
+#else
+        ssize_t read;
+        do
+        {
+            read = pread(m_fd, pData, size, static_cast<off_t>(offset));
+        } while (read < 0 && errno == EINTR);
+        return read;
+#endif
+    }
+
+    // Reserves disk space for [offset, offset + size) without changing the file size.
+    // Best effort: returns false where the platform or file system can't do it.
+    bool Preallocate(uint64_t offset, uint64_t size)
+    {
+#ifdef _WIN32
+        // SetFileValidData would also skip zero-filling, but it needs the
+        // SE_MANAGE_VOLUME_NAME privilege and exposes stale disk contents, so we
+        // only grow the allocation.
+        FILE_ALLOCATION_INFO info;
+        info.AllocationSize.QuadPart = static_cast<LONGLONG>(offset + size);
+        return SetFileInformationByHandle(m_handle, FileAllocationInfo, &info, sizeof(info)) != FALSE;
+#elif defined(__linux__)
+        return fallocate(m_fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(size)) == 0;
+#else
+        (void)offset;
+        (void)size;
+        return false;
+#endif
+    }
+
+    bool Truncate(uint64_t size)
+    {
+#ifdef _WIN32
+        FILE_END_OF_FILE_INFO info;
+        info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+        return SetFileInformationByHandle(m_handle, FileEndOfFileInfo, &info, sizeof(info)) != FALSE;
+#else
+        return ftruncate(m_fd, static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    // Flushes file data to stable storage.
+    bool Sync()
+    {
+#ifdef _WIN32
+        bool ok = FlushFileBuffers(m_handle) != FALSE;
+        if (m_direct != INVALID_HANDLE_VALUE)
+        {
+            ok = (FlushFileBuffers(m_direct) != FALSE) && ok;
+        }
+        return ok;
+#elif defined(__APPLE__)
+        return fsync(m_fd) == 0;
+#else
+        bool ok = fdatasync(m_fd) == 0;
+        if (m_directFd >= 0)
+        {
+            ok = (fdatasync(m_directFd) == 0) && ok;
+        }
+        return ok;
+#endif
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (m_direct != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_direct);
+            m_direct = INVALID_HANDLE_VALUE;
+        }
+        if (m_handle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_handle);
+            m_handle = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (m_directFd >= 0)
+        {
+            close(m_directFd);
+            m_directFd = -1;
+        }
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+#endif
+    }
+
+private:
+    bool WriteRange(bool direct, const uint8_t* p, size_t size, uint64_t offset)
+    {
+        while (size > 0)
+        {
+#ifdef _WIN32
+            OVERLAPPED ov = {};
+            ov.Offset = static_cast<DWORD>(offset);
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            // Keep direct chunks a multiple of the alignment.
+            const DWORD chunk = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size);
+            DWORD written = 0;
+            if (!WriteFile(direct ? m_direct : m_handle, p, chunk, &written, &ov) || written == 0)
+            {
+                return false;
+            }
+#else
+            const ssize_t written = pwrite(direct ? m_directFd : m_fd, p, size, static_cast<off_t>(offset));
+            if (written < 0)
+            {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            if (written == 0)
+            {
+                return false;
+            }
+#endif
+            p += written;
+            size -= static_cast<size_t>(written);
+            offset += static_cast<uint64_t>(written);
+        }
+        return true;
+    }
+
+#ifdef _WIN32
+    HANDLE m_handle = INVALID_HANDLE_VALUE;
+    HANDLE m_direct = INVALID_HANDLE_VALUE;
+#else
+    int m_fd = -1;
+    int m_directFd = -1;
+#endif
+};
+
+//======================================================================================
+// FileWriter
+//======================================================================================
+enum class SyncPolicy
+{
+    None,     // Leave it to the OS.
+    OnClose,  // One sync when the file is closed.
+    Periodic, // Every Options::syncIntervalBytes, from the writer thread.
+};
+
+class FileWriter
+{
+public:
+    static const size_t Alignment = OsFile::DirectAlignment;
+
+    struct Options
+    {
+        size_t bufferSize = 8 * 1024 * 1024; // Rounded up to Alignment.
+        unsigned bufferCount = 4;            // At least 2 when writeBehind is set.
+        bool writeBehind = true;
+        bool directIo = false;               // Falls back to buffered I/O if unsupported.
+        uint64_t preallocateBytes = 0;       // Extend-ahead step; 0 disables preallocation.
+        SyncPolicy syncPolicy = SyncPolicy::None;
+        uint64_t syncIntervalBytes = 64ull * 1024 * 1024;
+    };
+
+    // Producer-side and device-side timings, for spotting stalls.
+    struct Stats
+    {
+        uint64_t bytesWritten = 0;    // Bytes handed to the OS so far.
+        uint64_t writeCalls = 0;
+        uint64_t writeNsMax = 0;      // Slowest single write (device latency).
+        uint64_t producerWaits = 0;   // Times the producer found no free buffer.
+        uint64_t producerWaitNsTotal = 0;
+        uint64_t producerWaitNsMax = 0;
+        uint64_t syncs = 0;
+        uint64_t queueDepthMax = 0;   // Most writes ever waiting for the writer thread.
+        bool directIo = false;
+    };
+
+    FileWriter() = default;
+    ~FileWriter() { Close(); }
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    //----------------------------------------------------------------------------------
+    // [FileWriter::Open]
+    //----------------------------------------------------------------------------------
+    bool Open(const std::string& path, const Options& options)
+    {
+        Close();
+        if (!m_file.Open(path, options.directIo))
+        {
+            return false;
+        }
+
+        m_options = options;
+        m_bufferSize = (options.bufferSize + Alignment - 1) / Alignment * Alignment;
+        const unsigned count = options.writeBehind ? (options.bufferCount < 2 ? 2 : options.bufferCount) : 1;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            void* pMem = AlignedAlloc(m_bufferSize);
+            if (!pMem)
+            {
+                Close();
+                return false;
+            }
+            m_allBuffers.push_back(static_cast<uint8_t*>(pMem));
+            m_freeBuffers.push_back(static_cast<uint8_t*>(pMem));
+        }
+
+        m_failed = false;
+        m_stopping = false;
+        m_stats = Stats();
+        m_stats.directIo = m_file.HasDirect();
+        m_stagingOffset = 0;
+        m_position = 0;
+        m_fileSize = 0;
+        m_preallocatedEnd = 0;
+        m_bytesSinceSync = 0;
+        m_pCurrent = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+        m_used = 0;
+
+        if (options.writeBehind)
+        {
+            m_thread = std::thread(&FileWriter::WriterThread, this);
+        }
+        return true;
+    }
+
+    bool IsOpen() const { return m_file.IsOpen(); }
+    size_t BufferSize() const { return m_bufferSize; }
+
+    // Current write position and logical file size.
+    uint64_t Tell() const { return m_position; }
+    uint64_t Size() const { return m_fileSize; }
+
+    //----------------------------------------------------------------------------------
+    // [FileWriter::Seek]
+    // Moves the write position. Seeking past the end leaves a zero-filled gap once
+    // something is written there.
+    //----------------------------------------------------------------------------------
+    void Seek(uint64_t position)
+    {
+        m_position = position;
+    }
+
+    // Sets the logical file size (applied when the file is closed).
+    void SetSize(uint64_t size)
+    {
+        m_fileSize = size;
+        if (m_position > size)
+        {
+            m_position = size;
+        }
+        if (StagingEnd() > size && m_stagingOffset <= size)
+        {
+            m_used = static_cast<size_t>(size - m_stagingOffset);
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FileWriter::Reserve]
+    // Returns a pointer to 'size' contiguous bytes inside the staging buffer at the
+    // end of the file, or nullptr if 'size' exceeds the buffer size, the position is
+    // not at the end of the file, or a previous write failed. The data only counts
+    // once Commit() is called.
+    //----------------------------------------------------------------------------------
+    uint8_t* Reserve(size_t size)
+    {
+        if (!m_pCurrent || size > m_bufferSize || m_position != StagingEnd() || HasFailed())
+        {
+            return nullptr;
+        }
+        if (m_bufferSize - m_used < size && !SubmitCurrent())
+        {
+            return nullptr;
+        }
+        return m_pCurrent + m_used;
+    }
+
+    void Commit(size_t size)
+    {
+        m_used += size;
+        m_position += size;
+        if (m_position > m_fileSize)
+        {
+            m_fileSize = m_position;
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FileWriter::Write]
+    // Writes at the current position, spanning as many buffers as needed.
+    //----------------------------------------------------------------------------------
+    bool Write(const void* pData, size_t size)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(pData);
+        if (!m_pCurrent || HasFailed())
+        {
+            return false;
+        }
+
+        // 1. Anything before the staging buffer has already been handed off; queue
+        //    a copy so it is rewritten after the original write.
+        if (size > 0 && m_position < m_stagingOffset)
+        {
+            const uint64_t before = m_stagingOffset - m_position;
+            const size_t chunk = before < size ? static_cast<size_t>(before) : size;
+            if (!SubmitCopy(p, chunk, m_position))
+            {
+                return false;
+            }
+            Advance(p, size, chunk);
+        }
+
+        // 2. Overwrite bytes that are still staged.
+        if (size > 0 && m_position < StagingEnd())
+        {
+            const size_t at = static_cast<size_t>(m_position - m_stagingOffset);
+            const size_t chunk = (m_used - at < size) ? (m_used - at) : size;
+            memcpy(m_pCurrent + at, p, chunk);
+            Advance(p, size, chunk);
+        }
+
+        // 3. Zero-fill a gap left by seeking past the end.
+        while (m_position > StagingEnd())
+        {
+            if (m_used == m_bufferSize && !SubmitCurrent())
+            {
+                return false;
+            }
+            const uint64_t gap = m_position - StagingEnd();
+            const size_t chunk = (m_bufferSize - m_used < gap) ? (m_bufferSize - m_used) : static_cast<size_t>(gap);
+            memset(m_pCurrent + m_used, 0, chunk);
+            m_used += chunk;
+        }
+
+        // 4. Append.
+        while (size > 0)
+        {
+            if (m_used == m_bufferSize && !SubmitCurrent())
+            {
+                return false;
+            }
+            const size_t chunk = (m_bufferSize - m_used < size) ? (m_bufferSize - m_used) : size;
+            memcpy(m_pCurrent + m_used, p, chunk);
+            m_used += chunk;
+            Advance(p, size, chunk);
+        }
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FileWriter::Flush]
+    // Makes everything written so far visible to readers of the file and waits for
+    // it to reach the OS. The staged tail is written as a copy and kept in the
+    // buffer, so the bulk stream stays aligned.
+    //----------------------------------------------------------------------------------
+    bool Flush()
+    {
+        if (!m_pCurrent)
+        {
+            return false;
+        }
+        if (m_used > 0 && !SubmitCopy(m_pCurrent, m_used, m_stagingOffset))
+        {
+            return false;
+        }
+        WaitForIdle();
+        return !HasFailed();
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FileWriter::Read]
+    // Reads back data that was written earlier. Flushes first; meant for the rare
+    // container that reads its own output, not for the hot path.
+    //----------------------------------------------------------------------------------
+    int64_t Read(uint64_t offset, void* pData, size_t size)
+    {
+        if (!Flush())
+        {
+            return -1;
+        }
+        if (offset >= m_fileSize)
+        {
+            return 0;
+        }
+        if (size > m_fileSize - offset)
+        {
+            size = static_cast<size_t>(m_fileSize - offset);
+        }
+        return m_file.ReadAt(pData, size, offset);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FileWriter::Close]
+    // Writes any staged data, stops the writer thread, applies the final size and
+    // sync policy and closes the file. Returns false if any write failed during the
+    // lifetime of the file.
+    //----------------------------------------------------------------------------------
+    bool Close()
+    {
+        if (m_pCurrent && m_used > 0)
+        {
+            SubmitCurrent();
+        }
+        if (m_thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_cv.notify_all();
+            m_thread.join();
+        }
+        if (m_file.IsOpen())
+        {
+            // Preallocation and SetSize() can leave the file longer than the data.
+            if (!m_file.Truncate(m_fileSize))
+            {
+                m_failed = true;
+            }
+            if (m_options.syncPolicy != SyncPolicy::None)
+            {
+                if (!m_file.Sync())
+                {
+                    m_failed = true;
+                }
+                ++m_stats.syncs;
+            }
+            m_file.Close();
+        }
+
+        for (uint8_t* pBuffer : m_allBuffers)
+        {
+            AlignedFree(pBuffer);
+        }
+        m_allBuffers.clear();
+        m_freeBuffers.clear();
+        m_queue.clear();
+        m_pCurrent = nullptr;
+        m_used = 0;
+        return !HasFailed();
+    }
+
+    bool HasFailed() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_failed;
+    }
+
+    Stats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+private:
+    // One unit of work for the writer. Pooled buffers return to the free list once
+    // written; copies (patches and flushes) own their bytes.
+    struct WriteItem
+    {
+        uint8_t* pBuffer;
+        size_t size;
+        uint64_t offset;
+        std::vector<uint8_t> copy;
+    };
+
+    static uint64_t NowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static void* AlignedAlloc(size_t size)
+    {
+#ifdef _WIN32
+        return _aligned_malloc(size, Alignment);
+#else
+        void* p = nullptr;
+        return posix_memalign(&p, Alignment, size) == 0 ? p : nullptr;
+#endif
+    }
+
+    static void AlignedFree(void* p)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+
+    uint64_t StagingEnd() const { return m_stagingOffset + m_used; }
+
+    void Advance(const uint8_t*& p, size_t& size, size_t chunk)
+    {
+        p += chunk;
+        size -= chunk;
+        m_position += chunk;
+        if (m_position > m_fileSize)
+        {
+            m_fileSize = m_position;
+        }
+    }
+
+    // Hands the current buffer to the writer and makes a fresh buffer current.
+    bool SubmitCurrent()
+    {
+        WriteItem item = { m_pCurrent, m_used, m_stagingOffset, std::vector<uint8_t>() };
+        m_stagingOffset += m_used;
+        m_used = 0;
+
+        if (!m_options.writeBehind)
+        {
+            // The single buffer is reused as soon as the write returns.
+            return Execute(item);
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(item));
+        NoteQueueDepth();
+        m_pCurrent = nullptr;
+        m_cv.notify_all();
+
+        // Back-pressure: wait for the writer to return a buffer.
+        if (m_freeBuffers.empty() && !m_failed)
+        {
+            const uint64_t start = NowNs();
+            m_cv.wait(lock, [this] { return !m_freeBuffers.empty() || m_failed; });
+            const uint64_t waited = NowNs() - start;
+            ++m_stats.producerWaits;
+            m_stats.producerWaitNsTotal += waited;
+            if (waited > m_stats.producerWaitNsMax)
+            {
+                m_stats.producerWaitNsMax = waited;
+            }
+        }
+        if (m_failed)
+        {
+            return false;
+        }
+        m_pCurrent = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+        return true;
+    }
+
+    bool SubmitCopy(const uint8_t* pData, size_t size, uint64_t offset)
+    {
+        WriteItem item = { nullptr, size, offset, std::vector<uint8_t>(pData, pData + size) };
+        if (!m_options.writeBehind)
+        {
+            return Execute(item);
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(item));
+        NoteQueueDepth();
+        m_cv.notify_all();
+        return !m_failed;
+    }
+
+    // Called with m_mutex held.
+    void NoteQueueDepth()
+    {
+        if (m_queue.size() > m_stats.queueDepthMax)
+        {
+            m_stats.queueDepthMax = m_queue.size();
+        }
+    }
+
+    void WaitForIdle()
+    {
+        if (!m_options.writeBehind)
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this] { return (m_queue.empty() && !m_busy) || m_failed; });
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FileWriter::Execute]
+    // Performs one write, preallocating ahead of it and syncing as configured. Runs
+    // on the writer thread, or inline when write-behind is off.
+    //----------------------------------------------------------------------------------
+    bool Execute(const WriteItem& item)
+    {
+        const uint8_t* pData = item.pBuffer ? item.pBuffer : item.copy.data();
+        const uint64_t end = item.offset + item.size;
+
+        if (m_options.preallocateBytes > 0 && end > m_preallocatedEnd)
+        {
+            const uint64_t target = end + m_options.preallocateBytes;
+            m_file.Preallocate(m_preallocatedEnd, target - m_preallocatedEnd);
+            m_preallocatedEnd = target;
+        }
+
+        const uint64_t start = NowNs();
+        Trace::Begin("disk write", TickClock::Now(), Trace::NoFrame);
+        const bool ok = m_file.WriteAt(pData, item.size, item.offset);
+        Trace::End("disk write", TickClock::Now());
+        const uint64_t elapsed = NowNs() - start;
+
+        bool synced = false;
+        bool syncOk = true;
+        m_bytesSinceSync += item.size;
+        if (ok && m_options.syncPolicy == SyncPolicy::Periodic && m_bytesSinceSync >= m_options.syncIntervalBytes)
+        {
+            // A failed sync means the data may not be durable; fail the file as Close() does.
+            syncOk = m_file.Sync();
+            m_bytesSinceSync = 0;
+            synced = true;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.writeCalls;
+        m_stats.bytesWritten += item.size;
+        if (elapsed > m_stats.writeNsMax)
+        {
+            m_stats.writeNsMax = elapsed;
+        }
+        if (synced)
+        {
+            ++m_stats.syncs;
+        }
+        if (!ok || !syncOk)
+        {
+            m_failed = true;
+        }
+        return ok && syncOk;
+    }
+
+    void WriterThread()
+    {
+        Trace::SetThreadName("file writer");
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            m_cv.wait(lock, [this] { return !m_queue.empty() || m_stopping; });
+            if (m_queue.empty())
+            {
+                return; // Stopping and nothing left to write.
+            }
+            WriteItem item = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_busy = true;
+            Trace::Counter("write-behind queue", static_cast<int64_t>(m_queue.size()));
+
+            lock.unlock();
+            if (!HasFailed())
+            {
+                Execute(item);
+            }
+            lock.lock();
+
+            if (item.pBuffer)
+            {
+                m_freeBuffers.push_back(item.pBuffer);
+            }
+            m_busy = false;
+            m_cv.notify_all();
+        }
+    }
+
+    OsFile m_file;
+    Options m_options;
+    size_t m_bufferSize = 0;
+
+    // Producer side.
+    std::vector<uint8_t*> m_allBuffers;
+    uint8_t* m_pCurrent = nullptr;
+    size_t m_used = 0;
+    uint64_t m_stagingOffset = 0; // File offset of m_pCurrent[0].
+    uint64_t m_position = 0;
+    uint64_t m_fileSize = 0;
+
+    // Writer side (the writer thread, or the producer when write-behind is off).
+    uint64_t m_preallocatedEnd = 0;
+    uint64_t m_bytesSinceSync = 0;
+
+    // Shared, guarded by m_mutex.
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<uint8_t*> m_freeBuffers;
+    std::deque<WriteItem> m_queue;
+    Stats m_stats;
+    bool m_busy = false;
+    bool m_failed = false;
+    bool m_stopping = false;
+    std::thread m_thread;
+};
@@ -0,0 +1,119 @@
+#pragma once
+//======================================================================================
+// FrameClock.h
+// The schedule several recordings follow so their streams line up: a common start
+// time and a grid of frame slots at the recording frame rate. Every participant
+// captures at the start of each slot and stamps the frame with the slot's time, so
+// frame N of every file shows the same instant, whatever each output's refresh
+// rate or setup time.
+//
+// Participants set up (devices, encoders, files) at their own pace and then meet
+// in WaitForStart(); the last one to arrive starts the clock for all of them. One
+// that fails before getting there calls Leave() instead, so the rest don't wait for
+// it. A participant that falls behind skips the slots it missed rather than
+// drifting: WaitForSlot() returns the slot that is current now.
+//======================================================================================
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+class FrameClock
+{
+public:
+    FrameClock(uint32_t fps, uint32_t participants) :
+        m_fps(fps ? fps : 30),
+        m_waiting(participants)
+    {
+    }
+
+    FrameClock(const FrameClock&) = delete;
+    FrameClock& operator=(const FrameClock&) = delete;
+
+    static uint64_t NowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FrameClock::WaitForStart]
+    // Blocks until every participant has arrived or left. Slot 0 starts when the last
+    // one arrives.
+    //----------------------------------------------------------------------------------
+    void WaitForStart()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Arrive();
+        m_started.wait(lock, [this]() { return m_waiting == 0; });
+    }
+
+    // For a participant that will never call WaitForStart().
+    void Leave()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Arrive();
+    }
+
+    uint32_t Fps() const { return m_fps; }
+
+    // Steady-clock time slot 0 started; 0 until the clock has started.
+    uint64_t StartNs() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_startNs;
+    }
+
+    uint64_t SlotStartNs(uint64_t slot) const
+    {
+        return StartNs() + slot * 1000000000ull / m_fps;
+    }
+
+    // The slot's presentation time in 100-ns units, as Media Foundation counts.
+    int64_t SlotTime(uint64_t slot) const
+    {
+        return static_cast<int64_t>(slot * 10000000ull / m_fps);
+    }
+
+    uint64_t CurrentSlot() const
+    {
+        const uint64_t startNs = StartNs();
+        const uint64_t now = NowNs();
+        return now > startNs ? (now - startNs) * m_fps / 1000000000ull : 0;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FrameClock::WaitForSlot]
+    // Sleeps until 'slot' starts and returns it, or returns the current slot right
+    // away if that is already later.
+    //----------------------------------------------------------------------------------
+    uint64_t WaitForSlot(uint64_t slot) const
+    {
+        const uint64_t current = CurrentSlot();
+        if (current > slot)
+        {
+            return current;
+        }
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+            std::chrono::nanoseconds(SlotStartNs(slot))));
+        return slot;
+    }
+
+private:
+    // Called with m_mutex held.
+    void Arrive()
+    {
+        if (m_waiting > 0 && --m_waiting == 0)
+        {
+            m_startNs = NowNs();
+            m_started.notify_all();
+        }
+    }
+
+    const uint32_t m_fps;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_started;
+    uint32_t m_waiting;
+    uint64_t m_startNs = 0;
+};
@@ -0,0 +1,179 @@
+#pragma once
+//======================================================================================
+// FrameMarker.h
+// A machine-readable stamp carrying a frame counter and a timestamp, drawn into the
+// picture before encoding and read back from the decoded output, so glass-to-glass
+// latency can be measured without trusting any container timestamps.
+//
+// The marker is a strip of 2 x 64 black or white square cells in the bottom-right
+// corner of the frame: an 8-bit sync byte, the 32-bit frame number, the 64-bit
+// timestamp (steady-clock nanoseconds, comparable across processes on one machine),
+// a CRC-16 of those 12 bytes and an 8-bit trailer. Cells are up to 16 pixels so
+// the strip survives chroma subsampling and lossy encoding; only the centre of each
+// cell is sampled when reading. Its placement depends only on the frame size, so a
+// reader needs nothing but the decoded picture.
+//======================================================================================
+#include <cstddef>
+#include <cstdint>
+
+namespace FrameMarker
+{
+    static const uint32_t Columns = 64;
+    static const uint32_t Rows = 2;
+    static const uint32_t MinCellSize = 4;
+    static const uint32_t MaxCellSize = 16;
+    static const uint8_t SyncByte = 0xA5;
+    static const uint8_t TrailerByte = 0x5A;
+
+    struct Marker
+    {
+        uint32_t frameNumber = 0;
+        uint64_t timestampNs = 0;
+    };
+
+    // Where the strip sits; cellSize is 0 when the frame is too small to hold it.
+    struct Placement
+    {
+        uint32_t left = 0;
+        uint32_t top = 0;
+        uint32_t cellSize = 0;
+
+        uint32_t Width() const { return Columns * cellSize; }
+        uint32_t Height() const { return Rows * cellSize; }
+    };
+
+    // Fits inside the synthetic desktop's taskbar (min(40, height / 24) rows), clear
+    // of the right edge.
+    inline Placement Place(uint32_t width, uint32_t height)
+    {
+        Placement placement;
+        uint32_t cell = MaxCellSize;
+        cell = height / 48 < cell ? height / 48 : cell;
+        cell = width > 16 && (width - 16) / Columns < cell ? (width - 16) / Columns : cell;
+        if (width <= 16 || cell < MinCellSize)
+        {
+            return placement;
+        }
+        placement.cellSize = cell;
+        placement.left = width - 8 - placement.Width();
+        placement.top = height - placement.Height();
+        return placement;
+    }
+
+    // CRC-16/CCITT-FALSE.
+    inline uint16_t Crc16(const uint8_t* pData, size_t size)
+    {
+        uint16_t crc = 0xFFFF;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc ^= static_cast<uint16_t>(pData[i] << 8);
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = static_cast<uint16_t>(crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    // The 16 bytes of the strip, most significant bit first, row by row.
+    inline void Encode(const Marker& marker, uint8_t (&bytes)[16])
+    {
+        bytes[0] = SyncByte;
+        for (int i = 0; i < 4; ++i)
+        {
+            bytes[1 + i] = static_cast<uint8_t>(marker.frameNumber >> (24 - 8 * i));
+        }
+        for (int i = 0; i < 8; ++i)
+        {
+            bytes[5 + i] = static_cast<uint8_t>(marker.timestampNs >> (56 - 8 * i));
+        }
+        const uint16_t crc = Crc16(bytes + 1, 12);
+        bytes[13] = static_cast<uint8_t>(crc >> 8);
+        bytes[14] = static_cast<uint8_t>(crc);
+        bytes[15] = TrailerByte;
+    }
+
+    inline bool Decode(const uint8_t (&bytes)[16], Marker& marker)
+    {
+        if (bytes[0] != SyncByte || bytes[15] != TrailerByte ||
+            Crc16(bytes + 1, 12) != ((bytes[13] << 8) | bytes[14]))
+        {
+            return false;
+        }
+        marker.frameNumber = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            marker.frameNumber = (marker.frameNumber << 8) | bytes[1 + i];
+        }
+        marker.timestampNs = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            marker.timestampNs = (marker.timestampNs << 8) | bytes[5 + i];
+        }
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FrameMarker::Stamp]
+    // Draws the marker into a BGRA frame. Returns false (and draws nothing) if the
+    // frame is too small to carry one.
+    //----------------------------------------------------------------------------------
+    inline bool Stamp(uint8_t* pBgra, ptrdiff_t stride, uint32_t width, uint32_t height, const Marker& marker)
+    {
+        const Placement placement = Place(width, height);
+        if (placement.cellSize == 0)
+        {
+            return false;
+        }
+        uint8_t bytes[16];
+        Encode(marker, bytes);
+        for (uint32_t y = 0; y < placement.Height(); ++y)
+        {
+            uint32_t* pRow = reinterpret_cast<uint32_t*>(pBgra + static_cast<ptrdiff_t>(placement.top + y) * stride) + placement.left;
+            const uint32_t row = y / placement.cellSize;
+            for (uint32_t x = 0; x < placement.Width(); ++x)
+            {
+                const uint32_t bit = row * Columns + x / placement.cellSize;
+                pRow[x] = (bytes[bit / 8] >> (7 - bit % 8)) & 1 ? 0xFFFFFFFFu : 0xFF000000u;
+            }
+        }
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [FrameMarker::Read]
+    // Reads the marker back from a decoded luma plane. Each cell's value is the mean
+    // of its central half, thresholded halfway between video black and white.
+    // Returns false if there is no marker or it doesn't check out.
+    //----------------------------------------------------------------------------------
+    inline bool Read(const uint8_t* pY, ptrdiff_t stride, uint32_t width, uint32_t height, Marker& marker)
+    {
+        const Placement placement = Place(width, height);
+        if (placement.cellSize == 0)
+        {
+            return false;
+        }
+        const uint32_t inset = placement.cellSize / 4;
+        const uint32_t span = placement.cellSize - 2 * inset;
+        uint8_t bytes[16] = {};
+        for (uint32_t bit = 0; bit < Rows * Columns; ++bit)
+        {
+            const uint32_t cellLeft = placement.left + (bit % Columns) * placement.cellSize + inset;
+            const uint32_t cellTop = placement.top + (bit / Columns) * placement.cellSize + inset;
+            uint32_t sum = 0;
+            for (uint32_t y = 0; y < span; ++y)
+            {
+                const uint8_t* pRow = pY + static_cast<ptrdiff_t>(cellTop + y) * stride + cellLeft;
+                for (uint32_t x = 0; x < span; ++x)
+                {
+                    sum += pRow[x];
+                }
+            }
+            if (sum > 126u * span * span)
+            {
+                bytes[bit / 8] |= static_cast<uint8_t>(0x80 >> (bit % 8));
+            }
+        }
+        return Decode(bytes, marker);
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+//======================================================================================
+// H264Bitstream.h
+// Helpers for walking H.264 Annex-B byte streams (NAL units separated by 00 00 01
+// or 00 00 00 01 start codes), as produced by the encoders we drive.
+//======================================================================================
+#include <cstddef>
+#include <cstdint>
+
+namespace H264
+{
+    enum NalType : uint8_t
+    {
+        NalSlice = 1,
+        NalIdrSlice = 5,
+        NalSei = 6,
+        NalSps = 7,
+        NalPps = 8,
+        NalAud = 9,
+    };
+
+    struct NalUnit
+    {
+        const uint8_t* pData; // First byte after the start code (the NAL header).
+        size_t size;          // Bytes up to the next start code, trailing zeros removed.
+        uint8_t type;
+    };
+
+    // Returns the first start code at or after p, or 'end' if there is none.
+    // *pStartCodeSize receives 3 or 4.
+    inline const uint8_t* FindStartCode(const uint8_t* p, const uint8_t* end, size_t* pStartCodeSize)
+    {
+        for (; p + 3 <= end; ++p)
+        {
+            if (p[0] == 0 && p[1] == 0)
+            {
+                if (p[2] == 1)
+                {
+                    *pStartCodeSize = 3;
+                    return p;
+                }
+                if (p[2] == 0 && p + 4 <= end && p[3] == 1)
+                {
+                    *pStartCodeSize = 4;
+                    return p;
+                }
+            }
+        }
+        *pStartCodeSize = 0;
+        return end;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [H264::NextNal]
+    // Iterates the NAL units of an Annex-B buffer. Start with cursor = buffer start;
+    // returns false when there are no more units.
+    //----------------------------------------------------------------------------------
+    inline bool NextNal(const uint8_t*& cursor, const uint8_t* end, NalUnit& nal)
+    {
+        size_t startCodeSize = 0;
+        const uint8_t* pStart = FindStartCode(cursor, end, &startCodeSize);
+        if (pStart == end)
+        {
+            cursor = end;
+            return false;
+        }
+        const uint8_t* pPayload = pStart + startCodeSize;
+        size_t nextSize = 0;
+        const uint8_t* pNext = FindStartCode(pPayload, end, &nextSize);
+
+        // A 4-byte start code's leading zero belongs to the next unit, and
+        // trailing_zero_8bits may pad the end of a unit.
+        const uint8_t* pEnd = pNext;
+        while (pEnd > pPayload && pEnd[-1] == 0)
+        {
+            --pEnd;
+        }
+
+        nal.pData = pPayload;
+        nal.size = static_cast<size_t>(pEnd - pPayload);
+        nal.type = nal.size ? static_cast<uint8_t>(pPayload[0] & 0x1F) : 0;
+        cursor = pNext;
+        return true;
+    }
+
+    // True if the access unit contains a NAL unit of the given type.
+    inline bool ContainsNal(const uint8_t* pData, size_t size, uint8_t type)
+    {
+        const uint8_t* cursor = pData;
+        const uint8_t* end = pData + size;
+        NalUnit nal;
+        while (NextNal(cursor, end, nal))
+        {
+            if (nal.type == type)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
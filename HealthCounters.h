@@ -0,0 +1,273 @@
+#pragma once
+//======================================================================================
+// HealthCounters.h
+// What happened to every frame of a recording: how many were captured, repeated,
+// merged by the compositor or dropped, why keyframes were forced, and how deep
+// each queue got. Summarized periodically in the log and written as a JSON report
+// ("<output>.health.json") at the end for dashboards to collect.
+//
+// Each thread that counts gets its own cache-line aligned slot, so incrementing is
+// a plain load and store on a line no other thread writes. Readers sum (or take
+// the maximum of) all slots at any time.
+//======================================================================================
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+enum class HealthCounter
+{
+    // Capture (Recorder::GrabFrameAndCreateSample)
+    AcquireTimeouts,     // No desktop update within the acquire timeout.
+    AcquireErrors,       // AcquireNextFrame failed (access lost, mode change...).
+    FramesCaptured,      // A desktop image was read back.
+    FramesRepeated,      // Captured, but only the pointer had changed since the last one.
+    FramesCoalesced,     // Desktop updates the compositor merged before we acquired.
+    ReadbackErrors,      // Staging copy, map or sample creation failed.
+    SourceLosses,        // The source went away and is being recreated (RecoveringSource.h).
+    SourceRecoveries,    // A new source took over after a loss.
+    FramesHeld,          // The last image repeated while the source was gone.
+
+    // Output (Recorder::Record)
+    FramesWritten,       // Handed to the encoder or raw sink.
+    FramesDropped,       // Output frame slots lost to an acquire timeout.
+    KeyframesScheduled,  // Including the first frame.
+    KeyframesSceneChange,
+    KeyframesRequested,
+    EncodeErrors,
+    WriteErrors,
+
+    // The largest value seen, not a total: queue depths, and the start latency.
+    EncoderQueueMax,     // Frames submitted to the encoder but not yet output.
+    FileQueueMax,        // Buffers waiting for the file writer thread.
+    StreamQueueBytesMax, // Bytes waiting for the stream reader.
+    TimeToFirstFrameUs,  // From the start command (--daemon) or launch to the first frame written.
+
+    // Downstream losses, copied from the stream and log stats at the end.
+    StreamFramesDropped,
+    StreamDisconnects,
+    LogRecordsDropped,
+
+    Count,
+};
+
+inline const char* HealthCounterName(HealthCounter counter)
+{
+    switch (counter)
+    {
+    case HealthCounter::AcquireTimeouts: return "acquire_timeouts";
+    case HealthCounter::AcquireErrors: return "acquire_errors";
+    case HealthCounter::FramesCaptured: return "frames_captured";
+    case HealthCounter::FramesRepeated: return "frames_repeated";
+    case HealthCounter::FramesCoalesced: return "frames_coalesced";
+    case HealthCounter::ReadbackErrors: return "readback_errors";
+    case HealthCounter::SourceLosses: return "source_losses";
+    case HealthCounter::SourceRecoveries: return "source_recoveries";
+    case HealthCounter::FramesHeld: return "frames_held";
+    case HealthCounter::FramesWritten: return "frames_written";
+    case HealthCounter::FramesDropped: return "frames_dropped";
+    case HealthCounter::KeyframesScheduled: return "keyframes_scheduled";
+    case HealthCounter::KeyframesSceneChange: return "keyframes_scene_change";
+    case HealthCounter::KeyframesRequested: return "keyframes_requested";
+    case HealthCounter::EncodeErrors: return "encode_errors";
+    case HealthCounter::WriteErrors: return "write_errors";
+    case HealthCounter::EncoderQueueMax: return "encoder_queue_max";
+    case HealthCounter::FileQueueMax: return "file_queue_max";
+    case HealthCounter::StreamQueueBytesMax: return "stream_queue_bytes_max";
+    case HealthCounter::TimeToFirstFrameUs: return "time_to_first_frame_us";
+    case HealthCounter::StreamFramesDropped: return "stream_frames_dropped";
+    case HealthCounter::StreamDisconnects: return "stream_disconnects";
+    case HealthCounter::LogRecordsDropped: return "log_records_dropped";
+    default: return "?";
+    }
+}
+
+// One line describing the counter, for the metrics' HELP text.
+inline const char* HealthCounterHelp(HealthCounter counter)
+{
+    switch (counter)
+    {
+    case HealthCounter::AcquireTimeouts: return "No desktop update within the acquire timeout.";
+    case HealthCounter::AcquireErrors: return "Frame acquisitions that failed (access lost, mode change).";
+    case HealthCounter::FramesCaptured: return "Desktop images read back.";
+    case HealthCounter::FramesRepeated: return "Frames captured where only the pointer had changed.";
+    case HealthCounter::FramesCoalesced: return "Desktop updates the compositor merged before they were acquired.";
+    case HealthCounter::ReadbackErrors: return "Staging copies, maps or sample creations that failed.";
+    case HealthCounter::SourceLosses: return "Times the capture source went away.";
+    case HealthCounter::SourceRecoveries: return "Times a new capture source took over after a loss.";
+    case HealthCounter::FramesHeld: return "Frames that repeated the last image while the source was gone.";
+    case HealthCounter::FramesWritten: return "Frames handed to the encoder or raw sink.";
+    case HealthCounter::FramesDropped: return "Output frame slots lost to an acquire timeout.";
+    case HealthCounter::KeyframesScheduled: return "Keyframes placed by the GOP, including the first frame.";
+    case HealthCounter::KeyframesSceneChange: return "Keyframes forced by a scene change.";
+    case HealthCounter::KeyframesRequested: return "Keyframes forced on request.";
+    case HealthCounter::EncodeErrors: return "Frames the encoder failed on.";
+    case HealthCounter::WriteErrors: return "Frames the output failed to write.";
+    case HealthCounter::EncoderQueueMax: return "Most frames submitted to the encoder but not yet output.";
+    case HealthCounter::FileQueueMax: return "Most buffers waiting for the file writer thread.";
+    case HealthCounter::StreamQueueBytesMax: return "Most bytes waiting for the stream reader.";
+    case HealthCounter::TimeToFirstFrameUs: return "Microseconds from the start command or launch to the first frame written.";
+    case HealthCounter::StreamFramesDropped: return "Frames the stream output dropped for a slow reader.";
+    case HealthCounter::StreamDisconnects: return "Stream readers that went away.";
+    case HealthCounter::LogRecordsDropped: return "Log records dropped because the log queue was full.";
+    default: return "?";
+    }
+}
+
+// Maxima are combined across threads with max() instead of a sum.
+inline bool HealthCounterIsMax(HealthCounter counter)
+{
+    return counter == HealthCounter::EncoderQueueMax || counter == HealthCounter::FileQueueMax ||
+           counter == HealthCounter::StreamQueueBytesMax || counter == HealthCounter::TimeToFirstFrameUs;
+}
+
+//======================================================================================
+// HealthCounters
+//======================================================================================
+class HealthCounters
+{
+public:
+    static const size_t CounterCount = static_cast<size_t>(HealthCounter::Count);
+    static const size_t MaxThreads = 8;
+
+    // One thread's counters. Only the thread that registered it may write to it.
+    struct alignas(64) Slot
+    {
+        void Add(HealthCounter counter, uint64_t amount = 1)
+        {
+            std::atomic<uint64_t>& value = m_values[static_cast<size_t>(counter)];
+            value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        void RaiseMax(HealthCounter counter, uint64_t candidate)
+        {
+            std::atomic<uint64_t>& value = m_values[static_cast<size_t>(counter)];
+            if (candidate > value.load(std::memory_order_relaxed))
+            {
+                value.store(candidate, std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic<uint64_t> m_values[CounterCount];
+    };
+
+    struct Snapshot
+    {
+        uint64_t values[CounterCount] = {};
+
+        uint64_t operator[](HealthCounter counter) const { return values[static_cast<size_t>(counter)]; }
+    };
+
+    HealthCounters()
+    {
+        for (size_t slot = 0; slot < MaxThreads; ++slot)
+        {
+            for (size_t i = 0; i < CounterCount; ++i)
+            {
+                m_slots[slot].m_values[i].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    HealthCounters(const HealthCounters&) = delete;
+    HealthCounters& operator=(const HealthCounters&) = delete;
+
+    // Hands the calling thread a slot of its own; nullptr once all are taken.
+    Slot* RegisterThread()
+    {
+        const size_t index = m_registered.fetch_add(1, std::memory_order_relaxed);
+        return index < MaxThreads ? &m_slots[index] : nullptr;
+    }
+
+    Snapshot Read() const
+    {
+        Snapshot snapshot;
+        size_t used = m_registered.load(std::memory_order_relaxed);
+        if (used > MaxThreads)
+        {
+            used = MaxThreads;
+        }
+        for (size_t slot = 0; slot < used; ++slot)
+        {
+            for (size_t i = 0; i < CounterCount; ++i)
+            {
+                const uint64_t value = m_slots[slot].m_values[i].load(std::memory_order_relaxed);
+                if (HealthCounterIsMax(static_cast<HealthCounter>(i)))
+                {
+                    snapshot.values[i] = value > snapshot.values[i] ? value : snapshot.values[i];
+                }
+                else
+                {
+                    snapshot.values[i] += value;
+                }
+            }
+        }
+        return snapshot;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [HealthCounters::FormatJson]
+    // The report written next to the recording:
+    //   { "output": "...", "duration_seconds": 12.5, "fps": 60, "result": "ok",
+    //     "counters": { "frames_captured": 750, ... } }
+    // 'extraMembers' are further top-level members, already formatted, appended
+    // after the counters (e.g. the quality summary).
+    //----------------------------------------------------------------------------------
+    static void FormatJson(const Snapshot& snapshot, const std::string& outputPath, double durationSeconds,
+                           uint32_t fps, bool succeeded, std::string& json,
+                           const std::string& extraMembers = std::string())
+    {
+        char line[160];
+        json = "{\n  \"output\": \"";
+        for (char c : outputPath)
+        {
+            if (c == '"' || c == '\\')
+            {
+                json += '\\';
+            }
+            if (static_cast<unsigned char>(c) >= 0x20)
+            {
+                json += c;
+            }
+        }
+        snprintf(line, sizeof(line), "\",\n  \"duration_seconds\": %.3f,\n  \"fps\": %u,\n  \"result\": \"%s\",\n  \"counters\": {\n",
+                 durationSeconds, fps, succeeded ? "ok" : "failed");
+        json += line;
+        for (size_t i = 0; i < CounterCount; ++i)
+        {
+            snprintf(line, sizeof(line), "    \"%s\": %llu%s\n", HealthCounterName(static_cast<HealthCounter>(i)),
+                     static_cast<unsigned long long>(snapshot.values[i]), i + 1 < CounterCount ? "," : "");
+            json += line;
+        }
+        json += "  }";
+        if (!extraMembers.empty())
+        {
+            json += ",\n";
+            json += extraMembers;
+        }
+        json += "\n}\n";
+    }
+
+    //----------------------------------------------------------------------------------
+    // [HealthCounters::FormatCounters]
+    // Just the counters, on one line: {"frames_captured":750,...} (for the control
+    // socket's query-stats, see ControlProtocol.h).
+    //----------------------------------------------------------------------------------
+    static void FormatCounters(const Snapshot& snapshot, std::string& json)
+    {
+        char member[80];
+        json = "{";
+        for (size_t i = 0; i < CounterCount; ++i)
+        {
+            snprintf(member, sizeof(member), "%s\"%s\":%llu", i ? "," : "", HealthCounterName(static_cast<HealthCounter>(i)),
+                     static_cast<unsigned long long>(snapshot.values[i]));
+            json += member;
+        }
+        json += "}";
+    }
+
+private:
+    Slot m_slots[MaxThreads];
+    std::atomic<size_t> m_registered{ 0 };
+};
@@ -0,0 +1,222 @@
+#pragma once
+//======================================================================================
+// KeyframeController.h
+// Decides which frames should be encoded as IDR frames and records where they landed.
+//
+// Keyframes are placed on a fixed GOP schedule, when a large part of the screen
+// changes at once (a new window, a slide change), and whenever some other part of
+// the application asks for one, e.g. right before a replay buffer is saved.
+//======================================================================================
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "EncodedSink.h"
+#include "Utf8Path.h"
+
+enum class KeyframeReason : uint32_t
+{
+    None = 0,
+    First = 1,       // The first frame of a recording is always a keyframe.
+    Gop = 2,         // The GOP length has elapsed since the previous keyframe.
+    SceneChange = 3, // The changed area crossed the scene-change threshold.
+    Requested = 4,   // RequestKeyframe() was called.
+};
+
+//======================================================================================
+// KeyframeController
+//======================================================================================
+class KeyframeController
+{
+public:
+    // gopLength: frames between scheduled keyframes (0 disables the schedule).
+    // sceneThreshold: changed-area fraction that forces a keyframe (0 disables it).
+    // sceneCooldown: minimum frames between two scene-change keyframes, so a burst
+    //                of large updates (e.g. dragging a window) does not become a
+    //                burst of expensive IDR frames.
+    KeyframeController(uint32_t gopLength, double sceneThreshold, uint32_t sceneCooldown) :
+        m_gopLength(gopLength),
+        m_sceneThreshold(sceneThreshold),
+        m_sceneCooldown(sceneCooldown),
+        m_framesSinceKeyframe(0),
+        m_hasKeyframe(false),
+        m_requested(false)
+    {
+    }
+
+    // Thread-safe: may be called from any thread. The next frame passed to Decide()
+    // becomes a keyframe.
+    void RequestKeyframe()
+    {
+        m_requested.store(true, std::memory_order_release);
+    }
+
+    bool SceneDetectionEnabled() const
+    {
+        return m_sceneThreshold > 0.0;
+    }
+
+    // Called once per encoded frame, in order, from the capture thread.
+    // changedFraction is the share of the frame area that differs from the previous
+    // frame (0..1); pass 0 if it was not measured.
+    KeyframeReason Decide(double changedFraction)
+    {
+        KeyframeReason reason = KeyframeReason::None;
+        if (!m_hasKeyframe)
+        {
+            reason = KeyframeReason::First;
+        }
+        else if (m_requested.exchange(false, std::memory_order_acq_rel))
+        {
+            reason = KeyframeReason::Requested;
+        }
+        else if (m_gopLength != 0 && m_framesSinceKeyframe + 1 >= m_gopLength)
+        {
+            reason = KeyframeReason::Gop;
+        }
+        else if (SceneDetectionEnabled() && changedFraction >= m_sceneThreshold &&
+                 m_framesSinceKeyframe + 1 >= m_sceneCooldown)
+        {
+            reason = KeyframeReason::SceneChange;
+        }
+
+        if (reason != KeyframeReason::None)
+        {
+            // An IDR restarts the GOP, so the schedule counts from here.
+            m_hasKeyframe = true;
+            m_framesSinceKeyframe = 0;
+        }
+        else
+        {
+            ++m_framesSinceKeyframe;
+        }
+        return reason;
+    }
+
+private:
+    const uint32_t m_gopLength;
+    const double m_sceneThreshold;
+    const uint32_t m_sceneCooldown;
+    uint32_t m_framesSinceKeyframe;
+    bool m_hasKeyframe;
+    std::atomic<bool> m_requested;
+};
+
+//======================================================================================
+// KeyframeIndexWriter
+// Writes the ".kfidx" sidecar: a 16-byte header followed by one fixed-size record
+// per keyframe. All fields are little-endian.
+//
+//   Header: char magic[4] = "KFIX", uint32 version = 1, uint32 timescale, uint32 0
+//   Record: uint64 frameIndex, int64 timestamp (in timescale units),
+//           uint64 byteOffset (UINT64_MAX if the container does not expose it),
+//           uint32 reason (KeyframeReason), uint32 0
+//
+// Each record is flushed as it is written, so the index remains usable for
+// everything up to the last keyframe if the recorder dies mid-session.
+//======================================================================================
+class KeyframeIndexWriter
+{
+public:
+    static const uint32_t Version = 1;
+    static const uint64_t UnknownOffset = ~0ull;
+
+    bool Open(const std::string& path, uint32_t timescale)
+    {
+        if (!OpenUtf8(m_file, path, std::ios::binary | std::ios::trunc))
+        {
+            return false;
+        }
+        const uint32_t header[4] = { 0x5849464Bu /* "KFIX" */, Version, timescale, 0 };
+        m_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        m_file.flush();
+        return m_file.good();
+    }
+
+    bool IsOpen() const
+    {
+        return m_file.is_open();
+    }
+
+    void Append(uint64_t frameIndex, int64_t timestamp, uint64_t byteOffset, KeyframeReason reason)
+    {
+        if (!m_file.is_open())
+        {
+            return;
+        }
+        struct Record
+        {
+            uint64_t frameIndex;
+            int64_t timestamp;
+            uint64_t byteOffset;
+            uint32_t reason;
+            uint32_t reserved;
+        } record = { frameIndex, timestamp, byteOffset, static_cast<uint32_t>(reason), 0 };
+        static_assert(sizeof(Record) == 32, "Keyframe index records must stay 32 bytes");
+        m_file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        m_file.flush();
+    }
+
+    void Close()
+    {
+        if (m_file.is_open())
+        {
+            m_file.close();
+        }
+    }
+
+private:
+    std::ofstream m_file;
+};
+
+//======================================================================================
+// KeyframeIndexingSink
+// Sits in front of a muxer and records every keyframe that actually comes out of
+// the encoder, with the byte offset it starts at in the muxer's output. The encoder
+// has the final say on keyframes, so indexing its output (rather than our requests)
+// keeps the index exact.
+//======================================================================================
+class KeyframeIndexingSink : public EncodedSink
+{
+public:
+    KeyframeIndexingSink(EncodedSink* pInner, const ByteSink* pOutput, KeyframeIndexWriter* pIndex) :
+        m_pInner(pInner),
+        m_pOutput(pOutput),
+        m_pIndex(pIndex),
+        m_requestedFrameId(~0ull),
+        m_requestedReason(KeyframeReason::None)
+    {
+    }
+
+    // Remembers why we asked for a keyframe at frameId, for the index record.
+    void NoteKeyframeRequest(uint64_t frameId, KeyframeReason reason)
+    {
+        m_requestedFrameId = frameId;
+        m_requestedReason = reason;
+    }
+
+    bool WriteFrame(const EncodedFrame& frame) override
+    {
+        if (frame.keyframe && m_pIndex)
+        {
+            // Muxers flush at the end of every frame, so the output position is
+            // exactly where this frame's bytes begin.
+            const KeyframeReason reason = (frame.frameId == m_requestedFrameId) ? m_requestedReason : KeyframeReason::Gop;
+            m_pIndex->Append(frame.frameId, frame.pts, m_pOutput->Position(), reason);
+        }
+        return m_pInner->WriteFrame(frame);
+    }
+
+    bool Finish() override
+    {
+        return m_pInner->Finish();
+    }
+
+private:
+    EncodedSink* m_pInner;
+    const ByteSink* m_pOutput;
+    KeyframeIndexWriter* m_pIndex;
+    uint64_t m_requestedFrameId;
+    KeyframeReason m_requestedReason;
+};
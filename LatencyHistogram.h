@@ -0,0 +1,180 @@
+#pragma once
+//======================================================================================
+// LatencyHistogram.h
+// Fixed-size log-linear histogram of durations, cheap enough to record into from
+// the capture loop on every frame. Values are in whatever unit the caller uses
+// (nanoseconds, timestamp-counter ticks).
+//
+// Each power of two is split into 16 linear sub-buckets, so any recorded value is
+// reported within 1/16 (6.25%) of its true value, up to 2^40, in under 5 KB.
+//
+// A histogram has a single writer. Record() is then a plain load and store per
+// counter - no locked instructions - and other threads can still read a
+// consistent-enough snapshot at any time.
+//======================================================================================
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+class LatencyHistogram
+{
+public:
+    static const int SubBucketBits = 4;
+    static const uint64_t SubBucketCount = 1ull << SubBucketBits;
+    static const int MaxExponent = 40; // Values are clamped below 2^40.
+    static const size_t BucketCount = (MaxExponent - SubBucketBits + 1) * SubBucketCount;
+
+    struct Summary
+    {
+        uint64_t count = 0;
+        uint64_t mean = 0;
+        uint64_t p50 = 0;
+        uint64_t p99 = 0;
+        uint64_t p999 = 0;
+        uint64_t max = 0;
+    };
+
+    LatencyHistogram()
+    {
+        Reset();
+    }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // Only ever call from one thread per histogram.
+    void Record(uint64_t value)
+    {
+        std::atomic<uint64_t>& count = m_counts[BucketIndex(value)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_sum.store(m_sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        if (value > m_max.load(std::memory_order_relaxed))
+        {
+            m_max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    // Not atomic with respect to concurrent Record() calls; use between runs.
+    void Reset()
+    {
+        for (size_t i = 0; i < BucketCount; ++i)
+        {
+            m_counts[i].store(0, std::memory_order_relaxed);
+        }
+        m_sum.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [LatencyHistogram::Summarize]
+    // Percentiles are reported as the upper edge of the bucket they fall in (capped
+    // at the true maximum), so they never understate a latency.
+    //----------------------------------------------------------------------------------
+    Summary Summarize() const
+    {
+        // Copy the buckets first so the percentiles come from one consistent count.
+        static_assert(BucketCount <= 1024, "snapshot buffer");
+        uint64_t counts[BucketCount];
+        Summary summary;
+        for (size_t i = 0; i < BucketCount; ++i)
+        {
+            counts[i] = m_counts[i].load(std::memory_order_relaxed);
+            summary.count += counts[i];
+        }
+        summary.max = m_max.load(std::memory_order_relaxed);
+        if (summary.count == 0)
+        {
+            return summary;
+        }
+        summary.mean = m_sum.load(std::memory_order_relaxed) / summary.count;
+        summary.p50 = Percentile(counts, summary.count, 0.50, summary.max);
+        summary.p99 = Percentile(counts, summary.count, 0.99, summary.max);
+        summary.p999 = Percentile(counts, summary.count, 0.999, summary.max);
+        return summary;
+    }
+
+    uint64_t Sum() const
+    {
+        return m_sum.load(std::memory_order_relaxed);
+    }
+
+    // Values recorded in buckets that lie entirely at or below 'bound', i.e. a count
+    // that may miss values up to 1/16 below it. For cumulative exports.
+    uint64_t CountAtOrBelow(uint64_t bound) const
+    {
+        uint64_t count = 0;
+        for (size_t i = 0; i < BucketCount && BucketUpperBound(i) <= bound; ++i)
+        {
+            count += m_counts[i].load(std::memory_order_relaxed);
+        }
+        return count;
+    }
+
+    static size_t BucketIndex(uint64_t value)
+    {
+        if (value < SubBucketCount)
+        {
+            return static_cast<size_t>(value);
+        }
+        if (value >= (1ull << MaxExponent))
+        {
+            value = (1ull << MaxExponent) - 1;
+        }
+        const int exponent = HighestBit(value); // >= SubBucketBits
+        const uint64_t sub = (value >> (exponent - SubBucketBits)) & (SubBucketCount - 1);
+        return static_cast<size_t>((exponent - SubBucketBits + 1) * SubBucketCount + sub);
+    }
+
+    // Largest value that lands in the bucket.
+    static uint64_t BucketUpperBound(size_t index)
+    {
+        if (index < SubBucketCount)
+        {
+            return index;
+        }
+        const int exponent = static_cast<int>(index / SubBucketCount) + SubBucketBits - 1;
+        const uint64_t sub = index % SubBucketCount;
+        const int shift = exponent - SubBucketBits;
+        return ((SubBucketCount + sub + 1) << shift) - 1;
+    }
+
+private:
+    static int HighestBit(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<int>(index);
+#else
+        return 63 - __builtin_clzll(value);
+#endif
+    }
+
+    static uint64_t Percentile(const uint64_t* pCounts, uint64_t total, double fraction, uint64_t max)
+    {
+        uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(total) + 0.5);
+        if (rank == 0)
+        {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BucketCount; ++i)
+        {
+            seen += pCounts[i];
+            if (seen >= rank)
+            {
+                const uint64_t bound = BucketUpperBound(i);
+                return bound < max ? bound : max;
+            }
+        }
+        return max;
+    }
+
+    std::atomic<uint64_t> m_counts[BucketCount];
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+};
@@ -0,0 +1,513 @@
+#pragma once
+//======================================================================================
+// Log.h
+// Asynchronous logging that is safe to call from the capture loop.
+//
+// A LOG_* call copies its format string pointer and arguments into a fixed-size
+// record in a bounded lock-free queue and returns; a background thread formats
+// the records and writes them to the console and, optionally, a log file. The
+// caller never allocates, formats, locks or touches the console. If the queue is
+// full the record is dropped (and the drop counted) rather than stalling capture.
+//
+//     LOG_INFO("Wrote {} bytes to {}", bytes, path);
+//     LOG_ERROR("Encoder failed: 0x{:x}", hr);
+//
+// '{}' prints the next argument, '{:x}' prints it in hex. Strings are copied, up to
+// the record's text capacity. Format strings must be literals: only the pointer is
+// kept. Levels below LOG_MIN_LEVEL (0 = debug ... 3 = error) compile to nothing;
+// the rest are filtered at run time with a single load.
+//======================================================================================
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "FileWriter.h"
+#include "TickClock.h"
+#include "Trace.h"
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+namespace Log
+{
+    enum class Level : uint8_t
+    {
+        Debug = 0,
+        Info = 1,
+        Warn = 2,
+        Error = 3,
+    };
+
+    inline const char* LevelName(Level level)
+    {
+        switch (level)
+        {
+        case Level::Debug: return "debug";
+        case Level::Info: return "info ";
+        case Level::Warn: return "warn ";
+        case Level::Error: return "error";
+        default: return "?    ";
+        }
+    }
+
+    //==================================================================================
+    // Record
+    // One log call, captured by value. 256 bytes including the queue's sequence.
+    //==================================================================================
+    struct Record
+    {
+        static const size_t MaxArgs = 8;
+        static const size_t TextCapacity = 152;
+
+        enum class ArgType : uint8_t
+        {
+            Signed,
+            Unsigned,
+            Double,
+            Text, // Offset/length into 'text'.
+        };
+
+        union Arg
+        {
+            int64_t i;
+            uint64_t u;
+            double d;
+            struct
+            {
+                uint16_t offset;
+                uint16_t length;
+            } text;
+        };
+
+        uint64_t ticks;
+        const char* pFormat;
+        const char* pThreadName;
+        Level level;
+        uint8_t argCount;
+        uint8_t textUsed;
+        ArgType argTypes[MaxArgs];
+        Arg args[MaxArgs];
+        char text[TextCapacity];
+
+        void Add(int64_t value) { if (argCount < MaxArgs) { argTypes[argCount] = ArgType::Signed; args[argCount++].i = value; } }
+        void Add(uint64_t value) { if (argCount < MaxArgs) { argTypes[argCount] = ArgType::Unsigned; args[argCount++].u = value; } }
+        void Add(double value) { if (argCount < MaxArgs) { argTypes[argCount] = ArgType::Double; args[argCount++].d = value; } }
+
+        void AddText(const char* pText, size_t length)
+        {
+            if (argCount >= MaxArgs)
+            {
+                return;
+            }
+            if (length > TextCapacity - textUsed)
+            {
+                length = TextCapacity - textUsed;
+            }
+            memcpy(text + textUsed, pText, length);
+            argTypes[argCount] = ArgType::Text;
+            args[argCount].text.offset = textUsed;
+            args[argCount].text.length = static_cast<uint16_t>(length);
+            ++argCount;
+            textUsed = static_cast<uint8_t>(textUsed + length);
+        }
+
+        // --- Argument capture by type ---
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type Capture(T value) { Add(static_cast<int64_t>(value)); }
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type Capture(T value) { Add(static_cast<uint64_t>(value)); }
+        template <typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type Capture(T value) { Add(static_cast<double>(value)); }
+        template <typename T>
+        typename std::enable_if<std::is_enum<T>::value>::type Capture(T value) { Add(static_cast<int64_t>(value)); }
+        void Capture(const char* pText) { pText ? AddText(pText, strlen(pText)) : AddText("(null)", 6); }
+        void Capture(char* pText) { Capture(static_cast<const char*>(pText)); }
+        void Capture(const std::string& text) { AddText(text.data(), text.size()); }
+        void Capture(const void* p) { Add(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(p))); }
+
+        void CaptureAll() {}
+        template <typename First, typename... Rest>
+        void CaptureAll(const First& first, const Rest&... rest)
+        {
+            Capture(first);
+            CaptureAll(rest...);
+        }
+
+        //------------------------------------------------------------------------------
+        // [Record::Format]
+        // Expands '{}' / '{:x}' placeholders. Runs on the logging thread.
+        //------------------------------------------------------------------------------
+        void Format(std::string& out) const
+        {
+            size_t next = 0;
+            char number[32];
+            for (const char* p = pFormat; *p; ++p)
+            {
+                if (p[0] == '{' && (p[1] == '}' || (p[1] == ':' && p[2] == 'x' && p[3] == '}')))
+                {
+                    const bool hex = (p[1] == ':');
+                    p += hex ? 3 : 1;
+                    if (next >= argCount)
+                    {
+                        out += "{?}";
+                        continue;
+                    }
+                    const Arg& arg = args[next];
+                    switch (argTypes[next++])
+                    {
+                    case ArgType::Signed:
+                        // Negative values in hex are nearly always HRESULTs: print 32 bits.
+                        if (hex) snprintf(number, sizeof(number), "%llx", static_cast<unsigned long long>(arg.i) & 0xFFFFFFFFull);
+                        else snprintf(number, sizeof(number), "%lld", static_cast<long long>(arg.i));
+                        out += number;
+                        break;
+                    case ArgType::Unsigned:
+                        snprintf(number, sizeof(number), hex ? "%llx" : "%llu", static_cast<unsigned long long>(arg.u));
+                        out += number;
+                        break;
+                    case ArgType::Double:
+                        snprintf(number, sizeof(number), "%g", arg.d);
+                        out += number;
+                        break;
+                    case ArgType::Text:
+                        out.append(text + arg.text.offset, arg.text.length);
+                        break;
+                    }
+                }
+                else
+                {
+                    out += *p;
+                }
+            }
+        }
+    };
+
+    //==================================================================================
+    // RecordQueue
+    // Bounded multi-producer/single-consumer queue: each cell carries a sequence
+    // number, so producers claim a slot with one compare-exchange and publish it
+    // with one release store (D. Vyukov's bounded queue).
+    //==================================================================================
+    class RecordQueue
+    {
+    public:
+        static const size_t Capacity = 8192; // 2 MB of records.
+
+        RecordQueue()
+        {
+            for (size_t i = 0; i < Capacity; ++i)
+            {
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        // Returns a slot to fill, or nullptr if the queue is full. Publish() it after.
+        Record* Claim(uint64_t* pTicket)
+        {
+            uint64_t position = m_tail.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell& cell = m_cells[position & (Capacity - 1)];
+                const uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+                const int64_t difference = static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+                if (difference == 0)
+                {
+                    if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        *pTicket = position;
+                        return &cell.record;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return nullptr; // Full.
+                }
+                else
+                {
+                    position = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        void Publish(uint64_t ticket)
+        {
+            m_cells[ticket & (Capacity - 1)].sequence.store(ticket + 1, std::memory_order_release);
+        }
+
+        // Consumer: the next published record, or nullptr. Release() it after use.
+        const Record* Peek()
+        {
+            Cell& cell = m_cells[m_head & (Capacity - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+            {
+                return nullptr;
+            }
+            return &cell.record;
+        }
+
+        void Release()
+        {
+            m_cells[m_head & (Capacity - 1)].sequence.store(m_head + Capacity, std::memory_order_release);
+            ++m_head;
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<uint64_t> sequence;
+            Record record;
+        };
+
+        Cell m_cells[Capacity];
+        alignas(64) std::atomic<uint64_t> m_tail{ 0 };
+        alignas(64) uint64_t m_head = 0; // Consumer only.
+    };
+
+    //==================================================================================
+    // Logger
+    //==================================================================================
+    class Logger
+    {
+    public:
+        static Logger& Instance()
+        {
+            static Logger logger;
+            return logger;
+        }
+
+        void SetLevel(Level level) { m_level.store(static_cast<uint8_t>(level), std::memory_order_relaxed); }
+
+    // With console output off, only the log file (if any) receives the lines.
+    void SetConsoleOutput(bool enabled) { m_console.store(enabled, std::memory_order_relaxed); }
+        bool IsEnabled(Level level) const { return static_cast<uint8_t>(level) >= m_level.load(std::memory_order_relaxed); }
+
+        //------------------------------------------------------------------------------
+        // [Logger::Start]
+        // Starts the background thread. Until then (and after Stop()) records are
+        // formatted and written synchronously. logFilePath may be empty.
+        //------------------------------------------------------------------------------
+        bool Start(const std::string& logFilePath)
+        {
+            if (m_running.load())
+            {
+                return true;
+            }
+            bool ok = true;
+            if (!logFilePath.empty())
+            {
+                FileWriter::Options io;
+                io.bufferSize = 256 * 1024;
+                io.bufferCount = 2;
+                ok = m_file.Open(logFilePath, io);
+            }
+            m_stopping = false;
+            m_running.store(true);
+            m_thread = std::thread(&Logger::Run, this);
+            return ok;
+        }
+
+        // Writes everything queued, then stops the thread and closes the log file.
+        void Stop()
+        {
+            if (!m_running.load())
+            {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_cv.notify_all();
+            m_thread.join();
+            m_running.store(false);
+            if (m_file.IsOpen())
+            {
+                m_file.Close();
+            }
+        }
+
+        // Blocks until everything logged so far has been written, e.g. before showing
+        // a message box or exiting.
+        void Flush()
+        {
+            if (!m_running.load())
+            {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            const uint64_t target = ++m_flushRequests;
+            m_cv.notify_all();
+            m_cv.wait(lock, [&] { return m_flushesDone >= target || !m_running.load(); });
+        }
+
+        uint64_t DroppedRecords() const { return m_dropped.load(std::memory_order_relaxed); }
+
+        template <typename... Args>
+        void Write(Level level, const char* pFormat, const Args&... args)
+        {
+            if (!m_running.load(std::memory_order_acquire))
+            {
+                Record record;
+                Fill(record, level, pFormat, args...);
+                std::lock_guard<std::mutex> lock(m_syncMutex);
+                m_nsPerTick = TickClock::NsPerTick();
+                std::string line;
+                Emit(record, line);
+                fflush(stdout);
+                return;
+            }
+
+            uint64_t ticket;
+            Record* pRecord = m_queue.Claim(&ticket);
+            if (!pRecord)
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            Fill(*pRecord, level, pFormat, args...);
+            m_queue.Publish(ticket);
+        }
+
+    private:
+        Logger()
+        {
+            TickClock::Start(); // Log timestamps count from here.
+        }
+
+        ~Logger() { Stop(); }
+
+        template <typename... Args>
+        static void Fill(Record& record, Level level, const char* pFormat, const Args&... args)
+        {
+            record.ticks = TickClock::Now();
+            record.pFormat = pFormat;
+            record.pThreadName = Trace::Local().pPendingName;
+            record.level = level;
+            record.argCount = 0;
+            record.textUsed = 0;
+            record.CaptureAll(args...);
+        }
+
+        // Formats one record and writes it to the console and log file.
+        void Emit(const Record& record, std::string& line)
+        {
+            char prefix[64];
+            const double seconds = (record.ticks > TickClock::Start().ticks)
+                ? (record.ticks - TickClock::Start().ticks) * m_nsPerTick * 1e-9 : 0.0;
+            snprintf(prefix, sizeof(prefix), "[%10.6f] %s %s: ", seconds, LevelName(record.level),
+                     record.pThreadName ? record.pThreadName : "main");
+            line.assign(prefix);
+            record.Format(line);
+            line += '\n';
+
+            if (m_console.load(std::memory_order_relaxed))
+            {
+                FILE* pConsole = (record.level >= Level::Warn) ? stderr : stdout;
+                fwrite(line.data(), 1, line.size(), pConsole);
+            }
+            if (m_file.IsOpen())
+            {
+                m_file.Write(line.data(), line.size());
+            }
+        }
+
+        void Run()
+        {
+            Trace::SetThreadName("logger");
+            std::string line;
+            line.reserve(512);
+            uint64_t reportedDrops = 0;
+            for (;;)
+            {
+                uint64_t flushTarget;
+                bool stopping;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    // Producers never signal; poll often enough that output keeps up.
+                    m_cv.wait_for(lock, std::chrono::milliseconds(5), [this] { return m_stopping || m_flushRequests > m_flushesDone; });
+                    flushTarget = m_flushRequests;
+                    stopping = m_stopping;
+                }
+
+                m_nsPerTick = TickClock::NsPerTick();
+                bool wrote = false;
+                while (const Record* pRecord = m_queue.Peek())
+                {
+                    Emit(*pRecord, line);
+                    m_queue.Release();
+                    wrote = true;
+                }
+                const uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+                if (dropped != reportedDrops)
+                {
+                    fprintf(stderr, "[log] %llu messages dropped (queue full)\n", static_cast<unsigned long long>(dropped - reportedDrops));
+                    reportedDrops = dropped;
+                    wrote = true;
+                }
+                if (wrote)
+                {
+                    fflush(stdout);
+                    fflush(stderr);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_flushesDone = flushTarget;
+                }
+                m_cv.notify_all();
+                if (stopping)
+                {
+                    return;
+                }
+            }
+        }
+
+        RecordQueue m_queue;
+        std::atomic<uint8_t> m_level{ static_cast<uint8_t>(Level::Info) };
+        std::atomic<bool> m_running{ false };
+    std::atomic<bool> m_console{ true };
+        std::atomic<uint64_t> m_dropped{ 0 };
+        double m_nsPerTick = 1.0; // Whoever is formatting: the logging thread, or Write() before Start().
+        FileWriter m_file;
+        std::thread m_thread;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_stopping = false;
+        uint64_t m_flushRequests = 0;
+        uint64_t m_flushesDone = 0;
+
+        std::mutex m_syncMutex; // Serializes synchronous writes before Start().
+    };
+}
+
+// The level check against LOG_MIN_LEVEL happens in the preprocessor, so disabled
+// levels cost nothing, not even argument evaluation.
+#define LOG_WRITE(level, ...) \
+    do { if (Log::Logger::Instance().IsEnabled(level)) Log::Logger::Instance().Write(level, __VA_ARGS__); } while (false)
+
+#if LOG_MIN_LEVEL <= 0
+#define LOG_DEBUG(...) LOG_WRITE(Log::Level::Debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (false)
+#endif
+#if LOG_MIN_LEVEL <= 1
+#define LOG_INFO(...) LOG_WRITE(Log::Level::Info, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (false)
+#endif
+#if LOG_MIN_LEVEL <= 2
+#define LOG_WARN(...) LOG_WRITE(Log::Level::Warn, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (false)
+#endif
+#define LOG_ERROR(...) LOG_WRITE(Log::Level::Error, __VA_ARGS__)
@@ -0,0 +1,371 @@
+#pragma once
+//======================================================================================
+// MFH264Decoder.h
+// Decodes our own H.264 access units back to NV12 with a Media Foundation decoder
+// MFT, for measuring what the encoder did to the picture (see QualityMonitor.h).
+//
+// Like MFH264Encoder we use a synchronous MFT and pull every available output
+// right after each input. The decoder picks its output buffer layout: luma rows
+// are padded to its own pitch and the frame height to a multiple of 16, so each
+// picture is handed out as plane pointers and strides.
+//======================================================================================
+#include <windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mftransform.h>
+#include <mferror.h>
+#include <functional>
+
+#include "ComHelpers.h"
+#include "EncodedSink.h"
+
+// One decoded picture; only valid for the duration of the callback.
+struct DecodedPicture
+{
+    const BYTE* pY;
+    LONG yStride;
+    const BYTE* pUV;
+    LONG uvStride;
+    LONGLONG pts;
+};
+
+class MFH264Decoder
+{
+public:
+    typedef std::function<void(const DecodedPicture&)> PictureCallback;
+
+    MFH264Decoder() :
+        m_pDecoder(nullptr),
+        m_pInputSample(nullptr),
+        m_pInputBuffer(nullptr),
+        m_inputBufferSize(0),
+        m_pOutputSample(nullptr),
+        m_pOutputBuffer(nullptr),
+        m_outputBufferSize(0),
+        m_providesSamples(false),
+        m_outputHeight(0),
+        m_outputStride(0),
+        m_streaming(false)
+    {
+    }
+
+    ~MFH264Decoder()
+    {
+        Shutdown();
+    }
+
+    HRESULT Initialize(UINT32 width, UINT32 height, UINT32 fps);
+    HRESULT Decode(const EncodedFrame& frame, const PictureCallback& onPicture);
+    HRESULT Flush();
+    void Shutdown();
+
+private:
+    HRESULT SelectOutputType();
+    HRESULT PullOutputs(const PictureCallback& onPicture);
+
+    IMFTransform* m_pDecoder;
+    IMFSample* m_pInputSample;
+    IMFMediaBuffer* m_pInputBuffer;
+    DWORD m_inputBufferSize;
+    IMFSample* m_pOutputSample;
+    IMFMediaBuffer* m_pOutputBuffer;
+    DWORD m_outputBufferSize;
+    bool m_providesSamples;
+    UINT32 m_outputHeight; // Coded height, e.g. 1088 for 1080p.
+    LONG m_outputStride;   // Used when the buffer has no IMF2DBuffer.
+    bool m_streaming;
+};
+
+//--------------------------------------------------------------------------------------
+// [MFH264Decoder::Initialize]
+// Finds a synchronous H.264 decoder and configures H.264 in / NV12 out.
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Decoder::Initialize(UINT32 width, UINT32 height, UINT32 fps)
+{
+    HRESULT hr = S_OK;
+    IMFActivate** ppActivate = nullptr;
+    UINT32 activateCount = 0;
+    IMFMediaType* pInputType = nullptr;
+    IMFAttributes* pAttributes = nullptr;
+
+    do
+    {
+        // 1. Enumerate decoders that take H.264 and produce NV12.
+        MFT_REGISTER_TYPE_INFO inputInfo = { MFMediaType_Video, MFVideoFormat_H264 };
+        MFT_REGISTER_TYPE_INFO outputInfo = { MFMediaType_Video, MFVideoFormat_NV12 };
+        hr = MFTEnumEx(MFT_CATEGORY_VIDEO_DECODER, MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_LOCALMFT | MFT_ENUM_FLAG_SORTANDFILTER,
+                       &inputInfo, &outputInfo, &ppActivate, &activateCount);
+        if (FAILED(hr)) break;
+        if (activateCount == 0)
+        {
+            hr = MF_E_TOPO_CODEC_NOT_FOUND;
+            break;
+        }
+        hr = ppActivate[0]->ActivateObject(IID_PPV_ARGS(&m_pDecoder));
+        if (FAILED(hr)) break;
+
+        // Output each picture as soon as it is decoded; we never send B-frames.
+        if (SUCCEEDED(m_pDecoder->GetAttributes(&pAttributes)))
+        {
+            pAttributes->SetUINT32(MF_LOW_LATENCY, TRUE);
+        }
+
+        // 2. Decoders want the input type first; the output types follow from it.
+        hr = MFCreateMediaType(&pInputType);
+        if (FAILED(hr)) break;
+        hr = pInputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+        if (SUCCEEDED(hr)) hr = pInputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
+        if (SUCCEEDED(hr)) hr = MFSetAttributeRatio(pInputType, MF_MT_FRAME_RATE, fps, 1);
+        if (SUCCEEDED(hr)) hr = MFSetAttributeSize(pInputType, MF_MT_FRAME_SIZE, width, height);
+        if (SUCCEEDED(hr)) hr = pInputType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+        if (SUCCEEDED(hr)) hr = m_pDecoder->SetInputType(0, pInputType, 0);
+        if (FAILED(hr)) break;
+
+        hr = SelectOutputType();
+        if (FAILED(hr)) break;
+
+        hr = MFCreateSample(&m_pInputSample);
+        if (FAILED(hr)) break;
+
+        hr = m_pDecoder->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0);
+        if (SUCCEEDED(hr)) hr = m_pDecoder->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0);
+        if (FAILED(hr)) break;
+        m_streaming = true;
+
+    } while (false);
+
+    for (UINT32 i = 0; i < activateCount; ++i)
+    {
+        SafeRelease(&ppActivate[i]);
+    }
+    CoTaskMemFree(ppActivate);
+    SafeRelease(&pInputType);
+    SafeRelease(&pAttributes);
+
+    if (FAILED(hr))
+    {
+        Shutdown();
+    }
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Decoder::SelectOutputType]
+// Picks NV12 among the decoder's output types and (re)creates our output sample if
+// the decoder expects the caller to provide one. Called at start-up and whenever
+// the decoder reports a format change (it learns the real size from the SPS).
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Decoder::SelectOutputType()
+{
+    HRESULT hr = S_OK;
+    IMFMediaType* pType = nullptr;
+    for (DWORD i = 0; ; ++i)
+    {
+        hr = m_pDecoder->GetOutputAvailableType(0, i, &pType);
+        if (FAILED(hr))
+        {
+            return hr; // MF_E_NO_MORE_TYPES: no NV12 on offer.
+        }
+        GUID subtype = GUID_NULL;
+        if (SUCCEEDED(pType->GetGUID(MF_MT_SUBTYPE, &subtype)) && subtype == MFVideoFormat_NV12)
+        {
+            break;
+        }
+        SafeRelease(&pType);
+    }
+
+    hr = m_pDecoder->SetOutputType(0, pType, 0);
+    if (SUCCEEDED(hr))
+    {
+        UINT32 width = 0;
+        UINT32 stride = 0;
+        MFGetAttributeSize(pType, MF_MT_FRAME_SIZE, &width, &m_outputHeight);
+        m_outputStride = SUCCEEDED(pType->GetUINT32(MF_MT_DEFAULT_STRIDE, &stride)) ? (LONG)stride : (LONG)width;
+    }
+    SafeRelease(&pType);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    MFT_OUTPUT_STREAM_INFO info = {};
+    hr = m_pDecoder->GetOutputStreamInfo(0, &info);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    m_providesSamples = (info.dwFlags & (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES | MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES)) != 0;
+    if (m_providesSamples || (m_pOutputSample && info.cbSize <= m_outputBufferSize))
+    {
+        return S_OK;
+    }
+
+    SafeRelease(&m_pOutputBuffer);
+    SafeRelease(&m_pOutputSample);
+    m_outputBufferSize = info.cbSize;
+    hr = MFCreateSample(&m_pOutputSample);
+    if (SUCCEEDED(hr)) hr = MFCreateMemoryBuffer(m_outputBufferSize, &m_pOutputBuffer);
+    if (SUCCEEDED(hr)) hr = m_pOutputSample->AddBuffer(m_pOutputBuffer);
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Decoder::Decode]
+// Submits one Annex-B access unit and calls onPicture for every picture the
+// decoder outputs. Pictures carry the pts of the access unit they came from.
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Decoder::Decode(const EncodedFrame& frame, const PictureCallback& onPicture)
+{
+    if (!m_streaming)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    // The decoder may hold on to the input buffer, so a new one is made when it is
+    // too small rather than resized in place.
+    HRESULT hr = S_OK;
+    if (!m_pInputBuffer || m_inputBufferSize < frame.size)
+    {
+        m_pInputSample->RemoveAllBuffers();
+        SafeRelease(&m_pInputBuffer);
+        m_inputBufferSize = (DWORD)frame.size * 2;
+        hr = MFCreateMemoryBuffer(m_inputBufferSize, &m_pInputBuffer);
+        if (SUCCEEDED(hr)) hr = m_pInputSample->AddBuffer(m_pInputBuffer);
+        if (FAILED(hr)) return hr;
+    }
+
+    BYTE* pDst = nullptr;
+    hr = m_pInputBuffer->Lock(&pDst, nullptr, nullptr);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    memcpy(pDst, frame.pData, frame.size);
+    m_pInputBuffer->Unlock();
+    m_pInputBuffer->SetCurrentLength((DWORD)frame.size);
+
+    m_pInputSample->SetSampleTime(frame.pts);
+    m_pInputSample->SetSampleDuration(frame.duration);
+    m_pInputSample->SetUINT32(MFSampleExtension_CleanPoint, frame.keyframe ? TRUE : FALSE);
+
+    hr = m_pDecoder->ProcessInput(0, m_pInputSample, 0);
+    if (hr == MF_E_NOTACCEPTING)
+    {
+        hr = PullOutputs(onPicture);
+        if (SUCCEEDED(hr)) hr = m_pDecoder->ProcessInput(0, m_pInputSample, 0);
+    }
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    return PullOutputs(onPicture);
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Decoder::PullOutputs]
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Decoder::PullOutputs(const PictureCallback& onPicture)
+{
+    for (;;)
+    {
+        if (!m_providesSamples)
+        {
+            m_pOutputBuffer->SetCurrentLength(0);
+        }
+
+        MFT_OUTPUT_DATA_BUFFER output = {};
+        output.dwStreamID = 0;
+        output.pSample = m_providesSamples ? nullptr : m_pOutputSample;
+        DWORD status = 0;
+        HRESULT hr = m_pDecoder->ProcessOutput(0, 1, &output, &status);
+        SafeRelease(&output.pEvents);
+
+        if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+        {
+            return S_OK;
+        }
+        if (hr == MF_E_TRANSFORM_STREAM_CHANGE)
+        {
+            hr = SelectOutputType();
+            if (FAILED(hr)) return hr;
+            continue;
+        }
+        if (FAILED(hr))
+        {
+            if (m_providesSamples) SafeRelease(&output.pSample);
+            return hr;
+        }
+
+        IMFSample* pSample = output.pSample;
+        IMFMediaBuffer* pBuffer = nullptr;
+        IMF2DBuffer* p2DBuffer = nullptr;
+        hr = pSample->GetBufferByIndex(0, &pBuffer);
+        if (SUCCEEDED(hr))
+        {
+            BYTE* pData = nullptr;
+            LONG stride = m_outputStride;
+            const bool locked2D = SUCCEEDED(pBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer))) &&
+                                  SUCCEEDED(p2DBuffer->Lock2D(&pData, &stride));
+            if (!locked2D)
+            {
+                hr = pBuffer->Lock(&pData, nullptr, nullptr);
+            }
+            if (SUCCEEDED(hr))
+            {
+                DecodedPicture picture;
+                picture.pY = pData;
+                picture.yStride = stride;
+                picture.pUV = pData + (size_t)stride * m_outputHeight;
+                picture.uvStride = stride;
+                picture.pts = 0;
+                pSample->GetSampleTime(&picture.pts);
+                onPicture(picture);
+                if (locked2D)
+                {
+                    p2DBuffer->Unlock2D();
+                }
+                else
+                {
+                    pBuffer->Unlock();
+                }
+            }
+        }
+        SafeRelease(&p2DBuffer);
+        SafeRelease(&pBuffer);
+        if (m_providesSamples)
+        {
+            SafeRelease(&output.pSample);
+        }
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Decoder::Flush]
+// Discards everything queued in the decoder, e.g. after access units were skipped;
+// decoding resumes at the next keyframe.
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Decoder::Flush()
+{
+    return m_pDecoder ? m_pDecoder->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0) : MF_E_NOT_INITIALIZED;
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Decoder::Shutdown]
+//--------------------------------------------------------------------------------------
+inline void MFH264Decoder::Shutdown()
+{
+    if (m_pDecoder && m_streaming)
+    {
+        m_pDecoder->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0);
+        m_streaming = false;
+    }
+    SafeRelease(&m_pInputBuffer);
+    SafeRelease(&m_pInputSample);
+    SafeRelease(&m_pOutputBuffer);
+    SafeRelease(&m_pOutputSample);
+    SafeRelease(&m_pDecoder);
+}
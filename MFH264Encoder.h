@@ -0,0 +1,447 @@
+#pragma once
+//======================================================================================
+// MFH264Encoder.h
+// Drives a Media Foundation H.264 encoder MFT directly, so we get the encoded access
+// units back instead of having the Sink Writer bury them in an MP4. This is what
+// feeds our own muxers (TS, MKV) and streaming outputs.
+//
+// We pick a synchronous (software) encoder, feed it NV12 converted on the CPU from
+// the captured BGRA frame, and pull every available output right after each input.
+// Low-latency mode and no B-frames keep it one frame in, one frame out.
+//======================================================================================
+#include <windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mftransform.h>
+#include <mferror.h>
+#include <strmif.h>
+#include <codecapi.h>
+#include <vector>
+
+#include "ComHelpers.h"
+#include "EncodedSink.h"
+#include "PixelKernels.h"
+
+class MFH264Encoder
+{
+public:
+    MFH264Encoder() :
+        m_pEncoder(nullptr),
+        m_pCodecApi(nullptr),
+        m_pOutputSample(nullptr),
+        m_pOutputBuffer(nullptr),
+        m_outputBufferSize(0),
+        m_providesSamples(false),
+        m_nextInput(0),
+        m_width(0),
+        m_height(0),
+        m_streaming(false)
+    {
+        for (UINT i = 0; i < InputRingSize; ++i)
+        {
+            m_pInputSamples[i] = nullptr;
+            m_pInputBuffers[i] = nullptr;
+        }
+        for (UINT i = 0; i < FrameIdRingSize; ++i)
+        {
+            m_frameIds[i].pts = -1;
+            m_frameIds[i].frameId = 0;
+        }
+    }
+
+    ~MFH264Encoder()
+    {
+        Shutdown();
+    }
+
+    HRESULT Initialize(UINT32 width, UINT32 height, UINT32 fps, UINT32 bitRate, UINT32 gopLength);
+    HRESULT Encode(const BYTE* pBgra, LONG stride, LONGLONG sampleTime, LONGLONG duration,
+                   bool forceKeyframe, UINT64 frameId, EncodedSink* pSink);
+    HRESULT Drain(EncodedSink* pSink);
+    HRESULT GetSequenceHeader(std::vector<BYTE>& header);
+    void Shutdown();
+
+private:
+    // The encoder may still reference the previous input while we fill the next, so
+    // input samples rotate through a small ring instead of being reused immediately.
+    static const UINT InputRingSize = 4;
+    // Capture frame IDs travel with the frame through the encoder, keyed by time.
+    static const UINT FrameIdRingSize = 16;
+
+    HRESULT RefreshOutputStreamInfo();
+    HRESULT PullOutputs(EncodedSink* pSink);
+
+    IMFTransform* m_pEncoder;
+    ICodecAPI* m_pCodecApi;
+    IMFSample* m_pInputSamples[InputRingSize];
+    IMFMediaBuffer* m_pInputBuffers[InputRingSize];
+    IMFSample* m_pOutputSample;
+    IMFMediaBuffer* m_pOutputBuffer;
+    DWORD m_outputBufferSize;
+    bool m_providesSamples;
+    UINT m_nextInput;
+    UINT32 m_width;
+    UINT32 m_height;
+    bool m_streaming;
+
+    struct FrameIdEntry
+    {
+        LONGLONG pts;
+        UINT64 frameId;
+    } m_frameIds[FrameIdRingSize];
+};
+
+//--------------------------------------------------------------------------------------
+// [MFH264Encoder::Initialize]
+// Finds a synchronous H.264 encoder, configures NV12 in / H.264 out and starts
+// streaming.
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Encoder::Initialize(UINT32 width, UINT32 height, UINT32 fps, UINT32 bitRate, UINT32 gopLength)
+{
+    HRESULT hr = S_OK;
+    IMFActivate** ppActivate = nullptr;
+    UINT32 activateCount = 0;
+    IMFMediaType* pOutputType = nullptr;
+    IMFMediaType* pInputType = nullptr;
+
+    m_width = width;
+    m_height = height;
+
+    do
+    {
+        // 1. Enumerate encoders that accept NV12 and produce H.264.
+        MFT_REGISTER_TYPE_INFO inputInfo = { MFMediaType_Video, MFVideoFormat_NV12 };
+        MFT_REGISTER_TYPE_INFO outputInfo = { MFMediaType_Video, MFVideoFormat_H264 };
+        hr = MFTEnumEx(MFT_CATEGORY_VIDEO_ENCODER, MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_LOCALMFT | MFT_ENUM_FLAG_SORTANDFILTER,
+                       &inputInfo, &outputInfo, &ppActivate, &activateCount);
+        if (FAILED(hr)) break;
+        if (activateCount == 0)
+        {
+            hr = MF_E_TOPO_CODEC_NOT_FOUND;
+            break;
+        }
+        hr = ppActivate[0]->ActivateObject(IID_PPV_ARGS(&m_pEncoder));
+        if (FAILED(hr)) break;
+
+        // 2. Encoders want the output type first; it determines the valid inputs.
+        hr = MFCreateMediaType(&pOutputType);
+        if (FAILED(hr)) break;
+        hr = pOutputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+        if (SUCCEEDED(hr)) hr = pOutputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
+        if (SUCCEEDED(hr)) hr = pOutputType->SetUINT32(MF_MT_AVG_BITRATE, bitRate);
+        if (SUCCEEDED(hr)) hr = MFSetAttributeRatio(pOutputType, MF_MT_FRAME_RATE, fps, 1);
+        if (SUCCEEDED(hr)) hr = MFSetAttributeSize(pOutputType, MF_MT_FRAME_SIZE, width, height);
+        if (SUCCEEDED(hr)) hr = pOutputType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+        if (SUCCEEDED(hr)) hr = pOutputType->SetUINT32(MF_MT_MPEG2_PROFILE, eAVEncH264VProfile_Main);
+        if (SUCCEEDED(hr)) hr = m_pEncoder->SetOutputType(0, pOutputType, 0);
+        if (FAILED(hr)) break;
+
+        hr = MFCreateMediaType(&pInputType);
+        if (FAILED(hr)) break;
+        hr = pInputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+        if (SUCCEEDED(hr)) hr = pInputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12);
+        if (SUCCEEDED(hr)) hr = MFSetAttributeRatio(pInputType, MF_MT_FRAME_RATE, fps, 1);
+        if (SUCCEEDED(hr)) hr = MFSetAttributeSize(pInputType, MF_MT_FRAME_SIZE, width, height);
+        if (SUCCEEDED(hr)) hr = pInputType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+        if (SUCCEEDED(hr)) hr = m_pEncoder->SetInputType(0, pInputType, 0);
+        if (FAILED(hr)) break;
+
+        // 3. Keyframe and latency settings. Optional: not every encoder has them.
+        if (SUCCEEDED(m_pEncoder->QueryInterface(IID_PPV_ARGS(&m_pCodecApi))))
+        {
+            VARIANT var;
+            VariantInit(&var);
+            var.vt = VT_UI4;
+            var.ulVal = gopLength;
+            m_pCodecApi->SetValue(&CODECAPI_AVEncMPVGOPSize, &var);
+            var.ulVal = 0;
+            m_pCodecApi->SetValue(&CODECAPI_AVEncMPVDefaultBPictureCount, &var);
+            var.vt = VT_BOOL;
+            var.boolVal = VARIANT_TRUE;
+            m_pCodecApi->SetValue(&CODECAPI_AVLowLatencyMode, &var);
+        }
+
+        // 4. Input ring. NV12 is a full-size Y plane plus a half-height UV plane.
+        const DWORD inputSize = (DWORD)PixelKernels::NV12Bytes(width, height);
+        for (UINT i = 0; i < InputRingSize && SUCCEEDED(hr); ++i)
+        {
+            hr = MFCreateSample(&m_pInputSamples[i]);
+            if (SUCCEEDED(hr)) hr = MFCreateMemoryBuffer(inputSize, &m_pInputBuffers[i]);
+            if (SUCCEEDED(hr)) hr = m_pInputSamples[i]->AddBuffer(m_pInputBuffers[i]);
+        }
+        if (FAILED(hr)) break;
+
+        hr = RefreshOutputStreamInfo();
+        if (FAILED(hr)) break;
+
+        hr = m_pEncoder->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0);
+        if (SUCCEEDED(hr)) hr = m_pEncoder->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0);
+        if (FAILED(hr)) break;
+        m_streaming = true;
+
+    } while (false);
+
+    for (UINT32 i = 0; i < activateCount; ++i)
+    {
+        SafeRelease(&ppActivate[i]);
+    }
+    CoTaskMemFree(ppActivate);
+    SafeRelease(&pOutputType);
+    SafeRelease(&pInputType);
+
+    if (FAILED(hr))
+    {
+        Shutdown();
+    }
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Encoder::RefreshOutputStreamInfo]
+// (Re)creates our reusable output sample if the encoder expects the caller to
+// provide one. Called at start-up and after an output format change.
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Encoder::RefreshOutputStreamInfo()
+{
+    MFT_OUTPUT_STREAM_INFO info = {};
+    HRESULT hr = m_pEncoder->GetOutputStreamInfo(0, &info);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_providesSamples = (info.dwFlags & (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES | MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES)) != 0;
+    if (m_providesSamples || (m_pOutputSample && info.cbSize <= m_outputBufferSize))
+    {
+        return S_OK;
+    }
+
+    SafeRelease(&m_pOutputBuffer);
+    SafeRelease(&m_pOutputSample);
+    // Some encoders report 0; a raw frame is a safe upper bound for one access unit.
+    m_outputBufferSize = info.cbSize ? info.cbSize : (DWORD)(m_width * m_height * 4);
+    hr = MFCreateSample(&m_pOutputSample);
+    if (SUCCEEDED(hr)) hr = MFCreateMemoryBuffer(m_outputBufferSize, &m_pOutputBuffer);
+    if (SUCCEEDED(hr)) hr = m_pOutputSample->AddBuffer(m_pOutputBuffer);
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Encoder::Encode]
+// Converts one BGRA frame to NV12, submits it and forwards every access unit the
+// encoder produces to pSink. Pass the last row and a negative stride for bottom-up
+// frames.
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Encoder::Encode(const BYTE* pBgra, LONG stride, LONGLONG sampleTime, LONGLONG duration,
+                                     bool forceKeyframe, UINT64 frameId, EncodedSink* pSink)
+{
+    if (!m_streaming)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    IMFSample* pSample = m_pInputSamples[m_nextInput];
+    IMFMediaBuffer* pBuffer = m_pInputBuffers[m_nextInput];
+    m_nextInput = (m_nextInput + 1) % InputRingSize;
+
+    BYTE* pDst = nullptr;
+    HRESULT hr = pBuffer->Lock(&pDst, nullptr, nullptr);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    PixelKernels::BgraToNV12(pBgra, stride, pDst, m_width, pDst + (size_t)m_width * m_height, ((m_width + 1) / 2) * 2, m_width, m_height);
+    pBuffer->Unlock();
+    pBuffer->SetCurrentLength((DWORD)PixelKernels::NV12Bytes(m_width, m_height));
+
+    pSample->SetSampleTime(sampleTime);
+    pSample->SetSampleDuration(duration);
+
+    FrameIdEntry& entry = m_frameIds[frameId % FrameIdRingSize];
+    entry.pts = sampleTime;
+    entry.frameId = frameId;
+
+    if (forceKeyframe && m_pCodecApi)
+    {
+        VARIANT var;
+        VariantInit(&var);
+        var.vt = VT_UI4;
+        var.ulVal = 1;
+        m_pCodecApi->SetValue(&CODECAPI_AVEncVideoForceKeyFrame, &var);
+    }
+
+    hr = m_pEncoder->ProcessInput(0, pSample, 0);
+    if (hr == MF_E_NOTACCEPTING)
+    {
+        // The encoder still has output queued; collect it and try again.
+        hr = PullOutputs(pSink);
+        if (SUCCEEDED(hr)) hr = m_pEncoder->ProcessInput(0, pSample, 0);
+    }
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    return PullOutputs(pSink);
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Encoder::PullOutputs]
+// Collects every access unit the encoder has ready.
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Encoder::PullOutputs(EncodedSink* pSink)
+{
+    for (;;)
+    {
+        if (!m_providesSamples)
+        {
+            m_pOutputBuffer->SetCurrentLength(0);
+        }
+
+        MFT_OUTPUT_DATA_BUFFER output = {};
+        output.dwStreamID = 0;
+        output.pSample = m_providesSamples ? nullptr : m_pOutputSample;
+        DWORD status = 0;
+        HRESULT hr = m_pEncoder->ProcessOutput(0, 1, &output, &status);
+        SafeRelease(&output.pEvents);
+
+        if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+        {
+            return S_OK;
+        }
+        if (hr == MF_E_TRANSFORM_STREAM_CHANGE)
+        {
+            // The encoder changed its output format (e.g. to add the sequence
+            // header); accept its preferred type and carry on.
+            IMFMediaType* pType = nullptr;
+            hr = m_pEncoder->GetOutputAvailableType(0, 0, &pType);
+            if (SUCCEEDED(hr)) hr = m_pEncoder->SetOutputType(0, pType, 0);
+            SafeRelease(&pType);
+            if (SUCCEEDED(hr)) hr = RefreshOutputStreamInfo();
+            if (FAILED(hr)) return hr;
+            continue;
+        }
+        if (FAILED(hr))
+        {
+            if (m_providesSamples) SafeRelease(&output.pSample);
+            return hr;
+        }
+
+        IMFSample* pSample = output.pSample;
+        IMFMediaBuffer* pBuffer = nullptr;
+        hr = pSample->ConvertToContiguousBuffer(&pBuffer);
+        if (SUCCEEDED(hr))
+        {
+            BYTE* pData = nullptr;
+            DWORD length = 0;
+            hr = pBuffer->Lock(&pData, nullptr, &length);
+            if (SUCCEEDED(hr))
+            {
+                LONGLONG pts = 0;
+                LONGLONG duration = 0;
+                pSample->GetSampleTime(&pts);
+                pSample->GetSampleDuration(&duration);
+                UINT64 dts = 0;
+                if (FAILED(pSample->GetUINT64(MFSampleExtension_DecodeTimestamp, &dts)))
+                {
+                    dts = (UINT64)pts; // No B-frames, so decode order is display order.
+                }
+
+                // Recover the capture frame ID; the slot is only valid if its time matches.
+                UINT64 frameId = 0;
+                for (UINT i = 0; i < FrameIdRingSize; ++i)
+                {
+                    if (m_frameIds[i].pts == pts)
+                    {
+                        frameId = m_frameIds[i].frameId;
+                        break;
+                    }
+                }
+
+                EncodedFrame frame;
+                frame.pData = pData;
+                frame.size = length;
+                frame.pts = pts;
+                frame.dts = (int64_t)dts;
+                frame.duration = duration;
+                frame.keyframe = MFGetAttributeUINT32(pSample, MFSampleExtension_CleanPoint, FALSE) != FALSE;
+                frame.frameId = frameId;
+                if (pSink && length > 0 && !pSink->WriteFrame(frame))
+                {
+                    hr = E_FAIL;
+                }
+                pBuffer->Unlock();
+            }
+            SafeRelease(&pBuffer);
+        }
+        if (m_providesSamples)
+        {
+            SafeRelease(&output.pSample);
+        }
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Encoder::Drain]
+// Flushes every frame still inside the encoder to pSink at the end of a recording.
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Encoder::Drain(EncodedSink* pSink)
+{
+    if (!m_streaming)
+    {
+        return S_OK;
+    }
+    HRESULT hr = m_pEncoder->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, 0);
+    if (SUCCEEDED(hr)) hr = PullOutputs(pSink);
+    m_pEncoder->ProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, 0);
+    m_pEncoder->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0);
+    m_streaming = false;
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Encoder::GetSequenceHeader]
+// Returns the Annex-B SPS/PPS, if the encoder reports them out of band.
+//--------------------------------------------------------------------------------------
+inline HRESULT MFH264Encoder::GetSequenceHeader(std::vector<BYTE>& header)
+{
+    header.clear();
+    IMFMediaType* pType = nullptr;
+    HRESULT hr = m_pEncoder ? m_pEncoder->GetOutputCurrentType(0, &pType) : MF_E_NOT_INITIALIZED;
+    if (SUCCEEDED(hr))
+    {
+        UINT32 size = 0;
+        hr = pType->GetBlobSize(MF_MT_MPEG_SEQUENCE_HEADER, &size);
+        if (SUCCEEDED(hr))
+        {
+            header.resize(size);
+            hr = pType->GetBlob(MF_MT_MPEG_SEQUENCE_HEADER, header.data(), size, nullptr);
+        }
+    }
+    SafeRelease(&pType);
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [MFH264Encoder::Shutdown]
+//--------------------------------------------------------------------------------------
+inline void MFH264Encoder::Shutdown()
+{
+    if (m_pEncoder && m_streaming)
+    {
+        m_pEncoder->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0);
+        m_streaming = false;
+    }
+    for (UINT i = 0; i < InputRingSize; ++i)
+    {
+        SafeRelease(&m_pInputBuffers[i]);
+        SafeRelease(&m_pInputSamples[i]);
+    }
+    SafeRelease(&m_pOutputBuffer);
+    SafeRelease(&m_pOutputSample);
+    SafeRelease(&m_pCodecApi);
+    SafeRelease(&m_pEncoder);
+}
@@ -0,0 +1,469 @@
+#pragma once
+//======================================================================================
+// MetricsExporter.h
+// Publishes the recorder's health counters and stage latencies in the Prometheus
+// text format, either on a localhost HTTP endpoint (GET /metrics) or by rewriting
+// a file for node_exporter's textfile collector, or both.
+//
+// Everything runs on the exporter's own thread. It reads the counters and
+// histograms the way any other reader does - relaxed loads of single-writer
+// values - so the capture thread takes no locks and does no extra work.
+//
+// Textfile updates are atomic: the new contents are written next to the target
+// and renamed over it, so a scrape never sees a half-written file.
+//======================================================================================
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "FileWriter.h"
+#include "HealthCounters.h"
+#include "PipelineStats.h"
+#include "QualityMetrics.h"
+#include "TickClock.h"
+#include "Trace.h"
+#include "Utf8Path.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <cstdlib>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace Metrics
+{
+    //----------------------------------------------------------------------------------
+    // [Metrics::AppendHealth]
+    // Totals become "recorder_<name>_total" counters, high-water marks gauges.
+    //----------------------------------------------------------------------------------
+    inline void AppendHealth(const HealthCounters::Snapshot& snapshot, std::string& text)
+    {
+        char line[320];
+        for (size_t i = 0; i < HealthCounters::CounterCount; ++i)
+        {
+            const HealthCounter counter = static_cast<HealthCounter>(i);
+            const bool gauge = HealthCounterIsMax(counter);
+            const char* pName = HealthCounterName(counter);
+            const char* pSuffix = gauge ? "" : "_total";
+            snprintf(line, sizeof(line), "# HELP recorder_%s%s %s\n# TYPE recorder_%s%s %s\nrecorder_%s%s %llu\n",
+                     pName, pSuffix, HealthCounterHelp(counter), pName, pSuffix, gauge ? "gauge" : "counter",
+                     pName, pSuffix, static_cast<unsigned long long>(snapshot[counter]));
+            text += line;
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [Metrics::AppendStageLatencies]
+    // One histogram, labelled by stage, with fixed bucket bounds around a frame time.
+    // Cumulative counts come from LatencyHistogram::CountAtOrBelow, so they are
+    // exact to within its 1/16 bucket resolution.
+    //----------------------------------------------------------------------------------
+    inline void AppendStageLatencies(const PipelineStats& stats, std::string& text)
+    {
+        static const double BoundsSeconds[] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+                                                0.01, 0.0167, 0.025, 0.05, 0.1, 0.25, 1.0 };
+        // Measured once: a new measurement at every scrape moves the bucket bounds and
+        // the sum a little, and Prometheus takes any drop in them for a reset.
+        static const double nsPerTick = TickClock::NsPerTick();
+        char line[512];
+        text += "# HELP recorder_stage_latency_seconds Time spent in each capture pipeline stage.\n"
+                "# TYPE recorder_stage_latency_seconds histogram\n";
+        for (size_t stage = 0; stage < static_cast<size_t>(PipelineStage::Count); ++stage)
+        {
+            const LatencyHistogram& histogram = stats.Histogram(static_cast<PipelineStage>(stage));
+            const char* pName = PipelineStageName(static_cast<PipelineStage>(stage));
+            for (double bound : BoundsSeconds)
+            {
+                const uint64_t ticks = static_cast<uint64_t>(bound * 1e9 / nsPerTick);
+                snprintf(line, sizeof(line), "recorder_stage_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                         pName, bound, static_cast<unsigned long long>(histogram.CountAtOrBelow(ticks)));
+                text += line;
+            }
+            // Read last, so it is never below a finite bucket read before it.
+            const uint64_t count = histogram.CountAtOrBelow(~0ull);
+            snprintf(line, sizeof(line),
+                     "recorder_stage_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+                     "recorder_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n"
+                     "recorder_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+                     pName, static_cast<unsigned long long>(count), pName, histogram.Sum() * nsPerTick * 1e-9,
+                     pName, static_cast<unsigned long long>(count));
+            text += line;
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [Metrics::AppendQuality]
+    // The sampled-frame quality summary (QualityMonitor.h) as gauges. Nothing is
+    // exported until a frame has been measured.
+    //----------------------------------------------------------------------------------
+    inline void AppendQuality(const QualityMetrics::QualityTotals& totals, std::string& text)
+    {
+        if (totals.frames == 0)
+        {
+            return;
+        }
+        char line[1024];
+        snprintf(line, sizeof(line),
+                 "# HELP recorder_quality_frames_total Sampled frames measured against their source.\n"
+                 "# TYPE recorder_quality_frames_total counter\nrecorder_quality_frames_total %llu\n"
+                 "# HELP recorder_quality_psnr_db PSNR of the sampled frames.\n"
+                 "# TYPE recorder_quality_psnr_db gauge\n"
+                 "recorder_quality_psnr_db{stat=\"mean\"} %.3f\nrecorder_quality_psnr_db{stat=\"min\"} %.3f\n"
+                 "# HELP recorder_quality_ssim SSIM of the sampled frames.\n"
+                 "# TYPE recorder_quality_ssim gauge\n"
+                 "recorder_quality_ssim{stat=\"mean\"} %.5f\nrecorder_quality_ssim{stat=\"min\"} %.5f\n"
+                 "# HELP recorder_quality_worst_tile_psnr_db Lowest PSNR of any tile in a sampled frame.\n"
+                 "# TYPE recorder_quality_worst_tile_psnr_db gauge\nrecorder_quality_worst_tile_psnr_db %.3f\n",
+                 static_cast<unsigned long long>(totals.frames), totals.PsnrMean(), totals.psnrMin,
+                 totals.SsimMean(), totals.ssimMin, totals.worstTilePsnrMin);
+        text += line;
+    }
+}
+
+//======================================================================================
+// MetricsExporter
+//======================================================================================
+class MetricsExporter
+{
+public:
+    struct Options
+    {
+        uint16_t httpPort = 0;          // Serve http://127.0.0.1:<port>/metrics; 0 disables.
+        std::string filePath;           // Textfile to keep up to date; empty disables.
+        uint32_t fileIntervalSeconds = 15;
+    };
+
+    // Fills in the complete exposition text. Called on the exporter thread.
+    typedef std::function<void(std::string&)> Collector;
+
+    MetricsExporter() = default;
+    ~MetricsExporter() { Stop(); }
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    //----------------------------------------------------------------------------------
+    // [MetricsExporter::Start]
+    // Binds the listening socket up front so a port conflict is reported here.
+    //----------------------------------------------------------------------------------
+    bool Start(const Options& options, Collector collect, std::string& error)
+    {
+        Stop();
+        m_options = options;
+        m_collect = collect;
+        if (m_options.httpPort && !Listen(error))
+        {
+            return false;
+        }
+        m_stopping = false;
+        m_thread = std::thread(&MetricsExporter::Run, this);
+        return true;
+    }
+
+    // Writes the textfile one last time, so it holds the final values.
+    void Stop()
+    {
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+        if (!m_options.filePath.empty())
+        {
+            WriteTextfile();
+        }
+        CloseListener();
+    }
+
+    uint64_t ScrapesServed() const { return m_scrapes.load(std::memory_order_relaxed); }
+
+private:
+    static const int PollIntervalMs = 100;
+
+    void Run()
+    {
+        Trace::SetThreadName("metrics");
+        auto nextFileWrite = std::chrono::steady_clock::now();
+        for (;;)
+        {
+            if (!m_options.filePath.empty() && std::chrono::steady_clock::now() >= nextFileWrite)
+            {
+                WriteTextfile();
+                nextFileWrite += std::chrono::seconds(m_options.fileIntervalSeconds ? m_options.fileIntervalSeconds : 1);
+            }
+
+            if (m_options.httpPort)
+            {
+                // Waiting for a connection doubles as our sleep.
+                ServeOne();
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_stopping)
+                {
+                    return;
+                }
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_cv.wait_for(lock, std::chrono::milliseconds(PollIntervalMs), [this] { return m_stopping; }))
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [MetricsExporter::WriteTextfile]
+    //----------------------------------------------------------------------------------
+    bool WriteTextfile()
+    {
+        std::string text;
+        m_collect(text);
+
+        const std::string temporaryPath = m_options.filePath + ".tmp";
+        FileWriter::Options io;
+        io.writeBehind = false;
+        io.bufferSize = 64 * 1024;
+        FileWriter file;
+        if (!file.Open(temporaryPath, io))
+        {
+            return false;
+        }
+        const bool written = file.Write(text.data(), text.size());
+        if (!file.Close() || !written)
+        {
+            return false;
+        }
+#ifdef _WIN32
+        return MoveFileExW(Utf8ToWide(temporaryPath).c_str(), Utf8ToWide(m_options.filePath).c_str(),
+                           MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return rename(temporaryPath.c_str(), m_options.filePath.c_str()) == 0;
+#endif
+    }
+
+    //----------------------------------------------------------------------------------
+    // [MetricsExporter::ServeOne]
+    // Waits up to PollIntervalMs for a connection and answers it. Scrapes are rare
+    // and tiny, so one at a time is plenty.
+    //----------------------------------------------------------------------------------
+    void ServeOne()
+    {
+        Socket client = AcceptClient();
+        if (client == InvalidSocket)
+        {
+            return;
+        }
+
+        // Read up to the end of the request headers; the body (if any) is ignored.
+        std::string request;
+        char buffer[1024];
+        while (request.size() < 8192 && request.find("\r\n\r\n") == std::string::npos)
+        {
+            if (!WaitReadable(client, 1000))
+            {
+                break;
+            }
+            const int received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+            {
+                break;
+            }
+            request.append(buffer, received);
+        }
+
+        std::string body;
+        const char* pStatus = "200 OK";
+        const char* pContentType = "text/plain; version=0.0.4; charset=utf-8";
+        if (request.compare(0, 12, "GET /metrics") == 0 && request.size() > 12 &&
+            (request[12] == ' ' || request[12] == '?'))
+        {
+            m_collect(body);
+            m_scrapes.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            pStatus = "404 Not Found";
+            pContentType = "text/plain";
+            body = "Metrics are at /metrics\n";
+        }
+
+        char header[256];
+        snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                 pStatus, pContentType, body.size());
+        std::string response = header;
+        response += body;
+        size_t sent = 0;
+        while (sent < response.size())
+        {
+            const int chunk = send(client, response.data() + sent, static_cast<int>(response.size() - sent), SendFlags);
+            if (chunk <= 0)
+            {
+                break;
+            }
+            sent += chunk;
+        }
+        CloseSocket(client);
+    }
+
+#ifdef _WIN32
+    typedef SOCKET Socket;
+    static const SOCKET InvalidSocket = INVALID_SOCKET;
+    static const int SendFlags = 0;
+
+    bool Listen(std::string& error)
+    {
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+        {
+            error = "Could not initialize Winsock";
+            return false;
+        }
+        m_wsaStarted = true;
+        m_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(m_options.httpPort);
+        if (m_listen == INVALID_SOCKET ||
+            bind(m_listen, (sockaddr*)&address, sizeof(address)) != 0 ||
+            listen(m_listen, 4) != 0)
+        {
+            error = "Could not listen on 127.0.0.1:" + std::to_string(m_options.httpPort) + " for metrics";
+            CloseListener();
+            return false;
+        }
+        return true;
+    }
+
+    Socket AcceptClient()
+    {
+        WSAPOLLFD pfd = {};
+        pfd.fd = m_listen;
+        pfd.events = POLLRDNORM;
+        if (WSAPoll(&pfd, 1, PollIntervalMs) <= 0)
+        {
+            return InvalidSocket;
+        }
+        return accept(m_listen, nullptr, nullptr);
+    }
+
+    static bool WaitReadable(Socket socket, int timeoutMs)
+    {
+        WSAPOLLFD pfd = {};
+        pfd.fd = socket;
+        pfd.events = POLLRDNORM;
+        return WSAPoll(&pfd, 1, timeoutMs) > 0;
+    }
+
+    static void CloseSocket(Socket socket)
+    {
+        closesocket(socket);
+    }
+
+    void CloseListener()
+    {
+        if (m_listen != INVALID_SOCKET)
+        {
+            closesocket(m_listen);
+            m_listen = INVALID_SOCKET;
+        }
+        if (m_wsaStarted)
+        {
+            WSACleanup();
+            m_wsaStarted = false;
+        }
+    }
+
+    bool m_wsaStarted = false;
+#else
+    typedef int Socket;
+    static const int InvalidSocket = -1;
+    static const int SendFlags = MSG_NOSIGNAL; // A scraper hanging up must not raise SIGPIPE.
+
+    bool Listen(std::string& error)
+    {
+        m_listen = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const int reuse = 1;
+        if (m_listen >= 0)
+        {
+            setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        }
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(m_options.httpPort);
+        if (m_listen < 0 ||
+            bind(m_listen, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(m_listen, 4) != 0)
+        {
+            error = "Could not listen on 127.0.0.1:" + std::to_string(m_options.httpPort) + " for metrics";
+            CloseListener();
+            return false;
+        }
+        return true;
+    }
+
+    Socket AcceptClient()
+    {
+        pollfd pfd = { m_listen, POLLIN, 0 };
+        if (poll(&pfd, 1, PollIntervalMs) <= 0)
+        {
+            return InvalidSocket;
+        }
+        return accept4(m_listen, nullptr, nullptr, SOCK_CLOEXEC);
+    }
+
+    static bool WaitReadable(Socket socket, int timeoutMs)
+    {
+        pollfd pfd = { socket, POLLIN, 0 };
+        return poll(&pfd, 1, timeoutMs) > 0;
+    }
+
+    static void CloseSocket(Socket socket)
+    {
+        close(socket);
+    }
+
+    void CloseListener()
+    {
+        if (m_listen >= 0)
+        {
+            close(m_listen);
+            m_listen = -1;
+        }
+    }
+#endif
+
+    Options m_options;
+    Collector m_collect;
+    Socket m_listen = InvalidSocket;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stopping = false;
+    std::atomic<uint64_t> m_scrapes{ 0 };
+};
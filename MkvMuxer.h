@@ -0,0 +1,590 @@
+#pragma once
+//======================================================================================
+// MkvMuxer.h
+// Matroska muxer for a single H.264 video stream.
+//
+// The file is written front to back as frames arrive: EBML header, a Segment of
+// unknown size, Info and Tracks, then one Cluster per GOP. Each cluster is opened
+// with an unknown size and its real size is patched in when the next one starts,
+// so a file cut off mid-write (crash, power loss) is still a valid Matroska stream
+// up to the last complete block; only the Cues, SeekHead, Duration and Segment size
+// written by Finish() are missing, and players rebuild those by scanning. When the
+// ByteSink can't seek back (a pipe), everything is simply left at unknown size.
+//
+// Every block carries its own millisecond timestamp, so variable frame rates need
+// nothing special. Blocks are assembled in a fixed member buffer and large frame
+// payloads go straight to the sink, so muxing never allocates per frame; only the
+// cue list grows, by one entry per keyframe.
+//======================================================================================
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "EncodedSink.h"
+#include "H264Bitstream.h"
+
+class MkvMuxer : public EncodedSink
+{
+public:
+    // Block timestamps are in milliseconds (TimestampScale = 1,000,000 ns).
+    static const uint64_t TimestampScaleNs = 1000000;
+
+    MkvMuxer() = default;
+    MkvMuxer(const MkvMuxer&) = delete;
+    MkvMuxer& operator=(const MkvMuxer&) = delete;
+
+    // Starts a new file on pSink. The sink must outlive the muxer or Finish().
+    void Open(ByteSink* pSink, uint32_t width, uint32_t height)
+    {
+        m_pSink = pSink;
+        m_width = width;
+        m_height = height;
+        m_used = 0;
+        m_headerWritten = false;
+        m_clusterOpen = false;
+        m_canPatch = true;
+        m_failed = false;
+        m_endTimestamp = 0;
+        m_cues.clear();
+        m_cues.reserve(1024);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [MkvMuxer::SetSequenceHeader]
+    // Annex-B SPS/PPS for the track's CodecPrivate, when the encoder reports them
+    // out of band. Otherwise they are taken from the first keyframe.
+    //----------------------------------------------------------------------------------
+    bool SetSequenceHeader(const uint8_t* pData, size_t size)
+    {
+        return ParseSequenceHeader(pData, size);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [MkvMuxer::WriteFrame]
+    // Writes one access unit as a SimpleBlock, converting Annex-B start codes to
+    // the 4-byte length prefixes Matroska's AVC mapping uses.
+    //----------------------------------------------------------------------------------
+    bool WriteFrame(const EncodedFrame& frame) override
+    {
+        if (m_failed || !m_pSink)
+        {
+            return false;
+        }
+        if (!m_headerWritten)
+        {
+            // Decoders need SPS/PPS up front; nothing before the first IDR is usable.
+            if (!frame.keyframe)
+            {
+                return true;
+            }
+            if (m_spsSize == 0)
+            {
+                ParseSequenceHeader(frame.pData, frame.size);
+            }
+            WriteHeader();
+        }
+
+        const uint64_t timestamp = frame.pts > 0 ? static_cast<uint64_t>(frame.pts) / 10000 : 0;
+
+        // New cluster at every keyframe (so cues point at decodable starts), and
+        // whenever the 16-bit relative block timestamp would overflow.
+        if (!m_clusterOpen || frame.keyframe || timestamp < m_clusterTimestamp ||
+            timestamp - m_clusterTimestamp > 32767)
+        {
+            StartCluster(timestamp, frame.keyframe);
+        }
+
+        // Length-prefixed payload size; AUDs have no place in Matroska.
+        size_t payloadSize = 0;
+        {
+            const uint8_t* cursor = frame.pData;
+            const uint8_t* end = frame.pData + frame.size;
+            H264::NalUnit nal;
+            while (H264::NextNal(cursor, end, nal))
+            {
+                if (nal.size && nal.type != H264::NalAud)
+                {
+                    payloadSize += 4 + nal.size;
+                }
+            }
+        }
+
+        // SimpleBlock: track number, signed 16-bit timestamp relative to the
+        // cluster, flags, then the frame.
+        const int16_t relative = static_cast<int16_t>(timestamp - m_clusterTimestamp);
+        uint8_t header[16];
+        size_t headerSize = 0;
+        header[headerSize++] = 0xA3;
+        headerSize += WriteSize(header + headerSize, 4 + payloadSize, payloadSize + 4 < 0x0FFFFFFF ? 4 : 8);
+        header[headerSize++] = 0x81; // Track 1
+        header[headerSize++] = static_cast<uint8_t>(static_cast<uint16_t>(relative) >> 8);
+        header[headerSize++] = static_cast<uint8_t>(relative);
+        header[headerSize++] = frame.keyframe ? 0x80 : 0x00;
+        Put(header, headerSize);
+
+        const uint8_t* cursor = frame.pData;
+        const uint8_t* end = frame.pData + frame.size;
+        H264::NalUnit nal;
+        while (H264::NextNal(cursor, end, nal))
+        {
+            if (!nal.size || nal.type == H264::NalAud)
+            {
+                continue;
+            }
+            const uint8_t length[4] = {
+                static_cast<uint8_t>(nal.size >> 24), static_cast<uint8_t>(nal.size >> 16),
+                static_cast<uint8_t>(nal.size >> 8), static_cast<uint8_t>(nal.size),
+            };
+            Put(length, sizeof(length));
+            Put(nal.pData, nal.size);
+        }
+
+        const uint64_t duration = frame.duration > 0 ? static_cast<uint64_t>(frame.duration) / 10000 : 0;
+        if (timestamp + duration > m_endTimestamp)
+        {
+            m_endTimestamp = timestamp + duration;
+        }
+        return Flush();
+    }
+
+    //----------------------------------------------------------------------------------
+    // [MkvMuxer::Finish]
+    // Closes the last cluster and writes the Cues, then (if the sink can seek)
+    // fills in the SeekHead, Duration and Segment size reserved by the header.
+    //----------------------------------------------------------------------------------
+    bool Finish() override
+    {
+        if (!m_headerWritten || m_failed)
+        {
+            return Flush();
+        }
+        CloseCluster();
+
+        const uint64_t cuesPosition = Tell() - m_segmentDataStart;
+        WriteCues();
+        if (!Flush())
+        {
+            return false;
+        }
+        if (!m_canPatch)
+        {
+            return true;
+        }
+
+        const uint64_t segmentSize = Tell() - m_segmentDataStart;
+        uint8_t buffer[SeekHeadReserve];
+        WriteSize(buffer, segmentSize, 8);
+        if (!m_pSink->Patch(m_segmentDataStart - 8, buffer, 8))
+        {
+            return true; // Unseekable after all; the unknown sizes stand.
+        }
+
+        const double duration = static_cast<double>(m_endTimestamp);
+        uint64_t bits;
+        memcpy(&bits, &duration, sizeof(bits));
+        for (int i = 0; i < 8; ++i)
+        {
+            buffer[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        }
+        m_pSink->Patch(m_durationPosition, buffer, 8);
+
+        // SeekHead with Info, Tracks and Cues, then a Void over the rest of the
+        // reserved space.
+        size_t size = 0;
+        size += PutId(buffer + size, IdSeekHead);
+        const size_t seekHeadSizeAt = size;
+        size += 1;
+        const uint32_t ids[3] = { IdInfo, IdTracks, IdCues };
+        const uint64_t positions[3] = { m_infoPosition - m_segmentDataStart, m_tracksPosition - m_segmentDataStart, cuesPosition };
+        for (int i = 0; i < 3; ++i)
+        {
+            size += PutId(buffer + size, IdSeek);
+            buffer[size++] = 0x80 | 18;
+            size += PutId(buffer + size, IdSeekId);
+            buffer[size++] = 0x80 | 4;
+            size += PutId(buffer + size, ids[i]);
+            size += PutId(buffer + size, IdSeekPosition);
+            buffer[size++] = 0x80 | 8;
+            for (int b = 7; b >= 0; --b)
+            {
+                buffer[size++] = static_cast<uint8_t>(positions[i] >> (8 * b));
+            }
+        }
+        buffer[seekHeadSizeAt] = static_cast<uint8_t>(0x80 | (size - seekHeadSizeAt - 1));
+        buffer[size++] = IdVoid;
+        buffer[size] = static_cast<uint8_t>(0x80 | (SeekHeadReserve - size - 1));
+        ++size;
+        memset(buffer + size, 0, SeekHeadReserve - size);
+        m_pSink->Patch(m_seekHeadPosition, buffer, SeekHeadReserve);
+        return true;
+    }
+
+private:
+    // Element IDs (including their length marker bits).
+    static const uint32_t IdEbml = 0x1A45DFA3;
+    static const uint32_t IdEbmlVersion = 0x4286;
+    static const uint32_t IdEbmlReadVersion = 0x42F7;
+    static const uint32_t IdEbmlMaxIdLength = 0x42F2;
+    static const uint32_t IdEbmlMaxSizeLength = 0x42F3;
+    static const uint32_t IdDocType = 0x4282;
+    static const uint32_t IdDocTypeVersion = 0x4287;
+    static const uint32_t IdDocTypeReadVersion = 0x4285;
+    static const uint32_t IdSegment = 0x18538067;
+    static const uint32_t IdSeekHead = 0x114D9B74;
+    static const uint32_t IdSeek = 0x4DBB;
+    static const uint32_t IdSeekId = 0x53AB;
+    static const uint32_t IdSeekPosition = 0x53AC;
+    static const uint32_t IdInfo = 0x1549A966;
+    static const uint32_t IdTimestampScale = 0x2AD7B1;
+    static const uint32_t IdDuration = 0x4489;
+    static const uint32_t IdMuxingApp = 0x4D80;
+    static const uint32_t IdWritingApp = 0x5741;
+    static const uint32_t IdTracks = 0x1654AE6B;
+    static const uint32_t IdTrackEntry = 0xAE;
+    static const uint32_t IdTrackNumber = 0xD7;
+    static const uint32_t IdTrackUid = 0x73C5;
+    static const uint32_t IdTrackType = 0x83;
+    static const uint32_t IdFlagLacing = 0x9C;
+    static const uint32_t IdCodecId = 0x86;
+    static const uint32_t IdCodecPrivate = 0x63A2;
+    static const uint32_t IdVideo = 0xE0;
+    static const uint32_t IdPixelWidth = 0xB0;
+    static const uint32_t IdPixelHeight = 0xBA;
+    static const uint32_t IdCluster = 0x1F43B675;
+    static const uint32_t IdClusterTimestamp = 0xE7;
+    static const uint32_t IdCues = 0x1C53BB6B;
+    static const uint32_t IdCuePoint = 0xBB;
+    static const uint32_t IdCueTime = 0xB3;
+    static const uint32_t IdCueTrackPositions = 0xB7;
+    static const uint32_t IdCueTrack = 0xF7;
+    static const uint32_t IdCueClusterPosition = 0xF1;
+    static const uint8_t IdVoid = 0xEC;
+
+    // Space kept after the Segment header for the SeekHead Finish() writes.
+    static const size_t SeekHeadReserve = 96;
+
+    struct CuePoint
+    {
+        uint64_t timestamp;
+        uint64_t clusterPosition; // Relative to the Segment's data.
+    };
+
+    // Keeps SPS and PPS (without start codes) for the AVCDecoderConfigurationRecord.
+    bool ParseSequenceHeader(const uint8_t* pData, size_t size)
+    {
+        const uint8_t* cursor = pData;
+        const uint8_t* end = pData + size;
+        H264::NalUnit nal;
+        while (H264::NextNal(cursor, end, nal))
+        {
+            if (nal.type == H264::NalSps && nal.size >= 4 && nal.size <= sizeof(m_sps))
+            {
+                memcpy(m_sps, nal.pData, nal.size);
+                m_spsSize = nal.size;
+            }
+            else if (nal.type == H264::NalPps && nal.size <= sizeof(m_pps))
+            {
+                memcpy(m_pps, nal.pData, nal.size);
+                m_ppsSize = nal.size;
+            }
+        }
+        return m_spsSize > 0 && m_ppsSize > 0;
+    }
+
+    void WriteHeader()
+    {
+        uint8_t scratch[64];
+
+        // EBML header. DocTypeVersion 4 is what current tools write; nothing we use
+        // needs more than version 2 to read.
+        size_t body = 0;
+        body += PutUIntElement(scratch + body, IdEbmlVersion, 1);
+        body += PutUIntElement(scratch + body, IdEbmlReadVersion, 1);
+        body += PutUIntElement(scratch + body, IdEbmlMaxIdLength, 4);
+        body += PutUIntElement(scratch + body, IdEbmlMaxSizeLength, 8);
+        body += PutStringElement(scratch + body, IdDocType, "matroska");
+        body += PutUIntElement(scratch + body, IdDocTypeVersion, 4);
+        body += PutUIntElement(scratch + body, IdDocTypeReadVersion, 2);
+        PutMaster(IdEbml, body);
+        Put(scratch, body);
+
+        // Segment of unknown size (patched by Finish()), then room for the SeekHead.
+        PutMaster(IdSegment, UnknownSize);
+        m_segmentDataStart = Tell();
+        m_seekHeadPosition = Tell();
+        uint8_t voidElement[SeekHeadReserve] = {};
+        voidElement[0] = IdVoid;
+        voidElement[1] = static_cast<uint8_t>(0x80 | (SeekHeadReserve - 2));
+        Put(voidElement, sizeof(voidElement));
+
+        // Info. Duration starts at 0 and is patched once known.
+        m_infoPosition = Tell();
+        body = 0;
+        body += PutUIntElement(scratch + body, IdTimestampScale, TimestampScaleNs);
+        body += PutStringElement(scratch + body, IdMuxingApp, "windowsrecorder");
+        body += PutStringElement(scratch + body, IdWritingApp, "windowsrecorder");
+        const size_t durationOffset = body + 3;
+        body += PutId(scratch + body, IdDuration);
+        scratch[body++] = 0x88;
+        memset(scratch + body, 0, 8);
+        body += 8;
+        const size_t infoHeader = PutMaster(IdInfo, body);
+        m_durationPosition = m_infoPosition + infoHeader + durationOffset;
+        Put(scratch, body);
+
+        // Tracks: one H.264 video track.
+        uint8_t codecPrivate[sizeof(m_sps) + sizeof(m_pps) + 16];
+        size_t codecPrivateSize = 0;
+        if (m_spsSize > 0 && m_ppsSize > 0)
+        {
+            // AVCDecoderConfigurationRecord, 4-byte NAL lengths.
+            codecPrivate[codecPrivateSize++] = 1;
+            codecPrivate[codecPrivateSize++] = m_sps[1]; // profile_idc
+            codecPrivate[codecPrivateSize++] = m_sps[2]; // constraint flags
+            codecPrivate[codecPrivateSize++] = m_sps[3]; // level_idc
+            codecPrivate[codecPrivateSize++] = 0xFF;     // lengthSizeMinusOne = 3
+            codecPrivate[codecPrivateSize++] = 0xE1;     // one SPS
+            codecPrivate[codecPrivateSize++] = static_cast<uint8_t>(m_spsSize >> 8);
+            codecPrivate[codecPrivateSize++] = static_cast<uint8_t>(m_spsSize);
+            memcpy(codecPrivate + codecPrivateSize, m_sps, m_spsSize);
+            codecPrivateSize += m_spsSize;
+            codecPrivate[codecPrivateSize++] = 1;        // one PPS
+            codecPrivate[codecPrivateSize++] = static_cast<uint8_t>(m_ppsSize >> 8);
+            codecPrivate[codecPrivateSize++] = static_cast<uint8_t>(m_ppsSize);
+            memcpy(codecPrivate + codecPrivateSize, m_pps, m_ppsSize);
+            codecPrivateSize += m_ppsSize;
+        }
+
+        uint8_t video[32];
+        size_t videoSize = 0;
+        videoSize += PutUIntElement(video + videoSize, IdPixelWidth, m_width);
+        videoSize += PutUIntElement(video + videoSize, IdPixelHeight, m_height);
+
+        uint8_t entry[sizeof(codecPrivate) + 128];
+        size_t entrySize = 0;
+        entrySize += PutUIntElement(entry + entrySize, IdTrackNumber, 1);
+        entrySize += PutUIntElement(entry + entrySize, IdTrackUid, 1);
+        entrySize += PutUIntElement(entry + entrySize, IdTrackType, 1); // video
+        entrySize += PutUIntElement(entry + entrySize, IdFlagLacing, 0);
+        entrySize += PutStringElement(entry + entrySize, IdCodecId, "V_MPEG4/ISO/AVC");
+        if (codecPrivateSize > 0)
+        {
+            entrySize += PutId(entry + entrySize, IdCodecPrivate);
+            entrySize += WriteSize(entry + entrySize, codecPrivateSize, 2);
+            memcpy(entry + entrySize, codecPrivate, codecPrivateSize);
+            entrySize += codecPrivateSize;
+        }
+        entrySize += PutId(entry + entrySize, IdVideo);
+        entrySize += WriteSize(entry + entrySize, videoSize, 1);
+        memcpy(entry + entrySize, video, videoSize);
+        entrySize += videoSize;
+
+        m_tracksPosition = Tell();
+        PutMaster(IdTracks, 1 + 2 + entrySize);
+        PutMaster(IdTrackEntry, entrySize, 2);
+        Put(entry, entrySize);
+
+        m_headerWritten = true;
+    }
+
+    void StartCluster(uint64_t timestamp, bool keyframe)
+    {
+        CloseCluster();
+        m_clusterPosition = Tell();
+        m_clusterTimestamp = timestamp;
+        m_clusterOpen = true;
+        if (keyframe)
+        {
+            m_cues.push_back({ timestamp, m_clusterPosition - m_segmentDataStart });
+        }
+        PutMaster(IdCluster, UnknownSize);
+        uint8_t element[16];
+        Put(element, PutUIntElement(element, IdClusterTimestamp, timestamp));
+    }
+
+    // Replaces the open cluster's unknown size with its real one.
+    void CloseCluster()
+    {
+        if (!m_clusterOpen)
+        {
+            return;
+        }
+        m_clusterOpen = false;
+        if (!m_canPatch || !Flush())
+        {
+            return;
+        }
+        const uint64_t dataStart = m_clusterPosition + 4 + 8;
+        uint8_t size[8];
+        WriteSize(size, Tell() - dataStart, 8);
+        m_canPatch = m_pSink->Patch(m_clusterPosition + 4, size, 8);
+    }
+
+    void WriteCues()
+    {
+        uint64_t cuesSize = 0;
+        for (const CuePoint& cue : m_cues)
+        {
+            cuesSize += CuePointSize(cue);
+        }
+        PutMaster(IdCues, cuesSize, 8);
+        for (const CuePoint& cue : m_cues)
+        {
+            const size_t positions = 2 * 2 + 1 + UIntSize(cue.clusterPosition);
+            uint8_t element[64];
+            size_t size = 0;
+            size += PutId(element + size, IdCuePoint);
+            element[size++] = static_cast<uint8_t>(0x80 | (CuePointSize(cue) - 2));
+            size += PutUIntElement(element + size, IdCueTime, cue.timestamp);
+            size += PutId(element + size, IdCueTrackPositions);
+            element[size++] = static_cast<uint8_t>(0x80 | positions);
+            size += PutUIntElement(element + size, IdCueTrack, 1);
+            size += PutUIntElement(element + size, IdCueClusterPosition, cue.clusterPosition);
+            Put(element, size);
+        }
+    }
+
+    static size_t CuePointSize(const CuePoint& cue)
+    {
+        const size_t positions = 2 * 2 + 1 + UIntSize(cue.clusterPosition);
+        return 2 + (2 + UIntSize(cue.timestamp)) + 2 + positions;
+    }
+
+    // --- EBML encoding ---
+    static const uint64_t UnknownSize = ~0ull;
+
+    static size_t IdSize(uint32_t id)
+    {
+        return id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+    }
+
+    static size_t PutId(uint8_t* p, uint32_t id)
+    {
+        const size_t size = IdSize(id);
+        for (size_t i = 0; i < size; ++i)
+        {
+            p[i] = static_cast<uint8_t>(id >> (8 * (size - 1 - i)));
+        }
+        return size;
+    }
+
+    static size_t UIntSize(uint64_t value)
+    {
+        size_t size = 1;
+        while (size < 8 && (value >> (8 * size)) != 0)
+        {
+            ++size;
+        }
+        return size;
+    }
+
+    // Element data size as a 'length'-byte variable-length integer. UnknownSize
+    // becomes the reserved all-ones value.
+    static size_t WriteSize(uint8_t* p, uint64_t value, size_t length)
+    {
+        if (value == UnknownSize)
+        {
+            value = (1ull << (7 * length)) - 1;
+        }
+        value |= 1ull << (7 * length);
+        for (size_t i = 0; i < length; ++i)
+        {
+            p[i] = static_cast<uint8_t>(value >> (8 * (length - 1 - i)));
+        }
+        return length;
+    }
+
+    static size_t PutUIntElement(uint8_t* p, uint32_t id, uint64_t value)
+    {
+        size_t size = PutId(p, id);
+        const size_t valueSize = UIntSize(value);
+        p[size++] = static_cast<uint8_t>(0x80 | valueSize);
+        for (size_t i = 0; i < valueSize; ++i)
+        {
+            p[size++] = static_cast<uint8_t>(value >> (8 * (valueSize - 1 - i)));
+        }
+        return size;
+    }
+
+    static size_t PutStringElement(uint8_t* p, uint32_t id, const char* pValue)
+    {
+        size_t size = PutId(p, id);
+        const size_t length = strlen(pValue);
+        p[size++] = static_cast<uint8_t>(0x80 | length);
+        memcpy(p + size, pValue, length);
+        return size + length;
+    }
+
+    // Writes a master element's ID and size; returns the header length.
+    size_t PutMaster(uint32_t id, uint64_t size, size_t sizeLength = 8)
+    {
+        uint8_t header[12];
+        size_t headerSize = PutId(header, id);
+        headerSize += WriteSize(header + headerSize, size, sizeLength);
+        Put(header, headerSize);
+        return headerSize;
+    }
+
+    uint64_t Tell() const
+    {
+        return m_pSink->Position() + m_used;
+    }
+
+    void Put(const void* pData, size_t size)
+    {
+        if (m_used + size > sizeof(m_buffer))
+        {
+            Flush();
+            if (size >= sizeof(m_buffer))
+            {
+                // Big slices go straight out rather than through the buffer.
+                if (!m_failed && !m_pSink->Write(pData, size))
+                {
+                    m_failed = true;
+                }
+                return;
+            }
+        }
+        memcpy(m_buffer + m_used, pData, size);
+        m_used += size;
+    }
+
+    bool Flush()
+    {
+        if (m_used > 0 && m_pSink)
+        {
+            if (!m_failed && !m_pSink->Write(m_buffer, m_used))
+            {
+                m_failed = true;
+            }
+            m_used = 0;
+        }
+        return !m_failed;
+    }
+
+    ByteSink* m_pSink = nullptr;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint8_t m_buffer[64 * 1024];
+    size_t m_used = 0;
+    uint8_t m_sps[128];
+    size_t m_spsSize = 0;
+    uint8_t m_pps[64];
+    size_t m_ppsSize = 0;
+
+    bool m_headerWritten = false;
+    bool m_canPatch = true;
+    bool m_failed = false;
+    uint64_t m_segmentDataStart = 0;
+    uint64_t m_seekHeadPosition = 0;
+    uint64_t m_infoPosition = 0;
+    uint64_t m_durationPosition = 0;
+    uint64_t m_tracksPosition = 0;
+
+    bool m_clusterOpen = false;
+    uint64_t m_clusterPosition = 0;
+    uint64_t m_clusterTimestamp = 0;
+    uint64_t m_endTimestamp = 0;
+    std::vector<CuePoint> m_cues;
+};
@@ -0,0 +1,107 @@
+#pragma once
+//======================================================================================
+// OutputCache.h
+// The monitor the last recording captured, remembered between runs so the next
+// start can open it straight away instead of enumerating every adapter and output
+// and creating a device for each one it tries (see Recorder::Initialize).
+//
+// The adapter is identified by its LUID, which stays the same until the adapter or
+// its driver restarts (a reboot, a driver update). After that the entry simply
+// doesn't match any more: the full enumeration runs once and the entry is
+// rewritten. The file is a single line of text,
+//
+//   <adapter LUID, hex> <output on the adapter> <number> <left> <top> <right> <bottom>
+//
+// with the number --outputs gave the monitor (for messages) and its desktop
+// rectangle, so a monitor that has moved or changed
+// resolution in the meantime counts as a miss too. It is replaced through a
+// temporary file, so a recorder starting at the same moment never reads half an
+// entry.
+//======================================================================================
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "FileWriter.h"
+#include "Utf8Path.h"
+
+struct CachedOutput
+{
+    uint64_t adapterLuid = 0;
+    uint32_t outputIndex = 0;
+    uint32_t number = 0;
+    int32_t left = 0;
+    int32_t top = 0;
+    int32_t right = 0;
+    int32_t bottom = 0;
+
+    bool operator==(const CachedOutput& other) const
+    {
+        return adapterLuid == other.adapterLuid && outputIndex == other.outputIndex && number == other.number &&
+               left == other.left && top == other.top && right == other.right && bottom == other.bottom;
+    }
+    bool operator!=(const CachedOutput& other) const { return !(*this == other); }
+};
+
+namespace OutputCache
+{
+    //----------------------------------------------------------------------------------
+    // [OutputCache::Load]
+    // False if there is no cache or it can't be read.
+    //----------------------------------------------------------------------------------
+    inline bool Load(const std::string& path, CachedOutput& output)
+    {
+        std::ifstream file;
+        std::string line;
+        if (!OpenUtf8(file, path, std::ios::in) || !std::getline(file, line))
+        {
+            return false;
+        }
+        CachedOutput entry;
+        char end = 0;
+        if (sscanf(line.c_str(), "%" SCNx64 " %" SCNu32 " %" SCNu32 " %" SCNd32 " %" SCNd32 " %" SCNd32 " %" SCNd32 " %c",
+                   &entry.adapterLuid, &entry.outputIndex, &entry.number, &entry.left, &entry.top, &entry.right,
+                   &entry.bottom, &end) != 7 ||
+            entry.right <= entry.left || entry.bottom <= entry.top)
+        {
+            return false;
+        }
+        output = entry;
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [OutputCache::Save]
+    //----------------------------------------------------------------------------------
+    inline bool Save(const std::string& path, const CachedOutput& output)
+    {
+        char line[128];
+        const int length = snprintf(line, sizeof(line),
+                                    "%" PRIx64 " %" PRIu32 " %" PRIu32 " %" PRId32 " %" PRId32 " %" PRId32 " %" PRId32 "\n",
+                                    output.adapterLuid, output.outputIndex, output.number, output.left, output.top,
+                                    output.right, output.bottom);
+
+        const std::string temporaryPath = path + ".tmp";
+        FileWriter::Options io;
+        io.writeBehind = false;
+        io.bufferSize = 64 * 1024;
+        FileWriter file;
+        if (!file.Open(temporaryPath, io))
+        {
+            return false;
+        }
+        const bool written = file.Write(line, static_cast<size_t>(length));
+        if (!file.Close() || !written)
+        {
+            return false;
+        }
+#ifdef _WIN32
+        return MoveFileExW(Utf8ToWide(temporaryPath).c_str(), Utf8ToWide(path).c_str(),
+                           MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+    }
+}
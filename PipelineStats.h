@@ -0,0 +1,175 @@
+#pragma once
+//======================================================================================
+// PipelineStats.h
+// Per-stage latency histograms for the capture pipeline. Each stage is timed with
+// a StageTimer around the call and summarized (p50/p99/p99.9/max) periodically
+// and at the end of a recording, instead of logging every frame.
+//
+// Stages nest where the calls do: with our own encoder, EncodeSubmit includes the
+// muxer Write it triggers; with the MP4 sink writer, EncodeSubmit is WriteSample
+// and there is no separate Write.
+//
+// Histograms are kept in TickClock ticks and converted when printing. Each
+// StageTimer also emits a begin/end pair into the trace ring when tracing is on.
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+
+#include "EncodedSink.h"
+#include "LatencyHistogram.h"
+#include "Log.h"
+#include "TickClock.h"
+#include "Trace.h"
+
+enum class PipelineStage
+{
+    Acquire,      // AcquireNextFrame
+    Readback,     // Staging copy, GPU flush and Map
+    Convert,      // Row copy/flip and scene-change diff
+    EncodeSubmit, // Handing the frame to the encoder
+    Write,        // Container/raw output into the I/O layer
+    Count,
+};
+
+inline const char* PipelineStageName(PipelineStage stage)
+{
+    switch (stage)
+    {
+    case PipelineStage::Acquire: return "acquire";
+    case PipelineStage::Readback: return "readback";
+    case PipelineStage::Convert: return "convert";
+    case PipelineStage::EncodeSubmit: return "encode-submit";
+    case PipelineStage::Write: return "write";
+    default: return "?";
+    }
+}
+
+class PipelineStats
+{
+public:
+    PipelineStats()
+    {
+        TickClock::Start();
+    }
+
+    // Durations are in TickClock ticks. Each stage must be recorded from one thread.
+    void Record(PipelineStage stage, uint64_t ticks)
+    {
+        m_histograms[static_cast<size_t>(stage)].Record(ticks);
+    }
+
+    const LatencyHistogram& Histogram(PipelineStage stage) const
+    {
+        return m_histograms[static_cast<size_t>(stage)];
+    }
+
+    //----------------------------------------------------------------------------------
+    // [PipelineStats::Print]
+    // One line per stage that has samples, in microseconds.
+    //----------------------------------------------------------------------------------
+    void Print(std::ostream& out) const
+    {
+        FormatLines([&](const char* pLine) { out << pLine << '\n'; });
+        out.flush();
+    }
+
+    // The same table through the logger, for use while capturing.
+    void PrintToLog() const
+    {
+        FormatLines([](const char* pLine) { LOG_INFO("{}", pLine); });
+    }
+
+private:
+    template <typename LineFn>
+    void FormatLines(LineFn emit) const
+    {
+        const double usPerTick = TickClock::NsPerTick() / 1000.0;
+        char line[128];
+        snprintf(line, sizeof(line), "%-14s %8s %9s %9s %9s %9s %9s",
+                 "stage (us)", "count", "mean", "p50", "p99", "p99.9", "max");
+        emit(line);
+        for (size_t i = 0; i < static_cast<size_t>(PipelineStage::Count); ++i)
+        {
+            const LatencyHistogram::Summary s = m_histograms[i].Summarize();
+            if (s.count == 0)
+            {
+                continue;
+            }
+            snprintf(line, sizeof(line), "%-14s %8llu %9.1f %9.1f %9.1f %9.1f %9.1f",
+                     PipelineStageName(static_cast<PipelineStage>(i)), static_cast<unsigned long long>(s.count),
+                     s.mean * usPerTick, s.p50 * usPerTick, s.p99 * usPerTick, s.p999 * usPerTick, s.max * usPerTick);
+            emit(line);
+        }
+    }
+
+    LatencyHistogram m_histograms[static_cast<size_t>(PipelineStage::Count)];
+};
+
+// Records the time from construction to Stop() (or destruction) into one stage,
+// and traces it as a slice tagged with the thread's current frame.
+class StageTimer
+{
+public:
+    StageTimer(PipelineStats& stats, PipelineStage stage) :
+        m_stats(stats), m_stage(stage), m_start(TickClock::Now()), m_running(true)
+    {
+        Trace::Begin(PipelineStageName(stage), m_start);
+    }
+
+    ~StageTimer() { Stop(); }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    void Stop()
+    {
+        if (m_running)
+        {
+            const uint64_t end = TickClock::Now();
+            m_stats.Record(m_stage, end - m_start);
+            Trace::End(PipelineStageName(m_stage), end);
+            m_running = false;
+        }
+    }
+
+private:
+    PipelineStats& m_stats;
+    PipelineStage m_stage;
+    uint64_t m_start;
+    bool m_running;
+};
+
+// Times every WriteFrame() of the wrapped sink as the Write stage.
+class TimedSink : public EncodedSink
+{
+public:
+    TimedSink(EncodedSink* pInner, PipelineStats& stats) : m_pInner(pInner), m_stats(stats) {}
+
+    // The encoder may hand us an earlier frame than the one being captured, so
+    // the trace slice is tagged with the frame actually written.
+    bool WriteFrame(const EncodedFrame& frame) override
+    {
+        const uint64_t start = TickClock::Now();
+        Trace::Begin("write", start, frame.frameId);
+        const bool ok = m_pInner->WriteFrame(frame);
+        ++m_frames;
+        const uint64_t end = TickClock::Now();
+        Trace::End("write", end);
+        m_stats.Record(PipelineStage::Write, end - start);
+        return ok;
+    }
+
+    bool Finish() override
+    {
+        return m_pInner->Finish();
+    }
+
+    // Frames that have come out of the encoder so far.
+    uint64_t FramesWritten() const { return m_frames; }
+
+private:
+    EncodedSink* m_pInner;
+    PipelineStats& m_stats;
+    uint64_t m_frames = 0;
+};
@@ -0,0 +1,349 @@
+#pragma once
+//======================================================================================
+// PixelKernels.h
+// Portable CPU pixel routines used by the capture path. Nothing in here depends on
+// Windows, so the same code can be exercised and measured on any platform.
+//======================================================================================
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace PixelKernels
+{
+    //----------------------------------------------------------------------------------
+    // [PixelKernels::CopyRowsFlipped]
+    // Copies a 32-bit image while flipping it vertically. Media Foundation expects
+    // RGB32 bottom-up, while the desktop texture is top-down, and the mapped source
+    // row pitch is usually wider than the visible row.
+    //----------------------------------------------------------------------------------
+    inline void CopyRowsFlipped(uint8_t* pDst, size_t dstStride,
+                                const uint8_t* pSrc, size_t srcStride,
+                                uint32_t width, uint32_t height)
+    {
+        if (height == 0)
+        {
+            return;
+        }
+        const size_t rowBytes = static_cast<size_t>(width) * 4;
+        const uint8_t* pSrcRow = pSrc + (static_cast<size_t>(height) - 1) * srcStride;
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            memcpy(pDst, pSrcRow, rowBytes);
+            pDst += dstStride;
+            pSrcRow -= srcStride;
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [PixelKernels::DiffTilesAndUpdate]
+    // Compares a 32-bit frame against a shadow copy of the previous frame in square
+    // tiles and returns the fraction of the frame area covered by changed tiles.
+    // Changed tiles are copied into the shadow so it always holds the latest frame.
+    // Unchanged tiles cost one read of each buffer; memcmp bails out at the first
+    // differing byte, so heavily changing content is cheap to classify.
+    //----------------------------------------------------------------------------------
+    inline double DiffTilesAndUpdate(const uint8_t* pCur, size_t curStride,
+                                     uint8_t* pPrev, size_t prevStride,
+                                     uint32_t width, uint32_t height,
+                                     uint32_t tileSize = 32)
+    {
+        if (width == 0 || height == 0 || tileSize == 0)
+        {
+            return 0.0;
+        }
+
+        uint64_t changedPixels = 0;
+        for (uint32_t ty = 0; ty < height; ty += tileSize)
+        {
+            const uint32_t tileH = (height - ty < tileSize) ? (height - ty) : tileSize;
+            for (uint32_t tx = 0; tx < width; tx += tileSize)
+            {
+                const uint32_t tileW = (width - tx < tileSize) ? (width - tx) : tileSize;
+                const size_t tileBytes = static_cast<size_t>(tileW) * 4;
+                const uint8_t* pCurTile = pCur + ty * curStride + static_cast<size_t>(tx) * 4;
+                uint8_t* pPrevTile = pPrev + ty * prevStride + static_cast<size_t>(tx) * 4;
+
+                // Find the first differing row, if any.
+                uint32_t y = 0;
+                while (y < tileH && memcmp(pCurTile + y * curStride, pPrevTile + y * prevStride, tileBytes) == 0)
+                {
+                    ++y;
+                }
+                if (y == tileH)
+                {
+                    continue;
+                }
+
+                // The rows above y are already identical, so only the rest needs copying.
+                for (; y < tileH; ++y)
+                {
+                    memcpy(pPrevTile + y * prevStride, pCurTile + y * curStride, tileBytes);
+                }
+                changedPixels += static_cast<uint64_t>(tileW) * tileH;
+            }
+        }
+        return static_cast<double>(changedPixels) / (static_cast<double>(width) * height);
+    }
+
+    //----------------------------------------------------------------------------------
+    // Colour conversion
+    // BGRA (as captured) to 8-bit 4:2:0 YUV using BT.709 limited-range coefficients in
+    // 8.8 fixed point. Chroma is taken from the average of each 2x2 block, i.e.
+    // centre-sited. Strides are signed so a bottom-up source can be passed as a
+    // pointer to its last row with a negative stride. Odd widths and heights are
+    // handled by replicating the last column/row into the chroma average.
+    //----------------------------------------------------------------------------------
+    // Size of a tightly packed 4:2:0 frame (NV12 or I420).
+    inline size_t NV12Bytes(uint32_t width, uint32_t height)
+    {
+        return static_cast<size_t>(width) * height +
+               static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2) * 2;
+    }
+
+    inline uint8_t RgbToY(int r, int g, int b)
+    {
+        return static_cast<uint8_t>(16 + ((47 * r + 157 * g + 16 * b + 128) >> 8));
+    }
+
+    inline uint8_t RgbToU(int r, int g, int b)
+    {
+        return static_cast<uint8_t>(128 + ((-26 * r - 86 * g + 112 * b + 128) >> 8));
+    }
+
+    inline uint8_t RgbToV(int r, int g, int b)
+    {
+        return static_cast<uint8_t>(128 + ((112 * r - 102 * g - 10 * b + 128) >> 8));
+    }
+
+    // Shared row-pair loop. Chroma samples for column x/2 are written to
+    // pU[x/2 * chromaStep] and pV[x/2 * chromaStep], which covers both the planar
+    // (step 1) and the interleaved NV12 (step 2) layouts.
+    inline void BgraRowPairToYuv420(const uint8_t* pSrc0, const uint8_t* pSrc1,
+                                    uint8_t* pY0, uint8_t* pY1,
+                                    uint8_t* pU, uint8_t* pV, size_t chromaStep,
+                                    uint32_t width)
+    {
+        for (uint32_t x = 0; x < width; x += 2)
+        {
+            const uint32_t x1 = (x + 1 < width) ? x + 1 : x;
+            const uint8_t* a = pSrc0 + static_cast<size_t>(x) * 4;
+            const uint8_t* b = pSrc0 + static_cast<size_t>(x1) * 4;
+            const uint8_t* c = pSrc1 + static_cast<size_t>(x) * 4;
+            const uint8_t* d = pSrc1 + static_cast<size_t>(x1) * 4;
+
+            pY0[x] = RgbToY(a[2], a[1], a[0]);
+            pY1[x] = RgbToY(c[2], c[1], c[0]);
+            if (x + 1 < width)
+            {
+                pY0[x + 1] = RgbToY(b[2], b[1], b[0]);
+                pY1[x + 1] = RgbToY(d[2], d[1], d[0]);
+            }
+
+            const int r = (a[2] + b[2] + c[2] + d[2] + 2) >> 2;
+            const int g = (a[1] + b[1] + c[1] + d[1] + 2) >> 2;
+            const int bl = (a[0] + b[0] + c[0] + d[0] + 2) >> 2;
+            pU[(x / 2) * chromaStep] = RgbToU(r, g, bl);
+            pV[(x / 2) * chromaStep] = RgbToV(r, g, bl);
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [PixelKernels::BgraToI420]
+    // Planar Y, then U, then V. Chroma planes are ((width+1)/2) x ((height+1)/2).
+    //----------------------------------------------------------------------------------
+    inline void BgraToI420(const uint8_t* pSrc, ptrdiff_t srcStride,
+                           uint8_t* pY, ptrdiff_t yStride,
+                           uint8_t* pU, ptrdiff_t uStride,
+                           uint8_t* pV, ptrdiff_t vStride,
+                           uint32_t width, uint32_t height)
+    {
+        for (uint32_t y = 0; y < height; y += 2)
+        {
+            const uint32_t y1 = (y + 1 < height) ? y + 1 : y;
+            // When the height is odd the last luma row is simply written twice.
+            BgraRowPairToYuv420(pSrc + static_cast<ptrdiff_t>(y) * srcStride,
+                                pSrc + static_cast<ptrdiff_t>(y1) * srcStride,
+                                pY + static_cast<ptrdiff_t>(y) * yStride,
+                                pY + static_cast<ptrdiff_t>(y1) * yStride,
+                                pU + static_cast<ptrdiff_t>(y / 2) * uStride,
+                                pV + static_cast<ptrdiff_t>(y / 2) * vStride,
+                                1, width);
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [PixelKernels::BgraToNV12]
+    // Y plane followed by one interleaved UV plane of ((width+1)/2) pairs per row.
+    //----------------------------------------------------------------------------------
+    inline void BgraToNV12(const uint8_t* pSrc, ptrdiff_t srcStride,
+                           uint8_t* pY, ptrdiff_t yStride,
+                           uint8_t* pUV, ptrdiff_t uvStride,
+                           uint32_t width, uint32_t height)
+    {
+        for (uint32_t y = 0; y < height; y += 2)
+        {
+            const uint32_t y1 = (y + 1 < height) ? y + 1 : y;
+            uint8_t* pUVRow = pUV + static_cast<ptrdiff_t>(y / 2) * uvStride;
+            BgraRowPairToYuv420(pSrc + static_cast<ptrdiff_t>(y) * srcStride,
+                                pSrc + static_cast<ptrdiff_t>(y1) * srcStride,
+                                pY + static_cast<ptrdiff_t>(y) * yStride,
+                                pY + static_cast<ptrdiff_t>(y1) * yStride,
+                                pUVRow, pUVRow + 1, 2, width);
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [PixelKernels::CopyRows]
+    // Plain 32-bit image copy between buffers with different (signed) strides.
+    //----------------------------------------------------------------------------------
+    inline void CopyRows(uint8_t* pDst, ptrdiff_t dstStride,
+                         const uint8_t* pSrc, ptrdiff_t srcStride,
+                         uint32_t width, uint32_t height)
+    {
+        const size_t rowBytes = static_cast<size_t>(width) * 4;
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            memcpy(pDst + static_cast<ptrdiff_t>(y) * dstStride, pSrc + static_cast<ptrdiff_t>(y) * srcStride, rowBytes);
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [PixelKernels::ScaleBgraBilinear]
+    // Resamples a 32-bit image to another size, bilinearly between the four source
+    // pixels around each destination pixel's center (16.16 positions, 8-bit
+    // weights). Equal sizes give an exact copy. Each destination row blends its two
+    // source rows into 16-bit sums, gathers the left and right neighbors of every
+    // destination pixel from those, and blends them; the two blends run in
+    // ScaleRunLength chunks through local buffers, as BlendCursorRun does, so they
+    // vectorize.
+    //----------------------------------------------------------------------------------
+    const size_t ScaleRunLength = 64;
+
+    inline void ScaleBgraBilinear(uint8_t* pDst, size_t dstStride, uint32_t dstWidth, uint32_t dstHeight,
+                                  const uint8_t* pSrc, size_t srcStride, uint32_t srcWidth, uint32_t srcHeight)
+    {
+        if (dstWidth == 0 || dstHeight == 0 || srcWidth == 0 || srcHeight == 0)
+        {
+            return;
+        }
+        const int64_t stepX = (static_cast<int64_t>(srcWidth) << 16) / dstWidth;
+        const int64_t stepY = (static_cast<int64_t>(srcHeight) << 16) / dstHeight;
+        const int64_t maxX = static_cast<int64_t>(srcWidth - 1) << 16;
+        const int64_t maxY = static_cast<int64_t>(srcHeight - 1) << 16;
+
+        // Rows are processed in whole chunks; the buffers are padded to match.
+        const size_t srcValues = (static_cast<size_t>(srcWidth) * 4 + ScaleRunLength - 1) / ScaleRunLength * ScaleRunLength;
+        const size_t dstValues = (static_cast<size_t>(dstWidth) * 4 + ScaleRunLength - 1) / ScaleRunLength * ScaleRunLength;
+
+        // Per destination column: the left source pixel and the right one's weight,
+        // repeated for each channel.
+        std::vector<uint32_t> columns(dstWidth);
+        std::vector<uint16_t> weights(dstValues, 0);
+        for (uint32_t x = 0; x < dstWidth; ++x)
+        {
+            int64_t sx = x * stepX + stepX / 2 - 0x8000;
+            sx = sx < 0 ? 0 : (sx > maxX ? maxX : sx);
+            columns[x] = static_cast<uint32_t>(sx >> 16);
+            for (size_t c = 0; c < 4; ++c)
+            {
+                weights[static_cast<size_t>(x) * 4 + c] = static_cast<uint16_t>((sx >> 8) & 0xFF);
+            }
+        }
+        std::vector<uint8_t> rows(srcValues * 2, 0);
+        std::vector<uint16_t> blended(srcValues + 4, 0);
+        std::vector<uint16_t> left(dstValues, 0);
+        std::vector<uint16_t> right(dstValues, 0);
+        std::vector<uint8_t> out(dstValues);
+
+        for (uint32_t y = 0; y < dstHeight; ++y)
+        {
+            int64_t sy = y * stepY + stepY / 2 - 0x8000;
+            sy = sy < 0 ? 0 : (sy > maxY ? maxY : sy);
+            const uint32_t y0 = static_cast<uint32_t>(sy >> 16);
+            const uint32_t y1 = y0 + 1 < srcHeight ? y0 + 1 : y0;
+            const uint16_t fy = static_cast<uint16_t>((sy >> 8) & 0xFF);
+            memcpy(rows.data(), pSrc + y0 * srcStride, static_cast<size_t>(srcWidth) * 4);
+            memcpy(rows.data() + srcValues, pSrc + y1 * srcStride, static_cast<size_t>(srcWidth) * 4);
+
+            for (size_t i = 0; i < srcValues; i += ScaleRunLength)
+            {
+                uint16_t sums[ScaleRunLength];
+                const uint8_t* pRow0 = rows.data() + i;
+                const uint8_t* pRow1 = rows.data() + srcValues + i;
+                for (size_t k = 0; k < ScaleRunLength; ++k)
+                {
+                    sums[k] = static_cast<uint16_t>(pRow0[k] * (256 - fy) + pRow1[k] * fy);
+                }
+                memcpy(blended.data() + i, sums, sizeof(sums));
+            }
+
+            const uint16_t* pBlended = blended.data();
+            const size_t lastPixel = static_cast<size_t>(srcWidth - 1) * 4;
+            for (uint32_t x = 0; x < dstWidth; ++x)
+            {
+                const size_t source = static_cast<size_t>(columns[x]) * 4;
+                memcpy(left.data() + static_cast<size_t>(x) * 4, pBlended + source, 4 * sizeof(uint16_t));
+                memcpy(right.data() + static_cast<size_t>(x) * 4, pBlended + (source < lastPixel ? source + 4 : source),
+                       4 * sizeof(uint16_t));
+            }
+
+            for (size_t i = 0; i < dstValues; i += ScaleRunLength)
+            {
+                uint8_t pixels[ScaleRunLength];
+                const uint16_t* pLeft = left.data() + i;
+                const uint16_t* pRight = right.data() + i;
+                const uint16_t* pWeight = weights.data() + i;
+                for (size_t k = 0; k < ScaleRunLength; ++k)
+                {
+                    pixels[k] = static_cast<uint8_t>((static_cast<uint32_t>(pLeft[k]) * (256 - pWeight[k]) +
+                                                      static_cast<uint32_t>(pRight[k]) * pWeight[k] + 0x8000) >> 16);
+                }
+                memcpy(out.data() + i, pixels, ScaleRunLength);
+            }
+            memcpy(pDst + y * dstStride, out.data(), static_cast<size_t>(dstWidth) * 4);
+        }
+    }
+
+    // One byte of BlendCursorRow: round((color * weight + dst * (255 - weight)) / 255)
+    // then XOR. 16-bit arithmetic is exact here and keeps vector lanes narrow.
+    inline uint8_t BlendCursorByte(uint8_t dst, uint8_t color, uint8_t weight, uint8_t xorMask)
+    {
+        const uint16_t v = static_cast<uint16_t>(color * weight + dst * (255 - weight) + 128);
+        return static_cast<uint8_t>(((v + (v >> 8)) >> 8) ^ xorMask);
+    }
+
+    // A fixed trip count and results staged in a local buffer (so nothing can alias
+    // the inputs) are what let compilers vectorize this; GCC does at -O2.
+    const uint32_t BlendRunLength = 64;
+
+    inline void BlendCursorRun(uint8_t* pDst, const uint8_t* pColor, const uint8_t* pWeight, const uint8_t* pXor)
+    {
+        uint8_t blended[BlendRunLength];
+        for (uint32_t i = 0; i < BlendRunLength; ++i)
+        {
+            blended[i] = BlendCursorByte(pDst[i], pColor[i], pWeight[i], pXor[i]);
+        }
+        memcpy(pDst, blended, BlendRunLength);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [PixelKernels::BlendCursorRow]
+    // Composites one row of a prepared pointer image (see CursorCompositor.h) over
+    // BGRA pixels. Every pointer type reduces to the same per-byte blend-then-XOR, so
+    // there are no branches on the pixel data.
+    //----------------------------------------------------------------------------------
+    inline void BlendCursorRow(uint8_t* pDst, const uint8_t* pColor, const uint8_t* pWeight,
+                               const uint8_t* pXor, uint32_t bytes)
+    {
+        uint32_t i = 0;
+        for (; i + BlendRunLength <= bytes; i += BlendRunLength)
+        {
+            BlendCursorRun(pDst + i, pColor + i, pWeight + i, pXor + i);
+        }
+        for (; i < bytes; ++i)
+        {
+            pDst[i] = BlendCursorByte(pDst[i], pColor[i], pWeight[i], pXor[i]);
+        }
+    }
+}
@@ -0,0 +1,280 @@
+#pragma once
+//======================================================================================
+// QualityMetrics.h
+// Objective quality of an encoded frame against the frame that went into the
+// encoder: PSNR per plane and overall, SSIM on luma, and the PSNR of the worst
+// luma tile. Screen content tends to be sharp text on flat backgrounds, where a
+// whole-frame average hides a smeared window behind a large static desktop; the
+// worst tile does not.
+//
+// Like PixelKernels.h, everything here is portable and written as plain loops over
+// rows that compilers vectorize (build for the ISA level you deploy on). Planes
+// are processed in horizontal stripes of one tile or four rows, so the working
+// set stays in cache even at 8K.
+//======================================================================================
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace QualityMetrics
+{
+    // Reported for identical planes instead of infinity.
+    const double MaxPsnr = 100.0;
+
+    inline double Psnr(uint64_t sse, uint64_t samples)
+    {
+        if (sse == 0 || samples == 0)
+        {
+            return MaxPsnr;
+        }
+        const double psnr = 10.0 * std::log10(255.0 * 255.0 * static_cast<double>(samples) / static_cast<double>(sse));
+        return psnr < MaxPsnr ? psnr : MaxPsnr;
+    }
+
+    // Runs of 64 samples: a fixed trip count is what lets compilers vectorize these
+    // loops without an epilogue (GCC does at -O2). Step 2 reads one component of
+    // an interleaved plane.
+    const uint32_t RunLength = 64;
+
+    template <uint32_t Step>
+    inline uint32_t RowSse(const uint8_t* pA, const uint8_t* pB, uint32_t count)
+    {
+        // 64 squared 8-bit differences fit in 32 bits with room to spare.
+        uint32_t sum = 0;
+        if (count == RunLength)
+        {
+            for (uint32_t x = 0; x < RunLength; ++x)
+            {
+                const int d = static_cast<int>(pA[x * Step]) - static_cast<int>(pB[x * Step]);
+                sum += static_cast<uint32_t>(d * d);
+            }
+            return sum;
+        }
+        for (uint32_t x = 0; x < count; ++x)
+        {
+            const int d = static_cast<int>(pA[x * Step]) - static_cast<int>(pB[x * Step]);
+            sum += static_cast<uint32_t>(d * d);
+        }
+        return sum;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [QualityMetrics::PlaneSse]
+    // Sum of squared differences between two 8-bit planes, accumulated per 64x64
+    // tile. If pWorstTilePsnr is given it receives the lowest PSNR of any tile
+    // (partial tiles at the edges included). Step 2 reads one component of an
+    // interleaved (NV12 UV) plane; width counts samples of that component.
+    //----------------------------------------------------------------------------------
+    template <uint32_t Step = 1>
+    inline uint64_t PlaneSse(const uint8_t* pA, ptrdiff_t strideA, const uint8_t* pB, ptrdiff_t strideB,
+                             uint32_t width, uint32_t height, double* pWorstTilePsnr = nullptr)
+    {
+        const uint32_t tileSize = RunLength;
+        const uint32_t tilesX = (width + tileSize - 1) / tileSize;
+        std::vector<uint64_t> tileSse(tilesX);
+        uint64_t total = 0;
+        double worst = MaxPsnr;
+        for (uint32_t ty = 0; ty < height; ty += tileSize)
+        {
+            const uint32_t tileH = (height - ty < tileSize) ? (height - ty) : tileSize;
+            for (uint32_t tx = 0; tx < tilesX; ++tx)
+            {
+                tileSse[tx] = 0;
+            }
+            for (uint32_t y = ty; y < ty + tileH; ++y)
+            {
+                const uint8_t* pRowA = pA + static_cast<ptrdiff_t>(y) * strideA;
+                const uint8_t* pRowB = pB + static_cast<ptrdiff_t>(y) * strideB;
+                for (uint32_t tx = 0; tx < tilesX; ++tx)
+                {
+                    const uint32_t first = tx * tileSize;
+                    const uint32_t count = (width - first < tileSize) ? width - first : tileSize;
+                    tileSse[tx] += RowSse<Step>(pRowA + first * Step, pRowB + first * Step, count);
+                }
+            }
+            for (uint32_t tx = 0; tx < tilesX; ++tx)
+            {
+                total += tileSse[tx];
+                const uint32_t tileW = (width - tx * tileSize < tileSize) ? width - tx * tileSize : tileSize;
+                const double psnr = Psnr(tileSse[tx], static_cast<uint64_t>(tileW) * tileH);
+                worst = psnr < worst ? psnr : worst;
+            }
+        }
+        if (pWorstTilePsnr)
+        {
+            *pWorstTilePsnr = worst;
+        }
+        return total;
+    }
+
+    // Adds one row to the per-column sums of a, b, a*a + b*b and a*b.
+    inline void AccumulateColumns(const uint8_t* pA, const uint8_t* pB, uint32_t* pSumA, uint32_t* pSumB,
+                                  uint32_t* pSumSquares, uint32_t* pSumProducts, uint32_t count)
+    {
+        auto accumulate = [&](uint32_t x)
+        {
+            const uint32_t a = pA[x];
+            const uint32_t b = pB[x];
+            pSumA[x] += a;
+            pSumB[x] += b;
+            pSumSquares[x] += a * a + b * b;
+            pSumProducts[x] += a * b;
+        };
+        if (count == RunLength)
+        {
+            for (uint32_t x = 0; x < RunLength; ++x)
+            {
+                accumulate(x);
+            }
+            return;
+        }
+        for (uint32_t x = 0; x < count; ++x)
+        {
+            accumulate(x);
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [QualityMetrics::Ssim]
+    // Mean SSIM of an 8-bit plane over 8x8 windows spaced 4 pixels apart, the
+    // variant x264 and libvpx report. Sums are taken over 4x4 blocks, one stripe
+    // of four rows at a time, and each window adds up 2x2 neighbouring blocks.
+    // Planes smaller than 8x8 report 1.
+    //----------------------------------------------------------------------------------
+    inline double Ssim(const uint8_t* pA, ptrdiff_t strideA, const uint8_t* pB, ptrdiff_t strideB,
+                       uint32_t width, uint32_t height)
+    {
+        const uint32_t blocksX = width / 4;
+        const uint32_t blocksY = height / 4;
+        if (blocksX < 2 || blocksY < 2)
+        {
+            return 1.0;
+        }
+
+        // Per-block sums of a, b, a*a + b*b and a*b for the previous and current
+        // stripe, and per-column sums over the four rows of the current stripe.
+        struct BlockSums
+        {
+            uint32_t sumA, sumB, sumSquares, sumProducts;
+        };
+        std::vector<BlockSums> stripes[2] = { std::vector<BlockSums>(blocksX), std::vector<BlockSums>(blocksX) };
+        const uint32_t columns = blocksX * 4;
+        std::vector<uint32_t> columnA(columns), columnB(columns), columnSquares(columns), columnProducts(columns);
+
+        // (0.01 * 255)^2 and (0.03 * 255)^2, scaled to sums over 64 samples.
+        const double c1 = 0.01 * 0.01 * 255 * 255 * 64 * 64;
+        const double c2 = 0.03 * 0.03 * 255 * 255 * 64 * 63;
+        double total = 0.0;
+        for (uint32_t by = 0; by < blocksY; ++by)
+        {
+            for (uint32_t x = 0; x < columns; ++x)
+            {
+                columnA[x] = columnB[x] = columnSquares[x] = columnProducts[x] = 0;
+            }
+            for (uint32_t y = by * 4; y < by * 4 + 4; ++y)
+            {
+                const uint8_t* pRowA = pA + static_cast<ptrdiff_t>(y) * strideA;
+                const uint8_t* pRowB = pB + static_cast<ptrdiff_t>(y) * strideB;
+                for (uint32_t first = 0; first < columns; first += RunLength)
+                {
+                    const uint32_t count = (columns - first < RunLength) ? columns - first : RunLength;
+                    AccumulateColumns(pRowA + first, pRowB + first, &columnA[first], &columnB[first],
+                                      &columnSquares[first], &columnProducts[first], count);
+                }
+            }
+            std::vector<BlockSums>& current = stripes[by & 1];
+            for (uint32_t bx = 0; bx < blocksX; ++bx)
+            {
+                const uint32_t x = bx * 4;
+                current[bx].sumA = columnA[x] + columnA[x + 1] + columnA[x + 2] + columnA[x + 3];
+                current[bx].sumB = columnB[x] + columnB[x + 1] + columnB[x + 2] + columnB[x + 3];
+                current[bx].sumSquares = columnSquares[x] + columnSquares[x + 1] + columnSquares[x + 2] + columnSquares[x + 3];
+                current[bx].sumProducts = columnProducts[x] + columnProducts[x + 1] + columnProducts[x + 2] + columnProducts[x + 3];
+            }
+            if (by == 0)
+            {
+                continue;
+            }
+
+            const std::vector<BlockSums>& previous = stripes[(by - 1) & 1];
+            for (uint32_t bx = 0; bx + 1 < blocksX; ++bx)
+            {
+                const double s1 = static_cast<double>(previous[bx].sumA + previous[bx + 1].sumA + current[bx].sumA + current[bx + 1].sumA);
+                const double s2 = static_cast<double>(previous[bx].sumB + previous[bx + 1].sumB + current[bx].sumB + current[bx + 1].sumB);
+                const double ss = static_cast<double>(previous[bx].sumSquares + previous[bx + 1].sumSquares +
+                                                      current[bx].sumSquares + current[bx + 1].sumSquares);
+                const double s12 = static_cast<double>(previous[bx].sumProducts + previous[bx + 1].sumProducts +
+                                                       current[bx].sumProducts + current[bx + 1].sumProducts);
+                const double variances = ss * 64 - s1 * s1 - s2 * s2;
+                const double covariance = s12 * 64 - s1 * s2;
+                total += (2 * s1 * s2 + c1) * (2 * covariance + c2) / ((s1 * s1 + s2 * s2 + c1) * (variances + c2));
+            }
+        }
+        return total / (static_cast<double>(blocksX - 1) * (blocksY - 1));
+    }
+
+    // One measured frame.
+    struct FrameQuality
+    {
+        double psnrY = MaxPsnr;
+        double psnrU = MaxPsnr;
+        double psnrV = MaxPsnr;
+        double psnr = MaxPsnr;          // Over all samples of all three planes.
+        double ssim = 1.0;              // Luma.
+        double worstTilePsnr = MaxPsnr; // Luma, 64x64 tiles.
+    };
+
+    //----------------------------------------------------------------------------------
+    // [QualityMetrics::MeasureNV12]
+    // Compares a decoded NV12 frame against the reference (both width x height,
+    // each with its own plane pointers and strides).
+    //----------------------------------------------------------------------------------
+    inline FrameQuality MeasureNV12(const uint8_t* pRefY, ptrdiff_t refYStride, const uint8_t* pRefUV, ptrdiff_t refUVStride,
+                                    const uint8_t* pY, ptrdiff_t yStride, const uint8_t* pUV, ptrdiff_t uvStride,
+                                    uint32_t width, uint32_t height)
+    {
+        const uint32_t chromaWidth = (width + 1) / 2;
+        const uint32_t chromaHeight = (height + 1) / 2;
+        const uint64_t lumaSamples = static_cast<uint64_t>(width) * height;
+        const uint64_t chromaSamples = static_cast<uint64_t>(chromaWidth) * chromaHeight;
+
+        FrameQuality quality;
+        const uint64_t sseY = PlaneSse(pRefY, refYStride, pY, yStride, width, height, &quality.worstTilePsnr);
+        const uint64_t sseU = PlaneSse<2>(pRefUV, refUVStride, pUV, uvStride, chromaWidth, chromaHeight);
+        const uint64_t sseV = PlaneSse<2>(pRefUV + 1, refUVStride, pUV + 1, uvStride, chromaWidth, chromaHeight);
+        quality.psnrY = Psnr(sseY, lumaSamples);
+        quality.psnrU = Psnr(sseU, chromaSamples);
+        quality.psnrV = Psnr(sseV, chromaSamples);
+        quality.psnr = Psnr(sseY + sseU + sseV, lumaSamples + chromaSamples * 2);
+        quality.ssim = Ssim(pRefY, refYStride, pY, yStride, width, height);
+        return quality;
+    }
+
+    //==================================================================================
+    // QualityTotals
+    // Running summary of the frames measured during a recording.
+    //==================================================================================
+    struct QualityTotals
+    {
+        uint64_t frames = 0;
+        double psnrSum = 0.0;
+        double psnrMin = MaxPsnr;
+        double ssimSum = 0.0;
+        double ssimMin = 1.0;
+        double worstTilePsnrMin = MaxPsnr;
+
+        void Add(const FrameQuality& quality)
+        {
+            ++frames;
+            psnrSum += quality.psnr;
+            psnrMin = quality.psnr < psnrMin ? quality.psnr : psnrMin;
+            ssimSum += quality.ssim;
+            ssimMin = quality.ssim < ssimMin ? quality.ssim : ssimMin;
+            worstTilePsnrMin = quality.worstTilePsnr < worstTilePsnrMin ? quality.worstTilePsnr : worstTilePsnrMin;
+        }
+
+        double PsnrMean() const { return frames ? psnrSum / frames : 0.0; }
+        double SsimMean() const { return frames ? ssimSum / frames : 0.0; }
+    };
+}
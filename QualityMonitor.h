@@ -0,0 +1,375 @@
+#pragma once
+//======================================================================================
+// QualityMonitor.h
+// Measures what the encoder does to the picture while recording: decodes the
+// encoded stream on a background thread and compares a sample of frames (every
+// Nth) against the frame that went into the encoder, with the metrics in
+// QualityMetrics.h. Results go to the log, the health report and the metrics
+// endpoint, so bitrate and rate-control changes can be judged on numbers.
+//
+// It sits next to the muxers as one more EncodedSink. The capture thread only pays
+// for copying an access unit into the queue and, for sampled frames, one copy of
+// the source image. Decoding and measuring run at background priority: every
+// access unit has to be decoded to keep the reference pictures right, so when
+// the thread falls behind the queue fills up and it drops access units up to the
+// next keyframe instead of slowing down the recording.
+//======================================================================================
+#include <windows.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EncodedSink.h"
+#include "H264Bitstream.h"
+#include "MFH264Decoder.h"
+#include "PixelKernels.h"
+#include "QualityMetrics.h"
+#include "Trace.h"
+
+class QualityMonitor : public EncodedSink
+{
+public:
+    struct Stats
+    {
+        QualityMetrics::QualityTotals totals;
+        uint64_t framesSkipped = 0; // Sampled, but dropped before they were decoded.
+        uint64_t decodeErrors = 0;
+    };
+
+    // Encoded data waiting for the decoder before access units are dropped.
+    static const size_t QueueBytes = 32 * 1024 * 1024;
+    // Sampled source frames that can wait for their decoded counterpart.
+    static const size_t ReferenceCount = 2;
+
+    QualityMonitor() = default;
+    ~QualityMonitor() { Stop(); }
+    QualityMonitor(const QualityMonitor&) = delete;
+    QualityMonitor& operator=(const QualityMonitor&) = delete;
+
+    //----------------------------------------------------------------------------------
+    // [QualityMonitor::Start]
+    // Creates the decoder and starts the measuring thread. Every sampleInterval-th
+    // frame (by capture frame ID) is measured.
+    //----------------------------------------------------------------------------------
+    bool Start(uint32_t width, uint32_t height, uint32_t fps, uint32_t sampleInterval, std::string& error)
+    {
+        const HRESULT hr = m_decoder.Initialize(width, height, fps);
+        if (FAILED(hr))
+        {
+            char message[96];
+            snprintf(message, sizeof(message), "No H.264 decoder for quality measurement (0x%08lx)", (unsigned long)hr);
+            error = message;
+            return false;
+        }
+        m_width = width;
+        m_height = height;
+        m_sampleInterval = sampleInterval ? sampleInterval : 1;
+        for (Reference& reference : m_references)
+        {
+            reference.bgra.resize(static_cast<size_t>(width) * height * 4);
+            reference.state = ReferenceState::Free;
+        }
+        m_reference.resize(PixelKernels::NV12Bytes(width, height));
+        m_queuedBytes = 0;
+        m_waitingForKeyframe = true;
+        m_discontinuity = false;
+        m_stopping = false;
+        m_stats = Stats();
+        m_thread = std::thread(&QualityMonitor::MeasureThread, this);
+        return true;
+    }
+
+    // Inserted in front of keyframes that don't carry SPS/PPS themselves.
+    void SetSequenceHeader(const uint8_t* pData, size_t size)
+    {
+        m_sequenceHeader.assign(pData, pData + size);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [QualityMonitor::SubmitSource]
+    // Called by the capture thread for every frame before it is encoded; copies the
+    // ones that are sampled. A negative stride reads a bottom-up image top-down.
+    //----------------------------------------------------------------------------------
+    void SubmitSource(uint64_t frameId, const uint8_t* pBgra, ptrdiff_t stride)
+    {
+        if (!m_thread.joinable() || frameId % m_sampleInterval != 0)
+        {
+            return;
+        }
+        Reference* pReference = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (Reference& reference : m_references)
+            {
+                if (reference.state == ReferenceState::Free)
+                {
+                    pReference = &reference;
+                    pReference->state = ReferenceState::Filling;
+                    break;
+                }
+            }
+            if (!pReference)
+            {
+                ++m_stats.framesSkipped; // Still busy with earlier samples.
+                return;
+            }
+        }
+        PixelKernels::CopyRows(pReference->bgra.data(), static_cast<ptrdiff_t>(m_width) * 4, pBgra, stride, m_width, m_height);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pReference->frameId = frameId;
+        pReference->state = ReferenceState::Ready;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [QualityMonitor::WriteFrame]
+    // Queues a copy of the access unit for the decoder. Never fails the recording.
+    //----------------------------------------------------------------------------------
+    bool WriteFrame(const EncodedFrame& frame) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread.joinable() || m_stopping)
+        {
+            return true;
+        }
+        if (m_waitingForKeyframe && !frame.keyframe)
+        {
+            return true;
+        }
+        if (m_queuedBytes + frame.size > QueueBytes)
+        {
+            // Behind: skip to the next keyframe and have the decoder start over.
+            m_waitingForKeyframe = true;
+            m_discontinuity = true;
+            return true;
+        }
+        m_waitingForKeyframe = false;
+
+        m_queue.emplace_back();
+        QueuedFrame& queued = m_queue.back();
+        if (!m_spare.empty())
+        {
+            queued.data.swap(m_spare.back());
+            m_spare.pop_back();
+        }
+        const bool addHeader = frame.keyframe && !m_sequenceHeader.empty() &&
+                               !H264::ContainsNal(frame.pData, frame.size, H264::NalSps);
+        queued.data.clear();
+        if (addHeader)
+        {
+            queued.data.insert(queued.data.end(), m_sequenceHeader.begin(), m_sequenceHeader.end());
+        }
+        queued.data.insert(queued.data.end(), frame.pData, frame.pData + frame.size);
+        queued.frame = frame;
+        queued.discontinuity = m_discontinuity;
+        m_discontinuity = false;
+        m_queuedBytes += queued.data.size();
+        m_cv.notify_one();
+        return true;
+    }
+
+    bool Finish() override { return true; }
+
+    // Measures what is still queued, then stops the thread.
+    void Stop()
+    {
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            m_cv.notify_one();
+        }
+        m_thread.join();
+        m_decoder.Shutdown();
+    }
+
+    Stats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [QualityMonitor::FormatJson]
+    // The "quality" member of the health report:
+    //   "quality": { "frames": 120, "psnr_mean": 41.2, "psnr_min": 35.0, ... }
+    //----------------------------------------------------------------------------------
+    static void FormatJson(const Stats& stats, std::string& json)
+    {
+        char text[512];
+        snprintf(text, sizeof(text),
+                 "  \"quality\": {\n    \"frames\": %llu,\n    \"frames_skipped\": %llu,\n    \"decode_errors\": %llu,\n"
+                 "    \"psnr_mean\": %.3f,\n    \"psnr_min\": %.3f,\n    \"ssim_mean\": %.5f,\n    \"ssim_min\": %.5f,\n"
+                 "    \"worst_tile_psnr_min\": %.3f\n  }",
+                 static_cast<unsigned long long>(stats.totals.frames), static_cast<unsigned long long>(stats.framesSkipped),
+                 static_cast<unsigned long long>(stats.decodeErrors), stats.totals.PsnrMean(), stats.totals.psnrMin,
+                 stats.totals.SsimMean(), stats.totals.ssimMin, stats.totals.worstTilePsnrMin);
+        json = text;
+    }
+
+private:
+    enum class ReferenceState
+    {
+        Free,
+        Filling, // Being copied by the capture thread.
+        Ready,
+    };
+
+    struct Reference
+    {
+        std::vector<uint8_t> bgra;
+        uint64_t frameId = 0;
+        ReferenceState state = ReferenceState::Free;
+    };
+
+    struct QueuedFrame
+    {
+        std::vector<uint8_t> data;
+        EncodedFrame frame;
+        bool discontinuity;
+    };
+
+    // Decoded pictures carry the pts of their access unit; this maps it back.
+    static const size_t FrameIdRingSize = 16;
+    struct FrameIdEntry
+    {
+        int64_t pts = -1;
+        uint64_t frameId = 0;
+    };
+
+    void MeasureThread()
+    {
+        Trace::SetThreadName("quality");
+        // Lowers CPU, I/O and memory priority: measuring must never compete with
+        // capture or encoding.
+        SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+        FrameIdEntry frameIds[FrameIdRingSize];
+        size_t nextFrameId = 0;
+        const MFH264Decoder::PictureCallback onPicture = [&](const DecodedPicture& picture)
+        {
+            for (const FrameIdEntry& entry : frameIds)
+            {
+                if (entry.pts == picture.pts)
+                {
+                    Measure(entry.frameId, picture);
+                    break;
+                }
+            }
+        };
+
+        for (;;)
+        {
+            QueuedFrame queued;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [&] { return m_stopping || !m_queue.empty(); });
+                if (m_queue.empty())
+                {
+                    break;
+                }
+                queued.data.swap(m_queue.front().data);
+                queued.frame = m_queue.front().frame;
+                queued.discontinuity = m_queue.front().discontinuity;
+                m_queue.pop_front();
+            }
+
+            if (queued.discontinuity)
+            {
+                m_decoder.Flush();
+            }
+            FrameIdEntry& entry = frameIds[nextFrameId++ % FrameIdRingSize];
+            entry.pts = queued.frame.pts;
+            entry.frameId = queued.frame.frameId;
+            queued.frame.pData = queued.data.data();
+            queued.frame.size = queued.data.size();
+            if (FAILED(m_decoder.Decode(queued.frame, onPicture)))
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_stats.decodeErrors;
+                m_waitingForKeyframe = true;
+                m_discontinuity = true;
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queuedBytes -= queued.data.size();
+            m_spare.emplace_back();
+            m_spare.back().swap(queued.data);
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [QualityMonitor::Measure]
+    // Compares a decoded picture with its source frame, if that frame was sampled.
+    // Samples older than the picture will never be decoded (their access units
+    // were dropped), so they are given up.
+    //----------------------------------------------------------------------------------
+    void Measure(uint64_t frameId, const DecodedPicture& picture)
+    {
+        Reference* pMatch = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (Reference& reference : m_references)
+            {
+                if (reference.state != ReferenceState::Ready || reference.frameId > frameId)
+                {
+                    continue;
+                }
+                if (reference.frameId == frameId)
+                {
+                    pMatch = &reference;
+                }
+                else
+                {
+                    reference.state = ReferenceState::Free;
+                    ++m_stats.framesSkipped;
+                }
+            }
+        }
+        if (!pMatch)
+        {
+            return;
+        }
+
+        // Convert exactly as the encoder does, so only coding loss is measured.
+        const size_t chromaStride = static_cast<size_t>((m_width + 1) / 2) * 2;
+        uint8_t* pRefY = m_reference.data();
+        uint8_t* pRefUV = pRefY + static_cast<size_t>(m_width) * m_height;
+        PixelKernels::BgraToNV12(pMatch->bgra.data(), static_cast<ptrdiff_t>(m_width) * 4, pRefY, m_width, pRefUV,
+                                 static_cast<ptrdiff_t>(chromaStride), m_width, m_height);
+        const QualityMetrics::FrameQuality quality =
+            QualityMetrics::MeasureNV12(pRefY, m_width, pRefUV, static_cast<ptrdiff_t>(chromaStride), picture.pY,
+                                        picture.yStride, picture.pUV, picture.uvStride, m_width, m_height);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pMatch->state = ReferenceState::Free;
+        m_stats.totals.Add(quality);
+    }
+
+    MFH264Decoder m_decoder; // Only used by the measuring thread once started.
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint32_t m_sampleInterval = 1;
+    std::vector<uint8_t> m_sequenceHeader;
+    std::vector<uint8_t> m_reference; // NV12 conversion of the matched source frame.
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<QueuedFrame> m_queue;
+    std::vector<std::vector<uint8_t>> m_spare; // Recycled access unit buffers.
+    size_t m_queuedBytes = 0;
+    bool m_waitingForKeyframe = true;
+    bool m_discontinuity = false;
+    bool m_stopping = false;
+    Reference m_references[ReferenceCount];
+    Stats m_stats;
+    std::thread m_thread;
+};
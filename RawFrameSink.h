@@ -0,0 +1,227 @@
+#pragma once
+//======================================================================================
+// RawFrameSink.h
+// Writes uncompressed frames to disk so a capture can be encoded (and re-encoded)
+// offline, or kept as the reference when judging encoder quality.
+//
+// Two containers are supported:
+//
+//   Y4M  - the standard YUV4MPEG2 stream, I420 only. Readable by ffmpeg, x264,
+//          vmaf and most encoder test tools.
+//
+//   Raw  - a minimal headered format for any of BGRA, NV12 or I420, with the
+//          capture timestamp of every frame (Y4M cannot carry VFR timestamps).
+//          All fields little-endian:
+//            File header (32 bytes):
+//              char magic[4] = "RAWV", uint32 version = 1, char fourcc[4],
+//              uint32 width, uint32 height, uint32 fpsNum, uint32 fpsDen,
+//              uint32 frameHeaderSize = 16
+//            Per frame: int64 timestamp (100 ns units), uint32 payloadBytes,
+//              uint32 0, then the payload: BGRA rows top-down with no padding, or
+//              the Y plane followed by the UV (NV12) or U and V (I420) planes.
+//
+// Frames are converted directly into the FileWriter's staging buffers, so each
+// frame is touched exactly once on its way to disk. The pointer is drawn by passing
+// a small patch of the frame with the pointer already blended in, which is
+// converted over the frame where it belongs.
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "CaptureSource.h"
+#include "FileWriter.h"
+#include "PixelKernels.h"
+
+enum class RawPixelFormat
+{
+    BGRA,
+    NV12,
+    I420,
+};
+
+enum class RawContainer
+{
+    Y4M,
+    Raw,
+};
+
+//======================================================================================
+// RawFrameSink
+//======================================================================================
+class RawFrameSink
+{
+public:
+    static const uint32_t Version = 1;
+    static const uint32_t FrameHeaderSize = 16;
+
+    // Bytes of converted pixel data for one frame.
+    static size_t FrameBytes(RawPixelFormat format, uint32_t width, uint32_t height)
+    {
+        const size_t lumaBytes = static_cast<size_t>(width) * height;
+        const size_t chromaBytes = static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+        switch (format)
+        {
+        case RawPixelFormat::BGRA: return lumaBytes * 4;
+        case RawPixelFormat::NV12: return lumaBytes + chromaBytes * 2;
+        case RawPixelFormat::I420: return lumaBytes + chromaBytes * 2;
+        }
+        return 0;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [RawFrameSink::Open]
+    // Creates the file and writes the stream header. Y4M requires I420.
+    //----------------------------------------------------------------------------------
+    bool Open(const std::string& path, RawContainer container, RawPixelFormat format,
+              uint32_t width, uint32_t height, uint32_t fpsNum, uint32_t fpsDen,
+              const FileWriter::Options& ioOptions, std::string& error)
+    {
+        if (container == RawContainer::Y4M && format != RawPixelFormat::I420)
+        {
+            error = "Y4M output only supports the I420 pixel format";
+            return false;
+        }
+
+        m_container = container;
+        m_format = format;
+        m_width = width;
+        m_height = height;
+        m_frameBytes = FrameBytes(format, width, height);
+
+        // Every frame must fit in one staging buffer so it can be converted in place.
+        FileWriter::Options options = ioOptions;
+        const size_t perFrame = m_frameBytes + 64;
+        if (options.bufferSize < perFrame * 2)
+        {
+            options.bufferSize = perFrame * 2;
+        }
+        if (!m_writer.Open(path, options))
+        {
+            error = "Could not create " + path;
+            return false;
+        }
+
+        if (container == RawContainer::Y4M)
+        {
+            char header[128];
+            const int length = snprintf(header, sizeof(header),
+                "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+                width, height, fpsNum, fpsDen);
+            m_writer.Write(header, static_cast<size_t>(length));
+        }
+        else
+        {
+            uint32_t header[8] = { 0x56574152u /* "RAWV" */, Version, FourCC(format),
+                                   width, height, fpsNum, fpsDen, FrameHeaderSize };
+            m_writer.Write(header, sizeof(header));
+        }
+        return !m_writer.HasFailed();
+    }
+
+    //----------------------------------------------------------------------------------
+    // [RawFrameSink::WriteFrame]
+    // Converts one BGRA frame into the output format and queues it for writing.
+    // pBgra/stride describe a top-down image; pass the last row and a negative
+    // stride for bottom-up buffers. pPatch, if given, replaces the 'patchRect' part
+    // of the frame (e.g. with the pointer drawn in); for NV12 and I420 its corners
+    // must lie on even coordinates so it covers whole chroma samples.
+    //----------------------------------------------------------------------------------
+    bool WriteFrame(const uint8_t* pBgra, ptrdiff_t stride, int64_t timestamp,
+                    const uint8_t* pPatch = nullptr, ptrdiff_t patchStride = 0, const FrameRect& patchRect = FrameRect())
+    {
+        const size_t headerBytes = (m_container == RawContainer::Y4M) ? 6 : FrameHeaderSize;
+        uint8_t* pOut = m_writer.Reserve(headerBytes + m_frameBytes);
+        if (!pOut)
+        {
+            return false;
+        }
+
+        if (m_container == RawContainer::Y4M)
+        {
+            memcpy(pOut, "FRAME\n", 6);
+        }
+        else
+        {
+            const uint32_t payload = static_cast<uint32_t>(m_frameBytes);
+            const uint32_t reserved = 0;
+            memcpy(pOut, &timestamp, 8);
+            memcpy(pOut + 8, &payload, 4);
+            memcpy(pOut + 12, &reserved, 4);
+        }
+
+        uint8_t* pPixels = pOut + headerBytes;
+        Convert(pBgra, stride, pPixels, FrameRect{ 0, 0, static_cast<int32_t>(m_width), static_cast<int32_t>(m_height) });
+        if (pPatch && patchRect.right > patchRect.left && patchRect.bottom > patchRect.top)
+        {
+            Convert(pPatch, patchStride, pPixels, patchRect);
+        }
+
+        m_writer.Commit(headerBytes + m_frameBytes);
+        return true;
+    }
+
+    // Flushes everything to disk. Returns false if any write failed.
+    bool Close()
+    {
+        return m_writer.Close();
+    }
+
+    FileWriter::Stats GetIoStats() const
+    {
+        return m_writer.GetStats();
+    }
+
+private:
+    // Converts a BGRA image of 'rect' into that part of the frame at pPixels.
+    void Convert(const uint8_t* pBgra, ptrdiff_t stride, uint8_t* pPixels, const FrameRect& rect) const
+    {
+        const uint32_t width = static_cast<uint32_t>(rect.right - rect.left);
+        const uint32_t height = static_cast<uint32_t>(rect.bottom - rect.top);
+        const size_t left = static_cast<size_t>(rect.left);
+        const size_t top = static_cast<size_t>(rect.top);
+        const size_t lumaStride = m_width;
+        const size_t chromaWidth = (m_width + 1) / 2;
+        const size_t lumaBytes = static_cast<size_t>(m_width) * m_height;
+        const size_t chromaPlane = chromaWidth * ((m_height + 1) / 2);
+        uint8_t* pLuma = pPixels + top * lumaStride + left;
+        switch (m_format)
+        {
+        case RawPixelFormat::BGRA:
+            PixelKernels::CopyRows(pPixels + (top * m_width + left) * 4, static_cast<ptrdiff_t>(m_width) * 4, pBgra, stride,
+                                   width, height);
+            break;
+        case RawPixelFormat::NV12:
+            PixelKernels::BgraToNV12(pBgra, stride, pLuma, static_cast<ptrdiff_t>(lumaStride),
+                                     pPixels + lumaBytes + top / 2 * chromaWidth * 2 + left / 2 * 2,
+                                     static_cast<ptrdiff_t>(chromaWidth * 2), width, height);
+            break;
+        case RawPixelFormat::I420:
+        {
+            const size_t chromaOffset = top / 2 * chromaWidth + left / 2;
+            PixelKernels::BgraToI420(pBgra, stride, pLuma, static_cast<ptrdiff_t>(lumaStride),
+                                     pPixels + lumaBytes + chromaOffset, static_cast<ptrdiff_t>(chromaWidth),
+                                     pPixels + lumaBytes + chromaPlane + chromaOffset,
+                                     static_cast<ptrdiff_t>(chromaWidth), width, height);
+            break;
+        }
+        }
+    }
+
+    static uint32_t FourCC(RawPixelFormat format)
+    {
+        const char* pCode = (format == RawPixelFormat::BGRA) ? "BGRA" :
+                            (format == RawPixelFormat::NV12) ? "NV12" : "I420";
+        uint32_t value = 0;
+        memcpy(&value, pCode, 4);
+        return value;
+    }
+
+    FileWriter m_writer;
+    RawContainer m_container = RawContainer::Raw;
+    RawPixelFormat m_format = RawPixelFormat::BGRA;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    size_t m_frameBytes = 0;
+};
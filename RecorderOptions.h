@@ -0,0 +1,833 @@
+#pragma once
+//======================================================================================
+// RecorderOptions.h
+// Settings for a recording session and a small parser for the command line that
+// WinMain receives. Everything has a default, so running without arguments keeps
+// the original behaviour: 5 seconds at 30 FPS into output.mp4.
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Log.h"
+#include "ReplaySource.h"
+#include "MetricsExporter.h"
+#include "RawFrameSink.h"
+#include "StreamOutput.h"
+#include "SyntheticSource.h"
+
+// Where frames come from: the primary monitor, a generated desktop (see
+// SyntheticSource.h) or a recorded capture trace (see ReplaySource.h).
+enum class CaptureSourceType
+{
+    Desktop,
+    Synthetic,
+    Replay,
+};
+
+// Where captured frames go. Mp4 encodes through the Media Foundation Sink Writer;
+// Ts and Mkv drive the encoder directly and mux MPEG-TS or Matroska themselves (see
+// TsMuxer.h, MkvMuxer.h); Y4M and Raw write uncompressed frames (see
+// RawFrameSink.h). None writes no file, for when the only output is a live stream
+// (--stream).
+enum class OutputSink
+{
+    Mp4,
+    Ts,
+    Mkv,
+    Y4M,
+    Raw,
+    None,
+};
+
+// True for sinks that go through an H.264 encoder (and therefore have keyframes).
+// None only exists to feed a stream, which is always encoded.
+inline bool IsEncodedSink(OutputSink sink)
+{
+    return sink == OutputSink::Mp4 || sink == OutputSink::Ts || sink == OutputSink::Mkv || sink == OutputSink::None;
+}
+
+struct RecorderOptions
+{
+    std::string outputPath = "output.mp4";
+    OutputSink sink = OutputSink::Mp4;
+    uint32_t fps = 30;
+    uint32_t bitRate = 8000000; // 8 Mbps
+    uint32_t durationSeconds = 5;
+    // Whether --duration was on the command line; a --daemon recording without it
+    // runs until stopped instead of for the default.
+    bool durationGiven = false;
+
+    // --- Capture source ---
+    CaptureSourceType sourceType = CaptureSourceType::Desktop;
+    SyntheticSource::Options synthetic;
+    std::string replayPath;
+    ReplaySource::Options replay;
+    // Record what the source delivers into a capture trace for later replay.
+    std::string captureTracePath;
+    // How long a lost desktop is waited for (RecoveringSource.h), holding its last
+    // image, before the recording fails. 0 waits for the rest of the recording.
+    uint32_t recoveryTimeoutSeconds = 0;
+    // Draw the mouse pointer into the recorded frames (CursorCompositor.h).
+    bool drawCursor = true;
+    // Record the pointer into <output>.cursor (CursorTrack.h) instead of drawing it.
+    bool cursorTrack = false;
+    // Monitors to record (--outputs), numbered as in DesktopOutputs.h; with a
+    // synthetic source, independent synthetic desktops. Empty records the first
+    // attached monitor. Each one gets its own recorder thread and file (see
+    // OptionsForOutput), all following one FrameClock.
+    std::vector<uint32_t> outputIndices;
+    bool allOutputs = false;
+    // Record the selected outputs into one picture laid out as on the desktop
+    // (CanvasSource.h) instead of a file each.
+    bool canvas = false;
+    // Without --outputs, start with the monitor recorded last time (OutputCache.h).
+    // An empty path means the default location under %LOCALAPPDATA%.
+    bool useOutputCache = true;
+    std::string outputCachePath;
+    // Keep a recording set up and waiting, and start it on command (StartGate.h).
+    // Each recording goes to its own numbered file (PathForRecording) and lasts
+    // until stopped or for --duration seconds, if that is given.
+    bool daemon = false;
+    // Take the commands on this local socket (ControlServer.h) instead of stdin.
+    // Implies daemon.
+    std::string controlPath;
+    // No console window and no message boxes; the exit code tells how it went.
+    bool headless = false;
+    // Seconds of encoded stream kept for "save-replay" (ReplayBuffer.h); 0 keeps
+    // none. Needs our own encoder, like --quality-sample.
+    uint32_t replaySeconds = 0;
+
+    // --- Keyframe control ---
+    // Frames between scheduled keyframes. 0 means "two seconds worth of frames".
+    uint32_t gopLength = 0;
+    // Fraction of the frame area (0..1) that must change between two frames to force
+    // an IDR frame. 0 disables scene-change detection and the frame diff it requires.
+    double sceneChangeThreshold = 0.5;
+    // Write "<output>.kfidx" listing every keyframe position for fast seeking.
+    bool writeKeyframeIndex = true;
+
+    // --- Uncompressed output ---
+    RawPixelFormat rawPixelFormat = RawPixelFormat::I420;
+
+    // --- File I/O (all sinks) ---
+    // Write-behind, preallocation, direct I/O and fsync policy; see FileWriter.h.
+    FileWriter::Options io;
+
+    // --- Live stream (see StreamOutput.h) ---
+    // "stdout", "pipe:<name>" or "unix:<path>"; empty disables streaming.
+    std::string streamTarget;
+    StreamFormat streamFormat = StreamFormat::Ts;
+    SlowReaderPolicy streamPolicy = SlowReaderPolicy::Drop;
+    uint32_t streamQueueBytes = 8 * 1024 * 1024;
+
+    // --- Diagnostics ---
+    // Seconds of capture between printed per-stage latency summaries; 0 prints
+    // only the final one.
+    uint32_t statsIntervalSeconds = 5;
+    // Chrome trace JSON written at the end of the recording; empty disables tracing.
+    std::string tracePath;
+    // Messages below this level are discarded (LOG_MIN_LEVEL removes them at
+    // compile time instead). The log file gets the same lines as the console.
+    Log::Level logLevel = Log::Level::Info;
+    std::string logFilePath;
+    // Write "<output>.health.json" with the recording's frame and queue counters.
+    bool writeHealthReport = true;
+    // Prometheus export of the health counters and stage latencies while recording.
+    MetricsExporter::Options metrics;
+    // Decode the output and measure PSNR/SSIM on every Nth frame (QualityMonitor.h);
+    // 0 disables it. Needs our own encoder (--sink ts/mkv or --stream).
+    uint32_t qualitySampleInterval = 0;
+
+    uint32_t EffectiveGopLength() const
+    {
+        return gopLength ? gopLength : fps * 2;
+    }
+
+    // True when --outputs selects more than one monitor.
+    bool SelectsSeveralOutputs() const
+    {
+        return allOutputs || outputIndices.size() > 1;
+    }
+
+    // True when more than one recording runs at once.
+    bool RecordsSeveralOutputs() const
+    {
+        return SelectsSeveralOutputs() && !canvas;
+    }
+
+    // True when frames go through our own H.264 encoder: our muxers and live streams.
+    bool UsesDirectEncoder() const
+    {
+        return sink == OutputSink::Ts || sink == OutputSink::Mkv || !streamTarget.empty();
+    }
+
+    // Frame slots one recording lasts. A --daemon recording without a --duration (or
+    // with --duration 0) lasts until it is stopped.
+    uint32_t FramesToRecord() const
+    {
+        if (daemon && (!durationGiven || durationSeconds == 0))
+        {
+            return UINT32_MAX;
+        }
+        const uint64_t frames = static_cast<uint64_t>(fps) * durationSeconds;
+        return frames < UINT32_MAX ? static_cast<uint32_t>(frames) : UINT32_MAX;
+    }
+};
+
+//--------------------------------------------------------------------------------------
+// [InsertBeforeExtension]
+// "rec.mp4" with "-x" becomes "rec-x.mp4"; a path without an extension gets it at
+// the end.
+//--------------------------------------------------------------------------------------
+inline std::string InsertBeforeExtension(const std::string& path, const std::string& suffix)
+{
+    const size_t slash = path.find_last_of("/\\");
+    const size_t dot = path.find_last_of('.');
+    const size_t split = (dot == std::string::npos || (slash != std::string::npos && dot < slash)) ? path.size() : dot;
+    return path.substr(0, split) + suffix + path.substr(split);
+}
+
+//--------------------------------------------------------------------------------------
+// [PathForOutput]
+// "rec.mp4" becomes "rec-display2.mp4" for output 2.
+//--------------------------------------------------------------------------------------
+inline std::string PathForOutput(const std::string& path, uint32_t index)
+{
+    return InsertBeforeExtension(path, "-display" + std::to_string(index));
+}
+
+//--------------------------------------------------------------------------------------
+// [PathForRecording]
+// "rec.mp4" becomes "rec-0003.mp4" for the third recording of a --daemon run.
+//--------------------------------------------------------------------------------------
+inline std::string PathForRecording(const std::string& path, uint32_t number)
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "-%04u", number);
+    return InsertBeforeExtension(path, suffix);
+}
+
+//--------------------------------------------------------------------------------------
+// [PathForReplay]
+// "rec-0003.mkv" becomes "rec-0003-replay2.ts" for the second replay saved from it;
+// replays are always MPEG-TS (ReplayBuffer.h).
+//--------------------------------------------------------------------------------------
+inline std::string PathForReplay(const std::string& path, uint32_t number)
+{
+    const std::string marker = "-replay" + std::to_string(number);
+    const std::string marked = InsertBeforeExtension(path, marker);
+    return marked.substr(0, marked.rfind(marker) + marker.size()) + ".ts";
+}
+
+//--------------------------------------------------------------------------------------
+// [OptionsForOutput]
+// The settings for one of several concurrent recordings: its own files, and for a
+// synthetic desktop its own seed. Process-wide outputs (the metrics endpoint and
+// the Chrome trace, which already covers every thread) stay with the first one.
+//--------------------------------------------------------------------------------------
+inline RecorderOptions OptionsForOutput(const RecorderOptions& options, uint32_t index, bool first)
+{
+    RecorderOptions output = options;
+    output.outputPath = PathForOutput(options.outputPath, index);
+    if (!options.captureTracePath.empty())
+    {
+        output.captureTracePath = PathForOutput(options.captureTracePath, index);
+    }
+    output.synthetic.seed = options.synthetic.seed + index;
+    output.outputIndices.assign(1, index);
+    output.allOutputs = false;
+    if (!first)
+    {
+        output.metrics = MetricsExporter::Options();
+        output.tracePath.clear();
+    }
+    return output;
+}
+
+//--------------------------------------------------------------------------------------
+// [SplitCommandLine]
+// Splits a raw command line into arguments. Double quotes group words containing
+// spaces, which is all we need for file paths.
+//--------------------------------------------------------------------------------------
+inline std::vector<std::string> SplitCommandLine(const char* cmdLine)
+{
+    std::vector<std::string> args;
+    if (!cmdLine)
+    {
+        return args;
+    }
+
+    std::string current;
+    bool inQuotes = false;
+    bool hasToken = false;
+    for (const char* p = cmdLine; *p; ++p)
+    {
+        const char c = *p;
+        if (c == '"')
+        {
+            inQuotes = !inQuotes;
+            hasToken = true;
+        }
+        else if ((c == ' ' || c == '\t') && !inQuotes)
+        {
+            if (hasToken)
+            {
+                args.push_back(current);
+                current.clear();
+                hasToken = false;
+            }
+        }
+        else
+        {
+            current += c;
+            hasToken = true;
+        }
+    }
+    if (hasToken)
+    {
+        args.push_back(current);
+    }
+    return args;
+}
+
+//--------------------------------------------------------------------------------------
+// [ParseDigits]
+// Reads the decimal number 'pText' starts with and points 'pEnd' past its digits.
+// Only digits count: strtoul() would take "-1" as ULONG_MAX. Returns false if there
+// are none (pEnd == pText) or the number doesn't fit in 32 bits.
+//--------------------------------------------------------------------------------------
+inline bool ParseDigits(const char* pText, const char*& pEnd, uint32_t& value)
+{
+    uint64_t number = 0;
+    bool fits = true;
+    for (pEnd = pText; *pEnd >= '0' && *pEnd <= '9'; ++pEnd)
+    {
+        number = number * 10 + static_cast<uint32_t>(*pEnd - '0');
+        if (number > UINT32_MAX)
+        {
+            fits = false;
+            number = UINT32_MAX;
+        }
+    }
+    value = static_cast<uint32_t>(number);
+    return pEnd != pText && fits;
+}
+
+//--------------------------------------------------------------------------------------
+// [ParseRecorderOptions]
+// Fills 'options' from the command line. Returns false and sets 'error' on the first
+// unknown switch or missing/invalid value.
+//--------------------------------------------------------------------------------------
+inline bool ParseRecorderOptions(const std::vector<std::string>& args, RecorderOptions& options, std::string& error)
+{
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        const std::string& arg = args[i];
+
+        // Fetches the value following a switch, e.g. the "60" in "--gop 60".
+        auto nextValue = [&](const char** ppValue) -> bool
+        {
+            if (i + 1 >= args.size())
+            {
+                error = "Missing value for " + arg;
+                return false;
+            }
+            *ppValue = args[++i].c_str();
+            return true;
+        };
+        auto parseUInt = [&](uint32_t& out) -> bool
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            const char* pEnd = nullptr;
+            uint32_t value = 0;
+            if (!ParseDigits(pValue, pEnd, value) || *pEnd != '\0')
+            {
+                const bool digitsOnly = pEnd != pValue && *pEnd == '\0';
+                error = (digitsOnly ? "Number out of range for " : "Invalid number for ") + arg + ": " + pValue;
+                return false;
+            }
+            out = value;
+            return true;
+        };
+        auto parseDouble = [&](double& out) -> bool
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            char* pEnd = nullptr;
+            const double value = strtod(pValue, &pEnd);
+            if (pEnd == pValue || *pEnd != '\0')
+            {
+                error = "Invalid number for " + arg + ": " + pValue;
+                return false;
+            }
+            out = value;
+            return true;
+        };
+
+        if (arg == "--output" || arg == "-o")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            options.outputPath = pValue;
+        }
+        else if (arg == "--fps")
+        {
+            if (!parseUInt(options.fps)) return false;
+            // The 100 ns frame duration and the GOP and timestamp arithmetic assume a
+            // display's rates, not millions of frames a second.
+            if (options.fps == 0 || options.fps > 240)
+            {
+                error = "--fps must be from 1 to 240";
+                return false;
+            }
+        }
+        else if (arg == "--bitrate")
+        {
+            if (!parseUInt(options.bitRate)) return false;
+        }
+        else if (arg == "--duration")
+        {
+            if (!parseUInt(options.durationSeconds)) return false;
+            options.durationGiven = true;
+        }
+        else if (arg == "--source")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            const std::string value = pValue;
+            if (value == "desktop")
+            {
+                options.sourceType = CaptureSourceType::Desktop;
+            }
+            else if (value.compare(0, 10, "synthetic:") == 0 &&
+                     SyntheticSource::ParseScenario(value.substr(10), options.synthetic.scenario))
+            {
+                options.sourceType = CaptureSourceType::Synthetic;
+            }
+            else if (value.compare(0, 7, "replay:") == 0 && value.size() > 7)
+            {
+                options.sourceType = CaptureSourceType::Replay;
+                options.replayPath = value.substr(7);
+            }
+            else
+            {
+                error = "Unknown source: " + value +
+                        " (expected desktop, synthetic:static|scroll|video|drag or replay:<trace>)";
+                return false;
+            }
+        }
+        else if (arg == "--source-size")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            const char* pEnd = nullptr;
+            uint32_t width = 0;
+            uint32_t height = 0;
+            if (!ParseDigits(pValue, pEnd, width) || *pEnd != 'x' || !ParseDigits(pEnd + 1, pEnd, height) ||
+                *pEnd != '\0' || width < 64 || height < 64 || width > 16384 || height > 16384)
+            {
+                error = std::string("Invalid --source-size: ") + pValue + " (expected WxH, 64 to 16384 each)";
+                return false;
+            }
+            options.synthetic.width = width;
+            options.synthetic.height = height;
+        }
+        else if (arg == "--source-virtual-time")
+        {
+            options.synthetic.realTime = false;
+        }
+        else if (arg == "--recovery-timeout")
+        {
+            if (!parseUInt(options.recoveryTimeoutSeconds)) return false;
+            // RecoveringSource counts it in 32-bit milliseconds.
+            if (options.recoveryTimeoutSeconds > UINT32_MAX / 1000)
+            {
+                error = "--recovery-timeout can be at most " + std::to_string(UINT32_MAX / 1000) + " seconds (49 days)";
+                return false;
+            }
+        }
+        else if (arg == "--no-cursor")
+        {
+            options.drawCursor = false;
+        }
+        else if (arg == "--cursor-track")
+        {
+            options.cursorTrack = true;
+            options.drawCursor = false;
+        }
+        else if (arg == "--outputs")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            options.outputIndices.clear();
+            options.allOutputs = std::string(pValue) == "all";
+            for (const char* p = pValue; !options.allOutputs && *p; )
+            {
+                const char* pEnd = nullptr;
+                uint32_t index = 0;
+                if (!ParseDigits(p, pEnd, index) || index > 63 || (*pEnd != ',' && *pEnd != '\0'))
+                {
+                    error = std::string("Invalid --outputs: ") + pValue + " (expected all or a list like 0,2)";
+                    return false;
+                }
+                for (uint32_t existing : options.outputIndices)
+                {
+                    if (existing == index)
+                    {
+                        error = std::string("--outputs lists output ") + std::to_string(index) + " twice";
+                        return false;
+                    }
+                }
+                options.outputIndices.push_back(index);
+                p = (*pEnd == ',') ? pEnd + 1 : pEnd;
+            }
+        }
+        else if (arg == "--canvas")
+        {
+            options.canvas = true;
+        }
+        else if (arg == "--output-cache")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            options.useOutputCache = std::string(pValue) != "off";
+            options.outputCachePath = options.useOutputCache ? pValue : "";
+        }
+        else if (arg == "--daemon")
+        {
+            options.daemon = true;
+        }
+        else if (arg == "--control")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            options.controlPath = pValue;
+            options.daemon = true;
+        }
+        else if (arg == "--headless")
+        {
+            options.headless = true;
+        }
+        else if (arg == "--replay-seconds")
+        {
+            if (!parseUInt(options.replaySeconds)) return false;
+            if (options.replaySeconds > 600)
+            {
+                error = "--replay-seconds can be at most 600";
+                return false;
+            }
+        }
+        else if (arg == "--frame-markers")
+        {
+            options.synthetic.frameMarkers = true;
+        }
+        else if (arg == "--replay-speed")
+        {
+            if (!parseDouble(options.replay.speed)) return false;
+            if (options.replay.speed < 0.0)
+            {
+                error = "--replay-speed must not be negative";
+                return false;
+            }
+        }
+        else if (arg == "--replay-start")
+        {
+            if (!parseDouble(options.replay.startSeconds)) return false;
+            if (options.replay.startSeconds < 0.0)
+            {
+                error = "--replay-start must not be negative";
+                return false;
+            }
+        }
+        else if (arg == "--replay-loop")
+        {
+            options.replay.loop = true;
+        }
+        else if (arg == "--capture-trace")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            options.captureTracePath = pValue;
+        }
+        else if (arg == "--gop")
+        {
+            if (!parseUInt(options.gopLength)) return false;
+        }
+        else if (arg == "--scene-threshold")
+        {
+            if (!parseDouble(options.sceneChangeThreshold)) return false;
+            if (options.sceneChangeThreshold < 0.0 || options.sceneChangeThreshold > 1.0)
+            {
+                error = "--scene-threshold must be between 0 and 1";
+                return false;
+            }
+        }
+        else if (arg == "--no-keyframe-index")
+        {
+            options.writeKeyframeIndex = false;
+        }
+        else if (arg == "--sink")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            const std::string value = pValue;
+            if (value == "mp4") options.sink = OutputSink::Mp4;
+            else if (value == "ts") options.sink = OutputSink::Ts;
+            else if (value == "mkv") options.sink = OutputSink::Mkv;
+            else if (value == "y4m") options.sink = OutputSink::Y4M;
+            else if (value == "raw") options.sink = OutputSink::Raw;
+            else if (value == "none") options.sink = OutputSink::None;
+            else
+            {
+                error = "Unknown sink: " + value + " (expected mp4, ts, mkv, y4m, raw or none)";
+                return false;
+            }
+        }
+        else if (arg == "--pixel-format")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            const std::string value = pValue;
+            if (value == "i420") options.rawPixelFormat = RawPixelFormat::I420;
+            else if (value == "nv12") options.rawPixelFormat = RawPixelFormat::NV12;
+            else if (value == "bgra") options.rawPixelFormat = RawPixelFormat::BGRA;
+            else
+            {
+                error = "Unknown pixel format: " + value + " (expected i420, nv12 or bgra)";
+                return false;
+            }
+        }
+        else if (arg == "--no-write-behind")
+        {
+            options.io.writeBehind = false;
+        }
+        else if (arg == "--io-buffers")
+        {
+            uint32_t count = 0;
+            if (!parseUInt(count)) return false;
+            options.io.bufferCount = count;
+        }
+        else if (arg == "--direct-io")
+        {
+            options.io.directIo = true;
+        }
+        else if (arg == "--preallocate")
+        {
+            uint32_t megabytes = 0;
+            if (!parseUInt(megabytes)) return false;
+            options.io.preallocateBytes = static_cast<uint64_t>(megabytes) * 1024 * 1024;
+        }
+        else if (arg == "--fsync")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            const std::string value = pValue;
+            if (value == "none") options.io.syncPolicy = SyncPolicy::None;
+            else if (value == "close") options.io.syncPolicy = SyncPolicy::OnClose;
+            else
+            {
+                // A number means "sync every N megabytes".
+                const char* pEnd = nullptr;
+                uint32_t megabytes = 0;
+                if (!ParseDigits(pValue, pEnd, megabytes) || *pEnd != '\0' || megabytes == 0)
+                {
+                    error = "Invalid --fsync value: " + value + " (expected none, close or a size in MB)";
+                    return false;
+                }
+                options.io.syncPolicy = SyncPolicy::Periodic;
+                options.io.syncIntervalBytes = static_cast<uint64_t>(megabytes) * 1024 * 1024;
+            }
+        }
+        else if (arg == "--stats-interval")
+        {
+            if (!parseUInt(options.statsIntervalSeconds)) return false;
+        }
+        else if (arg == "--trace")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            options.tracePath = pValue;
+        }
+        else if (arg == "--log-level")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            const std::string value = pValue;
+            if (value == "debug") options.logLevel = Log::Level::Debug;
+            else if (value == "info") options.logLevel = Log::Level::Info;
+            else if (value == "warn") options.logLevel = Log::Level::Warn;
+            else if (value == "error") options.logLevel = Log::Level::Error;
+            else
+            {
+                error = "Unknown log level: " + value + " (expected debug, info, warn or error)";
+                return false;
+            }
+        }
+        else if (arg == "--log-file")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            options.logFilePath = pValue;
+        }
+        else if (arg == "--no-health-report")
+        {
+            options.writeHealthReport = false;
+        }
+        else if (arg == "--metrics-port")
+        {
+            uint32_t port = 0;
+            if (!parseUInt(port)) return false;
+            if (port == 0 || port > 65535)
+            {
+                error = "--metrics-port must be between 1 and 65535";
+                return false;
+            }
+            options.metrics.httpPort = static_cast<uint16_t>(port);
+        }
+        else if (arg == "--metrics-file")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            options.metrics.filePath = pValue;
+        }
+        else if (arg == "--metrics-interval")
+        {
+            if (!parseUInt(options.metrics.fileIntervalSeconds)) return false;
+            if (options.metrics.fileIntervalSeconds == 0)
+            {
+                error = "--metrics-interval must be at least 1 second";
+                return false;
+            }
+        }
+        else if (arg == "--quality-sample")
+        {
+            if (!parseUInt(options.qualitySampleInterval)) return false;
+        }
+        else if (arg == "--stream")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            options.streamTarget = pValue;
+            StreamTarget target;
+            if (!target.Configure(options.streamTarget, error)) return false;
+        }
+        else if (arg == "--stream-format")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            const std::string value = pValue;
+            if (value == "ts") options.streamFormat = StreamFormat::Ts;
+            else if (value == "annexb" || value == "h264") options.streamFormat = StreamFormat::AnnexB;
+            else
+            {
+                error = "Unknown stream format: " + value + " (expected ts or annexb)";
+                return false;
+            }
+        }
+        else if (arg == "--stream-policy")
+        {
+            const char* pValue = nullptr;
+            if (!nextValue(&pValue)) return false;
+            const std::string value = pValue;
+            if (value == "block") options.streamPolicy = SlowReaderPolicy::Block;
+            else if (value == "drop") options.streamPolicy = SlowReaderPolicy::Drop;
+            else if (value == "disconnect") options.streamPolicy = SlowReaderPolicy::Disconnect;
+            else
+            {
+                error = "Unknown stream policy: " + value + " (expected block, drop or disconnect)";
+                return false;
+            }
+        }
+        else if (arg == "--stream-queue")
+        {
+            uint32_t megabytes = 0;
+            if (!parseUInt(megabytes)) return false;
+            if (megabytes == 0 || megabytes > 1024)
+            {
+                error = "--stream-queue must be between 1 and 1024 MB";
+                return false;
+            }
+            options.streamQueueBytes = megabytes * 1024 * 1024;
+        }
+        else
+        {
+            error = "Unknown option: " + arg;
+            return false;
+        }
+    }
+
+    if (options.sink == OutputSink::Y4M && options.rawPixelFormat != RawPixelFormat::I420)
+    {
+        error = "The y4m sink only supports --pixel-format i420";
+        return false;
+    }
+    // The stream shares our encoder, which only the ts/mkv sinks (or no file) use.
+    if (!options.streamTarget.empty() && options.sink != OutputSink::Ts && options.sink != OutputSink::Mkv &&
+        options.sink != OutputSink::None)
+    {
+        error = "--stream can only be combined with --sink ts, mkv or none";
+        return false;
+    }
+    if (options.synthetic.frameMarkers && options.sourceType != CaptureSourceType::Synthetic)
+    {
+        error = "--frame-markers needs --source synthetic:<scenario>";
+        return false;
+    }
+    if (options.RecordsSeveralOutputs() && !options.streamTarget.empty())
+    {
+        error = "--stream carries one picture, so it can't be combined with several --outputs";
+        return false;
+    }
+    if (options.sourceType == CaptureSourceType::Replay && (options.SelectsSeveralOutputs() || !options.outputIndices.empty()))
+    {
+        error = "--outputs doesn't apply to --source replay:, which has one trace";
+        return false;
+    }
+    if (options.sourceType == CaptureSourceType::Synthetic && options.allOutputs)
+    {
+        error = "--outputs all needs monitors; list synthetic desktops by number instead, e.g. --outputs 0,1,2";
+        return false;
+    }
+    if (options.canvas && (!options.SelectsSeveralOutputs() || options.sourceType == CaptureSourceType::Replay))
+    {
+        error = "--canvas needs several --outputs of the desktop or a synthetic source";
+        return false;
+    }
+    // One warm recording is kept, and only one desktop duplication per monitor can exist.
+    if (options.daemon && options.RecordsSeveralOutputs())
+    {
+        error = "--daemon keeps one recording ready; record several --outputs into one with --canvas";
+        return false;
+    }
+    // Without --control the daemon answers its commands on stdout.
+    if (options.daemon && options.controlPath.empty() && options.streamTarget == "stdout")
+    {
+        error = "--stream stdout needs the daemon's commands on a --control socket";
+        return false;
+    }
+    if (options.cursorTrack && options.sink == OutputSink::None)
+    {
+        error = "--cursor-track writes next to the output file, so it can't be combined with --sink none";
+        return false;
+    }
+    if (options.qualitySampleInterval && !options.UsesDirectEncoder())
+    {
+        error = "--quality-sample needs --sink ts, mkv or a --stream (the mp4 sink keeps its encoder output to itself)";
+        return false;
+    }
+    if (options.replaySeconds && !options.UsesDirectEncoder())
+    {
+        error = "--replay-seconds needs --sink ts, mkv or a --stream (the mp4 sink keeps its encoder output to itself)";
+        return false;
+    }
+    if (options.streamTarget.empty() && options.sink == OutputSink::None)
+    {
+        error = "--sink none needs a --stream target";
+        return false;
+    }
+    return true;
+}
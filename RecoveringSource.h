@@ -0,0 +1,450 @@
+#pragma once
+//======================================================================================
+// RecoveringSource.h
+// Keeps a recording going when its capture source goes away. Desktop duplication
+// is lost whenever the display mode changes, a UAC prompt or the lock screen takes
+// over the desktop, or a fullscreen application switches modes; without this the
+// recording would end there.
+//
+// RecoveringSource wraps the real source and makes new ones from a factory:
+//
+//   Live  - frames come from the current source. The image is mirrored into a
+//           held copy one dirty rect at a time, so there is something to show if
+//           the source is lost.
+//   Lost  - the source failed. Every output frame period the held image is
+//           delivered again (as a frame without an image update), so the video
+//           keeps its pace and timestamps through the gap. A new source is tried
+//           right away, then with a backoff doubling up to maxRetryMs.
+//   Failed - lost for longer than giveUpMs; AcquireFrame reports Error.
+//
+// The output keeps the size of the first source. If a new source comes back at
+// another resolution, its frames are scaled to fit, centered with black bars,
+// and reported as fully changed; the pointer position is scaled the same way
+// (its shape is not). Time comes from Options::now and Options::sleepUntil, so
+// the whole state machine can be driven in virtual time.
+//======================================================================================
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "PixelKernels.h"
+
+enum class RecoveryEvent
+{
+    Lost,      // The source failed; held frames from now on.
+    Held,      // A held frame was delivered.
+    Recovered, // A new source was made; see SourceWidth()/SourceHeight() for its mode.
+    GaveUp,    // Lost for longer than Options::giveUpMs.
+};
+
+class RecoveringSource : public CaptureSource
+{
+public:
+    // Makes a new source, or returns null with a reason if it can't right now.
+    typedef std::function<std::unique_ptr<CaptureSource>(std::string& error)> Factory;
+    typedef std::function<void(RecoveryEvent)> Listener;
+
+    struct Options
+    {
+        uint32_t fps = 30;           // Held frames are delivered at this rate.
+        uint32_t firstRetryMs = 50;  // Wait before the second attempt at a new source...
+        uint32_t maxRetryMs = 1000;  // ...doubling up to this.
+        uint32_t giveUpMs = 0;       // Fail after being lost this long; 0 keeps trying.
+        std::function<uint64_t()> now;              // Steady clock in ns.
+        std::function<void(uint64_t)> sleepUntil;   // Until a now() value.
+    };
+
+    enum class State
+    {
+        Live,
+        Lost,
+        Failed,
+    };
+
+    //----------------------------------------------------------------------------------
+    // [RecoveringSource::Open]
+    // Makes the first source, which fixes the output size. The listener (optional) is
+    // called on the thread calling AcquireFrame.
+    //----------------------------------------------------------------------------------
+    bool Open(Factory factory, const Options& options, Listener listener, std::string& error)
+    {
+        m_options = options;
+        m_options.fps = m_options.fps ? m_options.fps : 30;
+        if (!m_options.now)
+        {
+            m_options.now = []() {
+                return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+            };
+        }
+        if (!m_options.sleepUntil)
+        {
+            m_options.sleepUntil = [](uint64_t ns) {
+                std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(ns)));
+            };
+        }
+        m_pSource = factory(error);
+        if (!m_pSource)
+        {
+            return false;
+        }
+        m_factory = std::move(factory);
+        m_listener = std::move(listener);
+        m_width = m_pSource->Width();
+        m_height = m_pSource->Height();
+        m_held.assign(static_cast<size_t>(m_width) * m_height * 4, 0);
+        ClearHeld();
+        m_state = State::Live;
+        m_fresh = true;
+        m_lastDeliveredNs = m_options.now();
+        Retarget();
+        return true;
+    }
+
+    uint32_t Width() const override { return m_width; }
+    uint32_t Height() const override { return m_height; }
+
+    State GetState() const { return m_state; }
+
+    // The current source's mode, 0x0 while lost.
+    uint32_t SourceWidth() const { return m_pSource ? m_pSource->Width() : 0; }
+    uint32_t SourceHeight() const { return m_pSource ? m_pSource->Height() : 0; }
+
+    // Why the last attempt at a new source failed.
+    const std::string& LastError() const { return m_lastError; }
+
+    //----------------------------------------------------------------------------------
+    // [RecoveringSource::AcquireFrame]
+    //----------------------------------------------------------------------------------
+    CaptureResult AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info) override
+    {
+        const uint64_t deadlineNs = m_options.now() + static_cast<uint64_t>(timeoutMs) * 1000000;
+        for (;;)
+        {
+            if (m_state == State::Failed)
+            {
+                return CaptureResult::Error;
+            }
+            const uint64_t nowNs = m_options.now();
+            if (m_state == State::Live)
+            {
+                const uint64_t remainingMs = nowNs >= deadlineNs ? 0 : (deadlineNs - nowNs + 999999) / 1000000;
+                const CaptureResult result = m_pSource->AcquireFrame(static_cast<uint32_t>(remainingMs), m_sourceInfo);
+                if (result == CaptureResult::Ok)
+                {
+                    DeliverLive(info);
+                    return result;
+                }
+                if (result != CaptureResult::AccessLost && result != CaptureResult::Error)
+                {
+                    return result;
+                }
+                Lose(m_options.now());
+                continue;
+            }
+
+            // Lost: try for a new source when the backoff allows, otherwise hold.
+            if (nowNs >= m_nextRetryNs && Recreate(nowNs))
+            {
+                continue;
+            }
+            if (m_options.giveUpMs && nowNs - m_lostNs >= static_cast<uint64_t>(m_options.giveUpMs) * 1000000)
+            {
+                m_state = State::Failed;
+                Notify(RecoveryEvent::GaveUp);
+                return CaptureResult::Error;
+            }
+            const uint64_t heldNs = m_lastDeliveredNs + FramePeriodNs();
+            if (nowNs >= heldNs)
+            {
+                DeliverHeld(info, nowNs);
+                return CaptureResult::Ok;
+            }
+            if (nowNs >= deadlineNs)
+            {
+                return CaptureResult::Timeout;
+            }
+            uint64_t wakeNs = heldNs < m_nextRetryNs ? heldNs : m_nextRetryNs;
+            wakeNs = wakeNs < deadlineNs ? wakeNs : deadlineNs;
+            m_options.sleepUntil(wakeNs);
+        }
+    }
+
+    bool MapFrame(MappedFrame& mapped) override
+    {
+        if (m_acquired == Acquired::Source)
+        {
+            MappedFrame source;
+            if (!m_pSource->MapFrame(source))
+            {
+                return false;
+            }
+            UpdateHeld(source);
+            if (!m_scaled)
+            {
+                mapped = source;
+                return true;
+            }
+        }
+        else if (m_acquired != Acquired::Held)
+        {
+            return false;
+        }
+        mapped.pPixels = m_held.data();
+        mapped.stride = static_cast<size_t>(m_width) * 4;
+        mapped.width = m_width;
+        mapped.height = m_height;
+        return true;
+    }
+
+    void ReleaseFrame() override
+    {
+        if (m_acquired == Acquired::Source)
+        {
+            // A frame nobody mapped still has to reach the held copy.
+            MappedFrame source;
+            if (m_heldPending && m_pSource->MapFrame(source))
+            {
+                UpdateHeld(source);
+            }
+            m_pSource->ReleaseFrame();
+        }
+        m_acquired = Acquired::None;
+    }
+
+    bool Prepare() override
+    {
+        return !m_pSource || m_pSource->Prepare();
+    }
+
+private:
+    enum class Acquired
+    {
+        None,
+        Source,
+        Held,
+    };
+
+    uint64_t FramePeriodNs() const { return 1000000000ull / m_options.fps; }
+
+    void Notify(RecoveryEvent event)
+    {
+        if (m_listener)
+        {
+            m_listener(event);
+        }
+    }
+
+    void ClearHeld()
+    {
+        memset(m_held.data(), 0, m_held.size());
+        for (size_t i = 3; i < m_held.size(); i += 4)
+        {
+            m_held[i] = 0xFF; // Opaque black.
+        }
+    }
+
+    // Where a source of the current size lands in the output.
+    void Retarget()
+    {
+        const uint64_t sourceWidth = m_pSource->Width();
+        const uint64_t sourceHeight = m_pSource->Height();
+        m_scaled = sourceWidth != m_width || sourceHeight != m_height;
+        FrameRect fit = { 0, 0, static_cast<int32_t>(m_width), static_cast<int32_t>(m_height) };
+        if (m_scaled && sourceWidth && sourceHeight)
+        {
+            if (sourceWidth * m_height >= sourceHeight * m_width)
+            {
+                const int32_t height = static_cast<int32_t>(sourceHeight * m_width / sourceWidth);
+                fit.top = (static_cast<int32_t>(m_height) - height) / 2;
+                fit.bottom = fit.top + height;
+            }
+            else
+            {
+                const int32_t width = static_cast<int32_t>(sourceWidth * m_height / sourceHeight);
+                fit.left = (static_cast<int32_t>(m_width) - width) / 2;
+                fit.right = fit.left + width;
+            }
+        }
+        if (fit.left != m_fit.left || fit.top != m_fit.top || fit.right != m_fit.right || fit.bottom != m_fit.bottom)
+        {
+            ClearHeld();
+        }
+        m_fit = fit;
+    }
+
+    void Lose(uint64_t nowNs)
+    {
+        m_pSource.reset(); // Duplication only allows one instance per output.
+        m_state = State::Lost;
+        m_lostNs = nowNs;
+        m_nextRetryNs = nowNs;
+        m_retryDelayMs = 0;
+        Notify(RecoveryEvent::Lost);
+    }
+
+    bool Recreate(uint64_t nowNs)
+    {
+        m_lastError.clear();
+        m_pSource = m_factory(m_lastError);
+        if (!m_pSource)
+        {
+            m_retryDelayMs = m_retryDelayMs ? m_retryDelayMs * 2 : m_options.firstRetryMs;
+            m_retryDelayMs = m_retryDelayMs < m_options.maxRetryMs ? m_retryDelayMs : m_options.maxRetryMs;
+            m_nextRetryNs = nowNs + static_cast<uint64_t>(m_retryDelayMs) * 1000000;
+            return false;
+        }
+        m_state = State::Live;
+        m_fresh = true;
+        Retarget();
+        Notify(RecoveryEvent::Recovered);
+        return true;
+    }
+
+    // Passes the source's frame on, in output coordinates.
+    void DeliverLive(CaptureFrameInfo& info)
+    {
+        info = m_sourceInfo;
+        if (m_fresh)
+        {
+            // A new source starts from a whole image, whatever it reports.
+            info.imageUpdated = true;
+            info.pDirtyRects = nullptr;
+            info.dirtyRectCount = 0;
+            info.pMoveRects = nullptr;
+            info.moveRectCount = 0;
+        }
+        m_heldPending = info.imageUpdated;
+        if (m_scaled || m_fresh)
+        {
+            m_whole = FrameRect{ 0, 0, static_cast<int32_t>(m_width), static_cast<int32_t>(m_height) };
+            info.pDirtyRects = info.imageUpdated ? &m_whole : nullptr;
+            info.dirtyRectCount = info.imageUpdated ? 1 : 0;
+            info.pMoveRects = nullptr;
+            info.moveRectCount = 0;
+        }
+        if (m_scaled)
+        {
+            const int64_t sourceWidth = m_pSource->Width();
+            const int64_t sourceHeight = m_pSource->Height();
+            info.pointerX = m_fit.left + static_cast<int32_t>(info.pointerX * (m_fit.right - m_fit.left) / sourceWidth);
+            info.pointerY = m_fit.top + static_cast<int32_t>(info.pointerY * (m_fit.bottom - m_fit.top) / sourceHeight);
+        }
+        m_pointerVisible = info.pointerVisible;
+        m_pointerX = info.pointerX;
+        m_pointerY = info.pointerY;
+        // Frames with only a pointer update carry no time.
+        m_lastTimestamp = info.timestamp > m_lastTimestamp ? info.timestamp : m_lastTimestamp;
+        m_lastDeliveredNs = m_options.now();
+        m_acquired = Acquired::Source;
+    }
+
+    // The last image again, one frame period after the previous frame.
+    void DeliverHeld(CaptureFrameInfo& info, uint64_t nowNs)
+    {
+        const uint64_t periodNs = FramePeriodNs();
+        m_lastDeliveredNs += periodNs;
+        if (nowNs - m_lastDeliveredNs >= periodNs)
+        {
+            m_lastDeliveredNs = nowNs; // Called late; don't deliver a burst to catch up.
+        }
+        m_lastTimestamp += static_cast<int64_t>(10000000ull / m_options.fps);
+        info = CaptureFrameInfo();
+        info.timestamp = m_lastTimestamp;
+        info.pointerVisible = m_pointerVisible;
+        info.pointerX = m_pointerX;
+        info.pointerY = m_pointerY;
+        m_acquired = Acquired::Held;
+        Notify(RecoveryEvent::Held);
+    }
+
+    // Mirrors what changed in the acquired frame into the held copy.
+    void UpdateHeld(const MappedFrame& source)
+    {
+        if (!m_heldPending)
+        {
+            return;
+        }
+        m_heldPending = false;
+        const size_t heldStride = static_cast<size_t>(m_width) * 4;
+        if (m_scaled)
+        {
+            uint8_t* pTarget = m_held.data() + static_cast<size_t>(m_fit.top) * heldStride + static_cast<size_t>(m_fit.left) * 4;
+            PixelKernels::ScaleBgraBilinear(pTarget, heldStride, static_cast<uint32_t>(m_fit.right - m_fit.left),
+                                            static_cast<uint32_t>(m_fit.bottom - m_fit.top), source.pPixels, source.stride,
+                                            source.width, source.height);
+        }
+        else if (m_fresh || !m_sourceInfo.pDirtyRects)
+        {
+            PixelKernels::CopyRows(m_held.data(), static_cast<ptrdiff_t>(heldStride), source.pPixels,
+                                   static_cast<ptrdiff_t>(source.stride), m_width, m_height);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < m_sourceInfo.dirtyRectCount; ++i)
+            {
+                CopyRect(source, m_sourceInfo.pDirtyRects[i]);
+            }
+            for (uint32_t i = 0; i < m_sourceInfo.moveRectCount; ++i)
+            {
+                CopyRect(source, m_sourceInfo.pMoveRects[i].destination);
+            }
+        }
+        m_fresh = false;
+    }
+
+    void CopyRect(const MappedFrame& source, FrameRect rect)
+    {
+        rect.left = rect.left < 0 ? 0 : rect.left;
+        rect.top = rect.top < 0 ? 0 : rect.top;
+        rect.right = rect.right > static_cast<int32_t>(m_width) ? static_cast<int32_t>(m_width) : rect.right;
+        rect.bottom = rect.bottom > static_cast<int32_t>(m_height) ? static_cast<int32_t>(m_height) : rect.bottom;
+        if (rect.right <= rect.left || rect.bottom <= rect.top)
+        {
+            return;
+        }
+        const size_t heldStride = static_cast<size_t>(m_width) * 4;
+        const size_t offset = static_cast<size_t>(rect.left) * 4;
+        PixelKernels::CopyRows(m_held.data() + static_cast<size_t>(rect.top) * heldStride + offset,
+                               static_cast<ptrdiff_t>(heldStride),
+                               source.pPixels + static_cast<size_t>(rect.top) * source.stride + offset,
+                               static_cast<ptrdiff_t>(source.stride), static_cast<uint32_t>(rect.right - rect.left),
+                               static_cast<uint32_t>(rect.bottom - rect.top));
+    }
+
+    Options m_options;
+    Factory m_factory;
+    Listener m_listener;
+    std::unique_ptr<CaptureSource> m_pSource;
+    State m_state = State::Live;
+    Acquired m_acquired = Acquired::None;
+    std::string m_lastError;
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    bool m_scaled = false;
+    FrameRect m_fit = {};
+    FrameRect m_whole = {};
+
+    // The last image delivered, at the output size.
+    std::vector<uint8_t> m_held;
+    bool m_fresh = true;        // The next source frame replaces the whole held image.
+    bool m_heldPending = false; // The acquired frame hasn't been mirrored yet.
+    CaptureFrameInfo m_sourceInfo;
+
+    uint64_t m_lastDeliveredNs = 0;
+    int64_t m_lastTimestamp = 0;
+    bool m_pointerVisible = false;
+    int32_t m_pointerX = 0;
+    int32_t m_pointerY = 0;
+
+    uint64_t m_lostNs = 0;
+    uint64_t m_nextRetryNs = 0;
+    uint32_t m_retryDelayMs = 0;
+};
@@ -0,0 +1,218 @@
+#pragma once
+//======================================================================================
+// ReplayBuffer.h
+// The last few seconds of the encoded stream, kept in memory so they can be saved
+// on request ("save-replay", see ControlProtocol.h) while the recording goes on.
+//
+// It sits behind the encoder like the muxers (--replay-seconds). Whole GOPs are
+// dropped from the front once the next keyframe is itself older than the window,
+// so a saved replay always starts at a keyframe and covers at least the window
+// (once that much has been recorded), plus at most one GOP.
+//
+// WriteFrame() runs on the capture thread and Save() anywhere else. Access units
+// are held by reference, so Save() only holds the lock to copy the list of them
+// and muxes the file after letting go; the capture thread never waits for a save.
+// Dropped access units are reused for new ones unless a save still holds them, so
+// once the window is full, keeping it allocates nothing.
+//======================================================================================
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "EncodedSink.h"
+#include "FileWriter.h"
+#include "TsMuxer.h"
+
+class ReplayBuffer : public EncodedSink
+{
+public:
+    // What Save() wrote.
+    struct Saved
+    {
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        double seconds = 0.0;
+    };
+
+    ReplayBuffer() = default;
+    ReplayBuffer(const ReplayBuffer&) = delete;
+    ReplayBuffer& operator=(const ReplayBuffer&) = delete;
+
+    // Keeps 'seconds' of frames, or fewer if they take more than 'maxBytes'.
+    void Start(uint32_t seconds, uint64_t maxBytes = 512ull * 1024 * 1024)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_window = static_cast<int64_t>(seconds) * 10 * 1000 * 1000;
+        m_maxBytes = maxBytes;
+        m_frames.clear();
+        m_keyframes.clear();
+        m_bytes = 0;
+        m_started = seconds > 0;
+    }
+
+    bool IsStarted() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_started;
+    }
+
+    // Annex-B SPS/PPS for keyframes that don't carry their own (see TsMuxer).
+    void SetSequenceHeader(const uint8_t* pData, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sequenceHeader.assign(pData, pData + size);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [ReplayBuffer::WriteFrame]
+    // Copies the access unit in and drops what has fallen out of the window.
+    //----------------------------------------------------------------------------------
+    bool WriteFrame(const EncodedFrame& frame) override
+    {
+        std::shared_ptr<Frame> pFrame;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_started || (m_frames.empty() && !frame.keyframe))
+            {
+                return true; // Nothing to keep before the first keyframe.
+            }
+            if (!m_spare.empty())
+            {
+                pFrame = std::move(m_spare.back());
+                m_spare.pop_back();
+            }
+        }
+        if (!pFrame)
+        {
+            pFrame = std::make_shared<Frame>();
+        }
+        pFrame->data.assign(frame.pData, frame.pData + frame.size);
+        pFrame->pts = frame.pts;
+        pFrame->dts = frame.dts;
+        pFrame->duration = frame.duration;
+        pFrame->keyframe = frame.keyframe;
+        pFrame->frameId = frame.frameId;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (frame.keyframe)
+        {
+            m_keyframes.push_back(frame.dts);
+        }
+        m_bytes += frame.size;
+        m_frames.push_back(std::move(pFrame));
+        while (m_keyframes.size() >= 2 &&
+               (frame.dts - m_keyframes[1] >= m_window || m_bytes > m_maxBytes))
+        {
+            DropGop();
+        }
+        return true;
+    }
+
+    bool Finish() override { return true; }
+
+    //----------------------------------------------------------------------------------
+    // [ReplayBuffer::Save]
+    // Writes what is buffered to 'path' as MPEG-TS, with timestamps starting at
+    // zero. Safe to call from any thread while frames come in.
+    //----------------------------------------------------------------------------------
+    bool Save(const std::string& path, Saved& saved, std::string& error) const
+    {
+        std::vector<std::shared_ptr<Frame>> frames;
+        std::vector<uint8_t> sequenceHeader;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            frames.assign(m_frames.begin(), m_frames.end());
+            sequenceHeader = m_sequenceHeader;
+        }
+        if (frames.empty())
+        {
+            error = "Nothing has been recorded yet";
+            return false;
+        }
+
+        FileWriter::Options io;
+        io.bufferSize = 1024 * 1024;
+        FileWriter file;
+        if (!file.Open(path, io))
+        {
+            error = "Could not create " + path;
+            return false;
+        }
+        FileByteSink output(file);
+        TsMuxer muxer;
+        muxer.Open(&output);
+        if (!sequenceHeader.empty())
+        {
+            muxer.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+        }
+
+        const int64_t start = frames.front()->dts;
+        bool written = true;
+        for (const std::shared_ptr<Frame>& pFrame : frames)
+        {
+            EncodedFrame frame;
+            frame.pData = pFrame->data.data();
+            frame.size = pFrame->data.size();
+            frame.pts = pFrame->pts - start;
+            frame.dts = pFrame->dts - start;
+            frame.duration = pFrame->duration;
+            frame.keyframe = pFrame->keyframe;
+            frame.frameId = pFrame->frameId;
+            written = muxer.WriteFrame(frame) && written;
+        }
+        written = muxer.Finish() && written;
+        saved.bytes = file.Tell();
+        if (!file.Close() || !written)
+        {
+            error = "Could not write " + path;
+            return false;
+        }
+        saved.frames = frames.size();
+        saved.seconds = (frames.back()->dts + frames.back()->duration - start) / 1e7;
+        return true;
+    }
+
+private:
+    struct Frame
+    {
+        std::vector<uint8_t> data;
+        int64_t pts = 0;
+        int64_t dts = 0;
+        int64_t duration = 0;
+        bool keyframe = false;
+        uint64_t frameId = 0;
+    };
+
+    // Enough spares to refill a GOP without allocating.
+    static const size_t MaxSpares = 512;
+
+    // Drops the oldest GOP, keeping its frames for reuse. Called with the lock held.
+    void DropGop()
+    {
+        m_keyframes.pop_front();
+        while (!m_frames.empty() && !(m_frames.front()->keyframe && m_frames.front()->dts == m_keyframes.front()))
+        {
+            std::shared_ptr<Frame>& pFrame = m_frames.front();
+            m_bytes -= pFrame->data.size();
+            if (pFrame.use_count() == 1 && m_spare.size() < MaxSpares)
+            {
+                m_spare.push_back(std::move(pFrame));
+            }
+            m_frames.pop_front();
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    std::deque<std::shared_ptr<Frame>> m_frames;
+    std::deque<int64_t> m_keyframes; // dts of each keyframe in m_frames.
+    std::vector<std::shared_ptr<Frame>> m_spare;
+    std::vector<uint8_t> m_sequenceHeader;
+    int64_t m_window = 0;
+    uint64_t m_maxBytes = 0;
+    uint64_t m_bytes = 0;
+    bool m_started = false;
+};
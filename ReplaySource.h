@@ -0,0 +1,166 @@
+#pragma once
+//======================================================================================
+// ReplaySource.h
+// Plays a capture trace (CaptureTrace.h) back as a capture source: the recorded
+// pixels, rects, pointer positions and accumulated-frame counts, delivered on the
+// recorded schedule. The pipeline behind it sees the same workload as the original
+// session, on any machine.
+//
+// speed scales the schedule: 1 is the original timing, 4 is four times faster, and
+// 0 hands out every frame as soon as it is asked for. Gaps in the recording (an
+// idle desktop) turn into acquire timeouts, as they did live. Timestamps are the
+// recorded ones; when looping they keep increasing across passes.
+//======================================================================================
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "CaptureSource.h"
+#include "CaptureTrace.h"
+
+class ReplaySource : public CaptureSource
+{
+public:
+    struct Options
+    {
+        double speed = 1.0;
+        bool loop = false;
+        double startSeconds = 0.0; // Skip this far into the trace.
+    };
+
+    bool Open(const std::string& path, const Options& options, std::string& error)
+    {
+        if (!m_reader.Open(path, error))
+        {
+            return false;
+        }
+        m_options = options;
+        m_options.speed = options.speed > 0.0 ? options.speed : 0.0;
+
+        // Start at the first frame at or after startSeconds.
+        const int64_t startTimestamp = m_reader.Timestamp(0) + static_cast<int64_t>(options.startSeconds * 1e7);
+        size_t first = 0;
+        while (first + 1 < m_reader.FrameCount() && m_reader.Timestamp(first) < startTimestamp)
+        {
+            ++first;
+        }
+        if (!m_reader.Seek(first))
+        {
+            error = path + " is corrupt before the start position";
+            return false;
+        }
+        m_firstFrame = first;
+
+        // A pass lasts from the first to the last frame plus one typical interval.
+        const size_t count = m_reader.FrameCount() - first;
+        const int64_t span = m_reader.Timestamp(m_reader.FrameCount() - 1) - m_reader.Timestamp(first);
+        m_passDuration = span + (count > 1 ? span / static_cast<int64_t>(count - 1) : 10000000 / 60);
+        return true;
+    }
+
+    uint32_t Width() const override { return m_reader.Width(); }
+    uint32_t Height() const override { return m_reader.Height(); }
+
+    // True if the trace had no index (the recording was cut off) and was rebuilt.
+    bool Recovered() const { return m_reader.Recovered(); }
+    uint64_t FramesReplayed() const { return m_framesReplayed; }
+
+    //----------------------------------------------------------------------------------
+    // [ReplaySource::AcquireFrame]
+    //----------------------------------------------------------------------------------
+    CaptureResult AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info) override
+    {
+        if (m_reader.NextFrame() >= m_reader.FrameCount())
+        {
+            if (!m_options.loop)
+            {
+                return CaptureResult::Ended;
+            }
+            if (!m_reader.Seek(m_firstFrame))
+            {
+                return CaptureResult::Error;
+            }
+            ++m_pass;
+        }
+
+        // Frames are due relative to the first one handed out, scaled by speed.
+        const size_t next = m_reader.NextFrame();
+        const int64_t timestamp = m_reader.Timestamp(next) + m_pass * m_passDuration;
+        const auto now = std::chrono::steady_clock::now();
+        if (!m_started)
+        {
+            m_started = true;
+            m_startTime = now;
+            m_startTimestamp = timestamp;
+        }
+        if (m_options.speed > 0.0)
+        {
+            const auto due = m_startTime + std::chrono::nanoseconds(static_cast<int64_t>(
+                static_cast<double>(timestamp - m_startTimestamp) * 100.0 / m_options.speed));
+            if (due > now)
+            {
+                const auto deadline = now + std::chrono::milliseconds(timeoutMs);
+                std::this_thread::sleep_until(due < deadline ? due : deadline);
+                if (due > deadline)
+                {
+                    return CaptureResult::Timeout;
+                }
+            }
+        }
+
+        CaptureTraceReader::Frame frame;
+        if (!m_reader.Decode(frame))
+        {
+            return CaptureResult::Error;
+        }
+        info = frame.info;
+        info.timestamp = timestamp;
+        if (next == m_firstFrame)
+        {
+            // The first frame of a pass starts from an image the consumer has not
+            // seen (a seek, or a jump cut when looping): all of it is new.
+            m_fullFrame = FrameRect{ 0, 0, static_cast<int32_t>(Width()), static_cast<int32_t>(Height()) };
+            info.pDirtyRects = &m_fullFrame;
+            info.dirtyRectCount = 1;
+            info.pMoveRects = nullptr;
+            info.moveRectCount = 0;
+        }
+        m_pImage = frame.pImage;
+        ++m_framesReplayed;
+        return CaptureResult::Ok;
+    }
+
+    bool MapFrame(MappedFrame& mapped) override
+    {
+        if (!m_pImage)
+        {
+            return false;
+        }
+        mapped.pPixels = reinterpret_cast<const uint8_t*>(m_pImage);
+        mapped.stride = static_cast<size_t>(Width()) * 4;
+        mapped.width = Width();
+        mapped.height = Height();
+        return true;
+    }
+
+    void ReleaseFrame() override
+    {
+        m_pImage = nullptr;
+    }
+
+private:
+    CaptureTraceReader m_reader;
+    Options m_options;
+    size_t m_firstFrame = 0;
+    int64_t m_passDuration = 0;
+    int64_t m_pass = 0;
+
+    bool m_started = false;
+    std::chrono::steady_clock::time_point m_startTime;
+    int64_t m_startTimestamp = 0;
+
+    const uint32_t* m_pImage = nullptr;
+    FrameRect m_fullFrame = {};
+    uint64_t m_framesReplayed = 0;
+};
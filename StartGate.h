@@ -0,0 +1,92 @@
+#pragma once
+//======================================================================================
+// StartGate.h
+// Holds a fully set-up recording at the line until it is told to go (--daemon).
+// Everything that makes starting slow - the device and duplication, the readback
+// texture, the encoder session, the output file and its write buffers - is done
+// beforehand, so the first frame is captured as soon as the start command arrives
+// instead of a few hundred milliseconds later.
+//
+// The capture thread calls WaitForStart() once it is set up and polls
+// StopRequested() once per frame, which costs one relaxed load. Start() and Stop()
+// may be called from any thread, in any order: a start that arrives before the
+// recording is ready lets it through the moment it is, and a stop before the start
+// cancels it. Start() notes the time so the recorder can report how long the
+// first frame took (time_to_first_frame_us).
+//======================================================================================
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "TickClock.h"
+
+class StartGate
+{
+public:
+    StartGate() = default;
+    StartGate(const StartGate&) = delete;
+    StartGate& operator=(const StartGate&) = delete;
+
+    //----------------------------------------------------------------------------------
+    // [StartGate::WaitForStart]
+    // Marks the recording ready and blocks until it is started (true) or cancelled
+    // (false).
+    //----------------------------------------------------------------------------------
+    bool WaitForStart()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready = true;
+        m_changed.notify_all();
+        m_changed.wait(lock, [this]() { return m_startNs != 0 || m_stop.load(std::memory_order_relaxed); });
+        return m_startNs != 0;
+    }
+
+    // Waits until the recording has called WaitForStart(), up to timeoutMs.
+    bool WaitUntilReady(uint32_t timeoutMs)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return m_ready; });
+    }
+
+    bool IsReady() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_ready;
+    }
+
+    // Ignored once stopped, or if already started.
+    void Start()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_startNs == 0 && !m_stop.load(std::memory_order_relaxed))
+        {
+            m_startNs = TickClock::NowNs();
+            m_changed.notify_all();
+        }
+    }
+
+    void Stop()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop.store(true, std::memory_order_relaxed);
+        m_changed.notify_all();
+    }
+
+    bool StopRequested() const { return m_stop.load(std::memory_order_relaxed); }
+
+    // TickClock::NowNs() at Start(); 0 until then.
+    uint64_t StartNs() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_startNs;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_changed;
+    bool m_ready = false;
+    uint64_t m_startNs = 0;
+    std::atomic<bool> m_stop{ false };
+};
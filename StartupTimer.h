@@ -0,0 +1,94 @@
+#pragma once
+//======================================================================================
+// StartupTimer.h
+// Where the time between launching the recorder and its first recorded frame
+// goes. Recordings are often started by an event, and the first second after it
+// is the one that matters, so the breakdown is logged once the first frame is in
+// and written into the health report (Recorder::WriteHealthReport):
+//
+//   "startup_ms": { "setup": 41.2, "find_output": 0.9, "device": 96.3, ...,
+//                   "total": 212.6 }
+//
+// Each Mark() closes a phase that began at the previous one (or at
+// construction). Phases with the same name add up, so trying three monitors
+// reports the time spent on all three devices as one "device" phase. Phase names
+// must be literals; only the pointer is kept.
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "TickClock.h"
+
+class StartupTimer
+{
+public:
+    static const size_t MaxPhases = 12;
+
+    StartupTimer() : m_startNs(TickClock::NowNs()), m_lastNs(m_startNs) {}
+
+    // Ends the current phase. Beyond MaxPhases names, time goes to the last one.
+    void Mark(const char* pPhase)
+    {
+        const uint64_t now = TickClock::NowNs();
+        size_t i = 0;
+        while (i < m_count && strcmp(m_phases[i].pName, pPhase) != 0)
+        {
+            ++i;
+        }
+        if (i == m_count && m_count < MaxPhases)
+        {
+            m_phases[m_count++] = Phase{ pPhase, 0 };
+        }
+        m_phases[i < m_count ? i : m_count - 1].ns += now - m_lastNs;
+        m_lastNs = now;
+    }
+
+    double TotalMs() const { return (m_lastNs - m_startNs) / 1e6; }
+
+    //----------------------------------------------------------------------------------
+    // [StartupTimer::Format]
+    // "setup 41.2, find_output 0.9, ..." (milliseconds) for the log, which keeps
+    // little text per message.
+    //----------------------------------------------------------------------------------
+    void Format(std::string& text) const
+    {
+        char part[64];
+        text.clear();
+        for (size_t i = 0; i < m_count; ++i)
+        {
+            snprintf(part, sizeof(part), "%s%s %.1f", i ? ", " : "", m_phases[i].pName, m_phases[i].ns / 1e6);
+            text += part;
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [StartupTimer::FormatJson]
+    // The "startup_ms" member of the health report (see HealthCounters::FormatJson).
+    //----------------------------------------------------------------------------------
+    void FormatJson(std::string& json) const
+    {
+        char part[64];
+        json = "  \"startup_ms\": {\n";
+        for (size_t i = 0; i < m_count; ++i)
+        {
+            snprintf(part, sizeof(part), "    \"%s\": %.3f,\n", m_phases[i].pName, m_phases[i].ns / 1e6);
+            json += part;
+        }
+        snprintf(part, sizeof(part), "    \"total\": %.3f\n  }", TotalMs());
+        json += part;
+    }
+
+private:
+    struct Phase
+    {
+        const char* pName;
+        uint64_t ns;
+    };
+
+    uint64_t m_startNs;
+    uint64_t m_lastNs;
+    Phase m_phases[MaxPhases] = {};
+    size_t m_count = 0;
+};
@@ -0,0 +1,878 @@
+#pragma once
+//======================================================================================
+// StreamOutput.h
+// Live output of the encoded stream to another local process: our own stdout, a
+// named pipe (FIFO) or a Unix domain socket.
+//
+// The capture thread never touches the pipe. StreamingSink muxes each access unit
+// (raw Annex-B H.264, or MPEG-TS) into a fixed-size ring buffer and a sender thread
+// drains the ring into the target. When the reader can't keep up and the ring
+// fills, the configured policy decides what happens:
+//
+//   Block      - the capture thread waits for the reader. Nothing is lost, but a
+//                stalled reader stalls the recording.
+//   Drop       - the frame is dropped, and so is everything up to the next
+//                keyframe (which we request immediately), so the reader only ever
+//                sees decodable data.
+//   Disconnect - the reader is dropped and the queue discarded; pipes and sockets
+//                wait for a new reader, which starts at a fresh keyframe.
+//
+// Each access unit's time from WriteFrame() to its last byte leaving the ring is
+// measured, so encode-to-pipe latency is visible in GetStats().
+//======================================================================================
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EncodedSink.h"
+#include "H264Bitstream.h"
+#include "Trace.h"
+#include "TsMuxer.h"
+#include "Utf8Path.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//======================================================================================
+// StreamTarget
+// One reader at a time on stdout, a named pipe or a Unix domain socket.
+// Spec strings: "stdout", "pipe:<name>", "unix:<path>". On Windows a pipe name
+// becomes \\.\pipe\<name>; on Linux it is the path of a FIFO we create.
+//======================================================================================
+class StreamTarget
+{
+public:
+    enum class Kind
+    {
+        Stdout,
+        Pipe,
+        UnixSocket,
+    };
+
+    StreamTarget() = default;
+    ~StreamTarget() { Close(); }
+    StreamTarget(const StreamTarget&) = delete;
+    StreamTarget& operator=(const StreamTarget&) = delete;
+
+#ifdef _WIN32
+    // Our stdout is redirected to the debug console at start-up, so WinMain hands us
+    // the handle the process was started with.
+    static HANDLE& InheritedStdout()
+    {
+        static HANDLE handle = INVALID_HANDLE_VALUE;
+        return handle;
+    }
+#endif
+
+    bool Configure(const std::string& spec, std::string& error)
+    {
+        if (spec == "stdout" || spec == "-")
+        {
+            m_kind = Kind::Stdout;
+        }
+        else if (spec.compare(0, 5, "pipe:") == 0 && spec.size() > 5)
+        {
+            m_kind = Kind::Pipe;
+            m_name = spec.substr(5);
+        }
+        else if (spec.compare(0, 5, "unix:") == 0 && spec.size() > 5)
+        {
+            m_kind = Kind::UnixSocket;
+            m_name = spec.substr(5);
+        }
+        else
+        {
+            error = "Unknown stream target: " + spec + " (expected stdout, pipe:<name> or unix:<path>)";
+            return false;
+        }
+        return true;
+    }
+
+    Kind GetKind() const { return m_kind; }
+    const std::string& Name() const { return m_name; }
+
+    // True if a lost reader can be replaced by a new one.
+    bool CanReconnect() const { return m_kind != Kind::Stdout; }
+
+    //----------------------------------------------------------------------------------
+    // [StreamTarget::Connect]
+    // Waits for a reader. Returns false if Cancel() was called or the target could
+    // not be set up. Runs on the sender thread.
+    //----------------------------------------------------------------------------------
+    bool Connect()
+    {
+        while (!m_cancelled.load(std::memory_order_acquire))
+        {
+            switch (m_kind)
+            {
+            case Kind::Stdout:
+                return OpenStdout();
+            case Kind::Pipe:
+                if (TryConnectPipe()) return true;
+                break;
+            case Kind::UnixSocket:
+                if (TryAcceptSocket()) return true;
+                break;
+            }
+            if (m_setupFailed)
+            {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // Writes everything or returns false once the reader has gone away.
+    bool Send(const uint8_t* pData, size_t size)
+    {
+        while (size > 0)
+        {
+            if (m_cancelled.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+#ifdef _WIN32
+            DWORD written = 0;
+            if (m_kind == Kind::UnixSocket)
+            {
+                const int chunk = size > 0x10000000 ? 0x10000000 : (int)size;
+                const int sent = send(m_socket, (const char*)pData, chunk, 0);
+                if (sent <= 0) return false;
+                written = (DWORD)sent;
+            }
+            else if (m_kind == Kind::Pipe)
+            {
+                if (!OverlappedWrite(pData, size > 0x10000000 ? 0x10000000 : (DWORD)size, &written)) return false;
+            }
+            else if (!WriteFile(m_handle, pData, size > 0x10000000 ? 0x10000000 : (DWORD)size, &written, nullptr) || written == 0)
+            {
+                return false;
+            }
+#else
+            ssize_t written;
+            if (m_kind == Kind::UnixSocket)
+            {
+                written = send(m_fd, pData, size, MSG_NOSIGNAL);
+            }
+            else
+            {
+                written = write(m_fd, pData, size);
+            }
+            if (written < 0)
+            {
+                if (errno == EINTR) continue;
+                if (errno == EPIPE) ConsumeSigpipe();
+                return false;
+            }
+#endif
+            pData += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    // Drops the current reader (pipes and sockets can then Connect() again).
+    void Disconnect()
+    {
+#ifdef _WIN32
+        if (m_kind == Kind::Pipe && m_handle != INVALID_HANDLE_VALUE)
+        {
+            DisconnectNamedPipe(m_handle);
+        }
+        if (m_socket != INVALID_SOCKET)
+        {
+            closesocket(m_socket);
+            m_socket = INVALID_SOCKET;
+        }
+#else
+        if (m_kind != Kind::Stdout && m_fd >= 0)
+        {
+            close(m_fd);
+        }
+        m_fd = -1;
+#endif
+    }
+
+    // Unblocks Connect()/Send() from another thread, for shutdown.
+    void Cancel()
+    {
+        m_cancelled.store(true, std::memory_order_release);
+    }
+
+    void Close()
+    {
+        Disconnect();
+#ifdef _WIN32
+        if (m_kind == Kind::Pipe && m_handle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_handle);
+        }
+        m_handle = INVALID_HANDLE_VALUE;
+        if (m_event)
+        {
+            CloseHandle(m_event);
+            m_event = nullptr;
+        }
+        if (m_listenSocket != INVALID_SOCKET)
+        {
+            closesocket(m_listenSocket);
+            m_listenSocket = INVALID_SOCKET;
+            DeleteFileW(Utf8ToWide(m_name).c_str());
+            WSACleanup();
+        }
+#else
+        if (m_listenFd >= 0)
+        {
+            close(m_listenFd);
+            m_listenFd = -1;
+            unlink(m_name.c_str());
+        }
+        if (m_createdFifo)
+        {
+            unlink(m_name.c_str());
+            m_createdFifo = false;
+        }
+#endif
+    }
+
+private:
+    // How often blocking waits wake up to check for Cancel().
+    static const int PollIntervalMs = 100;
+
+#ifdef _WIN32
+    bool OpenStdout()
+    {
+        m_handle = InheritedStdout();
+        m_setupFailed = (m_handle == INVALID_HANDLE_VALUE || m_handle == nullptr);
+        return !m_setupFailed;
+    }
+
+    bool TryConnectPipe()
+    {
+        if (m_handle == INVALID_HANDLE_VALUE)
+        {
+            const std::wstring fullName = L"\\\\.\\pipe\\" + Utf8ToWide(m_name);
+            m_handle = CreateNamedPipeW(fullName.c_str(), PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED,
+                                        PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1,
+                                        1024 * 1024, 0, 0, nullptr);
+            m_event = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+            if (m_handle == INVALID_HANDLE_VALUE || !m_event)
+            {
+                m_setupFailed = true;
+                return false;
+            }
+        }
+
+        OVERLAPPED ov = {};
+        ov.hEvent = m_event;
+        ResetEvent(m_event);
+        if (ConnectNamedPipe(m_handle, &ov))
+        {
+            return true;
+        }
+        DWORD error = GetLastError();
+        if (error == ERROR_PIPE_CONNECTED)
+        {
+            return true;
+        }
+        if (error != ERROR_IO_PENDING)
+        {
+            // The previous reader is gone but not yet disconnected; reset and retry.
+            DisconnectNamedPipe(m_handle);
+            return false;
+        }
+        while (!m_cancelled.load(std::memory_order_acquire))
+        {
+            if (WaitForSingleObject(m_event, PollIntervalMs) == WAIT_OBJECT_0)
+            {
+                DWORD unused = 0;
+                return GetOverlappedResult(m_handle, &ov, &unused, FALSE) != FALSE;
+            }
+        }
+        CancelIoEx(m_handle, &ov);
+        DWORD unused = 0;
+        GetOverlappedResult(m_handle, &ov, &unused, TRUE);
+        return false;
+    }
+
+    bool OverlappedWrite(const uint8_t* pData, DWORD size, DWORD* pWritten)
+    {
+        OVERLAPPED ov = {};
+        ov.hEvent = m_event;
+        ResetEvent(m_event);
+        if (!WriteFile(m_handle, pData, size, nullptr, &ov) && GetLastError() != ERROR_IO_PENDING)
+        {
+            return false;
+        }
+        while (WaitForSingleObject(m_event, PollIntervalMs) != WAIT_OBJECT_0)
+        {
+            if (m_cancelled.load(std::memory_order_acquire))
+            {
+                CancelIoEx(m_handle, &ov);
+                GetOverlappedResult(m_handle, &ov, pWritten, TRUE);
+                return false;
+            }
+        }
+        return GetOverlappedResult(m_handle, &ov, pWritten, FALSE) && *pWritten > 0;
+    }
+
+    bool TryAcceptSocket()
+    {
+        if (m_listenSocket == INVALID_SOCKET)
+        {
+            WSADATA wsaData;
+            if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+            {
+                m_setupFailed = true;
+                return false;
+            }
+            m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            strncpy_s(address.sun_path, m_name.c_str(), sizeof(address.sun_path) - 1);
+            DeleteFileW(Utf8ToWide(m_name).c_str());
+            if (m_listenSocket == INVALID_SOCKET ||
+                bind(m_listenSocket, (sockaddr*)&address, sizeof(address)) != 0 ||
+                listen(m_listenSocket, 1) != 0)
+            {
+                m_setupFailed = true;
+                return false;
+            }
+        }
+
+        WSAPOLLFD pfd = {};
+        pfd.fd = m_listenSocket;
+        pfd.events = POLLRDNORM;
+        if (WSAPoll(&pfd, 1, PollIntervalMs) <= 0)
+        {
+            return false;
+        }
+        m_socket = accept(m_listenSocket, nullptr, nullptr);
+        return m_socket != INVALID_SOCKET;
+    }
+
+    HANDLE m_handle = INVALID_HANDLE_VALUE;
+    HANDLE m_event = nullptr;
+    SOCKET m_listenSocket = INVALID_SOCKET;
+    SOCKET m_socket = INVALID_SOCKET;
+#else
+    bool OpenStdout()
+    {
+        m_fd = STDOUT_FILENO;
+        return true;
+    }
+
+    bool TryConnectPipe()
+    {
+        if (!m_createdFifo)
+        {
+            if (mkfifo(m_name.c_str(), 0600) != 0 && errno != EEXIST)
+            {
+                m_setupFailed = true;
+                return false;
+            }
+            m_createdFifo = true;
+        }
+
+        // A non-blocking open for writing fails with ENXIO until a reader opens the
+        // FIFO, which lets us keep checking for Cancel().
+        m_fd = open(m_name.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (m_fd < 0)
+        {
+            usleep(PollIntervalMs * 1000);
+            return false;
+        }
+        fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_NONBLOCK);
+        return true;
+    }
+
+    bool TryAcceptSocket()
+    {
+        if (m_listenFd < 0)
+        {
+            m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            strncpy(address.sun_path, m_name.c_str(), sizeof(address.sun_path) - 1);
+            unlink(m_name.c_str());
+            if (m_listenFd < 0 ||
+                bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+                listen(m_listenFd, 1) != 0)
+            {
+                m_setupFailed = true;
+                return false;
+            }
+        }
+
+        pollfd pfd = { m_listenFd, POLLIN, 0 };
+        if (poll(&pfd, 1, PollIntervalMs) <= 0)
+        {
+            return false;
+        }
+        m_fd = accept(m_listenFd, nullptr, nullptr);
+        return m_fd >= 0;
+    }
+
+    // Writing to a pipe without a reader raises SIGPIPE. The sender thread blocks
+    // the signal, so it stays pending; clear it so it can't fire later.
+    static void ConsumeSigpipe()
+    {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        timespec zero = { 0, 0 };
+        while (sigtimedwait(&set, nullptr, &zero) > 0)
+        {
+        }
+    }
+
+    int m_fd = -1;
+    int m_listenFd = -1;
+    bool m_createdFifo = false;
+#endif
+
+    Kind m_kind = Kind::Stdout;
+    std::string m_name;
+    std::atomic<bool> m_cancelled{ false };
+    bool m_setupFailed = false;
+};
+
+//======================================================================================
+// StreamingSink
+//======================================================================================
+enum class StreamFormat
+{
+    AnnexB,
+    Ts,
+};
+
+enum class SlowReaderPolicy
+{
+    Block,
+    Drop,
+    Disconnect,
+};
+
+class StreamingSink : public EncodedSink
+{
+public:
+    struct Stats
+    {
+        uint64_t framesSent = 0;
+        uint64_t framesDropped = 0;
+        uint64_t bytesSent = 0;
+        uint64_t disconnects = 0;
+        // WriteFrame() to last byte written to the target.
+        uint64_t latencyNsTotal = 0;
+        uint64_t latencyNsMax = 0;
+        uint64_t queueBytesMax = 0;
+    };
+
+    StreamingSink() = default;
+    ~StreamingSink() { Stop(); }
+    StreamingSink(const StreamingSink&) = delete;
+    StreamingSink& operator=(const StreamingSink&) = delete;
+
+    //----------------------------------------------------------------------------------
+    // [StreamingSink::Start]
+    // Allocates the queue and starts the sender thread. requestKeyframe is called
+    // (from either thread) whenever a new reader needs a fresh starting point.
+    //----------------------------------------------------------------------------------
+    bool Start(const std::string& targetSpec, StreamFormat format, SlowReaderPolicy policy,
+               size_t queueBytes, std::function<void()> requestKeyframe, std::string& error)
+    {
+        if (!m_target.Configure(targetSpec, error))
+        {
+            return false;
+        }
+        m_format = format;
+        m_policy = policy;
+        m_requestKeyframe = requestKeyframe;
+        m_ring.assign(queueBytes < MinQueueBytes ? MinQueueBytes : queueBytes, 0);
+        m_head = 0;
+        m_tail = 0;
+        m_markerHead = 0;
+        m_markerTail = 0;
+        m_pendingHead = 0;
+        m_connected = false;
+        m_waitingForKeyframe = true;
+        m_stopping = false;
+        m_stats = Stats();
+
+        m_ringOutput.m_pOwner = this;
+        m_tsMuxer.Open(&m_ringOutput);
+
+        m_thread = std::thread(&StreamingSink::SenderThread, this);
+        return true;
+    }
+
+    // Inserted in front of keyframes that don't carry SPS/PPS themselves.
+    void SetSequenceHeader(const uint8_t* pData, size_t size)
+    {
+        if (size <= sizeof(m_sequenceHeader))
+        {
+            memcpy(m_sequenceHeader, pData, size);
+            m_sequenceHeaderSize = size;
+        }
+        m_tsMuxer.SetSequenceHeader(pData, size);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [StreamingSink::WriteFrame]
+    // Queues one access unit, applying the slow-reader policy. Never fails the
+    // recording: a lost reader only costs the stream, not the capture.
+    //----------------------------------------------------------------------------------
+    bool WriteFrame(const EncodedFrame& frame) override
+    {
+        const uint64_t enqueueNs = NowNs();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_connected || m_stopping)
+        {
+            m_waitingForKeyframe = true;
+            return true;
+        }
+        if (m_waitingForKeyframe)
+        {
+            if (!frame.keyframe)
+            {
+                ++m_stats.framesDropped;
+                return true;
+            }
+            // The reader missed what came before, so there is no PCR gap to fill.
+            m_waitingForKeyframe = false;
+            m_tsMuxer.RestartPcr();
+        }
+        // Muxing overhead: TS adds 4 bytes per 184 plus tables and PCR-only packets
+        // below 10 fps; Annex-B at most the sequence header. Reserve generously so a
+        // frame never straddles a policy decision.
+        const size_t pcrPackets = m_format == StreamFormat::Ts ? m_tsMuxer.PcrPacketsBefore(frame) : 0;
+        const size_t needed = frame.size + frame.size / 32 + sizeof(m_sequenceHeader) +
+                              (4 + pcrPackets) * TsMuxer::PacketSize;
+        if (needed > m_ring.size())
+        {
+            // Can never fit; treat like a stalled reader.
+            ++m_stats.framesDropped;
+            m_waitingForKeyframe = true;
+            return true;
+        }
+
+        while (m_ring.size() - (m_head - m_tail) < needed)
+        {
+            if (m_policy == SlowReaderPolicy::Block)
+            {
+                m_cv.wait(lock, [&] { return m_ring.size() - (m_head - m_tail) >= needed || !m_connected || m_stopping; });
+                if (!m_connected || m_stopping)
+                {
+                    m_waitingForKeyframe = true;
+                    return true;
+                }
+                continue;
+            }
+            if (m_policy == SlowReaderPolicy::Disconnect && m_target.CanReconnect())
+            {
+                m_dropReader = true;
+                m_cv.notify_all();
+            }
+            ++m_stats.framesDropped;
+            m_waitingForKeyframe = true;
+            lock.unlock();
+            if (m_requestKeyframe) m_requestKeyframe();
+            return true;
+        }
+        if (MarkerCount() == MaxMarkers)
+        {
+            ++m_stats.framesDropped;
+            m_waitingForKeyframe = true;
+            return true;
+        }
+        const uint64_t generation = m_readerGeneration;
+        lock.unlock();
+
+        // Only this thread advances m_head, so the space we checked stays ours while
+        // we write without the lock.
+        if (m_format == StreamFormat::Ts)
+        {
+            m_tsMuxer.WriteFrame(frame);
+        }
+        else
+        {
+            if (frame.keyframe && m_sequenceHeaderSize > 0 && !H264::ContainsNal(frame.pData, frame.size, H264::NalSps))
+            {
+                m_ringOutput.Write(m_sequenceHeader, m_sequenceHeaderSize);
+            }
+            m_ringOutput.Write(frame.pData, frame.size);
+        }
+
+        lock.lock();
+        m_head = m_pendingHead;
+        if (generation != m_readerGeneration || !m_connected)
+        {
+            // The reader changed while we were muxing; this frame was meant for the
+            // old one.
+            m_tail = m_head;
+            m_markerTail = m_markerHead;
+            m_waitingForKeyframe = true;
+            return true;
+        }
+        Marker& marker = m_markers[m_markerHead % MaxMarkers];
+        marker.endPosition = m_head;
+        marker.enqueueNs = enqueueNs;
+        marker.frameId = frame.frameId;
+        ++m_markerHead;
+        if (m_head - m_tail > m_stats.queueBytesMax)
+        {
+            m_stats.queueBytesMax = m_head - m_tail;
+        }
+        m_cv.notify_all();
+        return true;
+    }
+
+    bool Finish() override
+    {
+        Stop();
+        return true;
+    }
+
+    // Sends what is queued (unless the reader is gone) and stops the sender thread.
+    void Stop()
+    {
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        // Give a connected reader the chance to drain the queue, but don't wait
+        // forever on one that has stalled.
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait_for(lock, std::chrono::seconds(2), [this] { return m_head == m_tail || !m_connected; });
+        }
+        m_target.Cancel();
+        m_cv.notify_all();
+        m_thread.join();
+        m_target.Close();
+    }
+
+    Stats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+private:
+    static const size_t MinQueueBytes = 1024 * 1024;
+    static const size_t MaxMarkers = 1024;
+
+    // Where a queued access unit ends, for latency measurement.
+    struct Marker
+    {
+        uint64_t endPosition;
+        uint64_t enqueueNs;
+        uint64_t frameId;
+    };
+
+    // ByteSink that appends into the ring at m_pendingHead (producer only).
+    class RingOutput : public ByteSink
+    {
+    public:
+        bool Write(const void* pData, size_t size) override
+        {
+            return m_pOwner->AppendToRing(static_cast<const uint8_t*>(pData), size);
+        }
+        uint64_t Position() const override
+        {
+            return m_pOwner->m_pendingHead;
+        }
+        StreamingSink* m_pOwner = nullptr;
+    };
+
+    static uint64_t NowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    size_t MarkerCount() const { return static_cast<size_t>(m_markerHead - m_markerTail); }
+
+    bool AppendToRing(const uint8_t* pData, size_t size)
+    {
+        // The reservation in WriteFrame() covers this; refuse rather than overwrite
+        // unsent data if an estimate was ever wrong.
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_ring.size() - (m_pendingHead - m_tail) < size)
+            {
+                return false;
+            }
+        }
+        const size_t capacity = m_ring.size();
+        size_t at = static_cast<size_t>(m_pendingHead % capacity);
+        const size_t first = (capacity - at < size) ? capacity - at : size;
+        memcpy(&m_ring[at], pData, first);
+        if (first < size)
+        {
+            memcpy(&m_ring[0], pData + first, size - first);
+        }
+        m_pendingHead += size;
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [StreamingSink::SenderThread]
+    // Connects to a reader, then drains the ring into it until stopped.
+    //----------------------------------------------------------------------------------
+    void SenderThread()
+    {
+        Trace::SetThreadName("stream sender");
+#ifndef _WIN32
+        // Let a vanished reader show up as EPIPE instead of killing the process.
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &set, nullptr);
+#endif
+        for (;;)
+        {
+            if (!m_target.Connect())
+            {
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_connected = true;
+                m_waitingForKeyframe = true;
+                ++m_readerGeneration;
+            }
+            if (m_requestKeyframe) m_requestKeyframe();
+
+            const bool readerLeft = !DrainToReader();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_connected = false;
+                m_dropReader = false;
+                // Whatever is queued belonged to the old reader.
+                m_tail = m_head;
+                m_markerTail = m_markerHead;
+                if (readerLeft)
+                {
+                    ++m_stats.disconnects;
+                }
+            }
+            m_cv.notify_all();
+            m_target.Disconnect();
+
+            if (!readerLeft || !m_target.CanReconnect())
+            {
+                break;
+            }
+        }
+    }
+
+    // Returns true when stopped normally, false when the reader went away.
+    bool DrainToReader()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            m_cv.wait(lock, [this] { return m_head != m_tail || m_stopping || m_dropReader; });
+            if (m_dropReader)
+            {
+                return false;
+            }
+            if (m_head == m_tail)
+            {
+                return true; // Stopping with nothing left to send.
+            }
+
+            const size_t capacity = m_ring.size();
+            const size_t at = static_cast<size_t>(m_tail % capacity);
+            const uint64_t available = m_head - m_tail;
+            const size_t chunk = static_cast<size_t>(capacity - at < available ? capacity - at : available);
+            lock.unlock();
+
+            Trace::Counter("stream queue bytes", static_cast<int64_t>(available));
+            Trace::Begin("pipe send", TickClock::Now(), Trace::NoFrame);
+            const bool sent = m_target.Send(&m_ring[at], chunk);
+            Trace::End("pipe send", TickClock::Now());
+            const uint64_t now = NowNs();
+
+            lock.lock();
+            if (!sent)
+            {
+                return false;
+            }
+            m_tail += chunk;
+            m_stats.bytesSent += chunk;
+            while (m_markerTail != m_markerHead && m_markers[m_markerTail % MaxMarkers].endPosition <= m_tail)
+            {
+                const uint64_t latency = now - m_markers[m_markerTail % MaxMarkers].enqueueNs;
+                Trace::Instant("frame sent", m_markers[m_markerTail % MaxMarkers].frameId);
+                m_stats.latencyNsTotal += latency;
+                if (latency > m_stats.latencyNsMax)
+                {
+                    m_stats.latencyNsMax = latency;
+                }
+                ++m_stats.framesSent;
+                ++m_markerTail;
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    StreamTarget m_target;
+    StreamFormat m_format = StreamFormat::AnnexB;
+    SlowReaderPolicy m_policy = SlowReaderPolicy::Drop;
+    std::function<void()> m_requestKeyframe;
+
+    TsMuxer m_tsMuxer;
+    RingOutput m_ringOutput;
+    uint8_t m_sequenceHeader[256];
+    size_t m_sequenceHeaderSize = 0;
+    bool m_waitingForKeyframe = true; // Producer state, guarded by m_mutex.
+    uint64_t m_pendingHead = 0;       // Producer-only: bytes written, not yet published.
+
+    // Shared, guarded by m_mutex.
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<uint8_t> m_ring;
+    uint64_t m_head = 0; // Published write position (total bytes).
+    uint64_t m_tail = 0; // Send position (total bytes).
+    Marker m_markers[MaxMarkers];
+    uint64_t m_markerHead = 0;
+    uint64_t m_markerTail = 0;
+    bool m_connected = false;
+    uint64_t m_readerGeneration = 0;
+    bool m_dropReader = false;
+    bool m_stopping = false;
+    Stats m_stats;
+    std::thread m_thread;
+};
@@ -0,0 +1,674 @@
+#pragma once
+//======================================================================================
+// SyntheticSource.h
+// A capture source that draws its own desktop, so the whole pipeline can run - and
+// be measured reproducibly - on a machine with no display, including Linux.
+//
+// The desktop is redrawn only where it changes, the way a compositor would, and
+// each frame reports matching dirty and move rects, pointer position and shape (a
+// monochrome arrow) and presentation timestamps. Scenarios:
+//
+//   static - an idle desktop with a text caret blinking every 530 ms; almost
+//            every acquire waits.
+//   scroll - a document window scrolling continuously: one move rect and a thin
+//            dirty band per refresh.
+//   video  - a 16:9 region playing 30 fps content with full-motion noise.
+//   drag   - a window dragged around the screen by the pointer: a move rect for
+//            the window and dirty rects for the desktop it uncovers.
+//
+// In real-time mode updates happen on a virtual vsync at refreshHz of wall-clock
+// time, and a slow consumer sees several merged into one frame (accumulatedFrames
+// > 1), as with desktop duplication. Otherwise time is virtual: every acquire
+// returns the next update immediately, which makes runs deterministic and as fast
+// as the pipeline allows. The same seed always draws the same pixels.
+//
+// With frameMarkers set, every refresh is a frame and carries a FrameMarker with its
+// refresh number and presentation time (the vsync it was drawn for in real-time
+// mode, the time it was acquired otherwise), for measuring end-to-end latency.
+//======================================================================================
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "FrameMarker.h"
+
+class SyntheticSource : public CaptureSource
+{
+public:
+    enum class Scenario
+    {
+        StaticDesktop,
+        ScrollingText,
+        Video,
+        WindowDrag,
+    };
+
+    struct Options
+    {
+        Scenario scenario = Scenario::ScrollingText;
+        uint32_t width = 1920;
+        uint32_t height = 1080;
+        uint32_t refreshHz = 60;
+        bool realTime = true;
+        uint32_t seed = 1;
+        bool frameMarkers = false;
+    };
+
+    static const char* ScenarioName(Scenario scenario)
+    {
+        switch (scenario)
+        {
+        case Scenario::StaticDesktop: return "static";
+        case Scenario::ScrollingText: return "scroll";
+        case Scenario::Video: return "video";
+        case Scenario::WindowDrag: return "drag";
+        default: return "?";
+        }
+    }
+
+    static bool ParseScenario(const std::string& name, Scenario& scenario)
+    {
+        for (Scenario candidate : { Scenario::StaticDesktop, Scenario::ScrollingText, Scenario::Video, Scenario::WindowDrag })
+        {
+            if (name == ScenarioName(candidate))
+            {
+                scenario = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    explicit SyntheticSource(const Options& options) :
+        m_options(options),
+        m_width(options.width & ~1u),
+        m_height(options.height & ~1u),
+        m_pixels(static_cast<size_t>(m_width) * m_height)
+    {
+        if (m_options.refreshHz == 0)
+        {
+            m_options.refreshHz = 60;
+        }
+        BuildGlyphs();
+        BuildPointer();
+        Layout();
+        DrawInitial();
+    }
+
+    uint32_t Width() const override { return m_width; }
+    uint32_t Height() const override { return m_height; }
+
+    //----------------------------------------------------------------------------------
+    // [SyntheticSource::AcquireFrame]
+    //----------------------------------------------------------------------------------
+    CaptureResult AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info) override
+    {
+        m_dirty.clear();
+        m_moves.clear();
+        uint32_t accumulated = 0;
+        uint64_t presentedTick = m_tick;
+        bool pointerUpdated = false;
+        bool shapeUpdated = false;
+
+        if (m_firstFrame)
+        {
+            // Like desktop duplication, the first frame is the whole desktop.
+            m_firstFrame = false;
+            shapeUpdated = true;
+            m_startNs = NowNs();
+            accumulated = 1;
+            m_dirty.push_back(FrameRect{ 0, 0, static_cast<int32_t>(m_width), static_cast<int32_t>(m_height) });
+            pointerUpdated = true;
+        }
+
+        const uint64_t timeoutTicks = (static_cast<uint64_t>(timeoutMs) * m_options.refreshHz + 999) / 1000;
+        const uint64_t deadlineTick = m_tick + (timeoutTicks ? timeoutTicks : 1);
+        while (accumulated == 0)
+        {
+            const uint64_t targetTick = m_options.realTime ? CurrentTick() : m_tick + 1;
+            while (m_tick < targetTick)
+            {
+                ++m_tick;
+                const size_t movesBefore = m_moves.size();
+                const size_t dirtyBefore = m_dirty.size();
+                const int32_t pointerX = m_pointerX;
+                const int32_t pointerY = m_pointerY;
+                Step();
+                if (m_moves.size() != movesBefore || m_dirty.size() != dirtyBefore || m_options.frameMarkers)
+                {
+                    ++accumulated;
+                    presentedTick = m_tick;
+                }
+                pointerUpdated = pointerUpdated || pointerX != m_pointerX || pointerY != m_pointerY;
+                if (!m_options.realTime && accumulated)
+                {
+                    break;
+                }
+            }
+            if (accumulated || pointerUpdated)
+            {
+                break;
+            }
+            if (m_tick >= deadlineTick)
+            {
+                return CaptureResult::Timeout;
+            }
+            if (m_options.realTime)
+            {
+                std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+                    std::chrono::nanoseconds(TickStartNs(m_tick + 1))));
+            }
+        }
+
+        if (m_options.frameMarkers && accumulated)
+        {
+            StampMarker(presentedTick);
+        }
+
+        // Several updates merged into one frame: report everything they touched as
+        // dirty rather than replaying the moves in order.
+        if (accumulated > 1 && !m_moves.empty())
+        {
+            for (const FrameMoveRect& move : m_moves)
+            {
+                m_dirty.push_back(move.destination);
+            }
+            m_moves.clear();
+        }
+        if (m_dirty.size() > MaxDirtyRects)
+        {
+            FrameRect bounds = m_dirty[0];
+            for (const FrameRect& rect : m_dirty)
+            {
+                bounds.left = rect.left < bounds.left ? rect.left : bounds.left;
+                bounds.top = rect.top < bounds.top ? rect.top : bounds.top;
+                bounds.right = rect.right > bounds.right ? rect.right : bounds.right;
+                bounds.bottom = rect.bottom > bounds.bottom ? rect.bottom : bounds.bottom;
+            }
+            m_dirty.assign(1, bounds);
+        }
+
+        info = CaptureFrameInfo();
+        info.timestamp = static_cast<int64_t>(presentedTick * 10000000ull / m_options.refreshHz);
+        info.imageUpdated = accumulated > 0;
+        info.accumulatedFrames = accumulated;
+        info.pDirtyRects = m_dirty.empty() ? nullptr : m_dirty.data();
+        info.dirtyRectCount = static_cast<uint32_t>(m_dirty.size());
+        info.pMoveRects = m_moves.empty() ? nullptr : m_moves.data();
+        info.moveRectCount = static_cast<uint32_t>(m_moves.size());
+        info.pointerUpdated = pointerUpdated;
+        info.pointerVisible = true;
+        info.pointerX = m_pointerX;
+        info.pointerY = m_pointerY;
+        info.pPointerShape = shapeUpdated ? &m_pointerShape : nullptr;
+        m_acquired = true;
+        return CaptureResult::Ok;
+    }
+
+    bool MapFrame(MappedFrame& mapped) override
+    {
+        if (!m_acquired)
+        {
+            return false;
+        }
+        mapped.pPixels = reinterpret_cast<const uint8_t*>(m_pixels.data());
+        mapped.stride = static_cast<size_t>(m_width) * 4;
+        mapped.width = m_width;
+        mapped.height = m_height;
+        return true;
+    }
+
+    void ReleaseFrame() override
+    {
+        m_acquired = false;
+    }
+
+    // Refresh intervals simulated so far.
+    uint64_t Tick() const { return m_tick; }
+
+    // Frames stamped with a FrameMarker so far.
+    uint32_t MarkersStamped() const { return m_markerFrame; }
+
+private:
+    static const size_t MaxDirtyRects = 64;
+    static const int GlyphWidth = 9;   // 8 pixels plus one of spacing.
+    static const int LineHeight = 20;  // 16-pixel glyphs plus spacing.
+    static const int TitleHeight = 30;
+    static const uint32_t White = 0xFFFFFFFF;
+    static const uint32_t Ink = 0xFF202020;
+
+    static uint64_t NowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    uint64_t TickStartNs(uint64_t tick) const
+    {
+        return m_startNs + tick * 1000000000ull / m_options.refreshHz;
+    }
+
+    uint64_t CurrentTick() const
+    {
+        return (NowNs() - m_startNs) * m_options.refreshHz / 1000000000ull;
+    }
+
+    static uint32_t Hash(uint32_t value)
+    {
+        value ^= value >> 16;
+        value *= 0x7feb352d;
+        value ^= value >> 15;
+        value *= 0x846ca68b;
+        value ^= value >> 16;
+        return value;
+    }
+
+    static uint32_t Bgra(uint32_t r, uint32_t g, uint32_t b)
+    {
+        return 0xFF000000u | (r << 16) | (g << 8) | b;
+    }
+
+    uint32_t* Row(int32_t y) { return m_pixels.data() + static_cast<size_t>(y) * m_width; }
+
+    // --- Content ---
+
+    void BuildGlyphs()
+    {
+        for (uint32_t glyph = 0; glyph < GlyphCount; ++glyph)
+        {
+            for (uint32_t row = 0; row < 16; ++row)
+            {
+                // Roughly a third of the cell inked, and blank rows at the top and
+                // bottom like real lowercase text.
+                const uint32_t bits = Hash(m_options.seed * 7919 + glyph * 16 + row);
+                m_glyphs[glyph][row] = (row < 3 || row > 13) ? 0 : static_cast<uint8_t>(bits & (bits >> 8));
+            }
+        }
+    }
+
+    // A 12-pixel black-outlined white arrow with its tip, the hotspot, at the top-left:
+    // AND mask rows, then XOR mask rows, 16 pixels (2 bytes) wide.
+    void BuildPointer()
+    {
+        const uint32_t size = 16;
+        m_pointerMasks.assign(2 * size * 2, 0);
+        for (uint32_t y = 0; y < size; ++y)
+        {
+            for (uint32_t x = 0; x < size; ++x)
+            {
+                const bool inside = y < 12 && x <= y;
+                const bool outline = inside && (x == 0 || x == y || y == 11);
+                const uint8_t bit = static_cast<uint8_t>(0x80 >> (x % 8));
+                if (!inside)
+                {
+                    m_pointerMasks[y * 2 + x / 8] |= bit;
+                }
+                else if (!outline)
+                {
+                    m_pointerMasks[(size + y) * 2 + x / 8] |= bit;
+                }
+            }
+        }
+        m_pointerShape.type = PointerShapeType::Monochrome;
+        m_pointerShape.width = size;
+        m_pointerShape.height = size;
+        m_pointerShape.pitch = 2;
+        m_pointerShape.pData = m_pointerMasks.data();
+    }
+
+    uint32_t BackgroundPixel(int32_t x, int32_t y) const
+    {
+        if (y >= static_cast<int32_t>(m_height) - m_taskbarHeight)
+        {
+            // Taskbar with a row of icons.
+            const int32_t cell = x % 48;
+            const bool icon = cell >= 10 && cell < 38 && (y - (static_cast<int32_t>(m_height) - m_taskbarHeight)) % 40 >= 6 &&
+                              x / 48 < 12;
+            return icon ? Bgra(80 + (x / 48) * 12, 140, 200) : Bgra(32, 32, 36);
+        }
+        return Bgra(20 + y * 40 / m_height, 60 + x * 50 / m_width, 110 + y * 80 / m_height);
+    }
+
+    // Text of an endless document; docY counts pixels from its first line.
+    uint32_t TextPixel(int64_t docY, int32_t x) const
+    {
+        const uint32_t line = static_cast<uint32_t>(docY / LineHeight);
+        const int32_t rowInLine = static_cast<int32_t>(docY % LineHeight) - 2;
+        const int32_t column = (x - 8) / GlyphWidth;
+        const int32_t xInGlyph = (x - 8) % GlyphWidth;
+        if (x < 8 || rowInLine < 0 || rowInLine >= 16 || xInGlyph >= 8)
+        {
+            return White;
+        }
+        const uint32_t lineLength = (Hash(line * 31 + m_options.seed) % 90);
+        if (static_cast<uint32_t>(column) >= lineLength)
+        {
+            return White;
+        }
+        const uint32_t character = Hash(line * 131 + column + m_options.seed * 17);
+        if (character % 6 == 0)
+        {
+            return White; // Space.
+        }
+        return (m_glyphs[character % GlyphCount][rowInLine] >> (7 - xInGlyph)) & 1 ? Ink : White;
+    }
+
+    uint32_t VideoPixel(int32_t x, int32_t y, uint32_t frame, uint32_t& noise) const
+    {
+        noise = noise * 1664525u + 1013904223u;
+        const uint32_t grain = noise >> 28;
+        const uint32_t r = ((x + frame * 6) ^ (y + frame * 2)) & 0xFF;
+        const uint32_t g = ((x * 2 - frame * 3) + y) & 0xFF;
+        const uint32_t b = (y * 3 + frame * 5) & 0xFF;
+        return Bgra((r + grain) & 0xFF, (g + grain) & 0xFF, (b + grain) & 0xFF);
+    }
+
+    void FillBackground(const FrameRect& rect)
+    {
+        for (int32_t y = rect.top; y < rect.bottom; ++y)
+        {
+            uint32_t* pRow = Row(y);
+            for (int32_t x = rect.left; x < rect.right; ++x)
+            {
+                pRow[x] = BackgroundPixel(x, y);
+            }
+        }
+    }
+
+    // Title bar, border and a text body scrolled to scrollY.
+    void DrawWindow(const FrameRect& rect, int64_t scrollY)
+    {
+        for (int32_t y = rect.top; y < rect.bottom; ++y)
+        {
+            uint32_t* pRow = Row(y);
+            for (int32_t x = rect.left; x < rect.right; ++x)
+            {
+                uint32_t pixel;
+                if (x == rect.left || x == rect.right - 1 || y == rect.bottom - 1)
+                {
+                    pixel = Bgra(90, 90, 90);
+                }
+                else if (y < rect.top + TitleHeight)
+                {
+                    const bool button = x >= rect.right - 40 && x < rect.right - 16 && y >= rect.top + 8 && y < rect.top + 22;
+                    pixel = button ? Bgra(230, 80, 70) : Bgra(43, 87, 154);
+                }
+                else
+                {
+                    pixel = TextPixel(scrollY + (y - rect.top - TitleHeight), x - rect.left);
+                }
+                pRow[x] = pixel;
+            }
+        }
+    }
+
+    // --- Scenes ---
+
+    void Layout()
+    {
+        const int32_t w = static_cast<int32_t>(m_width);
+        const int32_t h = static_cast<int32_t>(m_height);
+        m_taskbarHeight = h / 24 > 40 ? 40 : h / 24;
+        m_backWindow = FrameRect{ w / 16, h / 12, w / 16 + w * 5 / 12, h / 12 + h / 2 };
+        m_frontWindow = FrameRect{ w * 3 / 8, h / 5, w * 3 / 8 + w / 2, h / 5 + h * 3 / 5 };
+
+        // The caret sits after the text of the window's fifth line.
+        const int32_t caretLine = 4;
+        const uint32_t lineLength = Hash(caretLine * 31 + m_options.seed) % 90;
+        int32_t caretX = m_frontWindow.left + 8 + static_cast<int32_t>(lineLength) * GlyphWidth + 1;
+        caretX = caretX < m_frontWindow.right - 4 ? caretX : m_frontWindow.right - 4;
+        const int32_t caretY = m_frontWindow.top + TitleHeight + caretLine * LineHeight + 2;
+        m_caret = FrameRect{ caretX, caretY, caretX + 2, caretY + 16 };
+
+        const int32_t videoWidth = (w * 2 / 3) & ~1;
+        const int32_t videoHeight = (videoWidth * 9 / 16) & ~1;
+        m_video = FrameRect{ (w - videoWidth) / 2, (h - videoHeight) / 2, (w - videoWidth) / 2 + videoWidth,
+                             (h - videoHeight) / 2 + videoHeight };
+
+        m_dragWindow = FrameRect{ 0, 0, w * 5 / 12, h * 5 / 11 };
+        PlaceDragWindow(0, m_dragWindow);
+        m_pointerX = m_frontWindow.left + (m_frontWindow.right - m_frontWindow.left) / 2;
+        m_pointerY = m_frontWindow.top + (m_frontWindow.bottom - m_frontWindow.top) / 2;
+        if (m_options.scenario == Scenario::WindowDrag)
+        {
+            m_pointerX = m_dragWindow.left + 60;
+            m_pointerY = m_dragWindow.top + TitleHeight / 2;
+        }
+        m_windowPixels.resize(static_cast<size_t>(m_dragWindow.right - m_dragWindow.left) *
+                              (m_dragWindow.bottom - m_dragWindow.top));
+    }
+
+    // The drag path: a slow Lissajous figure over the whole screen.
+    void PlaceDragWindow(uint64_t tick, FrameRect& rect) const
+    {
+        const int32_t windowWidth = rect.right - rect.left;
+        const int32_t windowHeight = rect.bottom - rect.top;
+        const int32_t rangeX = static_cast<int32_t>(m_width) - windowWidth;
+        const int32_t rangeY = static_cast<int32_t>(m_height) - m_taskbarHeight - windowHeight;
+        // Triangle waves keep the motion integer-exact and reproducible.
+        const int64_t periodX = 7 * static_cast<int64_t>(m_options.refreshHz);
+        const int64_t periodY = 5 * static_cast<int64_t>(m_options.refreshHz);
+        const int64_t phaseX = static_cast<int64_t>(tick % periodX);
+        const int64_t phaseY = static_cast<int64_t>(tick % periodY);
+        const int64_t triangleX = phaseX < periodX / 2 ? phaseX : periodX - phaseX;
+        const int64_t triangleY = phaseY < periodY / 2 ? phaseY : periodY - phaseY;
+        rect.left = static_cast<int32_t>(triangleX * rangeX / (periodX / 2));
+        rect.top = static_cast<int32_t>(triangleY * rangeY / (periodY / 2));
+        rect.right = rect.left + windowWidth;
+        rect.bottom = rect.top + windowHeight;
+    }
+
+    void DrawInitial()
+    {
+        FillBackground(FrameRect{ 0, 0, static_cast<int32_t>(m_width), static_cast<int32_t>(m_height) });
+        switch (m_options.scenario)
+        {
+        case Scenario::StaticDesktop:
+            DrawWindow(m_backWindow, 4000);
+            DrawWindow(m_frontWindow, 0);
+            break;
+        case Scenario::ScrollingText:
+            DrawWindow(m_backWindow, 4000);
+            DrawWindow(m_frontWindow, 0);
+            break;
+        case Scenario::Video:
+            DrawWindow(m_backWindow, 4000);
+            DrawVideoFrame();
+            break;
+        case Scenario::WindowDrag:
+            DrawWindow(m_dragWindow, 0);
+            break;
+        }
+    }
+
+    // Advances the scene by one refresh interval, recording what changed.
+    void StampMarker(uint64_t presentedTick)
+    {
+        FrameMarker::Marker marker;
+        // Numbered by refresh, so updates merged by a slow consumer show up as gaps.
+        marker.frameNumber = static_cast<uint32_t>(presentedTick);
+        marker.timestampNs = m_options.realTime ? TickStartNs(presentedTick) : NowNs();
+        if (!FrameMarker::Stamp(reinterpret_cast<uint8_t*>(m_pixels.data()), static_cast<ptrdiff_t>(m_width) * 4,
+                                m_width, m_height, marker))
+        {
+            return;
+        }
+        ++m_markerFrame;
+        const FrameMarker::Placement placement = FrameMarker::Place(m_width, m_height);
+        m_dirty.push_back(FrameRect{ static_cast<int32_t>(placement.left), static_cast<int32_t>(placement.top),
+                                     static_cast<int32_t>(placement.left + placement.Width()),
+                                     static_cast<int32_t>(placement.top + placement.Height()) });
+    }
+
+    void Step()
+    {
+        switch (m_options.scenario)
+        {
+        case Scenario::StaticDesktop: StepCaret(); break;
+        case Scenario::ScrollingText: StepScroll(); break;
+        case Scenario::Video: StepVideo(); break;
+        case Scenario::WindowDrag: StepDrag(); break;
+        }
+    }
+
+    void StepCaret()
+    {
+        const bool on = (m_tick * 1000 / m_options.refreshHz / 530) % 2 == 0;
+        if (on == m_caretOn)
+        {
+            return;
+        }
+        m_caretOn = on;
+        for (int32_t y = m_caret.top; y < m_caret.bottom; ++y)
+        {
+            for (int32_t x = m_caret.left; x < m_caret.right; ++x)
+            {
+                Row(y)[x] = on ? Ink : TextPixel(y - m_frontWindow.top - TitleHeight, x - m_frontWindow.left);
+            }
+        }
+        m_dirty.push_back(m_caret);
+    }
+
+    void StepScroll()
+    {
+        // About two lines a second at 60 Hz, like reading along in a log window.
+        const int32_t step = 2;
+        const int32_t left = m_frontWindow.left + 1;
+        const int32_t right = m_frontWindow.right - 1;
+        const int32_t top = m_frontWindow.top + TitleHeight;
+        const int32_t bottom = m_frontWindow.bottom - 1;
+        const size_t rowBytes = static_cast<size_t>(right - left) * 4;
+        for (int32_t y = top; y < bottom - step; ++y)
+        {
+            memcpy(Row(y) + left, Row(y + step) + left, rowBytes);
+        }
+        m_scrollY += step;
+        for (int32_t y = bottom - step; y < bottom; ++y)
+        {
+            uint32_t* pRow = Row(y);
+            for (int32_t x = left; x < right; ++x)
+            {
+                pRow[x] = TextPixel(m_scrollY + (y - top), x - m_frontWindow.left);
+            }
+        }
+        m_moves.push_back(FrameMoveRect{ left, top + step, FrameRect{ left, top, right, bottom - step } });
+        m_dirty.push_back(FrameRect{ left, bottom - step, right, bottom });
+    }
+
+    void DrawVideoFrame()
+    {
+        uint32_t noise = Hash(m_videoFrame + m_options.seed);
+        for (int32_t y = m_video.top; y < m_video.bottom; ++y)
+        {
+            uint32_t* pRow = Row(y);
+            for (int32_t x = m_video.left; x < m_video.right; ++x)
+            {
+                pRow[x] = VideoPixel(x - m_video.left, y - m_video.top, m_videoFrame, noise);
+            }
+        }
+    }
+
+    void StepVideo()
+    {
+        // 30 fps content: a new picture every refreshHz/30 intervals.
+        const uint64_t interval = m_options.refreshHz >= 60 ? m_options.refreshHz / 30 : 1;
+        if (m_tick % interval != 0)
+        {
+            return;
+        }
+        ++m_videoFrame;
+        DrawVideoFrame();
+        m_dirty.push_back(m_video);
+    }
+
+    void StepDrag()
+    {
+        FrameRect next = m_dragWindow;
+        PlaceDragWindow(m_tick, next);
+        if (next.left == m_dragWindow.left && next.top == m_dragWindow.top)
+        {
+            return;
+        }
+
+        // Move the window's pixels (through a copy, as the areas overlap) and
+        // repaint the desktop it no longer covers.
+        const FrameRect old = m_dragWindow;
+        const int32_t windowWidth = old.right - old.left;
+        const size_t rowBytes = static_cast<size_t>(windowWidth) * 4;
+        for (int32_t y = old.top; y < old.bottom; ++y)
+        {
+            memcpy(&m_windowPixels[static_cast<size_t>(y - old.top) * windowWidth], Row(y) + old.left, rowBytes);
+        }
+        AddUncovered(old, next);
+        for (int32_t y = next.top; y < next.bottom; ++y)
+        {
+            memcpy(Row(y) + next.left, &m_windowPixels[static_cast<size_t>(y - next.top) * windowWidth], rowBytes);
+        }
+        m_moves.push_back(FrameMoveRect{ old.left, old.top, next });
+        m_pointerX += next.left - old.left;
+        m_pointerY += next.top - old.top;
+        m_dragWindow = next;
+    }
+
+    // Repaints and reports the parts of 'old' outside 'next' (up to four bands).
+    void AddUncovered(const FrameRect& old, const FrameRect& next)
+    {
+        FrameRect bands[4];
+        int count = 0;
+        const int32_t overlapTop = old.top > next.top ? old.top : next.top;
+        const int32_t overlapBottom = old.bottom < next.bottom ? old.bottom : next.bottom;
+        if (overlapTop >= overlapBottom || old.right <= next.left || next.right <= old.left)
+        {
+            bands[count++] = old;
+        }
+        else
+        {
+            if (old.top < overlapTop) bands[count++] = FrameRect{ old.left, old.top, old.right, overlapTop };
+            if (old.bottom > overlapBottom) bands[count++] = FrameRect{ old.left, overlapBottom, old.right, old.bottom };
+            if (old.left < next.left) bands[count++] = FrameRect{ old.left, overlapTop, next.left, overlapBottom };
+            if (old.right > next.right) bands[count++] = FrameRect{ next.right, overlapTop, old.right, overlapBottom };
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            FillBackground(bands[i]);
+            m_dirty.push_back(bands[i]);
+        }
+    }
+
+    static const uint32_t GlyphCount = 64;
+
+    Options m_options;
+    uint32_t m_width;
+    uint32_t m_height;
+    std::vector<uint32_t> m_pixels;
+    uint8_t m_glyphs[GlyphCount][16];
+    std::vector<uint8_t> m_pointerMasks;
+    PointerShape m_pointerShape;
+
+    // Scene layout and state.
+    int32_t m_taskbarHeight = 40;
+    FrameRect m_backWindow = {};
+    FrameRect m_frontWindow = {};
+    FrameRect m_caret = {};
+    FrameRect m_video = {};
+    FrameRect m_dragWindow = {};
+    std::vector<uint32_t> m_windowPixels;
+    bool m_caretOn = false;
+    int64_t m_scrollY = 0;
+    uint32_t m_videoFrame = 0;
+    uint32_t m_markerFrame = 0;
+    int32_t m_pointerX = 0;
+    int32_t m_pointerY = 0;
+
+    // Timing and the frame being handed out.
+    uint64_t m_tick = 0;
+    uint64_t m_startNs = 0;
+    bool m_firstFrame = true;
+    bool m_acquired = false;
+    std::vector<FrameRect> m_dirty;
+    std::vector<FrameMoveRect> m_moves;
+};
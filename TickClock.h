@@ -0,0 +1,81 @@
+#pragma once
+//======================================================================================
+// TickClock.h
+// The cheapest timestamp we can take on the hot path, shared by the latency
+// histograms and the trace ring.
+//
+// On x86 this is the timestamp counter (a few ns, versus ~20-40 ns for
+// QueryPerformanceCounter/clock_gettime); every CPU we run on has an invariant TSC.
+// Its rate is measured against steady_clock since the first use, so converting
+// ticks to time gets more accurate the longer the process runs. Elsewhere ticks
+// are simply nanoseconds.
+//======================================================================================
+#include <chrono>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TICK_CLOCK_USE_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace TickClock
+{
+    inline uint64_t NowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    inline uint64_t Now()
+    {
+#ifdef TICK_CLOCK_USE_TSC
+        return __rdtsc();
+#else
+        return NowNs();
+#endif
+    }
+
+    // The reference point for calibration and for Origin().
+    struct Epoch
+    {
+        uint64_t ticks;
+        uint64_t ns;
+    };
+
+    inline const Epoch& Start()
+    {
+        static const Epoch epoch = { Now(), NowNs() };
+        return epoch;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [TickClock::NsPerTick]
+    // Measured over everything since Start(); spins for a millisecond if that is
+    // still too short to be stable.
+    //----------------------------------------------------------------------------------
+    inline double NsPerTick()
+    {
+#ifdef TICK_CLOCK_USE_TSC
+        const Epoch& start = Start();
+        uint64_t ticks = Now() - start.ticks;
+        uint64_t ns = NowNs() - start.ns;
+        if (ns < 1000000)
+        {
+            const uint64_t ticks0 = Now();
+            const uint64_t ns0 = NowNs();
+            while (NowNs() - ns0 < 1000000)
+            {
+            }
+            ticks = Now() - ticks0;
+            ns = NowNs() - ns0;
+        }
+        return ticks ? static_cast<double>(ns) / static_cast<double>(ticks) : 1.0;
+#else
+        return 1.0;
+#endif
+    }
+}
@@ -0,0 +1,392 @@
+#pragma once
+//======================================================================================
+// Trace.h
+// Low-overhead event tracing for finding out which stage stalled when a recording
+// stutters.
+//
+// Every thread that emits events gets its own fixed-size ring of binary events
+// (begin/end of a slice, instant, counter), each tagged with a frame ID. Writing an
+// event is a TickClock read and a few stores into the thread's own ring - no locks,
+// no allocation - and the ring simply overwrites its oldest events, so tracing can
+// stay on for a whole session and the last few seconds are always available.
+// ExportChromeJson() snapshots every ring into the Chrome trace event format,
+// which chrome://tracing and ui.perfetto.dev both open. Events that share a frame
+// ID are linked with flow arrows, so one frame can be followed from capture
+// through encode to the file and stream threads.
+//
+// Event names must be string literals (or otherwise live forever): only the
+// pointer is stored.
+//======================================================================================
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "TickClock.h"
+
+namespace Trace
+{
+    static const uint64_t NoFrame = ~0ull;
+
+    enum class EventType : uint8_t
+    {
+        Begin,
+        End,
+        Instant,
+        Counter,
+    };
+
+    struct Event
+    {
+        uint64_t ticks;
+        const char* pName;
+        uint64_t frameId;
+        int64_t value; // Counter value.
+        EventType type;
+    };
+
+    //==================================================================================
+    // ThreadRing
+    // One thread's events. Single producer; readers copy a snapshot and discard
+    // whatever the producer may have overwritten while they were copying.
+    //==================================================================================
+    class ThreadRing
+    {
+    public:
+        static const uint64_t Capacity = 32768; // ~1.3 MB per tracing thread.
+
+        explicit ThreadRing(uint32_t threadIndex) : m_threadIndex(threadIndex)
+        {
+            m_name[0] = '\0';
+        }
+
+        void Push(EventType type, const char* pName, uint64_t ticks, uint64_t frameId, int64_t value)
+        {
+            const uint64_t head = m_head.load(std::memory_order_relaxed);
+            Event& event = m_events[head & (Capacity - 1)];
+            event.ticks = ticks;
+            event.pName = pName;
+            event.frameId = frameId;
+            event.value = value;
+            event.type = type;
+            m_head.store(head + 1, std::memory_order_release);
+        }
+
+        // Appends the surviving events, oldest first.
+        void Snapshot(std::vector<Event>& out) const
+        {
+            const uint64_t head = m_head.load(std::memory_order_acquire);
+            const uint64_t first = head > Capacity ? head - Capacity : 0;
+            const size_t start = out.size();
+            for (uint64_t i = first; i < head; ++i)
+            {
+                out.push_back(m_events[i & (Capacity - 1)]);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // Anything the producer reached while we copied may be torn.
+            const uint64_t after = m_head.load(std::memory_order_relaxed);
+            const uint64_t valid = after > Capacity ? after - Capacity : 0;
+            if (valid > first)
+            {
+                const size_t drop = static_cast<size_t>(std::min(valid - first, head - first));
+                out.erase(out.begin() + start, out.begin() + start + drop);
+            }
+        }
+
+        void SetName(const char* pName)
+        {
+            snprintf(m_name, sizeof(m_name), "%s", pName);
+        }
+
+        const char* Name() const { return m_name; }
+        uint32_t ThreadIndex() const { return m_threadIndex; }
+
+    private:
+        Event m_events[Capacity];
+        std::atomic<uint64_t> m_head{ 0 };
+        uint32_t m_threadIndex;
+        char m_name[32];
+    };
+
+    //==================================================================================
+    // Tracer
+    // Owns every thread's ring. Rings outlive their threads, so a dump still shows
+    // a thread that has already exited.
+    //==================================================================================
+    class Tracer
+    {
+    public:
+        static Tracer& Instance()
+        {
+            static Tracer tracer;
+            return tracer;
+        }
+
+        void Enable(bool enabled)
+        {
+            TickClock::Start();
+            m_enabled.store(enabled, std::memory_order_relaxed);
+        }
+
+        bool IsEnabled() const
+        {
+            return m_enabled.load(std::memory_order_relaxed);
+        }
+
+        ThreadRing* RegisterThread()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_rings.emplace_back(new ThreadRing(static_cast<uint32_t>(m_rings.size() + 1)));
+            return m_rings.back().get();
+        }
+
+        //------------------------------------------------------------------------------
+        // [Tracer::ExportChromeJson]
+        // Chrome trace event JSON of everything currently in the rings. Safe to call
+        // from any thread while tracing continues.
+        //------------------------------------------------------------------------------
+        void ExportChromeJson(std::string& json) const
+        {
+            struct Snapshot
+            {
+                uint32_t tid;
+                std::string name;
+                std::vector<Event> events;
+            };
+            std::vector<Snapshot> snapshots;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (const std::unique_ptr<ThreadRing>& ring : m_rings)
+                {
+                    snapshots.push_back({ ring->ThreadIndex(), ring->Name(), {} });
+                    ring->Snapshot(snapshots.back().events);
+                }
+            }
+
+            const uint64_t originTicks = TickClock::Start().ticks;
+            const double usPerTick = TickClock::NsPerTick() / 1000.0;
+            auto toUs = [&](uint64_t ticks) { return ticks > originTicks ? (ticks - originTicks) * usPerTick : 0.0; };
+
+            // Slice starts that carry a frame ID, for the flow arrows.
+            struct FlowPoint
+            {
+                uint64_t frameId;
+                uint64_t ticks;
+                uint32_t tid;
+            };
+            std::vector<FlowPoint> flowPoints;
+
+            json.clear();
+            json += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+            char line[256];
+            bool first = true;
+            auto append = [&](const char* text)
+            {
+                if (!first)
+                {
+                    json += ",\n";
+                }
+                json += text;
+                first = false;
+            };
+
+            for (const Snapshot& snapshot : snapshots)
+            {
+                snprintf(line, sizeof(line),
+                         "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                         snapshot.tid, snapshot.name.empty() ? "thread" : EscapeName(snapshot.name.c_str()).c_str());
+                append(line);
+
+                for (const Event& event : snapshot.events)
+                {
+                    const std::string name = EscapeName(event.pName);
+                    const double ts = toUs(event.ticks);
+                    switch (event.type)
+                    {
+                    case EventType::Begin:
+                    case EventType::Instant:
+                        if (event.frameId != NoFrame)
+                        {
+                            snprintf(line, sizeof(line),
+                                     "{\"name\":\"%s\",\"cat\":\"pipeline\",\"ph\":\"%s,\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"frame\":%llu}}",
+                                     name.c_str(), event.type == EventType::Begin ? "B\"" : "i\",\"s\":\"t\"", ts, snapshot.tid,
+                                     static_cast<unsigned long long>(event.frameId));
+                            flowPoints.push_back({ event.frameId, event.ticks, snapshot.tid });
+                        }
+                        else
+                        {
+                            snprintf(line, sizeof(line),
+                                     "{\"name\":\"%s\",\"cat\":\"pipeline\",\"ph\":\"%s,\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                                     name.c_str(), event.type == EventType::Begin ? "B\"" : "i\",\"s\":\"t\"", ts, snapshot.tid);
+                        }
+                        break;
+                    case EventType::End:
+                        snprintf(line, sizeof(line), "{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", ts, snapshot.tid);
+                        break;
+                    case EventType::Counter:
+                        snprintf(line, sizeof(line),
+                                 "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%lld}}",
+                                 name.c_str(), ts, snapshot.tid, static_cast<long long>(event.value));
+                        break;
+                    }
+                    append(line);
+                }
+            }
+
+            // Chain each frame's slices in time order: start, steps, finish.
+            std::sort(flowPoints.begin(), flowPoints.end(), [](const FlowPoint& a, const FlowPoint& b)
+            {
+                return a.frameId != b.frameId ? a.frameId < b.frameId : a.ticks < b.ticks;
+            });
+            for (size_t i = 0; i < flowPoints.size(); ++i)
+            {
+                const FlowPoint& point = flowPoints[i];
+                const bool isFirst = (i == 0 || flowPoints[i - 1].frameId != point.frameId);
+                const bool isLast = (i + 1 == flowPoints.size() || flowPoints[i + 1].frameId != point.frameId);
+                if (isFirst && isLast)
+                {
+                    continue; // A frame seen once has nothing to link.
+                }
+                snprintf(line, sizeof(line),
+                         "{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"%s\",\"id\":%llu,\"ts\":%.3f,\"pid\":1,\"tid\":%u%s}",
+                         isFirst ? "s" : isLast ? "f" : "t", static_cast<unsigned long long>(point.frameId),
+                         toUs(point.ticks), point.tid, isLast ? ",\"bp\":\"e\"" : "");
+                append(line);
+            }
+            json += "\n]}\n";
+        }
+
+    private:
+        Tracer() = default;
+
+        static std::string EscapeName(const char* pName)
+        {
+            std::string escaped;
+            for (const char* p = pName ? pName : "?"; *p && escaped.size() < 96; ++p)
+            {
+                if (*p == '"' || *p == '\\')
+                {
+                    escaped += '\\';
+                }
+                if (static_cast<unsigned char>(*p) >= 0x20)
+                {
+                    escaped += *p;
+                }
+            }
+            return escaped;
+        }
+
+        std::atomic<bool> m_enabled{ false };
+        mutable std::mutex m_mutex;
+        std::vector<std::unique_ptr<ThreadRing>> m_rings;
+    };
+
+    // --- Per-thread state ---
+    struct ThreadState
+    {
+        ThreadRing* pRing = nullptr;
+        uint64_t frameId = NoFrame;
+        const char* pPendingName = nullptr;
+    };
+
+    inline ThreadState& Local()
+    {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    inline ThreadRing* LocalRing()
+    {
+        ThreadState& state = Local();
+        if (!state.pRing)
+        {
+            state.pRing = Tracer::Instance().RegisterThread();
+            if (state.pPendingName)
+            {
+                state.pRing->SetName(state.pPendingName);
+            }
+        }
+        return state.pRing;
+    }
+
+    inline bool Enabled()
+    {
+        return Tracer::Instance().IsEnabled();
+    }
+
+    // Names the calling thread in the exported trace. Cheap; the ring itself is
+    // only allocated once the thread emits an event with tracing on.
+    inline void SetThreadName(const char* pName)
+    {
+        ThreadState& state = Local();
+        state.pPendingName = pName;
+        if (state.pRing)
+        {
+            state.pRing->SetName(pName);
+        }
+    }
+
+    // The frame this thread is working on; tags Begin()/Instant() by default.
+    inline void SetFrame(uint64_t frameId) { Local().frameId = frameId; }
+    inline uint64_t CurrentFrame() { return Local().frameId; }
+
+    inline void Begin(const char* pName, uint64_t ticks, uint64_t frameId)
+    {
+        if (Enabled())
+        {
+            LocalRing()->Push(EventType::Begin, pName, ticks, frameId, 0);
+        }
+    }
+
+    inline void Begin(const char* pName, uint64_t ticks)
+    {
+        Begin(pName, ticks, CurrentFrame());
+    }
+
+    inline void End(const char* pName, uint64_t ticks)
+    {
+        if (Enabled())
+        {
+            LocalRing()->Push(EventType::End, pName, ticks, NoFrame, 0);
+        }
+    }
+
+    inline void Instant(const char* pName, uint64_t frameId)
+    {
+        if (Enabled())
+        {
+            LocalRing()->Push(EventType::Instant, pName, TickClock::Now(), frameId, 0);
+        }
+    }
+
+    inline void Counter(const char* pName, int64_t value)
+    {
+        if (Enabled())
+        {
+            LocalRing()->Push(EventType::Counter, pName, TickClock::Now(), NoFrame, value);
+        }
+    }
+
+    // Traces the enclosing block as one slice.
+    class Scope
+    {
+    public:
+        explicit Scope(const char* pName, uint64_t frameId = CurrentFrame()) : m_pName(pName)
+        {
+            Begin(pName, TickClock::Now(), frameId);
+        }
+        ~Scope()
+        {
+            End(m_pName, TickClock::Now());
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* m_pName;
+    };
+}
@@ -0,0 +1,412 @@
+#pragma once
+//======================================================================================
+// TsMuxer.h
+// MPEG-2 Transport Stream muxer for a single H.264 video stream.
+//
+// TS is append-only and self-synchronising: every 188-byte packet starts with a
+// sync byte and the program tables are repeated, so a file that was cut off
+// mid-write (crash, power loss) is still playable up to the last packet, and a
+// reader can start tailing it at any packet boundary while we are still writing.
+//
+// Layout: PAT on PID 0, PMT on PID 0x1000, video (stream_type 0x1B) on PID 0x100
+// carrying the PCR. Each access unit becomes one PES packet, preceded by PAT/PMT
+// before every keyframe and at least every 100 ms. The PCR rides on each access
+// unit's first packet; frames further apart than the 100 ms ISO 13818-1 allows
+// between PCRs (below 10 fps) get PCR-only packets in between. Packets are
+// assembled in a fixed member buffer, so muxing never allocates.
+//======================================================================================
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "EncodedSink.h"
+#include "H264Bitstream.h"
+
+class TsMuxer : public EncodedSink
+{
+public:
+    static const size_t PacketSize = 188;
+    static const uint16_t PmtPid = 0x1000;
+    static const uint16_t VideoPid = 0x100;
+
+    TsMuxer() = default;
+    TsMuxer(const TsMuxer&) = delete;
+    TsMuxer& operator=(const TsMuxer&) = delete;
+
+    // Starts a new stream on pSink. The sink must outlive the muxer or Finish().
+    void Open(ByteSink* pSink)
+    {
+        m_pSink = pSink;
+        m_used = 0;
+        m_patCc = 0;
+        m_pmtCc = 0;
+        m_videoCc = 0;
+        m_lastTablesPts = -1;
+        m_lastPcrDts = -1;
+        m_failed = false;
+    }
+
+    // Forgets the last PCR, for a sink that skipped frames: the next frame starts the
+    // clock again instead of filling the gap with PCR-only packets.
+    void RestartPcr()
+    {
+        m_lastPcrDts = -1;
+    }
+
+    // PCR-only packets WriteFrame() will put in front of 'frame', for sinks that
+    // reserve room for its output.
+    size_t PcrPacketsBefore(const EncodedFrame& frame) const
+    {
+        const int64_t gap = ToTicks90k(frame.dts) + TimestampOffset - m_lastPcrDts;
+        return (m_lastPcrDts >= 0 && gap > MaxPcrInterval) ? static_cast<size_t>((gap - 1) / MaxPcrInterval) : 0;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [TsMuxer::SetSequenceHeader]
+    // Annex-B SPS/PPS to insert before keyframes that don't carry their own, e.g.
+    // when the encoder only reports them out of band. Returns false if too large.
+    //----------------------------------------------------------------------------------
+    bool SetSequenceHeader(const uint8_t* pData, size_t size)
+    {
+        if (size > sizeof(m_sequenceHeader))
+        {
+            return false;
+        }
+        memcpy(m_sequenceHeader, pData, size);
+        m_sequenceHeaderSize = size;
+        return true;
+    }
+
+    // Offset of the next byte the muxer will produce. Sample it before WriteFrame()
+    // to learn where a keyframe (including its PAT/PMT) starts.
+    uint64_t Position() const
+    {
+        return (m_pSink ? m_pSink->Position() : 0) + m_used;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [TsMuxer::WriteFrame]
+    // Packetizes one access unit.
+    //----------------------------------------------------------------------------------
+    bool WriteFrame(const EncodedFrame& frame) override
+    {
+        if (!m_pSink || m_failed)
+        {
+            return false;
+        }
+
+        const int64_t pts = ToTicks90k(frame.pts) + TimestampOffset;
+        const int64_t dts = ToTicks90k(frame.dts) + TimestampOffset;
+
+        for (size_t n = PcrPacketsBefore(frame); n > 0; --n)
+        {
+            m_lastPcrDts += MaxPcrInterval;
+            if (!WritePcrPacket(m_lastPcrDts))
+            {
+                return false;
+            }
+        }
+        m_lastPcrDts = dts;
+
+        if (frame.keyframe || m_lastTablesPts < 0 || pts - m_lastTablesPts >= 9000)
+        {
+            WriteTables();
+            m_lastTablesPts = pts;
+        }
+
+        // --- Build the PES header plus any NAL units we add in front ---
+        uint8_t prefix[32 + sizeof(m_sequenceHeader)];
+        size_t prefixSize = 0;
+        prefix[prefixSize++] = 0x00;
+        prefix[prefixSize++] = 0x00;
+        prefix[prefixSize++] = 0x01;
+        prefix[prefixSize++] = 0xE0;                 // Video stream 0
+        prefix[prefixSize++] = 0x00;                 // PES_packet_length 0: unbounded,
+        prefix[prefixSize++] = 0x00;                 // allowed for video in TS
+        prefix[prefixSize++] = 0x84;                 // '10', data_alignment_indicator
+        const bool writeDts = (dts != pts);
+        prefix[prefixSize++] = writeDts ? 0xC0 : 0x80; // PTS_DTS_flags
+        prefix[prefixSize++] = writeDts ? 10 : 5;    // PES_header_data_length
+        WriteTimestamp(prefix + prefixSize, writeDts ? 0x3 : 0x2, pts);
+        prefixSize += 5;
+        if (writeDts)
+        {
+            WriteTimestamp(prefix + prefixSize, 0x1, dts);
+            prefixSize += 5;
+        }
+
+        // H.264 in TS wants an access unit delimiter at the start of every AU.
+        const bool hasAud = frame.size > 4 && H264::ContainsNal(frame.pData, frame.size < 64 ? frame.size : 64, H264::NalAud);
+        if (!hasAud)
+        {
+            static const uint8_t aud[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
+            memcpy(prefix + prefixSize, aud, sizeof(aud));
+            prefixSize += sizeof(aud);
+        }
+        if (frame.keyframe && m_sequenceHeaderSize > 0 && !H264::ContainsNal(frame.pData, frame.size, H264::NalSps))
+        {
+            memcpy(prefix + prefixSize, m_sequenceHeader, m_sequenceHeaderSize);
+            prefixSize += m_sequenceHeaderSize;
+        }
+
+        // --- Split into packets ---
+        const uint8_t* segments[2] = { prefix, frame.pData };
+        size_t segmentSizes[2] = { prefixSize, frame.size };
+        size_t segment = 0;
+        size_t remaining = prefixSize + frame.size;
+        bool first = true;
+
+        while (remaining > 0)
+        {
+            uint8_t* pPacket = NextPacket();
+            if (!pPacket)
+            {
+                return false;
+            }
+
+            // Adaptation field: PCR and random access flag on the first packet,
+            // stuffing on the last one if the payload doesn't fill it.
+            size_t afSize = 0; // Including the length byte.
+            uint8_t afFlags = 0;
+            if (first)
+            {
+                afFlags = 0x10; // PCR_flag
+                if (frame.keyframe)
+                {
+                    afFlags |= 0x40; // random_access_indicator
+                }
+                afSize = 2 + 6;
+            }
+            const size_t capacity = PacketSize - 4 - afSize;
+            size_t payload = remaining < capacity ? remaining : capacity;
+            if (payload < capacity)
+            {
+                // Last packet: grow the adaptation field to fill the gap.
+                afSize += capacity - payload;
+            }
+
+            pPacket[0] = 0x47;
+            pPacket[1] = static_cast<uint8_t>((first ? 0x40 : 0x00) | (VideoPid >> 8));
+            pPacket[2] = static_cast<uint8_t>(VideoPid & 0xFF);
+            pPacket[3] = static_cast<uint8_t>((afSize ? 0x30 : 0x10) | (m_videoCc & 0x0F));
+            m_videoCc = (m_videoCc + 1) & 0x0F;
+
+            uint8_t* p = pPacket + 4;
+            if (afSize > 0)
+            {
+                p[0] = static_cast<uint8_t>(afSize - 1);
+                if (afSize > 1)
+                {
+                    p[1] = afFlags;
+                    size_t at = 2;
+                    if (afFlags & 0x10)
+                    {
+                        WritePcr(p + at, dts - TimestampOffset);
+                        at += 6;
+                    }
+                    memset(p + at, 0xFF, afSize - at);
+                }
+                p += afSize;
+            }
+
+            // Copy payload, crossing from the prefix into the frame data as needed.
+            size_t left = payload;
+            while (left > 0)
+            {
+                const size_t chunk = segmentSizes[segment] < left ? segmentSizes[segment] : left;
+                memcpy(p, segments[segment], chunk);
+                p += chunk;
+                segments[segment] += chunk;
+                segmentSizes[segment] -= chunk;
+                left -= chunk;
+                if (segmentSizes[segment] == 0 && segment == 0)
+                {
+                    segment = 1;
+                }
+            }
+            remaining -= payload;
+            first = false;
+        }
+
+        return Flush();
+    }
+
+    // TS needs no trailer; just push out anything still buffered.
+    bool Finish() override
+    {
+        return Flush();
+    }
+
+private:
+    // PTS/DTS start here (0.7 s) so the PCR, which runs at the frame's DTS without
+    // the offset, stays ahead of every timestamp by the decoder buffering delay.
+    static const int64_t TimestampOffset = 63000;
+    // ISO 13818-1: at most 100 ms between PCRs.
+    static const int64_t MaxPcrInterval = 9000;
+
+    static int64_t ToTicks90k(int64_t time100ns)
+    {
+        return time100ns * 9 / 1000;
+    }
+
+    static uint32_t Crc32(const uint8_t* pData, size_t size)
+    {
+        // MPEG-2 CRC: polynomial 0x04C11DB7, MSB first, no reflection, no final XOR.
+        static const struct Table
+        {
+            uint32_t values[256];
+            Table()
+            {
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    uint32_t crc = i << 24;
+                    for (int bit = 0; bit < 8; ++bit)
+                    {
+                        crc = (crc & 0x80000000u) ? (crc << 1) ^ 0x04C11DB7u : (crc << 1);
+                    }
+                    values[i] = crc;
+                }
+            }
+        } table;
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = (crc << 8) ^ table.values[((crc >> 24) ^ pData[i]) & 0xFF];
+        }
+        return crc;
+    }
+
+    // '0010'/'0011'/'0001' prefix, then the 33-bit value split 3/15/15 with markers.
+    static void WriteTimestamp(uint8_t* p, uint8_t prefix, int64_t value)
+    {
+        const uint64_t v = static_cast<uint64_t>(value) & 0x1FFFFFFFFull;
+        p[0] = static_cast<uint8_t>((prefix << 4) | ((v >> 29) & 0x0E) | 0x01);
+        p[1] = static_cast<uint8_t>(v >> 22);
+        p[2] = static_cast<uint8_t>(((v >> 14) & 0xFE) | 0x01);
+        p[3] = static_cast<uint8_t>(v >> 7);
+        p[4] = static_cast<uint8_t>(((v << 1) & 0xFE) | 0x01);
+    }
+
+    // 33-bit 90 kHz base, 6 reserved bits, 9-bit 27 MHz extension (always 0 here).
+    static void WritePcr(uint8_t* p, int64_t base90k)
+    {
+        const uint64_t base = static_cast<uint64_t>(base90k) & 0x1FFFFFFFFull;
+        p[0] = static_cast<uint8_t>(base >> 25);
+        p[1] = static_cast<uint8_t>(base >> 17);
+        p[2] = static_cast<uint8_t>(base >> 9);
+        p[3] = static_cast<uint8_t>(base >> 1);
+        p[4] = static_cast<uint8_t>(((base & 1) << 7) | 0x7E);
+        p[5] = 0x00;
+    }
+
+    // An adaptation-field-only video packet carrying the PCR for 'dts'. Without a
+    // payload it repeats the continuity counter of the packet before it.
+    bool WritePcrPacket(int64_t dts)
+    {
+        uint8_t* pPacket = NextPacket();
+        if (!pPacket)
+        {
+            return false;
+        }
+        pPacket[0] = 0x47;
+        pPacket[1] = static_cast<uint8_t>(VideoPid >> 8);
+        pPacket[2] = static_cast<uint8_t>(VideoPid & 0xFF);
+        pPacket[3] = static_cast<uint8_t>(0x20 | ((m_videoCc - 1) & 0x0F)); // adaptation_field_control '10'
+        pPacket[4] = static_cast<uint8_t>(PacketSize - 5);                 // adaptation_field_length
+        pPacket[5] = 0x10;                                                  // PCR_flag
+        WritePcr(pPacket + 6, dts - TimestampOffset);
+        memset(pPacket + 12, 0xFF, PacketSize - 12);
+        return true;
+    }
+
+    // Writes one PSI section (PAT or PMT) in a single packet.
+    void WriteSection(uint16_t pid, uint8_t& cc, const uint8_t* pSection, size_t size)
+    {
+        uint8_t* pPacket = NextPacket();
+        if (!pPacket)
+        {
+            return;
+        }
+        pPacket[0] = 0x47;
+        pPacket[1] = static_cast<uint8_t>(0x40 | (pid >> 8)); // payload_unit_start_indicator
+        pPacket[2] = static_cast<uint8_t>(pid & 0xFF);
+        pPacket[3] = static_cast<uint8_t>(0x10 | (cc & 0x0F));
+        cc = (cc + 1) & 0x0F;
+        pPacket[4] = 0x00; // pointer_field
+        memcpy(pPacket + 5, pSection, size);
+        const uint32_t crc = Crc32(pSection, size);
+        uint8_t* pCrc = pPacket + 5 + size;
+        pCrc[0] = static_cast<uint8_t>(crc >> 24);
+        pCrc[1] = static_cast<uint8_t>(crc >> 16);
+        pCrc[2] = static_cast<uint8_t>(crc >> 8);
+        pCrc[3] = static_cast<uint8_t>(crc);
+        memset(pCrc + 4, 0xFF, PacketSize - (5 + size + 4));
+    }
+
+    void WriteTables()
+    {
+        // section_length counts everything after itself, including the CRC.
+        const uint8_t pat[] = {
+            0x00,                    // table_id: program_association_section
+            0xB0, 0x0D,              // section_syntax_indicator, section_length = 13
+            0x00, 0x01,              // transport_stream_id
+            0xC1,                    // version 0, current_next_indicator
+            0x00, 0x00,              // section_number, last_section_number
+            0x00, 0x01,              // program_number 1
+            static_cast<uint8_t>(0xE0 | (PmtPid >> 8)), static_cast<uint8_t>(PmtPid & 0xFF),
+        };
+        WriteSection(0x0000, m_patCc, pat, sizeof(pat));
+
+        const uint8_t pmt[] = {
+            0x02,                    // table_id: TS_program_map_section
+            0xB0, 0x12,              // section_length = 18
+            0x00, 0x01,              // program_number
+            0xC1,                    // version 0, current_next_indicator
+            0x00, 0x00,
+            static_cast<uint8_t>(0xE0 | (VideoPid >> 8)), static_cast<uint8_t>(VideoPid & 0xFF), // PCR_PID
+            0xF0, 0x00,              // program_info_length 0
+            0x1B,                    // stream_type: H.264
+            static_cast<uint8_t>(0xE0 | (VideoPid >> 8)), static_cast<uint8_t>(VideoPid & 0xFF),
+            0xF0, 0x00,              // ES_info_length 0
+        };
+        WriteSection(PmtPid, m_pmtCc, pmt, sizeof(pmt));
+    }
+
+    // Returns room for one packet in the staging buffer, flushing it when full.
+    uint8_t* NextPacket()
+    {
+        if (m_used + PacketSize > sizeof(m_buffer) && !Flush())
+        {
+            return nullptr;
+        }
+        uint8_t* pPacket = m_buffer + m_used;
+        m_used += PacketSize;
+        return pPacket;
+    }
+
+    bool Flush()
+    {
+        if (m_used > 0 && m_pSink)
+        {
+            if (!m_pSink->Write(m_buffer, m_used))
+            {
+                m_failed = true;
+            }
+            m_used = 0;
+        }
+        return !m_failed;
+    }
+
+    ByteSink* m_pSink = nullptr;
+    uint8_t m_buffer[PacketSize * 348]; // ~64 KB of packets per sink write.
+    size_t m_used = 0;
+    uint8_t m_sequenceHeader[256];
+    size_t m_sequenceHeaderSize = 0;
+    uint8_t m_patCc = 0;
+    uint8_t m_pmtCc = 0;
+    uint8_t m_videoCc = 0;
+    int64_t m_lastTablesPts = -1;
+    int64_t m_lastPcrDts = -1;   // DTS of the last PCR written, offset included.
+    bool m_failed = false;
+};
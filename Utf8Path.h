@@ -0,0 +1,56 @@
+#pragma once
+//======================================================================================
+// Utf8Path.h
+// Paths are UTF-8 everywhere in the recorder: on the command line (RecorderOptions),
+// in control requests and in the output cache. POSIX takes them as they are. On
+// Windows the narrow "A" APIs and narrow stream opens read them in the ANSI code
+// page instead, which garbles anything outside ASCII, so every file the recorder
+// opens, moves or deletes goes through the wide APIs with Utf8ToWide().
+//======================================================================================
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+// Converts a UTF-8 string (as used by RecorderOptions) to the UTF-16 Windows APIs expect.
+inline std::wstring Utf8ToWide(const std::string& text)
+{
+    if (text.empty())
+    {
+        return std::wstring();
+    }
+    const int length = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), (int)text.size(), nullptr, 0);
+    std::wstring wide(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.c_str(), (int)text.size(), &wide[0], length);
+    return wide;
+}
+
+// The other way round, for what Windows hands us (the command line, folders).
+inline std::string WideToUtf8(const wchar_t* pText)
+{
+    const int length = WideCharToMultiByte(CP_UTF8, 0, pText, -1, nullptr, 0, nullptr, nullptr);
+    if (length <= 1)
+    {
+        return std::string();
+    }
+    std::string text(length - 1, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, pText, -1, &text[0], length, nullptr, nullptr);
+    return text;
+}
+#endif
+
+// Opens a file stream on a UTF-8 path. Returns whether it is open.
+template <class Stream>
+bool OpenUtf8(Stream& stream, const std::string& path, std::ios_base::openmode mode)
+{
+#ifdef _WIN32
+    stream.open(Utf8ToWide(path).c_str(), mode);
+#else
+    stream.open(path, mode);
+#endif
+    return stream.is_open();
+}
@@ -0,0 +1,189 @@
+#pragma once
+//======================================================================================
+// WriterStream.h
+// An IStream over FileWriter, so the Media Foundation sink writer sends its output
+// through our write-behind I/O layer instead of writing synchronously from whatever
+// thread happens to call WriteSample. Wrap it with MFCreateMFByteStreamOnStream
+// and pass the byte stream to MFCreateSinkWriterFromURL.
+//
+// Media Foundation may call in from its own work queue threads, so every method
+// takes the lock; the calls are few and large, and the actual disk writes happen
+// on the FileWriter's thread without it.
+//======================================================================================
+#include <windows.h>
+#include <objidl.h>
+#include <mutex>
+#include <new>
+#include <string>
+
+#include "FileWriter.h"
+
+class WriterStream : public IStream
+{
+public:
+    //----------------------------------------------------------------------------------
+    // [WriterStream::Create]
+    // Creates the file and returns a stream with a reference count of one.
+    //----------------------------------------------------------------------------------
+    static HRESULT Create(const std::string& path, const FileWriter::Options& options, WriterStream** ppStream)
+    {
+        *ppStream = nullptr;
+        WriterStream* pStream = new (std::nothrow) WriterStream();
+        if (!pStream)
+        {
+            return E_OUTOFMEMORY;
+        }
+        if (!pStream->m_writer.Open(path, options))
+        {
+            pStream->Release();
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        *ppStream = pStream;
+        return S_OK;
+    }
+
+    // Writes out everything still buffered and closes the file. Call after the sink
+    // writer has been finalized; the stream fails all further calls.
+    HRESULT Close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_writer.Close() ? S_OK : E_FAIL;
+    }
+
+    FileWriter::Stats GetStats() const
+    {
+        return m_writer.GetStats();
+    }
+
+    // --- IUnknown ---
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override
+    {
+        if (!ppv)
+        {
+            return E_POINTER;
+        }
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(IStream) || riid == __uuidof(ISequentialStream))
+        {
+            *ppv = static_cast<IStream*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHODIMP_(ULONG) AddRef() override
+    {
+        return InterlockedIncrement(&m_refCount);
+    }
+
+    STDMETHODIMP_(ULONG) Release() override
+    {
+        const ULONG count = InterlockedDecrement(&m_refCount);
+        if (count == 0)
+        {
+            delete this;
+        }
+        return count;
+    }
+
+    // --- ISequentialStream ---
+    STDMETHODIMP Read(void* pv, ULONG cb, ULONG* pcbRead) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const int64_t read = m_writer.Read(m_position, pv, cb);
+        if (read < 0)
+        {
+            return STG_E_READFAULT;
+        }
+        m_position += static_cast<uint64_t>(read);
+        if (pcbRead)
+        {
+            *pcbRead = static_cast<ULONG>(read);
+        }
+        return static_cast<ULONG>(read) == cb ? S_OK : S_FALSE;
+    }
+
+    STDMETHODIMP Write(const void* pv, ULONG cb, ULONG* pcbWritten) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_writer.Seek(m_position);
+        if (!m_writer.Write(pv, cb))
+        {
+            return STG_E_WRITEFAULT;
+        }
+        m_position = m_writer.Tell();
+        if (pcbWritten)
+        {
+            *pcbWritten = cb;
+        }
+        return S_OK;
+    }
+
+    // --- IStream ---
+    STDMETHODIMP Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* pNewPosition) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int64_t base = 0;
+        switch (origin)
+        {
+        case STREAM_SEEK_SET: base = 0; break;
+        case STREAM_SEEK_CUR: base = static_cast<int64_t>(m_position); break;
+        case STREAM_SEEK_END: base = static_cast<int64_t>(m_writer.Size()); break;
+        default: return STG_E_INVALIDFUNCTION;
+        }
+        const int64_t target = base + move.QuadPart;
+        if (target < 0)
+        {
+            return STG_E_INVALIDFUNCTION;
+        }
+        m_position = static_cast<uint64_t>(target);
+        if (pNewPosition)
+        {
+            pNewPosition->QuadPart = m_position;
+        }
+        return S_OK;
+    }
+
+    STDMETHODIMP SetSize(ULARGE_INTEGER newSize) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_writer.SetSize(newSize.QuadPart);
+        return S_OK;
+    }
+
+    STDMETHODIMP Commit(DWORD) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_writer.Flush() ? S_OK : STG_E_WRITEFAULT;
+    }
+
+    STDMETHODIMP Stat(STATSTG* pStat, DWORD) override
+    {
+        if (!pStat)
+        {
+            return STG_E_INVALIDPOINTER;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ZeroMemory(pStat, sizeof(*pStat));
+        pStat->type = STGTY_STREAM;
+        pStat->cbSize.QuadPart = m_writer.Size();
+        pStat->grfMode = STGM_READWRITE;
+        return S_OK;
+    }
+
+    STDMETHODIMP CopyTo(IStream*, ULARGE_INTEGER, ULARGE_INTEGER*, ULARGE_INTEGER*) override { return E_NOTIMPL; }
+    STDMETHODIMP Revert() override { return E_NOTIMPL; }
+    STDMETHODIMP LockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override { return STG_E_INVALIDFUNCTION; }
+    STDMETHODIMP UnlockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override { return STG_E_INVALIDFUNCTION; }
+    STDMETHODIMP Clone(IStream**) override { return E_NOTIMPL; }
+
+private:
+    WriterStream() : m_refCount(1), m_position(0) {}
+    ~WriterStream() { m_writer.Close(); }
+
+    volatile LONG m_refCount;
+    std::mutex m_mutex;
+    FileWriter m_writer;
+    uint64_t m_position; // The stream's single seek pointer, shared by reads and writes.
+};
@@ -0,0 +1,236 @@
+#pragma once
+//======================================================================================
+// BenchHarness.h
+// A small self-contained microbenchmark runner, so the benchmarks build anywhere
+// with nothing but a C++17 compiler (see README.md, "Benchmarks").
+//
+// Each benchmark is a callable that runs one iteration. The runner calibrates the
+// iteration count to a minimum run time, repeats the measurement and reports the
+// fastest and median repetition, which is far more stable on a shared machine
+// than the mean. Throughput is reported as GB/s of bytes touched (read + written)
+// and, for pixel kernels, as reference cycles per pixel - timestamp-counter ticks,
+// which run at the CPU's nominal frequency regardless of turbo (nanoseconds on
+// CPUs without one).
+//
+//     BenchRunner runner(argc, argv);
+//     runner.Run("flip/1080p", bytesPerIteration, pixelsPerIteration, [&] { ... });
+//     return runner.Finish();
+//
+// Work that must not be measured (e.g. letting a consumer thread catch up) can be
+// bracketed with PauseTiming()/ResumeTiming().
+//
+// Options: --filter <substring>, --min-time <seconds>, --repetitions <n>, --csv.
+//======================================================================================
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../TickClock.h"
+
+// Keeps the compiler from discarding or hoisting work whose result is unused.
+template <typename T>
+inline void DoNotOptimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    const volatile char* p = reinterpret_cast<const volatile char*>(&value);
+    (void)*p;
+#endif
+}
+
+inline void ClobberMemory()
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : : "memory");
+#endif
+}
+
+// The instruction set the benchmark binary was compiled for. The kernels have no
+// runtime dispatch, so this is what they were vectorized for.
+inline const char* CompiledIsaLevel()
+{
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    return "x86-64-v4 (AVX-512)";
+#elif defined(__AVX2__)
+    return "x86-64-v3 (AVX2)";
+#elif defined(__SSE4_2__)
+    return "x86-64-v2 (SSE4.2)";
+#elif defined(__x86_64__) || defined(_M_X64)
+    return "x86-64 (SSE2)";
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    return "aarch64 (NEON)";
+#else
+    return "generic";
+#endif
+}
+
+//======================================================================================
+// BenchRunner
+//======================================================================================
+class BenchRunner
+{
+public:
+    BenchRunner(int argc, char** argv)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            if (arg == "--filter" && i + 1 < argc) m_filter = argv[++i];
+            else if (arg == "--min-time" && i + 1 < argc) m_minSeconds = atof(argv[++i]);
+            else if (arg == "--repetitions" && i + 1 < argc) m_repetitions = atoi(argv[++i]);
+            else if (arg == "--csv") m_csv = true;
+            else
+            {
+                fprintf(stderr, "Usage: %s [--filter <substring>] [--min-time <seconds>] [--repetitions <n>] [--csv]\n", argv[0]);
+                exit(2);
+            }
+        }
+        if (m_repetitions < 1)
+        {
+            m_repetitions = 1;
+        }
+        TickClock::Start();
+    }
+
+    bool Matches(const std::string& name) const
+    {
+        return m_filter.empty() || name.find(m_filter) != std::string::npos;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [BenchRunner::Run]
+    // bytes/pixels are per iteration; pass 0 for whichever does not apply.
+    //----------------------------------------------------------------------------------
+    template <typename Fn>
+    void Run(const std::string& name, uint64_t bytes, uint64_t pixels, Fn&& fn)
+    {
+        if (!Matches(name))
+        {
+            return;
+        }
+        if (!m_headerPrinted)
+        {
+            PrintHeader();
+        }
+
+        // Warm up (page in buffers, train predictors), then grow the iteration count
+        // until one repetition takes its share of the minimum run time.
+        fn();
+        const double targetNs = m_minSeconds * 1e9 / m_repetitions;
+        uint64_t iterations = 1;
+        for (;;)
+        {
+            m_pausedNs = 0;
+            const uint64_t start = TickClock::NowNs();
+            for (uint64_t i = 0; i < iterations; ++i)
+            {
+                fn();
+            }
+            const double elapsed = static_cast<double>(TickClock::NowNs() - start - m_pausedNs);
+            if (elapsed >= targetNs || iterations >= (1ull << 40))
+            {
+                break;
+            }
+            const double scale = elapsed > 0 ? targetNs * 1.2 / elapsed : 10.0;
+            iterations = std::max(iterations + 1, static_cast<uint64_t>(iterations * std::min(scale, 10.0)));
+        }
+
+        std::vector<double> nsPerIteration;
+        std::vector<double> ticksPerIteration;
+        for (int rep = 0; rep < m_repetitions; ++rep)
+        {
+            m_pausedNs = 0;
+            m_pausedTicks = 0;
+            const uint64_t startNs = TickClock::NowNs();
+            const uint64_t startTicks = TickClock::Now();
+            for (uint64_t i = 0; i < iterations; ++i)
+            {
+                fn();
+            }
+            ticksPerIteration.push_back(static_cast<double>(TickClock::Now() - startTicks - m_pausedTicks) / iterations);
+            nsPerIteration.push_back(static_cast<double>(TickClock::NowNs() - startNs - m_pausedNs) / iterations);
+        }
+        std::sort(nsPerIteration.begin(), nsPerIteration.end());
+        std::sort(ticksPerIteration.begin(), ticksPerIteration.end());
+        const double best = nsPerIteration.front();
+        const double median = nsPerIteration[nsPerIteration.size() / 2];
+        const double gbPerSecond = bytes ? static_cast<double>(bytes) / best : 0.0;
+        const double cyclesPerPixel = pixels ? ticksPerIteration.front() / static_cast<double>(pixels) : 0.0;
+
+        if (m_csv)
+        {
+            printf("%s,%s,%.1f,%.1f,%.3f,%.4f,%llu\n", name.c_str(), CompiledIsaLevel(), best, median,
+                   gbPerSecond, cyclesPerPixel, static_cast<unsigned long long>(iterations));
+        }
+        else
+        {
+            char gb[16] = "-";
+            char cpp[16] = "-";
+            if (bytes) snprintf(gb, sizeof(gb), "%.2f", gbPerSecond);
+            if (pixels) snprintf(cpp, sizeof(cpp), "%.3f", cyclesPerPixel);
+            printf("%-34s %14s %14s %10s %10s\n", name.c_str(), FormatTime(best).c_str(), FormatTime(median).c_str(), gb, cpp);
+        }
+        fflush(stdout);
+        ++m_count;
+    }
+
+    void PauseTiming()
+    {
+        m_pauseStartNs = TickClock::NowNs();
+        m_pauseStartTicks = TickClock::Now();
+    }
+
+    void ResumeTiming()
+    {
+        m_pausedTicks += TickClock::Now() - m_pauseStartTicks;
+        m_pausedNs += TickClock::NowNs() - m_pauseStartNs;
+    }
+
+    int Finish() const
+    {
+        if (m_count == 0)
+        {
+            fprintf(stderr, "No benchmark matched '%s'\n", m_filter.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+private:
+    void PrintHeader()
+    {
+        m_headerPrinted = true;
+        if (m_csv)
+        {
+            printf("name,isa,best_ns,median_ns,gb_per_s,ref_cycles_per_pixel,iterations\n");
+            return;
+        }
+        printf("Compiled for %s\n", CompiledIsaLevel());
+        printf("%-34s %14s %14s %10s %10s\n", "benchmark", "best", "median", "GB/s", "cyc/px");
+    }
+
+    static std::string FormatTime(double ns)
+    {
+        char text[32];
+        if (ns < 1e3) snprintf(text, sizeof(text), "%.1f ns", ns);
+        else if (ns < 1e6) snprintf(text, sizeof(text), "%.2f us", ns / 1e3);
+        else snprintf(text, sizeof(text), "%.2f ms", ns / 1e6);
+        return text;
+    }
+
+    std::string m_filter;
+    double m_minSeconds = 0.5;
+    int m_repetitions = 5;
+    bool m_csv = false;
+    bool m_headerPrinted = false;
+    int m_count = 0;
+    uint64_t m_pausedNs = 0;
+    uint64_t m_pausedTicks = 0;
+    uint64_t m_pauseStartNs = 0;
+    uint64_t m_pauseStartTicks = 0;
+};
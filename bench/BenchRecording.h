@@ -0,0 +1,210 @@
+#pragma once
+//======================================================================================
+// BenchRecording.h
+// A whole recording for the benchmarks that need one rather than a single stage
+// (ControlBench, MetricsBench, WarmStartBench): the recorder's per-frame pipeline
+// without Windows. A synthetic desktop (SyntheticSource.h) stands in for the
+// duplication, followed by the pitched readback buffer, the NV12 conversion and
+// PcmH264Encoder (see its header), into whatever EncodedSink the benchmark gives
+// it: a muxer on a file, a ReplayBuffer.
+//
+// It runs the way Recorder::Record does. Prepare() sets up everything before the
+// first frame; Record() waits on a StartGate if it is given one, then records one
+// frame per interval (or back to back) until the gate is stopped or its frames are
+// in. Every stage is timed into PipelineStats and every frame counted in
+// HealthCounters, including time_to_first_frame_us: from the gate's Start(), or
+// without a gate from when the recording was created, as for a one-off recording.
+//
+//     BenchRecording recording(options);
+//     recording.Prepare();
+//     recording.GetSequenceHeader(header);   // for the muxer
+//     recording.Record(&muxer, &gate);       // on the capture thread
+//======================================================================================
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PcmH264Encoder.h"
+#include "../EncodedSink.h"
+#include "../HealthCounters.h"
+#include "../LatencyHistogram.h"
+#include "../PipelineStats.h"
+#include "../PixelKernels.h"
+#include "../StartGate.h"
+#include "../StartupTimer.h"
+#include "../SyntheticSource.h"
+#include "../TickClock.h"
+#include "../Trace.h"
+
+class BenchRecording
+{
+public:
+    // Called on the capture thread after each frame written, with its number.
+    typedef std::function<void(uint64_t frame, HealthCounters::Slot& health)> FrameHook;
+
+    struct Options
+    {
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        std::string workload = "scroll"; // SyntheticSource::ParseScenario
+        uint32_t fps = 30;
+        uint64_t frames = UINT64_MAX;    // At most; a stopped gate ends the recording sooner.
+        bool paced = true;               // One frame per interval; otherwise back to back.
+        LatencyHistogram* pLateness = nullptr; // How late each paced frame started.
+        FrameHook onFrameWritten;
+    };
+
+    explicit BenchRecording(const Options& options) : m_options(options) {}
+
+    BenchRecording(const BenchRecording&) = delete;
+    BenchRecording& operator=(const BenchRecording&) = delete;
+
+    //----------------------------------------------------------------------------------
+    // [BenchRecording::Prepare]
+    // Everything a recording sets up before its first frame: the source and what its
+    // first frame would allocate, the staging and NV12 buffers, the encoder.
+    //----------------------------------------------------------------------------------
+    void Prepare()
+    {
+        SyntheticSource::Options options;
+        SyntheticSource::ParseScenario(m_options.workload, options.scenario);
+        options.width = m_options.width;
+        options.height = m_options.height;
+        options.realTime = false;
+        m_pSource.reset(new SyntheticSource(options));
+        m_pSource->Prepare();
+
+        const uint32_t width = m_pSource->Width();
+        const uint32_t height = m_pSource->Height();
+        m_pitch = (static_cast<size_t>(width) * 4 + 255) / 256 * 256;
+        m_staging.assign(m_pitch * height, 0);
+        m_nv12.assign(PixelKernels::NV12Bytes(width, height), 0);
+        m_encoder.Initialize(width, height, GopLength(), 1);
+        m_startup.Mark("prepare");
+    }
+
+    // SPS and PPS, for sinks that write them up front.
+    void GetSequenceHeader(std::vector<uint8_t>& header) const { m_encoder.GetSequenceHeader(header); }
+
+    //----------------------------------------------------------------------------------
+    // [BenchRecording::Record]
+    // Records into 'pSink' on the calling thread, after Prepare(). With a gate, the
+    // first frame waits for its Start() and a Stop() ends the recording; false if it
+    // was stopped before it started.
+    //----------------------------------------------------------------------------------
+    bool Record(EncodedSink* pSink, StartGate* pGate = nullptr)
+    {
+        Trace::SetThreadName("capture");
+        HealthCounters::Slot* pHealth = m_health.RegisterThread();
+        TimedSink sink(pSink, m_stats);
+        if (pGate)
+        {
+            if (!pGate->WaitForStart())
+            {
+                return false;
+            }
+            m_startup.Mark("wait_for_start");
+        }
+
+        const uint32_t width = m_pSource->Width();
+        const uint32_t height = m_pSource->Height();
+        const uint32_t gop = GopLength();
+        const size_t lumaBytes = static_cast<size_t>(width) * height;
+        const ptrdiff_t chromaStride = static_cast<ptrdiff_t>((width + 1) / 2 * 2);
+        const int64_t duration = 10 * 1000 * 1000 / m_options.fps;
+        const uint64_t periodNs = 1000000000ull / m_options.fps;
+        const uint64_t startNs = TickClock::NowNs();
+        for (uint64_t i = 0; i < m_options.frames && !(pGate && pGate->StopRequested()); ++i)
+        {
+            if (m_options.paced)
+            {
+                const uint64_t dueNs = startNs + i * periodNs;
+                std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(dueNs)));
+                const uint64_t nowNs = TickClock::NowNs();
+                if (m_options.pLateness)
+                {
+                    m_options.pLateness->Record(nowNs > dueNs ? nowNs - dueNs : 0);
+                }
+            }
+
+            CaptureFrameInfo info;
+            MappedFrame mapped;
+            StageTimer acquire(m_stats, PipelineStage::Acquire);
+            const bool acquired = m_pSource->AcquireFrame(1000, info) == CaptureResult::Ok;
+            acquire.Stop();
+            if (!acquired)
+            {
+                pHealth->Add(HealthCounter::AcquireTimeouts);
+                continue;
+            }
+            {
+                StageTimer readback(m_stats, PipelineStage::Readback);
+                if (!m_pSource->MapFrame(mapped))
+                {
+                    m_pSource->ReleaseFrame();
+                    pHealth->Add(HealthCounter::ReadbackErrors);
+                    continue;
+                }
+                PixelKernels::CopyRows(m_staging.data(), static_cast<ptrdiff_t>(m_pitch), mapped.pPixels,
+                                       static_cast<ptrdiff_t>(mapped.stride), width, height);
+                m_pSource->ReleaseFrame();
+            }
+            pHealth->Add(HealthCounter::FramesCaptured);
+            {
+                StageTimer convert(m_stats, PipelineStage::Convert);
+                PixelKernels::BgraToNV12(m_staging.data(), static_cast<ptrdiff_t>(m_pitch), m_nv12.data(), width,
+                                         m_nv12.data() + lumaBytes, chromaStride, width, height);
+            }
+            if (i % gop == 0)
+            {
+                pHealth->Add(HealthCounter::KeyframesScheduled);
+            }
+            {
+                StageTimer submit(m_stats, PipelineStage::EncodeSubmit);
+                m_encoder.BeginPicture(false);
+                m_encoder.EncodeSlice(0, m_nv12.data(), width, m_nv12.data() + lumaBytes, chromaStride);
+                if (!m_encoder.FinishPicture(static_cast<int64_t>(i) * duration, duration, i, &sink))
+                {
+                    pHealth->Add(HealthCounter::WriteErrors);
+                }
+            }
+            pHealth->Add(HealthCounter::FramesWritten);
+            if (!m_firstFrameWritten)
+            {
+                // From the start command, or for a one-off recording from its creation.
+                m_firstFrameWritten = true;
+                m_startup.Mark("first_frame");
+                const uint64_t firstFrameUs = pGate ? (TickClock::NowNs() - pGate->StartNs()) / 1000
+                                                    : static_cast<uint64_t>(m_startup.TotalMs() * 1000.0);
+                pHealth->RaiseMax(HealthCounter::TimeToFirstFrameUs, firstFrameUs);
+            }
+            if (m_options.onFrameWritten)
+            {
+                m_options.onFrameWritten(i, *pHealth);
+            }
+        }
+        return true;
+    }
+
+    // Safe to call from any thread while recording.
+    HealthCounters::Snapshot Health() const { return m_health.Read(); }
+    const PipelineStats& Stats() const { return m_stats; }
+
+private:
+    uint32_t GopLength() const { return m_options.fps * 2; }
+
+    const Options m_options;
+    StartupTimer m_startup;
+    std::unique_ptr<SyntheticSource> m_pSource;
+    size_t m_pitch = 0;
+    std::vector<uint8_t> m_staging;
+    std::vector<uint8_t> m_nv12;
+    PcmH264Encoder m_encoder;
+    PipelineStats m_stats;
+    HealthCounters m_health;
+    bool m_firstFrameWritten = false;
+};
@@ -0,0 +1,366 @@
+//======================================================================================
+// CanvasBench.cpp
+// Stitching several monitors into one canvas (CanvasCompositor.h) for synthetic
+// monitor layouts: three 1080p side by side, a 4K monitor between a 1440p one and
+// a portrait one at different heights, and small monitors with gaps, odd offsets
+// and negative coordinates. Each layout is measured with every monitor redrawn,
+// with one large scrolling window, and with a few small rects per monitor (typing,
+// a blinking caret), on 1, 2 and 4 threads.
+//
+// Before timing, each layout is recorded through CanvasSource from synthetic
+// desktops of those sizes, and every canvas frame is checked against the
+// monitors' full images at their placements: gaps black, and the pointer mapped
+// into canvas coordinates. Since only dirty and moved rects are copied, a wrong
+// rect shows up as stale pixels. A mismatch fails the run.
+//
+// Build and run (from the repository root):
+//     g++ -O2 -std=c++17 -pthread -I. bench/CanvasBench.cpp -o canvas_bench
+//     ./canvas_bench [--filter mixed] [--csv]
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BenchHarness.h"
+#include "../CanvasCompositor.h"
+#include "../CanvasSource.h"
+#include "../SyntheticSource.h"
+
+namespace
+{
+    struct Layout
+    {
+        const char* pName;
+        std::vector<FrameRect> monitors; // Desktop coordinates.
+    };
+
+    std::vector<Layout> MakeLayouts()
+    {
+        return {
+            { "3x1080p", { { 0, 0, 1920, 1080 }, { 1920, 0, 3840, 1080 }, { 3840, 0, 5760, 1080 } } },
+            { "mixed", { { 0, 0, 3840, 2160 }, { -2560, 720, 0, 2160 }, { 3840, 240, 4920, 2160 } } },
+            { "gaps", { { 0, 0, 1920, 1080 }, { 2000, 57, 3280, 1081 }, { -1366, -300, 0, 468 } } },
+        };
+    }
+
+    const char* const Modes[] = { "full", "scroll", "typing" };
+    const uint32_t ThreadCounts[] = { 1, 2, 4 };
+
+    std::string CaseName(const Layout& layout, const char* pMode, uint32_t threads)
+    {
+        return std::string("canvas/") + layout.pName + "/" + pMode + "/t" + std::to_string(threads);
+    }
+
+    bool LayoutSelected(const BenchRunner& runner, const Layout& layout)
+    {
+        for (const char* pMode : Modes)
+        {
+            for (uint32_t threads : ThreadCounts)
+            {
+                if (runner.Matches(CaseName(layout, pMode, threads)))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    int32_t RectWidth(const FrameRect& rect) { return rect.right - rect.left; }
+    int32_t RectHeight(const FrameRect& rect) { return rect.bottom - rect.top; }
+
+    // Forwards to a synthetic desktop and keeps a copy of each frame it released, so
+    // the canvas can be compared with what the monitor last showed in full.
+    class RecordingSource : public CaptureSource
+    {
+    public:
+        explicit RecordingSource(const SyntheticSource::Options& options) :
+            m_source(options),
+            m_image(static_cast<size_t>(m_source.Width()) * m_source.Height() * 4)
+        {
+        }
+
+        uint32_t Width() const override { return m_source.Width(); }
+        uint32_t Height() const override { return m_source.Height(); }
+
+        CaptureResult AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info) override
+        {
+            const CaptureResult result = m_source.AcquireFrame(timeoutMs, info);
+            if (result == CaptureResult::Ok)
+            {
+                pointerUpdated = info.pointerUpdated;
+                pointerVisible = info.pointerVisible;
+                pointerX = info.pointerX;
+                pointerY = info.pointerY;
+            }
+            return result;
+        }
+
+        bool MapFrame(MappedFrame& mapped) override { return m_source.MapFrame(mapped); }
+
+        void ReleaseFrame() override
+        {
+            MappedFrame mapped;
+            if (m_source.MapFrame(mapped))
+            {
+                const size_t rowBytes = static_cast<size_t>(mapped.width) * 4;
+                for (uint32_t y = 0; y < mapped.height; ++y)
+                {
+                    memcpy(m_image.data() + y * rowBytes, mapped.pPixels + y * mapped.stride, rowBytes);
+                }
+            }
+            m_source.ReleaseFrame();
+        }
+
+        const std::vector<uint8_t>& Image() const { return m_image; }
+
+        // The pointer as of the last acquired frame.
+        bool pointerUpdated = false;
+        bool pointerVisible = false;
+        int32_t pointerX = 0;
+        int32_t pointerY = 0;
+
+    private:
+        SyntheticSource m_source;
+        std::vector<uint8_t> m_image;
+    };
+
+    //----------------------------------------------------------------------------------
+    // [VerifyLayout]
+    // Records a few dozen canvas frames of synthetic desktops laid out like 'layout'
+    // and checks each one. False on the first mismatch.
+    //----------------------------------------------------------------------------------
+    bool VerifyLayout(const Layout& layout)
+    {
+        static const SyntheticSource::Scenario Scenarios[] = { SyntheticSource::Scenario::ScrollingText,
+                                                              SyntheticSource::Scenario::WindowDrag,
+                                                              SyntheticSource::Scenario::Video };
+        std::vector<CanvasSource::Monitor> monitors;
+        std::vector<RecordingSource*> sources;
+        for (size_t i = 0; i < layout.monitors.size(); ++i)
+        {
+            SyntheticSource::Options options;
+            options.scenario = Scenarios[i % 3];
+            options.width = static_cast<uint32_t>(RectWidth(layout.monitors[i]));
+            options.height = static_cast<uint32_t>(RectHeight(layout.monitors[i]));
+            options.realTime = false;
+            options.seed = static_cast<uint32_t>(i + 1);
+            CanvasSource::Monitor monitor;
+            sources.push_back(new RecordingSource(options));
+            monitor.pSource.reset(sources.back());
+            monitor.left = layout.monitors[i].left;
+            monitor.top = layout.monitors[i].top;
+            monitors.push_back(std::move(monitor));
+        }
+        CanvasSource canvas;
+        if (!canvas.Open(std::move(monitors), 4))
+        {
+            fprintf(stderr, "%s: the layout was rejected\n", layout.pName);
+            return false;
+        }
+        const CanvasCompositor& compositor = canvas.Canvas();
+
+        // Which canvas pixels each monitor covers; the rest must stay black.
+        const uint32_t width = compositor.Width();
+        const uint32_t height = compositor.Height();
+        std::vector<int32_t> owner(static_cast<size_t>(width) * height, -1);
+        for (uint32_t m = 0; m < compositor.MonitorCount(); ++m)
+        {
+            const FrameRect& placement = compositor.Placement(m);
+            for (int32_t y = placement.top; y < placement.bottom; ++y)
+            {
+                for (int32_t x = placement.left; x < placement.right; ++x)
+                {
+                    owner[static_cast<size_t>(y) * width + x] = static_cast<int32_t>(m);
+                }
+            }
+        }
+
+        int32_t pointerMonitor = -1;
+        for (uint32_t frame = 0; frame < 40; ++frame)
+        {
+            for (RecordingSource* pSource : sources)
+            {
+                pSource->pointerUpdated = false; // Stays false unless acquired this time.
+            }
+            CaptureFrameInfo info;
+            if (canvas.AcquireFrame(100, info) != CaptureResult::Ok)
+            {
+                fprintf(stderr, "%s: frame %u was not acquired\n", layout.pName, frame);
+                return false;
+            }
+            for (uint32_t i = 0; i < info.dirtyRectCount; ++i)
+            {
+                const FrameRect& rect = info.pDirtyRects[i];
+                if (rect.left < 0 || rect.top < 0 || rect.right > static_cast<int32_t>(width) ||
+                    rect.bottom > static_cast<int32_t>(height) || rect.right <= rect.left || rect.bottom <= rect.top)
+                {
+                    fprintf(stderr, "%s: frame %u reports dirty rect %d,%d-%d,%d outside the canvas\n", layout.pName,
+                            frame, rect.left, rect.top, rect.right, rect.bottom);
+                    return false;
+                }
+            }
+
+            MappedFrame mapped;
+            if (!canvas.MapFrame(mapped) || mapped.width != width || mapped.height != height)
+            {
+                fprintf(stderr, "%s: frame %u could not be mapped\n", layout.pName, frame);
+                return false;
+            }
+            for (uint32_t y = 0; y < height; ++y)
+            {
+                const uint8_t* pRow = mapped.pPixels + y * mapped.stride;
+                for (uint32_t x = 0; x < width; ++x)
+                {
+                    const int32_t m = owner[static_cast<size_t>(y) * width + x];
+                    static const uint8_t Black[4] = { 0, 0, 0, 0xFF };
+                    const uint8_t* pExpected = Black;
+                    if (m >= 0)
+                    {
+                        const FrameRect& placement = compositor.Placement(static_cast<uint32_t>(m));
+                        const size_t monitorWidth = static_cast<size_t>(RectWidth(placement));
+                        pExpected = sources[m]->Image().data() +
+                                    ((y - placement.top) * monitorWidth + (x - placement.left)) * 4;
+                    }
+                    if (memcmp(pRow + x * 4, pExpected, 4) != 0)
+                    {
+                        fprintf(stderr, "%s: frame %u differs at canvas pixel (%u, %u), monitor %d\n", layout.pName,
+                                frame, x, y, m);
+                        return false;
+                    }
+                }
+            }
+
+            for (size_t m = 0; m < sources.size(); ++m)
+            {
+                if (sources[m]->pointerUpdated && sources[m]->pointerVisible)
+                {
+                    pointerMonitor = static_cast<int32_t>(m);
+                }
+            }
+            if (pointerMonitor >= 0)
+            {
+                const FrameRect& placement = compositor.Placement(static_cast<uint32_t>(pointerMonitor));
+                const int32_t x = sources[pointerMonitor]->pointerX + placement.left;
+                const int32_t y = sources[pointerMonitor]->pointerY + placement.top;
+                if (!info.pointerVisible || info.pointerX != x || info.pointerY != y)
+                {
+                    fprintf(stderr, "%s: frame %u puts the pointer at (%d, %d) instead of (%d, %d)\n", layout.pName,
+                            frame, info.pointerX, info.pointerY, x, y);
+                    return false;
+                }
+            }
+            canvas.ReleaseFrame();
+        }
+        return true;
+    }
+
+    // Desktop-like content, different for every monitor.
+    void FillPattern(std::vector<uint8_t>& buffer, uint32_t width, uint32_t height, uint32_t seed)
+    {
+        uint32_t state = seed * 2654435761u + 1;
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                uint8_t* pPixel = buffer.data() + (static_cast<size_t>(y) * width + x) * 4;
+                state = state * 1664525u + 1013904223u;
+                pPixel[0] = static_cast<uint8_t>(x + (state >> 28));
+                pPixel[1] = static_cast<uint8_t>(y + (state >> 29));
+                pPixel[2] = static_cast<uint8_t>((x ^ y) + seed);
+                pPixel[3] = 0xFF;
+            }
+        }
+    }
+
+    void RunLayout(BenchRunner& runner, const Layout& layout)
+    {
+        std::vector<std::vector<uint8_t>> images(layout.monitors.size());
+        std::vector<std::vector<FrameRect>> scrollRects(layout.monitors.size());
+        std::vector<std::vector<FrameRect>> typingRects(layout.monitors.size());
+        for (size_t m = 0; m < layout.monitors.size(); ++m)
+        {
+            const uint32_t width = static_cast<uint32_t>(RectWidth(layout.monitors[m]));
+            const uint32_t height = static_cast<uint32_t>(RectHeight(layout.monitors[m]));
+            images[m].resize(static_cast<size_t>(width) * height * 4);
+            FillPattern(images[m], width, height, static_cast<uint32_t>(m + 1));
+
+            // A browser window scrolling on the first monitor, most of its height.
+            const int32_t w = static_cast<int32_t>(width);
+            const int32_t h = static_cast<int32_t>(height);
+            if (m == 0)
+            {
+                scrollRects[m].push_back(FrameRect{ w / 5, h / 10, w * 4 / 5, h * 9 / 10 });
+            }
+            // A few words typed and a caret blinking on every monitor.
+            for (int32_t i = 0; i < 6; ++i)
+            {
+                const int32_t left = (w / 7) * (i + 1) - 48;
+                const int32_t top = (h / 8) * (i + 1);
+                typingRects[m].push_back(FrameRect{ left, top, left + 96, top + 20 });
+            }
+            typingRects[m].push_back(FrameRect{ w / 2, h / 2, w / 2 + 2, h / 2 + 20 });
+        }
+
+        // Null: whole monitors.
+        const std::vector<std::vector<FrameRect>>* const modeRects[] = { nullptr, &scrollRects, &typingRects };
+        for (size_t mode = 0; mode < sizeof(Modes) / sizeof(Modes[0]); ++mode)
+        {
+            const std::vector<std::vector<FrameRect>>* pModeRects = modeRects[mode];
+            for (uint32_t threads : ThreadCounts)
+            {
+                const std::string name = CaseName(layout, Modes[mode], threads);
+                if (!runner.Matches(name))
+                {
+                    continue;
+                }
+                CanvasCompositor canvas;
+                canvas.Configure(layout.monitors, threads);
+                uint64_t pixels = 0;
+                for (size_t m = 0; m < layout.monitors.size(); ++m)
+                {
+                    if (!pModeRects)
+                    {
+                        pixels += static_cast<uint64_t>(RectWidth(layout.monitors[m])) * RectHeight(layout.monitors[m]);
+                        continue;
+                    }
+                    for (const FrameRect& rect : (*pModeRects)[m])
+                    {
+                        pixels += static_cast<uint64_t>(RectWidth(rect)) * RectHeight(rect);
+                    }
+                }
+                // Every copied pixel is read once and written once.
+                runner.Run(name, pixels * 8, pixels, [&] {
+                    for (size_t m = 0; m < layout.monitors.size(); ++m)
+                    {
+                        const size_t stride = static_cast<size_t>(RectWidth(layout.monitors[m])) * 4;
+                        const std::vector<FrameRect>* pRects = pModeRects ? &(*pModeRects)[m] : nullptr;
+                        canvas.AddFrame(static_cast<uint32_t>(m), images[m].data(), stride,
+                                        pRects ? pRects->data() : nullptr, pRects ? static_cast<uint32_t>(pRects->size()) : 0);
+                    }
+                    DoNotOptimize(canvas.Compose().size());
+                    ClobberMemory();
+                });
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchRunner runner(argc, argv);
+    bool ok = true;
+    for (const Layout& layout : MakeLayouts())
+    {
+        if (LayoutSelected(runner, layout))
+        {
+            ok = VerifyLayout(layout) && ok;
+            RunLayout(runner, layout);
+        }
+    }
+    const int result = runner.Finish();
+    return ok ? result : 1;
+}
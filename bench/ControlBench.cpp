@@ -0,0 +1,519 @@
+//======================================================================================
+// ControlBench.cpp
+// The --daemon control socket, end to end on one machine: a recording parked on a
+// StartGate, a ControlServer on a Unix domain socket in front of it, and clients
+// driving it with the requests of ControlProtocol.h while it records.
+//
+// The recording is BenchRecording (see its header) on its own thread, paced at
+// --fps, into a ReplayBuffer keeping the last --replay-seconds. The requests are
+// handled by ServeDaemon() (DaemonControl.h), the code that handles them in the
+// recorder: the server queues them on a CommandQueue and the daemon's thread
+// answers from what the recording publishes, so requests never run on the capture
+// thread. The daemon's options are parsed
+// from a recorder command line without --duration (RecorderOptions.h), so the
+// recording must still be going past the 5 s --duration default.
+//
+// One client walks through start, mark, save-replay, query-stats, stop and quit,
+// in JSON and in bare words, and sends requests that must be refused (unknown or
+// malformed ones, a start while recording, an over-long line). A second one sends
+// query-stats back to back meanwhile. The saved replay must be MPEG-TS, start at
+// an IDR picture and cover the window.
+//
+// Reported: request round trip p50, p99 and max under that load, and how late the
+// capture thread started its frames. The run fails (exit code 1) if a response is
+// wrong, the replay is, or the capture lateness p99 exceeds one frame interval.
+//
+// Build and run (from the repository root, on Linux):
+//     g++ -O2 -std=c++17 -pthread -I. bench/ControlBench.cpp -o control_bench
+//     ./control_bench --size 1280x720 --fps 30 --seconds 6 --replay-seconds 3
+//======================================================================================
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "BenchRecording.h"
+#include "../ControlProtocol.h"
+#include "../ControlServer.h"
+#include "../DaemonControl.h"
+#include "../HealthCounters.h"
+#include "../LatencyHistogram.h"
+#include "../RecorderOptions.h"
+#include "../ReplayBuffer.h"
+#include "../StartGate.h"
+#include "../SyntheticSource.h"
+#include "../TickClock.h"
+
+namespace
+{
+    struct Settings
+    {
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        std::string workload = "scroll";
+        uint32_t fps = 30;
+        uint32_t seconds = 6;
+        uint32_t replaySeconds = 3;
+        std::string socketPath = "/tmp/control_bench.sock";
+        std::string directory = "/tmp";
+        bool json = false;
+    };
+
+    [[noreturn]] void Usage(const char* pProgram)
+    {
+        fprintf(stderr,
+                "Usage: %s [--size <W>x<H>] [--workload static|scroll|video|drag] [--fps <n>] [--seconds <n>]\n"
+                "          [--replay-seconds <n>] [--socket <path>] [--dir <path>] [--json]\n",
+                pProgram);
+        exit(2);
+    }
+
+    Settings ParseSettings(int argc, char** argv)
+    {
+        Settings settings;
+        // Digits only (ParseDigits in RecorderOptions.h): atoi() would take "-1" as 2^32 - 1.
+        auto number = [&](const char* pValue, uint32_t& value)
+        {
+            const char* pEnd = nullptr;
+            if (!ParseDigits(pValue, pEnd, value) || *pEnd != '\0') Usage(argv[0]);
+        };
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+            if (arg == "--size" && hasValue)
+            {
+                const char* pEnd = nullptr;
+                if (!ParseDigits(argv[++i], pEnd, settings.width) || *pEnd != 'x' ||
+                    !ParseDigits(pEnd + 1, pEnd, settings.height) || *pEnd != '\0' || settings.width < 64 ||
+                    settings.height < 64)
+                {
+                    Usage(argv[0]);
+                }
+            }
+            else if (arg == "--workload" && hasValue) settings.workload = argv[++i];
+            else if (arg == "--fps" && hasValue) number(argv[++i], settings.fps);
+            else if (arg == "--seconds" && hasValue) number(argv[++i], settings.seconds);
+            else if (arg == "--replay-seconds" && hasValue) number(argv[++i], settings.replaySeconds);
+            else if (arg == "--socket" && hasValue) settings.socketPath = argv[++i];
+            else if (arg == "--dir" && hasValue) settings.directory = argv[++i];
+            else if (arg == "--json") settings.json = true;
+            else Usage(argv[0]);
+        }
+        SyntheticSource::Scenario scenario;
+        if (settings.fps < 1 || settings.fps > 240 || settings.replaySeconds < 1 ||
+            settings.seconds <= settings.replaySeconds || settings.seconds <= 5 ||
+            !SyntheticSource::ParseScenario(settings.workload, scenario))
+        {
+            Usage(argv[0]);
+        }
+        return settings;
+    }
+
+    //==================================================================================
+    // Recording
+    // One recording of the daemon (DaemonRecorder in DaemonControl.h): BenchRecording
+    // (see its header) into a ReplayBuffer, paced at the options' fps and parked on
+    // the gate until started. How late each frame started goes to 'lateness', which
+    // outlives the recording.
+    //==================================================================================
+    class Recording : public DaemonRecorder
+    {
+    public:
+        Recording(const Settings& settings, const RecorderOptions& options, LatencyHistogram& lateness)
+            : m_replaySeconds(options.replaySeconds), m_recording(Options(settings, options, lateness))
+        {
+        }
+
+        bool Prepare() override
+        {
+            m_recording.Prepare();
+            std::vector<uint8_t> sequenceHeader;
+            m_recording.GetSequenceHeader(sequenceHeader);
+            m_replay.Start(m_replaySeconds);
+            m_replay.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+            return true;
+        }
+
+        Result Record(StartGate& gate) override
+        {
+            return m_recording.Record(&m_replay, &gate) ? Result::Recorded : Result::Cancelled;
+        }
+
+        HealthCounters::Snapshot Health() const override { return m_recording.Health(); }
+
+        bool SaveReplay(const std::string& path, ReplayBuffer::Saved& saved, std::string& error) override
+        {
+            return m_replay.Save(path, saved, error);
+        }
+
+        // Only the replay is written, and only once started.
+        void Discard() override {}
+
+    private:
+        static BenchRecording::Options Options(const Settings& settings, const RecorderOptions& options,
+                                               LatencyHistogram& lateness)
+        {
+            BenchRecording::Options recording;
+            recording.width = settings.width;
+            recording.height = settings.height;
+            recording.workload = settings.workload;
+            recording.fps = options.fps;
+            recording.frames = options.FramesToRecord();
+            recording.pLateness = &lateness;
+            return recording;
+        }
+
+        const uint32_t m_replaySeconds;
+        ReplayBuffer m_replay;
+        BenchRecording m_recording;
+    };
+
+    //==================================================================================
+    // Client
+    // One connection to the control socket, one request at a time.
+    //==================================================================================
+    class Client
+    {
+    public:
+        ~Client()
+        {
+            if (m_socket >= 0)
+            {
+                close(m_socket);
+            }
+        }
+
+        bool Connect(const std::string& path)
+        {
+            m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+            return m_socket >= 0 && connect(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        }
+
+        // Sends 'line' and returns the response line; empty if the connection ended.
+        std::string Request(const std::string& line)
+        {
+            const std::string message = line + "\n";
+            if (send(m_socket, message.data(), message.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(message.size()))
+            {
+                return std::string();
+            }
+            return ReadLine();
+        }
+
+        std::string ReadLine()
+        {
+            for (;;)
+            {
+                const size_t end = m_pending.find('\n');
+                if (end != std::string::npos)
+                {
+                    const std::string response = m_pending.substr(0, end);
+                    m_pending.erase(0, end + 1);
+                    return response;
+                }
+                char buffer[512];
+                const ssize_t received = recv(m_socket, buffer, sizeof(buffer), 0);
+                if (received <= 0)
+                {
+                    return std::string();
+                }
+                m_pending.append(buffer, static_cast<size_t>(received));
+            }
+        }
+
+    private:
+        int m_socket = -1;
+        std::string m_pending;
+    };
+
+    bool IsOk(const std::string& response)
+    {
+        return response.compare(0, 10, "{\"ok\":true") == 0;
+    }
+
+    bool IsError(const std::string& response)
+    {
+        return response.compare(0, 19, "{\"ok\":false,\"error\"") == 0;
+    }
+
+    // A number member of a flat response; -1 if it isn't there.
+    double NumberMember(const std::string& response, const char* pName)
+    {
+        const std::string key = std::string("\"") + pName + "\":";
+        const size_t at = response.find(key);
+        return at == std::string::npos ? -1.0 : atof(response.c_str() + at + key.size());
+    }
+
+    //----------------------------------------------------------------------------------
+    // CheckReplay
+    // MPEG-TS packets from the first byte on, and an IDR slice before any other.
+    //----------------------------------------------------------------------------------
+    bool CheckReplay(const std::string& path, std::string& problem)
+    {
+        std::ifstream file(path, std::ios::binary);
+        const std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (bytes.empty() || bytes.size() % 188 != 0)
+        {
+            problem = "not a whole number of TS packets";
+            return false;
+        }
+        for (size_t i = 0; i < bytes.size(); i += 188)
+        {
+            if (bytes[i] != 0x47)
+            {
+                problem = "lost TS sync";
+                return false;
+            }
+        }
+        for (size_t i = 0; i + 3 < bytes.size(); ++i)
+        {
+            if (bytes[i] == 0 && bytes[i + 1] == 0 && bytes[i + 2] == 1)
+            {
+                const unsigned type = bytes[i + 3] & 0x1F;
+                if (type == 5)
+                {
+                    return true;
+                }
+                if (type == 1)
+                {
+                    problem = "starts with a non-IDR picture";
+                    return false;
+                }
+            }
+        }
+        problem = "no IDR picture";
+        return false;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const Settings settings = ParseSettings(argc, argv);
+    std::vector<std::string> failures;
+    auto expect = [&](bool condition, const std::string& what, const std::string& response)
+    {
+        if (!condition)
+        {
+            failures.push_back(what + ": " + (response.empty() ? std::string("(no response)") : response));
+        }
+    };
+
+    // The daemon this bench stands in for, as it would be started: no --duration.
+    const std::vector<std::string> daemonArgs = {
+        "--daemon", "--source", "synthetic:" + settings.workload, "--sink", "ts", "--fps", std::to_string(settings.fps),
+        "--output", settings.directory + "/control_bench.ts", "--control", settings.socketPath,
+        "--replay-seconds", std::to_string(settings.replaySeconds)};
+    RecorderOptions options;
+    std::string error;
+    if (!ParseRecorderOptions(daemonArgs, options, error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    Log::Logger::Instance().SetConsoleOutput(false); // The daemon's log lines would mix with the report.
+    const std::string recordingPath = PathForRecording(options.outputPath, 1);
+    const std::string marksPath = recordingPath + ".marks";
+
+    // The control socket in front of ServeDaemon(), which runs on a thread of its own
+    // here instead of the recorder's main thread.
+    CommandQueue commands;
+    ControlServer server;
+    if (!server.Start(settings.socketPath, [&commands](const ControlRequest& request) { return commands.Submit(request); },
+                      error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    LatencyHistogram frameLateness;
+    bool daemonSucceeded = false;
+    std::thread daemon([&]()
+    {
+        daemonSucceeded = ServeDaemon(options, commands, [&](const RecorderOptions& recordingOptions)
+        {
+            return std::unique_ptr<DaemonRecorder>(new Recording(settings, recordingOptions, frameLateness));
+        });
+        commands.Close();
+    });
+
+    Client client;
+    if (!client.Connect(settings.socketPath))
+    {
+        fprintf(stderr, "Could not connect to %s\n", settings.socketPath.c_str());
+        commands.SubmitLine("quit");
+        daemon.join();
+        return 1;
+    }
+
+    // Before the start, once the recording is set up.
+    std::string response;
+    for (int i = 0; i < 1000; ++i)
+    {
+        response = client.Request("{\"cmd\":\"query-stats\"}");
+        if (response.find("\"state\":\"preparing\"") == std::string::npos)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    expect(IsOk(response) && response.find("\"state\":\"ready\"") != std::string::npos, "query-stats when ready",
+           response);
+    response = client.Request("{\"cmd\":\"stop\"}");
+    expect(IsError(response), "stop before start", response);
+    response = client.Request("{\"cmd\":\"rewind\"}");
+    expect(IsError(response), "unknown command", response);
+    response = client.Request("{\"cmd\":\"start\"");
+    expect(IsError(response), "malformed request", response);
+    response = client.Request("{\"label\":\"x\"}");
+    expect(IsError(response), "request without cmd", response);
+
+    response = client.Request("{\"cmd\":\"start\",\"id\":7}");
+    expect(IsOk(response), "start", response);
+    response = client.Request("start");
+    expect(IsError(response), "second start", response);
+
+    // A second client asks for stats back to back while the first one marks.
+    LatencyHistogram roundTrips;
+    std::atomic<bool> hammering(true);
+    std::atomic<uint64_t> badStats(0);
+    std::thread hammer([&]()
+    {
+        Client stats;
+        if (!stats.Connect(settings.socketPath))
+        {
+            badStats = 1;
+            return;
+        }
+        while (hammering.load())
+        {
+            const uint64_t sentNs = TickClock::NowNs();
+            const std::string answer = stats.Request("query-stats");
+            roundTrips.Record(TickClock::NowNs() - sentNs);
+            if (!IsOk(answer) || answer.find("\"frames_written\":") == std::string::npos)
+            {
+                badStats.fetch_add(1);
+            }
+        }
+    });
+
+    const uint32_t marks = settings.seconds * 2;
+    double lastMarkSeconds = -1.0;
+    bool marksInOrder = true;
+    for (uint32_t i = 0; i < marks; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        response = (i % 2) ? client.Request("mark lap " + std::to_string(i))
+                           : client.Request("{\"cmd\":\"mark\",\"label\":\"lap \\\"" + std::to_string(i) + "\\\"\"}");
+        expect(IsOk(response), "mark", response);
+        const double markSeconds = NumberMember(response, "seconds");
+        marksInOrder = marksInOrder && markSeconds >= lastMarkSeconds;
+        lastMarkSeconds = markSeconds;
+    }
+    expect(marksInOrder, "marks in recording order", response);
+
+    // Past the --duration default, a daemon recording without one is still going.
+    response = client.Request("query-stats");
+    expect(IsOk(response) && response.find("\"state\":\"recording\"") != std::string::npos &&
+               NumberMember(response, "seconds") > 5.0 + 1.0 / settings.fps,
+           "still recording past the 5 s --duration default", response);
+
+    const std::string replayPath = settings.directory + "/control_bench-saved.ts";
+    response = client.Request("{\"cmd\":\"save-replay\",\"path\":\"" + replayPath + "\"}");
+    expect(IsOk(response), "save-replay", response);
+    const double replayFrames = NumberMember(response, "frames");
+    const double replaySeconds = NumberMember(response, "seconds");
+    // At least the window, plus at most one GOP (2 s, see Recording::Record).
+    expect(replaySeconds >= settings.replaySeconds && replaySeconds <= settings.replaySeconds + 2.0,
+           "replay covers the window", response);
+    std::string problem;
+    expect(CheckReplay(replayPath, problem), "replay file", problem);
+    response = client.Request("save-replay");
+    const std::string defaultReplayPath = PathForReplay(recordingPath, 2);
+    expect(IsOk(response) && response.find(defaultReplayPath) != std::string::npos, "save-replay default", response);
+
+    hammering = false;
+    hammer.join();
+    expect(badStats.load() == 0, "query-stats from the second client", std::to_string(badStats.load()) + " bad");
+
+    // A line that never ends costs the client its connection, nobody else's.
+    {
+        Client greedy;
+        const std::string line(ControlProtocol::MaxLineBytes + 100, 'x');
+        response = greedy.Connect(settings.socketPath) ? greedy.Request(line) : std::string();
+        expect(IsError(response), "over-long line", response);
+        expect(greedy.ReadLine().empty(), "over-long line disconnects", std::string());
+    }
+
+    response = client.Request("{\"cmd\":\"stop\"}");
+    expect(IsOk(response) && NumberMember(response, "frames") > 0, "stop", response);
+    const double recordedFrames = NumberMember(response, "frames");
+    response = client.Request("mark too late");
+    expect(IsError(response), "mark after stop", response);
+    // The next recording is set up straight away.
+    response = client.Request("query-stats");
+    expect(IsOk(response) && response.find("\"recordings\":1") != std::string::npos &&
+               response.find(PathForRecording(options.outputPath, 2)) != std::string::npos,
+           "next recording after stop", response);
+    response = client.Request("quit");
+    expect(IsOk(response), "quit", response);
+    daemon.join();
+    expect(daemonSucceeded, "daemon result", std::string());
+    server.Stop();
+
+    std::ifstream marksFile(marksPath);
+    uint32_t markLines = 0;
+    for (std::string line; std::getline(marksFile, line); )
+    {
+        markLines += (line.find("\tlap ") != std::string::npos) ? 1 : 0;
+    }
+    expect(markLines == marks, "marks file", std::to_string(markLines) + " lines");
+    remove(replayPath.c_str());
+    remove(defaultReplayPath.c_str());
+    remove(marksPath.c_str());
+
+    const LatencyHistogram::Summary rtt = roundTrips.Summarize();
+    const LatencyHistogram::Summary lateness = frameLateness.Summarize();
+    const uint64_t periodNs = 1000000000ull / settings.fps;
+    const bool passed = failures.empty() && lateness.p99 <= periodNs;
+
+    if (settings.json)
+    {
+        printf("{\"width\":%u,\"height\":%u,\"workload\":\"%s\",\"fps\":%u,\"seconds\":%u,\"replay_seconds\":%u,"
+               "\"requests\":%llu,\"rtt_p50_us\":%.1f,\"rtt_p99_us\":%.1f,\"rtt_max_us\":%.1f,"
+               "\"capture_late_p99_ms\":%.3f,\"capture_late_max_ms\":%.3f,\"frame_interval_ms\":%.3f,"
+               "\"frames\":%.0f,\"replay_frames\":%.0f,\"replay_seconds_saved\":%.3f,\"failures\":%zu,\"passed\":%s}\n",
+               settings.width, settings.height, settings.workload.c_str(), settings.fps, settings.seconds,
+               settings.replaySeconds, static_cast<unsigned long long>(server.RequestsServed()), rtt.p50 / 1e3,
+               rtt.p99 / 1e3, rtt.max / 1e3, lateness.p99 / 1e6, lateness.max / 1e6, periodNs / 1e6, recordedFrames,
+               replayFrames, replaySeconds, failures.size(), passed ? "true" : "false");
+        return passed ? 0 : 1;
+    }
+
+    printf("%ux%u %s at %u fps for about %u s, replay window %u s\n", settings.width, settings.height,
+           settings.workload.c_str(), settings.fps, settings.seconds, settings.replaySeconds);
+    printf("requests: %llu served, round trip p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           static_cast<unsigned long long>(server.RequestsServed()), rtt.p50 / 1e3, rtt.p99 / 1e3, rtt.max / 1e3);
+    printf("recording: %.0f frames; replay %.0f frames, %.3f s\n", recordedFrames, replayFrames, replaySeconds);
+    for (const std::string& failure : failures)
+    {
+        printf("FAILED %s\n", failure.c_str());
+    }
+    printf("capture lateness p99 %.3f ms (max %.3f ms) against a %.3f ms frame interval -> %s\n", lateness.p99 / 1e6,
+           lateness.max / 1e6, periodNs / 1e6, passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,373 @@
+//======================================================================================
+// FileWriterBench.cpp
+// Runs FileWriter against a slow disk and measures what the producer - the capture
+// thread in the recorder - feels of it.
+//
+// The slow disk is this program's own pwrite() and fdatasync(), which FileWriter's
+// calls resolve to: each write is throttled to --disk-mbps, and on the scenario's
+// schedule a write blocks for a while (a stall) or a sync fails. The producer
+// writes --frame-kb frames at --fps, like the raw sink, and times every Write().
+// Each scenario checks that:
+//
+//   - with write-behind, stalls the buffer pool can absorb never hold up the
+//     producer for a frame interval, with or without periodic fsync;
+//   - a stall longer than the pool holds the producer up for no more than the
+//     stall itself;
+//   - without write-behind the producer pays for every stall (which shows the
+//     stalls are really injected);
+//   - every frame ends up in the file intact, and a failing periodic fsync fails
+//     the writes that follow it as well as Close().
+//
+// Reported per scenario: sustained throughput, producer wait p50, p99 and max,
+// the slowest disk write and the writer's own wait count. The last scenario
+// writes unpaced to measure sustained throughput through the stalls. Any
+// violation is printed and the run exits with 1.
+//
+// Build and run (from the repository root, on Linux):
+//     g++ -O2 -std=c++17 -pthread -I. bench/FileWriterBench.cpp -o file_writer_bench
+//     ./file_writer_bench [--seconds 4] [--dir /var/tmp] [--json]
+//======================================================================================
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../FileWriter.h"
+#include "../LatencyHistogram.h"
+#include "../TickClock.h"
+
+namespace
+{
+    //==================================================================================
+    // SlowDisk
+    // The schedule the interposed pwrite()/fdatasync() follow. Set before a file is
+    // opened; read by the writer thread.
+    //==================================================================================
+    struct SlowDisk
+    {
+        uint32_t mbps = 0;          // Bandwidth limit; 0 for none.
+        uint32_t stallMs = 0;       // How long a stall blocks the write it hits.
+        uint32_t stallEveryMs = 0;  // Time between stalls; 0 for a single one.
+        uint32_t firstStallMs = 0;  // When the first stall comes, from Arm().
+        uint32_t syncMs = 0;        // Added to every fdatasync().
+        bool failSync = false;      // fdatasync() fails with EIO.
+
+        std::atomic<bool> armed{ false };
+        uint64_t nextStallNs = 0;
+
+        void Arm()
+        {
+            nextStallNs = stallMs ? TickClock::NowNs() + firstStallMs * 1000000ull : 0;
+            armed = true;
+        }
+    };
+
+    SlowDisk g_disk;
+
+    void SleepMs(double ms)
+    {
+        if (ms > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(ms * 1000)));
+        }
+    }
+}
+
+// FileWriter's writes and syncs end up here (see the file comment).
+extern "C" ssize_t pwrite(int fd, const void* pData, size_t size, off_t offset)
+{
+    if (g_disk.armed.load())
+    {
+        const uint64_t now = TickClock::NowNs();
+        if (g_disk.nextStallNs && now >= g_disk.nextStallNs)
+        {
+            SleepMs(g_disk.stallMs);
+            g_disk.nextStallNs = g_disk.stallEveryMs ? now + g_disk.stallEveryMs * 1000000ull : 0;
+        }
+        if (g_disk.mbps)
+        {
+            SleepMs(static_cast<double>(size) / (g_disk.mbps * 1000.0));
+        }
+    }
+    return syscall(SYS_pwrite64, fd, pData, size, offset);
+}
+
+extern "C" int fdatasync(int fd)
+{
+    if (g_disk.armed.load())
+    {
+        SleepMs(g_disk.syncMs);
+        if (g_disk.failSync)
+        {
+            errno = EIO;
+            return -1;
+        }
+    }
+    return static_cast<int>(syscall(SYS_fdatasync, fd));
+}
+
+namespace
+{
+    struct Settings
+    {
+        uint32_t fps = 60;
+        uint32_t frameKb = 1024;
+        uint32_t seconds = 4;
+        uint32_t diskMbps = 400;
+        std::string directory = ".";
+        bool json = false;
+    };
+
+    [[noreturn]] void Usage(const char* pProgram)
+    {
+        fprintf(stderr,
+                "Usage: %s [--fps <n>] [--frame-kb <n>] [--seconds <n>] [--disk-mbps <n>] [--dir <path>] [--json]\n",
+                pProgram);
+        exit(2);
+    }
+
+    Settings ParseSettings(int argc, char** argv)
+    {
+        Settings settings;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+            if (arg == "--fps" && hasValue) settings.fps = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--frame-kb" && hasValue) settings.frameKb = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--seconds" && hasValue) settings.seconds = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--disk-mbps" && hasValue) settings.diskMbps = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--dir" && hasValue) settings.directory = argv[++i];
+            else if (arg == "--json") settings.json = true;
+            else Usage(argv[0]);
+        }
+        if (settings.fps < 1 || settings.frameKb < 1 || settings.seconds < 2)
+        {
+            Usage(argv[0]);
+        }
+        return settings;
+    }
+
+    // What is expected of the producer's waits.
+    enum class Bound
+    {
+        UnderFrame,   // Max wait below one frame interval.
+        UnderStall,   // Max wait no longer than the stall (plus a frame).
+        PaysStall,    // Max wait at least most of the stall.
+        Unpaced,      // Only throughput is reported.
+    };
+
+    struct Scenario
+    {
+        const char* pName;
+        bool writeBehind;
+        uint32_t stallMs;
+        uint32_t stallEveryMs;
+        uint32_t syncMs;
+        bool periodicSync;
+        bool failSync;
+        Bound bound;
+    };
+
+    struct Result
+    {
+        LatencyHistogram::Summary waits;
+        double mbps = 0.0;
+        FileWriter::Stats io;
+        uint64_t frames = 0;
+        bool closed = false;
+        bool intact = false;
+    };
+
+    //----------------------------------------------------------------------------------
+    // Run
+    // Writes frames at the scenario's pace (or unpaced) and checks the file.
+    //----------------------------------------------------------------------------------
+    Result Run(const Settings& settings, const Scenario& scenario, const std::string& path)
+    {
+        const size_t frameBytes = static_cast<size_t>(settings.frameKb) * 1024;
+        FileWriter::Options options;
+        options.writeBehind = scenario.writeBehind;
+        if (scenario.periodicSync)
+        {
+            options.syncPolicy = SyncPolicy::Periodic;
+            options.syncIntervalBytes = 2 * options.bufferSize;
+        }
+
+        g_disk.mbps = settings.diskMbps;
+        g_disk.stallMs = scenario.stallMs;
+        g_disk.stallEveryMs = scenario.stallEveryMs;
+        g_disk.firstStallMs = 500;
+        g_disk.syncMs = scenario.syncMs;
+        g_disk.failSync = scenario.failSync;
+
+        Result result;
+        FileWriter writer;
+        if (!writer.Open(path, options))
+        {
+            return result;
+        }
+        g_disk.Arm();
+
+        LatencyHistogram waits;
+        std::vector<uint8_t> frame(frameBytes);
+        const bool paced = scenario.bound != Bound::Unpaced;
+        const uint64_t periodNs = 1000000000ull / settings.fps;
+        const uint64_t frames = paced ? static_cast<uint64_t>(settings.seconds) * settings.fps
+                                      : static_cast<uint64_t>(settings.seconds) * settings.diskMbps * 1000000ull / frameBytes;
+        const uint64_t startNs = TickClock::NowNs();
+        for (uint64_t i = 0; i < frames; ++i)
+        {
+            if (paced)
+            {
+                std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+                    std::chrono::nanoseconds(startNs + i * periodNs)));
+            }
+            memset(frame.data(), static_cast<int>(i & 0xFF), frameBytes);
+            memcpy(frame.data(), &i, sizeof(i));
+            const uint64_t beforeNs = TickClock::NowNs();
+            const bool written = writer.Write(frame.data(), frameBytes);
+            waits.Record(TickClock::NowNs() - beforeNs);
+            if (!written)
+            {
+                break;
+            }
+            ++result.frames;
+        }
+        result.closed = writer.Close();
+        const double seconds = (TickClock::NowNs() - startNs) / 1e9;
+        g_disk.armed = false;
+
+        result.waits = waits.Summarize();
+        result.io = writer.GetStats();
+        result.mbps = result.io.bytesWritten / 1e6 / seconds;
+
+        // Every frame in place: its number at the start, its fill byte at the end.
+        result.intact = result.frames == frames;
+        FILE* pFile = fopen(path.c_str(), "rb");
+        for (uint64_t i = 0; pFile && result.intact && i < frames; ++i)
+        {
+            uint64_t number = 0;
+            uint8_t last = 0;
+            result.intact = fseek(pFile, static_cast<long>(i * frameBytes), SEEK_SET) == 0 &&
+                            fread(&number, sizeof(number), 1, pFile) == 1 && number == i &&
+                            fseek(pFile, static_cast<long>((i + 1) * frameBytes - 1), SEEK_SET) == 0 &&
+                            fread(&last, 1, 1, pFile) == 1 && last == (i & 0xFF);
+        }
+        result.intact = result.intact && pFile && fseek(pFile, 0, SEEK_END) == 0 &&
+                        static_cast<uint64_t>(ftell(pFile)) == frames * frameBytes;
+        if (pFile)
+        {
+            fclose(pFile);
+        }
+        remove(path.c_str());
+        return result;
+    }
+
+    std::vector<Scenario> MakeScenarios()
+    {
+        // With the default 4 x 8 MB buffers and 60 MB/s of frames, the pool covers
+        // about half a second.
+        return {
+            { "steady",             true,  0,    0,    0,   false, false, Bound::UnderFrame },
+            { "stalls 250ms/1.5s",  true,  250,  1500, 0,   false, false, Bound::UnderFrame },
+            { "fsync 100ms/16MB",   true,  0,    0,    100, true,  false, Bound::UnderFrame },
+            { "stall 1.2s",         true,  1200, 0,    0,   false, false, Bound::UnderStall },
+            { "inline, stalls",     false, 250,  1500, 0,   false, false, Bound::PaysStall },
+            { "fsync fails",        true,  0,    0,    0,   true,  true,  Bound::Unpaced },
+            { "unpaced, stalls",    true,  100,  1000, 0,   false, false, Bound::Unpaced },
+        };
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const Settings settings = ParseSettings(argc, argv);
+    const std::string path = settings.directory + "/file_writer_bench.bin";
+    const uint64_t periodNs = 1000000000ull / settings.fps;
+
+    bool ok = true;
+    if (settings.json)
+    {
+        printf("[");
+    }
+    else
+    {
+        printf("%u KB frames at %u fps for %u s per scenario, disk %u MB/s\n", settings.frameKb, settings.fps,
+               settings.seconds, settings.diskMbps);
+        printf("%-18s %9s %11s %11s %11s %11s %6s  %s\n", "scenario", "MB/s", "wait p50", "wait p99", "wait max",
+               "write max", "waits", "result");
+    }
+    const std::vector<Scenario> scenarios = MakeScenarios();
+    for (size_t s = 0; s < scenarios.size(); ++s)
+    {
+        const Scenario& scenario = scenarios[s];
+        const Result result = Run(settings, scenario, path);
+
+        std::string problem;
+        const uint64_t stallNs = scenario.stallMs * 1000000ull;
+        if (scenario.failSync)
+        {
+            // The first periodic sync fails well before the last frame; the
+            // producer should hear of it then, not only at Close().
+            if (result.closed)
+            {
+                problem = "a failed fsync was reported as success";
+            }
+            else if (result.intact)
+            {
+                problem = "writes went on after a failed fsync";
+            }
+        }
+        else if (!result.closed || !result.intact)
+        {
+            problem = "the file is incomplete or damaged";
+        }
+        else if (scenario.bound == Bound::UnderFrame && result.waits.max >= periodNs)
+        {
+            problem = "the producer waited longer than a frame interval";
+        }
+        else if (scenario.bound == Bound::UnderStall && result.waits.max > stallNs + periodNs)
+        {
+            problem = "the producer waited longer than the stall";
+        }
+        else if (scenario.bound == Bound::PaysStall && result.waits.max < stallNs * 8 / 10)
+        {
+            problem = "the stall never reached the producer";
+        }
+        ok = ok && problem.empty();
+
+        if (settings.json)
+        {
+            printf("%s{\"scenario\":\"%s\",\"mbps\":%.1f,\"wait_p50_ms\":%.3f,\"wait_p99_ms\":%.3f,\"wait_max_ms\":%.3f,"
+                   "\"write_max_ms\":%.3f,\"producer_waits\":%llu,\"syncs\":%llu,\"frames\":%llu,\"passed\":%s}",
+                   s ? "," : "", scenario.pName, result.mbps, result.waits.p50 / 1e6, result.waits.p99 / 1e6,
+                   result.waits.max / 1e6, result.io.writeNsMax / 1e6,
+                   static_cast<unsigned long long>(result.io.producerWaits),
+                   static_cast<unsigned long long>(result.io.syncs), static_cast<unsigned long long>(result.frames),
+                   problem.empty() ? "true" : "false");
+            continue;
+        }
+        printf("%-18s %9.1f %8.3f ms %8.3f ms %8.3f ms %8.3f ms %6llu  %s\n", scenario.pName, result.mbps,
+               result.waits.p50 / 1e6, result.waits.p99 / 1e6, result.waits.max / 1e6, result.io.writeNsMax / 1e6,
+               static_cast<unsigned long long>(result.io.producerWaits),
+               problem.empty() ? "PASS" : ("FAIL: " + problem).c_str());
+    }
+    if (settings.json)
+    {
+        printf("]\n");
+    }
+    else
+    {
+        printf("frame interval %.3f ms -> %s\n", periodNs / 1e6, ok ? "PASS" : "FAIL");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+//======================================================================================
+// HotPathBench.cpp
+// Cost of the instrumentation the capture thread runs on every frame: reading the
+// clock, recording into a latency histogram, emitting trace events and logging.
+// These have to stay in the nanoseconds for the numbers they produce to mean
+// anything.
+//
+// Build and run (from the repository root):
+//     g++ -O2 -std=c++17 -pthread -I. bench/HotPathBench.cpp -o hot_path_bench
+//     ./hot_path_bench
+//======================================================================================
+#include <cstdint>
+#include <string>
+
+#include "BenchHarness.h"
+#include "../HealthCounters.h"
+#include "../LatencyHistogram.h"
+#include "../Log.h"
+#include "../TickClock.h"
+#include "../Trace.h"
+
+int main(int argc, char** argv)
+{
+    BenchRunner runner(argc, argv);
+
+    runner.Run("tick_clock/now", 0, 0, [] { DoNotOptimize(TickClock::Now()); });
+    runner.Run("tick_clock/now_ns", 0, 0, [] { DoNotOptimize(TickClock::NowNs()); });
+
+    LatencyHistogram histogram;
+    uint64_t value = 12345;
+    runner.Run("latency_histogram/record", 0, 0, [&] {
+        histogram.Record(value);
+        value = (value * 6364136223846793005ull + 1442695040888963407ull) >> 40; // Spread across buckets.
+    });
+
+    HealthCounters health;
+    HealthCounters::Slot* pSlot = health.RegisterThread();
+    runner.Run("health_counters/add", 0, 0, [&] { pSlot->Add(HealthCounter::FramesCaptured); });
+
+    // A begin/end pair, as a StageTimer emits.
+    Trace::SetThreadName("bench");
+    runner.Run("trace/slice_disabled", 0, 0, [] {
+        Trace::Begin("stage", TickClock::Now());
+        Trace::End("stage", TickClock::Now());
+    });
+    Trace::Tracer::Instance().Enable(true);
+    runner.Run("trace/slice_enabled", 0, 0, [] {
+        Trace::Begin("stage", TickClock::Now());
+        Trace::End("stage", TickClock::Now());
+    });
+    Trace::Tracer::Instance().Enable(false);
+
+    // Logging with the background thread running (formatting into the void).
+    const std::string path = "C:\\Videos\\capture.mp4";
+    Log::Logger::Instance().SetConsoleOutput(false);
+    Log::Logger::Instance().Start("");
+    uint64_t frame = 0;
+    runner.Run("log/enqueue", 0, 0, [&] {
+        LOG_INFO("frame {} wrote {} bytes to {}", frame, frame * 4096, path);
+        ++frame;
+        // Let the logging thread catch up, untimed, so we measure enqueueing rather
+        // than drops.
+        if ((frame & 1023) == 0)
+        {
+            runner.PauseTiming();
+            Log::Logger::Instance().Flush();
+            runner.ResumeTiming();
+        }
+    });
+    runner.Run("log/filtered", 0, 0, [&] { LOG_DEBUG("frame {}", frame); });
+    Log::Logger::Instance().Stop();
+
+    return runner.Finish();
+}
@@ -0,0 +1,400 @@
+//======================================================================================
+// LatencyProbe.cpp
+// Glass-to-glass latency of a live stream, measured from the pictures themselves.
+//
+//   send   - runs the synthetic desktop in real time with a FrameMarker (frame
+//            number and vsync time) stamped into every refresh, converts, encodes
+//            with PcmH264Encoder and streams the result through StreamingSink, the
+//            recorder's --stream path: to stdout, pipe:<name> or unix:<path>.
+//   verify - reads decoded pictures as YUV4MPEG2 (stdin or --input), reads the
+//            marker back from each and compares its timestamp with the time the
+//            picture arrived. Reports the latency distribution, frames that never
+//            arrived (gaps in the numbering) and frames that arrived out of order.
+//
+// Both ends use the steady clock, so they must run on the same machine; anything
+// can sit between them. On Linux, with no Media Foundation anywhere:
+//
+//     ./latency_probe send --seconds 30 |
+//         ffmpeg -loglevel error -fflags nobuffer -flags low_delay -threads 1 -i - -f yuv4mpegpipe - |
+//         ./latency_probe verify --skip 30
+//
+// measures encode, stream queue, pipe and a real decoder end to end. The recorder
+// itself stamps the same markers with --source synthetic:<scenario> --frame-markers,
+// so `recorder --sink none --stream stdout ... | ffmpeg ... | latency_probe verify`
+// measures the production pipeline the same way. A decoder that buffers frames
+// shows up as latency here, which is the point.
+//
+// Build (from the repository root):
+//     g++ -O2 -std=c++17 -pthread -I. bench/LatencyProbe.cpp -o latency_probe
+//======================================================================================
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "PcmH264Encoder.h"
+#include "../FrameMarker.h"
+#include "../LatencyHistogram.h"
+#include "../PixelKernels.h"
+#include "../StreamOutput.h"
+#include "../SyntheticSource.h"
+#include "../TickClock.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace
+{
+    struct Settings
+    {
+        std::string mode;
+        // send
+        uint32_t width = 1920;
+        uint32_t height = 1080;
+        std::string workload = "scroll";
+        uint32_t refreshHz = 60;
+        double seconds = 30.0;
+        uint32_t gopLength = 120;
+        std::string target = "stdout";
+        StreamFormat format = StreamFormat::Ts;
+        SlowReaderPolicy policy = SlowReaderPolicy::Drop;
+        // verify
+        std::string inputPath;
+        uint32_t skip = 0;
+        bool json = false;
+    };
+
+    [[noreturn]] void Usage(const char* pProgram)
+    {
+        fprintf(stderr,
+                "Usage: %s send [--resolution <W>x<H>] [--workload static|scroll|video|drag] [--refresh <hz>]\n"
+                "          [--seconds <s>] [--gop <frames>] [--stream stdout|pipe:<name>|unix:<path>]\n"
+                "          [--format ts|annexb] [--policy block|drop|disconnect]\n"
+                "       %s verify [--input <file.y4m>] [--skip <frames>] [--json]\n",
+                pProgram, pProgram);
+        exit(2);
+    }
+
+    Settings ParseSettings(int argc, char** argv)
+    {
+        Settings settings;
+        if (argc < 2)
+        {
+            Usage(argv[0]);
+        }
+        settings.mode = argv[1];
+        const bool send = settings.mode == "send";
+        if (!send && settings.mode != "verify")
+        {
+            Usage(argv[0]);
+        }
+        for (int i = 2; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+            if (send && arg == "--resolution" && hasValue)
+            {
+                char* pEnd = nullptr;
+                settings.width = static_cast<uint32_t>(strtoul(argv[++i], &pEnd, 10));
+                settings.height = *pEnd == 'x' ? static_cast<uint32_t>(strtoul(pEnd + 1, &pEnd, 10)) : 0;
+                if (*pEnd != '\0' || settings.width < 64 || settings.height < 64) Usage(argv[0]);
+            }
+            else if (send && arg == "--workload" && hasValue) settings.workload = argv[++i];
+            else if (send && arg == "--refresh" && hasValue) settings.refreshHz = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (send && arg == "--seconds" && hasValue) settings.seconds = atof(argv[++i]);
+            else if (send && arg == "--gop" && hasValue) settings.gopLength = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (send && arg == "--stream" && hasValue) settings.target = argv[++i];
+            else if (send && arg == "--format" && hasValue)
+            {
+                const std::string value = argv[++i];
+                if (value == "ts") settings.format = StreamFormat::Ts;
+                else if (value == "annexb") settings.format = StreamFormat::AnnexB;
+                else Usage(argv[0]);
+            }
+            else if (send && arg == "--policy" && hasValue)
+            {
+                const std::string value = argv[++i];
+                if (value == "block") settings.policy = SlowReaderPolicy::Block;
+                else if (value == "drop") settings.policy = SlowReaderPolicy::Drop;
+                else if (value == "disconnect") settings.policy = SlowReaderPolicy::Disconnect;
+                else Usage(argv[0]);
+            }
+            else if (!send && arg == "--input" && hasValue) settings.inputPath = argv[++i];
+            else if (!send && arg == "--skip" && hasValue) settings.skip = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (!send && arg == "--json") settings.json = true;
+            else Usage(argv[0]);
+        }
+        if (settings.refreshHz < 1 || settings.gopLength < 1)
+        {
+            Usage(argv[0]);
+        }
+        return settings;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [Send]
+    //----------------------------------------------------------------------------------
+    int Send(const Settings& settings)
+    {
+        SyntheticSource::Options options;
+        if (!SyntheticSource::ParseScenario(settings.workload, options.scenario))
+        {
+            fprintf(stderr, "Unknown workload: %s\n", settings.workload.c_str());
+            return 1;
+        }
+        options.width = settings.width;
+        options.height = settings.height;
+        options.refreshHz = settings.refreshHz;
+        options.realTime = true;
+        options.frameMarkers = true;
+        SyntheticSource source(options);
+        const uint32_t width = source.Width();
+        const uint32_t height = source.Height();
+        if (FrameMarker::Place(width, height).cellSize == 0)
+        {
+            fprintf(stderr, "%ux%u is too small to carry a frame marker\n", width, height);
+            return 1;
+        }
+
+        PcmH264Encoder encoder;
+        encoder.Initialize(width, height, settings.gopLength, 1);
+        std::vector<uint8_t> sequenceHeader;
+        encoder.GetSequenceHeader(sequenceHeader);
+
+#ifdef _WIN32
+        StreamTarget::InheritedStdout() = GetStdHandle(STD_OUTPUT_HANDLE);
+#endif
+        std::atomic<bool> keyframeRequested{ false };
+        StreamingSink stream;
+        std::string error;
+        if (!stream.Start(settings.target, settings.format, settings.policy, 16 * 1024 * 1024,
+                          [&keyframeRequested] { keyframeRequested.store(true, std::memory_order_relaxed); }, error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        stream.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+
+        std::vector<uint8_t> nv12(PixelKernels::NV12Bytes(width, height));
+        uint8_t* pY = nv12.data();
+        uint8_t* pUV = pY + static_cast<size_t>(width) * height;
+        const int64_t frameDuration = 10000000 / settings.refreshHz;
+        const uint64_t endNs = TickClock::NowNs() + static_cast<uint64_t>(settings.seconds * 1e9);
+        uint64_t frames = 0;
+        uint64_t coalesced = 0;
+        while (TickClock::NowNs() < endNs)
+        {
+            CaptureFrameInfo info;
+            const CaptureResult result = source.AcquireFrame(1000, info);
+            if (result == CaptureResult::Timeout)
+            {
+                continue;
+            }
+            if (result != CaptureResult::Ok)
+            {
+                fprintf(stderr, "The source failed after %llu frames\n", static_cast<unsigned long long>(frames));
+                return 1;
+            }
+            MappedFrame mapped;
+            if (source.MapFrame(mapped))
+            {
+                PixelKernels::BgraToNV12(mapped.pPixels, static_cast<ptrdiff_t>(mapped.stride), pY, width, pUV, width,
+                                         width, height);
+                encoder.BeginPicture(keyframeRequested.exchange(false, std::memory_order_relaxed));
+                encoder.EncodeSlice(0, pY, width, pUV, width);
+                encoder.FinishPicture(info.timestamp, frameDuration, frames, &stream);
+                ++frames;
+                coalesced += info.accumulatedFrames > 1 ? info.accumulatedFrames - 1 : 0;
+            }
+            source.ReleaseFrame();
+        }
+        stream.Stop();
+
+        const StreamingSink::Stats stats = stream.GetStats();
+        fprintf(stderr,
+                "latency_probe: sent %llu of %llu frames (%llu dropped, %llu refreshes coalesced by a slow "
+                "encoder), encode-to-pipe mean %.3f ms, max %.3f ms\n",
+                static_cast<unsigned long long>(stats.framesSent), static_cast<unsigned long long>(frames),
+                static_cast<unsigned long long>(stats.framesDropped), static_cast<unsigned long long>(coalesced),
+                stats.framesSent ? stats.latencyNsTotal / 1e6 / stats.framesSent : 0.0, stats.latencyNsMax / 1e6);
+        return 0;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [ReadY4mHeader]
+    // Parses the stream header; only 4:2:0 and monochrome pictures are accepted.
+    //----------------------------------------------------------------------------------
+    bool ReadY4mHeader(FILE* pFile, uint32_t& width, uint32_t& height, size_t& chromaBytes)
+    {
+        char line[256];
+        if (!fgets(line, sizeof(line), pFile) || strncmp(line, "YUV4MPEG2 ", 10) != 0)
+        {
+            fprintf(stderr, "The input is not a YUV4MPEG2 stream\n");
+            return false;
+        }
+        width = 0;
+        height = 0;
+        std::string colorspace = "420";
+        for (char* pToken = strtok(line + 10, " \n"); pToken; pToken = strtok(nullptr, " \n"))
+        {
+            if (pToken[0] == 'W') width = static_cast<uint32_t>(atoi(pToken + 1));
+            else if (pToken[0] == 'H') height = static_cast<uint32_t>(atoi(pToken + 1));
+            else if (pToken[0] == 'C') colorspace = pToken + 1;
+        }
+        if (width == 0 || height == 0)
+        {
+            fprintf(stderr, "The YUV4MPEG2 header has no picture size\n");
+            return false;
+        }
+        if (colorspace.compare(0, 4, "mono") == 0)
+        {
+            chromaBytes = 0;
+        }
+        else if (colorspace.compare(0, 3, "420") == 0)
+        {
+            chromaBytes = 2 * static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+        }
+        else
+        {
+            fprintf(stderr, "Unsupported YUV4MPEG2 colorspace C%s (expected 4:2:0)\n", colorspace.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [Verify]
+    //----------------------------------------------------------------------------------
+    int Verify(const Settings& settings)
+    {
+        FILE* pFile = stdin;
+        if (!settings.inputPath.empty() && settings.inputPath != "-")
+        {
+            pFile = fopen(settings.inputPath.c_str(), "rb");
+            if (!pFile)
+            {
+                fprintf(stderr, "Could not open %s\n", settings.inputPath.c_str());
+                return 1;
+            }
+        }
+#ifdef _WIN32
+        else
+        {
+            _setmode(_fileno(stdin), _O_BINARY);
+        }
+#endif
+        uint32_t width = 0;
+        uint32_t height = 0;
+        size_t chromaBytes = 0;
+        if (!ReadY4mHeader(pFile, width, height, chromaBytes))
+        {
+            return 1;
+        }
+        if (FrameMarker::Place(width, height).cellSize == 0)
+        {
+            fprintf(stderr, "%ux%u is too small to carry a frame marker\n", width, height);
+            return 1;
+        }
+
+        std::vector<uint8_t> picture(static_cast<size_t>(width) * height + chromaBytes);
+        LatencyHistogram latency;
+        uint64_t pictures = 0;
+        uint64_t unreadable = 0;
+        uint64_t missing = 0;
+        uint64_t outOfOrder = 0;
+        uint64_t minNs = UINT64_MAX;
+        uint64_t clockSkew = 0;
+        bool haveLast = false;
+        uint32_t lastFrame = 0;
+        char line[256];
+        while (fgets(line, sizeof(line), pFile))
+        {
+            if (strncmp(line, "FRAME", 5) != 0 || fread(picture.data(), 1, picture.size(), pFile) != picture.size())
+            {
+                break;
+            }
+            // The picture is complete now; this is as close to "on glass" as we get.
+            const uint64_t arrivalNs = TickClock::NowNs();
+            ++pictures;
+
+            FrameMarker::Marker marker;
+            if (!FrameMarker::Read(picture.data(), width, width, height, marker))
+            {
+                ++unreadable;
+                continue;
+            }
+            if (haveLast)
+            {
+                const int32_t step = static_cast<int32_t>(marker.frameNumber - lastFrame);
+                if (step <= 0)
+                {
+                    ++outOfOrder;
+                    continue;
+                }
+                missing += static_cast<uint32_t>(step - 1);
+            }
+            haveLast = true;
+            lastFrame = marker.frameNumber;
+            if (pictures <= settings.skip)
+            {
+                continue;
+            }
+            if (marker.timestampNs > arrivalNs)
+            {
+                // Stamped in the future: the sender is on another clock.
+                ++clockSkew;
+                continue;
+            }
+            const uint64_t ns = arrivalNs - marker.timestampNs;
+            latency.Record(ns);
+            minNs = ns < minNs ? ns : minNs;
+        }
+        if (pFile != stdin)
+        {
+            fclose(pFile);
+        }
+
+        const LatencyHistogram::Summary summary = latency.Summarize();
+        const double minMs = summary.count ? minNs / 1e6 : 0.0;
+        if (settings.json)
+        {
+            printf("{\"pictures\":%llu,\"measured\":%llu,\"unreadable\":%llu,\"missing\":%llu,\"out_of_order\":%llu,"
+                   "\"clock_skew\":%llu,\"latency_min_ms\":%.3f,\"latency_mean_ms\":%.3f,\"latency_p50_ms\":%.3f,"
+                   "\"latency_p99_ms\":%.3f,\"latency_p999_ms\":%.3f,\"latency_max_ms\":%.3f}\n",
+                   static_cast<unsigned long long>(pictures), static_cast<unsigned long long>(summary.count),
+                   static_cast<unsigned long long>(unreadable), static_cast<unsigned long long>(missing),
+                   static_cast<unsigned long long>(outOfOrder), static_cast<unsigned long long>(clockSkew), minMs,
+                   summary.mean / 1e6, summary.p50 / 1e6, summary.p99 / 1e6, summary.p999 / 1e6, summary.max / 1e6);
+        }
+        else
+        {
+            printf("%ux%u: %llu pictures, %llu measured (%llu skipped), %llu without a readable marker\n", width, height,
+                   static_cast<unsigned long long>(pictures), static_cast<unsigned long long>(summary.count),
+                   static_cast<unsigned long long>(pictures < settings.skip ? pictures : settings.skip),
+                   static_cast<unsigned long long>(unreadable));
+            printf("frames missing: %llu, out of order: %llu\n", static_cast<unsigned long long>(missing),
+                   static_cast<unsigned long long>(outOfOrder));
+            if (clockSkew)
+            {
+                printf("%llu markers were stamped in the future: sender and verifier must share a clock\n",
+                       static_cast<unsigned long long>(clockSkew));
+            }
+            printf("glass-to-glass latency: min %.3f ms, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, "
+                   "max %.3f ms\n",
+                   minMs, summary.mean / 1e6, summary.p50 / 1e6, summary.p99 / 1e6, summary.p999 / 1e6,
+                   summary.max / 1e6);
+        }
+        return summary.count ? 0 : 1;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const Settings settings = ParseSettings(argc, argv);
+    return settings.mode == "send" ? Send(settings) : Verify(settings);
+}
@@ -0,0 +1,746 @@
+//======================================================================================
+// MetricsBench.cpp
+// Scrapes the metrics endpoint during a short synthetic recording and checks that
+// what it serves is valid Prometheus text exposition format.
+//
+// The recording is BenchRecording (see its header) on its own thread, paced at
+// --fps, into the MPEG-TS muxer, each stage timed into PipelineStats and every
+// frame counted in HealthCounters as Recorder::Record does. Every 10th frame adds a made-up quality measurement. A
+// MetricsExporter serves the same collector as Recorder::FormatMetrics over HTTP
+// on --port and rewrites a textfile every second.
+//
+// Each scrape is checked for:
+//   - the HTTP status, Content-Type and Content-Length;
+//   - line syntax: metric and label names, quoted label values, sample values;
+//   - a HELP and a TYPE line for every family, once each, before its samples,
+//     with all of the family's samples together and no series twice;
+//   - counters ending in _total and never negative;
+//   - histograms: buckets in increasing le order with non-decreasing counts,
+//     ending at +Inf, whose count equals _count, and a _sum;
+// and against the scrape before it: no series goes away, and no counter, bucket,
+// _sum or _count goes down. Once the recording has stopped, the last scrape and
+// the final textfile must both hold the frames it counted.
+//
+// Reported: scrapes, series per scrape, and the scrape round trip p50, p99 and
+// max. The first problem is printed and the run exits with 1.
+//
+// Build and run (from the repository root, on Linux):
+//     g++ -O2 -std=c++17 -pthread -I. bench/MetricsBench.cpp -o metrics_bench
+//     ./metrics_bench [--size 1280x720] [--fps 30] [--seconds 3] [--port 19465] [--dir /tmp]
+//======================================================================================
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "BenchRecording.h"
+#include "../HealthCounters.h"
+#include "../LatencyHistogram.h"
+#include "../MetricsExporter.h"
+#include "../PipelineStats.h"
+#include "../QualityMetrics.h"
+#include "../SyntheticSource.h"
+#include "../TickClock.h"
+#include "../TsMuxer.h"
+
+namespace
+{
+    struct Settings
+    {
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        std::string workload = "scroll";
+        uint32_t fps = 30;
+        uint32_t seconds = 3;
+        uint16_t port = 19465;
+        std::string directory = "/tmp";
+    };
+
+    [[noreturn]] void Usage(const char* pProgram)
+    {
+        fprintf(stderr,
+                "Usage: %s [--size <W>x<H>] [--workload static|scroll|video|drag] [--fps <n>] [--seconds <n>]\n"
+                "          [--port <n>] [--dir <path>]\n",
+                pProgram);
+        exit(2);
+    }
+
+    Settings ParseSettings(int argc, char** argv)
+    {
+        Settings settings;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+            if (arg == "--size" && hasValue)
+            {
+                char* pEnd = nullptr;
+                settings.width = static_cast<uint32_t>(strtoul(argv[++i], &pEnd, 10));
+                settings.height = (*pEnd == 'x') ? static_cast<uint32_t>(strtoul(pEnd + 1, &pEnd, 10)) : 0;
+                if (*pEnd != '\0' || settings.width < 64 || settings.height < 64) Usage(argv[0]);
+            }
+            else if (arg == "--workload" && hasValue) settings.workload = argv[++i];
+            else if (arg == "--fps" && hasValue) settings.fps = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--seconds" && hasValue) settings.seconds = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--port" && hasValue) settings.port = static_cast<uint16_t>(atoi(argv[++i]));
+            else if (arg == "--dir" && hasValue) settings.directory = argv[++i];
+            else Usage(argv[0]);
+        }
+        SyntheticSource::Scenario scenario;
+        if (settings.fps < 1 || settings.seconds < 1 || settings.port == 0 ||
+            !SyntheticSource::ParseScenario(settings.workload, scenario))
+        {
+            Usage(argv[0]);
+        }
+        return settings;
+    }
+
+    class NullByteSink : public ByteSink
+    {
+    public:
+        bool Write(const void*, size_t size) override
+        {
+            m_position += size;
+            return true;
+        }
+        uint64_t Position() const override { return m_position; }
+
+    private:
+        uint64_t m_position = 0;
+    };
+
+    //==================================================================================
+    // Recording
+    // BenchRecording (see its header) on its own thread, one frame per interval for
+    // --seconds into the MPEG-TS muxer, timed and counted the way the recorder times
+    // and counts. Every 10th frame adds a made-up quality measurement.
+    //==================================================================================
+    class Recording
+    {
+    public:
+        explicit Recording(const Settings& settings) : m_recording(Options(settings, *this)) {}
+
+        ~Recording() { Join(); }
+
+        void Start() { m_thread = std::thread(&Recording::Run, this); }
+
+        void Join()
+        {
+            if (m_thread.joinable())
+            {
+                m_thread.join();
+            }
+        }
+
+        bool Running() const { return m_running.load(); }
+        uint64_t Frames() const { return m_recording.Health()[HealthCounter::FramesWritten]; }
+
+        // What Recorder::FormatMetrics collects.
+        void FormatMetrics(std::string& text) const
+        {
+            Metrics::AppendHealth(m_recording.Health(), text);
+            Metrics::AppendStageLatencies(m_recording.Stats(), text);
+            QualityMetrics::QualityTotals quality;
+            {
+                std::lock_guard<std::mutex> lock(m_qualityMutex);
+                quality = m_quality;
+            }
+            Metrics::AppendQuality(quality, text);
+        }
+
+    private:
+        static BenchRecording::Options Options(const Settings& settings, Recording& owner)
+        {
+            BenchRecording::Options options;
+            options.width = settings.width;
+            options.height = settings.height;
+            options.workload = settings.workload;
+            options.fps = settings.fps;
+            options.frames = static_cast<uint64_t>(settings.seconds) * settings.fps;
+            options.onFrameWritten = [&owner](uint64_t frame, HealthCounters::Slot& health)
+            {
+                owner.FrameWritten(frame, health);
+            };
+            return options;
+        }
+
+        void FrameWritten(uint64_t frame, HealthCounters::Slot& health)
+        {
+            health.RaiseMax(HealthCounter::EncoderQueueMax, 1 + frame % 3);
+            if (frame % 10 == 0)
+            {
+                QualityMetrics::FrameQuality quality;
+                quality.psnr = 45.0 + (frame % 7);
+                quality.ssim = 0.99 - 0.001 * (frame % 5);
+                quality.worstTilePsnr = 38.0 + (frame % 3);
+                std::lock_guard<std::mutex> lock(m_qualityMutex);
+                m_quality.Add(quality);
+            }
+        }
+
+        void Run()
+        {
+            m_recording.Prepare();
+            std::vector<uint8_t> sequenceHeader;
+            m_recording.GetSequenceHeader(sequenceHeader);
+            NullByteSink output;
+            TsMuxer muxer;
+            muxer.Open(&output);
+            muxer.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+            m_recording.Record(&muxer);
+            muxer.Finish();
+            m_running = false;
+        }
+
+        BenchRecording m_recording;
+        mutable std::mutex m_qualityMutex;
+        QualityMetrics::QualityTotals m_quality;
+        std::atomic<bool> m_running{ true };
+        std::thread m_thread;
+    };
+
+    //==================================================================================
+    // Exposition
+    // One parsed scrape: every sample by series ("name{labels}"), in order.
+    //==================================================================================
+    struct Exposition
+    {
+        std::map<std::string, double> samples;
+        std::map<std::string, std::string> types; // Family name to its TYPE.
+    };
+
+    bool IsNameStart(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':';
+    }
+
+    bool IsNameChar(char c)
+    {
+        return IsNameStart(c) || (c >= '0' && c <= '9');
+    }
+
+    // Reads a metric (or, without colons, label) name at 'at'.
+    bool ReadName(const std::string& line, size_t& at, std::string& name, bool label)
+    {
+        const size_t start = at;
+        while (at < line.size() && IsNameChar(line[at]) && !(label && line[at] == ':') &&
+               (at > start || IsNameStart(line[at])))
+        {
+            ++at;
+        }
+        name = line.substr(start, at - start);
+        return !name.empty();
+    }
+
+    bool ReadValue(const std::string& token, double& value)
+    {
+        if (token == "+Inf" || token == "-Inf" || token == "NaN")
+        {
+            value = token == "NaN" ? NAN : (token[0] == '-' ? -INFINITY : INFINITY);
+            return true;
+        }
+        char* pEnd = nullptr;
+        value = strtod(token.c_str(), &pEnd);
+        return !token.empty() && *pEnd == '\0' && std::isfinite(value);
+    }
+
+    // The family a sample belongs to: its own name, or for histograms the name
+    // without _bucket, _sum or _count.
+    std::string FamilyOf(const std::string& name, const std::map<std::string, std::string>& types)
+    {
+        static const char* const Suffixes[] = { "_bucket", "_sum", "_count" };
+        for (const char* pSuffix : Suffixes)
+        {
+            const size_t length = strlen(pSuffix);
+            if (name.size() > length && name.compare(name.size() - length, length, pSuffix) == 0)
+            {
+                const std::string base = name.substr(0, name.size() - length);
+                const auto type = types.find(base);
+                if (type != types.end() && type->second == "histogram")
+                {
+                    return base;
+                }
+            }
+        }
+        return name;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [ParseExposition]
+    // Checks the syntax and the HELP/TYPE, counter and histogram rules of one scrape.
+    //----------------------------------------------------------------------------------
+    bool ParseExposition(const std::string& text, Exposition& exposition, std::string& problem)
+    {
+        if (text.empty() || text.back() != '\n')
+        {
+            problem = "the text does not end with a newline";
+            return false;
+        }
+
+        std::set<std::string> helped;
+        std::set<std::string> finished; // Families whose samples are behind us.
+        std::string current;
+        // Histogram series without le: bucket bounds and counts, in order.
+        std::map<std::string, std::vector<std::pair<double, double>>> buckets;
+
+        size_t lineNumber = 0;
+        for (size_t begin = 0; begin < text.size();)
+        {
+            const size_t end = text.find('\n', begin);
+            const std::string line = text.substr(begin, end - begin);
+            begin = end + 1;
+            ++lineNumber;
+            char where[48];
+            snprintf(where, sizeof(where), "line %zu: ", lineNumber);
+            if (line.empty())
+            {
+                continue;
+            }
+
+            if (line[0] == '#')
+            {
+                size_t at = 2;
+                std::string name;
+                const bool help = line.compare(0, 7, "# HELP ") == 0;
+                const bool type = line.compare(0, 7, "# TYPE ") == 0;
+                if (!help && !type)
+                {
+                    continue; // A plain comment.
+                }
+                at = 7;
+                if (!ReadName(line, at, name, false) || at >= line.size() || line[at] != ' ')
+                {
+                    problem = where + std::string("malformed ") + (help ? "HELP" : "TYPE");
+                    return false;
+                }
+                const std::string rest = line.substr(at + 1);
+                if (finished.count(name) || name == current)
+                {
+                    problem = where + std::string("HELP or TYPE for ") + name + " after its samples";
+                    return false;
+                }
+                if (help)
+                {
+                    if (!helped.insert(name).second || rest.empty())
+                    {
+                        problem = where + std::string("second or empty HELP for ") + name;
+                        return false;
+                    }
+                }
+                else
+                {
+                    if (exposition.types.count(name) ||
+                        (rest != "counter" && rest != "gauge" && rest != "histogram" && rest != "summary" &&
+                         rest != "untyped"))
+                    {
+                        problem = where + std::string("second or unknown TYPE for ") + name;
+                        return false;
+                    }
+                    exposition.types[name] = rest;
+                }
+                continue;
+            }
+
+            // name{label="value",...} value [timestamp]
+            size_t at = 0;
+            std::string name;
+            if (!ReadName(line, at, name, false))
+            {
+                problem = where + std::string("no metric name");
+                return false;
+            }
+            std::vector<std::pair<std::string, std::string>> labels;
+            if (at < line.size() && line[at] == '{')
+            {
+                ++at;
+                while (at < line.size() && line[at] != '}')
+                {
+                    std::string label;
+                    std::string value;
+                    if (!ReadName(line, at, label, true) || line.compare(at, 2, "=\"") != 0)
+                    {
+                        problem = where + std::string("malformed label");
+                        return false;
+                    }
+                    for (at += 2; at < line.size() && line[at] != '"'; ++at)
+                    {
+                        if (line[at] == '\\')
+                        {
+                            const char escaped = at + 1 < line.size() ? line[++at] : '\0';
+                            if (escaped != '\\' && escaped != '"' && escaped != 'n')
+                            {
+                                problem = where + std::string("bad escape in a label value");
+                                return false;
+                            }
+                        }
+                        value += line[at];
+                    }
+                    for (const auto& other : labels)
+                    {
+                        if (other.first == label)
+                        {
+                            problem = where + std::string("label ") + label + " twice";
+                            return false;
+                        }
+                    }
+                    labels.push_back({ label, value });
+                    if (at >= line.size() || (line[++at] != ',' && line[at] != '}'))
+                    {
+                        problem = where + std::string("unterminated label set");
+                        return false;
+                    }
+                    at += line[at] == ',' ? 1 : 0;
+                }
+                if (at >= line.size())
+                {
+                    problem = where + std::string("unterminated label set");
+                    return false;
+                }
+                ++at;
+            }
+            if (at >= line.size() || line[at] != ' ')
+            {
+                problem = where + std::string("no space before the value");
+                return false;
+            }
+            const size_t valueEnd = line.find(' ', at + 1);
+            double value = 0.0;
+            if (!ReadValue(line.substr(at + 1, valueEnd - at - 1), value))
+            {
+                problem = where + std::string("bad sample value");
+                return false;
+            }
+            if (valueEnd != std::string::npos &&
+                line.find_first_not_of("-0123456789", valueEnd + 1) != std::string::npos)
+            {
+                problem = where + std::string("bad timestamp");
+                return false;
+            }
+
+            // Its family: declared with HELP and TYPE, and all in one place.
+            const std::string family = FamilyOf(name, exposition.types);
+            const auto type = exposition.types.find(family);
+            if (type == exposition.types.end() || !helped.count(family))
+            {
+                problem = where + family + " has no HELP or TYPE";
+                return false;
+            }
+            if (family != current)
+            {
+                if (finished.count(family))
+                {
+                    problem = where + family + " samples are not together";
+                    return false;
+                }
+                if (!current.empty())
+                {
+                    finished.insert(current);
+                }
+                current = family;
+            }
+
+            std::string series = name + "{";
+            std::string withoutLe = "{";
+            double le = 0.0;
+            bool hasLe = false;
+            for (const auto& label : labels)
+            {
+                const std::string pair = label.first + "=\"" + label.second + "\"";
+                series += (series.back() == '{' ? "" : ",") + pair;
+                if (label.first == "le")
+                {
+                    hasLe = ReadValue(label.second, le);
+                }
+                else
+                {
+                    withoutLe += (withoutLe.back() == '{' ? "" : ",") + pair;
+                }
+            }
+            series += "}";
+            withoutLe += "}";
+            if (!exposition.samples.insert({ series, value }).second)
+            {
+                problem = where + series + " twice";
+                return false;
+            }
+
+            if (type->second == "counter" &&
+                (name.size() < 6 || name.compare(name.size() - 6, 6, "_total") != 0 || value < 0))
+            {
+                problem = where + name + " is a counter but not named _total or negative";
+                return false;
+            }
+            if (type->second == "histogram")
+            {
+                const std::string suffix = name.substr(family.size());
+                if (suffix == "_bucket")
+                {
+                    if (!hasLe)
+                    {
+                        problem = where + series + " has no valid le";
+                        return false;
+                    }
+                    buckets[family + withoutLe].push_back({ le, value });
+                }
+                else if (suffix != "_sum" && suffix != "_count")
+                {
+                    problem = where + name + " is not a histogram sample";
+                    return false;
+                }
+                else if (value < 0)
+                {
+                    problem = where + series + " is negative";
+                    return false;
+                }
+            }
+        }
+
+        // Buckets rise with le, end at +Inf, and agree with _count; _sum exists.
+        for (const auto& entry : buckets)
+        {
+            const std::string& key = entry.first;
+            const auto& bounds = entry.second;
+            const size_t brace = key.find('{');
+            const std::string family = key.substr(0, brace);
+            const std::string labels = key.substr(brace);
+            for (size_t i = 1; i < bounds.size(); ++i)
+            {
+                if (bounds[i].first <= bounds[i - 1].first || bounds[i].second < bounds[i - 1].second)
+                {
+                    problem = family + labels + ": bucket le=" + std::to_string(bounds[i].first) +
+                              " is out of order or below the one before";
+                    return false;
+                }
+            }
+            const auto count = exposition.samples.find(family + "_count" + labels);
+            if (bounds.empty() || !std::isinf(bounds.back().first) || count == exposition.samples.end() ||
+                count->second != bounds.back().second || !exposition.samples.count(family + "_sum" + labels))
+            {
+                problem = family + labels + ": no +Inf bucket, or _count or _sum missing or disagreeing";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // What must not go down between two scrapes: counters and everything of a
+    // histogram.
+    bool CheckMonotonic(const Exposition& before, const Exposition& after, std::string& problem)
+    {
+        for (const auto& sample : before.samples)
+        {
+            const auto now = after.samples.find(sample.first);
+            if (now == after.samples.end())
+            {
+                problem = sample.first + " went away";
+                return false;
+            }
+            const std::string name = sample.first.substr(0, sample.first.find('{'));
+            const std::string type = before.types.at(FamilyOf(name, before.types));
+            if ((type == "counter" || type == "histogram") && now->second < sample.second)
+            {
+                problem = sample.first + " went down from " + std::to_string(sample.second) + " to " +
+                          std::to_string(now->second);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [HttpGet]
+    // One request to 127.0.0.1; false if the connection fails. The exporter closes
+    // the connection after its response.
+    //----------------------------------------------------------------------------------
+    bool HttpGet(uint16_t port, const char* pPath, std::string& response)
+    {
+        const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return false;
+        }
+        const std::string request = std::string("GET ") + pPath + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+        send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+        response.clear();
+        char buffer[16384];
+        ssize_t received;
+        while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        {
+            response.append(buffer, static_cast<size_t>(received));
+        }
+        close(fd);
+        return true;
+    }
+
+    // Splits a response into status line, a header and the body, checking the
+    // body's length.
+    bool ReadResponse(const std::string& response, std::string& status, std::string& contentType, std::string& body)
+    {
+        const size_t headerEnd = response.find("\r\n\r\n");
+        if (headerEnd == std::string::npos)
+        {
+            return false;
+        }
+        status = response.substr(0, response.find("\r\n"));
+        body = response.substr(headerEnd + 4);
+        size_t length = ~static_cast<size_t>(0);
+        for (size_t at = response.find("\r\n") + 2; at < headerEnd;)
+        {
+            const size_t end = response.find("\r\n", at);
+            const std::string line = response.substr(at, end - at);
+            if (line.compare(0, 14, "Content-Type: ") == 0)
+            {
+                contentType = line.substr(14);
+            }
+            else if (line.compare(0, 16, "Content-Length: ") == 0)
+            {
+                length = static_cast<size_t>(strtoull(line.c_str() + 16, nullptr, 10));
+            }
+            at = end + 2;
+        }
+        return length == body.size();
+    }
+
+    bool Fail(const std::string& what)
+    {
+        fprintf(stderr, "FAIL %s\n", what.c_str());
+        return false;
+    }
+
+    // The scrape's count of a series, or -1.
+    double Value(const Exposition& exposition, const std::string& series)
+    {
+        const auto sample = exposition.samples.find(series);
+        return sample == exposition.samples.end() ? -1.0 : sample->second;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CheckFinal]
+    // The last scrape and the textfile hold every frame the recording counted.
+    //----------------------------------------------------------------------------------
+    bool CheckFinal(const char* pWhat, const Exposition& exposition, uint64_t frames)
+    {
+        const double expected = static_cast<double>(frames);
+        if (Value(exposition, "recorder_frames_captured_total{}") != expected ||
+            Value(exposition, "recorder_frames_written_total{}") != expected ||
+            Value(exposition, "recorder_stage_latency_seconds_count{stage=\"convert\"}") != expected ||
+            Value(exposition, "recorder_stage_latency_seconds_count{stage=\"write\"}") != expected ||
+            Value(exposition, "recorder_quality_frames_total{}") != static_cast<double>((frames + 9) / 10))
+        {
+            return Fail(std::string(pWhat) + " does not hold the " + std::to_string(frames) + " frames recorded");
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const Settings settings = ParseSettings(argc, argv);
+    const std::string textfile = settings.directory + "/metrics_bench.prom";
+    remove(textfile.c_str());
+
+    Recording recording(settings);
+    MetricsExporter exporter;
+    MetricsExporter::Options options;
+    options.httpPort = settings.port;
+    options.filePath = textfile;
+    options.fileIntervalSeconds = 1;
+    std::string error;
+    if (!exporter.Start(options, [&recording](std::string& text) { recording.FormatMetrics(text); }, error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    recording.Start();
+
+    bool ok = true;
+    LatencyHistogram roundTrips;
+    Exposition previous;
+    size_t scrapes = 0;
+    size_t series = 0;
+    std::string response;
+    std::string status;
+    std::string contentType;
+    std::string body;
+    std::string problem;
+    for (bool last = false; ok && !last;)
+    {
+        last = !recording.Running();
+        std::this_thread::sleep_for(std::chrono::milliseconds(last ? 0 : 50));
+
+        const uint64_t startNs = TickClock::NowNs();
+        if (!HttpGet(settings.port, "/metrics", response))
+        {
+            ok = Fail("could not connect to the exporter");
+            break;
+        }
+        roundTrips.Record(TickClock::NowNs() - startNs);
+        ++scrapes;
+        if (!ReadResponse(response, status, contentType, body) || status != "HTTP/1.1 200 OK" ||
+            contentType != "text/plain; version=0.0.4; charset=utf-8")
+        {
+            ok = Fail("scrape " + std::to_string(scrapes) + ": bad status, Content-Type or Content-Length");
+            break;
+        }
+        Exposition exposition;
+        if (!ParseExposition(body, exposition, problem) || !CheckMonotonic(previous, exposition, problem))
+        {
+            ok = Fail("scrape " + std::to_string(scrapes) + ": " + problem);
+            break;
+        }
+        series = exposition.samples.size();
+        previous = exposition;
+    }
+    recording.Join();
+    ok = ok && CheckFinal("the last scrape", previous, recording.Frames());
+
+    // Anything but /metrics is a 404.
+    if (ok && (!HttpGet(settings.port, "/", response) || !ReadResponse(response, status, contentType, body) ||
+               status != "HTTP/1.1 404 Not Found"))
+    {
+        ok = Fail("/ is not answered with 404");
+    }
+
+    // Stop() writes the textfile with the final values.
+    exporter.Stop();
+    std::ifstream file(textfile, std::ios::binary);
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    Exposition written;
+    if (ok && !ParseExposition(text, written, problem))
+    {
+        ok = Fail("textfile: " + problem);
+    }
+    ok = ok && CheckFinal("the textfile", written, recording.Frames());
+    remove(textfile.c_str());
+
+    const LatencyHistogram::Summary trips = roundTrips.Summarize();
+    printf("%ux%u %s at %u fps for %u s: %llu frames\n", settings.width, settings.height, settings.workload.c_str(),
+           settings.fps, settings.seconds, static_cast<unsigned long long>(recording.Frames()));
+    printf("%zu scrapes of %zu series, round trip p50 %.3f ms, p99 %.3f ms, max %.3f ms -> %s\n", scrapes, series,
+           trips.p50 / 1e6, trips.p99 / 1e6, trips.max / 1e6, ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
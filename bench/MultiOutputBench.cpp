@@ -0,0 +1,328 @@
+//======================================================================================
+// MultiOutputBench.cpp
+// Several outputs recorded at once, the way --outputs runs them: one synthetic
+// desktop per output, each with its own thread, readback buffer and encoder, all
+// following one FrameClock (FrameClock.h).
+//
+// Each output waits for the others in FrameClock::WaitForStart() (after a setup
+// delay that grows with its index, as device and encoder creation would), then
+// captures at the start of every slot and stamps the frame with the slot's time.
+// The desktops refresh at different rates (--refresh), so their own vsyncs never
+// line up; the clock is what aligns them. Reported per output: frames, slots
+// skipped or without an update, and how late into its slot each capture finished;
+// across outputs: the spread of capture times for the same slot. The run fails
+// (exit code 1) if any encoded frame carries a timestamp other than its slot's, or
+// the p99 spread exceeds a frame.
+//
+// --fail <index> makes that output give up during setup (FrameClock::Leave) to
+// check that the others still start.
+//
+// Build and run (from the repository root):
+//     g++ -O2 -std=c++17 -pthread -I. bench/MultiOutputBench.cpp -o multi_output_bench
+//     ./multi_output_bench --outputs 3 --refresh 60,75,144 --fps 30 --seconds 5
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PcmH264Encoder.h"
+#include "../FrameClock.h"
+#include "../LatencyHistogram.h"
+#include "../PixelKernels.h"
+#include "../SyntheticSource.h"
+
+namespace
+{
+    struct Settings
+    {
+        uint32_t outputs = 3;
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        std::string workload = "scroll";
+        std::vector<uint32_t> refreshHz = { 60, 75, 144 };
+        uint32_t fps = 30;
+        uint32_t seconds = 5;
+        uint32_t setupMs = 100;
+        int32_t failIndex = -1;
+        bool json = false;
+    };
+
+    // What one output did.
+    struct OutputResult
+    {
+        uint32_t refreshHz = 0;
+        bool left = false;
+        uint64_t frames = 0;
+        uint64_t timeouts = 0;
+        uint64_t skippedSlots = 0;
+        uint64_t bytes = 0;
+        uint64_t readyNs = 0;
+        LatencyHistogram lateness;
+        std::vector<uint64_t> captureNs; // Per slot; 0 if nothing was captured in it.
+        std::vector<int64_t> timestamps;
+    };
+
+    // Keeps the timestamp of the last access unit and counts bytes.
+    class CheckingSink : public EncodedSink
+    {
+    public:
+        int64_t lastPts = -1;
+        uint64_t bytes = 0;
+
+        bool WriteFrame(const EncodedFrame& frame) override
+        {
+            lastPts = frame.pts;
+            bytes += frame.size;
+            return true;
+        }
+        bool Finish() override { return true; }
+    };
+
+    [[noreturn]] void Usage(const char* pProgram)
+    {
+        fprintf(stderr,
+                "Usage: %s [--outputs <n>] [--size <W>x<H>] [--workload static|scroll|video|drag] [--refresh <hz>,<hz>,...]\n"
+                "          [--fps <n>] [--seconds <n>] [--setup-ms <n>] [--fail <index>] [--json]\n",
+                pProgram);
+        exit(2);
+    }
+
+    Settings ParseSettings(int argc, char** argv)
+    {
+        Settings settings;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+            if (arg == "--outputs" && hasValue) settings.outputs = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--size" && hasValue)
+            {
+                char* pEnd = nullptr;
+                settings.width = static_cast<uint32_t>(strtoul(argv[++i], &pEnd, 10));
+                settings.height = (*pEnd == 'x') ? static_cast<uint32_t>(strtoul(pEnd + 1, &pEnd, 10)) : 0;
+                if (*pEnd != '\0' || settings.width < 64 || settings.height < 64) Usage(argv[0]);
+            }
+            else if (arg == "--workload" && hasValue) settings.workload = argv[++i];
+            else if (arg == "--refresh" && hasValue)
+            {
+                settings.refreshHz.clear();
+                for (const char* p = argv[++i]; *p; )
+                {
+                    char* pEnd = nullptr;
+                    const unsigned long hz = strtoul(p, &pEnd, 10);
+                    if (pEnd == p || hz == 0 || (*pEnd != ',' && *pEnd != '\0')) Usage(argv[0]);
+                    settings.refreshHz.push_back(static_cast<uint32_t>(hz));
+                    p = (*pEnd == ',') ? pEnd + 1 : pEnd;
+                }
+            }
+            else if (arg == "--fps" && hasValue) settings.fps = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--seconds" && hasValue) settings.seconds = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--setup-ms" && hasValue) settings.setupMs = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--fail" && hasValue) settings.failIndex = atoi(argv[++i]);
+            else if (arg == "--json") settings.json = true;
+            else Usage(argv[0]);
+        }
+        SyntheticSource::Scenario scenario;
+        if (settings.outputs < 1 || settings.fps < 1 || settings.seconds < 1 || settings.refreshHz.empty() ||
+            !SyntheticSource::ParseScenario(settings.workload, scenario))
+        {
+            Usage(argv[0]);
+        }
+        return settings;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [RecordOutput]
+    // One output's recording loop: the recorder's clocked capture loop with the
+    // pipeline of PipelineBench squeezed onto one thread.
+    //----------------------------------------------------------------------------------
+    void RecordOutput(const Settings& settings, uint32_t index, FrameClock& clock, OutputResult& result)
+    {
+        SyntheticSource::Options options;
+        SyntheticSource::ParseScenario(settings.workload, options.scenario);
+        options.width = settings.width;
+        options.height = settings.height;
+        options.refreshHz = settings.refreshHz[index % settings.refreshHz.size()];
+        options.seed = 1 + index;
+        result.refreshHz = options.refreshHz;
+        SyntheticSource source(options);
+
+        const uint32_t width = source.Width();
+        const uint32_t height = source.Height();
+        const size_t pitch = (static_cast<size_t>(width) * 4 + 255) / 256 * 256;
+        std::vector<uint8_t> staging(pitch * height);
+        std::vector<uint8_t> nv12(PixelKernels::NV12Bytes(width, height));
+        const size_t lumaBytes = static_cast<size_t>(width) * height;
+        PcmH264Encoder encoder;
+        encoder.Initialize(width, height, settings.fps * 2, 1);
+        CheckingSink sink;
+
+        const uint64_t totalSlots = static_cast<uint64_t>(settings.fps) * settings.seconds;
+        result.captureNs.assign(totalSlots, 0);
+        result.timestamps.assign(totalSlots, -1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(settings.setupMs * index));
+        result.readyNs = FrameClock::NowNs();
+        if (static_cast<int32_t>(index) == settings.failIndex)
+        {
+            result.left = true;
+            clock.Leave();
+            return;
+        }
+        clock.WaitForStart();
+
+        const uint32_t timeoutMs = (1000 + settings.fps - 1) / settings.fps;
+        const int64_t duration = clock.SlotTime(1);
+        for (uint64_t i = 0; i < totalSlots; ++i)
+        {
+            const uint64_t slot = clock.WaitForSlot(i);
+            if (slot >= totalSlots)
+            {
+                break;
+            }
+            if (slot > i)
+            {
+                result.skippedSlots += slot - i;
+                i = slot;
+            }
+
+            CaptureFrameInfo info;
+            MappedFrame mapped;
+            if (source.AcquireFrame(timeoutMs, info) != CaptureResult::Ok)
+            {
+                ++result.timeouts;
+                continue;
+            }
+            if (!source.MapFrame(mapped))
+            {
+                source.ReleaseFrame();
+                continue;
+            }
+            PixelKernels::CopyRows(staging.data(), static_cast<ptrdiff_t>(pitch), mapped.pPixels,
+                                   static_cast<ptrdiff_t>(mapped.stride), width, height);
+            source.ReleaseFrame();
+            const uint64_t capturedNs = FrameClock::NowNs();
+            result.captureNs[i] = capturedNs;
+            result.lateness.Record(capturedNs - clock.SlotStartNs(i));
+
+            PixelKernels::BgraToNV12(staging.data(), static_cast<ptrdiff_t>(pitch), nv12.data(), width,
+                                     nv12.data() + lumaBytes, static_cast<ptrdiff_t>((width + 1) / 2 * 2), width, height);
+            encoder.BeginPicture(false);
+            encoder.EncodeSlice(0, nv12.data(), width, nv12.data() + lumaBytes, static_cast<ptrdiff_t>((width + 1) / 2 * 2));
+            encoder.FinishPicture(clock.SlotTime(i), duration, i, &sink);
+            result.timestamps[i] = sink.lastPts;
+            ++result.frames;
+        }
+        result.bytes = sink.bytes;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const Settings settings = ParseSettings(argc, argv);
+    FrameClock clock(settings.fps, settings.outputs);
+    std::vector<std::unique_ptr<OutputResult>> results;
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < settings.outputs; ++i)
+    {
+        results.emplace_back(new OutputResult());
+        threads.emplace_back([&, i]() { RecordOutput(settings, i, clock, *results[i]); });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    // --- Check ---
+    const uint64_t totalSlots = static_cast<uint64_t>(settings.fps) * settings.seconds;
+    const uint64_t periodNs = 1000000000ull / settings.fps;
+    uint64_t mismatches = 0;
+    uint64_t alignedSlots = 0;
+    LatencyHistogram skew;
+    uint64_t firstReadyNs = ~0ull;
+    for (const std::unique_ptr<OutputResult>& pResult : results)
+    {
+        firstReadyNs = pResult->readyNs < firstReadyNs ? pResult->readyNs : firstReadyNs;
+    }
+    for (uint64_t slot = 0; slot < totalSlots; ++slot)
+    {
+        uint64_t earliest = ~0ull;
+        uint64_t latest = 0;
+        bool everyOutput = true;
+        for (const std::unique_ptr<OutputResult>& pResult : results)
+        {
+            if (pResult->left)
+            {
+                continue;
+            }
+            const uint64_t captured = pResult->captureNs[slot];
+            if (!captured)
+            {
+                everyOutput = false;
+                continue;
+            }
+            mismatches += pResult->timestamps[slot] != clock.SlotTime(slot);
+            earliest = captured < earliest ? captured : earliest;
+            latest = captured > latest ? captured : latest;
+        }
+        if (everyOutput && latest)
+        {
+            skew.Record(latest - earliest);
+            ++alignedSlots;
+        }
+    }
+    const LatencyHistogram::Summary spread = skew.Summarize();
+    const bool passed = mismatches == 0 && spread.p99 <= periodNs;
+    const double startWaitMs = (clock.StartNs() - firstReadyNs) / 1e6;
+
+    // --- Report ---
+    if (settings.json)
+    {
+        printf("{\"outputs\":[");
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const OutputResult& result = *results[i];
+            const LatencyHistogram::Summary late = result.lateness.Summarize();
+            printf("%s{\"index\":%zu,\"refresh_hz\":%u,\"left\":%s,\"frames\":%llu,\"timeouts\":%llu,\"skipped_slots\":%llu,"
+                   "\"lateness_p50_ms\":%.3f,\"lateness_p99_ms\":%.3f,\"lateness_max_ms\":%.3f,\"output_mbps\":%.1f}",
+                   i ? "," : "", i, result.refreshHz, result.left ? "true" : "false",
+                   static_cast<unsigned long long>(result.frames), static_cast<unsigned long long>(result.timeouts),
+                   static_cast<unsigned long long>(result.skippedSlots), late.p50 / 1e6, late.p99 / 1e6, late.max / 1e6,
+                   result.bytes * 8 / 1e6 / settings.seconds);
+        }
+        printf("],\"fps\":%u,\"slots\":%llu,\"aligned_slots\":%llu,\"start_wait_ms\":%.1f,\"skew_p50_ms\":%.3f,"
+               "\"skew_p99_ms\":%.3f,\"skew_max_ms\":%.3f,\"timestamp_mismatches\":%llu,\"passed\":%s}\n",
+               settings.fps, static_cast<unsigned long long>(totalSlots), static_cast<unsigned long long>(alignedSlots),
+               startWaitMs, spread.p50 / 1e6, spread.p99 / 1e6, spread.max / 1e6,
+               static_cast<unsigned long long>(mismatches), passed ? "true" : "false");
+        return passed ? 0 : 1;
+    }
+
+    printf("%u outputs, %ux%u %s, recorded at %u fps for %u s; clock started %.1f ms after the first output was ready\n",
+           settings.outputs, settings.width, settings.height, settings.workload.c_str(), settings.fps, settings.seconds,
+           startWaitMs);
+    printf("%-7s %8s %8s %9s %8s %14s %14s %14s\n", "output", "refresh", "frames", "timeouts", "skipped", "late p50",
+           "late p99", "late max");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const OutputResult& result = *results[i];
+        if (result.left)
+        {
+            printf("%-7zu %5u Hz   left during setup\n", i, result.refreshHz);
+            continue;
+        }
+        const LatencyHistogram::Summary late = result.lateness.Summarize();
+        printf("%-7zu %5u Hz %8llu %9llu %8llu %11.3f ms %11.3f ms %11.3f ms\n", i, result.refreshHz,
+               static_cast<unsigned long long>(result.frames), static_cast<unsigned long long>(result.timeouts),
+               static_cast<unsigned long long>(result.skippedSlots), late.p50 / 1e6, late.p99 / 1e6, late.max / 1e6);
+    }
+    printf("alignment: %llu of %llu slots captured by every output; capture spread p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           static_cast<unsigned long long>(alignedSlots), static_cast<unsigned long long>(totalSlots), spread.p50 / 1e6,
+           spread.p99 / 1e6, spread.max / 1e6);
+    printf("timestamps: %llu frames stamped with another slot's time -> %s\n", static_cast<unsigned long long>(mismatches),
+           passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,1194 @@
+//======================================================================================
+// MuxRoundTrip.cpp
+// Muxes scripted H.264 streams and reads the files back with a demuxer of its own,
+// checking them against what went in.
+//
+// The access units are made up - start codes, NAL headers and filler - with
+// sizes, GOPs and timestamps chosen to reach the muxer's corners: payloads that
+// end on every byte of a packet, in-band and out-of-band SPS/PPS, frames that
+// carry their own AUD, reordered (B-frame) timestamps, a recording that crosses
+// the 33-bit wrap of the 90 kHz clock after 26.5 hours, frames further apart than
+// 100 ms, and idle gaps longer than a Matroska cluster can span.
+//
+// MPEG-TS (TsMuxer.h) is checked for:
+//   - sync bytes, adaptation field lengths and stuffing;
+//   - continuity counters on every PID;
+//   - PAT and PMT: CRC32, the program and stream they describe, and that they
+//     come before every keyframe and at least every 100 ms;
+//   - one PES per frame, holding the frame exactly (after the AUD and SPS/PPS the
+//     muxer adds), with its PTS and DTS, and the random access flag on keyframes;
+//   - a PCR on every frame, never after the frame's DTS, and at most 100 ms after
+//     the previous one, in PCR-only packets between frames if need be.
+//
+// Matroska (MkvMuxer.h) is checked, written to a seekable sink and to a pipe, for:
+//   - the EBML tree: every element fits exactly in its parent, and sizes are
+//     known where the muxer could seek back to fill them in, unknown otherwise;
+//   - the SeekHead pointing at Info, Tracks and Cues, the TimestampScale, the
+//     Duration, and the track's size and SPS/PPS;
+//   - one SimpleBlock per frame, holding the frame's NAL units without the AUD,
+//     whose cluster timestamp plus relative timecode is the frame's PTS in ms;
+//   - a CuePoint for every keyframe, at the offset of the cluster it starts.
+//
+// Reported per stream: frames, packets or clusters, and container overhead. The first problem
+// in a stream is printed and the run exits with 1.
+//
+// Build and run (from the repository root):
+//     g++ -O2 -std=c++17 -I. bench/MuxRoundTrip.cpp -o mux_round_trip
+//     ./mux_round_trip [--frames 900] [--seed 1]
+//======================================================================================
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../EncodedSink.h"
+#include "../MkvMuxer.h"
+#include "../TsMuxer.h"
+
+namespace
+{
+    struct Settings
+    {
+        uint32_t frames = 900;
+        uint32_t seed = 1;
+    };
+
+    [[noreturn]] void Usage(const char* pProgram)
+    {
+        fprintf(stderr, "Usage: %s [--frames <n>] [--seed <n>]\n", pProgram);
+        exit(2);
+    }
+
+    Settings ParseSettings(int argc, char** argv)
+    {
+        Settings settings;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+            if (arg == "--frames" && hasValue) settings.frames = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--seed" && hasValue) settings.seed = static_cast<uint32_t>(atoi(argv[++i]));
+            else Usage(argv[0]);
+        }
+        if (settings.frames < 2)
+        {
+            Usage(argv[0]);
+        }
+        return settings;
+    }
+
+    // Keeps everything the muxer writes. Unseekable, it stands in for a pipe.
+    class MemorySink : public ByteSink
+    {
+    public:
+        bool Write(const void* pData, size_t size) override
+        {
+            const uint8_t* p = static_cast<const uint8_t*>(pData);
+            bytes.insert(bytes.end(), p, p + size);
+            return true;
+        }
+
+        uint64_t Position() const override
+        {
+            return bytes.size();
+        }
+
+        bool Patch(uint64_t offset, const void* pData, size_t size) override
+        {
+            if (!seekable || offset + size > bytes.size())
+            {
+                return false;
+            }
+            memcpy(bytes.data() + offset, pData, size);
+            return true;
+        }
+
+        std::vector<uint8_t> bytes;
+        bool seekable = true;
+    };
+
+    //==================================================================================
+    // Input
+    //==================================================================================
+    struct Stream
+    {
+        const char* pName;
+        uint32_t fps;
+        uint32_t gop;
+        bool reordered;      // IPBB decode order, so DTS differs from PTS.
+        bool inBandSps;      // Keyframes carry SPS/PPS; otherwise SetSequenceHeader().
+        bool ownAud;         // Frames start with their own AUD.
+        int64_t startPts;    // 100 ns units.
+        size_t minSize;      // Frame sizes: random in [min, max], or min + n when
+        size_t maxSize;      // max is 0, one more byte each frame.
+        uint32_t idleEvery;  // Frames between 34 s idle gaps; 0 for none.
+    };
+
+    struct InputFrame
+    {
+        std::vector<uint8_t> data;
+        int64_t pts;
+        int64_t dts;
+        int64_t duration;
+        bool keyframe;
+    };
+
+    const uint8_t Sps[] = { 0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x28, 0xAC, 0xD9, 0x40, 0x78, 0x02, 0x27 };
+    const uint8_t Pps[] = { 0x00, 0x00, 0x00, 0x01, 0x68, 0xEB, 0xE3, 0xCB, 0x22, 0xC0 };
+    const uint8_t Aud[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
+
+    std::vector<Stream> MakeStreams()
+    {
+        // 2^33 ticks of 90 kHz, less 2 s and the muxer's 0.7 s offset, in 100 ns.
+        const int64_t nearWrap = ((int64_t(1) << 33) - 180000 - 63000) * 1000 / 9;
+        return {
+            { "30fps",         30, 30,  false, true,  false, 0,        200, 60000, 0 },
+            { "sizes",         30, 60,  false, true,  false, 0,        24,  0,     0 },
+            { "60fps-bframes", 60, 61,  true,  false, false, 0,        100, 20000, 0 },
+            { "own-aud",       30, 30,  false, false, true,  0,        50,  4000,  0 },
+            { "5fps",          5,  10,  false, true,  false, 0,        100, 8000,  0 },
+            { "33bit-wrap",    60, 60,  true,  true,  false, nearWrap, 100, 8000,  0 },
+            { "idle-gaps",     30, 600, false, true,  false, 0,        100, 2000,  100 },
+        };
+    }
+
+    //----------------------------------------------------------------------------------
+    // MakeFrames
+    // Access units in decode order. With reordering every GOP after the IDR picture
+    // goes P B B, i.e. the P picture is decoded before the two shown ahead of it.
+    // An idle gap, as on a desktop where nothing changes, can fall inside a GOP.
+    //----------------------------------------------------------------------------------
+    std::vector<InputFrame> MakeFrames(const Stream& stream, uint32_t count, std::mt19937& random)
+    {
+        const int64_t duration = 10000000 / stream.fps;
+        std::vector<InputFrame> frames(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            InputFrame& frame = frames[i];
+            const uint32_t inGop = i % stream.gop;
+            uint32_t shown = i;
+            if (stream.reordered && inGop > 0)
+            {
+                const uint32_t step = (inGop - 1) % 3;
+                shown = i - inGop + (inGop - 1) / 3 * 3 + 1 + (step == 0 ? 2 : step - 1);
+            }
+            frame.keyframe = inGop == 0;
+            frame.duration = duration;
+            const int64_t idle = stream.idleEvery ? (i / stream.idleEvery) * 340000000ll : 0;
+            frame.dts = stream.startPts + idle + i * duration;
+            frame.pts = stream.startPts + idle + (stream.reordered ? shown + 1 : shown) * duration;
+
+            if (stream.ownAud)
+            {
+                frame.data.insert(frame.data.end(), Aud, Aud + sizeof(Aud));
+            }
+            if (frame.keyframe && stream.inBandSps)
+            {
+                frame.data.insert(frame.data.end(), Sps, Sps + sizeof(Sps));
+                frame.data.insert(frame.data.end(), Pps, Pps + sizeof(Pps));
+            }
+            const uint8_t slice[] = { 0x00, 0x00, 0x00, 0x01, static_cast<uint8_t>(frame.keyframe ? 0x65 : 0x41) };
+            frame.data.insert(frame.data.end(), slice, slice + sizeof(slice));
+
+            // Filler without zero bytes, so it never looks like a start code.
+            size_t size = stream.maxSize ? stream.minSize + random() % (stream.maxSize - stream.minSize + 1)
+                                         : stream.minSize + i;
+            size = size > frame.data.size() ? size : frame.data.size() + 1;
+            while (frame.data.size() < size)
+            {
+                frame.data.push_back(static_cast<uint8_t>(1 + random() % 255));
+            }
+        }
+        return frames;
+    }
+
+    bool Fail(const char* pStream, const char* pFormat, ...)
+    {
+        char message[256];
+        va_list args;
+        va_start(args, pFormat);
+        vsnprintf(message, sizeof(message), pFormat, args);
+        va_end(args);
+        fprintf(stderr, "%s: %s\n", pStream, message);
+        return false;
+    }
+
+    //==================================================================================
+    // MPEG-TS
+    //==================================================================================
+    const uint64_t Mask33 = 0x1FFFFFFFFull;
+
+    // The 90 kHz value TsMuxer should write for a 100 ns timestamp.
+    uint64_t ExpectedTicks(int64_t time100ns)
+    {
+        return static_cast<uint64_t>(time100ns * 9 / 1000 + 63000) & Mask33;
+    }
+
+    // MPEG-2 CRC32, bit by bit. Run over a section including its CRC it gives 0.
+    uint32_t Crc32(const uint8_t* pData, size_t size)
+    {
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc ^= static_cast<uint32_t>(pData[i]) << 24;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc & 0x80000000u) ? (crc << 1) ^ 0x04C11DB7u : (crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    // Reads a PTS or DTS; false if the prefix or a marker bit is wrong.
+    bool ReadTimestamp(const uint8_t* p, uint8_t prefix, uint64_t& value)
+    {
+        value = (static_cast<uint64_t>((p[0] >> 1) & 0x07) << 30) | (static_cast<uint64_t>(p[1]) << 22) |
+                (static_cast<uint64_t>(p[2] >> 1) << 15) | (static_cast<uint64_t>(p[3]) << 7) | (p[4] >> 1);
+        return (p[0] >> 4) == prefix && (p[0] & 1) && (p[2] & 1) && (p[4] & 1);
+    }
+
+    struct Pes
+    {
+        std::vector<uint8_t> bytes;
+        uint64_t pcr = 0;
+        bool hasPcr = false;
+        bool randomAccess = false;
+        bool tablesBefore = false; // PAT and PMT since the previous PES.
+        size_t packet = 0;
+    };
+
+    // Reads one PSI section from a packet payload; null if it is malformed.
+    const uint8_t* ReadSection(const uint8_t* pPayload, size_t size, uint8_t tableId, size_t& sectionSize,
+                               const char*& pProblem)
+    {
+        const size_t pointer = pPayload[0];
+        if (1 + pointer + 3 > size)
+        {
+            pProblem = "section pointer runs past the packet";
+            return nullptr;
+        }
+        const uint8_t* pSection = pPayload + 1 + pointer;
+        sectionSize = 3 + (((pSection[1] & 0x0F) << 8) | pSection[2]);
+        if (1 + pointer + sectionSize > size || sectionSize < 12)
+        {
+            pProblem = "section_length does not fit the packet";
+            return nullptr;
+        }
+        if (pSection[0] != tableId || (pSection[1] & 0xC0) != 0x80)
+        {
+            pProblem = "wrong table_id or section_syntax_indicator";
+            return nullptr;
+        }
+        if (Crc32(pSection, sectionSize) != 0)
+        {
+            pProblem = "CRC32 mismatch";
+            return nullptr;
+        }
+        for (size_t i = 1 + pointer + sectionSize; i < size; ++i)
+        {
+            if (pPayload[i] != 0xFF)
+            {
+                pProblem = "stuffing after the section is not 0xFF";
+                return nullptr;
+            }
+        }
+        return pSection;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [CheckTs]
+    // Demuxes the file packet by packet, then matches the PES packets to the input.
+    //----------------------------------------------------------------------------------
+    bool CheckTs(const Stream& stream, const std::vector<uint8_t>& file, const std::vector<InputFrame>& frames,
+                 uint32_t& tables)
+    {
+        const char* pName = stream.pName;
+        if (file.size() % TsMuxer::PacketSize != 0)
+        {
+            return Fail(pName, "%zu bytes is not a whole number of packets", file.size());
+        }
+
+        int continuity[0x2000];
+        memset(continuity, -1, sizeof(continuity));
+        std::vector<Pes> pes;
+        bool patSeen = false;
+        bool pmtSeen = false;
+        uint64_t lastPcr = 0;
+        bool pcrSeen = false;
+        tables = 0;
+        const char* pProblem = nullptr;
+
+        const size_t packets = file.size() / TsMuxer::PacketSize;
+        for (size_t n = 0; n < packets; ++n)
+        {
+            const uint8_t* p = file.data() + n * TsMuxer::PacketSize;
+            const uint16_t pid = static_cast<uint16_t>(((p[1] & 0x1F) << 8) | p[2]);
+            const bool unitStart = (p[1] & 0x40) != 0;
+            const uint8_t control = (p[3] >> 4) & 0x03;
+            const int cc = p[3] & 0x0F;
+            if (p[0] != 0x47 || (p[1] & 0x80) || (p[3] & 0xC0) || control == 0)
+            {
+                return Fail(pName, "packet %zu: bad sync byte, error, scrambling or adaptation bits", n);
+            }
+
+            // Continuity: +1 per packet with payload, unchanged without.
+            if (continuity[pid] >= 0)
+            {
+                const int expected = (control & 0x01) ? (continuity[pid] + 1) & 0x0F : continuity[pid];
+                if (cc != expected)
+                {
+                    return Fail(pName, "packet %zu: PID 0x%x continuity counter %d, expected %d", n, pid, cc, expected);
+                }
+            }
+            continuity[pid] = cc;
+
+            // Adaptation field: flags, PCR, then nothing but stuffing.
+            size_t at = 4;
+            bool randomAccess = false;
+            bool hasPcr = false;
+            uint64_t pcr = 0;
+            if (control & 0x02)
+            {
+                const size_t length = p[4];
+                if ((control == 0x02 && length != 183) || (control == 0x03 && length > 182))
+                {
+                    return Fail(pName, "packet %zu: adaptation_field_length %zu", n, length);
+                }
+                size_t field = 5;
+                if (length > 0)
+                {
+                    const uint8_t flags = p[field++];
+                    randomAccess = (flags & 0x40) != 0;
+                    if (flags & 0x10)
+                    {
+                        if (length < 7)
+                        {
+                            return Fail(pName, "packet %zu: PCR runs past the adaptation field", n);
+                        }
+                        hasPcr = true;
+                        pcr = (static_cast<uint64_t>(p[field]) << 25) | (static_cast<uint64_t>(p[field + 1]) << 17) |
+                              (static_cast<uint64_t>(p[field + 2]) << 9) | (static_cast<uint64_t>(p[field + 3]) << 1) |
+                              (p[field + 4] >> 7);
+                        field += 6;
+                    }
+                    if (flags & 0x0F)
+                    {
+                        return Fail(pName, "packet %zu: unexpected adaptation field flags 0x%x", n, flags);
+                    }
+                }
+                for (; field < 5 + length; ++field)
+                {
+                    if (p[field] != 0xFF)
+                    {
+                        return Fail(pName, "packet %zu: adaptation field stuffing is not 0xFF", n);
+                    }
+                }
+                at = 5 + length;
+            }
+            const uint8_t* pPayload = p + at;
+            const size_t payloadSize = (control & 0x01) ? TsMuxer::PacketSize - at : 0;
+
+            // ISO 13818-1: PCRs at most 100 ms apart (which also keeps them rising).
+            if (hasPcr)
+            {
+                if (pcrSeen && ((pcr - lastPcr) & Mask33) > 9000)
+                {
+                    return Fail(pName, "packet %zu: PCR %llu more than 100 ms after the previous %llu", n,
+                                static_cast<unsigned long long>(pcr), static_cast<unsigned long long>(lastPcr));
+                }
+                lastPcr = pcr;
+                pcrSeen = true;
+            }
+
+            if (pid == 0x0000)
+            {
+                size_t size = 0;
+                const uint8_t* pPat = unitStart && payloadSize ? ReadSection(pPayload, payloadSize, 0x00, size, pProblem)
+                                                               : nullptr;
+                if (!pPat)
+                {
+                    return Fail(pName, "packet %zu: PAT: %s", n, pProblem ? pProblem : "no section start");
+                }
+                // One program after the 8-byte header, then the CRC.
+                const uint16_t program = static_cast<uint16_t>((pPat[8] << 8) | pPat[9]);
+                const uint16_t pmtPid = static_cast<uint16_t>(((pPat[10] & 0x1F) << 8) | pPat[11]);
+                if (size != 8 + 4 + 4 || program != 1 || pmtPid != TsMuxer::PmtPid)
+                {
+                    return Fail(pName, "packet %zu: PAT does not map program 1 to the PMT PID", n);
+                }
+                patSeen = true;
+            }
+            else if (pid == TsMuxer::PmtPid)
+            {
+                size_t size = 0;
+                const uint8_t* pPmt = unitStart && payloadSize ? ReadSection(pPayload, payloadSize, 0x02, size, pProblem)
+                                                               : nullptr;
+                if (!pPmt)
+                {
+                    return Fail(pName, "packet %zu: PMT: %s", n, pProblem ? pProblem : "no section start");
+                }
+                const uint16_t pcrPid = static_cast<uint16_t>(((pPmt[8] & 0x1F) << 8) | pPmt[9]);
+                const size_t infoLength = ((pPmt[10] & 0x0F) << 8) | pPmt[11];
+                const uint8_t* pEs = pPmt + 12 + infoLength;
+                const uint16_t esPid = static_cast<uint16_t>(((pEs[1] & 0x1F) << 8) | pEs[2]);
+                if (pcrPid != TsMuxer::VideoPid || 12 + infoLength + 5 + 4 != size || pEs[0] != 0x1B ||
+                    esPid != TsMuxer::VideoPid)
+                {
+                    return Fail(pName, "packet %zu: PMT does not describe one H.264 stream carrying the PCR", n);
+                }
+                pmtSeen = patSeen;
+            }
+            else if (pid == TsMuxer::VideoPid)
+            {
+                if (!(control & 0x01))
+                {
+                    // Adaptation field only: a PCR between frames, nothing else.
+                    if (!hasPcr || randomAccess || unitStart || pes.empty())
+                    {
+                        return Fail(pName, "packet %zu: video packet without payload or PCR", n);
+                    }
+                }
+                else if (unitStart)
+                {
+                    pes.emplace_back();
+                    Pes& unit = pes.back();
+                    unit.pcr = pcr;
+                    unit.hasPcr = hasPcr;
+                    unit.randomAccess = randomAccess;
+                    unit.tablesBefore = patSeen && pmtSeen;
+                    unit.packet = n;
+                    tables += unit.tablesBefore ? 1 : 0;
+                    patSeen = false;
+                    pmtSeen = false;
+                }
+                else if (pes.empty())
+                {
+                    return Fail(pName, "packet %zu: video payload before the first unit start", n);
+                }
+                else if (hasPcr || randomAccess)
+                {
+                    return Fail(pName, "packet %zu: PCR or random access flag inside a PES", n);
+                }
+                pes.back().bytes.insert(pes.back().bytes.end(), pPayload, pPayload + payloadSize);
+            }
+            else
+            {
+                return Fail(pName, "packet %zu: unexpected PID 0x%x", n, pid);
+            }
+        }
+
+        if (pes.size() != frames.size())
+        {
+            return Fail(pName, "%zu PES packets for %zu frames", pes.size(), frames.size());
+        }
+
+        // Each PES against its frame.
+        int64_t lastTablesPts = 0;
+        std::vector<uint8_t> expected;
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            const InputFrame& frame = frames[i];
+            const Pes& unit = pes[i];
+            const uint8_t* b = unit.bytes.data();
+            if (unit.bytes.size() < 14 || b[0] != 0x00 || b[1] != 0x00 || b[2] != 0x01 || b[3] != 0xE0 ||
+                (b[6] & 0xC0) != 0x80)
+            {
+                return Fail(pName, "frame %zu: no PES header for video stream 0", i);
+            }
+            const size_t packetLength = (b[4] << 8) | b[5];
+            const uint8_t timestamps = b[7] >> 6;
+            const size_t headerLength = b[8];
+            if ((packetLength != 0 && packetLength != unit.bytes.size() - 6) ||
+                headerLength != (timestamps == 3 ? 10u : 5u) || 9 + headerLength > unit.bytes.size())
+            {
+                return Fail(pName, "frame %zu: PES length fields do not match", i);
+            }
+
+            uint64_t pts = 0;
+            uint64_t dts = 0;
+            if ((timestamps != 2 && timestamps != 3) || !ReadTimestamp(b + 9, timestamps, pts) ||
+                (timestamps == 3 && !ReadTimestamp(b + 14, 1, dts)))
+            {
+                return Fail(pName, "frame %zu: malformed PTS/DTS", i);
+            }
+            dts = timestamps == 3 ? dts : pts;
+            if (pts != ExpectedTicks(frame.pts) || dts != ExpectedTicks(frame.dts) ||
+                (timestamps == 3) != (frame.pts * 9 / 1000 != frame.dts * 9 / 1000))
+            {
+                return Fail(pName, "frame %zu: PTS %llu DTS %llu, expected %llu and %llu", i,
+                            static_cast<unsigned long long>(pts), static_cast<unsigned long long>(dts),
+                            static_cast<unsigned long long>(ExpectedTicks(frame.pts)),
+                            static_cast<unsigned long long>(ExpectedTicks(frame.dts)));
+            }
+
+            // The PCR must not pass the DTS (modulo the wrap).
+            if (!unit.hasPcr)
+            {
+                return Fail(pName, "frame %zu: no PCR", i);
+            }
+            const uint64_t lead = (dts - unit.pcr) & Mask33;
+            if (lead > 90000)
+            {
+                return Fail(pName, "frame %zu: PCR %llu against DTS %llu", i, static_cast<unsigned long long>(unit.pcr),
+                            static_cast<unsigned long long>(dts));
+            }
+
+            // Tables before every keyframe and at least every 100 ms.
+            if (frame.keyframe && (!unit.tablesBefore || !unit.randomAccess))
+            {
+                return Fail(pName, "frame %zu: keyframe without PAT/PMT or random access flag", i);
+            }
+            if (!frame.keyframe && unit.randomAccess)
+            {
+                return Fail(pName, "frame %zu: random access flag on a non-keyframe", i);
+            }
+            const int64_t ticks = frame.pts * 9 / 1000;
+            if (unit.tablesBefore)
+            {
+                lastTablesPts = ticks;
+            }
+            else if (i == 0 || ticks - lastTablesPts >= 9000)
+            {
+                return Fail(pName, "frame %zu: no PAT/PMT for 100 ms", i);
+            }
+
+            // The payload: an AUD unless the frame has one, SPS/PPS on keyframes if
+            // they came out of band, then the frame itself.
+            expected.clear();
+            if (!stream.ownAud)
+            {
+                expected.insert(expected.end(), Aud, Aud + sizeof(Aud));
+            }
+            if (frame.keyframe && !stream.inBandSps)
+            {
+                expected.insert(expected.end(), Sps, Sps + sizeof(Sps));
+                expected.insert(expected.end(), Pps, Pps + sizeof(Pps));
+            }
+            expected.insert(expected.end(), frame.data.begin(), frame.data.end());
+            const size_t payloadSize = unit.bytes.size() - 9 - headerLength;
+            if (payloadSize != expected.size() || memcmp(b + 9 + headerLength, expected.data(), payloadSize) != 0)
+            {
+                return Fail(pName, "frame %zu: payload of %zu bytes differs from the %zu expected", i, payloadSize,
+                            expected.size());
+            }
+        }
+        return true;
+    }
+
+    bool RunTs(const Stream& stream, const std::vector<InputFrame>& frames, size_t inputBytes)
+    {
+        MemorySink sink;
+        TsMuxer muxer;
+        muxer.Open(&sink);
+        if (!stream.inBandSps)
+        {
+            uint8_t header[sizeof(Sps) + sizeof(Pps)];
+            memcpy(header, Sps, sizeof(Sps));
+            memcpy(header + sizeof(Sps), Pps, sizeof(Pps));
+            muxer.SetSequenceHeader(header, sizeof(header));
+        }
+        for (const InputFrame& frame : frames)
+        {
+            const EncodedFrame encoded = { frame.data.data(), frame.data.size(), frame.pts, frame.dts,
+                                           frame.duration, frame.keyframe, 0 };
+            if (!muxer.WriteFrame(encoded))
+            {
+                return Fail(stream.pName, "TsMuxer::WriteFrame failed");
+            }
+        }
+        if (!muxer.Finish())
+        {
+            return Fail(stream.pName, "TsMuxer::Finish failed");
+        }
+
+        uint32_t tables = 0;
+        const bool ok = CheckTs(stream, sink.bytes, frames, tables);
+        printf("%-8s %-14s %5zu frames %7zu packets %5u PAT/PMT  overhead %5.2f%%  %s\n", "ts", stream.pName,
+               frames.size(), sink.bytes.size() / TsMuxer::PacketSize, tables,
+               100.0 * (sink.bytes.size() - inputBytes) / sink.bytes.size(), ok ? "PASS" : "FAIL");
+        return ok;
+    }
+
+    //==================================================================================
+    // Matroska
+    //==================================================================================
+    const uint32_t IdEbml = 0x1A45DFA3;
+    const uint32_t IdDocType = 0x4282;
+    const uint32_t IdSegment = 0x18538067;
+    const uint32_t IdSeekHead = 0x114D9B74;
+    const uint32_t IdSeek = 0x4DBB;
+    const uint32_t IdSeekId = 0x53AB;
+    const uint32_t IdSeekPosition = 0x53AC;
+    const uint32_t IdInfo = 0x1549A966;
+    const uint32_t IdTimestampScale = 0x2AD7B1;
+    const uint32_t IdDuration = 0x4489;
+    const uint32_t IdTracks = 0x1654AE6B;
+    const uint32_t IdTrackEntry = 0xAE;
+    const uint32_t IdTrackNumber = 0xD7;
+    const uint32_t IdCodecId = 0x86;
+    const uint32_t IdCodecPrivate = 0x63A2;
+    const uint32_t IdVideo = 0xE0;
+    const uint32_t IdPixelWidth = 0xB0;
+    const uint32_t IdPixelHeight = 0xBA;
+    const uint32_t IdCluster = 0x1F43B675;
+    const uint32_t IdClusterTimestamp = 0xE7;
+    const uint32_t IdSimpleBlock = 0xA3;
+    const uint32_t IdCues = 0x1C53BB6B;
+    const uint32_t IdCuePoint = 0xBB;
+    const uint32_t IdCueTime = 0xB3;
+    const uint32_t IdCueTrackPositions = 0xB7;
+    const uint32_t IdCueTrack = 0xF7;
+    const uint32_t IdCueClusterPosition = 0xF1;
+    const uint32_t IdVoid = 0xEC;
+
+    const uint32_t MkvWidth = 1920;
+    const uint32_t MkvHeight = 1080;
+
+    struct Element
+    {
+        uint32_t id = 0;
+        uint64_t position = 0; // Of the ID.
+        uint64_t data = 0;
+        uint64_t size = 0;     // Up to the parent's end when unknown.
+        bool unknownSize = false;
+    };
+
+    //==================================================================================
+    // MkvReader
+    // Walks the EBML tree, checking that every element fits in its parent.
+    //==================================================================================
+    class MkvReader
+    {
+    public:
+        MkvReader(const char* pName, const std::vector<uint8_t>& file) : m_pName(pName), m_file(file) {}
+
+        // Reads the element at 'at', which must end by 'end'.
+        bool Read(uint64_t at, uint64_t end, Element& element) const
+        {
+            element.position = at;
+            size_t length = 0;
+            uint64_t id = 0;
+            if (!ReadVint(at, end, length, id, true) || length > 4)
+            {
+                return Fail(m_pName, "offset %llu: bad element ID", Offset(at));
+            }
+            element.id = static_cast<uint32_t>(id);
+            uint64_t size = 0;
+            size_t sizeLength = 0;
+            if (!ReadVint(at + length, end, sizeLength, size, false))
+            {
+                return Fail(m_pName, "offset %llu: bad size of element 0x%x", Offset(at), element.id);
+            }
+            element.data = at + length + sizeLength;
+            element.unknownSize = size == (1ull << (7 * sizeLength)) - 1;
+            element.size = element.unknownSize ? end - element.data : size;
+            if (element.data > end || element.size > end - element.data)
+            {
+                return Fail(m_pName, "offset %llu: element 0x%x runs past its parent", Offset(at), element.id);
+            }
+            return true;
+        }
+
+        // Calls 'visit' for each child of a known-size master element.
+        template <typename Visit>
+        bool ForEachChild(const Element& parent, Visit visit) const
+        {
+            const uint64_t end = parent.data + parent.size;
+            for (uint64_t at = parent.data; at < end;)
+            {
+                Element child;
+                if (!Read(at, end, child) || !visit(child))
+                {
+                    return false;
+                }
+                at = child.data + child.size;
+            }
+            return true;
+        }
+
+        uint64_t UInt(const Element& element) const
+        {
+            uint64_t value = 0;
+            for (uint64_t i = 0; i < element.size && i < 8; ++i)
+            {
+                value = (value << 8) | m_file[element.data + i];
+            }
+            return value;
+        }
+
+        double Float(const Element& element) const
+        {
+            const uint64_t bits = UInt(element);
+            if (element.size == 4)
+            {
+                const uint32_t bits32 = static_cast<uint32_t>(bits);
+                float value;
+                memcpy(&value, &bits32, sizeof(value));
+                return value;
+            }
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        std::string String(const Element& element) const
+        {
+            return std::string(reinterpret_cast<const char*>(m_file.data() + element.data), element.size);
+        }
+
+        const uint8_t* Data(const Element& element) const
+        {
+            return m_file.data() + element.data;
+        }
+
+    private:
+        static unsigned long long Offset(uint64_t at)
+        {
+            return static_cast<unsigned long long>(at);
+        }
+
+        // An EBML variable-length integer: the position of the first set bit gives
+        // the length. IDs keep that marker bit, sizes drop it.
+        bool ReadVint(uint64_t at, uint64_t end, size_t& length, uint64_t& value, bool keepMarker) const
+        {
+            if (at >= end || m_file[at] == 0)
+            {
+                return false;
+            }
+            length = 1;
+            while (!(m_file[at] & (0x80 >> (length - 1))))
+            {
+                ++length;
+            }
+            if (at + length > end)
+            {
+                return false;
+            }
+            value = keepMarker ? m_file[at] : m_file[at] & (0xFF >> length);
+            for (size_t i = 1; i < length; ++i)
+            {
+                value = (value << 8) | m_file[at + i];
+            }
+            return true;
+        }
+
+        const char* m_pName;
+        const std::vector<uint8_t>& m_file;
+    };
+
+    // Splits Annex-B data at its start codes.
+    std::vector<std::vector<uint8_t>> SplitNals(const std::vector<uint8_t>& data)
+    {
+        std::vector<size_t> starts;
+        for (size_t i = 0; i + 3 <= data.size(); ++i)
+        {
+            if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+            {
+                starts.push_back(i + 3);
+            }
+        }
+        std::vector<std::vector<uint8_t>> nals;
+        for (size_t n = 0; n < starts.size(); ++n)
+        {
+            size_t end = n + 1 < starts.size() ? starts[n + 1] - 3 : data.size();
+            while (end > starts[n] && data[end - 1] == 0)
+            {
+                --end;
+            }
+            nals.emplace_back(data.begin() + starts[n], data.begin() + end);
+        }
+        return nals;
+    }
+
+    struct Cluster
+    {
+        uint64_t timestamp;
+        bool startsWithKeyframe;
+    };
+
+    //----------------------------------------------------------------------------------
+    // [CheckMkv]
+    // Walks the file, then matches the blocks to the input and the cues to the
+    // clusters.
+    //----------------------------------------------------------------------------------
+    bool CheckMkv(const Stream& stream, const std::vector<uint8_t>& file, const std::vector<InputFrame>& frames,
+                  bool seekable, size_t& clusterCount, size_t& cueCount)
+    {
+        const char* pName = stream.pName;
+        const MkvReader reader(pName, file);
+
+        Element ebml;
+        bool matroska = false;
+        if (!reader.Read(0, file.size(), ebml) || ebml.id != IdEbml || ebml.unknownSize ||
+            !reader.ForEachChild(ebml, [&](const Element& child) {
+                matroska = matroska || (child.id == IdDocType && reader.String(child) == "matroska");
+                return true;
+            }))
+        {
+            return Fail(pName, "no EBML header");
+        }
+        if (!matroska)
+        {
+            return Fail(pName, "DocType is not matroska");
+        }
+
+        // One Segment to the end of the file; its size is only known if the muxer
+        // could seek back.
+        Element segment;
+        if (!reader.Read(ebml.data + ebml.size, file.size(), segment) || segment.id != IdSegment)
+        {
+            return Fail(pName, "no Segment after the EBML header");
+        }
+        if (segment.unknownSize == seekable || segment.data + segment.size != file.size())
+        {
+            return Fail(pName, "Segment size %s, expected it to end the file %s", segment.unknownSize ? "unknown" : "known",
+                        seekable ? "with a known size" : "with an unknown size");
+        }
+
+        std::vector<std::pair<uint32_t, uint64_t>> seeks;
+        std::vector<std::pair<uint32_t, uint64_t>> elements; // Top-level elements by offset.
+        std::vector<std::pair<uint64_t, Cluster>> clusters;  // By offset in the Segment.
+        std::vector<std::pair<uint64_t, uint64_t>> cues;     // Time and cluster offset.
+        double duration = -1.0;
+        size_t block = 0;
+        const uint64_t segmentEnd = segment.data + segment.size;
+
+        for (uint64_t at = segment.data; at < segmentEnd;)
+        {
+            Element element;
+            if (!reader.Read(at, segmentEnd, element))
+            {
+                return false;
+            }
+            elements.push_back({ element.id, element.position - segment.data });
+
+            if (element.id == IdCluster)
+            {
+                // An unknown-size cluster runs to the next cluster or the cues.
+                if (element.unknownSize == seekable)
+                {
+                    return Fail(pName, "cluster at %llu has %s size", static_cast<unsigned long long>(element.position),
+                                element.unknownSize ? "an unknown" : "a known");
+                }
+                uint64_t end = element.data + element.size;
+                bool first = true;
+                Cluster cluster = { 0, false };
+                for (uint64_t child = element.data; child < end;)
+                {
+                    Element item;
+                    if (!reader.Read(child, end, item))
+                    {
+                        return false;
+                    }
+                    if (element.unknownSize && (item.id == IdCluster || item.id == IdCues))
+                    {
+                        end = child;
+                        break;
+                    }
+                    if (first != (item.id == IdClusterTimestamp))
+                    {
+                        return Fail(pName, "cluster at %llu does not start with its timestamp",
+                                    static_cast<unsigned long long>(element.position));
+                    }
+                    if (item.id == IdClusterTimestamp)
+                    {
+                        cluster.timestamp = reader.UInt(item);
+                    }
+                    else if (item.id != IdSimpleBlock)
+                    {
+                        return Fail(pName, "unexpected element 0x%x in a cluster", item.id);
+                    }
+                    else
+                    {
+                        // Track 1, 16-bit timestamp relative to the cluster, flags
+                        // without lacing, then length-prefixed NAL units.
+                        const uint8_t* b = reader.Data(item);
+                        if (item.size < 4 || b[0] != 0x81 || (b[3] & 0x06))
+                        {
+                            return Fail(pName, "block %zu: not a plain SimpleBlock for track 1", block);
+                        }
+                        if (block == frames.size())
+                        {
+                            return Fail(pName, "more blocks than frames");
+                        }
+                        const InputFrame& frame = frames[block];
+                        const int16_t relative = static_cast<int16_t>((b[1] << 8) | b[2]);
+                        const int64_t timestamp = static_cast<int64_t>(cluster.timestamp) + relative;
+                        const bool keyframe = (b[3] & 0x80) != 0;
+                        if (timestamp != frame.pts / 10000 || keyframe != frame.keyframe)
+                        {
+                            return Fail(pName, "block %zu: %lld ms (cluster %llu%+d)%s, expected %lld ms%s", block,
+                                        static_cast<long long>(timestamp),
+                                        static_cast<unsigned long long>(cluster.timestamp), relative,
+                                        keyframe ? " key" : "", static_cast<long long>(frame.pts / 10000),
+                                        frame.keyframe ? " key" : "");
+                        }
+                        if (first)
+                        {
+                            return Fail(pName, "block %zu before its cluster's timestamp", block);
+                        }
+                        // The frame's NAL units without the AUD, each behind a
+                        // 4-byte length.
+                        std::vector<uint8_t> expected;
+                        for (const std::vector<uint8_t>& nal : SplitNals(frame.data))
+                        {
+                            if ((nal[0] & 0x1F) == 9)
+                            {
+                                continue;
+                            }
+                            const uint32_t size = static_cast<uint32_t>(nal.size());
+                            const uint8_t length[4] = { static_cast<uint8_t>(size >> 24), static_cast<uint8_t>(size >> 16),
+                                                        static_cast<uint8_t>(size >> 8), static_cast<uint8_t>(size) };
+                            expected.insert(expected.end(), length, length + 4);
+                            expected.insert(expected.end(), nal.begin(), nal.end());
+                        }
+                        if (item.size - 4 != expected.size() || memcmp(b + 4, expected.data(), expected.size()) != 0)
+                        {
+                            return Fail(pName, "block %zu: payload of %llu bytes differs from the %zu expected", block,
+                                        static_cast<unsigned long long>(item.size - 4), expected.size());
+                        }
+                        if (clusters.empty() || clusters.back().first != element.position - segment.data)
+                        {
+                            cluster.startsWithKeyframe = keyframe;
+                            clusters.push_back({ element.position - segment.data, cluster });
+                        }
+                        ++block;
+                    }
+                    first = false;
+                    child = item.data + item.size;
+                }
+                at = end;
+                continue;
+            }
+
+            if (element.unknownSize)
+            {
+                return Fail(pName, "element 0x%x has an unknown size", element.id);
+            }
+            bool ok = true;
+            if (element.id == IdSeekHead)
+            {
+                ok = reader.ForEachChild(element, [&](const Element& seek) {
+                    uint32_t id = 0;
+                    uint64_t position = 0;
+                    const bool read = seek.id == IdSeek && reader.ForEachChild(seek, [&](const Element& field) {
+                        id = field.id == IdSeekId ? static_cast<uint32_t>(reader.UInt(field)) : id;
+                        position = field.id == IdSeekPosition ? reader.UInt(field) : position;
+                        return true;
+                    });
+                    seeks.push_back({ id, position });
+                    return read || Fail(pName, "malformed Seek");
+                });
+            }
+            else if (element.id == IdInfo)
+            {
+                uint64_t scale = 0;
+                ok = reader.ForEachChild(element, [&](const Element& field) {
+                    scale = field.id == IdTimestampScale ? reader.UInt(field) : scale;
+                    duration = field.id == IdDuration ? reader.Float(field) : duration;
+                    return true;
+                });
+                if (ok && scale != MkvMuxer::TimestampScaleNs)
+                {
+                    return Fail(pName, "TimestampScale %llu", static_cast<unsigned long long>(scale));
+                }
+            }
+            else if (element.id == IdTracks)
+            {
+                // One H.264 track with the stream's size and its SPS/PPS in an
+                // AVCDecoderConfigurationRecord.
+                std::vector<uint8_t> avcc = { 1, Sps[5], Sps[6], Sps[7], 0xFF, 0xE1, 0, sizeof(Sps) - 4 };
+                avcc.insert(avcc.end(), Sps + 4, Sps + sizeof(Sps));
+                avcc.insert(avcc.end(), { 1, 0, sizeof(Pps) - 4 });
+                avcc.insert(avcc.end(), Pps + 4, Pps + sizeof(Pps));
+                size_t entries = 0;
+                uint64_t track = 0;
+                uint64_t width = 0;
+                uint64_t height = 0;
+                std::string codec;
+                std::vector<uint8_t> codecPrivate;
+                ok = reader.ForEachChild(element, [&](const Element& entry) {
+                    ++entries;
+                    return entry.id == IdTrackEntry && reader.ForEachChild(entry, [&](const Element& field) {
+                        track = field.id == IdTrackNumber ? reader.UInt(field) : track;
+                        codec = field.id == IdCodecId ? reader.String(field) : codec;
+                        if (field.id == IdCodecPrivate)
+                        {
+                            codecPrivate.assign(reader.Data(field), reader.Data(field) + field.size);
+                        }
+                        return field.id != IdVideo || reader.ForEachChild(field, [&](const Element& video) {
+                            width = video.id == IdPixelWidth ? reader.UInt(video) : width;
+                            height = video.id == IdPixelHeight ? reader.UInt(video) : height;
+                            return true;
+                        });
+                    });
+                });
+                if (ok && (entries != 1 || track != 1 || codec != "V_MPEG4/ISO/AVC" || codecPrivate != avcc ||
+                           width != MkvWidth || height != MkvHeight))
+                {
+                    return Fail(pName, "Tracks do not describe the one H.264 stream and its SPS/PPS");
+                }
+            }
+            else if (element.id == IdCues)
+            {
+                ok = reader.ForEachChild(element, [&](const Element& point) {
+                    uint64_t time = ~0ull;
+                    uint64_t track = 0;
+                    uint64_t position = ~0ull;
+                    const bool read = point.id == IdCuePoint && reader.ForEachChild(point, [&](const Element& field) {
+                        time = field.id == IdCueTime ? reader.UInt(field) : time;
+                        return field.id != IdCueTrackPositions || reader.ForEachChild(field, [&](const Element& p) {
+                            track = p.id == IdCueTrack ? reader.UInt(p) : track;
+                            position = p.id == IdCueClusterPosition ? reader.UInt(p) : position;
+                            return true;
+                        });
+                    });
+                    cues.push_back({ time, position });
+                    return (read && track == 1) || Fail(pName, "malformed CuePoint");
+                });
+            }
+            else if (element.id != IdVoid)
+            {
+                return Fail(pName, "unexpected element 0x%x in the Segment", element.id);
+            }
+            if (!ok)
+            {
+                return false;
+            }
+            at = element.data + element.size;
+        }
+
+        if (block != frames.size())
+        {
+            return Fail(pName, "%zu blocks for %zu frames", block, frames.size());
+        }
+
+        // A cue for every keyframe, pointing at the cluster it starts.
+        size_t keyframes = 0;
+        for (const InputFrame& frame : frames)
+        {
+            if (!frame.keyframe)
+            {
+                continue;
+            }
+            const uint64_t time = frame.pts / 10000;
+            if (keyframes >= cues.size() || cues[keyframes].first != time)
+            {
+                return Fail(pName, "no cue for the keyframe at %llu ms", static_cast<unsigned long long>(time));
+            }
+            const uint64_t position = cues[keyframes].second;
+            bool found = false;
+            for (const auto& cluster : clusters)
+            {
+                found = found || (cluster.first == position && cluster.second.timestamp == time &&
+                                  cluster.second.startsWithKeyframe);
+            }
+            if (!found)
+            {
+                return Fail(pName, "cue %zu points at %llu, not at the cluster its keyframe starts", keyframes,
+                            static_cast<unsigned long long>(position));
+            }
+            ++keyframes;
+        }
+        if (cues.size() != keyframes)
+        {
+            return Fail(pName, "%zu cues for %zu keyframes", cues.size(), keyframes);
+        }
+
+        // Finish() fills in the SeekHead and Duration when it can seek back.
+        uint64_t end = 0;
+        for (const InputFrame& frame : frames)
+        {
+            const uint64_t frameEnd = frame.pts / 10000 + frame.duration / 10000;
+            end = frameEnd > end ? frameEnd : end;
+        }
+        if (duration != (seekable ? static_cast<double>(end) : 0.0))
+        {
+            return Fail(pName, "Duration %.0f ms, expected %llu", duration, seekable ? static_cast<unsigned long long>(end) : 0ull);
+        }
+        if (seeks.size() != (seekable ? 3u : 0u))
+        {
+            return Fail(pName, "%zu SeekHead entries", seeks.size());
+        }
+        for (const auto& seek : seeks)
+        {
+            bool found = false;
+            for (const auto& element : elements)
+            {
+                found = found || element == seek;
+            }
+            if (!found || (seek.first != IdInfo && seek.first != IdTracks && seek.first != IdCues))
+            {
+                return Fail(pName, "Seek to 0x%x at %llu finds no such element", seek.first,
+                            static_cast<unsigned long long>(seek.second));
+            }
+        }
+
+        clusterCount = clusters.size();
+        cueCount = cues.size();
+        return true;
+    }
+
+    bool RunMkv(const Stream& stream, const std::vector<InputFrame>& frames, size_t inputBytes, bool seekable)
+    {
+        MemorySink sink;
+        sink.seekable = seekable;
+        MkvMuxer muxer;
+        muxer.Open(&sink, MkvWidth, MkvHeight);
+        if (!stream.inBandSps)
+        {
+            uint8_t header[sizeof(Sps) + sizeof(Pps)];
+            memcpy(header, Sps, sizeof(Sps));
+            memcpy(header + sizeof(Sps), Pps, sizeof(Pps));
+            muxer.SetSequenceHeader(header, sizeof(header));
+        }
+        for (const InputFrame& frame : frames)
+        {
+            const EncodedFrame encoded = { frame.data.data(), frame.data.size(), frame.pts, frame.dts,
+                                           frame.duration, frame.keyframe, 0 };
+            if (!muxer.WriteFrame(encoded))
+            {
+                return Fail(stream.pName, "MkvMuxer::WriteFrame failed");
+            }
+        }
+        if (!muxer.Finish())
+        {
+            return Fail(stream.pName, "MkvMuxer::Finish failed");
+        }
+
+        size_t clusters = 0;
+        size_t cues = 0;
+        const bool ok = CheckMkv(stream, sink.bytes, frames, seekable, clusters, cues);
+        printf("%-8s %-14s %5zu frames %7zu clusters %4zu cues     overhead %5.2f%%  %s\n",
+               seekable ? "mkv" : "mkv-pipe", stream.pName, frames.size(), clusters, cues,
+               100.0 * (static_cast<double>(sink.bytes.size()) - inputBytes) / sink.bytes.size(), ok ? "PASS" : "FAIL");
+        return ok;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const Settings settings = ParseSettings(argc, argv);
+    std::mt19937 random(settings.seed);
+
+    bool ok = true;
+    for (const Stream& stream : MakeStreams())
+    {
+        const uint32_t count = stream.maxSize ? settings.frames : 2 * TsMuxer::PacketSize;
+        const std::vector<InputFrame> frames = MakeFrames(stream, count, random);
+        size_t inputBytes = 0;
+        for (const InputFrame& frame : frames)
+        {
+            inputBytes += frame.data.size();
+        }
+        ok = RunTs(stream, frames, inputBytes) && ok;
+        ok = RunMkv(stream, frames, inputBytes, true) && ok;
+        ok = RunMkv(stream, frames, inputBytes, false) && ok;
+    }
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,426 @@
+#pragma once
+//======================================================================================
+// PcmH264Encoder.h
+// A minimal, portable H.264 encoder that stands in for the Media Foundation encoder
+// where there is none (the pipeline benchmark on Linux). It produces a valid
+// Baseline-profile stream a regular decoder plays, but does no real compression:
+//
+//   - Macroblocks that changed since the previous picture are sent as I_PCM, i.e.
+//     their raw 4:2:0 samples.
+//   - Unchanged macroblocks in P pictures are skipped. Every motion vector in the
+//     stream is zero, so a skip is an exact copy of the same macroblock in the
+//     previous picture, and the decoded output is lossless with respect to the
+//     NV12 input. Deblocking is off so nothing alters it.
+//
+// Work per picture therefore scales with how much of the screen changed, as with a
+// hardware encoder, but the output is as large as raw video for full-motion
+// content. Use it to exercise and time everything around the encoder, not to judge
+// encoder speed or quality.
+//
+// Pictures are split into independent slices that can be encoded on separate
+// threads: BeginPicture(), EncodeSlice() once per slice (concurrently if wanted),
+// then FinishPicture() to emit the access unit.
+//======================================================================================
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "../EncodedSink.h"
+
+class PcmH264Encoder
+{
+public:
+    //----------------------------------------------------------------------------------
+    // [PcmH264Encoder::Initialize]
+    //----------------------------------------------------------------------------------
+    bool Initialize(uint32_t width, uint32_t height, uint32_t gopLength, uint32_t sliceCount)
+    {
+        if (width == 0 || height == 0 || width > 16384 || height > 16384 || sliceCount == 0)
+        {
+            return false;
+        }
+        m_width = width;
+        m_height = height;
+        m_mbWidth = (width + 15) / 16;
+        m_mbHeight = (height + 15) / 16;
+        m_gopLength = gopLength ? gopLength : 1;
+        m_slices.assign(sliceCount < m_mbHeight ? sliceCount : m_mbHeight, Slice());
+        m_referenceY.assign(static_cast<size_t>(m_mbWidth) * 16 * m_mbHeight * 16, 0);
+        m_referenceUV.assign(static_cast<size_t>(m_mbWidth) * 16 * m_mbHeight * 8, 0);
+        m_pictureCount = 0;
+        m_idrCount = 0;
+        m_frameNum = 0;
+        return true;
+    }
+
+    uint32_t SliceCount() const { return static_cast<uint32_t>(m_slices.size()); }
+
+    // Annex-B SPS and PPS.
+    void GetSequenceHeader(std::vector<uint8_t>& header) const
+    {
+        header.clear();
+        std::vector<uint8_t> rbsp;
+        BitWriter bits(rbsp);
+        WriteSps(bits);
+        AppendNal(header, 3, 7, rbsp);
+        rbsp.clear();
+        WritePps(bits);
+        AppendNal(header, 3, 8, rbsp);
+    }
+
+    void BeginPicture(bool forceKeyframe)
+    {
+        m_idr = forceKeyframe || m_pictureCount % m_gopLength == 0;
+        if (m_idr)
+        {
+            m_frameNum = 0;
+        }
+    }
+
+    //----------------------------------------------------------------------------------
+    // [PcmH264Encoder::EncodeSlice]
+    // Encodes the slice's macroblock rows from an NV12 picture. Slices touch
+    // disjoint state, so different slices of one picture may run concurrently.
+    //----------------------------------------------------------------------------------
+    void EncodeSlice(uint32_t index, const uint8_t* pY, ptrdiff_t yStride, const uint8_t* pUV, ptrdiff_t uvStride)
+    {
+        Slice& slice = m_slices[index];
+        const uint32_t firstRow = index * m_mbHeight / SliceCount();
+        const uint32_t endRow = (index + 1) * m_mbHeight / SliceCount();
+
+        slice.rbsp.clear();
+        BitWriter bits(slice.rbsp);
+        WriteSliceHeader(bits, firstRow * m_mbWidth);
+
+        uint32_t skipRun = 0;
+        uint8_t samples[384];
+        slice.changedMacroblocks = 0;
+        for (uint32_t mbY = firstRow; mbY < endRow; ++mbY)
+        {
+            for (uint32_t mbX = 0; mbX < m_mbWidth; ++mbX)
+            {
+                GatherMacroblock(pY, yStride, pUV, uvStride, mbX, mbY, samples);
+                if (!m_idr && MatchesReference(mbX, mbY, samples))
+                {
+                    ++skipRun;
+                    continue;
+                }
+                if (!m_idr)
+                {
+                    bits.PutUe(skipRun);
+                    skipRun = 0;
+                }
+                bits.PutUe(m_idr ? 25 : 30); // I_PCM in an I or a P slice.
+                bits.AlignZero();
+                bits.PutBytes(samples, sizeof(samples));
+                StoreReference(mbX, mbY, samples);
+                ++slice.changedMacroblocks;
+            }
+        }
+        if (skipRun > 0)
+        {
+            bits.PutUe(skipRun);
+        }
+        bits.PutTrailingBits();
+
+        slice.nal.clear();
+        AppendNal(slice.nal, 3, m_idr ? 5 : 1, slice.rbsp);
+    }
+
+    //----------------------------------------------------------------------------------
+    // [PcmH264Encoder::FinishPicture]
+    // Gathers the slices into one access unit (with SPS/PPS on IDR pictures) and
+    // hands it to pSink.
+    //----------------------------------------------------------------------------------
+    bool FinishPicture(int64_t pts, int64_t duration, uint64_t frameId, EncodedSink* pSink)
+    {
+        m_accessUnit.clear();
+        if (m_idr)
+        {
+            GetSequenceHeader(m_sequenceHeader);
+            m_accessUnit.insert(m_accessUnit.end(), m_sequenceHeader.begin(), m_sequenceHeader.end());
+        }
+        for (const Slice& slice : m_slices)
+        {
+            m_accessUnit.insert(m_accessUnit.end(), slice.nal.begin(), slice.nal.end());
+        }
+
+        const bool keyframe = m_idr;
+        if (m_idr)
+        {
+            ++m_idrCount;
+        }
+        ++m_pictureCount;
+        m_frameNum = (m_frameNum + 1) % (1u << Log2MaxFrameNum);
+
+        EncodedFrame frame;
+        frame.pData = m_accessUnit.data();
+        frame.size = m_accessUnit.size();
+        frame.pts = pts;
+        frame.dts = pts;
+        frame.duration = duration;
+        frame.keyframe = keyframe;
+        frame.frameId = frameId;
+        return pSink->WriteFrame(frame);
+    }
+
+    // Macroblocks sent as PCM in the last picture (the rest were skipped).
+    uint64_t ChangedMacroblocks() const
+    {
+        uint64_t total = 0;
+        for (const Slice& slice : m_slices)
+        {
+            total += slice.changedMacroblocks;
+        }
+        return total;
+    }
+
+private:
+    static const uint32_t Log2MaxFrameNum = 8;
+
+    //==================================================================================
+    // BitWriter
+    // Big-endian bit packing for RBSP syntax elements.
+    //==================================================================================
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+        void PutBits(uint32_t value, uint32_t count)
+        {
+            for (uint32_t i = count; i > 0; --i)
+            {
+                m_current = static_cast<uint8_t>((m_current << 1) | ((value >> (i - 1)) & 1));
+                if (++m_used == 8)
+                {
+                    m_out.push_back(m_current);
+                    m_current = 0;
+                    m_used = 0;
+                }
+            }
+        }
+
+        // Exp-Golomb ue(v) and se(v).
+        void PutUe(uint32_t value)
+        {
+            const uint64_t coded = static_cast<uint64_t>(value) + 1;
+            uint32_t length = 0;
+            while ((coded >> (length + 1)) != 0)
+            {
+                ++length;
+            }
+            PutBits(0, length);
+            PutBits(static_cast<uint32_t>(coded), length + 1);
+        }
+
+        void PutSe(int32_t value)
+        {
+            PutUe(value > 0 ? static_cast<uint32_t>(value) * 2 - 1 : static_cast<uint32_t>(-value) * 2);
+        }
+
+        void AlignZero()
+        {
+            if (m_used)
+            {
+                PutBits(0, 8 - m_used);
+            }
+        }
+
+        // Only at byte alignment.
+        void PutBytes(const uint8_t* pData, size_t size)
+        {
+            m_out.insert(m_out.end(), pData, pData + size);
+        }
+
+        void PutTrailingBits()
+        {
+            PutBits(1, 1);
+            AlignZero();
+        }
+
+    private:
+        std::vector<uint8_t>& m_out;
+        uint8_t m_current = 0;
+        uint32_t m_used = 0;
+    };
+
+    struct Slice
+    {
+        std::vector<uint8_t> rbsp;
+        std::vector<uint8_t> nal;
+        uint64_t changedMacroblocks = 0;
+    };
+
+    // Start code, NAL header and the RBSP with emulation prevention bytes.
+    static void AppendNal(std::vector<uint8_t>& out, uint32_t refIdc, uint32_t type, const std::vector<uint8_t>& rbsp)
+    {
+        const uint8_t header[5] = { 0, 0, 0, 1, static_cast<uint8_t>((refIdc << 5) | type) };
+        out.insert(out.end(), header, header + 5);
+        out.reserve(out.size() + rbsp.size() + rbsp.size() / 64 + 16);
+        uint32_t zeros = 0;
+        for (uint8_t byte : rbsp)
+        {
+            if (zeros >= 2 && byte <= 3)
+            {
+                out.push_back(3);
+                zeros = 0;
+            }
+            out.push_back(byte);
+            zeros = (byte == 0) ? zeros + 1 : 0;
+        }
+    }
+
+    uint32_t LevelIdc() const
+    {
+        // Smallest level whose maximum frame size fits the picture.
+        const uint32_t macroblocks = m_mbWidth * m_mbHeight;
+        return macroblocks <= 8192 ? 41 : macroblocks <= 36864 ? 52 : 62;
+    }
+
+    void WriteSps(BitWriter& bits) const
+    {
+        bits.PutBits(66, 8);              // profile_idc: Baseline
+        bits.PutBits(0xC0, 8);            // constraint_set0/1: also Main-compatible
+        bits.PutBits(LevelIdc(), 8);
+        bits.PutUe(0);                    // seq_parameter_set_id
+        bits.PutUe(Log2MaxFrameNum - 4);
+        bits.PutUe(2);                    // pic_order_cnt_type: output order = decode order
+        bits.PutUe(1);                    // max_num_ref_frames
+        bits.PutBits(0, 1);               // gaps_in_frame_num_value_allowed_flag
+        bits.PutUe(m_mbWidth - 1);
+        bits.PutUe(m_mbHeight - 1);
+        bits.PutBits(1, 1);               // frame_mbs_only_flag
+        bits.PutBits(1, 1);               // direct_8x8_inference_flag
+        const uint32_t cropRight = (m_mbWidth * 16 - m_width) / 2;
+        const uint32_t cropBottom = (m_mbHeight * 16 - m_height) / 2;
+        bits.PutBits(cropRight || cropBottom ? 1 : 0, 1);
+        if (cropRight || cropBottom)
+        {
+            bits.PutUe(0);
+            bits.PutUe(cropRight);
+            bits.PutUe(0);
+            bits.PutUe(cropBottom);
+        }
+        bits.PutBits(0, 1);               // vui_parameters_present_flag
+        bits.PutTrailingBits();
+    }
+
+    static void WritePps(BitWriter& bits)
+    {
+        bits.PutUe(0);                    // pic_parameter_set_id
+        bits.PutUe(0);                    // seq_parameter_set_id
+        bits.PutBits(0, 1);               // entropy_coding_mode_flag: CAVLC
+        bits.PutBits(0, 1);               // bottom_field_pic_order_in_frame_present_flag
+        bits.PutUe(0);                    // num_slice_groups_minus1
+        bits.PutUe(0);                    // num_ref_idx_l0_default_active_minus1
+        bits.PutUe(0);                    // num_ref_idx_l1_default_active_minus1
+        bits.PutBits(0, 1);               // weighted_pred_flag
+        bits.PutBits(0, 2);               // weighted_bipred_idc
+        bits.PutSe(0);                    // pic_init_qp_minus26
+        bits.PutSe(0);                    // pic_init_qs_minus26
+        bits.PutSe(0);                    // chroma_qp_index_offset
+        bits.PutBits(1, 1);               // deblocking_filter_control_present_flag
+        bits.PutBits(0, 1);               // constrained_intra_pred_flag
+        bits.PutBits(0, 1);               // redundant_pic_cnt_present_flag
+        bits.PutTrailingBits();
+    }
+
+    void WriteSliceHeader(BitWriter& bits, uint32_t firstMacroblock) const
+    {
+        bits.PutUe(firstMacroblock);
+        bits.PutUe(m_idr ? 7 : 5);        // slice_type: I or P (all slices alike)
+        bits.PutUe(0);                    // pic_parameter_set_id
+        bits.PutBits(m_frameNum, Log2MaxFrameNum);
+        if (m_idr)
+        {
+            bits.PutUe(m_idrCount & 1);   // idr_pic_id differs between neighbouring IDRs
+        }
+        else
+        {
+            bits.PutBits(0, 1);           // num_ref_idx_active_override_flag
+            bits.PutBits(0, 1);           // ref_pic_list_modification_flag_l0
+        }
+        if (m_idr)
+        {
+            bits.PutBits(0, 1);           // no_output_of_prior_pics_flag
+            bits.PutBits(0, 1);           // long_term_reference_flag
+        }
+        else
+        {
+            bits.PutBits(0, 1);           // adaptive_ref_pic_marking_mode_flag
+        }
+        bits.PutSe(0);                    // slice_qp_delta
+        bits.PutUe(1);                    // disable_deblocking_filter_idc: off
+    }
+
+    // Copies a macroblock's samples in PCM order (256 Y, 64 Cb, 64 Cr), repeating
+    // the last row/column where the picture does not fill it.
+    void GatherMacroblock(const uint8_t* pY, ptrdiff_t yStride, const uint8_t* pUV, ptrdiff_t uvStride,
+                          uint32_t mbX, uint32_t mbY, uint8_t* pSamples) const
+    {
+        const uint32_t x0 = mbX * 16;
+        const uint32_t y0 = mbY * 16;
+        const bool inside = x0 + 16 <= m_width && y0 + 16 <= m_height;
+        for (uint32_t y = 0; y < 16; ++y)
+        {
+            const uint32_t row = (y0 + y < m_height) ? y0 + y : m_height - 1;
+            const uint8_t* pRow = pY + static_cast<ptrdiff_t>(row) * yStride;
+            if (inside)
+            {
+                memcpy(pSamples + y * 16, pRow + x0, 16);
+                continue;
+            }
+            for (uint32_t x = 0; x < 16; ++x)
+            {
+                pSamples[y * 16 + x] = pRow[(x0 + x < m_width) ? x0 + x : m_width - 1];
+            }
+        }
+        const uint32_t chromaWidth = (m_width + 1) / 2;
+        const uint32_t chromaHeight = (m_height + 1) / 2;
+        for (uint32_t y = 0; y < 8; ++y)
+        {
+            const uint32_t row = (y0 / 2 + y < chromaHeight) ? y0 / 2 + y : chromaHeight - 1;
+            const uint8_t* pRow = pUV + static_cast<ptrdiff_t>(row) * uvStride;
+            for (uint32_t x = 0; x < 8; ++x)
+            {
+                const uint32_t column = (x0 / 2 + x < chromaWidth) ? x0 / 2 + x : chromaWidth - 1;
+                pSamples[256 + y * 8 + x] = pRow[column * 2];
+                pSamples[320 + y * 8 + x] = pRow[column * 2 + 1];
+            }
+        }
+    }
+
+    // The reference keeps each macroblock's samples contiguously, in PCM order.
+    bool MatchesReference(uint32_t mbX, uint32_t mbY, const uint8_t* pSamples) const
+    {
+        const size_t index = static_cast<size_t>(mbY) * m_mbWidth + mbX;
+        return memcmp(m_referenceY.data() + index * 256, pSamples, 256) == 0 &&
+               memcmp(m_referenceUV.data() + index * 128, pSamples + 256, 128) == 0;
+    }
+
+    void StoreReference(uint32_t mbX, uint32_t mbY, const uint8_t* pSamples)
+    {
+        const size_t index = static_cast<size_t>(mbY) * m_mbWidth + mbX;
+        memcpy(m_referenceY.data() + index * 256, pSamples, 256);
+        memcpy(m_referenceUV.data() + index * 128, pSamples + 256, 128);
+    }
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint32_t m_mbWidth = 0;
+    uint32_t m_mbHeight = 0;
+    uint32_t m_gopLength = 1;
+    std::vector<Slice> m_slices;
+    std::vector<uint8_t> m_referenceY;
+    std::vector<uint8_t> m_referenceUV;
+    std::vector<uint8_t> m_sequenceHeader;
+    std::vector<uint8_t> m_accessUnit;
+
+    // Per-picture state, fixed between BeginPicture() and FinishPicture().
+    bool m_idr = true;
+    uint32_t m_frameNum = 0;
+    uint64_t m_pictureCount = 0;
+    uint64_t m_idrCount = 0;
+};
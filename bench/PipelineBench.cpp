@@ -0,0 +1,539 @@
+//======================================================================================
+// PipelineBench.cpp
+// End-to-end throughput of the capture pipeline, run unthrottled on any machine:
+//
+//   source -> readback -> convert -> encode -> mux
+//
+// The source is a synthetic desktop (SyntheticSource.h, in virtual time) or a
+// recorded capture trace (ReplaySource.h, at full speed). Readback copies each
+// frame into a pitched buffer, as mapping a staging texture does; convert is the
+// BGRA to NV12 conversion the encoder needs; encode is PcmH264Encoder (see its
+// header - it exercises the data flow of an encoder, not its compression); mux
+// packs the access units into MPEG-TS or Matroska.
+//
+// Every stage runs on its own thread with bounded queues in between, like the
+// recorder's capture, encode and write-behind threads, so the sustained frame rate
+// is set by the slowest stage. --threads splits conversion into bands and encoding
+// into slices across that many threads. Reported per stage: utilization (busy
+// time over wall time - the bottleneck is the one near 100%) and per-frame time;
+// overall: sustained fps against --target-fps, end-to-end latency, output rate
+// and the process's peak resident memory.
+//
+// Build and run (from the repository root):
+//     g++ -O2 -std=c++17 -pthread -I. bench/PipelineBench.cpp -o pipeline_bench
+//     ./pipeline_bench --resolution 4k --workload video --threads 4 --target-fps 60 --json
+//======================================================================================
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchHarness.h"
+#include "PcmH264Encoder.h"
+#include "../BandPool.h"
+#include "../LatencyHistogram.h"
+#include "../MkvMuxer.h"
+#include "../PixelKernels.h"
+#include "../ReplaySource.h"
+#include "../SyntheticSource.h"
+#include "../TickClock.h"
+#include "../TsMuxer.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    struct Settings
+    {
+        uint32_t width = 1920;
+        uint32_t height = 1080;
+        std::string workload = "scroll";
+        uint32_t threads = 1;
+        uint32_t frames = 600;
+        double maxSeconds = 30.0;
+        uint32_t queueDepth = 2;
+        uint32_t targetFps = 60;
+        uint32_t gopLength = 120;
+        std::string mux = "ts";
+        std::string outputPath;
+        bool json = false;
+        bool csv = false;
+    };
+
+    enum Stage
+    {
+        StageSource,
+        StageReadback,
+        StageConvert,
+        StageEncode,
+        StageMux,
+        StageCount,
+    };
+
+    const char* const StageNames[StageCount] = { "source", "readback", "convert", "encode", "mux" };
+
+    uint64_t PeakResidentBytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters = {};
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.PeakWorkingSetSize;
+#else
+        struct rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // Kilobytes on Linux.
+#endif
+    }
+
+    //==================================================================================
+    // BoundedQueue
+    // Blocking hand-off between stage threads. Close() wakes everyone and makes Pop()
+    // return false once the queue is drained.
+    //==================================================================================
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity) : m_capacity(capacity) {}
+
+        void Push(T item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notFull.wait(lock, [&] { return m_items.size() < m_capacity; });
+            m_items.push_back(item);
+            m_notEmpty.notify_one();
+        }
+
+        bool Pop(T& item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [&] { return !m_items.empty() || m_closed; });
+            if (m_items.empty())
+            {
+                return false;
+            }
+            item = m_items.front();
+            m_items.pop_front();
+            m_notFull.notify_one();
+            return true;
+        }
+
+        void Close()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+            m_notEmpty.notify_all();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_notEmpty;
+        std::condition_variable m_notFull;
+        std::deque<T> m_items;
+        size_t m_capacity;
+        bool m_closed = false;
+    };
+
+    // Discards muxed output, counting it.
+    class NullByteSink : public ByteSink
+    {
+    public:
+        bool Write(const void*, size_t size) override
+        {
+            m_position += size;
+            return true;
+        }
+        uint64_t Position() const override { return m_position; }
+        bool Patch(uint64_t, const void*, size_t) override { return true; }
+
+    private:
+        uint64_t m_position = 0;
+    };
+
+    // A captured frame on its way from the source to the encoder.
+    struct FrameSlot
+    {
+        std::vector<uint8_t> staging; // BGRA with a 256-byte aligned pitch.
+        std::vector<uint8_t> nv12;
+        uint64_t frameId = 0;
+        int64_t timestamp = 0;
+        uint64_t startNs = 0;
+    };
+
+    // An access unit on its way to the muxer.
+    struct AccessUnit
+    {
+        std::vector<uint8_t> data;
+        EncodedFrame frame = {};
+        uint64_t startNs = 0;
+    };
+
+    // Copies each access unit the encoder produces into the slot handed to it.
+    class CopyingSink : public EncodedSink
+    {
+    public:
+        AccessUnit* pTarget = nullptr;
+
+        bool WriteFrame(const EncodedFrame& frame) override
+        {
+            pTarget->data.assign(frame.pData, frame.pData + frame.size);
+            pTarget->frame = frame;
+            pTarget->frame.pData = pTarget->data.data();
+            return true;
+        }
+        bool Finish() override { return true; }
+    };
+
+    struct StageStats
+    {
+        LatencyHistogram perFrame;
+        uint64_t busyNs = 0;
+    };
+
+    bool ParseResolution(const std::string& value, uint32_t& width, uint32_t& height)
+    {
+        if (value == "1080p") { width = 1920; height = 1080; return true; }
+        if (value == "1440p") { width = 2560; height = 1440; return true; }
+        if (value == "4k") { width = 3840; height = 2160; return true; }
+        if (value == "8k") { width = 7680; height = 4320; return true; }
+        char* pEnd = nullptr;
+        width = static_cast<uint32_t>(strtoul(value.c_str(), &pEnd, 10));
+        height = (*pEnd == 'x') ? static_cast<uint32_t>(strtoul(pEnd + 1, &pEnd, 10)) : 0;
+        return *pEnd == '\0' && width >= 64 && height >= 64 && width <= 16384 && height <= 16384;
+    }
+
+    [[noreturn]] void Usage(const char* pProgram)
+    {
+        fprintf(stderr,
+                "Usage: %s [--resolution 1080p|1440p|4k|8k|<W>x<H>] [--workload static|scroll|video|drag|replay:<trace>]\n"
+                "          [--threads <n>] [--frames <n>] [--max-seconds <s>] [--queue-depth <n>] [--target-fps <n>]\n"
+                "          [--gop <frames>] [--mux ts|mkv] [--output <file>] [--json | --csv]\n",
+                pProgram);
+        exit(2);
+    }
+
+    Settings ParseSettings(int argc, char** argv)
+    {
+        Settings settings;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+            if (arg == "--resolution" && hasValue)
+            {
+                if (!ParseResolution(argv[++i], settings.width, settings.height)) Usage(argv[0]);
+            }
+            else if (arg == "--workload" && hasValue) settings.workload = argv[++i];
+            else if (arg == "--threads" && hasValue) settings.threads = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--frames" && hasValue) settings.frames = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--max-seconds" && hasValue) settings.maxSeconds = atof(argv[++i]);
+            else if (arg == "--queue-depth" && hasValue) settings.queueDepth = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--target-fps" && hasValue) settings.targetFps = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--gop" && hasValue) settings.gopLength = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--mux" && hasValue) settings.mux = argv[++i];
+            else if (arg == "--output" && hasValue) settings.outputPath = argv[++i];
+            else if (arg == "--json") settings.json = true;
+            else if (arg == "--csv") settings.csv = true;
+            else Usage(argv[0]);
+        }
+        if (settings.threads < 1 || settings.frames < 1 || settings.queueDepth < 1 || settings.targetFps < 1 ||
+            (settings.mux != "ts" && settings.mux != "mkv"))
+        {
+            Usage(argv[0]);
+        }
+        return settings;
+    }
+
+    std::unique_ptr<CaptureSource> CreateSource(const Settings& settings)
+    {
+        if (settings.workload.compare(0, 7, "replay:") == 0)
+        {
+            std::unique_ptr<ReplaySource> pReplay(new ReplaySource());
+            ReplaySource::Options options;
+            options.speed = 0.0;
+            options.loop = true;
+            std::string error;
+            if (!pReplay->Open(settings.workload.substr(7), options, error))
+            {
+                fprintf(stderr, "%s\n", error.c_str());
+                return nullptr;
+            }
+            return std::unique_ptr<CaptureSource>(pReplay.release());
+        }
+        SyntheticSource::Options options;
+        if (!SyntheticSource::ParseScenario(settings.workload, options.scenario))
+        {
+            fprintf(stderr, "Unknown workload: %s\n", settings.workload.c_str());
+            return nullptr;
+        }
+        options.width = settings.width;
+        options.height = settings.height;
+        options.realTime = false;
+        return std::unique_ptr<CaptureSource>(new SyntheticSource(options));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const Settings settings = ParseSettings(argc, argv);
+    TickClock::Start();
+
+    std::unique_ptr<CaptureSource> pSource = CreateSource(settings);
+    if (!pSource)
+    {
+        return 1;
+    }
+    const uint32_t width = pSource->Width();
+    const uint32_t height = pSource->Height();
+    const size_t rowBytes = static_cast<size_t>(width) * 4;
+    const size_t pitch = (rowBytes + 255) / 256 * 256;
+    const size_t chromaWidth = (width + 1) / 2;
+    const size_t lumaBytes = static_cast<size_t>(width) * height;
+
+    PcmH264Encoder encoder;
+    encoder.Initialize(width, height, settings.gopLength, settings.threads);
+    std::vector<uint8_t> sequenceHeader;
+    encoder.GetSequenceHeader(sequenceHeader);
+
+    NullByteSink nullOutput;
+    FileWriter file;
+    FileByteSink fileOutput(file);
+    ByteSink* pOutput = &nullOutput;
+    if (!settings.outputPath.empty())
+    {
+        if (!file.Open(settings.outputPath, FileWriter::Options()))
+        {
+            fprintf(stderr, "Could not create %s\n", settings.outputPath.c_str());
+            return 1;
+        }
+        pOutput = &fileOutput;
+    }
+    TsMuxer tsMuxer;
+    MkvMuxer mkvMuxer;
+    EncodedSink* pMuxer = &tsMuxer;
+    if (settings.mux == "mkv")
+    {
+        mkvMuxer.Open(pOutput, width, height);
+        mkvMuxer.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+        pMuxer = &mkvMuxer;
+    }
+    else
+    {
+        tsMuxer.Open(pOutput);
+        tsMuxer.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+    }
+
+    // Each queue holds queueDepth items; a slot can also be in use by each stage.
+    const size_t slotCount = settings.queueDepth * 2 + 3;
+    std::vector<std::unique_ptr<FrameSlot>> slots;
+    BoundedQueue<FrameSlot*> freeSlots(slotCount);
+    for (size_t i = 0; i < slotCount; ++i)
+    {
+        slots.emplace_back(new FrameSlot());
+        slots.back()->staging.resize(pitch * height);
+        slots.back()->nv12.resize(PixelKernels::NV12Bytes(width, height));
+        freeSlots.Push(slots.back().get());
+    }
+    const size_t unitCount = settings.queueDepth + 2;
+    std::vector<std::unique_ptr<AccessUnit>> units;
+    BoundedQueue<AccessUnit*> freeUnits(unitCount);
+    for (size_t i = 0; i < unitCount; ++i)
+    {
+        units.emplace_back(new AccessUnit());
+        freeUnits.Push(units.back().get());
+    }
+
+    BoundedQueue<FrameSlot*> toConvert(settings.queueDepth);
+    BoundedQueue<FrameSlot*> toEncode(settings.queueDepth);
+    BoundedQueue<AccessUnit*> toMux(settings.queueDepth);
+    StageStats stats[StageCount];
+    LatencyHistogram endToEnd;
+    uint64_t framesMuxed = 0;
+    const int64_t frameDuration = 10000000 / settings.targetFps;
+
+    auto timeStage = [&](Stage stage, uint64_t startNs) {
+        const uint64_t elapsed = TickClock::NowNs() - startNs;
+        stats[stage].perFrame.Record(elapsed);
+        stats[stage].busyNs += elapsed;
+    };
+
+    const uint64_t startNs = TickClock::NowNs();
+    const uint64_t deadlineNs = startNs + static_cast<uint64_t>(settings.maxSeconds * 1e9);
+
+    // Source and readback share a thread, as acquiring and mapping do.
+    std::thread sourceThread([&] {
+        for (uint32_t frame = 0; frame < settings.frames && TickClock::NowNs() < deadlineNs; ++frame)
+        {
+            FrameSlot* pSlot = nullptr;
+            freeSlots.Pop(pSlot);
+
+            uint64_t stageStart = TickClock::NowNs();
+            pSlot->startNs = stageStart;
+            CaptureFrameInfo info;
+            CaptureResult result;
+            while ((result = pSource->AcquireFrame(100, info)) == CaptureResult::Timeout)
+            {
+            }
+            MappedFrame mapped;
+            if (result != CaptureResult::Ok || !pSource->MapFrame(mapped))
+            {
+                fprintf(stderr, "The source failed after %u frames\n", frame);
+                freeSlots.Push(pSlot);
+                break;
+            }
+            timeStage(StageSource, stageStart);
+
+            stageStart = TickClock::NowNs();
+            PixelKernels::CopyRows(pSlot->staging.data(), static_cast<ptrdiff_t>(pitch), mapped.pPixels,
+                                   static_cast<ptrdiff_t>(mapped.stride), width, height);
+            pSource->ReleaseFrame();
+            pSlot->frameId = frame;
+            pSlot->timestamp = static_cast<int64_t>(frame) * frameDuration;
+            timeStage(StageReadback, stageStart);
+            toConvert.Push(pSlot);
+        }
+        toConvert.Close();
+    });
+
+    std::thread convertThread([&] {
+        BandPool pool(settings.threads);
+        FrameSlot* pSlot = nullptr;
+        while (toConvert.Pop(pSlot))
+        {
+            const uint64_t stageStart = TickClock::NowNs();
+            pool.Run([&](uint32_t band) {
+                // Bands of even height so chroma rows are not shared.
+                const uint32_t first = (height / 2 * band / settings.threads) * 2;
+                const uint32_t end = (band + 1 == settings.threads) ? height : (height / 2 * (band + 1) / settings.threads) * 2;
+                uint8_t* pY = pSlot->nv12.data() + static_cast<size_t>(first) * width;
+                uint8_t* pUV = pSlot->nv12.data() + lumaBytes + static_cast<size_t>(first / 2) * chromaWidth * 2;
+                PixelKernels::BgraToNV12(pSlot->staging.data() + first * pitch, static_cast<ptrdiff_t>(pitch), pY, width,
+                                         pUV, static_cast<ptrdiff_t>(chromaWidth * 2), width, end - first);
+            });
+            timeStage(StageConvert, stageStart);
+            toEncode.Push(pSlot);
+        }
+        toEncode.Close();
+    });
+
+    std::thread encodeThread([&] {
+        BandPool pool(encoder.SliceCount());
+        CopyingSink sink;
+        FrameSlot* pSlot = nullptr;
+        while (toEncode.Pop(pSlot))
+        {
+            AccessUnit* pUnit = nullptr;
+            freeUnits.Pop(pUnit);
+            const uint64_t stageStart = TickClock::NowNs();
+            encoder.BeginPicture(false);
+            pool.Run([&](uint32_t slice) {
+                encoder.EncodeSlice(slice, pSlot->nv12.data(), width, pSlot->nv12.data() + lumaBytes,
+                                    static_cast<ptrdiff_t>(chromaWidth * 2));
+            });
+            sink.pTarget = pUnit;
+            encoder.FinishPicture(pSlot->timestamp, frameDuration, pSlot->frameId, &sink);
+            pUnit->startNs = pSlot->startNs;
+            timeStage(StageEncode, stageStart);
+            freeSlots.Push(pSlot);
+            toMux.Push(pUnit);
+        }
+        toMux.Close();
+    });
+
+    std::thread muxThread([&] {
+        AccessUnit* pUnit = nullptr;
+        while (toMux.Pop(pUnit))
+        {
+            const uint64_t stageStart = TickClock::NowNs();
+            pMuxer->WriteFrame(pUnit->frame);
+            timeStage(StageMux, stageStart);
+            endToEnd.Record(TickClock::NowNs() - pUnit->startNs);
+            ++framesMuxed;
+            freeUnits.Push(pUnit);
+        }
+        pMuxer->Finish();
+    });
+
+    sourceThread.join();
+    convertThread.join();
+    encodeThread.join();
+    muxThread.join();
+    const double wallSeconds = static_cast<double>(TickClock::NowNs() - startNs) / 1e9;
+    const uint64_t outputBytes = pOutput->Position();
+    if (!settings.outputPath.empty() && !file.Close())
+    {
+        fprintf(stderr, "Writing %s failed\n", settings.outputPath.c_str());
+    }
+
+    // --- Report ---
+    const double fps = framesMuxed / wallSeconds;
+    const double peakMb = static_cast<double>(PeakResidentBytes()) / (1024.0 * 1024.0);
+    const double outputMbps = static_cast<double>(outputBytes) * 8 / 1e6 / wallSeconds;
+    const LatencyHistogram::Summary latency = endToEnd.Summarize();
+    char resolution[32];
+    snprintf(resolution, sizeof(resolution), "%ux%u", width, height);
+
+    if (settings.json)
+    {
+        printf("{\"resolution\":\"%s\",\"workload\":\"%s\",\"threads\":%u,\"isa\":\"%s\",\"frames\":%llu,"
+               "\"seconds\":%.3f,\"fps\":%.2f,\"target_fps\":%u,\"meets_target\":%s,\"stages\":[",
+               resolution, settings.workload.c_str(), settings.threads, CompiledIsaLevel(),
+               static_cast<unsigned long long>(framesMuxed), wallSeconds, fps, settings.targetFps,
+               fps >= settings.targetFps ? "true" : "false");
+        for (int stage = 0; stage < StageCount; ++stage)
+        {
+            const LatencyHistogram::Summary summary = stats[stage].perFrame.Summarize();
+            printf("%s{\"name\":\"%s\",\"utilization\":%.3f,\"mean_ms\":%.3f,\"p99_ms\":%.3f}", stage ? "," : "",
+                   StageNames[stage], stats[stage].busyNs / 1e9 / wallSeconds, summary.mean / 1e6, summary.p99 / 1e6);
+        }
+        printf("],\"latency_mean_ms\":%.3f,\"latency_p99_ms\":%.3f,\"output_mbps\":%.1f,\"peak_rss_mb\":%.1f}\n",
+               latency.mean / 1e6, latency.p99 / 1e6, outputMbps, peakMb);
+        return 0;
+    }
+    if (settings.csv)
+    {
+        printf("resolution,workload,threads,isa,frames,seconds,fps,target_fps");
+        for (const char* pName : StageNames)
+        {
+            printf(",%s_utilization,%s_mean_ms,%s_p99_ms", pName, pName, pName);
+        }
+        printf(",latency_mean_ms,latency_p99_ms,output_mbps,peak_rss_mb\n");
+        printf("%s,%s,%u,%s,%llu,%.3f,%.2f,%u", resolution, settings.workload.c_str(), settings.threads,
+               CompiledIsaLevel(), static_cast<unsigned long long>(framesMuxed), wallSeconds, fps, settings.targetFps);
+        for (int stage = 0; stage < StageCount; ++stage)
+        {
+            const LatencyHistogram::Summary summary = stats[stage].perFrame.Summarize();
+            printf(",%.3f,%.3f,%.3f", stats[stage].busyNs / 1e9 / wallSeconds, summary.mean / 1e6, summary.p99 / 1e6);
+        }
+        printf(",%.3f,%.3f,%.1f,%.1f\n", latency.mean / 1e6, latency.p99 / 1e6, outputMbps, peakMb);
+        return 0;
+    }
+
+    printf("%s %s, %u thread(s), compiled for %s\n", resolution, settings.workload.c_str(), settings.threads,
+           CompiledIsaLevel());
+    printf("%llu frames in %.2f s: %.1f fps sustained (target %u fps: %s)\n",
+           static_cast<unsigned long long>(framesMuxed), wallSeconds, fps, settings.targetFps,
+           fps >= settings.targetFps ? "met" : "NOT met");
+    printf("%-10s %12s %12s %12s\n", "stage", "utilization", "mean", "p99");
+    for (int stage = 0; stage < StageCount; ++stage)
+    {
+        const LatencyHistogram::Summary summary = stats[stage].perFrame.Summarize();
+        printf("%-10s %11.1f%% %9.3f ms %9.3f ms\n", StageNames[stage], 100.0 * stats[stage].busyNs / 1e9 / wallSeconds,
+               summary.mean / 1e6, summary.p99 / 1e6);
+    }
+    printf("end-to-end latency: mean %.3f ms, p99 %.3f ms\n", latency.mean / 1e6, latency.p99 / 1e6);
+    printf("output: %.1f Mbit/s, peak resident memory: %.1f MB\n", outputMbps, peakMb);
+    return 0;
+}
@@ -0,0 +1,343 @@
+//======================================================================================
+// PixelKernelsBench.cpp
+// Throughput of every PixelKernels routine at the resolutions we capture: 1080p,
+// 1440p, 4K and 8K. Buffers are allocated once per resolution with a realistic
+// row pitch (rounded up to 256 bytes, as mapped staging textures are) and filled
+// with a deterministic pattern.
+//
+// Pointer compositing (CursorCompositor.h) only touches the pointer's bounding box,
+// so it is measured per pointer type and size instead. Before timing, its output
+// is checked against a straightforward per-pixel blend written from the desktop
+// duplication documentation, including pointers clipped by the frame edges; a
+// mismatch fails the run.
+//
+// Build and run (from the repository root):
+//     g++ -O2 -std=c++17 -I. bench/PixelKernelsBench.cpp -o pixel_kernels_bench
+//     ./pixel_kernels_bench [--filter 4k] [--csv]
+// bench/run_isa_levels.sh repeats this for each x86-64 ISA level.
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "BenchHarness.h"
+#include "../CursorCompositor.h"
+#include "../PixelKernels.h"
+#include "../QualityMetrics.h"
+
+namespace
+{
+    struct Resolution
+    {
+        const char* pName;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    const Resolution Resolutions[] = {
+        { "1080p", 1920, 1080 },
+        { "1440p", 2560, 1440 },
+        { "4k", 3840, 2160 },
+        { "8k", 7680, 4320 },
+    };
+
+    // Desktop-like content: mostly smooth gradients with some high-frequency detail,
+    // so nothing is trivially compressible or uniform.
+    void FillPattern(std::vector<uint8_t>& buffer, size_t stride, uint32_t width, uint32_t height, uint32_t seed)
+    {
+        uint32_t state = seed * 2654435761u + 1;
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            uint8_t* pRow = buffer.data() + y * stride;
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                state = state * 1664525u + 1013904223u;
+                pRow[x * 4 + 0] = static_cast<uint8_t>(x + (state >> 28));
+                pRow[x * 4 + 1] = static_cast<uint8_t>(y + (state >> 29));
+                pRow[x * 4 + 2] = static_cast<uint8_t>((x ^ y) + seed);
+                pRow[x * 4 + 3] = 0xFF;
+            }
+        }
+    }
+
+    void RunResolution(BenchRunner& runner, const Resolution& resolution)
+    {
+        const uint32_t width = resolution.width;
+        const uint32_t height = resolution.height;
+        const uint64_t pixels = static_cast<uint64_t>(width) * height;
+        const size_t rowBytes = static_cast<size_t>(width) * 4;
+        const size_t pitch = (rowBytes + 255) / 256 * 256;
+        const uint64_t frameBytes = static_cast<uint64_t>(rowBytes) * height;
+        const std::string suffix = std::string("/") + resolution.pName;
+
+        // Skip the allocations when nothing at this resolution is selected.
+        static const char* const Kernels[] = { "copy_rows_flipped", "copy_rows", "bgra_to_i420", "bgra_to_nv12",
+                                               "diff_tiles/static", "diff_tiles/changed", "psnr_nv12", "ssim_luma" };
+        bool any = false;
+        for (const char* pKernel : Kernels)
+        {
+            any = any || runner.Matches(pKernel + suffix);
+        }
+        if (!any)
+        {
+            return;
+        }
+
+        std::vector<uint8_t> source(pitch * height);
+        std::vector<uint8_t> other(pitch * height);
+        std::vector<uint8_t> destination(pitch * height);
+        FillPattern(source, pitch, width, height, 1);
+        FillPattern(other, pitch, width, height, 2);
+
+        runner.Run("copy_rows_flipped" + suffix, frameBytes * 2, pixels, [&] {
+            PixelKernels::CopyRowsFlipped(destination.data(), rowBytes, source.data(), pitch, width, height);
+            ClobberMemory();
+        });
+
+        runner.Run("copy_rows" + suffix, frameBytes * 2, pixels, [&] {
+            PixelKernels::CopyRows(destination.data(), static_cast<ptrdiff_t>(rowBytes), source.data(),
+                                   static_cast<ptrdiff_t>(pitch), width, height);
+            ClobberMemory();
+        });
+
+        // Conversions read BGRA and write 1.5 bytes per pixel.
+        const size_t chromaWidth = (width + 1) / 2;
+        const size_t chromaHeight = (height + 1) / 2;
+        const uint64_t yuvBytes = PixelKernels::NV12Bytes(width, height);
+        std::vector<uint8_t> yuv(yuvBytes);
+        uint8_t* pY = yuv.data();
+        uint8_t* pU = pY + pixels;
+        uint8_t* pV = pU + chromaWidth * chromaHeight;
+
+        // The capture path converts bottom-up samples, hence the negative stride.
+        const uint8_t* pBottomRow = source.data() + (height - 1) * pitch;
+        runner.Run("bgra_to_i420" + suffix, frameBytes + yuvBytes, pixels, [&] {
+            PixelKernels::BgraToI420(pBottomRow, -static_cast<ptrdiff_t>(pitch), pY, width, pU,
+                                     static_cast<ptrdiff_t>(chromaWidth), pV, static_cast<ptrdiff_t>(chromaWidth),
+                                     width, height);
+            ClobberMemory();
+        });
+
+        runner.Run("bgra_to_nv12" + suffix, frameBytes + yuvBytes, pixels, [&] {
+            PixelKernels::BgraToNV12(pBottomRow, -static_cast<ptrdiff_t>(pitch), pY, width, pU,
+                                     static_cast<ptrdiff_t>(chromaWidth * 2), width, height);
+            ClobberMemory();
+        });
+
+        // Best case: nothing changed, every tile is compared in full.
+        std::vector<uint8_t> shadow(frameBytes);
+        PixelKernels::CopyRows(shadow.data(), static_cast<ptrdiff_t>(rowBytes), source.data(),
+                               static_cast<ptrdiff_t>(pitch), width, height);
+        runner.Run("diff_tiles/static" + suffix, frameBytes * 2, pixels, [&] {
+            DoNotOptimize(PixelKernels::DiffTilesAndUpdate(source.data(), pitch, shadow.data(), rowBytes, width, height));
+        });
+
+        // Worst case: every tile differs and is copied into the shadow. Alternate the
+        // input so each iteration really sees a different frame.
+        bool flip = false;
+        runner.Run("diff_tiles/changed" + suffix, frameBytes * 3, pixels, [&] {
+            const uint8_t* pFrame = flip ? source.data() : other.data();
+            flip = !flip;
+            DoNotOptimize(PixelKernels::DiffTilesAndUpdate(pFrame, pitch, shadow.data(), rowBytes, width, height));
+        });
+
+        // Quality metrics (QualityMetrics.h) compare two NV12 frames, as the quality
+        // monitor does for each sampled frame.
+        std::vector<uint8_t> decoded(yuvBytes);
+        PixelKernels::BgraToNV12(source.data(), static_cast<ptrdiff_t>(pitch), pY, width, pU,
+                                 static_cast<ptrdiff_t>(chromaWidth * 2), width, height);
+        PixelKernels::BgraToNV12(other.data(), static_cast<ptrdiff_t>(pitch), decoded.data(), width,
+                                 decoded.data() + pixels, static_cast<ptrdiff_t>(chromaWidth * 2), width, height);
+        runner.Run("psnr_nv12" + suffix, yuvBytes * 2, pixels, [&] {
+            const QualityMetrics::FrameQuality quality = QualityMetrics::MeasureNV12(
+                pY, width, pU, static_cast<ptrdiff_t>(chromaWidth * 2), decoded.data(), width, decoded.data() + pixels,
+                static_cast<ptrdiff_t>(chromaWidth * 2), width, height);
+            DoNotOptimize(quality.psnr);
+        });
+
+        runner.Run("ssim_luma" + suffix, pixels * 2, pixels, [&] {
+            DoNotOptimize(QualityMetrics::Ssim(pY, width, decoded.data(), width, width, height));
+        });
+    }
+
+    // What each pointer type does to a desktop pixel, one pixel at a time.
+    void ReferenceBlend(uint8_t* pFrame, size_t stride, uint32_t width, uint32_t height, const PointerShape& shape,
+                        int32_t pointerX, int32_t pointerY)
+    {
+        for (uint32_t y = 0; y < shape.height; ++y)
+        {
+            for (uint32_t x = 0; x < shape.width; ++x)
+            {
+                const int64_t frameX = static_cast<int64_t>(pointerX) + x;
+                const int64_t frameY = static_cast<int64_t>(pointerY) + y;
+                if (frameX < 0 || frameY < 0 || frameX >= width || frameY >= height)
+                {
+                    continue;
+                }
+                uint8_t* pPixel = pFrame + static_cast<size_t>(frameY) * stride + static_cast<size_t>(frameX) * 4;
+                if (shape.type == PointerShapeType::Monochrome)
+                {
+                    const int andBit = (shape.pData[y * shape.pitch + x / 8] >> (7 - x % 8)) & 1;
+                    const int xorBit = (shape.pData[(y + shape.height) * shape.pitch + x / 8] >> (7 - x % 8)) & 1;
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        pPixel[c] = static_cast<uint8_t>((andBit ? pPixel[c] : 0) ^ (xorBit ? 0xFF : 0));
+                    }
+                    continue;
+                }
+                const uint8_t* pShape = shape.pData + y * shape.pitch + x * 4;
+                for (int c = 0; c < 3; ++c)
+                {
+                    if (shape.type == PointerShapeType::MaskedColor)
+                    {
+                        pPixel[c] = pShape[3] ? pPixel[c] ^ pShape[c] : pShape[c];
+                    }
+                    else
+                    {
+                        // Rounded to nearest.
+                        const uint32_t sum = pShape[c] * pShape[3] + pPixel[c] * (255u - pShape[3]);
+                        pPixel[c] = static_cast<uint8_t>((2 * sum + 255) / 510);
+                    }
+                }
+            }
+        }
+    }
+
+    // A pointer-like shape: a transparent margin around varied content.
+    void MakeShape(PointerShapeType type, uint32_t size, std::vector<uint8_t>& data, PointerShape& shape)
+    {
+        shape = PointerShape();
+        shape.type = type;
+        shape.width = size;
+        shape.height = size;
+        const bool monochrome = type == PointerShapeType::Monochrome;
+        shape.pitch = monochrome ? (size + 7) / 8 : size * 4;
+        data.assign(static_cast<size_t>(shape.pitch) * (monochrome ? 2 * size : size), 0);
+        uint32_t state = static_cast<uint32_t>(type) * 7919 + size;
+        for (uint32_t y = 0; y < size; ++y)
+        {
+            for (uint32_t x = 0; x < size; ++x)
+            {
+                state = state * 1664525u + 1013904223u;
+                const bool margin = x < size / 8 || y < size / 16 || x >= size - size / 8;
+                if (monochrome)
+                {
+                    // Transparent (AND 1, XOR 0) in the margin, anything inside.
+                    const uint8_t bit = static_cast<uint8_t>(0x80 >> (x % 8));
+                    if (margin || (state >> 31)) data[y * shape.pitch + x / 8] |= bit;
+                    if (!margin && (state >> 30) & 1) data[(y + size) * shape.pitch + x / 8] |= bit;
+                    continue;
+                }
+                uint8_t* pPixel = &data[y * shape.pitch + x * 4];
+                pPixel[0] = static_cast<uint8_t>(state >> 8);
+                pPixel[1] = static_cast<uint8_t>(state >> 16);
+                pPixel[2] = static_cast<uint8_t>(state >> 24);
+                if (type == PointerShapeType::MaskedColor)
+                {
+                    pPixel[3] = margin ? 0xFF : ((state >> 7) & 1 ? 0xFF : 0);
+                    if (margin) pPixel[0] = pPixel[1] = pPixel[2] = 0;
+                }
+                else
+                {
+                    pPixel[3] = margin ? 0 : static_cast<uint8_t>(state);
+                }
+            }
+        }
+        shape.pData = data.data();
+    }
+
+    bool RunCursor(BenchRunner& runner)
+    {
+        const uint32_t width = 1920;
+        const uint32_t height = 1080;
+        const size_t pitch = (static_cast<size_t>(width) * 4 + 255) / 256 * 256;
+        std::vector<uint8_t> frame(pitch * height);
+        std::vector<uint8_t> expected(pitch * height);
+        FillPattern(frame, pitch, width, height, 3);
+
+        static const struct
+        {
+            const char* pName;
+            PointerShapeType type;
+        } Types[] = {
+            { "color", PointerShapeType::Color },
+            { "masked", PointerShapeType::MaskedColor },
+            { "monochrome", PointerShapeType::Monochrome },
+        };
+        bool ok = true;
+        for (const auto& type : Types)
+        {
+            // 32 pixels at 100% scaling, 64 at 200%.
+            for (uint32_t size : { 32u, 64u })
+            {
+                const std::string name = std::string("cursor_blend/") + type.pName + "/" + std::to_string(size);
+                if (!runner.Matches(name))
+                {
+                    continue;
+                }
+                std::vector<uint8_t> data;
+                PointerShape shape;
+                MakeShape(type.type, size, data, shape);
+                CursorCompositor compositor;
+                compositor.SetShape(shape);
+
+                // Inside the frame and hanging off each edge.
+                const int32_t positions[][2] = { { 500, 300 },
+                                                 { -static_cast<int32_t>(size) / 2, 40 },
+                                                 { static_cast<int32_t>(width) - 5, 700 },
+                                                 { 900, -static_cast<int32_t>(size) / 3 },
+                                                 { 77, static_cast<int32_t>(height) - 9 } };
+                for (const auto& position : positions)
+                {
+                    CaptureFrameInfo info;
+                    info.pointerUpdated = true;
+                    info.pointerVisible = true;
+                    info.pointerX = position[0];
+                    info.pointerY = position[1];
+                    compositor.Update(info);
+                    expected = frame;
+                    ReferenceBlend(expected.data(), pitch, width, height, shape, position[0], position[1]);
+                    compositor.Composite(frame.data(), static_cast<ptrdiff_t>(pitch), width, height);
+                    if (frame != expected)
+                    {
+                        fprintf(stderr, "%s: composited pixels differ from the reference at (%d, %d)\n", name.c_str(),
+                                position[0], position[1]);
+                        ok = false;
+                    }
+                    frame = expected;
+                }
+
+                FrameRect touched = {};
+                const uint64_t pixels = compositor.Composite(frame.data(), static_cast<ptrdiff_t>(pitch), width, height, &touched)
+                                            ? static_cast<uint64_t>(touched.right - touched.left) * (touched.bottom - touched.top)
+                                            : 0;
+                CaptureFrameInfo info;
+                info.pointerUpdated = true;
+                info.pointerVisible = true;
+                info.pointerX = 960;
+                info.pointerY = 540;
+                compositor.Update(info);
+                // Frame pixels are read and written, the three shape planes read.
+                runner.Run(name, pixels * 4 * 5, pixels, [&] {
+                    compositor.Composite(frame.data(), static_cast<ptrdiff_t>(pitch), width, height);
+                    ClobberMemory();
+                });
+            }
+        }
+        return ok;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchRunner runner(argc, argv);
+    for (const Resolution& resolution : Resolutions)
+    {
+        RunResolution(runner, resolution);
+    }
+    const bool cursorOk = RunCursor(runner);
+    const int result = runner.Finish();
+    return cursorOk ? result : 1;
+}
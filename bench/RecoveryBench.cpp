@@ -0,0 +1,495 @@
+//======================================================================================
+// RecoveryBench.cpp
+// Drives RecoveringSource through scripted faults in virtual time, then measures
+// what it costs while nothing goes wrong.
+//
+// The faults come from FaultySource, a synthetic desktop that reports its
+// duplication lost after a given number of frames, and a factory that fails a
+// given number of times before handing out the next one, possibly at another
+// resolution. Each scenario checks that:
+//
+//   - every frame has the first source's size and frames keep coming at least
+//     every other frame period, with increasing timestamps, through every gap;
+//   - a held frame is exactly the last image delivered before it;
+//   - after a mode change the picture is the new source scaled into the middle
+//     with black bars, and the pointer is scaled with it;
+//   - the loss, retry, recovery and give-up events happen as scripted.
+//
+// Any violation is printed and the run exits with 1. The timed part is the
+// per-frame mirroring into the held copy (whole frames and a few small rects)
+// and the scaler used after a mode change, which is first checked against a
+// plain per-value version of its math.
+//
+// Build and run (from the repository root):
+//     g++ -O2 -std=c++17 -pthread -I. bench/RecoveryBench.cpp -o recovery_bench
+//     ./recovery_bench [--filter scale] [--csv]
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BenchHarness.h"
+#include "../PixelKernels.h"
+#include "../RecoveringSource.h"
+#include "../SyntheticSource.h"
+
+namespace
+{
+    const uint32_t Fps = 30;
+    const uint64_t PeriodNs = 1000000000ull / Fps;
+
+    // The scenario's clock; sleeping just moves it forward.
+    uint64_t g_nowNs = 1000000000ull;
+
+    struct Mode
+    {
+        uint32_t width;
+        uint32_t height;
+        uint32_t framesBeforeLoss; // 0: never lost.
+        uint32_t failedAttempts;   // Factory failures before this source is handed out.
+    };
+
+    // A synthetic desktop refreshing once per frame period of virtual time, which
+    // reports its duplication lost after a number of frames.
+    class FaultySource : public CaptureSource
+    {
+    public:
+        FaultySource(const Mode& mode, uint32_t seed) :
+            m_framesLeft(mode.framesBeforeLoss)
+        {
+            SyntheticSource::Options options;
+            options.scenario = SyntheticSource::Scenario::Video;
+            options.width = mode.width;
+            options.height = mode.height;
+            options.realTime = false;
+            options.seed = seed;
+            m_pSource.reset(new SyntheticSource(options));
+        }
+
+        uint32_t Width() const override { return m_pSource->Width(); }
+        uint32_t Height() const override { return m_pSource->Height(); }
+
+        CaptureResult AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info) override
+        {
+            if (m_lost || (m_framesLeft && --m_framesLeft == 0))
+            {
+                m_lost = true;
+                return CaptureResult::AccessLost;
+            }
+            g_nowNs += PeriodNs;
+            const CaptureResult result = m_pSource->AcquireFrame(timeoutMs, info);
+            info.timestamp = static_cast<int64_t>(g_nowNs / 100); // Like QPC, one clock for every source.
+            lastInfo = info;
+            return result;
+        }
+
+        bool MapFrame(MappedFrame& mapped) override { return m_pSource->MapFrame(mapped); }
+        void ReleaseFrame() override { m_pSource->ReleaseFrame(); }
+
+        CaptureFrameInfo lastInfo;
+
+    private:
+        std::unique_ptr<SyntheticSource> m_pSource;
+        uint32_t m_framesLeft;
+        bool m_lost = false;
+    };
+
+    struct Scenario
+    {
+        const char* pName;
+        std::vector<Mode> modes; // One per source, in order; the factory fails after the last.
+        uint32_t frames;         // Frames to pull.
+        uint32_t giveUpMs;
+        bool expectGiveUp;
+    };
+
+    std::vector<Scenario> MakeScenarios()
+    {
+        return {
+            // A UAC prompt: lost for a while, back in the same mode.
+            { "access-lost", { { 1920, 1080, 30, 0 }, { 1920, 1080, 0, 5 } }, 150, 0, false },
+            // Resolution changes: same aspect, then a wider one, then back.
+            { "mode-change",
+              { { 1920, 1080, 20, 0 }, { 1280, 720, 25, 1 }, { 1920, 1200, 25, 0 }, { 1920, 1080, 0, 2 } },
+              150, 0, false },
+            // The monitor never comes back.
+            { "give-up", { { 1280, 720, 10, 0 } }, 200, 2000, true },
+        };
+    }
+
+    bool Fail(const Scenario& scenario, uint32_t frame, const char* pWhat)
+    {
+        fprintf(stderr, "%s: frame %u: %s\n", scenario.pName, frame, pWhat);
+        return false;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [RunScenario]
+    //----------------------------------------------------------------------------------
+    bool RunScenario(const Scenario& scenario)
+    {
+        size_t next = 0;
+        uint32_t attempts = 0;
+        FaultySource* pCurrent = nullptr;
+        RecoveringSource::Factory factory = [&](std::string& error) -> std::unique_ptr<CaptureSource>
+        {
+            if (next >= scenario.modes.size() || attempts++ < scenario.modes[next].failedAttempts)
+            {
+                error = "not yet";
+                return std::unique_ptr<CaptureSource>();
+            }
+            attempts = 0;
+            pCurrent = new FaultySource(scenario.modes[next], static_cast<uint32_t>(next + 1));
+            ++next;
+            return std::unique_ptr<CaptureSource>(pCurrent);
+        };
+
+        uint32_t lost = 0;
+        uint32_t recovered = 0;
+        uint32_t held = 0;
+        uint32_t gaveUp = 0;
+        RecoveringSource::Options options;
+        options.fps = Fps;
+        options.giveUpMs = scenario.giveUpMs;
+        options.now = []() { return g_nowNs; };
+        options.sleepUntil = [](uint64_t ns) { g_nowNs = ns > g_nowNs ? ns : g_nowNs; };
+        RecoveringSource source;
+        std::string error;
+        if (!source.Open(factory, options,
+                         [&](RecoveryEvent event) {
+                             lost += event == RecoveryEvent::Lost;
+                             recovered += event == RecoveryEvent::Recovered;
+                             held += event == RecoveryEvent::Held;
+                             gaveUp += event == RecoveryEvent::GaveUp;
+                         },
+                         error))
+        {
+            return Fail(scenario, 0, error.c_str());
+        }
+
+        const uint32_t width = source.Width();
+        const uint32_t height = source.Height();
+        const size_t frameBytes = static_cast<size_t>(width) * height * 4;
+        std::vector<uint8_t> previous(frameBytes);
+        std::vector<uint8_t> expected(frameBytes);
+        uint64_t previousNs = g_nowNs;
+        int64_t previousTimestamp = 0;
+        uint64_t longestGapNs = 0;
+        bool failed = false;
+        uint32_t frame = 0;
+        for (; frame < scenario.frames; ++frame)
+        {
+            CaptureFrameInfo info;
+            const uint32_t heldBefore = held;
+            const CaptureResult result = source.AcquireFrame(1000, info);
+            if (result == CaptureResult::Error && scenario.expectGiveUp)
+            {
+                break;
+            }
+            if (result != CaptureResult::Ok)
+            {
+                return Fail(scenario, frame, "no frame within a second");
+            }
+            const bool isHeld = held != heldBefore;
+
+            const uint64_t gapNs = g_nowNs - previousNs;
+            longestGapNs = gapNs > longestGapNs ? gapNs : longestGapNs;
+            if (gapNs > 2 * PeriodNs)
+            {
+                return Fail(scenario, frame, "gap of more than two frame periods");
+            }
+            previousNs = g_nowNs;
+            if (info.timestamp <= previousTimestamp)
+            {
+                return Fail(scenario, frame, "timestamp did not increase");
+            }
+            previousTimestamp = info.timestamp;
+
+            MappedFrame mapped;
+            if (!source.MapFrame(mapped) || mapped.width != width || mapped.height != height)
+            {
+                return Fail(scenario, frame, "frame could not be mapped at the output size");
+            }
+            // Held frames repeat the last image; live ones show the source, scaled into
+            // the middle if its mode changed.
+            if (isHeld)
+            {
+                expected = previous;
+            }
+            else
+            {
+                MappedFrame raw;
+                if (!pCurrent->MapFrame(raw))
+                {
+                    return Fail(scenario, frame, "source frame could not be mapped");
+                }
+                const uint64_t sw = raw.width;
+                const uint64_t sh = raw.height;
+                FrameRect fit = { 0, 0, static_cast<int32_t>(width), static_cast<int32_t>(height) };
+                if (sw * height >= sh * width)
+                {
+                    fit.top = static_cast<int32_t>((height - sh * width / sw) / 2);
+                    fit.bottom = fit.top + static_cast<int32_t>(sh * width / sw);
+                }
+                else
+                {
+                    fit.left = static_cast<int32_t>((width - sw * height / sh) / 2);
+                    fit.right = fit.left + static_cast<int32_t>(sw * height / sh);
+                }
+                for (size_t i = 0; i < expected.size(); i += 4)
+                {
+                    expected[i] = expected[i + 1] = expected[i + 2] = 0;
+                    expected[i + 3] = 0xFF;
+                }
+                PixelKernels::ScaleBgraBilinear(expected.data() + (static_cast<size_t>(fit.top) * width + fit.left) * 4,
+                                                static_cast<size_t>(width) * 4, static_cast<uint32_t>(fit.right - fit.left),
+                                                static_cast<uint32_t>(fit.bottom - fit.top), raw.pPixels, raw.stride,
+                                                raw.width, raw.height);
+                const int32_t pointerX = fit.left + static_cast<int32_t>(pCurrent->lastInfo.pointerX * (fit.right - fit.left) / static_cast<int64_t>(sw));
+                const int32_t pointerY = fit.top + static_cast<int32_t>(pCurrent->lastInfo.pointerY * (fit.bottom - fit.top) / static_cast<int64_t>(sh));
+                if (info.pointerX != pointerX || info.pointerY != pointerY)
+                {
+                    return Fail(scenario, frame, "pointer not mapped onto the scaled picture");
+                }
+            }
+            for (uint32_t y = 0; y < height && !failed; ++y)
+            {
+                if (memcmp(mapped.pPixels + y * mapped.stride, expected.data() + static_cast<size_t>(y) * width * 4,
+                           static_cast<size_t>(width) * 4) != 0)
+                {
+                    fprintf(stderr, "%s: frame %u: %s image differs in row %u\n", scenario.pName, frame,
+                            isHeld ? "held" : "live", y);
+                    failed = true;
+                }
+            }
+            for (uint32_t y = 0; y < height; ++y)
+            {
+                memcpy(previous.data() + static_cast<size_t>(y) * width * 4, mapped.pPixels + y * mapped.stride,
+                       static_cast<size_t>(width) * 4);
+            }
+            source.ReleaseFrame();
+            if (failed)
+            {
+                return false;
+            }
+        }
+
+        const uint32_t losses = scenario.expectGiveUp ? 1 : static_cast<uint32_t>(scenario.modes.size() - 1);
+        if (lost != losses || recovered != (scenario.expectGiveUp ? 0 : losses) || gaveUp != (scenario.expectGiveUp ? 1u : 0u))
+        {
+            fprintf(stderr, "%s: %u losses, %u recoveries, %u give-ups\n", scenario.pName, lost, recovered, gaveUp);
+            return false;
+        }
+        if (next != scenario.modes.size())
+        {
+            return Fail(scenario, frame, "not every scripted source was used");
+        }
+        printf("%-12s %3u frames, %3u held, %u lost, %u recovered%s, longest gap %.1f ms\n", scenario.pName, frame, held,
+               lost, recovered, gaveUp ? ", gave up" : "", longestGapNs / 1e6);
+        return true;
+    }
+
+    // Hands out the same frame with the same rects forever.
+    class StillSource : public CaptureSource
+    {
+    public:
+        StillSource(uint32_t width, uint32_t height, std::vector<FrameRect> dirty) :
+            m_width(width),
+            m_height(height),
+            m_pixels(static_cast<size_t>(width) * height * 4, 0x80),
+            m_dirty(std::move(dirty))
+        {
+        }
+
+        uint32_t Width() const override { return m_width; }
+        uint32_t Height() const override { return m_height; }
+
+        CaptureResult AcquireFrame(uint32_t timeoutMs, CaptureFrameInfo& info) override
+        {
+            (void)timeoutMs;
+            info = CaptureFrameInfo();
+            info.timestamp = ++m_frames;
+            info.imageUpdated = true;
+            info.accumulatedFrames = 1;
+            info.pDirtyRects = m_dirty.empty() ? nullptr : m_dirty.data();
+            info.dirtyRectCount = static_cast<uint32_t>(m_dirty.size());
+            return CaptureResult::Ok;
+        }
+
+        bool MapFrame(MappedFrame& mapped) override
+        {
+            mapped.pPixels = m_pixels.data();
+            mapped.stride = static_cast<size_t>(m_width) * 4;
+            mapped.width = m_width;
+            mapped.height = m_height;
+            return true;
+        }
+
+        void ReleaseFrame() override {}
+
+    private:
+        uint32_t m_width;
+        uint32_t m_height;
+        std::vector<uint8_t> m_pixels;
+        std::vector<FrameRect> m_dirty;
+        int64_t m_frames = 0;
+    };
+
+    void RunMirror(BenchRunner& runner)
+    {
+        // A few words typed and a caret, or the whole frame (video, scrolling).
+        std::vector<FrameRect> typing;
+        for (int32_t i = 0; i < 6; ++i)
+        {
+            typing.push_back(FrameRect{ 200 + i * 250, 100 + i * 150, 296 + i * 250, 120 + i * 150 });
+        }
+        typing.push_back(FrameRect{ 960, 540, 962, 560 });
+        const struct
+        {
+            const char* pName;
+            std::vector<FrameRect> dirty;
+        } cases[] = { { "recovery/mirror/full/1080p", {} }, { "recovery/mirror/typing/1080p", typing } };
+        for (const auto& test : cases)
+        {
+            if (!runner.Matches(test.pName))
+            {
+                continue;
+            }
+            std::vector<FrameRect> dirty = test.dirty;
+            RecoveringSource source;
+            std::string error;
+            source.Open([dirty](std::string&) { return std::unique_ptr<CaptureSource>(new StillSource(1920, 1080, dirty)); },
+                        RecoveringSource::Options(), RecoveringSource::Listener(), error);
+            CaptureFrameInfo info;
+            MappedFrame mapped;
+            source.AcquireFrame(0, info); // The first frame is always copied whole.
+            source.MapFrame(mapped);
+            source.ReleaseFrame();
+            uint64_t pixels = 0;
+            for (const FrameRect& rect : dirty)
+            {
+                pixels += static_cast<uint64_t>(rect.right - rect.left) * (rect.bottom - rect.top);
+            }
+            pixels = dirty.empty() ? 1920ull * 1080 : pixels;
+            runner.Run(test.pName, pixels * 8, pixels, [&] {
+                source.AcquireFrame(0, info);
+                source.MapFrame(mapped);
+                source.ReleaseFrame();
+                ClobberMemory();
+            });
+        }
+    }
+
+    // ScaleBgraBilinear's math, one value at a time.
+    void ReferenceScale(uint8_t* pDst, uint32_t dstWidth, uint32_t dstHeight, const uint8_t* pSrc, uint32_t srcWidth,
+                        uint32_t srcHeight)
+    {
+        const int64_t stepX = (static_cast<int64_t>(srcWidth) << 16) / dstWidth;
+        const int64_t stepY = (static_cast<int64_t>(srcHeight) << 16) / dstHeight;
+        auto position = [](uint32_t i, int64_t step, uint32_t size) -> int64_t
+        {
+            const int64_t p = i * step + step / 2 - 0x8000;
+            const int64_t max = static_cast<int64_t>(size - 1) << 16;
+            return p < 0 ? 0 : (p > max ? max : p);
+        };
+        for (uint32_t y = 0; y < dstHeight; ++y)
+        {
+            const int64_t sy = position(y, stepY, srcHeight);
+            const uint32_t y0 = static_cast<uint32_t>(sy >> 16);
+            const uint32_t y1 = y0 + 1 < srcHeight ? y0 + 1 : y0;
+            const uint32_t fy = static_cast<uint32_t>((sy >> 8) & 0xFF);
+            for (uint32_t x = 0; x < dstWidth; ++x)
+            {
+                const int64_t sx = position(x, stepX, srcWidth);
+                const uint32_t x0 = static_cast<uint32_t>(sx >> 16);
+                const uint32_t x1 = x0 + 1 < srcWidth ? x0 + 1 : x0;
+                const uint32_t fx = static_cast<uint32_t>((sx >> 8) & 0xFF);
+                for (uint32_t c = 0; c < 4; ++c)
+                {
+                    auto at = [&](uint32_t row, uint32_t column) -> uint32_t
+                    {
+                        return pSrc[(static_cast<size_t>(row) * srcWidth + column) * 4 + c];
+                    };
+                    const uint32_t left = at(y0, x0) * (256 - fy) + at(y1, x0) * fy;
+                    const uint32_t right = at(y0, x1) * (256 - fy) + at(y1, x1) * fy;
+                    pDst[(static_cast<size_t>(y) * dstWidth + x) * 4 + c] =
+                        static_cast<uint8_t>((left * (256 - fx) + right * fx + 0x8000) >> 16);
+                }
+            }
+        }
+    }
+
+    bool VerifyScale(const char* pName, const std::vector<uint8_t>& source, uint32_t sourceWidth, uint32_t sourceHeight,
+                     uint32_t width, uint32_t height)
+    {
+        std::vector<uint8_t> actual(static_cast<size_t>(width) * height * 4);
+        std::vector<uint8_t> expected(actual.size());
+        PixelKernels::ScaleBgraBilinear(actual.data(), static_cast<size_t>(width) * 4, width, height, source.data(),
+                                        static_cast<size_t>(sourceWidth) * 4, sourceWidth, sourceHeight);
+        ReferenceScale(expected.data(), width, height, source.data(), sourceWidth, sourceHeight);
+        for (size_t i = 0; i < actual.size(); ++i)
+        {
+            if (actual[i] != expected[i])
+            {
+                printf("FAIL %s: value %zu is %u, expected %u\n", pName, i, actual[i], expected[i]);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool RunScale(BenchRunner& runner)
+    {
+        const struct
+        {
+            const char* pName;
+            uint32_t sourceWidth;
+            uint32_t sourceHeight;
+        } cases[] = {
+            { "recovery/scale/720p_to_1080p", 1280, 720 },
+            { "recovery/scale/1440p_to_1080p", 2560, 1440 },
+            { "recovery/scale/4k_to_1080p", 3840, 2160 },
+        };
+        for (const auto& test : cases)
+        {
+            if (!runner.Matches(test.pName))
+            {
+                continue;
+            }
+            std::vector<uint8_t> source(static_cast<size_t>(test.sourceWidth) * test.sourceHeight * 4);
+            for (size_t i = 0; i < source.size(); ++i)
+            {
+                source[i] = static_cast<uint8_t>(i * 7 + (i >> 12));
+            }
+            if (!VerifyScale(test.pName, source, test.sourceWidth, test.sourceHeight, 1920, 1080))
+            {
+                return false;
+            }
+            std::vector<uint8_t> target(1920ull * 1080 * 4);
+            runner.Run(test.pName, source.size() + target.size(), 1920ull * 1080, [&] {
+                PixelKernels::ScaleBgraBilinear(target.data(), 1920 * 4, 1920, 1080, source.data(),
+                                                static_cast<size_t>(test.sourceWidth) * 4, test.sourceWidth,
+                                                test.sourceHeight);
+                ClobberMemory();
+            });
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchRunner runner(argc, argv);
+    bool ok = true;
+    for (const Scenario& scenario : MakeScenarios())
+    {
+        ok = RunScenario(scenario) && ok;
+    }
+    RunMirror(runner);
+    ok = RunScale(runner) && ok;
+    const int result = runner.Finish();
+    return ok ? result : 1;
+}
@@ -0,0 +1,280 @@
+//======================================================================================
+// WarmStartBench.cpp
+// How long after a start command the first frame is written, for a recording set
+// up when the command arrives (cold) and for one set up beforehand and parked on a
+// StartGate (warm), the way --daemon keeps its next recording ready.
+//
+// A recording here is BenchRecording (see its header) on one thread, with the
+// synthetic desktop in virtual time, writing MPEG-TS through a FileWriter. Setting
+// it up creates the source, its buffers, the encoder and the file; the device,
+// duplication and Media Foundation setup of a real machine can't be made here, so
+// the cold start is shorter than on one. The time to the first frame is the
+// time_to_first_frame_us health counter the recording keeps as Recorder::Record
+// does: from the gate's Start() when warm, from the command when cold. Each
+// iteration records --frames frames cold and then warm into two files.
+//
+// Reported for each: time to first frame p50, p99 and max. The run fails (exit
+// code 1) if the warm p99 exceeds one frame interval at --fps, if a warm start is
+// not faster than the cold one, or if a warm recording differs by a single byte
+// from the cold one.
+//
+// Build and run (from the repository root):
+//     g++ -O2 -std=c++17 -pthread -I. bench/WarmStartBench.cpp -o warm_start_bench
+//     ./warm_start_bench --size 1920x1080 --fps 30 --iterations 20
+//======================================================================================
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchRecording.h"
+#include "../FileWriter.h"
+#include "../HealthCounters.h"
+#include "../LatencyHistogram.h"
+#include "../StartGate.h"
+#include "../SyntheticSource.h"
+#include "../TsMuxer.h"
+
+namespace
+{
+    struct Settings
+    {
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        std::string workload = "scroll";
+        uint32_t fps = 30;
+        uint32_t frames = 30;
+        uint32_t iterations = 20;
+        uint32_t idleMs = 20;
+        std::string directory = ".";
+        bool json = false;
+    };
+
+    [[noreturn]] void Usage(const char* pProgram)
+    {
+        fprintf(stderr,
+                "Usage: %s [--size <W>x<H>] [--workload static|scroll|video|drag] [--fps <n>] [--frames <n>]\n"
+                "          [--iterations <n>] [--idle-ms <n>] [--dir <path>] [--json]\n",
+                pProgram);
+        exit(2);
+    }
+
+    Settings ParseSettings(int argc, char** argv)
+    {
+        Settings settings;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+            if (arg == "--size" && hasValue)
+            {
+                char* pEnd = nullptr;
+                settings.width = static_cast<uint32_t>(strtoul(argv[++i], &pEnd, 10));
+                settings.height = (*pEnd == 'x') ? static_cast<uint32_t>(strtoul(pEnd + 1, &pEnd, 10)) : 0;
+                if (*pEnd != '\0' || settings.width < 64 || settings.height < 64) Usage(argv[0]);
+            }
+            else if (arg == "--workload" && hasValue) settings.workload = argv[++i];
+            else if (arg == "--fps" && hasValue) settings.fps = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--frames" && hasValue) settings.frames = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--iterations" && hasValue) settings.iterations = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--idle-ms" && hasValue) settings.idleMs = static_cast<uint32_t>(atoi(argv[++i]));
+            else if (arg == "--dir" && hasValue) settings.directory = argv[++i];
+            else if (arg == "--json") settings.json = true;
+            else Usage(argv[0]);
+        }
+        SyntheticSource::Scenario scenario;
+        if (settings.fps < 1 || settings.frames < 1 || settings.iterations < 1 ||
+            !SyntheticSource::ParseScenario(settings.workload, scenario))
+        {
+            Usage(argv[0]);
+        }
+        return settings;
+    }
+
+    BenchRecording::Options RecordingOptions(const Settings& settings)
+    {
+        BenchRecording::Options options;
+        options.width = settings.width;
+        options.height = settings.height;
+        options.workload = settings.workload;
+        options.fps = settings.fps;
+        options.frames = settings.frames;
+        options.paced = false;
+        return options;
+    }
+
+    //==================================================================================
+    // TsFile
+    // The MPEG-TS file a recording writes, through the recorder's FileWriter.
+    //==================================================================================
+    class TsFile
+    {
+    public:
+        TsFile() : m_output(m_file) {}
+
+        // False if the file can't be created.
+        bool Open(const std::string& path, const BenchRecording& recording)
+        {
+            if (!m_file.Open(path, FileWriter::Options()))
+            {
+                return false;
+            }
+            std::vector<uint8_t> sequenceHeader;
+            recording.GetSequenceHeader(sequenceHeader);
+            m_muxer.Open(&m_output);
+            m_muxer.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+            return true;
+        }
+
+        EncodedSink* Sink() { return &m_muxer; }
+
+        bool Close()
+        {
+            return m_muxer.Finish() && m_file.Close();
+        }
+
+    private:
+        FileWriter m_file;
+        FileByteSink m_output;
+        TsMuxer m_muxer;
+    };
+
+    // The recording's time to its first frame, in ns; 0 if it failed.
+    uint64_t FirstFrameNs(const BenchRecording& recording)
+    {
+        return recording.Health()[HealthCounter::TimeToFirstFrameUs] * 1000;
+    }
+
+    uint64_t RecordCold(const Settings& settings, const std::string& path)
+    {
+        uint64_t firstFrameNs = 0;
+        std::thread thread([&]()
+        {
+            // Created when the command arrives, so all of the setup counts.
+            BenchRecording recording(RecordingOptions(settings));
+            recording.Prepare();
+            TsFile file;
+            if (file.Open(path, recording) && recording.Record(file.Sink()) && file.Close())
+            {
+                firstFrameNs = FirstFrameNs(recording);
+            }
+        });
+        thread.join();
+        return firstFrameNs;
+    }
+
+    uint64_t RecordWarm(const Settings& settings, const std::string& path)
+    {
+        StartGate gate;
+        uint64_t firstFrameNs = 0;
+        std::thread thread([&]()
+        {
+            BenchRecording recording(RecordingOptions(settings));
+            recording.Prepare();
+            TsFile file;
+            if (!file.Open(path, recording))
+            {
+                gate.Stop();
+                return;
+            }
+            const bool started = recording.Record(file.Sink(), &gate);
+            if (file.Close() && started)
+            {
+                firstFrameNs = FirstFrameNs(recording);
+            }
+        });
+
+        // Ready and idle for a while, as between recordings, then the command.
+        gate.WaitUntilReady(10000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(settings.idleMs));
+        gate.Start();
+        thread.join();
+        return firstFrameNs;
+    }
+
+    bool ReadFile(const std::string& path, std::vector<char>& bytes)
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return static_cast<bool>(file) || file.eof();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const Settings settings = ParseSettings(argc, argv);
+    const std::string coldPath = settings.directory + "/warm_start_cold.ts";
+    const std::string warmPath = settings.directory + "/warm_start_warm.ts";
+
+    LatencyHistogram cold;
+    LatencyHistogram warm;
+    uint64_t failures = 0;
+    uint64_t mismatches = 0;
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < settings.iterations; ++i)
+    {
+        const uint64_t coldNs = RecordCold(settings, coldPath);
+        const uint64_t warmNs = RecordWarm(settings, warmPath);
+        if (!coldNs || !warmNs)
+        {
+            ++failures;
+            continue;
+        }
+        cold.Record(coldNs);
+        warm.Record(warmNs);
+
+        // Starting early must not change a byte of what is recorded.
+        std::vector<char> coldBytes;
+        std::vector<char> warmBytes;
+        if (!ReadFile(coldPath, coldBytes) || !ReadFile(warmPath, warmBytes) || coldBytes.empty() ||
+            coldBytes != warmBytes)
+        {
+            ++mismatches;
+        }
+        bytes = coldBytes.size();
+    }
+    remove(coldPath.c_str());
+    remove(warmPath.c_str());
+
+    const LatencyHistogram::Summary coldTimes = cold.Summarize();
+    const LatencyHistogram::Summary warmTimes = warm.Summarize();
+    const uint64_t periodNs = 1000000000ull / settings.fps;
+    // Setting up ahead has to save something, even without a device to create.
+    const bool warmFaster = warmTimes.p50 < coldTimes.p50;
+    const bool passed = failures == 0 && mismatches == 0 && warmTimes.p99 <= periodNs && warmFaster;
+
+    if (settings.json)
+    {
+        printf("{\"width\":%u,\"height\":%u,\"workload\":\"%s\",\"fps\":%u,\"frames\":%u,\"iterations\":%u,"
+               "\"cold_p50_ms\":%.3f,\"cold_p99_ms\":%.3f,\"cold_max_ms\":%.3f,"
+               "\"warm_p50_ms\":%.3f,\"warm_p99_ms\":%.3f,\"warm_max_ms\":%.3f,\"frame_interval_ms\":%.3f,"
+               "\"failures\":%llu,\"output_mismatches\":%llu,\"passed\":%s}\n",
+               settings.width, settings.height, settings.workload.c_str(), settings.fps, settings.frames,
+               settings.iterations, coldTimes.p50 / 1e6, coldTimes.p99 / 1e6, coldTimes.max / 1e6,
+               warmTimes.p50 / 1e6, warmTimes.p99 / 1e6, warmTimes.max / 1e6, periodNs / 1e6,
+               static_cast<unsigned long long>(failures), static_cast<unsigned long long>(mismatches),
+               passed ? "true" : "false");
+        return passed ? 0 : 1;
+    }
+
+    printf("%ux%u %s, %u frames per recording at %u fps, %u iterations\n", settings.width, settings.height,
+           settings.workload.c_str(), settings.frames, settings.fps, settings.iterations);
+    printf("%-6s %14s %14s %14s\n", "start", "first p50", "first p99", "first max");
+    printf("%-6s %11.3f ms %11.3f ms %11.3f ms\n", "cold", coldTimes.p50 / 1e6, coldTimes.p99 / 1e6, coldTimes.max / 1e6);
+    printf("%-6s %11.3f ms %11.3f ms %11.3f ms\n", "warm", warmTimes.p50 / 1e6, warmTimes.p99 / 1e6, warmTimes.max / 1e6);
+    printf("output: %llu bytes per recording, %llu warm recordings differ from the cold one, %llu failed\n",
+           static_cast<unsigned long long>(bytes), static_cast<unsigned long long>(mismatches),
+           static_cast<unsigned long long>(failures));
+    if (!warmFaster)
+    {
+        printf("FAILED the warm start is not faster than the cold one\n");
+    }
+    printf("warm p99 %.3f ms against a %.3f ms frame interval -> %s\n", warmTimes.p99 / 1e6, periodNs / 1e6,
+           passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Builds the pixel kernel benchmark once per x86-64 ISA level and runs each build,
+# producing one CSV for the build farm to track:
+#     bench/run_isa_levels.sh [benchmark args...] > pixel_kernels.csv
+# Levels the CPU can't run are skipped. Set CXX to use another compiler.
+set -e
+cd "$(dirname "$0")/.."
+CXX="${CXX:-g++}"
+OUT="${TMPDIR:-/tmp}/pixel_kernels_bench.$$"
+trap 'rm -f "$OUT"' EXIT
+
+header=1
+for level in x86-64 x86-64-v2 x86-64-v3 x86-64-v4; do
+    if ! "$CXX" -O2 -std=c++17 -march="$level" -I. bench/PixelKernelsBench.cpp -o "$OUT" 2>/dev/null; then
+        echo "skipping $level: compiler does not support it" >&2
+        continue
+    fi
+    # An unsupported instruction kills the binary with SIGILL; a tiny probe run
+    # finds out before the real one.
+    if ! "$OUT" --filter copy_rows/1080p --min-time 0.01 --repetitions 1 >/dev/null 2>&1; then
+        echo "skipping $level: not supported by this CPU" >&2
+        continue
+    fi
+    if [ $header -eq 1 ]; then
+        "$OUT" --csv "$@"
+        header=0
+    else
+        "$OUT" --csv "$@" | tail -n +2
+    fi
+done
@@ -1,476 +1,1911 @@
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
-#include <d3d11.h>
-#include <dxgi1_2.h>
-#include <iostream>
-#include <vector> // Used for the cursor buffer, though not currently implemented
-
-// Media Foundation Headers
-#include <mfapi.h>
-#include <mfidl.h>
-#include <mfreadwrite.h>
-#include <mferror.h>
-
-// Link necessary libraries
-#pragma comment(lib, "d3d11.lib")
-#pragma comment(lib, "dxgi.lib")
-#pragma comment(lib, "mf.lib")
-#pragma comment(lib, "mfplat.lib")
-#pragma comment(lib, "mfuuid.lib")
-#pragma comment(lib, "mfreadwrite.lib")
-
-// --- Helper Functions ---
-
-// Safely releases a COM interface pointer and sets it to nullptr.
-template <class T> void SafeRelease(T** ppT)
-{
-    if (*ppT)
-    {
-        (*ppT)->Release();
-        *ppT = nullptr;
-    }
-}
-
-
-//======================================================================================
-// Recorder Class
-// Encapsulates all the logic for initializing DirectX, capturing the screen,
-// and encoding it to a video file.
-//======================================================================================
-class Recorder
-{
-public:
-    // Constructor: Initializes all COM pointers to null.
-    Recorder() :
-        m_pDevice(nullptr),
-        m_pContext(nullptr),
-        m_pDuplication(nullptr)
-    {
-    }
-
-    // Destructor: Ensures all resources are released.
-    ~Recorder()
-    {
-        // The SafeRelease helper handles null pointers, so this is safe.
-        SafeRelease(&m_pDuplication);
-        SafeRelease(&m_pContext);
-        SafeRelease(&m_pDevice);
-    }
-
-    // Public methods
-    HRESULT Initialize();
-    HRESULT Record();
-
-private:
-    // Private helper methods
-    HRESULT GrabFrameAndCreateSample(IMFSample** ppSample);
-
-    // Private member variables for DirectX state
-    ID3D11Device* m_pDevice;
-    ID3D11DeviceContext* m_pContext;
-    IDXGIOutputDuplication* m_pDuplication;
-};
-
-// --- Main Application Entry Point ---
-int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
-{
-    // Attach a console so we can see the verbose std::cout output.
-    // This is purely for debugging and can be removed for a final release.
-    AllocConsole();
-    FILE* fDummy;
-    freopen_s(&fDummy, "CONOUT$", "w", stdout);
-    freopen_s(&fDummy, "CONOUT$", "w", stderr);
-
-    // Initialize the COM library for the Multi-Threaded Apartment, and Media Foundation.
-    // MTA is required for this synchronous, console-like application model to avoid deadlocks.
-    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-    MFStartup(MF_VERSION);
-
-    std::cout << "--- Starting Application ---" << std::endl;
-
-    // Create an invisible window. Its existence gives our application the proper
-    // desktop session context required by the Desktop Duplication API to succeed.
-    WNDCLASS wc = { 0 };
-    const wchar_t CLASS_NAME[] = L"ScreenRecordWindowClass";
-    wc.lpfnWndProc = DefWindowProc;
-    wc.hInstance = hInstance;
-    wc.lpszClassName = CLASS_NAME;
-    RegisterClass(&wc);
-    HWND hWnd = CreateWindowEx(0, CLASS_NAME, L"Screen Recorder", 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, hInstance, nullptr);
-
-    // Create an instance of our Recorder class
-    Recorder rec;
-
-    // Initialize the recorder (finds monitor, creates D3D device, sets up duplication)
-    HRESULT hr = rec.Initialize();
-
-    if (FAILED(hr))
-    {
-        MessageBox(nullptr, L"Failed to initialize DXGI for screen capture.", L"Error", MB_OK | MB_ICONERROR);
-    }
-    else
-    {
-        // If initialization succeeded, start the recording process.
-        std::cout << "\n--- Starting Capture ---" << std::endl;
-        hr = rec.Record();
-        if (SUCCEEDED(hr))
-        {
-            MessageBox(nullptr, L"Successfully recorded 5 seconds of video to output.mp4!", L"Success", MB_OK);
-        }
-        else
-        {
-            MessageBox(nullptr, L"Failed to record video.", L"Capture Error", MB_OK | MB_ICONERROR);
-        }
-    }
-
-    // The Recorder's destructor will automatically be called here, cleaning up its resources.
-
-    // Shut down Media Foundation and COM.
-    MFShutdown();
-    CoUninitialize();
-    std::cout << "\n--- Application Exiting ---" << std::endl;
-    return 0;
-}
-
-
-//======================================================================================
-// Recorder Class Method Implementations
-//======================================================================================
-
-//--------------------------------------------------------------------------------------
-// [Recorder::Initialize]
-// Finds the primary monitor and sets up the D3D11 device and Desktop Duplication API.
-//--------------------------------------------------------------------------------------
-HRESULT Recorder::Initialize()
-{
-    HRESULT hr = S_OK;
-
-    IDXGIFactory1* pFactory = nullptr;
-    IDXGIAdapter1* pAdapter = nullptr;
-
-    // Create a DXGI Factory
-    hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void**)(&pFactory));
-    if (FAILED(hr))
-    {
-        return hr;
-    }
-
-    // --- Enumerate Adapters (Graphics Cards) ---
-    // We'll iterate through all adapters until we find one that has an attached monitor.
-    for (UINT i = 0; ; ++i)
-    {
-        // Get the next adapter
-        hr = pFactory->EnumAdapters1(i, &pAdapter);
-        if (hr == DXGI_ERROR_NOT_FOUND)
-        {
-            // No more adapters, so we break the loop
-            break;
-        }
-        if (FAILED(hr))
-        {
-            continue; // Failed to get adapter, try the next one
-        }
-
-        // --- Enumerate Outputs (Monitors) ---
-        // Iterate through all monitors attached to this adapter.
-        for (UINT j = 0; ; ++j)
-        {
-            IDXGIOutput* pOutput = nullptr;
-            hr = pAdapter->EnumOutputs(j, &pOutput);
-            if (hr == DXGI_ERROR_NOT_FOUND)
-            {
-                // No more outputs on this adapter
-                break;
-            }
-            if (FAILED(hr))
-            {
-                continue; // Failed to get output, try the next one
-            }
-
-            // Check if the monitor is attached to the desktop
-            DXGI_OUTPUT_DESC desc;
-            pOutput->GetDesc(&desc);
-            if (desc.AttachedToDesktop)
-            {
-                IDXGIOutput1* pOutput1 = nullptr;
-                hr = pOutput->QueryInterface(__uuidof(IDXGIOutput1), (void**)&pOutput1);
-                if (SUCCEEDED(hr))
-                {
-                    // If we found a monitor, NOW we create the D3D11 Device from its adapter.
-                    hr = D3D11CreateDevice(pAdapter, D3D_DRIVER_TYPE_UNKNOWN, NULL, D3D11_CREATE_DEVICE_VIDEO_SUPPORT, NULL, 0, D3D11_SDK_VERSION, &m_pDevice, NULL, &m_pContext);
-                    if (SUCCEEDED(hr))
-                    {
-                        // And finally, create the duplication interface from the device.
-                        hr = pOutput1->DuplicateOutput(m_pDevice, &m_pDuplication);
-                        if (SUCCEEDED(hr))
-                        {
-                            // Success! We have found a working setup.
-                            std::cout << "Successfully created duplication for an attached monitor!" << std::endl;
-                            SafeRelease(&pOutput1);
-                            SafeRelease(&pOutput);
-                            SafeRelease(&pAdapter);
-                            SafeRelease(&pFactory);
-                            return S_OK;
-                        }
-                        // Cleanup failed device creation
-                        SafeRelease(&m_pDevice);
-                        SafeRelease(&m_pContext);
-                    }
-                }
-                SafeRelease(&pOutput1);
-            }
-            SafeRelease(&pOutput);
-        }
-        SafeRelease(&pAdapter);
-    }
-
-    SafeRelease(&pFactory);
-    // If we get here, we never found a suitable monitor.
-    return E_FAIL;
-}
-
-//--------------------------------------------------------------------------------------
-// [Recorder::Record]
-// Configures and runs the main video encoding loop.
-//--------------------------------------------------------------------------------------
-HRESULT Recorder::Record()
-{
-    HRESULT hr = S_OK;
-    IMFSinkWriter* pSinkWriter = nullptr;
-    IMFDXGIDeviceManager* pDeviceManager = nullptr;
-    IMFAttributes* pAttributes = nullptr;
-
-    // This do-while(false) loop is a C++-friendly replacement for goto statements.
-    // If any step fails, we can 'break' to the cleanup section at the end.
-    do
-    {
-        // --- Define Video Parameters ---
-        const UINT32 VIDEO_FPS = 30;
-        const UINT32 VIDEO_BIT_RATE = 8000000; // 8 Mbps
-        const UINT64 VIDEO_FRAME_DURATION = 10 * 1000 * 1000 / VIDEO_FPS;
-        LONGLONG rtStart = 0; // Running timestamp
-
-        // Get the screen dimensions from the duplication description
-        DXGI_OUTDUPL_DESC duplDesc;
-        m_pDuplication->GetDesc(&duplDesc);
-        const UINT32 VIDEO_WIDTH = duplDesc.ModeDesc.Width;
-        const UINT32 VIDEO_HEIGHT = duplDesc.ModeDesc.Height;
-
-        // --- Configure the Sink Writer ---
-
-        // 1. Create the DXGI Device Manager. This is the crucial link that allows the
-        //    Sink Writer's internal components (like the color converter) to use our GPU.
-        UINT resetToken;
-        hr = MFCreateDXGIDeviceManager(&resetToken, &pDeviceManager);
-        if (FAILED(hr)) break;
-        hr = pDeviceManager->ResetDevice(m_pDevice, resetToken);
-        if (FAILED(hr)) break;
-
-        // Create an attribute store to hold the device manager pointer.
-        hr = MFCreateAttributes(&pAttributes, 1);
-        if (FAILED(hr)) break;
-        hr = pAttributes->SetUnknown(MF_SINK_WRITER_D3D_MANAGER, pDeviceManager);
-        if (FAILED(hr)) break;
-
-        // 2. Create the Sink Writer, passing in the hardware attributes.
-        std::cout << "Configuring Sink Writer for " << VIDEO_WIDTH << "x" << VIDEO_HEIGHT << " @ " << VIDEO_FPS << " FPS" << std::endl;
-        hr = MFCreateSinkWriterFromURL(L"output.mp4", nullptr, pAttributes, &pSinkWriter);
-        if (FAILED(hr)) break;
-
-        // 3. Configure the Output Stream (what we want the final file to look like)
-        DWORD streamIndex;
-        IMFMediaType* pMediaTypeOut = nullptr;
-        hr = MFCreateMediaType(&pMediaTypeOut);
-        if (SUCCEEDED(hr))
-        {
-            hr = pMediaTypeOut->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
-            if (SUCCEEDED(hr)) hr = pMediaTypeOut->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264); // H.264 video
-            if (SUCCEEDED(hr)) hr = pMediaTypeOut->SetUINT32(MF_MT_AVG_BITRATE, VIDEO_BIT_RATE);
-            if (SUCCEEDED(hr)) hr = MFSetAttributeRatio(pMediaTypeOut, MF_MT_FRAME_RATE, VIDEO_FPS, 1);
-            if (SUCCEEDED(hr)) hr = MFSetAttributeSize(pMediaTypeOut, MF_MT_FRAME_SIZE, VIDEO_WIDTH, VIDEO_HEIGHT);
-            if (SUCCEEDED(hr)) hr = pMediaTypeOut->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
-            if (SUCCEEDED(hr)) hr = pSinkWriter->AddStream(pMediaTypeOut, &streamIndex);
-        }
-        SafeRelease(&pMediaTypeOut);
-        if (FAILED(hr)) break;
-
-        // 4. Configure the Input Stream (what we will be feeding the writer)
-        IMFMediaType* pMediaTypeIn = nullptr;
-        hr = MFCreateMediaType(&pMediaTypeIn);
-        if (SUCCEEDED(hr))
-        {
-            hr = pMediaTypeIn->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
-            if (SUCCEEDED(hr)) hr = pMediaTypeIn->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32); // Uncompressed 32-bit RGB from our capture
-            if (SUCCEEDED(hr)) hr = MFSetAttributeRatio(pMediaTypeIn, MF_MT_FRAME_RATE, VIDEO_FPS, 1);
-            if (SUCCEEDED(hr)) hr = MFSetAttributeSize(pMediaTypeIn, MF_MT_FRAME_SIZE, VIDEO_WIDTH, VIDEO_HEIGHT);
-            if (SUCCEEDED(hr)) hr = pMediaTypeIn->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
-            if (SUCCEEDED(hr)) hr = pSinkWriter->SetInputMediaType(streamIndex, pMediaTypeIn, nullptr);
-        }
-        SafeRelease(&pMediaTypeIn);
-        if (FAILED(hr)) break;
-
-        // 5. Start the encoding session.
-        hr = pSinkWriter->BeginWriting();
-        if (FAILED(hr)) break;
-        std::cout << "Sink Writer configured. Starting capture loop..." << std::endl;
-
-        // --- Main Capture Loop ---
-        for (int i = 0; i < (VIDEO_FPS * 5); ++i)
-        {
-            IMFSample* pSample = nullptr;
-            hr = GrabFrameAndCreateSample(&pSample);
-
-            if (hr == S_FALSE) {
-                // S_FALSE is our custom signal for a non-fatal timeout.
-                std::cout << "Skipping frame " << i << " due to timeout." << std::endl;
-                hr = S_OK; // Reset HR so we don't treat it as a failure
-                continue;
-            }
-            if (FAILED(hr)) {
-                std::cerr << "Failed to grab frame. Exiting loop." << std::endl;
-                break; // A real error occurred, exit the loop.
-            }
-
-            // Set the timestamp and duration for the frame.
-            hr = pSample->SetSampleTime(rtStart);
-            if (FAILED(hr)) { SafeRelease(&pSample); break; }
-            hr = pSample->SetSampleDuration(VIDEO_FRAME_DURATION);
-            if (FAILED(hr)) { SafeRelease(&pSample); break; }
-
-            // Write the frame to the video file.
-            hr = pSinkWriter->WriteSample(streamIndex, pSample);
-            if (FAILED(hr)) { SafeRelease(&pSample); break; }
-
-            SafeRelease(&pSample);
-            std::cout << "Wrote frame " << i << std::endl;
-            rtStart += VIDEO_FRAME_DURATION; // Increment the timestamp for the next frame
-        }
-        if (FAILED(hr)) break;
-
-        std::cout << "Capture loop finished." << std::endl;
-
-    } while (false);
-
-    // --- Finalize and Cleanup ---
-    if (pSinkWriter)
-    {
-        std::cout << "Finalizing video file..." << std::endl;
-        HRESULT finalizeHr = pSinkWriter->Finalize();
-        // If the main loop succeeded but finalize failed, report the finalize error.
-        if (SUCCEEDED(hr) && FAILED(finalizeHr))
-        {
-            hr = finalizeHr;
-        }
-    }
-
-    SafeRelease(&pSinkWriter);
-    SafeRelease(&pDeviceManager);
-    SafeRelease(&pAttributes);
-
-    if (FAILED(hr))
-    {
-        std::cerr << "An error occurred during recording. HRESULT: 0x" << std::hex << hr << std::endl;
-    }
-    return hr;
-}
-
-
-//--------------------------------------------------------------------------------------
-// [Recorder::GrabFrameAndCreateSample]
-// Captures a single frame, copies it to a CPU buffer, and creates an IMFSample.
-// This is the core logic that was debugged and proven to be reliable.
-//--------------------------------------------------------------------------------------
-HRESULT Recorder::GrabFrameAndCreateSample(IMFSample** ppSample)
-{
-    HRESULT hr = S_OK;
-    IDXGIResource* pDesktopResource = nullptr;
-    ID3D11Texture2D* pDesktopTexture = nullptr;
-    ID3D11Texture2D* pStagingTexture = nullptr;
-    IMFMediaBuffer* pBuffer = nullptr;
-    *ppSample = nullptr;
-
-    do {
-        // 1. Acquire a new frame from the Desktop Duplication API.
-        DXGI_OUTDUPL_FRAME_INFO frameInfo;
-        hr = m_pDuplication->AcquireNextFrame(1000, &frameInfo, &pDesktopResource);
-        if (hr == DXGI_ERROR_WAIT_TIMEOUT) {
-            // This is not a fatal error, just no screen updates. We signal this with S_FALSE.
-            hr = S_FALSE;
-            break;
-        }
-        if (FAILED(hr)) break;
-
-        // Get the underlying ID3D11Texture2D from the DXGI resource.
-        hr = pDesktopResource->QueryInterface(IID_PPV_ARGS(&pDesktopTexture));
-        if (FAILED(hr)) break;
-
-        // 2. Create a "staging" texture. This is a special texture that the CPU can read.
-        D3D11_TEXTURE2D_DESC desc;
-        pDesktopTexture->GetDesc(&desc);
-        desc.Usage = D3D11_USAGE_STAGING;
-        desc.BindFlags = 0;
-        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-        desc.MiscFlags = 0;
-        hr = m_pDevice->CreateTexture2D(&desc, NULL, &pStagingTexture);
-        if (FAILED(hr)) break;
-
-        // 3. Copy the GPU's desktop image to the staging texture.
-        m_pContext->CopyResource(pStagingTexture, pDesktopTexture);
-
-        // 4. Force the GPU to finish the copy operation. This is the critical step that
-        //    prevents the "black screen" race condition.
-        m_pContext->Flush();
-
-        // 5. Map the staging texture, which gives the CPU read access to its pixel data.
-        D3D11_MAPPED_SUBRESOURCE mapped;
-        hr = m_pContext->Map(pStagingTexture, 0, D3D11_MAP_READ, 0, &mapped);
-        if (FAILED(hr)) break;
-
-        // 6. Create a Media Foundation memory buffer and copy the pixel data into it,
-        //    flipping the image vertically and correcting for stride mismatch in the process.
-        hr = MFCreateMemoryBuffer(desc.Height * desc.Width * 4, &pBuffer);
-        if (SUCCEEDED(hr)) {
-            BYTE* pDst = nullptr;
-            pBuffer->Lock(&pDst, NULL, NULL);
-
-            const UINT Bpp = 4; // Bytes per pixel
-            const UINT rowWidthInBytes = desc.Width * Bpp;
-            BYTE* pSrc = (BYTE*)mapped.pData + ((desc.Height - 1) * mapped.RowPitch);
-
-            for (UINT y = 0; y < desc.Height; ++y) {
-                memcpy(pDst, pSrc, rowWidthInBytes);
-                pDst += rowWidthInBytes;
-                pSrc -= mapped.RowPitch;
-            }
-
-            pBuffer->Unlock();
-            pBuffer->SetCurrentLength(desc.Height * desc.Width * 4);
-        }
-        m_pContext->Unmap(pStagingTexture, 0);
-        if (FAILED(hr)) break;
-
-        // 7. Create the final IMFSample and attach the buffer.
-        hr = MFCreateSample(ppSample);
-        if (FAILED(hr)) break;
-
-        hr = (*ppSample)->AddBuffer(pBuffer);
-
-    } while (false);
-
-    // --- Cleanup ---
-    // This is always called, whether we succeeded or failed.
-    if (m_pDuplication) {
-        // We must release the frame, even if we failed to process it.
-        m_pDuplication->ReleaseFrame();
-    }
-    SafeRelease(&pDesktopResource);
-    SafeRelease(&pDesktopTexture);
-    SafeRelease(&pStagingTexture);
-    SafeRelease(&pBuffer);
-
-    // If any step failed, ensure the output sample is null.
-    if (FAILED(hr)) {
-        SafeRelease(ppSample);
-    }
-    return hr;
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <d3d11.h>
+#include <dxgi1_2.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Media Foundation Headers
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <mferror.h>
+
+// Encoder control (GOP length, forced keyframes)
+#include <strmif.h>
+#include <codecapi.h>
+
+#include "ComHelpers.h"
+#include "Utf8Path.h"
+#include "RecorderOptions.h"
+#include "CaptureSource.h"
+#include "CanvasSource.h"
+#include "DesktopOutputs.h"
+#include "DxgiCaptureSource.h"
+#include "SyntheticSource.h"
+#include "ReplaySource.h"
+#include "RecoveringSource.h"
+#include "OutputCache.h"
+#include "StartupTimer.h"
+#include "StartGate.h"
+#include "ControlServer.h"
+#include "DaemonControl.h"
+#include "ReplayBuffer.h"
+#include "CaptureTrace.h"
+#include "CursorCompositor.h"
+#include "CursorTrack.h"
+#include "FrameClock.h"
+#include "KeyframeController.h"
+#include "PixelKernels.h"
+#include "RawFrameSink.h"
+#include "WriterStream.h"
+#include "MFH264Encoder.h"
+#include "TsMuxer.h"
+#include "MkvMuxer.h"
+#include "StreamOutput.h"
+#include "QualityMonitor.h"
+#include "PipelineStats.h"
+#include "HealthCounters.h"
+#include "MetricsExporter.h"
+#include "Log.h"
+
+// Link necessary libraries
+#pragma comment(lib, "d3d11.lib")
+#pragma comment(lib, "dxgi.lib")
+#pragma comment(lib, "mf.lib")
+#pragma comment(lib, "mfplat.lib")
+#pragma comment(lib, "mfuuid.lib")
+#pragma comment(lib, "mfreadwrite.lib")
+#pragma comment(lib, "strmiids.lib")
+
+// --- Helper Functions ---
+
+// The arguments after the program name, in UTF-8 (see Utf8Path.h). WinMain's
+// lpCmdLine has them in the ANSI code page, which can't hold every path.
+static std::string CommandLineArguments()
+{
+    const wchar_t* p = GetCommandLineW();
+    bool inQuotes = false;
+    for (; *p && (inQuotes || (*p != L' ' && *p != L'\t')); ++p)
+    {
+        if (*p == L'"') inQuotes = !inQuotes;
+    }
+    return WideToUtf8(p);
+}
+
+// Where the output cache lives unless --output-cache says otherwise:
+// %LOCALAPPDATA%\ScreenRecorder\output-cache.txt. Empty if there is no such folder.
+static std::string DefaultOutputCachePath()
+{
+    wchar_t folder[MAX_PATH];
+    const DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", folder, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        return std::string();
+    }
+    const std::string directory = WideToUtf8(folder) + "\\ScreenRecorder";
+    CreateDirectoryW(Utf8ToWide(directory).c_str(), nullptr); // Fails harmlessly if it exists.
+    return directory + "\\output-cache.txt";
+}
+
+static CachedOutput ToCachedOutput(const DesktopOutput& output, uint32_t number)
+{
+    CachedOutput cached;
+    cached.adapterLuid = output.adapterLuid;
+    cached.outputIndex = output.outputIndex;
+    cached.number = number;
+    cached.left = output.desktopCoordinates.left;
+    cached.top = output.desktopCoordinates.top;
+    cached.right = output.desktopCoordinates.right;
+    cached.bottom = output.desktopCoordinates.bottom;
+    return cached;
+}
+
+
+//======================================================================================
+// Recorder Class
+// Encapsulates all the logic for initializing DirectX, capturing the screen,
+// and encoding it to a video file.
+//======================================================================================
+class Recorder
+{
+public:
+    // Constructor: Initializes all COM pointers to null. 'startup' has timed what
+    // happened since the process started (see StartupTimer.h).
+    explicit Recorder(const RecorderOptions& options, const StartupTimer& startup = StartupTimer()) :
+        m_options(options),
+        m_startup(startup),
+        m_pDevice(nullptr),
+        m_pContext(nullptr),
+        m_keyframes(options.EffectiveGopLength(),
+                    IsEncodedSink(options.sink) ? options.sceneChangeThreshold : 0.0, // Raw sinks have no keyframes
+                    options.fps / 2),
+        m_pHealth(m_health.RegisterThread()) // Only the thread running Record() counts into it.
+    {
+    }
+
+    // Destructor: Ensures all resources are released.
+    ~Recorder()
+    {
+        // The source holds references on the device, so it goes first.
+        m_pSource.reset();
+        // The SafeRelease helper handles null pointers, so this is safe.
+        SafeRelease(&m_pContext);
+        SafeRelease(&m_pDevice);
+    }
+
+    // Public methods
+    HRESULT Initialize();
+    // With a clock, frames are captured and stamped on its slots so this recording
+    // lines up with the others following it; without one, every acquired frame is
+    // the next frame of the video. With a gate (--daemon), everything is set up and
+    // the first frame waits for the gate's Start(); a Stop() before then cancels the
+    // recording with E_ABORT, and one after it ends the recording.
+    HRESULT Record(FrameClock* pClock = nullptr, StartGate* pGate = nullptr);
+
+    // Makes the next captured frame an IDR frame. Safe to call from any thread,
+    // e.g. right before a replay buffer is cut so the segment starts cleanly.
+    void RequestKeyframe() { m_keyframes.RequestKeyframe(); }
+
+    // Writes the last --replay-seconds of the recording to 'path' as MPEG-TS. Safe to
+    // call from any thread while recording; the capture thread never waits for it.
+    bool SaveReplay(const std::string& path, ReplayBuffer::Saved& saved, std::string& error) const
+    {
+        if (!m_replay.IsStarted())
+        {
+            error = "save-replay needs --replay-seconds";
+            return false;
+        }
+        return m_replay.Save(path, saved, error);
+    }
+
+    // Writes the trace events recorded so far as Chrome trace JSON. Safe to call
+    // from any thread while recording; requires tracing to be on (--trace).
+    bool DumpTrace(const std::string& path) const;
+
+    // Frame, keyframe and queue counters so far. Safe to call from any thread.
+    HealthCounters::Snapshot GetHealth() const { return m_health.Read(); }
+
+    // The health counters and stage latencies in the Prometheus text format. Safe to
+    // call from any thread; reads never block the capture thread.
+    void FormatMetrics(std::string& text) const;
+
+private:
+    // Private helper methods
+    HRESULT CreateOffscreenSource();
+    HRESULT OpenCachedOutput();
+    HRESULT OpenDesktopSource(const DesktopOutput& output, uint32_t index, const AdapterDevice& device,
+                              std::unique_ptr<CaptureSource>& pSource);
+    void OnRecoveryEvent(const RecoveringSource& source, uint32_t index, RecoveryEvent event);
+    HRESULT OpenDesktopCanvas(const std::vector<DesktopOutput>& outputs);
+    HRESULT OpenCanvas(std::vector<CanvasSource::Monitor> monitors);
+    HRESULT CreateSinkWriter(UINT32 width, UINT32 height, WriterStream* pStream, IMFSinkWriter** ppSinkWriter, DWORD* pStreamIndex, ICodecAPI** ppCodecApi);
+    HRESULT GrabFrameAndCreateSample(UINT timeoutMs, IMFSample** ppSample, double* pChangedFraction,
+                                     RawFrameSink* pRawSink, LONGLONG timestamp);
+    void CountKeyframe(KeyframeReason reason);
+    bool WriteHealthReport(const std::string& path, double durationSeconds, bool succeeded) const;
+
+    const RecorderOptions m_options;
+
+    // Time from process start to the first recorded frame, phase by phase.
+    StartupTimer m_startup;
+
+    // Private member variables for DirectX state
+    ID3D11Device* m_pDevice;
+    ID3D11DeviceContext* m_pContext;
+
+    // Where frames come from: the duplicated monitor or a synthetic desktop.
+    std::unique_ptr<CaptureSource> m_pSource;
+    // Optional recording of everything the source delivers (--capture-trace).
+    CaptureTraceWriter m_captureTrace;
+    // Pointer shape and position, drawn into each frame after the copy.
+    CursorCompositor m_cursor;
+    CursorTrackWriter m_cursorTrack;
+    // The pointer's surroundings with the pointer drawn in, for the raw sink.
+    std::vector<BYTE> m_cursorPatch;
+
+    // Keyframe placement and the previous frame used for scene-change detection.
+    KeyframeController m_keyframes;
+    std::vector<BYTE> m_prevFrame;
+
+    // Per-stage latency histograms, recorded on the capture thread.
+    PipelineStats m_stats;
+
+    // What happened to each frame; the capture thread counts into its own slot.
+    HealthCounters m_health;
+    HealthCounters::Slot* m_pHealth;
+
+    // PSNR/SSIM of sampled frames (--quality-sample), measured on its own thread.
+    QualityMonitor m_quality;
+
+    // The last --replay-seconds of encoded frames, for "save-replay".
+    ReplayBuffer m_replay;
+};
+
+//--------------------------------------------------------------------------------------
+// [SelectOutputs]
+// The settings for each recording --outputs asks for: the options as given for a
+// single one or a --canvas of several, or OptionsForOutput() for each of several.
+//--------------------------------------------------------------------------------------
+static HRESULT SelectOutputs(const RecorderOptions& options, std::vector<RecorderOptions>& outputOptions)
+{
+    std::vector<uint32_t> indices = options.outputIndices;
+    if (options.allOutputs)
+    {
+        std::vector<DesktopOutput> outputs;
+        HRESULT hr = EnumerateDesktopOutputs(outputs);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        for (uint32_t i = 0; i < outputs.size(); ++i)
+        {
+            indices.push_back(i);
+        }
+        if (indices.empty())
+        {
+            LOG_ERROR("No output is attached to the desktop.");
+            return E_FAIL;
+        }
+    }
+
+    if (indices.size() <= 1 || options.canvas)
+    {
+        outputOptions.assign(1, options);
+        outputOptions[0].allOutputs = false;
+        outputOptions[0].outputIndices = indices;
+        return S_OK;
+    }
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        outputOptions.push_back(OptionsForOutput(options, indices[i], i == 0));
+        LOG_INFO("Recording output {} to {}", indices[i], outputOptions.back().outputPath);
+    }
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// [StartCommandReader]
+// Reads --daemon requests from 'input' until it ends, which counts as "quit", and
+// prints the answers. A blocked console read can't be cancelled, so the thread is
+// left to the process exit; it holds its own reference to the queue.
+//--------------------------------------------------------------------------------------
+static void StartCommandReader(HANDLE input, const std::shared_ptr<CommandQueue>& pQueue)
+{
+    std::thread([input, pQueue]()
+    {
+        std::string line;
+        char buffer[256];
+        DWORD bytesRead = 0;
+        while (ReadFile(input, buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0)
+        {
+            for (DWORD i = 0; i < bytesRead; ++i)
+            {
+                if (buffer[i] != '\n' && buffer[i] != '\r')
+                {
+                    line += buffer[i];
+                }
+                else if (!line.empty())
+                {
+                    printf("%s\n", pQueue->SubmitLine(line).c_str());
+                    fflush(stdout);
+                    line.clear();
+                }
+            }
+        }
+        ControlRequest quit;
+        quit.command = ControlCommand::Quit;
+        pQueue->Submit(quit);
+    }).detach();
+}
+
+//--------------------------------------------------------------------------------------
+// [DaemonedRecorder]
+// A Recorder as ServeDaemon() drives it (see DaemonControl.h).
+//--------------------------------------------------------------------------------------
+class DaemonedRecorder : public DaemonRecorder
+{
+public:
+    DaemonedRecorder(const RecorderOptions& options, const StartupTimer& startup)
+        : m_options(options), m_recorder(options, startup)
+    {
+    }
+
+    bool Prepare() override
+    {
+        const HRESULT hr = m_recorder.Initialize();
+        if (FAILED(hr))
+        {
+            LOG_ERROR("Could not set up {}. HRESULT: 0x{:x}", m_options.outputPath, hr);
+        }
+        return SUCCEEDED(hr);
+    }
+
+    Result Record(StartGate& gate) override
+    {
+        CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+        const HRESULT hr = m_recorder.Record(nullptr, &gate);
+        CoUninitialize();
+        if (hr == E_ABORT)
+        {
+            return Result::Cancelled;
+        }
+        return SUCCEEDED(hr) ? Result::Recorded : Result::Failed;
+    }
+
+    HealthCounters::Snapshot Health() const override { return m_recorder.GetHealth(); }
+
+    bool SaveReplay(const std::string& path, ReplayBuffer::Saved& saved, std::string& error) override
+    {
+        return m_recorder.SaveReplay(path, saved, error);
+    }
+
+    void Discard() override
+    {
+        DeleteFileW(Utf8ToWide(m_options.outputPath).c_str());
+        DeleteFileW(Utf8ToWide(m_options.outputPath + ".kfidx").c_str());
+        DeleteFileW(Utf8ToWide(m_options.outputPath + ".cursor").c_str());
+        if (!m_options.captureTracePath.empty())
+        {
+            DeleteFileW(Utf8ToWide(m_options.captureTracePath).c_str());
+        }
+    }
+
+private:
+    const RecorderOptions m_options;
+    Recorder m_recorder;
+};
+
+//--------------------------------------------------------------------------------------
+// [RunDaemon]
+// --daemon: serves requests from the control socket or the standard input with
+// ServeDaemon() (DaemonControl.h) until "quit".
+//--------------------------------------------------------------------------------------
+static HRESULT RunDaemon(const RecorderOptions& options, const StartupTimer& startup, HANDLE input)
+{
+    std::shared_ptr<CommandQueue> pCommands = std::make_shared<CommandQueue>();
+    ControlServer control;
+    if (!options.controlPath.empty())
+    {
+        std::string error;
+        if (!control.Start(options.controlPath, [pCommands](const ControlRequest& request)
+                           { return pCommands->Submit(request); }, error))
+        {
+            LOG_ERROR("{}", error);
+            return E_FAIL;
+        }
+        LOG_INFO("Listening for commands on {}", options.controlPath);
+    }
+    else
+    {
+        if (!input || input == INVALID_HANDLE_VALUE)
+        {
+            input = CreateFileW(L"CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                OPEN_EXISTING, 0, nullptr);
+        }
+        StartCommandReader(input, pCommands);
+        LOG_INFO("Daemon mode: type start, stop, mark [label], save-replay [path], query-stats or quit.");
+    }
+
+    StartupTimer timer = startup;
+    const bool succeeded = ServeDaemon(options, *pCommands, [&timer](const RecorderOptions& recordingOptions)
+    {
+        std::unique_ptr<DaemonRecorder> pRecorder(new DaemonedRecorder(recordingOptions, timer));
+        timer = StartupTimer(); // Later recordings are timed from when they are set up.
+        return pRecorder;
+    });
+
+    pCommands->Close();
+    control.Stop();
+    return succeeded ? S_OK : E_FAIL;
+}
+
+// --- Main Application Entry Point ---
+int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
+{
+    StartupTimer startup;
+
+    // Keep the stdout we were started with (e.g. "recorder --stream stdout | ffplay -")
+    // before the debug console replaces it.
+    StreamTarget::InheritedStdout() = GetStdHandle(STD_OUTPUT_HANDLE);
+    // Likewise the stdin --daemon reads its commands from, if we were given one.
+    const HANDLE commandInput = GetStdHandle(STD_INPUT_HANDLE);
+
+    // Read the recording settings from the command line. Nothing is shown before
+    // this, so --headless can keep the console and the message boxes away.
+    RecorderOptions options;
+    std::string optionsError;
+    const bool optionsValid =
+        ParseRecorderOptions(SplitCommandLine(CommandLineArguments().c_str()), options, optionsError);
+
+    // Attach a console so we can see the log output.
+    // This is purely for debugging and can be removed for a final release.
+    if (!options.headless)
+    {
+        AllocConsole();
+        FILE* fDummy;
+        freopen_s(&fDummy, "CONOUT$", "w", stdout);
+        freopen_s(&fDummy, "CONOUT$", "w", stderr);
+    }
+
+    // Initialize the COM library for the Multi-Threaded Apartment, and Media Foundation.
+    // MTA is required for this synchronous, console-like application model to avoid deadlocks.
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    MFStartup(MF_VERSION);
+
+    LOG_INFO("--- Starting Application ---");
+
+    // Create an invisible window. Its existence gives our application the proper
+    // desktop session context required by the Desktop Duplication API to succeed.
+    WNDCLASS wc = { 0 };
+    const wchar_t CLASS_NAME[] = L"ScreenRecordWindowClass";
+    wc.lpfnWndProc = DefWindowProc;
+    wc.hInstance = hInstance;
+    wc.lpszClassName = CLASS_NAME;
+    RegisterClass(&wc);
+    HWND hWnd = CreateWindowEx(0, CLASS_NAME, L"Screen Recorder", 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, hInstance, nullptr);
+
+    if (!optionsValid)
+    {
+        LOG_ERROR("{}", optionsError);
+        if (!options.headless)
+        {
+            MessageBoxA(nullptr, optionsError.c_str(), "Invalid Arguments", MB_OK | MB_ICONERROR);
+        }
+        MFShutdown();
+        CoUninitialize();
+        return 1;
+    }
+
+    // From here on log records are formatted and written off the calling thread.
+    Log::Logger::Instance().SetLevel(options.logLevel);
+    if (!Log::Logger::Instance().Start(options.logFilePath))
+    {
+        LOG_WARN("Could not create log file {}", options.logFilePath);
+    }
+    if (options.useOutputCache && options.outputCachePath.empty())
+    {
+        options.outputCachePath = DefaultOutputCachePath();
+    }
+
+    // One recorder per output. Usually that's just the one; with several --outputs
+    // each records on its own thread, and a shared clock keeps their frames aligned.
+    std::vector<RecorderOptions> outputOptions;
+    HRESULT hr = SelectOutputs(options, outputOptions);
+    if (options.daemon)
+    {
+        // Records on command until told to quit; there is nobody to show a message box.
+        if (SUCCEEDED(hr))
+        {
+            hr = RunDaemon(outputOptions[0], startup, commandInput);
+        }
+        MFShutdown();
+        CoUninitialize();
+        LOG_INFO("--- Application Exiting ---");
+        Log::Logger::Instance().Stop();
+        return SUCCEEDED(hr) ? 0 : 1;
+    }
+    std::vector<std::unique_ptr<Recorder>> recorders;
+    for (size_t i = 0; SUCCEEDED(hr) && i < outputOptions.size(); ++i)
+    {
+        // Initialize each recorder (finds its monitor, creates a D3D device, sets up duplication)
+        recorders.emplace_back(new Recorder(outputOptions[i], startup));
+        hr = recorders.back()->Initialize();
+    }
+
+    if (FAILED(hr))
+    {
+        Log::Logger::Instance().Flush();
+        if (!options.headless)
+        {
+            MessageBox(nullptr, L"Failed to initialize DXGI for screen capture.", L"Error", MB_OK | MB_ICONERROR);
+        }
+    }
+    else
+    {
+        // If initialization succeeded, start the recording process.
+        LOG_INFO("--- Starting Capture ---");
+        if (recorders.size() == 1)
+        {
+            hr = recorders[0]->Record();
+        }
+        else
+        {
+            FrameClock clock(options.fps, (uint32_t)recorders.size());
+            std::vector<HRESULT> results(recorders.size(), S_OK);
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < recorders.size(); ++i)
+            {
+                threads.emplace_back([&, i]()
+                {
+                    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+                    results[i] = recorders[i]->Record(&clock);
+                    CoUninitialize();
+                });
+            }
+            for (size_t i = 0; i < threads.size(); ++i)
+            {
+                threads[i].join();
+                if (FAILED(results[i]))
+                {
+                    LOG_ERROR("Recording {} failed", outputOptions[i].outputPath);
+                    hr = results[i];
+                }
+            }
+        }
+        Log::Logger::Instance().Flush();
+        if (options.headless)
+        {
+            // Nobody to tell; the exit code says how it went.
+        }
+        else if (SUCCEEDED(hr))
+        {
+            std::string files;
+            for (const RecorderOptions& output : outputOptions)
+            {
+                files += (files.empty() ? "" : ", ") + output.outputPath;
+            }
+            const std::string message = "Successfully recorded " + std::to_string(options.durationSeconds) +
+                " seconds of video to " + files + "!";
+            MessageBoxA(nullptr, message.c_str(), "Success", MB_OK);
+        }
+        else
+        {
+            MessageBox(nullptr, L"Failed to record video.", L"Capture Error", MB_OK | MB_ICONERROR);
+        }
+    }
+
+    // The Recorders' destructors will automatically be called here, cleaning up their resources.
+    recorders.clear();
+
+    // Shut down Media Foundation and COM.
+    MFShutdown();
+    CoUninitialize();
+    LOG_INFO("--- Application Exiting ---");
+    Log::Logger::Instance().Stop();
+    return (options.headless && FAILED(hr)) ? 1 : 0;
+}
+
+
+//======================================================================================
+// Recorder Class Method Implementations
+//======================================================================================
+
+//--------------------------------------------------------------------------------------
+// [Recorder::Initialize]
+// Sets up the D3D11 device and Desktop Duplication API for the selected monitor (the
+// one recorded last time, or else the first attached one that works, unless
+// --outputs picked one), or the synthetic or replay source if one was asked for.
+//--------------------------------------------------------------------------------------
+HRESULT Recorder::Initialize()
+{
+    m_startup.Mark("setup");
+    if (m_options.sourceType != CaptureSourceType::Desktop)
+    {
+        const HRESULT hr = CreateOffscreenSource();
+        m_startup.Mark("open_source");
+        return hr;
+    }
+
+    const bool selected = !m_options.outputIndices.empty();
+    const bool cached = !selected && m_options.useOutputCache && !m_options.outputCachePath.empty();
+    if (cached && SUCCEEDED(OpenCachedOutput()))
+    {
+        return S_OK;
+    }
+
+    std::vector<DesktopOutput> outputs;
+    HRESULT hr = EnumerateDesktopOutputs(outputs);
+    m_startup.Mark("enumerate");
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    if (m_options.canvas)
+    {
+        return OpenDesktopCanvas(outputs);
+    }
+
+    if (selected && m_options.outputIndices[0] >= outputs.size())
+    {
+        LOG_ERROR("There is no output {}; {} are attached to the desktop.", m_options.outputIndices[0], outputs.size());
+        return E_INVALIDARG;
+    }
+
+    // Without a selection, try each attached monitor until one can be duplicated.
+    // Monitors on the same adapter are tried with the same device.
+    AdapterDevice device;
+    hr = E_FAIL;
+    for (size_t i = selected ? m_options.outputIndices[0] : 0; i < outputs.size(); ++i)
+    {
+        hr = device.Open(outputs[i].adapterIndex);
+        if (hr == S_OK)
+        {
+            m_startup.Mark("device");
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = OpenDesktopSource(outputs[i], (uint32_t)i, device, m_pSource);
+            m_startup.Mark("duplicate");
+        }
+        if (SUCCEEDED(hr))
+        {
+            const RECT& rect = outputs[i].desktopCoordinates;
+            LOG_INFO("Successfully created duplication for output {} ({}x{} at {},{})", i, rect.right - rect.left,
+                     rect.bottom - rect.top, rect.left, rect.top);
+            if (cached && !OutputCache::Save(m_options.outputCachePath, ToCachedOutput(outputs[i], (uint32_t)i)))
+            {
+                LOG_WARN("Could not write the output cache {}", m_options.outputCachePath);
+            }
+            m_startup.Mark("save_cache");
+            return S_OK;
+        }
+        if (selected)
+        {
+            break;
+        }
+    }
+
+    // If we get here, we never found a suitable monitor.
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [Recorder::OpenCachedOutput]
+// Duplicates the monitor recorded last time (OutputCache.h) without enumerating the
+// others, if it is still attached with the same position and size. Fails quietly
+// otherwise, and Initialize looks at every monitor instead.
+//--------------------------------------------------------------------------------------
+HRESULT Recorder::OpenCachedOutput()
+{
+    CachedOutput cached;
+    if (!OutputCache::Load(m_options.outputCachePath, cached))
+    {
+        m_startup.Mark("read_cache");
+        return E_FAIL; // The first run, or the cache was removed.
+    }
+
+    DesktopOutput output;
+    HRESULT hr = FindDesktopOutput(cached.adapterLuid, cached.outputIndex, output);
+    m_startup.Mark("find_output");
+    if (SUCCEEDED(hr) && ToCachedOutput(output, cached.number) != cached)
+    {
+        hr = DXGI_ERROR_NOT_FOUND; // Moved or resized; its number may have changed too.
+    }
+    AdapterDevice device;
+    if (SUCCEEDED(hr))
+    {
+        hr = device.Open(output.adapterIndex);
+        m_startup.Mark("device");
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = OpenDesktopSource(output, cached.number, device, m_pSource);
+        m_startup.Mark("duplicate");
+    }
+    if (FAILED(hr))
+    {
+        LOG_INFO("The output recorded last time is not available (0x{:x}); looking at all of them.", hr);
+        return hr;
+    }
+    LOG_INFO("Successfully created duplication for output {} ({}x{} at {},{}), as last time", cached.number,
+             cached.right - cached.left, cached.bottom - cached.top, cached.left, cached.top);
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// [Recorder::CreateOffscreenSource]
+// The synthetic desktop and trace replay need no monitor, but the encoders still
+// want a D3D11 device. Use the default adapter, or WARP where there is no GPU at all
+// (VMs, CI).
+//--------------------------------------------------------------------------------------
+HRESULT Recorder::CreateOffscreenSource()
+{
+    HRESULT hr = D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, D3D11_CREATE_DEVICE_VIDEO_SUPPORT, NULL, 0,
+                                   D3D11_SDK_VERSION, &m_pDevice, NULL, &m_pContext);
+    if (FAILED(hr))
+    {
+        hr = D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_WARP, NULL, 0, NULL, 0, D3D11_SDK_VERSION, &m_pDevice, NULL,
+                               &m_pContext);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        LOG_INFO("No hardware D3D11 device; using WARP.");
+    }
+
+    if (m_options.sourceType == CaptureSourceType::Replay)
+    {
+        std::unique_ptr<ReplaySource> pReplay(new ReplaySource());
+        std::string error;
+        if (!pReplay->Open(m_options.replayPath, m_options.replay, error))
+        {
+            LOG_ERROR("{}", error);
+            return E_FAIL;
+        }
+        if (pReplay->Recovered())
+        {
+            LOG_WARN("{} was not closed properly; replaying the frames that were written.", m_options.replayPath);
+        }
+        LOG_INFO("Replaying {} ({}x{}) at {}x speed.", m_options.replayPath, pReplay->Width(), pReplay->Height(),
+                 m_options.replay.speed);
+        m_pSource = std::move(pReplay);
+        return S_OK;
+    }
+
+    if (m_options.canvas)
+    {
+        // Independent synthetic desktops side by side, as --outputs numbers them.
+        std::vector<CanvasSource::Monitor> monitors;
+        int32_t left = 0;
+        for (uint32_t index : m_options.outputIndices)
+        {
+            SyntheticSource::Options synthetic = m_options.synthetic;
+            synthetic.seed += index;
+            CanvasSource::Monitor monitor;
+            monitor.pSource.reset(new SyntheticSource(synthetic));
+            monitor.left = left;
+            left += static_cast<int32_t>(synthetic.width);
+            monitors.push_back(std::move(monitor));
+        }
+        return OpenCanvas(std::move(monitors));
+    }
+
+    m_pSource.reset(new SyntheticSource(m_options.synthetic));
+    LOG_INFO("Capturing a synthetic {} desktop at {}x{} ({}).", SyntheticSource::ScenarioName(m_options.synthetic.scenario),
+             m_pSource->Width(), m_pSource->Height(), m_options.synthetic.realTime ? "real time" : "virtual time");
+    if (m_options.synthetic.frameMarkers)
+    {
+        if (FrameMarker::Place(m_pSource->Width(), m_pSource->Height()).cellSize == 0)
+        {
+            LOG_WARN("The synthetic desktop is too small to carry frame markers.");
+        }
+        else
+        {
+            LOG_INFO("Stamping a frame marker into every refresh; read them back with latency_probe verify.");
+        }
+    }
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// [Recorder::OpenDesktopSource]
+// Duplicates one monitor behind a RecoveringSource, so losing the duplication (mode
+// changes, UAC prompts, the lock screen) doesn't end the recording: the monitor is
+// looked up again by adapter and output number and duplicated on a new device. The
+// first monitor opened also provides the encoders' device, 'device' (on the
+// monitor's adapter).
+//--------------------------------------------------------------------------------------
+HRESULT Recorder::OpenDesktopSource(const DesktopOutput& output, uint32_t index, const AdapterDevice& device,
+                                    std::unique_ptr<CaptureSource>& pSource)
+{
+    IDXGIOutputDuplication* pDuplication = nullptr;
+    HRESULT hr = DuplicateDesktopOutput(output, device.Device(), &pDuplication);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    // The factory hands out the duplication opened here first, then opens new ones.
+    std::shared_ptr<std::unique_ptr<CaptureSource>> pFirst(
+        new std::unique_ptr<CaptureSource>(new DxgiCaptureSource(device.Device(), device.Context(), pDuplication)));
+    if (!m_pDevice)
+    {
+        m_pDevice = device.Device();
+        m_pContext = device.Context();
+        m_pDevice->AddRef();
+        m_pContext->AddRef();
+    }
+    SafeRelease(&pDuplication);
+
+    const UINT adapterIndex = output.adapterIndex;
+    const UINT outputIndex = output.outputIndex;
+    RecoveringSource::Factory factory = [pFirst, adapterIndex, outputIndex](std::string& error) -> std::unique_ptr<CaptureSource>
+    {
+        if (*pFirst)
+        {
+            return std::move(*pFirst);
+        }
+        std::vector<DesktopOutput> outputs;
+        HRESULT hr = EnumerateDesktopOutputs(outputs);
+        bool attached = false;
+        for (size_t i = 0; SUCCEEDED(hr) && i < outputs.size(); ++i)
+        {
+            if (outputs[i].adapterIndex != adapterIndex || outputs[i].outputIndex != outputIndex)
+            {
+                continue;
+            }
+            attached = true;
+            ID3D11Device* pNewDevice = nullptr;
+            ID3D11DeviceContext* pNewContext = nullptr;
+            IDXGIOutputDuplication* pNewDuplication = nullptr;
+            hr = OpenDesktopOutput(outputs[i], &pNewDevice, &pNewContext, &pNewDuplication);
+            std::unique_ptr<CaptureSource> pNew;
+            if (SUCCEEDED(hr))
+            {
+                pNew.reset(new DxgiCaptureSource(pNewDevice, pNewContext, pNewDuplication));
+            }
+            SafeRelease(&pNewDuplication);
+            SafeRelease(&pNewContext);
+            SafeRelease(&pNewDevice);
+            if (pNew)
+            {
+                return pNew;
+            }
+        }
+        error = "output " + std::to_string(outputIndex) + " of adapter " + std::to_string(adapterIndex) +
+                (attached ? " could not be duplicated" : " is not attached");
+        return std::unique_ptr<CaptureSource>();
+    };
+
+    RecoveringSource::Options options;
+    options.fps = m_options.fps;
+    options.giveUpMs = m_options.recoveryTimeoutSeconds * 1000;
+    std::unique_ptr<RecoveringSource> pRecovering(new RecoveringSource());
+    RecoveringSource* pRaw = pRecovering.get();
+    std::string error;
+    if (!pRecovering->Open(factory, options,
+                           [this, pRaw, index](RecoveryEvent event) { OnRecoveryEvent(*pRaw, index, event); }, error))
+    {
+        LOG_ERROR("{}", error);
+        return E_FAIL;
+    }
+    pSource = std::move(pRecovering);
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// [Recorder::OnRecoveryEvent]
+// Runs on the capture thread, inside AcquireFrame.
+//--------------------------------------------------------------------------------------
+void Recorder::OnRecoveryEvent(const RecoveringSource& source, uint32_t index, RecoveryEvent event)
+{
+    switch (event)
+    {
+    case RecoveryEvent::Lost:
+        m_pHealth->Add(HealthCounter::SourceLosses);
+        LOG_WARN("Lost output {}; holding its last frame until it is back.", index);
+        break;
+    case RecoveryEvent::Held:
+        m_pHealth->Add(HealthCounter::FramesHeld);
+        break;
+    case RecoveryEvent::Recovered:
+        m_pHealth->Add(HealthCounter::SourceRecoveries);
+        if (source.SourceWidth() != source.Width() || source.SourceHeight() != source.Height())
+        {
+            LOG_WARN("Output {} is back at {}x{}; scaling it to {}x{}.", index, source.SourceWidth(), source.SourceHeight(),
+                     source.Width(), source.Height());
+        }
+        else
+        {
+            LOG_INFO("Output {} is back.", index);
+        }
+        break;
+    case RecoveryEvent::GaveUp:
+        LOG_ERROR("Output {} did not come back within {} seconds: {}", index, m_options.recoveryTimeoutSeconds,
+                  source.LastError());
+        break;
+    default:
+        break;
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// [Recorder::OpenDesktopCanvas]
+// --canvas: duplicates every selected monitor with a device on its adapter (shared
+// by monitors listed one after another on the same adapter) and records them as
+// one picture. The encoders use the first monitor's device.
+//--------------------------------------------------------------------------------------
+HRESULT Recorder::OpenDesktopCanvas(const std::vector<DesktopOutput>& outputs)
+{
+    std::vector<CanvasSource::Monitor> monitors;
+    AdapterDevice device;
+    for (uint32_t index : m_options.outputIndices)
+    {
+        if (index >= outputs.size())
+        {
+            LOG_ERROR("There is no output {}; {} are attached to the desktop.", index, outputs.size());
+            return E_INVALIDARG;
+        }
+        CanvasSource::Monitor monitor;
+        HRESULT hr = device.Open(outputs[index].adapterIndex);
+        if (hr == S_OK)
+        {
+            m_startup.Mark("device");
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = OpenDesktopSource(outputs[index], index, device, monitor.pSource);
+            m_startup.Mark("duplicate");
+        }
+        if (FAILED(hr))
+        {
+            LOG_ERROR("Could not duplicate output {}. HRESULT: 0x{:x}", index, hr);
+            return hr;
+        }
+        monitor.left = outputs[index].desktopCoordinates.left;
+        monitor.top = outputs[index].desktopCoordinates.top;
+        monitors.push_back(std::move(monitor));
+        const RECT& rect = outputs[index].desktopCoordinates;
+        LOG_INFO("Successfully created duplication for output {} ({}x{} at {},{})", index, rect.right - rect.left,
+                 rect.bottom - rect.top, rect.left, rect.top);
+    }
+    return OpenCanvas(std::move(monitors));
+}
+
+//--------------------------------------------------------------------------------------
+// [Recorder::OpenCanvas]
+// Lays the monitors out on one canvas and makes it the capture source.
+//--------------------------------------------------------------------------------------
+HRESULT Recorder::OpenCanvas(std::vector<CanvasSource::Monitor> monitors)
+{
+    // A few helpers are enough to keep up with a full redraw of every monitor.
+    const uint32_t cores = std::thread::hardware_concurrency();
+    const uint32_t threads = cores == 0 ? 1 : (cores < 4 ? cores : 4);
+    const size_t count = monitors.size();
+    std::unique_ptr<CanvasSource> pCanvas(new CanvasSource());
+    if (!pCanvas->Open(std::move(monitors), threads))
+    {
+        LOG_ERROR("The outputs don't fit on one canvas of at most {}x{}.", CanvasCompositor::MaxDimension,
+                  CanvasCompositor::MaxDimension);
+        return E_INVALIDARG;
+    }
+    LOG_INFO("Recording {} outputs as one {}x{} canvas.", count, pCanvas->Width(), pCanvas->Height());
+    if (pCanvas->Width() > 4096 || pCanvas->Height() > 4096)
+    {
+        LOG_WARN("Many H.264 encoders stop at 4096 pixels a side; the encoder may refuse a {}x{} canvas.",
+                 pCanvas->Width(), pCanvas->Height());
+    }
+    m_pSource = std::move(pCanvas);
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// [Recorder::CreateSinkWriter]
+// Creates the Media Foundation Sink Writer for the MP4 output: a hardware-assisted
+// H.264 encoder fed with RGB32 frames, with keyframe control where the encoder
+// supports it. The container is written to pStream, i.e. through our own I/O layer.
+// On success the caller owns *ppSinkWriter and, if set, *ppCodecApi.
+//--------------------------------------------------------------------------------------
+HRESULT Recorder::CreateSinkWriter(UINT32 width, UINT32 height, WriterStream* pStream, IMFSinkWriter** ppSinkWriter, DWORD* pStreamIndex, ICodecAPI** ppCodecApi)
+{
+    HRESULT hr = S_OK;
+    IMFSinkWriter* pSinkWriter = nullptr;
+    IMFDXGIDeviceManager* pDeviceManager = nullptr;
+    IMFAttributes* pAttributes = nullptr;
+    IMFByteStream* pByteStream = nullptr;
+    *ppSinkWriter = nullptr;
+    *ppCodecApi = nullptr;
+
+    do
+    {
+        const UINT32 VIDEO_FPS = m_options.fps;
+        const UINT32 VIDEO_BIT_RATE = m_options.bitRate;
+
+        // 1. Create the DXGI Device Manager. This is the crucial link that allows the
+        //    Sink Writer's internal components (like the color converter) to use our GPU.
+        UINT resetToken;
+        hr = MFCreateDXGIDeviceManager(&resetToken, &pDeviceManager);
+        if (FAILED(hr)) break;
+        hr = pDeviceManager->ResetDevice(m_pDevice, resetToken);
+        if (FAILED(hr)) break;
+
+        // Create an attribute store to hold the device manager pointer.
+        hr = MFCreateAttributes(&pAttributes, 1);
+        if (FAILED(hr)) break;
+        hr = pAttributes->SetUnknown(MF_SINK_WRITER_D3D_MANAGER, pDeviceManager);
+        if (FAILED(hr)) break;
+
+        // 2. Create the Sink Writer, passing in the hardware attributes. The URL is
+        //    only used to pick the container from its extension; the bytes go to
+        //    our stream.
+        LOG_INFO("Configuring Sink Writer for {}x{} @ {} FPS", width, height, VIDEO_FPS);
+        hr = MFCreateMFByteStreamOnStream(pStream, &pByteStream);
+        if (FAILED(hr)) break;
+        hr = MFCreateSinkWriterFromURL(Utf8ToWide(m_options.outputPath).c_str(), pByteStream, pAttributes, &pSinkWriter);
+        if (FAILED(hr)) break;
+
+        // 3. Configure the Output Stream (what we want the final file to look like)
+        DWORD streamIndex;
+        IMFMediaType* pMediaTypeOut = nullptr;
+        hr = MFCreateMediaType(&pMediaTypeOut);
+        if (SUCCEEDED(hr))
+        {
+            hr = pMediaTypeOut->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+            if (SUCCEEDED(hr)) hr = pMediaTypeOut->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264); // H.264 video
+            if (SUCCEEDED(hr)) hr = pMediaTypeOut->SetUINT32(MF_MT_AVG_BITRATE, VIDEO_BIT_RATE);
+            if (SUCCEEDED(hr)) hr = MFSetAttributeRatio(pMediaTypeOut, MF_MT_FRAME_RATE, VIDEO_FPS, 1);
+            if (SUCCEEDED(hr)) hr = MFSetAttributeSize(pMediaTypeOut, MF_MT_FRAME_SIZE, width, height);
+            if (SUCCEEDED(hr)) hr = pMediaTypeOut->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+            if (SUCCEEDED(hr)) hr = pSinkWriter->AddStream(pMediaTypeOut, &streamIndex);
+        }
+        SafeRelease(&pMediaTypeOut);
+        if (FAILED(hr)) break;
+
+        // 4. Configure the Input Stream (what we will be feeding the writer)
+        IMFMediaType* pMediaTypeIn = nullptr;
+        hr = MFCreateMediaType(&pMediaTypeIn);
+        if (SUCCEEDED(hr))
+        {
+            hr = pMediaTypeIn->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+            if (SUCCEEDED(hr)) hr = pMediaTypeIn->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32); // Uncompressed 32-bit RGB from our capture
+            if (SUCCEEDED(hr)) hr = MFSetAttributeRatio(pMediaTypeIn, MF_MT_FRAME_RATE, VIDEO_FPS, 1);
+            if (SUCCEEDED(hr)) hr = MFSetAttributeSize(pMediaTypeIn, MF_MT_FRAME_SIZE, width, height);
+            if (SUCCEEDED(hr)) hr = pMediaTypeIn->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+            if (SUCCEEDED(hr)) hr = pSinkWriter->SetInputMediaType(streamIndex, pMediaTypeIn, nullptr);
+        }
+        SafeRelease(&pMediaTypeIn);
+        if (FAILED(hr)) break;
+
+        // 5. Configure keyframe placement on the encoder. The encoder only exists once
+        //    both media types are set, and must be configured before BeginWriting.
+        //    Not every encoder exposes ICodecAPI, so failures here are not fatal; we
+        //    just lose forced keyframes and fall back to the encoder's own GOP.
+        ICodecAPI* pCodecApi = nullptr;
+        if (SUCCEEDED(pSinkWriter->GetServiceForStream(streamIndex, GUID_NULL, IID_PPV_ARGS(&pCodecApi))))
+        {
+            VARIANT var;
+            VariantInit(&var);
+            var.vt = VT_UI4;
+            var.ulVal = m_options.EffectiveGopLength();
+            if (FAILED(pCodecApi->SetValue(&CODECAPI_AVEncMPVGOPSize, &var)))
+            {
+                LOG_WARN("Encoder rejected GOP length {}.", var.ulVal);
+            }
+            if (pCodecApi->IsSupported(&CODECAPI_AVEncVideoForceKeyFrame) != S_OK)
+            {
+                LOG_WARN("Encoder does not support forced keyframes.");
+                SafeRelease(&pCodecApi);
+            }
+        }
+        else
+        {
+            LOG_WARN("Encoder does not expose ICodecAPI; keyframe control is disabled.");
+        }
+
+        // 6. Start the encoding session.
+        hr = pSinkWriter->BeginWriting();
+        if (FAILED(hr))
+        {
+            SafeRelease(&pCodecApi);
+            break;
+        }
+
+        *ppSinkWriter = pSinkWriter;
+        *pStreamIndex = streamIndex;
+        *ppCodecApi = pCodecApi;
+        pSinkWriter = nullptr; // Ownership moved to the caller.
+
+    } while (false);
+
+    SafeRelease(&pSinkWriter);
+    SafeRelease(&pByteStream);
+    SafeRelease(&pDeviceManager);
+    SafeRelease(&pAttributes);
+    return hr;
+}
+
+//--------------------------------------------------------------------------------------
+// [Recorder::Record]
+// Configures the selected output and runs the main capture loop.
+//--------------------------------------------------------------------------------------
+HRESULT Recorder::Record(FrameClock* pClock, StartGate* pGate)
+{
+    Trace::SetThreadName("capture");
+    if (!m_options.tracePath.empty())
+    {
+        Trace::Tracer::Instance().Enable(true);
+    }
+
+    HRESULT hr = S_OK;
+    IMFSinkWriter* pSinkWriter = nullptr;
+    ICodecAPI* pCodecApi = nullptr;
+    WriterStream* pStream = nullptr;
+    DWORD streamIndex = 0;
+    RawFrameSink rawSink;
+    bool rawSinkOpen = false;
+    KeyframeIndexWriter keyframeIndex;
+
+    // Our own encode + mux path (--sink ts/mkv and/or --stream). The encoder's
+    // output goes through 'outputs' to the file muxer and the live stream.
+    MFH264Encoder encoder;
+    FileWriter muxFile;
+    FileByteSink muxOutput(muxFile);
+    TsMuxer tsMuxer;
+    MkvMuxer mkvMuxer;
+    EncodedSink* pFileMuxer = (m_options.sink == OutputSink::Mkv) ? static_cast<EncodedSink*>(&mkvMuxer) : &tsMuxer;
+    KeyframeIndexingSink indexingSink(pFileMuxer, &muxOutput, &keyframeIndex);
+    StreamingSink streamSink;
+    TeeSink muxers;
+    TimedSink outputs(&muxers, m_stats);
+    bool encoding = false;
+    bool streaming = false;
+    bool clockJoined = false;
+
+    // The write-behind and stream queues keep their own high-water marks; copy them
+    // into the health counters when reporting.
+    auto sampleQueueDepths = [&]()
+    {
+        if (pStream)
+        {
+            m_pHealth->RaiseMax(HealthCounter::FileQueueMax, pStream->GetStats().queueDepthMax);
+        }
+        m_pHealth->RaiseMax(HealthCounter::FileQueueMax, muxFile.GetStats().queueDepthMax); // Zeros if unused.
+        if (rawSinkOpen)
+        {
+            m_pHealth->RaiseMax(HealthCounter::FileQueueMax, rawSink.GetIoStats().queueDepthMax);
+        }
+        if (streaming)
+        {
+            m_pHealth->RaiseMax(HealthCounter::StreamQueueBytesMax, streamSink.GetStats().queueBytesMax);
+        }
+    };
+
+    // Monitoring must not be able to stop a recording, so a failure here is only
+    // reported.
+    MetricsExporter metrics;
+    if (m_options.metrics.httpPort || !m_options.metrics.filePath.empty())
+    {
+        std::string error;
+        if (!metrics.Start(m_options.metrics, [this](std::string& text) { FormatMetrics(text); }, error))
+        {
+            LOG_WARN("{}", error);
+        }
+    }
+
+    // This do-while(false) loop is a C++-friendly replacement for goto statements.
+    // If any step fails, we can 'break' to the cleanup section at the end.
+    do
+    {
+        // --- Define Video Parameters ---
+        const UINT32 VIDEO_FPS = m_options.fps;
+        const UINT64 VIDEO_FRAME_DURATION = 10 * 1000 * 1000 / VIDEO_FPS;
+        LONGLONG rtStart = 0; // Running timestamp
+
+        // Get the screen dimensions from the capture source
+        const UINT32 VIDEO_WIDTH = m_pSource->Width();
+        const UINT32 VIDEO_HEIGHT = m_pSource->Height();
+
+        if (!m_options.captureTracePath.empty() &&
+            !m_captureTrace.Open(m_options.captureTracePath, VIDEO_WIDTH, VIDEO_HEIGHT))
+        {
+            LOG_WARN("Could not create capture trace {}", m_options.captureTracePath);
+        }
+
+        // --- Configure the Output ---
+        if (m_options.sink == OutputSink::Mp4)
+        {
+            hr = WriterStream::Create(m_options.outputPath, m_options.io, &pStream);
+            if (FAILED(hr)) break;
+            hr = CreateSinkWriter(VIDEO_WIDTH, VIDEO_HEIGHT, pStream, &pSinkWriter, &streamIndex, &pCodecApi);
+            if (FAILED(hr)) break;
+
+            if (m_options.writeKeyframeIndex && !keyframeIndex.Open(m_options.outputPath + ".kfidx", 10 * 1000 * 1000))
+            {
+                LOG_WARN("Could not create keyframe index for {}", m_options.outputPath);
+            }
+            LOG_INFO("Sink Writer configured. Starting capture loop...");
+        }
+        else if (m_options.UsesDirectEncoder())
+        {
+            // Encode with the H.264 MFT and mux the access units ourselves.
+            const bool writeFile = (m_options.sink == OutputSink::Ts || m_options.sink == OutputSink::Mkv);
+            if (writeFile && !muxFile.Open(m_options.outputPath, m_options.io))
+            {
+                LOG_ERROR("Could not create {}", m_options.outputPath);
+                hr = E_FAIL;
+                break;
+            }
+            hr = encoder.Initialize(VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_FPS, m_options.bitRate, m_options.EffectiveGopLength());
+            if (FAILED(hr)) break;
+            encoding = true;
+
+            std::vector<BYTE> sequenceHeader;
+            encoder.GetSequenceHeader(sequenceHeader);
+
+            if (writeFile)
+            {
+                if (m_options.sink == OutputSink::Mkv)
+                {
+                    mkvMuxer.Open(&muxOutput, VIDEO_WIDTH, VIDEO_HEIGHT);
+                    if (!sequenceHeader.empty())
+                    {
+                        mkvMuxer.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+                    }
+                }
+                else
+                {
+                    tsMuxer.Open(&muxOutput);
+                    if (!sequenceHeader.empty())
+                    {
+                        tsMuxer.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+                    }
+                }
+                muxers.Add(&indexingSink);
+
+                // Unlike the MP4 sink, we know exactly where each keyframe lands.
+                if (m_options.writeKeyframeIndex && !keyframeIndex.Open(m_options.outputPath + ".kfidx", 10 * 1000 * 1000))
+                {
+                    LOG_WARN("Could not create keyframe index for {}", m_options.outputPath);
+                }
+            }
+
+            if (!m_options.streamTarget.empty())
+            {
+                // A reader that connects (or resyncs after a drop) needs an IDR to start
+                // decoding, so the stream may ask for one at any time.
+                std::string error;
+                if (!streamSink.Start(m_options.streamTarget, m_options.streamFormat, m_options.streamPolicy,
+                                      m_options.streamQueueBytes, [this]() { RequestKeyframe(); }, error))
+                {
+                    LOG_ERROR("{}", error);
+                    hr = E_FAIL;
+                    break;
+                }
+                if (!sequenceHeader.empty())
+                {
+                    streamSink.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+                }
+                muxers.Add(&streamSink);
+                streaming = true;
+                LOG_INFO("Streaming to {}", m_options.streamTarget);
+            }
+
+            if (m_options.qualitySampleInterval)
+            {
+                // Like the metrics, a missing decoder only costs the measurement.
+                std::string error;
+                if (!sequenceHeader.empty())
+                {
+                    m_quality.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+                }
+                if (m_quality.Start(VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_FPS, m_options.qualitySampleInterval, error))
+                {
+                    muxers.Add(&m_quality);
+                    LOG_INFO("Measuring quality on every {}th frame", m_options.qualitySampleInterval);
+                }
+                else
+                {
+                    LOG_WARN("{}", error);
+                }
+            }
+
+            if (m_options.replaySeconds)
+            {
+                if (!sequenceHeader.empty())
+                {
+                    m_replay.SetSequenceHeader(sequenceHeader.data(), sequenceHeader.size());
+                }
+                m_replay.Start(m_options.replaySeconds);
+                muxers.Add(&m_replay);
+                LOG_INFO("Keeping the last {} seconds for save-replay", m_options.replaySeconds);
+            }
+            LOG_INFO("H.264 encoder configured for {}x{}. Starting capture loop...", VIDEO_WIDTH, VIDEO_HEIGHT);
+        }
+        else
+        {
+            // Raw frames skip the encoder entirely; every frame is a "keyframe", so
+            // there is no index either.
+            const RawContainer container = (m_options.sink == OutputSink::Y4M) ? RawContainer::Y4M : RawContainer::Raw;
+            std::string error;
+            if (!rawSink.Open(m_options.outputPath, container, m_options.rawPixelFormat, VIDEO_WIDTH, VIDEO_HEIGHT,
+                              VIDEO_FPS, 1, m_options.io, error))
+            {
+                LOG_ERROR("{}", error);
+                hr = E_FAIL;
+                break;
+            }
+            rawSinkOpen = true;
+            LOG_INFO("Raw frame sink configured for {}x{}. Starting capture loop...", VIDEO_WIDTH, VIDEO_HEIGHT);
+        }
+
+        if (m_options.cursorTrack && !m_cursorTrack.Open(m_options.outputPath + ".cursor", 10 * 1000 * 1000))
+        {
+            LOG_WARN("Could not create cursor track for {}", m_options.outputPath);
+        }
+
+        m_startup.Mark("encoder");
+
+        // --- Main Capture Loop ---
+        const UINT32 totalFrames = m_options.FramesToRecord();
+        const UINT64 statsIntervalFrames = (UINT64)VIDEO_FPS * m_options.statsIntervalSeconds;
+        UINT64 framesWritten = 0;
+
+        // Following a clock, 'i' is the clock's slot and a frame that doesn't arrive
+        // within its slot is skipped, leaving a gap in the timestamps.
+        UINT acquireTimeoutMs = 1000;
+        if (pGate)
+        {
+            // Do now what the first frame would otherwise allocate, then wait for the
+            // start command with nothing left to set up.
+            if (!m_pSource->Prepare())
+            {
+                LOG_WARN("Could not prepare the capture source; the first frame will set it up.");
+            }
+            if (m_keyframes.SceneDetectionEnabled())
+            {
+                m_prevFrame.assign((size_t)VIDEO_WIDTH * 4 * VIDEO_HEIGHT, 0);
+            }
+            m_startup.Mark("prepare");
+            LOG_INFO("Ready to record {}; waiting for the start command.", m_options.outputPath);
+            if (!pGate->WaitForStart())
+            {
+                hr = E_ABORT;
+                break;
+            }
+            m_startup.Mark("wait_for_start");
+        }
+        if (pClock)
+        {
+            pClock->WaitForStart();
+            m_startup.Mark("wait_for_outputs");
+            clockJoined = true;
+            acquireTimeoutMs = (1000 + VIDEO_FPS - 1) / VIDEO_FPS;
+        }
+        for (UINT32 i = 0; i < totalFrames; ++i)
+        {
+            if (pGate && pGate->StopRequested())
+            {
+                break;
+            }
+            if (pClock)
+            {
+                const uint64_t slot = pClock->WaitForSlot(i);
+                if (slot >= totalFrames)
+                {
+                    break;
+                }
+                if (slot > i)
+                {
+                    m_pHealth->Add(HealthCounter::FramesDropped, slot - i);
+                    i = (UINT32)slot;
+                }
+                rtStart = pClock->SlotTime(i);
+            }
+
+            // Everything this iteration does is traced as part of frame 'framesWritten'.
+            Trace::SetFrame(framesWritten);
+            Trace::Scope frameScope("frame");
+
+            IMFSample* pSample = nullptr;
+            double changedFraction = 0.0;
+            hr = GrabFrameAndCreateSample(acquireTimeoutMs, &pSample, &changedFraction,
+                                          rawSinkOpen ? &rawSink : nullptr, rtStart);
+
+            if (hr == S_FALSE) {
+                // S_FALSE is our custom signal for a non-fatal timeout.
+                LOG_DEBUG("Skipping frame {} due to timeout.", i);
+                m_pHealth->Add(HealthCounter::FramesDropped);
+                hr = S_OK; // Reset HR so we don't treat it as a failure
+                continue;
+            }
+            if (hr == MF_E_END_OF_STREAM) {
+                // A replayed trace ran out before the requested duration.
+                LOG_INFO("The capture source has no more frames. Stopping after {} frames.", framesWritten);
+                hr = S_OK;
+                break;
+            }
+            if (FAILED(hr)) {
+                LOG_ERROR("Failed to grab frame. Exiting loop.");
+                break; // A real error occurred, exit the loop.
+            }
+
+            if (pSinkWriter)
+            {
+                // Set the timestamp and duration for the frame.
+                hr = pSample->SetSampleTime(rtStart);
+                if (FAILED(hr)) { SafeRelease(&pSample); break; }
+                hr = pSample->SetSampleDuration(VIDEO_FRAME_DURATION);
+                if (FAILED(hr)) { SafeRelease(&pSample); break; }
+
+                // Decide whether this frame starts a new GOP. The first frame is always an
+                // IDR, so only later keyframes need to be forced on the encoder.
+                const KeyframeReason keyframeReason = m_keyframes.Decide(changedFraction);
+                if (keyframeReason != KeyframeReason::None)
+                {
+                    CountKeyframe(keyframeReason);
+                    if (keyframeReason != KeyframeReason::First && pCodecApi)
+                    {
+                        VARIANT var;
+                        VariantInit(&var);
+                        var.vt = VT_UI4;
+                        var.ulVal = 1;
+                        pCodecApi->SetValue(&CODECAPI_AVEncVideoForceKeyFrame, &var);
+                    }
+                    // The MP4 sink does not expose where samples land in the file, so the
+                    // index records timestamps only.
+                    keyframeIndex.Append(framesWritten, rtStart, KeyframeIndexWriter::UnknownOffset, keyframeReason);
+                }
+
+                // Write the frame to the video file.
+                StageTimer submitTimer(m_stats, PipelineStage::EncodeSubmit);
+                hr = pSinkWriter->WriteSample(streamIndex, pSample);
+                submitTimer.Stop();
+                if (FAILED(hr)) { m_pHealth->Add(HealthCounter::EncodeErrors); SafeRelease(&pSample); break; }
+            }
+            else if (encoding)
+            {
+                // The sample holds a bottom-up RGB32 image; hand our encoder its last
+                // row with a negative stride so it is read top-down. (The raw sink was
+                // handed the frame while it was mapped.)
+                IMFMediaBuffer* pBuffer = nullptr;
+                BYTE* pData = nullptr;
+                hr = pSample->GetBufferByIndex(0, &pBuffer);
+                if (SUCCEEDED(hr)) hr = pBuffer->Lock(&pData, nullptr, nullptr);
+                if (SUCCEEDED(hr))
+                {
+                    const LONG stride = (LONG)VIDEO_WIDTH * 4;
+                    const BYTE* pTopRow = pData + (size_t)(VIDEO_HEIGHT - 1) * stride;
+                    const KeyframeReason keyframeReason = m_keyframes.Decide(changedFraction);
+                    if (keyframeReason != KeyframeReason::None)
+                    {
+                        CountKeyframe(keyframeReason);
+                        indexingSink.NoteKeyframeRequest(framesWritten, keyframeReason);
+                    }
+                    m_quality.SubmitSource(framesWritten, pTopRow, -stride);
+                    StageTimer submitTimer(m_stats, PipelineStage::EncodeSubmit);
+                    hr = encoder.Encode(pTopRow, -stride, rtStart, VIDEO_FRAME_DURATION,
+                                        keyframeReason != KeyframeReason::None && keyframeReason != KeyframeReason::First,
+                                        framesWritten, &outputs);
+                    submitTimer.Stop();
+                    if (FAILED(hr))
+                    {
+                        m_pHealth->Add(HealthCounter::EncodeErrors);
+                    }
+                    else
+                    {
+                        m_pHealth->RaiseMax(HealthCounter::EncoderQueueMax, framesWritten + 1 - outputs.FramesWritten());
+                    }
+                    pBuffer->Unlock();
+                }
+                SafeRelease(&pBuffer);
+                if (FAILED(hr)) { SafeRelease(&pSample); break; }
+            }
+
+            SafeRelease(&pSample);
+            m_cursorTrack.WriteFrame(framesWritten, rtStart);
+            rtStart += VIDEO_FRAME_DURATION; // Increment the timestamp for the next frame
+            ++framesWritten;
+            m_pHealth->Add(HealthCounter::FramesWritten);
+            if (framesWritten == 1)
+            {
+                m_startup.Mark("first_frame");
+                std::string phases;
+                m_startup.Format(phases);
+                LOG_INFO("First frame recorded {} ms after start (ms: {})", m_startup.TotalMs(), phases);
+
+                // From the start command, or for a one-off recording from launch.
+                const uint64_t firstFrameUs = pGate ? (TickClock::NowNs() - pGate->StartNs()) / 1000
+                                                    : (uint64_t)(m_startup.TotalMs() * 1000.0);
+                m_pHealth->RaiseMax(HealthCounter::TimeToFirstFrameUs, firstFrameUs);
+                if (pGate)
+                {
+                    LOG_INFO("First frame {} ms after the start command", firstFrameUs / 1000.0);
+                }
+            }
+
+            // Even queued log records add up at 60 fps, so only summarize every few
+            // seconds.
+            if (statsIntervalFrames && framesWritten % statsIntervalFrames == 0)
+            {
+                sampleQueueDepths();
+                const HealthCounters::Snapshot health = m_health.Read();
+                LOG_INFO("{} frames written", framesWritten);
+                LOG_INFO("Health: {} captured, {} repeated, {} coalesced, {} dropped, {} keyframes; queue max: encoder {}, file {}, stream {} bytes",
+                         health[HealthCounter::FramesCaptured], health[HealthCounter::FramesRepeated],
+                         health[HealthCounter::FramesCoalesced], health[HealthCounter::FramesDropped],
+                         health[HealthCounter::KeyframesScheduled] + health[HealthCounter::KeyframesSceneChange] +
+                             health[HealthCounter::KeyframesRequested],
+                         health[HealthCounter::EncoderQueueMax], health[HealthCounter::FileQueueMax],
+                         health[HealthCounter::StreamQueueBytesMax]);
+                m_stats.PrintToLog();
+            }
+        }
+        if (FAILED(hr)) break;
+
+        LOG_INFO("Capture loop finished after {} frames.", framesWritten);
+
+    } while (false);
+
+    // --- Finalize and Cleanup ---
+    if (pClock && !clockJoined)
+    {
+        // Failed during setup: don't keep the other outputs waiting for us.
+        pClock->Leave();
+    }
+    if (pSinkWriter)
+    {
+        LOG_INFO("Finalizing video file...");
+        HRESULT finalizeHr = pSinkWriter->Finalize();
+        // If the main loop succeeded but finalize failed, report the finalize error.
+        if (SUCCEEDED(hr) && FAILED(finalizeHr))
+        {
+            hr = finalizeHr;
+        }
+    }
+    if (pStream)
+    {
+        // The sink writer is done with the stream; drain the write-behind queue.
+        HRESULT closeHr = pStream->Close();
+        const FileWriter::Stats ioStats = pStream->GetStats();
+        if (SUCCEEDED(hr) && FAILED(closeHr))
+        {
+            hr = closeHr;
+        }
+        LOG_INFO("Wrote {} bytes in {} writes (slowest write {} us, capture thread waited {} times, max {} us)",
+                 ioStats.bytesWritten, ioStats.writeCalls, ioStats.writeNsMax / 1000,
+                 ioStats.producerWaits, ioStats.producerWaitNsMax / 1000);
+    }
+    if (encoding)
+    {
+        LOG_INFO("Draining encoder...");
+        HRESULT drainHr = encoder.Drain(&outputs);
+        if (!outputs.Finish() && SUCCEEDED(drainHr))
+        {
+            drainHr = E_FAIL;
+        }
+        if (SUCCEEDED(hr) && FAILED(drainHr))
+        {
+            hr = drainHr;
+        }
+
+        // Measures the last queued frames before returning.
+        m_quality.Stop();
+        const QualityMonitor::Stats quality = m_quality.GetStats();
+        if (quality.totals.frames)
+        {
+            LOG_INFO("Quality over {} sampled frames: PSNR mean {} dB, min {} dB; SSIM mean {}, min {}; worst 64x64 tile {} dB ({} samples skipped)",
+                     quality.totals.frames, quality.totals.PsnrMean(), quality.totals.psnrMin, quality.totals.SsimMean(),
+                     quality.totals.ssimMin, quality.totals.worstTilePsnrMin, quality.framesSkipped);
+        }
+    }
+    if (streaming)
+    {
+        // Finish() above sent what the reader could take and closed the stream.
+        const StreamingSink::Stats streamStats = streamSink.GetStats();
+        LOG_INFO("Streamed {} frames ({} bytes), dropped {}, reader disconnects {}, encode-to-pipe latency avg {} us, max {} us",
+                 streamStats.framesSent, streamStats.bytesSent, streamStats.framesDropped, streamStats.disconnects,
+                 streamStats.framesSent ? streamStats.latencyNsTotal / streamStats.framesSent / 1000 : 0,
+                 streamStats.latencyNsMax / 1000);
+    }
+    if (muxFile.IsOpen() && !muxFile.Close() && SUCCEEDED(hr))
+    {
+        hr = E_FAIL;
+    }
+    if (rawSinkOpen)
+    {
+        LOG_INFO("Flushing raw frames...");
+        if (!rawSink.Close() && SUCCEEDED(hr))
+        {
+            hr = E_FAIL;
+        }
+    }
+
+    keyframeIndex.Close();
+    m_cursorTrack.Close();
+
+    // Everything has been flushed, so the queue high-water marks are final.
+    sampleQueueDepths();
+    if (streaming)
+    {
+        const StreamingSink::Stats streamStats = streamSink.GetStats();
+        m_pHealth->Add(HealthCounter::StreamFramesDropped, streamStats.framesDropped);
+        m_pHealth->Add(HealthCounter::StreamDisconnects, streamStats.disconnects);
+    }
+    m_pHealth->Add(HealthCounter::LogRecordsDropped, Log::Logger::Instance().DroppedRecords());
+    metrics.Stop();
+
+    if (m_captureTrace.IsOpen())
+    {
+        const uint64_t traceFrames = m_captureTrace.FrameCount();
+        const uint64_t traceBytes = m_captureTrace.Bytes();
+        if (m_captureTrace.Close())
+        {
+            LOG_INFO("Capture trace: {} frames, {} MB in {}", traceFrames, traceBytes / (1024 * 1024),
+                     m_options.captureTracePath);
+        }
+        else
+        {
+            LOG_WARN("Could not finish capture trace {}", m_options.captureTracePath);
+        }
+    }
+
+    SafeRelease(&pCodecApi);
+    SafeRelease(&pSinkWriter);
+    SafeRelease(&pStream);
+
+    LOG_INFO("Pipeline latency:");
+    m_stats.PrintToLog();
+
+    // A cancelled recording never started, so there is nothing to report.
+    if (m_options.writeHealthReport && hr != E_ABORT)
+    {
+        const std::string reportPath = m_options.outputPath + ".health.json";
+        const double seconds = (double)m_health.Read()[HealthCounter::FramesWritten] / m_options.fps;
+        if (!WriteHealthReport(reportPath, seconds, SUCCEEDED(hr)))
+        {
+            LOG_WARN("Could not write health report to {}", reportPath);
+        }
+    }
+
+    if (!m_options.tracePath.empty())
+    {
+        if (DumpTrace(m_options.tracePath))
+        {
+            LOG_INFO("Trace written to {}", m_options.tracePath);
+        }
+        else
+        {
+            LOG_WARN("Could not write trace to {}", m_options.tracePath);
+        }
+    }
+
+    if (FAILED(hr) && hr != E_ABORT)
+    {
+        LOG_ERROR("An error occurred during recording. HRESULT: 0x{:x}", hr);
+    }
+    return hr;
+}
+
+
+//--------------------------------------------------------------------------------------
+// [Recorder::DumpTrace]
+// Snapshots the trace rings into a Chrome trace file (open it in chrome://tracing
+// or ui.perfetto.dev).
+//--------------------------------------------------------------------------------------
+bool Recorder::DumpTrace(const std::string& path) const
+{
+    std::string json;
+    Trace::Tracer::Instance().ExportChromeJson(json);
+
+    FileWriter::Options io;
+    io.writeBehind = false;
+    FileWriter file;
+    if (!file.Open(path, io))
+    {
+        return false;
+    }
+    const bool written = file.Write(json.data(), json.size());
+    return file.Close() && written;
+}
+
+
+//--------------------------------------------------------------------------------------
+// [Recorder::FormatMetrics]
+//--------------------------------------------------------------------------------------
+void Recorder::FormatMetrics(std::string& text) const
+{
+    Metrics::AppendHealth(m_health.Read(), text);
+    Metrics::AppendStageLatencies(m_stats, text);
+    Metrics::AppendQuality(m_quality.GetStats().totals, text);
+}
+
+
+//--------------------------------------------------------------------------------------
+// [Recorder::CountKeyframe]
+//--------------------------------------------------------------------------------------
+void Recorder::CountKeyframe(KeyframeReason reason)
+{
+    switch (reason)
+    {
+    case KeyframeReason::First:
+    case KeyframeReason::Gop: m_pHealth->Add(HealthCounter::KeyframesScheduled); break;
+    case KeyframeReason::SceneChange: m_pHealth->Add(HealthCounter::KeyframesSceneChange); break;
+    case KeyframeReason::Requested: m_pHealth->Add(HealthCounter::KeyframesRequested); break;
+    default: break;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// [Recorder::WriteHealthReport]
+// The final counters as JSON (see HealthCounters::FormatJson), for collection by
+// whatever runs the recorder.
+//--------------------------------------------------------------------------------------
+bool Recorder::WriteHealthReport(const std::string& path, double durationSeconds, bool succeeded) const
+{
+    std::string extra;
+    m_startup.FormatJson(extra);
+    if (m_options.qualitySampleInterval)
+    {
+        std::string quality;
+        QualityMonitor::FormatJson(m_quality.GetStats(), quality);
+        extra += ",\n" + quality;
+    }
+    std::string json;
+    HealthCounters::FormatJson(m_health.Read(), m_options.outputPath, durationSeconds, m_options.fps, succeeded, json,
+                               extra);
+
+    FileWriter::Options io;
+    io.writeBehind = false;
+    FileWriter file;
+    if (!file.Open(path, io))
+    {
+        return false;
+    }
+    const bool written = file.Write(json.data(), json.size());
+    return file.Close() && written;
+}
+
+
+//--------------------------------------------------------------------------------------
+// [Recorder::GrabFrameAndCreateSample]
+// Captures a single frame, copies it to a CPU buffer, and creates an IMFSample.
+// With pRawSink the frame is written to it straight from the mapped pixels instead,
+// stamped 'timestamp', and no sample is created. pChangedFraction receives the share
+// of the screen that changed since the previous frame, which drives scene-change
+// keyframes (0 if detection is disabled).
+// Returns S_FALSE when no frame arrived within timeoutMs, DXGI_ERROR_ACCESS_LOST when the
+// source has to be recreated and MF_E_END_OF_STREAM when a finite source is done.
+//--------------------------------------------------------------------------------------
+HRESULT Recorder::GrabFrameAndCreateSample(UINT timeoutMs, IMFSample** ppSample, double* pChangedFraction,
+                                           RawFrameSink* pRawSink, LONGLONG timestamp)
+{
+    HRESULT hr = S_OK;
+    IMFMediaBuffer* pBuffer = nullptr;
+    bool acquired = false;
+    bool writeFailed = false;
+    *ppSample = nullptr;
+    *pChangedFraction = 0.0;
+
+    do {
+        // 1. Wait for the source's next frame.
+        CaptureFrameInfo frameInfo;
+        StageTimer acquireTimer(m_stats, PipelineStage::Acquire);
+        const CaptureResult result = m_pSource->AcquireFrame(timeoutMs, frameInfo);
+        acquireTimer.Stop();
+        if (result == CaptureResult::Timeout) {
+            // This is not a fatal error, just no screen updates. We signal this with S_FALSE.
+            m_pHealth->Add(HealthCounter::AcquireTimeouts);
+            hr = S_FALSE;
+            break;
+        }
+        if (result == CaptureResult::Ended) {
+            hr = MF_E_END_OF_STREAM;
+            break;
+        }
+        if (result != CaptureResult::Ok) {
+            m_pHealth->Add(HealthCounter::AcquireErrors);
+            hr = (result == CaptureResult::AccessLost) ? DXGI_ERROR_ACCESS_LOST : E_FAIL;
+            break;
+        }
+        acquired = true;
+        m_cursor.Update(frameInfo);
+        m_cursorTrack.Update(frameInfo);
+
+        // A frame without an image update means only the pointer moved: we encode the
+        // same image again. More than one accumulated frame means the desktop changed
+        // several times since our last acquire and we only see the latest.
+        if (!frameInfo.imageUpdated) {
+            m_pHealth->Add(HealthCounter::FramesRepeated);
+        }
+        if (frameInfo.accumulatedFrames > 1) {
+            m_pHealth->Add(HealthCounter::FramesCoalesced, frameInfo.accumulatedFrames - 1);
+        }
+
+        // 2. Make the pixels readable by the CPU (a staging copy for the desktop).
+        StageTimer readbackTimer(m_stats, PipelineStage::Readback);
+        MappedFrame mapped;
+        if (!m_pSource->MapFrame(mapped)) {
+            hr = E_FAIL;
+            break;
+        }
+        readbackTimer.Stop();
+
+        // Keep a replayable record of exactly what the source delivered. A failing
+        // trace must not stop the recording.
+        if (m_captureTrace.IsOpen()) {
+            Trace::Scope traceScope("capture_trace");
+            if (!m_captureTrace.Append(frameInfo, &mapped)) {
+                LOG_WARN("Capture trace {} failed; no longer recording it.", m_options.captureTracePath);
+                m_captureTrace.Close();
+            }
+        }
+
+        // Measure how much of the screen changed by diffing against our copy of the
+        // previous frame. The first frame (or a mode change) just seeds the copy.
+        StageTimer convertTimer(m_stats, PipelineStage::Convert);
+        const UINT Bpp = 4; // Bytes per pixel
+        const UINT rowWidthInBytes = mapped.width * Bpp;
+        if (m_keyframes.SceneDetectionEnabled()) {
+            const size_t frameBytes = (size_t)rowWidthInBytes * mapped.height;
+            if (m_prevFrame.size() != frameBytes) {
+                m_prevFrame.assign(frameBytes, 0);
+            }
+            *pChangedFraction = PixelKernels::DiffTilesAndUpdate(mapped.pPixels, mapped.stride,
+                m_prevFrame.data(), rowWidthInBytes, mapped.width, mapped.height);
+        }
+
+        // 3a. The raw sink converts the mapped top-down pixels straight into its write
+        //     buffers. The pointer is blended into a copy of just its surroundings,
+        //     widened to whole 2x2 blocks for the chroma planes, which is converted
+        //     over the frame.
+        if (pRawSink) {
+            FrameRect patch = {};
+            if (m_options.drawCursor && m_cursor.Bounds(mapped.width, mapped.height, patch)) {
+                patch.left &= ~1;
+                patch.top &= ~1;
+                patch.right = (std::min)((patch.right + 1) & ~1, (int32_t)mapped.width);
+                patch.bottom = (std::min)((patch.bottom + 1) & ~1, (int32_t)mapped.height);
+                const size_t patchStride = (size_t)(patch.right - patch.left) * Bpp;
+                m_cursorPatch.resize(patchStride * (size_t)(patch.bottom - patch.top));
+                PixelKernels::CopyRows(m_cursorPatch.data(), (ptrdiff_t)patchStride,
+                                       mapped.pPixels + (size_t)patch.top * mapped.stride + (size_t)patch.left * Bpp,
+                                       (ptrdiff_t)mapped.stride, (uint32_t)(patch.right - patch.left),
+                                       (uint32_t)(patch.bottom - patch.top));
+                m_cursor.CompositeRegion(m_cursorPatch.data(), (ptrdiff_t)patchStride, patch);
+            }
+            convertTimer.Stop();
+            StageTimer writeTimer(m_stats, PipelineStage::Write);
+            const bool hasPatch = patch.right > patch.left;
+            if (!pRawSink->WriteFrame(mapped.pPixels, (ptrdiff_t)mapped.stride, timestamp,
+                                      hasPatch ? m_cursorPatch.data() : nullptr,
+                                      (ptrdiff_t)(patch.right - patch.left) * Bpp, patch)) {
+                m_pHealth->Add(HealthCounter::WriteErrors);
+                writeFailed = true;
+                hr = E_FAIL;
+                break;
+            }
+            m_pHealth->Add(HealthCounter::FramesCaptured);
+            break;
+        }
+
+        // 3b. Create a Media Foundation memory buffer and copy the pixel data into it,
+        //     flipping the image vertically and correcting for stride mismatch in the process.
+        hr = MFCreateMemoryBuffer(mapped.height * mapped.width * 4, &pBuffer);
+        if (SUCCEEDED(hr)) {
+            BYTE* pDst = nullptr;
+            pBuffer->Lock(&pDst, NULL, NULL);
+
+            PixelKernels::CopyRowsFlipped(pDst, rowWidthInBytes, mapped.pPixels, mapped.stride, mapped.width, mapped.height);
+
+            // The desktop comes without the pointer. The buffer is bottom-up, so the
+            // compositor gets its last row as the top and a negative stride.
+            if (m_options.drawCursor) {
+                m_cursor.Composite(pDst + (size_t)(mapped.height - 1) * rowWidthInBytes, -(ptrdiff_t)rowWidthInBytes,
+                                   mapped.width, mapped.height);
+            }
+
+            pBuffer->Unlock();
+            pBuffer->SetCurrentLength(mapped.height * mapped.width * 4);
+        }
+        convertTimer.Stop();
+        if (FAILED(hr)) break;
+
+        // 4. Create the final IMFSample and attach the buffer.
+        hr = MFCreateSample(ppSample);
+        if (FAILED(hr)) break;
+
+        hr = (*ppSample)->AddBuffer(pBuffer);
+        if (FAILED(hr)) break;
+
+        m_pHealth->Add(HealthCounter::FramesCaptured);
+
+    } while (false);
+
+    // --- Cleanup ---
+    // This is always called, whether we succeeded or failed.
+    if (acquired) {
+        // We must release the frame, even if we failed to process it.
+        m_pSource->ReleaseFrame();
+    }
+    SafeRelease(&pBuffer);
+
+    // If any step failed, ensure the output sample is null.
+    if (FAILED(hr)) {
+        if (acquired && !writeFailed) {
+            m_pHealth->Add(HealthCounter::ReadbackErrors);
+        }
+        SafeRelease(ppSample);
+    }
+    return hr;
 }
\ No newline at end of file
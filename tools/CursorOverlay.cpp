@@ -0,0 +1,250 @@
+//======================================================================================
+// CursorOverlay.cpp
+// Draws the pointer from a ".cursor" sidecar (CursorTrack.h, written by
+// --cursor-track) into decoded video, for players and tools that can't draw it
+// themselves. Reads and writes YUV4MPEG2 4:2:0, so any decoder and encoder can sit
+// on either side:
+//
+//     ffmpeg -i rec.mp4 -f yuv4mpegpipe - |
+//         ./cursor_overlay --cursor rec.mp4.cursor |
+//         ffmpeg -f yuv4mpegpipe -i - -c:v libx264 rec-with-pointer.mp4
+//
+// Frame N of the input is frame N of the recording. Only the 2x2-aligned blocks
+// around the pointer are converted to BGRA, blended with the recorder's own
+// CursorCompositor and converted back; everything else passes through untouched.
+//
+// Build (from the repository root):
+//     g++ -O2 -std=c++17 -I. tools/CursorOverlay.cpp -o cursor_overlay
+//======================================================================================
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../CursorCompositor.h"
+#include "../CursorTrack.h"
+#include "../PixelKernels.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace
+{
+    [[noreturn]] void Usage(const char* pProgram)
+    {
+        fprintf(stderr, "Usage: %s --cursor <recording.cursor> [--input <in.y4m>] [--output <out.y4m>]\n", pProgram);
+        exit(2);
+    }
+
+    uint8_t Clamp(int value)
+    {
+        return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+    }
+
+    // Inverse of PixelKernels::RgbToY/U/V (BT.709, video range).
+    void YuvToBgra(int y, int u, int v, uint8_t* pPixel)
+    {
+        const int c = 298 * (y - 16) + 128;
+        const int d = u - 128;
+        const int e = v - 128;
+        pPixel[0] = Clamp((c + 541 * d) >> 8);
+        pPixel[1] = Clamp((c - 55 * d - 136 * e) >> 8);
+        pPixel[2] = Clamp((c + 459 * e) >> 8);
+        pPixel[3] = 0xFF;
+    }
+
+    //----------------------------------------------------------------------------------
+    // [Overlay]
+    // Blends the pointer into one I420 picture.
+    //----------------------------------------------------------------------------------
+    void Overlay(const CursorCompositor& compositor, uint8_t* pPicture, uint32_t width, uint32_t height,
+                 std::vector<uint8_t>& bgra, std::vector<uint8_t>& original)
+    {
+        FrameRect region;
+        if (!compositor.Bounds(width, height, region))
+        {
+            return;
+        }
+        // Whole chroma blocks only.
+        region.left &= ~1;
+        region.top &= ~1;
+        region.right = static_cast<int32_t>(width) < ((region.right + 1) & ~1) ? static_cast<int32_t>(width) : ((region.right + 1) & ~1);
+        region.bottom = static_cast<int32_t>(height) < ((region.bottom + 1) & ~1) ? static_cast<int32_t>(height) : ((region.bottom + 1) & ~1);
+
+        const uint32_t chromaWidth = (width + 1) / 2;
+        const uint32_t chromaHeight = (height + 1) / 2;
+        uint8_t* pY = pPicture;
+        uint8_t* pU = pY + static_cast<size_t>(width) * height;
+        uint8_t* pV = pU + static_cast<size_t>(chromaWidth) * chromaHeight;
+
+        const uint32_t regionWidth = static_cast<uint32_t>(region.right - region.left);
+        const uint32_t regionHeight = static_cast<uint32_t>(region.bottom - region.top);
+        const size_t stride = static_cast<size_t>(regionWidth) * 4;
+        bgra.resize(stride * regionHeight);
+        for (uint32_t y = 0; y < regionHeight; ++y)
+        {
+            const uint32_t frameY = region.top + y;
+            for (uint32_t x = 0; x < regionWidth; ++x)
+            {
+                const uint32_t frameX = region.left + x;
+                const size_t chroma = static_cast<size_t>(frameY / 2) * chromaWidth + frameX / 2;
+                YuvToBgra(pY[static_cast<size_t>(frameY) * width + frameX], pU[chroma], pV[chroma], &bgra[y * stride + x * 4]);
+            }
+        }
+        original = bgra;
+        compositor.CompositeRegion(bgra.data(), static_cast<ptrdiff_t>(stride), region);
+
+        // Convert back only the 2x2 blocks the pointer changed, so the rest of the
+        // region doesn't pick up conversion rounding.
+        for (uint32_t y = 0; y < regionHeight; y += 2)
+        {
+            const uint32_t y1 = y + 1 < regionHeight ? y + 1 : y;
+            for (uint32_t x = 0; x < regionWidth; x += 2)
+            {
+                const uint32_t x1 = x + 1 < regionWidth ? x + 1 : x;
+                const size_t offsets[4] = { y * stride + x * 4, y * stride + x1 * 4, y1 * stride + x * 4, y1 * stride + x1 * 4 };
+                bool changed = false;
+                for (size_t offset : offsets)
+                {
+                    changed = changed || memcmp(&bgra[offset], &original[offset], 4) != 0;
+                }
+                if (!changed)
+                {
+                    continue;
+                }
+                const uint32_t frameX = region.left + x;
+                const uint32_t frameY = region.top + y;
+                uint8_t* pRow0 = pY + static_cast<size_t>(frameY) * width;
+                uint8_t* pRow1 = pY + static_cast<size_t>(region.top + y1) * width;
+                uint8_t* pChromaU = pU + static_cast<size_t>(frameY / 2) * chromaWidth + frameX / 2;
+                uint8_t* pChromaV = pV + static_cast<size_t>(frameY / 2) * chromaWidth + frameX / 2;
+                PixelKernels::BgraRowPairToYuv420(&bgra[y * stride + x * 4], &bgra[y1 * stride + x * 4], pRow0 + frameX,
+                                                  pRow1 + frameX, pChromaU, pChromaV, 1, x1 - x + 1);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string cursorPath;
+    std::string inputPath;
+    std::string outputPath;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--cursor" && hasValue) cursorPath = argv[++i];
+        else if (arg == "--input" && hasValue) inputPath = argv[++i];
+        else if (arg == "--output" && hasValue) outputPath = argv[++i];
+        else Usage(argv[0]);
+    }
+    if (cursorPath.empty())
+    {
+        Usage(argv[0]);
+    }
+
+    CursorTrackReader track;
+    std::string error;
+    if (!track.Open(cursorPath, error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    FILE* pInput = inputPath.empty() || inputPath == "-" ? stdin : fopen(inputPath.c_str(), "rb");
+    FILE* pOutput = outputPath.empty() || outputPath == "-" ? stdout : fopen(outputPath.c_str(), "wb");
+    if (!pInput || !pOutput)
+    {
+        fprintf(stderr, "Could not open %s\n", !pInput ? inputPath.c_str() : outputPath.c_str());
+        return 1;
+    }
+
+    // The header passes through unchanged; only 4:2:0 is supported.
+    char header[256];
+    if (!fgets(header, sizeof(header), pInput) || strncmp(header, "YUV4MPEG2 ", 10) != 0)
+    {
+        fprintf(stderr, "The input is not a YUV4MPEG2 stream\n");
+        return 1;
+    }
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::string colorspace = "420";
+    {
+        std::string fields(header + 10);
+        size_t start = 0;
+        while (start < fields.size())
+        {
+            size_t end = fields.find_first_of(" \n", start);
+            end = end == std::string::npos ? fields.size() : end;
+            const std::string field = fields.substr(start, end - start);
+            if (!field.empty() && field[0] == 'W') width = static_cast<uint32_t>(atoi(field.c_str() + 1));
+            else if (!field.empty() && field[0] == 'H') height = static_cast<uint32_t>(atoi(field.c_str() + 1));
+            else if (!field.empty() && field[0] == 'C') colorspace = field.substr(1);
+            start = end + 1;
+        }
+    }
+    if (width == 0 || height == 0 || colorspace.compare(0, 3, "420") != 0)
+    {
+        fprintf(stderr, "Unsupported YUV4MPEG2 stream (need 4:2:0 with a picture size)\n");
+        return 1;
+    }
+    fputs(header, pOutput);
+
+    const std::vector<CursorTrack::Shape>& shapes = track.Shapes();
+    const std::vector<CursorTrack::Position>& positions = track.Positions();
+    CursorCompositor compositor;
+    uint32_t currentShape = CursorTrack::NoShape;
+    size_t next = 0;
+    std::vector<uint8_t> picture(PixelKernels::NV12Bytes(width, height));
+    std::vector<uint8_t> bgra;
+    std::vector<uint8_t> original;
+    char frameHeader[256];
+    uint64_t frame = 0;
+    for (; fgets(frameHeader, sizeof(frameHeader), pInput); ++frame)
+    {
+        if (strncmp(frameHeader, "FRAME", 5) != 0 || fread(picture.data(), 1, picture.size(), pInput) != picture.size())
+        {
+            fprintf(stderr, "Truncated frame %llu\n", static_cast<unsigned long long>(frame));
+            break;
+        }
+
+        // Catch up with every pointer change up to this frame.
+        for (; next < positions.size() && positions[next].frameIndex <= frame; ++next)
+        {
+            const CursorTrack::Position& position = positions[next];
+            CaptureFrameInfo info;
+            PointerShape shape;
+            if (position.shapeId != currentShape && position.shapeId < shapes.size())
+            {
+                shape = shapes[position.shapeId].View();
+                info.pPointerShape = &shape;
+                currentShape = position.shapeId;
+            }
+            info.pointerUpdated = true;
+            info.pointerVisible = position.visible && position.shapeId < shapes.size();
+            info.pointerX = position.x;
+            info.pointerY = position.y;
+            compositor.Update(info);
+        }
+
+        Overlay(compositor, picture.data(), width, height, bgra, original);
+        if (fputs(frameHeader, pOutput) < 0 || fwrite(picture.data(), 1, picture.size(), pOutput) != picture.size())
+        {
+            fprintf(stderr, "Writing frame %llu failed\n", static_cast<unsigned long long>(frame));
+            return 1;
+        }
+    }
+    fflush(pOutput);
+    fprintf(stderr, "cursor_overlay: %llu frames, %zu pointer changes, %zu shapes\n",
+            static_cast<unsigned long long>(frame), positions.size(), shapes.size());
+    return 0;
+}